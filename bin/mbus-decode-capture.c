@@ -0,0 +1,574 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2012, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mbus/mbus.h>
+
+#define OUTPUT_XML  0
+#define OUTPUT_JSON 1
+#define OUTPUT_BIN  2
+
+#define INPUT_HEX 0
+#define INPUT_RAW 1
+#define INPUT_CAP 2
+
+// input bytes decoded by a worker at once, and chunks in flight per worker
+#define CHUNK_SIZE   (256*1024)
+#define CHUNK_WINDOW 4
+
+typedef struct _capture_chunk {
+    const unsigned char *start;
+    const unsigned char *end;
+    mbus_writer out;
+    size_t telegrams;
+    size_t errors;
+    int done;
+} capture_chunk;
+
+typedef struct _capture {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    const unsigned char *data;   // whole input
+    const unsigned char *pos;    // first byte not assigned to a chunk
+    const unsigned char *end;
+
+    capture_chunk *ring;
+    size_t ring_size;
+    size_t assigned;             // chunks handed to the workers
+    size_t written;              // chunks written to the output
+
+    int input;
+    int output;
+    int normalized;
+} capture;
+
+//------------------------------------------------------------------------------
+// Size of the frame (or garbage byte) at the start of a raw capture
+//------------------------------------------------------------------------------
+static size_t
+capture_frame_size(const unsigned char *data, size_t avail)
+{
+    size_t size = 1;
+
+    if (data[0] == MBUS_FRAME_SHORT_START)
+    {
+        size = MBUS_FRAME_BASE_SIZE_SHORT;
+    }
+    else if (data[0] == MBUS_FRAME_LONG_START && avail >= 3 && data[1] == data[2])
+    {
+        size = MBUS_FRAME_FIXED_SIZE_LONG + data[1];
+    }
+
+    return (size > avail) ? avail : size;
+}
+
+//------------------------------------------------------------------------------
+// Decode a single telegram into the output of the chunk
+//------------------------------------------------------------------------------
+static void
+capture_decode_frame(capture *cap, capture_chunk *chunk, unsigned char *buff, size_t buff_len)
+{
+    mbus_frame frame;
+    mbus_frame_data frame_data;
+    int result;
+
+    memset((void *)&frame, 0, sizeof(frame));
+
+    if (mbus_parse(&frame, buff, buff_len) != 0)
+    {
+        chunk->errors++;
+        return;
+    }
+
+    // requests and acknowledgements carry no data
+    if (frame.type != MBUS_FRAME_TYPE_LONG)
+        return;
+
+    memset((void *)&frame_data, 0, sizeof(frame_data));
+
+    if (mbus_frame_data_parse(&frame, &frame_data) != 0)
+    {
+        mbus_data_record_free(frame_data.data_var.record);
+        chunk->errors++;
+        return;
+    }
+
+    if (cap->output == OUTPUT_BIN)
+        result = (mbus_frame_data_write_bin(&(chunk->out), &frame_data) < 0) ? -1 : 0;
+    else if (cap->normalized)
+        result = mbus_frame_data_write_normalized(&(chunk->out), &frame_data);
+    else
+        result = mbus_frame_data_write(&(chunk->out), &frame_data);
+
+    mbus_data_record_free(frame_data.data_var.record);
+
+    if (result == 0)
+        chunk->telegrams++;
+    else
+        chunk->errors++;
+}
+
+//------------------------------------------------------------------------------
+// Decode all telegrams of a chunk: one telegram per line for hex captures,
+// consecutive frames for raw captures and the received frames of a capture
+// log (see mbus-capture.h).
+//------------------------------------------------------------------------------
+static void
+capture_decode(capture *cap, capture_chunk *chunk)
+{
+    unsigned char buff[1024];
+    const unsigned char *line, *eol, *p;
+    mbus_capture_record record;
+    size_t len, pos;
+    int result;
+
+    chunk->out.len = 0;
+    chunk->telegrams = 0;
+    chunk->errors = 0;
+
+    if (cap->input == INPUT_CAP)
+    {
+        pos = 0;
+
+        while ((result = mbus_capture_next(chunk->start, (size_t) (chunk->end - chunk->start),
+                                           &pos, &record, &p)) == 1)
+        {
+            // requests and single character acknowledgements are left out
+            if (record.direction == MBUS_CAPTURE_RECV && record.len > 1)
+                capture_decode_frame(cap, chunk, (unsigned char *) p, record.len);
+        }
+
+        if (result < 0)
+            chunk->errors++;
+
+        return;
+    }
+
+    if (cap->input == INPUT_RAW)
+    {
+        for (p = chunk->start; p < chunk->end; p += len)
+        {
+            len = capture_frame_size(p, (size_t) (chunk->end - p));
+
+            if (p[0] == MBUS_FRAME_ACK_START)
+                continue;
+
+            // skip garbage between the frames
+            if (len > 1)
+                capture_decode_frame(cap, chunk, (unsigned char *) p, len);
+        }
+
+        return;
+    }
+
+    for (line = chunk->start; line < chunk->end; line = eol + 1)
+    {
+        if ((eol = memchr(line, '\n', (size_t) (chunk->end - line))) == NULL)
+            eol = chunk->end;
+
+        while (line < eol && (*line == ' ' || *line == '\t' || *line == '\r'))
+            line++;
+
+        if (line == eol || *line == '#')
+            continue;
+
+        len = mbus_hex2bin(buff, sizeof(buff), line, (size_t) (eol - line));
+        capture_decode_frame(cap, chunk, buff, len);
+    }
+}
+
+//------------------------------------------------------------------------------
+// End of the next chunk, at a line or frame boundary
+//------------------------------------------------------------------------------
+static const unsigned char *
+capture_chunk_end(capture *cap)
+{
+    const unsigned char *p, *limit;
+    mbus_capture_record record;
+    size_t pos;
+
+    if ((size_t) (cap->end - cap->pos) <= CHUNK_SIZE)
+        return cap->end;
+
+    limit = cap->pos + CHUNK_SIZE;
+
+    if (cap->input == INPUT_CAP)
+    {
+        // a malformed record ends the input, the chunk reports it
+        for (pos = 0; cap->pos + pos < limit; )
+        {
+            if (mbus_capture_next(cap->pos, (size_t) (cap->end - cap->pos), &pos, &record, NULL) != 1)
+                return cap->end;
+        }
+
+        return cap->pos + pos;
+    }
+
+    if (cap->input == INPUT_RAW)
+    {
+        for (p = cap->pos; p < limit; p += capture_frame_size(p, (size_t) (cap->end - p)))
+            ;
+
+        return p;
+    }
+
+    if ((p = memchr(limit, '\n', (size_t) (cap->end - limit))) == NULL)
+        return cap->end;
+
+    return p + 1;
+}
+
+static void *
+capture_worker(void *arg)
+{
+    capture *cap = (capture *) arg;
+    capture_chunk *chunk;
+
+    pthread_mutex_lock(&(cap->lock));
+
+    for (;;)
+    {
+        // keep the number of buffered chunks bounded
+        while (cap->pos < cap->end && cap->assigned - cap->written >= cap->ring_size)
+            pthread_cond_wait(&(cap->cond), &(cap->lock));
+
+        if (cap->pos >= cap->end)
+            break;
+
+        chunk = &(cap->ring[cap->assigned % cap->ring_size]);
+        chunk->start = cap->pos;
+        chunk->end = capture_chunk_end(cap);
+        chunk->done = 0;
+        cap->pos = chunk->end;
+        cap->assigned++;
+
+        pthread_mutex_unlock(&(cap->lock));
+        capture_decode(cap, chunk);
+        pthread_mutex_lock(&(cap->lock));
+
+        chunk->done = 1;
+        pthread_cond_broadcast(&(cap->cond));
+    }
+
+    pthread_mutex_unlock(&(cap->lock));
+    return NULL;
+}
+
+static double
+capture_clock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+//------------------------------------------------------------------------------
+// Map (or read) an input file
+//------------------------------------------------------------------------------
+static unsigned char *
+capture_load(const char *file, size_t *size, int *mapped)
+{
+    struct stat st;
+    unsigned char *data = NULL, *new_data;
+    size_t len = 0, data_size = 0;
+    ssize_t n;
+    int fd;
+
+    *mapped = 0;
+    *size = 0;
+
+    if (strcmp(file, "-") == 0)
+        fd = STDIN_FILENO;
+    else if ((fd = open(file, O_RDONLY)) == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        data = (unsigned char *) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+            if (fd != STDIN_FILENO)
+                close(fd);
+
+            *mapped = 1;
+            *size = (size_t) st.st_size;
+            return data;
+        }
+
+        data = NULL;
+    }
+
+    // pipes and empty files
+    for (;;)
+    {
+        if (len == data_size)
+        {
+            data_size = data_size ? data_size * 2 : CHUNK_SIZE;
+
+            if ((new_data = (unsigned char *) realloc(data, data_size)) == NULL)
+                break;
+
+            data = new_data;
+        }
+
+        if ((n = read(fd, data + len, data_size - len)) <= 0)
+        {
+            if (n == -1 && errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        len += (size_t) n;
+    }
+
+    if (fd != STDIN_FILENO)
+        close(fd);
+
+    *size = len;
+    return data;
+}
+
+//------------------------------------------------------------------------------
+// Decode a capture file with the given number of worker threads
+//------------------------------------------------------------------------------
+static int
+capture_file(capture *cap, const char *file, int threads)
+{
+    pthread_t *workers;
+    capture_chunk *chunk;
+    unsigned char *data;
+    size_t size, len, i, telegrams = 0, errors = 0;
+    int mapped, result = 0;
+    double start, elapsed;
+
+    start = capture_clock();
+
+    if ((data = capture_load(file, &size, &mapped)) == NULL)
+    {
+        fprintf(stderr, "%s: failed to read '%s': %s\n", __PRETTY_FUNCTION__, file, strerror(errno));
+        return -1;
+    }
+
+    cap->data = data;
+    cap->pos = data;
+    cap->end = data + size;
+
+    if (cap->input == INPUT_CAP)
+    {
+        if (mbus_capture_check(data, size, &len) != 0)
+        {
+            fprintf(stderr, "%s: '%s' is not a capture log\n", __PRETTY_FUNCTION__, file);
+
+            if (mapped)
+                munmap(data, size);
+            else
+                free(data);
+
+            return -1;
+        }
+
+        cap->pos = data + MBUS_CAPTURE_HEADER_SIZE;
+        cap->end = data + len;
+    }
+    cap->assigned = 0;
+    cap->written = 0;
+
+    workers = (pthread_t *) calloc((size_t) threads, sizeof(pthread_t));
+
+    for (i = 0; workers && i < (size_t) threads; i++)
+    {
+        if (pthread_create(&workers[i], NULL, capture_worker, cap) != 0)
+            break;
+    }
+
+    if (i == 0)
+    {
+        fprintf(stderr, "%s: failed to start the workers\n", __PRETTY_FUNCTION__);
+        result = -1;
+    }
+
+    //
+    // write the chunks in input order
+    //
+    pthread_mutex_lock(&(cap->lock));
+
+    while (result == 0 && (cap->pos < cap->end || cap->written < cap->assigned))
+    {
+        chunk = &(cap->ring[cap->written % cap->ring_size]);
+
+        if (cap->written >= cap->assigned || chunk->done == 0)
+        {
+            pthread_cond_wait(&(cap->cond), &(cap->lock));
+            continue;
+        }
+
+        pthread_mutex_unlock(&(cap->lock));
+
+        if (chunk->out.error || fwrite(chunk->out.buff, 1, chunk->out.len, stdout) != chunk->out.len)
+        {
+            fprintf(stderr, "%s: failed to write the output\n", __PRETTY_FUNCTION__);
+            result = -1;
+        }
+
+        telegrams += chunk->telegrams;
+        errors += chunk->errors;
+
+        pthread_mutex_lock(&(cap->lock));
+        chunk->done = 0;
+        cap->written++;
+        pthread_cond_broadcast(&(cap->cond));
+    }
+
+    // let the workers run out of input
+    cap->pos = cap->end;
+    pthread_cond_broadcast(&(cap->cond));
+    pthread_mutex_unlock(&(cap->lock));
+
+    while (i > 0)
+        pthread_join(workers[--i], NULL);
+
+    free(workers);
+
+    if (mapped)
+        munmap(data, size);
+    else
+        free(data);
+
+    elapsed = capture_clock() - start;
+
+    fprintf(stderr, "%s: %zu telegrams, %zu errors, %zu bytes in %.3f s (%.0f telegrams/s, %.2f MB/s)\n",
+            file, telegrams, errors, size, elapsed,
+            elapsed > 0 ? telegrams / elapsed : 0.0,
+            elapsed > 0 ? size / elapsed / 1e6 : 0.0);
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+// Execution starts here:
+//------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+    capture cap;
+    unsigned char header[MBUS_BIN_HEADER_SIZE];
+    int c, i, threads, format, result = 0;
+
+    memset((void *)&cap, 0, sizeof(cap));
+
+    threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((c = getopt(argc, argv, "ni:o:t:")) != -1)
+    {
+        switch (c)
+        {
+            case 'n':
+                cap.normalized = 1;
+                break;
+            case 'i':
+                if (strcmp(optarg, "raw") == 0)
+                    cap.input = INPUT_RAW;
+                else if (strcmp(optarg, "cap") == 0)
+                    cap.input = INPUT_CAP;
+                else if (strcmp(optarg, "hex") != 0)
+                    threads = -1;
+                break;
+            case 'o':
+                if (strcmp(optarg, "json") == 0)
+                    cap.output = OUTPUT_JSON;
+                else if (strcmp(optarg, "bin") == 0)
+                    cap.output = OUTPUT_BIN;
+                else if (strcmp(optarg, "xml") != 0)
+                    threads = -1;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            default:
+                threads = -1;
+                break;
+        }
+    }
+
+    if (optind >= argc || threads < 0)
+    {
+        fprintf(stderr, "usage: %s [-n] [-i hex|raw|cap] [-o xml|json|bin] [-t THREADS] file...\n", argv[0]);
+        fprintf(stderr, "    optional flag -n for normalized values\n");
+        fprintf(stderr, "    optional flag -i for the capture format: one hex telegram per line (default), raw frames\n");
+        fprintf(stderr, "                     or a capture log written by mbus_capture_open\n");
+        fprintf(stderr, "    optional flag -o for the output format\n");
+        fprintf(stderr, "    optional flag -t for the number of worker threads (default: number of CPUs)\n");
+        fprintf(stderr, "    file - reads from stdin\n");
+        return 1;
+    }
+
+    if (threads == 0)
+        threads = 1;
+
+    format = (cap.output == OUTPUT_JSON) ? MBUS_WRITER_FORMAT_JSON : MBUS_WRITER_FORMAT_XML;
+
+    cap.ring_size = (size_t) threads * CHUNK_WINDOW;
+
+    if ((cap.ring = (capture_chunk *) calloc(cap.ring_size, sizeof(capture_chunk))) == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < (int) cap.ring_size; i++)
+    {
+        if (mbus_writer_init_buffer(&(cap.ring[i].out), format, CHUNK_SIZE) != 0)
+        {
+            fprintf(stderr, "Failed to allocate memory\n");
+            return 1;
+        }
+    }
+
+    pthread_mutex_init(&(cap.lock), NULL);
+    pthread_cond_init(&(cap.cond), NULL);
+
+    if (cap.output == OUTPUT_BIN)
+    {
+        mbus_bin_header_encode(header);
+        fwrite(header, 1, sizeof(header), stdout);
+    }
+
+    for (i = optind; i < argc; i++)
+    {
+        if (capture_file(&cap, argv[i], threads) != 0)
+            result = 1;
+    }
+
+    fflush(stdout);
+
+    for (i = 0; i < (int) cap.ring_size; i++)
+        mbus_writer_free(&(cap.ring[i].out));
+
+    free(cap.ring);
+    pthread_cond_destroy(&(cap.cond));
+    pthread_mutex_destroy(&(cap.lock));
+
+    return result;
+}
@@ -61,9 +61,34 @@ true \
     && rm -f test/*~ \
     && rm -f test/mbus_parse \
     && rm -f test/mbus_parse_hex \
+    && rm -f test/mbus_test_sim \
+    && rm -f test/mbus_test_cpp \
+    && rm -f test/mbus_test_layout \
+    && rm -f test/mbus_test_decode \
+    && rm -f test/mbus_test_pool \
+    && rm -f test/mbus_test_slaves \
+    && rm -f test/mbus_test_tcp \
+    && rm -f test/mbus_test_value \
+    && rm -f test/mbus_test_hex \
+    && rm -f test/mbus_test_writer \
+    && rm -f test/mbus_test_parser \
+    && rm -f test/mbus_test_view \
+    && rm -f test/mbus_test_ring \
+    && rm -f test/mbus_test_cache \
+    && rm -f test/mbus_test_stats \
+    && rm -f test/mbus_test_filter \
+    && rm -f test/mbus_test_timeout \
+    && rm -f test/mbus_test_capture \
+    && rm -f test/mbus_test_bin \
+    && rm -f test/mbus_test_baudrate \
+    && rm -f test/mbus_test_presence \
+    && rm -f test/mbus_test_poll \
+    && rm -f test/mbus_test_readout \
+    && rm -f test/*.log \
+    && rm -f test/*.trs \
     && rm -f test/mbus_unit_test1 \
     && rm -f -r debian/libmbus-dev \
-    && rm -f -r debian/libmbus1 \
+    && rm -f -r debian/libmbus2 \
     && rm -f -r debian/tmp \
     && rm -f -r debian/*.log \
     && rm -f -r debian/*.substvars \
@@ -0,0 +1,328 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2011, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mbus-capture.h"
+
+#define MBUS_CAPTURE_MIN_SIZE 4096
+#define MBUS_CAPTURE_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+
+//------------------------------------------------------------------------------
+/// Clock in nanoseconds. clock_gettime is served by the vDSO on Linux, so it
+/// does not enter the kernel.
+//------------------------------------------------------------------------------
+static int64_t
+mbus_capture_clock(clockid_t clock)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) != 0)
+        return 0;
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+/// Create, preallocate and map a new capture file
+//------------------------------------------------------------------------------
+static int
+mbus_capture_start(mbus_capture *capture, uint64_t sequence)
+{
+    mbus_capture_header *header;
+    void *map;
+    int fd, ret;
+
+    if ((fd = open(capture->path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
+    {
+        mbus_error_str_set("mbus_capture: failed to open the capture file");
+        return -1;
+    }
+
+    // the blocks are allocated now, not by page faults while writing;
+    // file systems without fallocate get a sparse file
+    if (ftruncate(fd, (off_t) capture->size) != 0 ||
+        ((ret = posix_fallocate(fd, 0, (off_t) capture->size)) != 0 &&
+         ret != EINVAL && ret != EOPNOTSUPP))
+    {
+        mbus_error_str_set("mbus_capture: failed to size the capture file");
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, capture->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        mbus_error_str_set("mbus_capture: failed to map the capture file");
+        close(fd);
+        return -1;
+    }
+
+    header = (mbus_capture_header *) map;
+    header->version = MBUS_CAPTURE_VERSION;
+    header->header_size = MBUS_CAPTURE_HEADER_SIZE;
+    header->used = MBUS_CAPTURE_HEADER_SIZE;
+    header->size = capture->size;
+    header->realtime_ns = mbus_capture_clock(CLOCK_REALTIME);
+    header->monotonic_ns = mbus_capture_clock(CLOCK_MONOTONIC);
+    header->sequence = sequence;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, MBUS_CAPTURE_MAGIC, sizeof(header->magic));
+
+    capture->fd = fd;
+    capture->map = (unsigned char *) map;
+    capture->header = header;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Unmap the current file and cut it to the records written
+//------------------------------------------------------------------------------
+static void
+mbus_capture_finish(mbus_capture *capture)
+{
+    off_t used;
+
+    if (capture->map == NULL)
+        return;
+
+    used = (off_t) capture->header->used;
+
+    munmap((void *) capture->map, capture->size);
+
+    // on failure the file keeps its size, readers stop at the used mark
+    if (ftruncate(capture->fd, used) != 0)
+        mbus_error_str_set("mbus_capture: failed to truncate the capture file");
+
+    close(capture->fd);
+
+    capture->fd = -1;
+    capture->map = NULL;
+    capture->header = NULL;
+}
+
+//------------------------------------------------------------------------------
+/// Move the full file out of the way (path -> path.1 -> path.2 ...) and start
+/// the next one. After a failed rename the file is left alone (it is not
+/// mapped any more) and the rotation is tried again with the next record.
+/// The kept files are only shifted once per rotation, a retry would move
+/// them on again and drop the oldest.
+//------------------------------------------------------------------------------
+static int
+mbus_capture_rotate(mbus_capture *capture)
+{
+    char from[PATH_MAX], to[PATH_MAX];
+    int i;
+
+    mbus_capture_finish(capture);
+
+    if (capture->keep > 0)
+    {
+        if (!capture->pending_rotation)
+        {
+            for (i = capture->keep - 1; i > 0; i--)
+            {
+                snprintf(from, sizeof(from), "%s.%d", capture->path, i);
+                snprintf(to, sizeof(to), "%s.%d", capture->path, i + 1);
+                rename(from, to);
+            }
+
+            capture->pending_rotation = 1;
+        }
+
+        snprintf(to, sizeof(to), "%s.1", capture->path);
+
+        // a file removed from under the log is not kept
+        if (rename(capture->path, to) != 0 && errno != ENOENT)
+        {
+            mbus_error_str_set("mbus_capture: failed to rotate the capture file");
+            return -1;
+        }
+
+        capture->pending_rotation = 0;
+    }
+
+    capture->rotations++;
+
+    return mbus_capture_start(capture, capture->rotations);
+}
+
+mbus_capture *
+mbus_capture_open(const char *path, size_t size, int keep)
+{
+    mbus_capture *capture;
+
+    if (path == NULL || size < MBUS_CAPTURE_MIN_SIZE || keep < 0 ||
+        strlen(path) + 12 >= PATH_MAX)
+    {
+        mbus_error_str_set("mbus_capture_open: invalid path or size");
+        return NULL;
+    }
+
+    if ((capture = (mbus_capture *) calloc(1, sizeof(mbus_capture))) == NULL ||
+        (capture->path = strdup(path)) == NULL)
+    {
+        mbus_error_str_set("mbus_capture_open: failed to allocate capture");
+        free(capture);
+        return NULL;
+    }
+
+    capture->size = size & ~((size_t) 7);
+    capture->keep = keep;
+    capture->fd = -1;
+
+    if (mbus_capture_start(capture, 0) != 0)
+    {
+        free(capture->path);
+        free(capture);
+        return NULL;
+    }
+
+    return capture;
+}
+
+void
+mbus_capture_close(mbus_capture *capture)
+{
+    if (capture)
+    {
+        mbus_capture_finish(capture);
+        free(capture->path);
+        free(capture);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Append a record. The record is complete in the mapping before the used
+/// mark is moved past it, so a reader of the live file never sees half a
+/// record.
+//------------------------------------------------------------------------------
+int
+mbus_capture_write(mbus_capture *capture, int direction, unsigned int handle_id,
+                   const unsigned char *data, size_t len)
+{
+    mbus_capture_record *record;
+    uint64_t used;
+    size_t size;
+
+    if (capture == NULL || (data == NULL && len > 0))
+    {
+        mbus_error_str_set("mbus_capture_write: invalid capture or data");
+        return -1;
+    }
+
+    size = MBUS_CAPTURE_ALIGN(MBUS_CAPTURE_RECORD_HEADER_SIZE + len);
+
+    if (len > 0xFFFF || size > capture->size - MBUS_CAPTURE_HEADER_SIZE)
+    {
+        capture->dropped++;
+        mbus_error_str_set("mbus_capture_write: record too large");
+        return -1;
+    }
+
+    if (capture->map == NULL ||
+        capture->header->used + size > capture->size)
+    {
+        if (mbus_capture_rotate(capture) != 0)
+        {
+            capture->dropped++;
+            return -1;
+        }
+    }
+
+    used = capture->header->used;
+    record = (mbus_capture_record *) (capture->map + used);
+
+    record->size = (uint32_t) size;
+    record->len = (uint16_t) len;
+    record->direction = (uint8_t) direction;
+    record->reserved = 0;
+    record->handle_id = (uint32_t) handle_id;
+    record->reserved2 = 0;
+    record->timestamp_ns = mbus_capture_clock(CLOCK_MONOTONIC);
+
+    if (len > 0)
+        memcpy(capture->map + used + MBUS_CAPTURE_RECORD_HEADER_SIZE, data, len);
+
+    // the padding of a reused file may hold an older record
+    memset(capture->map + used + MBUS_CAPTURE_RECORD_HEADER_SIZE + len, 0,
+           size - MBUS_CAPTURE_RECORD_HEADER_SIZE - len);
+
+    __atomic_store_n(&(capture->header->used), used + size, __ATOMIC_RELEASE);
+
+    capture->records++;
+
+    return 0;
+}
+
+int
+mbus_capture_check(const unsigned char *buff, size_t size, size_t *end)
+{
+    mbus_capture_header header;
+
+    if (buff == NULL || size < MBUS_CAPTURE_HEADER_SIZE)
+        return -1;
+
+    memcpy(&header, buff, sizeof(header));
+
+    if (memcmp(header.magic, MBUS_CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != MBUS_CAPTURE_VERSION ||
+        header.header_size != MBUS_CAPTURE_HEADER_SIZE ||
+        header.used < MBUS_CAPTURE_HEADER_SIZE)
+        return -1;
+
+    // a file cut short (while copying, or a crash before the header hit the
+    // disk) is read as far as it goes
+    if (end)
+        *end = (header.used < size) ? (size_t) header.used : size;
+
+    return 0;
+}
+
+int
+mbus_capture_next(const unsigned char *buff, size_t end, size_t *pos,
+                  mbus_capture_record *record, const unsigned char **data)
+{
+    if (buff == NULL || pos == NULL || record == NULL)
+        return -1;
+
+    if (*pos >= end)
+        return 0;
+
+    if (end - *pos < MBUS_CAPTURE_RECORD_HEADER_SIZE)
+        return -1;
+
+    memcpy(record, buff + *pos, sizeof(*record));
+
+    if (record->size != MBUS_CAPTURE_ALIGN(MBUS_CAPTURE_RECORD_HEADER_SIZE + record->len) ||
+        record->size > end - *pos)
+        return -1;
+
+    if (data)
+        *data = buff + *pos + MBUS_CAPTURE_RECORD_HEADER_SIZE;
+
+    *pos += record->size;
+
+    return 1;
+}
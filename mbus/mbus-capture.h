@@ -0,0 +1,186 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2011, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+/**
+ * @file   mbus-capture.h
+ *
+ * @brief  Memory-mapped capture log of the raw bus traffic.
+ *
+ * Frames sent and received by the handles a capture log is attached to are
+ * appended to a preallocated, memory-mapped file with a monotonic timestamp.
+ * Appending is a copy into the mapping, system calls are only made when the
+ * file is full and rotated:
+ * \verbatim
+ * capture = mbus_capture_open("bus.cap", 64 << 20, 4);
+ * mbus_handle_set_capture(handle, capture, 1);
+ * ...
+ * mbus_capture_close(capture);
+ * \endverbatim
+ * A full file is renamed to bus.cap.1 (bus.cap.1 to bus.cap.2 and so on, up
+ * to the number of files kept) and a new one started. Capture files are
+ * decoded with mbus-decode-capture -i cap and replayed with
+ * mbus_sim_add_capture_file.
+ *
+ * Layout of the file (native byte order):
+ * \verbatim
+ * header:   0  char[8]  magic "MBUSCAP" (NUL terminated)
+ *           8  uint16   version (MBUS_CAPTURE_VERSION)
+ *          10  uint16   header size (MBUS_CAPTURE_HEADER_SIZE)
+ *          12  uint32   reserved, 0
+ *          16  uint64   used: end of the last complete record
+ *          24  uint64   file size
+ *          32  int64    CLOCK_REALTIME at creation (ns)
+ *          40  int64    CLOCK_MONOTONIC at creation (ns)
+ *          48  uint64   number of the file, counts rotations
+ *          56  uint64   reserved, 0
+ *
+ * record:   0  uint32   record size, header and padding included
+ *           4  uint16   number of bytes
+ *           6  uint8    direction (MBUS_CAPTURE_SEND, MBUS_CAPTURE_RECV)
+ *           7  uint8    reserved, 0
+ *           8  uint32   handle id
+ *          12  uint32   reserved, 0
+ *          16  int64    CLOCK_MONOTONIC (ns)
+ *          24  bytes    as sent or received, padded to a multiple of 8
+ * \endverbatim
+ * Records start at MBUS_CAPTURE_HEADER_SIZE and end at used, so a file
+ * that was not closed (e.g. after a crash) can be read as well.
+ */
+
+#ifndef MBUS_CAPTURE_H
+#define MBUS_CAPTURE_H
+
+#include <stdint.h>
+
+#include "mbus-protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MBUS_CAPTURE_MAGIC             "MBUSCAP"
+#define MBUS_CAPTURE_VERSION           1
+#define MBUS_CAPTURE_HEADER_SIZE       64
+#define MBUS_CAPTURE_RECORD_HEADER_SIZE 24
+
+#define MBUS_CAPTURE_SEND              1 /**< master to slaves */
+#define MBUS_CAPTURE_RECV              2 /**< slaves to master */
+
+/**
+ * Header of a capture file
+ */
+typedef struct _mbus_capture_header {
+    char     magic[8];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t reserved;
+    uint64_t used;
+    uint64_t size;
+    int64_t  realtime_ns;
+    int64_t  monotonic_ns;
+    uint64_t sequence;
+    uint64_t reserved2;
+} mbus_capture_header;
+
+/**
+ * Header of a capture record, followed by the bytes
+ */
+typedef struct _mbus_capture_record {
+    uint32_t size;
+    uint16_t len;
+    uint8_t  direction;
+    uint8_t  reserved;
+    uint32_t handle_id;
+    uint32_t reserved2;
+    int64_t  timestamp_ns;
+} mbus_capture_record;
+
+/**
+ * Capture log being written. Not thread-safe: handles attached to the same
+ * log must be served by one thread (e.g. by the poll engine).
+ */
+typedef struct _mbus_capture {
+    char *path;
+    size_t size;                 /**< size of every file */
+    int keep;                    /**< rotated files kept */
+    int fd;
+    unsigned char *map;
+    mbus_capture_header *header;
+    int pending_rotation;        /**< kept files shifted, path not renamed yet */
+
+    unsigned long records;       /**< records written */
+    unsigned long rotations;     /**< files completed */
+    unsigned long dropped;       /**< records lost, too large or failed rotation */
+} mbus_capture;
+
+/**
+ * Create a capture log, an existing file is replaced
+ *
+ * @param path file to write
+ * @param size size of the file, preallocated (at least 4096 bytes)
+ * @param keep number of full files kept as path.1 .. path.keep, zero to
+ *             start over in the same file
+ *
+ * @return capture log, NULL on error (see mbus_error_str)
+ */
+mbus_capture *mbus_capture_open(const char *path, size_t size, int keep);
+
+/**
+ * Close a capture log, the file is truncated to the records written
+ *
+ * @param capture capture log
+ */
+void mbus_capture_close(mbus_capture *capture);
+
+/**
+ * Append a record
+ *
+ * @param capture   capture log
+ * @param direction MBUS_CAPTURE_SEND or MBUS_CAPTURE_RECV
+ * @param handle_id id of the handle, as given to mbus_handle_set_capture
+ * @param data      bytes sent or received
+ * @param len       number of bytes
+ *
+ * @return zero when OK
+ */
+int mbus_capture_write(mbus_capture *capture, int direction, unsigned int handle_id,
+                       const unsigned char *data, size_t len);
+
+/**
+ * Check the header of a capture file in memory
+ *
+ * @param buff  contents of the file
+ * @param size  number of bytes in buff
+ * @param end   end of the records in buff
+ *
+ * @return zero when OK, -1 if buff is not a capture file
+ */
+int mbus_capture_check(const unsigned char *buff, size_t size, size_t *end);
+
+/**
+ * Iterate over the records of a capture file in memory. Start with
+ * *pos = MBUS_CAPTURE_HEADER_SIZE.
+ *
+ * @param buff   contents of the file
+ * @param end    end of the records, from mbus_capture_check
+ * @param pos    position of the next record, advanced
+ * @param record header of the record
+ * @param data   bytes of the record, points into buff
+ *
+ * @return 1 for a record, 0 at the end and -1 for a malformed record
+ */
+int mbus_capture_next(const unsigned char *buff, size_t end, size_t *pos,
+                      mbus_capture_record *record, const unsigned char **data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MBUS_CAPTURE_H */
@@ -0,0 +1,1168 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2011, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mbus-poll.h"
+
+//------------------------------------------------------------------------------
+/// Monotonic clock in microseconds
+//------------------------------------------------------------------------------
+static long long
+mbus_poll_clock_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+//------------------------------------------------------------------------------
+/// Allocate a poll engine
+//------------------------------------------------------------------------------
+mbus_poll *
+mbus_poll_new(mbus_poll_reply_event reply_event, void *userdata)
+{
+    mbus_poll *engine;
+
+    if ((engine = (mbus_poll *) malloc(sizeof(mbus_poll))) == NULL)
+    {
+        mbus_error_str_set("mbus_poll_new: failed to allocate poll engine");
+        return NULL;
+    }
+
+    memset((void *)engine, 0, sizeof(mbus_poll));
+
+    engine->max_frames = 16;
+    engine->reply_event = reply_event;
+    engine->userdata = userdata;
+
+    return engine;
+}
+
+//------------------------------------------------------------------------------
+/// Drop the frames of the current job of a bus
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_clear(mbus_poll_bus *bus)
+{
+    mbus_frame_free(bus->request);
+    mbus_frame_free(bus->reply);
+
+    bus->request = NULL;
+    bus->reply = bus->last = NULL;
+    bus->state = MBUS_POLL_STATE_IDLE;
+    bus->retry = 0;
+    bus->frame_count = 0;
+    bus->quiet_deadline_us = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Free a job including its search state
+//------------------------------------------------------------------------------
+static void
+mbus_poll_scan_free(mbus_poll_scan *scan)
+{
+    if (scan)
+    {
+        free(scan->masks);
+        free(scan->known);
+        free(scan);
+    }
+}
+
+static void
+mbus_poll_job_free(mbus_poll_job *job)
+{
+    mbus_poll_scan_free(job->scan);
+    free(job);
+}
+
+//------------------------------------------------------------------------------
+/// Free a poll engine and all queued jobs
+//------------------------------------------------------------------------------
+void
+mbus_poll_free(mbus_poll *engine)
+{
+    mbus_poll_bus *bus;
+    mbus_poll_job *job;
+    size_t i;
+
+    if (engine == NULL)
+        return;
+
+    for (i = 0; i < engine->nbuses; i++)
+    {
+        bus = &(engine->buses[i]);
+
+        while ((job = bus->head) != NULL)
+        {
+            bus->head = job->next;
+            mbus_poll_job_free(job);
+        }
+
+        mbus_poll_bus_clear(bus);
+        mbus_handle_set_nonblocking(bus->handle, 0);
+    }
+
+    while ((job = engine->free_jobs) != NULL)
+    {
+        engine->free_jobs = job->next;
+        mbus_poll_job_free(job);
+    }
+
+    free(engine->buses);
+    free(engine->fds);
+    free(engine);
+}
+
+//------------------------------------------------------------------------------
+/// Find (or add) the bus of a handle
+//------------------------------------------------------------------------------
+static mbus_poll_bus *
+mbus_poll_bus_get(mbus_poll *engine, mbus_handle *handle)
+{
+    mbus_poll_bus *buses;
+    struct pollfd *fds;
+    size_t i, size;
+
+    for (i = 0; i < engine->nbuses; i++)
+    {
+        if (engine->buses[i].handle == handle)
+            return &(engine->buses[i]);
+    }
+
+    if (engine->nbuses == engine->size)
+    {
+        size = engine->size ? 2 * engine->size : 8;
+
+        if ((buses = (mbus_poll_bus *) realloc(engine->buses, size * sizeof(mbus_poll_bus))) == NULL)
+            return NULL;
+
+        engine->buses = buses;
+
+        if ((fds = (struct pollfd *) realloc(engine->fds, size * sizeof(struct pollfd))) == NULL)
+            return NULL;
+
+        engine->fds = fds;
+        engine->size = size;
+    }
+
+    if (handle->nonblocking == 0 && mbus_handle_set_nonblocking(handle, 1) != 0)
+        return NULL;
+
+    memset((void *)&(engine->buses[engine->nbuses]), 0, sizeof(mbus_poll_bus));
+    engine->buses[engine->nbuses].handle = handle;
+
+    return &(engine->buses[engine->nbuses++]);
+}
+
+//------------------------------------------------------------------------------
+/// Append a job to the queue of a handle
+//------------------------------------------------------------------------------
+static mbus_poll_job *
+mbus_poll_add(mbus_poll *engine, mbus_handle *handle, const char *address, int is_primary)
+{
+    mbus_poll_bus *bus;
+    mbus_poll_job *job;
+
+    if (engine == NULL || handle == NULL)
+    {
+        mbus_error_str_set("mbus_poll_add: invalid poll engine or handle");
+        return NULL;
+    }
+
+    if ((bus = mbus_poll_bus_get(engine, handle)) == NULL)
+    {
+        mbus_error_str_set("mbus_poll_add: failed to add handle");
+        return NULL;
+    }
+
+    if ((job = engine->free_jobs) != NULL)
+    {
+        engine->free_jobs = job->next;
+    }
+    else if ((job = (mbus_poll_job *) malloc(sizeof(mbus_poll_job))) == NULL)
+    {
+        mbus_error_str_set("mbus_poll_add: failed to allocate job");
+        return NULL;
+    }
+
+    snprintf(job->address, sizeof(job->address), "%s", address);
+    job->is_primary = is_primary;
+    job->scan = NULL;
+    job->next = NULL;
+
+    if (bus->tail)
+        bus->tail->next = job;
+    else
+        bus->head = job;
+
+    bus->tail = job;
+
+    return job;
+}
+
+int
+mbus_poll_add_primary(mbus_poll *engine, mbus_handle *handle, int address)
+{
+    char address_str[17];
+
+    if (mbus_is_primary_address(address) == 0)
+    {
+        mbus_error_str_set("mbus_poll_add_primary: invalid address");
+        return -1;
+    }
+
+    snprintf(address_str, sizeof(address_str), "%d", address);
+
+    return mbus_poll_add(engine, handle, address_str, 1) ? 0 : -1;
+}
+
+int
+mbus_poll_add_secondary(mbus_poll *engine, mbus_handle *handle, const char *address)
+{
+    if (mbus_is_secondary_address(address) == 0)
+    {
+        mbus_error_str_set("mbus_poll_add_secondary: invalid address");
+        return -1;
+    }
+
+    return mbus_poll_add(engine, handle, address, 0) ? 0 : -1;
+}
+
+size_t
+mbus_poll_pending(mbus_poll *engine)
+{
+    mbus_poll_job *job;
+    size_t i, n = 0;
+
+    if (engine == NULL)
+        return 0;
+
+    for (i = 0; i < engine->nbuses; i++)
+    {
+        for (job = engine->buses[i].head; job; job = job->next)
+            n++;
+    }
+
+    return n;
+}
+
+//------------------------------------------------------------------------------
+/// Send the request of the current job. Stale data of an earlier exchange is
+/// dropped first.
+//------------------------------------------------------------------------------
+static int
+mbus_poll_bus_send(mbus_poll_bus *bus)
+{
+    mbus_frame_parser_reset(bus->handle->parser);
+    bus->quiet_deadline_us = 0;
+
+    return mbus_handle_send_async(bus->handle, bus->request);
+}
+
+//------------------------------------------------------------------------------
+/// Send a REQ_UD2 to the address of the current job (or the selected slave)
+//------------------------------------------------------------------------------
+static int
+mbus_poll_bus_request(mbus_poll_bus *bus, int address)
+{
+    mbus_slave_data *slave;
+
+    mbus_frame_free(bus->request);
+
+    if ((bus->request = mbus_handle_frame_new(bus->handle, MBUS_FRAME_TYPE_SHORT)) == NULL)
+        return -1;
+
+    bus->request->control = MBUS_CONTROL_MASK_REQ_UD2 |
+                            MBUS_CONTROL_MASK_DIR_M2S |
+                            MBUS_CONTROL_MASK_FCV;
+    bus->request->address = address;
+
+    // continue the FCB sequence of the slave on this bus
+    slave = mbus_handle_slave_data(bus->handle, address);
+    if (slave == NULL || slave->state_fcb)
+        bus->request->control |= MBUS_CONTROL_MASK_FCB;
+
+    bus->state = MBUS_POLL_STATE_REQUEST;
+
+    return mbus_poll_bus_send(bus);
+}
+
+static int mbus_poll_scan_next(mbus_poll_bus *bus);
+
+//------------------------------------------------------------------------------
+/// Rate the requests of a job are sent at, see mbus_handle_slave_baudrate
+//------------------------------------------------------------------------------
+static long
+mbus_poll_job_baudrate(mbus_poll_bus *bus, mbus_poll_job *job)
+{
+    if (job->is_primary && !job->scan)
+        return mbus_handle_slave_baudrate(bus->handle, atoi(job->address));
+
+    return bus->handle->bus_baudrate;
+}
+
+//------------------------------------------------------------------------------
+/// With slave rates on the handle, start a job at the current port rate
+/// first, so slaves sharing a rate are read together without switching the
+/// port for every job
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_regroup(mbus_poll_bus *bus)
+{
+    mbus_poll_job *job, *prev;
+    long baudrate;
+
+    if (bus->handle->bus_baudrate == 0)
+        return;
+
+    baudrate = mbus_handle_get_baudrate(bus->handle);
+
+    if (mbus_poll_job_baudrate(bus, bus->head) == baudrate)
+        return;
+
+    for (prev = bus->head, job = prev->next; job; prev = job, job = job->next)
+    {
+        if (mbus_poll_job_baudrate(bus, job) == baudrate)
+        {
+            prev->next = job->next;
+            if (bus->tail == job)
+                bus->tail = prev;
+
+            job->next = bus->head;
+            bus->head = job;
+            return;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Start the job at the head of the queue
+//------------------------------------------------------------------------------
+static int
+mbus_poll_bus_start(mbus_poll_bus *bus)
+{
+    mbus_poll_job *job;
+
+    mbus_poll_bus_regroup(bus);
+    job = bus->head;
+
+    if (job->scan)
+        return mbus_poll_scan_next(bus);
+
+    if (job->is_primary)
+        return mbus_poll_bus_request(bus, atoi(job->address));
+
+    if ((bus->request = mbus_handle_frame_new(bus->handle, MBUS_FRAME_TYPE_LONG)) == NULL)
+        return -1;
+
+    if (mbus_frame_select_secondary_pack(bus->request, job->address) == -1)
+        return -1;
+
+    bus->state = MBUS_POLL_STATE_SELECT;
+
+    return mbus_poll_bus_send(bus);
+}
+
+//------------------------------------------------------------------------------
+/// Report the result of the current job and move on to the next one
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_finish(mbus_poll *engine, mbus_poll_bus *bus, int result)
+{
+    mbus_poll_job *job = bus->head;
+
+    // the end of a scan is told apart from the slaves found
+    if (job->scan && result == MBUS_RECV_RESULT_OK)
+        result = MBUS_POLL_RESULT_SCAN_DONE;
+
+    if (engine->reply_event)
+        engine->reply_event(engine, bus->handle, job->address, result,
+                          (result == MBUS_RECV_RESULT_OK) ? bus->reply : NULL,
+                          engine->userdata);
+
+    bus->head = job->next;
+    if (bus->head == NULL)
+        bus->tail = NULL;
+
+    // keep the job for the next mbus_poll_add
+    mbus_poll_scan_free(job->scan);
+    job->scan = NULL;
+    job->next = engine->free_jobs;
+    engine->free_jobs = job;
+
+    mbus_poll_bus_clear(bus);
+}
+
+//------------------------------------------------------------------------------
+/// The connection of a bus is gone, fail all of its jobs
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_abort(mbus_poll *engine, mbus_poll_bus *bus, int result)
+{
+    while (bus->head)
+        mbus_poll_bus_finish(engine, bus, result);
+}
+
+//------------------------------------------------------------------------------
+/// Repeat the last request after a timeout or invalid reply, give up after
+/// max_data_retry attempts
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_retry(mbus_poll *engine, mbus_poll_bus *bus, int result)
+{
+    if (++bus->retry > bus->handle->max_data_retry)
+    {
+        mbus_poll_bus_finish(engine, bus, result);
+        return;
+    }
+
+    mbus_stats_event(bus->handle, MBUS_STATS_EVENT_RETRY);
+
+    if (mbus_poll_bus_send(bus) != 0)
+        mbus_poll_bus_abort(engine, bus, MBUS_RECV_RESULT_ERROR);
+}
+
+//------------------------------------------------------------------------------
+/// Check a reply without decoding its records: returns 1 if the slave has
+/// more telegrams, 0 if not and -1 for replies mbus_frame_data_parse rejects.
+//------------------------------------------------------------------------------
+static int
+mbus_poll_reply_more(mbus_frame *frame)
+{
+    mbus_frame_view view;
+
+    if ((frame->control & MBUS_CONTROL_MASK_DIR) != MBUS_CONTROL_MASK_DIR_S2M)
+        return -1;
+
+    switch (frame->control_information)
+    {
+        case MBUS_CONTROL_INFO_ERROR_GENERAL:
+            return 0;
+
+        case MBUS_CONTROL_INFO_RESP_FIXED:
+            return (frame->data_size > 0) ? 0 : -1;
+
+        case MBUS_CONTROL_INFO_RESP_VARIABLE:
+            if (frame->data_size == 0)
+                return -1;
+
+            mbus_frame_view_of(&view, frame);
+
+            return mbus_frame_view_more_records_follow(&view);
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+/// Process a frame received for the current job
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_reply(mbus_poll *engine, mbus_poll_bus *bus, mbus_frame *frame)
+{
+    mbus_frame_pool *pool;
+    mbus_slave_data *slave;
+    mbus_frame *copy;
+    int more_frames;
+
+    if (bus->state == MBUS_POLL_STATE_SELECT)
+    {
+        if (mbus_frame_type(frame) != MBUS_FRAME_TYPE_ACK)
+        {
+            mbus_poll_bus_retry(engine, bus, MBUS_RECV_RESULT_INVALID);
+            return;
+        }
+
+        bus->retry = 0;
+
+        if (mbus_poll_bus_request(bus, MBUS_ADDRESS_NETWORK_LAYER) != 0)
+            mbus_poll_bus_abort(engine, bus, MBUS_RECV_RESULT_ERROR);
+
+        return;
+    }
+
+    //
+    // slice the records to tell if more telegrams are available
+    //
+    if ((more_frames = mbus_poll_reply_more(frame)) == -1)
+    {
+        mbus_poll_bus_retry(engine, bus, MBUS_RECV_RESULT_INVALID);
+        return;
+    }
+
+    if ((copy = mbus_handle_frame_new(bus->handle, MBUS_FRAME_TYPE_ANY)) == NULL)
+    {
+        mbus_poll_bus_finish(engine, bus, MBUS_RECV_RESULT_ERROR);
+        return;
+    }
+
+    pool = copy->pool;
+    *copy = *frame;
+    copy->next = NULL;
+    copy->pool = pool;
+
+    if (bus->last)
+        bus->last->next = copy;
+    else
+        bus->reply = copy;
+
+    bus->last = copy;
+    bus->retry = 0;
+    bus->frame_count++;
+
+    if ((slave = mbus_handle_slave_data(bus->handle, bus->request->address)) != NULL)
+    {
+        slave->state_fcb = (bus->request->control & MBUS_CONTROL_MASK_FCB) ? 0 : 1;
+        slave->state_acd = (frame->control & MBUS_CONTROL_MASK_ACD) ? 1 : 0;
+    }
+
+    if (more_frames && bus->frame_count < engine->max_frames)
+    {
+        // toggle FCB bit and ask for the next telegram
+        bus->request->control ^= MBUS_CONTROL_MASK_FCB;
+
+        if (mbus_poll_bus_send(bus) != 0)
+            mbus_poll_bus_abort(engine, bus, MBUS_RECV_RESULT_ERROR);
+
+        return;
+    }
+
+    mbus_poll_bus_finish(engine, bus, MBUS_RECV_RESULT_OK);
+}
+
+//------------------------------------------------------------------------------
+/// Wait until nothing is received for a response timeout
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_quiet_wait(mbus_poll_bus *bus)
+{
+    bus->quiet_deadline_us = mbus_poll_clock_us() + mbus_handle_timeout_us(bus->handle);
+}
+
+//------------------------------------------------------------------------------
+/// Append an address (mask) to a list
+//------------------------------------------------------------------------------
+static int
+mbus_poll_scan_list_add(char (**list)[17], size_t *n, size_t *size, const char *address)
+{
+    char (*tmp)[17];
+    size_t new_size;
+
+    if (*n == *size)
+    {
+        new_size = *size ? 2 * *size : 32;
+
+        if ((tmp = (char (*)[17]) realloc(*list, new_size * sizeof(**list))) == NULL)
+            return -1;
+
+        *list = tmp;
+        *size = new_size;
+    }
+
+    snprintf((*list)[(*n)++], 17, "%s", address);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Check if an address matches a mask (F is the wildcard)
+//------------------------------------------------------------------------------
+static int
+mbus_poll_scan_match(const char *mask, const char *address)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        if (mask[i] != 'F' && mask[i] != 'f' &&
+            toupper((unsigned char) mask[i]) != toupper((unsigned char) address[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Order in which wildcards are resolved after a collision: the ID from the
+/// least significant digit, then medium, version and manufacturer.
+//------------------------------------------------------------------------------
+static const int mbus_poll_scan_order[16] = {
+    7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+};
+
+//------------------------------------------------------------------------------
+/// Split a mask after a collision. Returns 0 when the mask has no wildcard
+/// left (i.e. several slaves share the address).
+//------------------------------------------------------------------------------
+static int
+mbus_poll_scan_expand(mbus_poll_scan *scan, const char *mask)
+{
+    static const char digits[] = "0123456789ABCDE";
+    char child[17], preferred[16];
+    const char *digit;
+    size_t i, ndigits;
+    int pos = -1, d;
+
+    for (i = 0; i < 16; i++)
+    {
+        if (mask[mbus_poll_scan_order[i]] == 'F' || mask[mbus_poll_scan_order[i]] == 'f')
+        {
+            pos = mbus_poll_scan_order[i];
+            break;
+        }
+    }
+
+    if (pos < 0)
+        return 0;
+
+    // the ID is BCD, manufacturer, version and medium are hex
+    ndigits = (pos < 8) ? 10 : 15;
+
+    memset(preferred, 0, sizeof(preferred));
+
+    for (i = 0; i < scan->nknown; i++)
+    {
+        if (mbus_poll_scan_match(mask, scan->known[i]) &&
+            (digit = strchr(digits, toupper((unsigned char) scan->known[i][pos]))) != NULL &&
+            (size_t) (digit - digits) < ndigits)
+            preferred[digit - digits] = 1;
+    }
+
+    snprintf(child, sizeof(child), "%s", mask);
+
+    // last in first out: push the preferred digits last
+    for (d = (int) ndigits - 1; d >= 0; d--)
+    {
+        if (preferred[d])
+            continue;
+
+        child[pos] = digits[d];
+        if (mbus_poll_scan_list_add(&scan->masks, &scan->nmasks, &scan->masks_size, child) != 0)
+            return -1;
+    }
+
+    for (d = (int) ndigits - 1; d >= 0; d--)
+    {
+        if (!preferred[d])
+            continue;
+
+        child[pos] = digits[d];
+        if (mbus_poll_scan_list_add(&scan->masks, &scan->nmasks, &scan->masks_size, child) != 0)
+            return -1;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Send the selection of the current mask
+//------------------------------------------------------------------------------
+static int
+mbus_poll_scan_select(mbus_poll_bus *bus)
+{
+    mbus_poll_scan *scan = bus->head->scan;
+
+    mbus_frame_free(bus->request);
+
+    if ((bus->request = mbus_handle_frame_new(bus->handle, MBUS_FRAME_TYPE_LONG)) == NULL)
+        return -1;
+
+    if (mbus_frame_select_secondary_pack(bus->request, scan->mask) == -1)
+        return -1;
+
+    bus->state = MBUS_POLL_STATE_SCAN_SELECT;
+
+    return mbus_poll_bus_send(bus);
+}
+
+//------------------------------------------------------------------------------
+/// Probe the next mask, or finish the search
+//------------------------------------------------------------------------------
+static int
+mbus_poll_scan_next(mbus_poll_bus *bus)
+{
+    mbus_poll_scan *scan = bus->head->scan;
+
+    mbus_frame_free(bus->reply);
+    bus->reply = bus->last = NULL;
+
+    if (scan->nmasks == 0)
+    {
+        bus->state = MBUS_POLL_STATE_IDLE;
+        return 1;
+    }
+
+    snprintf(scan->mask, sizeof(scan->mask), "%s", scan->masks[--scan->nmasks]);
+    scan->retry = 0;
+
+    if (bus->handle->scan_progress)
+        bus->handle->scan_progress(bus->handle, scan->mask);
+
+    return mbus_poll_scan_select(bus);
+}
+
+//------------------------------------------------------------------------------
+/// Continue with the next mask, report the end of the search
+//------------------------------------------------------------------------------
+static void
+mbus_poll_scan_continue(mbus_poll *engine, mbus_poll_bus *bus)
+{
+    switch (mbus_poll_scan_next(bus))
+    {
+        case 0:
+            break;
+        case 1:
+            mbus_poll_bus_finish(engine, bus, MBUS_RECV_RESULT_OK);
+            break;
+        default:
+            mbus_poll_bus_finish(engine, bus, MBUS_RECV_RESULT_ERROR);
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// No slave matches the current mask
+//------------------------------------------------------------------------------
+static void
+mbus_poll_scan_nothing(mbus_poll *engine, mbus_poll_bus *bus, int retry)
+{
+    mbus_poll_scan *scan = bus->head->scan;
+
+    if (retry && scan->retry < bus->handle->max_search_retry)
+    {
+        scan->retry++;
+        mbus_stats_event(bus->handle, MBUS_STATS_EVENT_RETRY);
+
+        if (mbus_poll_scan_select(bus) != 0)
+            mbus_poll_bus_finish(engine, bus, MBUS_RECV_RESULT_ERROR);
+
+        return;
+    }
+
+    mbus_poll_scan_continue(engine, bus);
+}
+
+//------------------------------------------------------------------------------
+/// Exactly one slave matches the current mask
+//------------------------------------------------------------------------------
+static void
+mbus_poll_scan_single(mbus_poll *engine, mbus_poll_bus *bus)
+{
+    mbus_poll_scan *scan = bus->head->scan;
+    char addr[32];
+    size_t i;
+
+    if (mbus_frame_get_secondary_address_r(bus->reply, addr, sizeof(addr)) != NULL)
+    {
+        addr[16] = '\0';
+
+        for (i = scan->nseeds; i < scan->nknown; i++)
+        {
+            if (strcmp(scan->known[i], addr) == 0)
+                break;
+        }
+
+        // seeds are probed first, so each slave is reported once
+        if (i == scan->nknown)
+        {
+            if (mbus_poll_scan_list_add(&scan->known, &scan->nknown, &scan->known_size, addr) != 0)
+            {
+                mbus_poll_bus_finish(engine, bus, MBUS_RECV_RESULT_ERROR);
+                return;
+            }
+
+            if (bus->handle->found_event)
+                bus->handle->found_event(bus->handle, bus->reply);
+
+            if (engine->reply_event)
+                engine->reply_event(engine, bus->handle, addr, MBUS_RECV_RESULT_OK,
+                                    bus->reply, engine->userdata);
+        }
+    }
+
+    mbus_poll_scan_continue(engine, bus);
+}
+
+//------------------------------------------------------------------------------
+/// Several slaves answered the current mask
+//------------------------------------------------------------------------------
+static void
+mbus_poll_scan_collision(mbus_poll *engine, mbus_poll_bus *bus)
+{
+    mbus_poll_scan *scan = bus->head->scan;
+
+    mbus_stats_event(bus->handle, MBUS_STATS_EVENT_COLLISION);
+
+    switch (mbus_poll_scan_expand(scan, scan->mask))
+    {
+        case 0:
+            // duplicate address, can't be resolved further
+            if (engine->reply_event)
+                engine->reply_event(engine, bus->handle, scan->mask, MBUS_RECV_RESULT_INVALID,
+                                    NULL, engine->userdata);
+            break;
+        case 1:
+            break;
+        default:
+            mbus_poll_bus_finish(engine, bus, MBUS_RECV_RESULT_ERROR);
+            return;
+    }
+
+    mbus_poll_scan_continue(engine, bus);
+}
+
+//------------------------------------------------------------------------------
+/// Process a frame (NULL for invalid data) received while probing
+//------------------------------------------------------------------------------
+static void
+mbus_poll_scan_reply(mbus_poll *engine, mbus_poll_bus *bus, mbus_frame *frame)
+{
+    mbus_frame_pool *pool;
+
+    switch (bus->state)
+    {
+        case MBUS_POLL_STATE_SCAN_SELECT:
+            if (frame == NULL)
+                bus->state = MBUS_POLL_STATE_SCAN_COLLISION;
+            else if (mbus_frame_type(frame) == MBUS_FRAME_TYPE_ACK)
+                bus->state = MBUS_POLL_STATE_SCAN_SELECT_QUIET; // check for more data (collision)
+            else
+            {
+                mbus_poll_scan_nothing(engine, bus, 0); // unexpected reply
+                return;
+            }
+
+            break;
+
+        case MBUS_POLL_STATE_SCAN_REQUEST:
+            if (frame != NULL && mbus_frame_type(frame) == MBUS_FRAME_TYPE_LONG)
+            {
+                if ((bus->reply = mbus_handle_frame_new(bus->handle, MBUS_FRAME_TYPE_ANY)) != NULL)
+                {
+                    pool = bus->reply->pool;
+                    *bus->reply = *frame;
+                    bus->reply->next = NULL;
+                    bus->reply->pool = pool;
+                }
+
+                bus->state = MBUS_POLL_STATE_SCAN_REQUEST_QUIET; // check for more data (collision)
+            }
+            else if (frame == NULL)
+                bus->state = MBUS_POLL_STATE_SCAN_COLLISION;
+            else
+            {
+                mbus_poll_scan_nothing(engine, bus, 0); // unexpected reply
+                return;
+            }
+
+            break;
+
+        default:
+            // anything received while waiting for silence is a collision
+            bus->state = MBUS_POLL_STATE_SCAN_COLLISION;
+            break;
+    }
+
+    bus->handle->deadline_us = 0;
+    mbus_poll_bus_quiet_wait(bus);
+}
+
+//------------------------------------------------------------------------------
+/// The bus has been quiet for a response timeout while probing
+//------------------------------------------------------------------------------
+static void
+mbus_poll_scan_quiet(mbus_poll *engine, mbus_poll_bus *bus)
+{
+    switch (bus->state)
+    {
+        case MBUS_POLL_STATE_SCAN_SELECT_QUIET:
+            // a single ACK, ask the selected slave for its data
+            if (mbus_poll_bus_request(bus, MBUS_ADDRESS_NETWORK_LAYER) != 0)
+            {
+                mbus_poll_bus_abort(engine, bus, MBUS_RECV_RESULT_ERROR);
+                return;
+            }
+
+            bus->state = MBUS_POLL_STATE_SCAN_REQUEST;
+            break;
+
+        case MBUS_POLL_STATE_SCAN_REQUEST_QUIET:
+            if (bus->reply)
+                mbus_poll_scan_single(engine, bus);
+            else
+                mbus_poll_bus_finish(engine, bus, MBUS_RECV_RESULT_ERROR);
+            break;
+
+        default:
+            mbus_poll_scan_collision(engine, bus);
+            break;
+    }
+}
+
+int
+mbus_poll_add_scan(mbus_poll *engine, mbus_handle *handle, const char *mask,
+                   const char **seeds, size_t nseeds)
+{
+    mbus_poll_scan *scan;
+    mbus_poll_job *job;
+    size_t i;
+
+    if (mbus_is_secondary_address(mask) == 0)
+    {
+        mbus_error_str_set("mbus_poll_add_scan: invalid address mask");
+        return -1;
+    }
+
+    if ((scan = (mbus_poll_scan *) malloc(sizeof(mbus_poll_scan))) == NULL)
+    {
+        mbus_error_str_set("mbus_poll_add_scan: failed to allocate scan");
+        return -1;
+    }
+
+    memset((void *)scan, 0, sizeof(mbus_poll_scan));
+
+    //
+    // the whole mask is probed first, the matching seeds before it
+    //
+    if (mbus_poll_scan_list_add(&scan->masks, &scan->nmasks, &scan->masks_size, mask) != 0)
+    {
+        mbus_poll_scan_free(scan);
+        return -1;
+    }
+
+    for (i = 0; seeds && i < nseeds; i++)
+    {
+        if (seeds[i] == NULL || mbus_is_secondary_address(seeds[i]) == 0 ||
+            mbus_poll_scan_match(mask, seeds[i]) == 0)
+            continue;
+
+        if (mbus_poll_scan_list_add(&scan->known, &scan->nknown, &scan->known_size, seeds[i]) != 0 ||
+            mbus_poll_scan_list_add(&scan->masks, &scan->nmasks, &scan->masks_size, seeds[i]) != 0)
+        {
+            mbus_poll_scan_free(scan);
+            return -1;
+        }
+    }
+
+    scan->nseeds = scan->nknown;
+
+    if ((job = mbus_poll_add(engine, handle, mask, 0)) == NULL)
+    {
+        mbus_poll_scan_free(scan);
+        return -1;
+    }
+
+    job->scan = scan;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Read all data available on a bus
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_readable(mbus_poll *engine, mbus_poll_bus *bus)
+{
+    mbus_frame frame;
+    int result;
+
+    while (bus->head)
+    {
+        result = mbus_handle_on_readable(bus->handle, &frame);
+
+        if (result == MBUS_RECV_RESULT_PENDING)
+            return;
+
+        if (result == MBUS_RECV_RESULT_RESET || result == MBUS_RECV_RESULT_ERROR)
+        {
+            mbus_poll_bus_abort(engine, bus, result);
+            return;
+        }
+
+        if (bus->state == MBUS_POLL_STATE_IDLE ||
+            bus->handle->tx_len > 0)
+            continue; // not waiting for a reply, drop it
+
+        if (bus->head->scan)
+        {
+            mbus_poll_scan_reply(engine, bus, (result == MBUS_RECV_RESULT_OK) ? &frame : NULL);
+            continue;
+        }
+
+        if (bus->quiet_deadline_us || result == MBUS_RECV_RESULT_INVALID)
+        {
+            // like mbus_purge_frames: retry when the bus is quiet
+            mbus_poll_bus_quiet_wait(bus);
+            continue;
+        }
+
+        mbus_poll_bus_reply(engine, bus, &frame);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Milliseconds until the earliest deadline of a bus, -1 if none
+//------------------------------------------------------------------------------
+static int
+mbus_poll_bus_timeout_ms(mbus_poll_bus *bus, long long now)
+{
+    long long remaining;
+
+    if (bus->quiet_deadline_us)
+    {
+        remaining = bus->quiet_deadline_us - now;
+        return (remaining <= 0) ? 0 : (int) ((remaining + 999) / 1000);
+    }
+
+    return mbus_handle_next_timeout_ms(bus->handle);
+}
+
+//------------------------------------------------------------------------------
+/// Handle expired deadlines of a bus
+//------------------------------------------------------------------------------
+static void
+mbus_poll_bus_timeout(mbus_poll *engine, mbus_poll_bus *bus, long long now)
+{
+    int result;
+
+    if (bus->head == NULL || bus->state == MBUS_POLL_STATE_IDLE)
+        return;
+
+    if (bus->quiet_deadline_us)
+    {
+        if (now < bus->quiet_deadline_us)
+            return;
+
+        bus->quiet_deadline_us = 0;
+
+        if (bus->head->scan)
+            mbus_poll_scan_quiet(engine, bus);
+        else
+            mbus_poll_bus_retry(engine, bus, MBUS_RECV_RESULT_INVALID);
+
+        return;
+    }
+
+    if ((result = mbus_handle_on_timeout(bus->handle)) == MBUS_RECV_RESULT_PENDING)
+        return;
+
+    if (bus->head->scan == NULL)
+        mbus_poll_bus_retry(engine, bus, result);
+    else if (result == MBUS_RECV_RESULT_INVALID)
+        mbus_poll_scan_collision(engine, bus); // garbled reply, the bus is quiet already
+    else
+        mbus_poll_scan_nothing(engine, bus, bus->state == MBUS_POLL_STATE_SCAN_SELECT);
+}
+
+int
+mbus_poll_step(mbus_poll *engine, int timeout_ms)
+{
+    mbus_poll_bus *bus;
+    struct pollfd *fd;
+    long long now;
+    int events, bus_timeout, n, ret;
+    size_t i;
+
+    if (engine == NULL)
+    {
+        mbus_error_str_set("mbus_poll_step: invalid poll engine");
+        return -1;
+    }
+
+    //
+    // start the next job on idle buses and collect the events to wait for
+    //
+    now = mbus_poll_clock_us();
+
+    for (i = 0; i < engine->nbuses; i++)
+    {
+        bus = &(engine->buses[i]);
+        fd = &(engine->fds[i]);
+
+        while (bus->head && bus->state == MBUS_POLL_STATE_IDLE)
+        {
+            if ((ret = mbus_poll_bus_start(bus)) != 0)
+                mbus_poll_bus_finish(engine, bus, (ret > 0) ? MBUS_RECV_RESULT_OK : MBUS_RECV_RESULT_ERROR);
+        }
+
+        fd->fd = -1;
+        fd->events = 0;
+        fd->revents = 0;
+
+        if (bus->head == NULL)
+            continue;
+
+        events = mbus_handle_events(bus->handle);
+
+        fd->fd = mbus_handle_fd(bus->handle);
+        fd->events = (events & MBUS_HANDLE_EVENT_WRITABLE) ? POLLOUT : POLLIN;
+
+        bus_timeout = mbus_poll_bus_timeout_ms(bus, now);
+
+        if (bus_timeout >= 0 && (timeout_ms < 0 || bus_timeout < timeout_ms))
+            timeout_ms = bus_timeout;
+    }
+
+    if (mbus_poll_pending(engine) == 0)
+        return 0;
+
+    if ((n = poll(engine->fds, engine->nbuses, timeout_ms)) < 0)
+    {
+        if (errno == EINTR)
+            return (int) mbus_poll_pending(engine);
+
+        mbus_error_str_set("mbus_poll_step: poll failed");
+        return -1;
+    }
+
+    //
+    // process readiness and expired deadlines
+    //
+    for (i = 0; i < engine->nbuses; i++)
+    {
+        bus = &(engine->buses[i]);
+        fd = &(engine->fds[i]);
+
+        if (fd->revents & POLLOUT)
+        {
+            if (mbus_handle_on_writable(bus->handle) == MBUS_RECV_RESULT_ERROR)
+                mbus_poll_bus_abort(engine, bus, MBUS_RECV_RESULT_ERROR);
+        }
+
+        if (fd->revents & (POLLIN | POLLHUP | POLLERR))
+            mbus_poll_bus_readable(engine, bus);
+    }
+
+    now = mbus_poll_clock_us();
+
+    for (i = 0; i < engine->nbuses; i++)
+        mbus_poll_bus_timeout(engine, &(engine->buses[i]), now);
+
+    return (int) mbus_poll_pending(engine);
+}
+
+int
+mbus_poll_run(mbus_poll *engine)
+{
+    int result;
+
+    while ((result = mbus_poll_step(engine, -1)) > 0)
+        ;
+
+    return (result < 0) ? -1 : 0;
+}
@@ -0,0 +1,236 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2011, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+/**
+ * @file   mbus-poll.h
+ *
+ * @brief  Concurrent readout of slaves on many M-Bus segments.
+ *
+ * Each handle (serial port or TCP gateway) gets its own queue of slave
+ * addresses. Only one request is outstanding per segment at any time, but
+ * all segments are serviced at once from a single thread using the
+ * non-blocking handle API:
+ * \verbatim
+ * poll = mbus_poll_new(reply_event, userdata);
+ * mbus_poll_add_primary(poll, handle_a, 1);
+ * mbus_poll_add_secondary(poll, handle_b, "1234567800000000");
+ * mbus_poll_add_scan(poll, handle_c, "FFFFFFFFFFFFFFFF", known, nknown);
+ * mbus_poll_run(poll);
+ * mbus_poll_free(poll);
+ * \endverbatim
+ */
+
+#ifndef MBUS_POLL_H
+#define MBUS_POLL_H
+
+#include <poll.h>
+
+#include "mbus-protocol.h"
+#include "mbus-protocol-aux.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct _mbus_poll;
+
+#define MBUS_POLL_RESULT_SCAN_DONE 2 /**< result of the event ending a scan */
+
+/**
+ * Called when the readout of a slave has finished
+ *
+ * @param engine   Poll engine
+ * @param handle   Handle of the segment
+ * @param address  Primary or secondary address of the slave (as string)
+ * @param result   MBUS_RECV_RESULT_OK or the error of the last attempt
+ * @param reply    Reply frame(s) chained by next, NULL on error. Freed by the
+ *                 engine when the callback returns.
+ * @param userdata as passed to mbus_poll_new
+ *
+ * For scans the callback is called with the reply of every device found.
+ * A duplicate address that can't be resolved is reported with the mask,
+ * MBUS_RECV_RESULT_INVALID and a NULL reply. When the scan has finished
+ * the callback is called once more with the mask, a NULL reply and
+ * MBUS_POLL_RESULT_SCAN_DONE, or the error if the scan failed.
+ *
+ * Further readouts may be queued from the callback, but only for handles
+ * already known to the engine.
+ */
+typedef void (*mbus_poll_reply_event)(struct _mbus_poll *engine, mbus_handle *handle,
+                                      const char *address, int result,
+                                      mbus_frame *reply, void *userdata);
+
+/**
+ * State of a secondary address search
+ */
+typedef struct _mbus_poll_scan {
+    char (*masks)[17];           /**< masks still to probe, probed last in first out */
+    size_t nmasks;
+    size_t masks_size;
+    char (*known)[17];           /**< seeds and found addresses, probed first */
+    size_t nknown;
+    size_t known_size;
+    size_t nseeds;               /**< leading entries of known given as seeds */
+    char mask[17];               /**< mask being probed */
+    int retry;                   /**< search retries of the current mask */
+} mbus_poll_scan;
+
+/**
+ * Queued readout of a single slave, or search of a secondary address range
+ */
+typedef struct _mbus_poll_job {
+    char address[17];            /**< primary (decimal), secondary address or scan mask */
+    char is_primary;             /**< non zero for a primary address */
+    mbus_poll_scan *scan;        /**< non NULL for a secondary address search */
+    struct _mbus_poll_job *next;
+} mbus_poll_job;
+
+/**
+ * Request queue and state of a single M-Bus segment
+ */
+typedef struct _mbus_poll_bus {
+    mbus_handle *handle;
+    mbus_poll_job *head;         /**< job in progress, followed by the queue */
+    mbus_poll_job *tail;
+    int state;                   /**< MBUS_POLL_STATE_* */
+    int retry;                   /**< failed attempts of the current job */
+    int frame_count;             /**< telegrams received for the current job */
+    long long quiet_deadline_us; /**< waiting for the bus to become quiet */
+    mbus_frame *request;         /**< request of the current job */
+    mbus_frame *reply;           /**< reply chain of the current job */
+    mbus_frame *last;
+} mbus_poll_bus;
+
+/**
+ * Poll engine
+ */
+typedef struct _mbus_poll {
+    mbus_poll_bus *buses;
+    struct pollfd *fds;
+    size_t nbuses;
+    size_t size;
+    int max_frames;              /**< telegrams read per slave (multi-telegram replies) */
+    mbus_poll_reply_event reply_event;
+    void *userdata;
+    mbus_poll_job *free_jobs;    /**< finished jobs kept for reuse */
+} mbus_poll;
+
+#define MBUS_POLL_STATE_IDLE    0
+#define MBUS_POLL_STATE_SELECT  1
+#define MBUS_POLL_STATE_REQUEST 2
+#define MBUS_POLL_STATE_SCAN_SELECT        3
+#define MBUS_POLL_STATE_SCAN_SELECT_QUIET  4
+#define MBUS_POLL_STATE_SCAN_REQUEST       5
+#define MBUS_POLL_STATE_SCAN_REQUEST_QUIET 6
+#define MBUS_POLL_STATE_SCAN_COLLISION     7
+
+/**
+ * Allocate a poll engine
+ *
+ * @param reply_event Called for every finished readout
+ * @param userdata    Passed to reply_event
+ *
+ * @return new engine, NULL on error
+ */
+mbus_poll *mbus_poll_new(mbus_poll_reply_event reply_event, void *userdata);
+
+/**
+ * Free a poll engine and all queued jobs. The handles are switched back to
+ * blocking mode, but stay connected.
+ *
+ * @param engine Poll engine
+ */
+void mbus_poll_free(mbus_poll *engine);
+
+/**
+ * Queue the readout of a slave by primary address. The handle must be
+ * connected. Queueing the first job of a handle switches it to non-blocking
+ * mode, it is switched back by mbus_poll_free.
+ *
+ * @param engine  Poll engine
+ * @param handle  Connected handle of the segment
+ * @param address Primary address
+ *
+ * @return Zero when successful.
+ */
+int mbus_poll_add_primary(mbus_poll *engine, mbus_handle *handle, int address);
+
+/**
+ * Queue the readout of a slave by secondary address
+ *
+ * @param engine  Poll engine
+ * @param handle  Connected handle of the segment
+ * @param address Secondary address (16 characters)
+ *
+ * @return Zero when successful.
+ */
+int mbus_poll_add_secondary(mbus_poll *engine, mbus_handle *handle, const char *address);
+
+/**
+ * Queue a search for all slaves matching a secondary address mask. Works
+ * like mbus_scan_2nd_address_range, but
+ *
+ * - the mask itself is probed first, so an empty bus or a single slave
+ *   needs only one probe,
+ * - the seeds (e.g. the result of the last scan) are verified first and
+ *   their digits are preferred when a collision is resolved,
+ * - collisions are resolved at the least significant ID digits first, where
+ *   sequentially numbered meters differ, the manufacturer, version and medium
+ *   nibbles last (including the hex digits A - E),
+ * - it runs concurrently with the jobs of all other handles.
+ *
+ * handle->scan_progress and handle->found_event are called like in
+ * mbus_scan_2nd_address_range.
+ *
+ * @param engine Poll engine
+ * @param handle Connected handle of the segment
+ * @param mask   Secondary address mask, F is the wildcard
+ * @param seeds  Known secondary addresses, may be NULL
+ * @param nseeds Number of seeds
+ *
+ * @return Zero when successful.
+ */
+int mbus_poll_add_scan(mbus_poll *engine, mbus_handle *handle, const char *mask,
+                       const char **seeds, size_t nseeds);
+
+/**
+ * Number of readouts not finished yet
+ *
+ * @param engine Poll engine
+ *
+ * @return queued and active jobs on all segments
+ */
+size_t mbus_poll_pending(mbus_poll *engine);
+
+/**
+ * Run a single iteration: start queued jobs, wait at most timeout_ms for
+ * any handle to become ready or a deadline to expire, and process the events.
+ *
+ * @param engine     Poll engine
+ * @param timeout_ms upper limit for waiting, -1 to wait for the next deadline
+ *
+ * @return number of pending jobs, -1 on error
+ */
+int mbus_poll_step(mbus_poll *engine, int timeout_ms);
+
+/**
+ * Run until all queued readouts have finished
+ *
+ * @param engine Poll engine
+ *
+ * @return Zero when successful, -1 on error
+ */
+int mbus_poll_run(mbus_poll *engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MBUS_POLL_H */
@@ -14,11 +14,17 @@
 #include "mbus-protocol-aux.h"
 #include "mbus-serial.h"
 #include "mbus-tcp.h"
+#include "mbus-sim.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 /*@ignore@*/
 #define MBUS_ERROR(...) fprintf (stderr, __VA_ARGS__)
@@ -32,719 +38,731 @@
 
 static int debug = 0;
 
-typedef struct _mbus_variable_vif {
-    unsigned     vif;
-    double       exponent;
-    const char * unit;
-    const char * quantity;
-} mbus_variable_vif;
+#define NITEMS(x) (sizeof(x)/sizeof(x[0]))
 
-mbus_variable_vif vif_table[] = {
+//------------------------------------------------------------------------------
+// Traffic counters. Updated with relaxed atomics, so that other threads can
+// read them without locking. Once allocated the counters stay until the
+// handle is freed, disabling them only clears stats_enabled.
+//------------------------------------------------------------------------------
+#if defined(__GNUC__)
+#define MBUS_STATS_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define MBUS_STATS_GET(counter)    __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define MBUS_STATS_ENABLE(handle, on) __atomic_store_n(&((handle)->stats_enabled), (on), __ATOMIC_RELEASE)
+#define MBUS_STATS_ENABLED(handle) __atomic_load_n(&((handle)->stats_enabled), __ATOMIC_ACQUIRE)
+#else
+#define MBUS_STATS_ADD(counter, n) ((counter) += (n))
+#define MBUS_STATS_GET(counter)    (counter)
+#define MBUS_STATS_ENABLE(handle, on) ((handle)->stats_enabled = (on))
+#define MBUS_STATS_ENABLED(handle) ((handle)->stats_enabled)
+#endif
+
+/*
+ * Both tables are indexed directly by the code they describe, unused codes
+ * have a NULL unit. vif_table holds the primary VIFs at 0x000 - 0x07F and
+ * the 0xFD / 0xFB extension tables at 0x100 - 0x17F and 0x200 - 0x27F.
+ */
+static const mbus_variable_vif vif_table[0x280] = {
 /*  Primary VIFs (main table), range 0x00 - 0xFF */
 
     /*  E000 0nnn    Energy Wh (0.001Wh to 10000Wh) */
-    { 0x00, 1.0e-3, "Wh", "Energy" },
-    { 0x01, 1.0e-2, "Wh", "Energy" },
-    { 0x02, 1.0e-1, "Wh", "Energy" },
-    { 0x03, 1.0e0,  "Wh", "Energy" },
-    { 0x04, 1.0e1,  "Wh", "Energy" },
-    { 0x05, 1.0e2,  "Wh", "Energy" },
-    { 0x06, 1.0e3,  "Wh", "Energy" },
-    { 0x07, 1.0e4,  "Wh", "Energy" },
+    [0x00] = { 0x00, 1.0e-3, "Wh", "Energy" },
+    [0x01] = { 0x01, 1.0e-2, "Wh", "Energy" },
+    [0x02] = { 0x02, 1.0e-1, "Wh", "Energy" },
+    [0x03] = { 0x03, 1.0e0,  "Wh", "Energy" },
+    [0x04] = { 0x04, 1.0e1,  "Wh", "Energy" },
+    [0x05] = { 0x05, 1.0e2,  "Wh", "Energy" },
+    [0x06] = { 0x06, 1.0e3,  "Wh", "Energy" },
+    [0x07] = { 0x07, 1.0e4,  "Wh", "Energy" },
 
     /* E000 1nnn    Energy  J (0.001kJ to 10000kJ) */
-    { 0x08, 1.0e0, "J", "Energy" },
-    { 0x09, 1.0e1, "J", "Energy" },
-    { 0x0A, 1.0e2, "J", "Energy" },
-    { 0x0B, 1.0e3, "J", "Energy" },
-    { 0x0C, 1.0e4, "J", "Energy" },
-    { 0x0D, 1.0e5, "J", "Energy" },
-    { 0x0E, 1.0e6, "J", "Energy" },
-    { 0x0F, 1.0e7, "J", "Energy" },
+    [0x08] = { 0x08, 1.0e0, "J", "Energy" },
+    [0x09] = { 0x09, 1.0e1, "J", "Energy" },
+    [0x0A] = { 0x0A, 1.0e2, "J", "Energy" },
+    [0x0B] = { 0x0B, 1.0e3, "J", "Energy" },
+    [0x0C] = { 0x0C, 1.0e4, "J", "Energy" },
+    [0x0D] = { 0x0D, 1.0e5, "J", "Energy" },
+    [0x0E] = { 0x0E, 1.0e6, "J", "Energy" },
+    [0x0F] = { 0x0F, 1.0e7, "J", "Energy" },
 
     /* E001 0nnn    Volume m^3 (0.001l to 10000l) */
-    { 0x10, 1.0e-6, "m^3", "Volume" },
-    { 0x11, 1.0e-5, "m^3", "Volume" },
-    { 0x12, 1.0e-4, "m^3", "Volume" },
-    { 0x13, 1.0e-3, "m^3", "Volume" },
-    { 0x14, 1.0e-2, "m^3", "Volume" },
-    { 0x15, 1.0e-1, "m^3", "Volume" },
-    { 0x16, 1.0e0,  "m^3", "Volume" },
-    { 0x17, 1.0e1,  "m^3", "Volume" },
+    [0x10] = { 0x10, 1.0e-6, "m^3", "Volume" },
+    [0x11] = { 0x11, 1.0e-5, "m^3", "Volume" },
+    [0x12] = { 0x12, 1.0e-4, "m^3", "Volume" },
+    [0x13] = { 0x13, 1.0e-3, "m^3", "Volume" },
+    [0x14] = { 0x14, 1.0e-2, "m^3", "Volume" },
+    [0x15] = { 0x15, 1.0e-1, "m^3", "Volume" },
+    [0x16] = { 0x16, 1.0e0,  "m^3", "Volume" },
+    [0x17] = { 0x17, 1.0e1,  "m^3", "Volume" },
 
     /* E001 1nnn    Mass kg (0.001kg to 10000kg) */
-    { 0x18, 1.0e-3, "kg", "Mass" },
-    { 0x19, 1.0e-2, "kg", "Mass" },
-    { 0x1A, 1.0e-1, "kg", "Mass" },
-    { 0x1B, 1.0e0,  "kg", "Mass" },
-    { 0x1C, 1.0e1,  "kg", "Mass" },
-    { 0x1D, 1.0e2,  "kg", "Mass" },
-    { 0x1E, 1.0e3,  "kg", "Mass" },
-    { 0x1F, 1.0e4,  "kg", "Mass" },
+    [0x18] = { 0x18, 1.0e-3, "kg", "Mass" },
+    [0x19] = { 0x19, 1.0e-2, "kg", "Mass" },
+    [0x1A] = { 0x1A, 1.0e-1, "kg", "Mass" },
+    [0x1B] = { 0x1B, 1.0e0,  "kg", "Mass" },
+    [0x1C] = { 0x1C, 1.0e1,  "kg", "Mass" },
+    [0x1D] = { 0x1D, 1.0e2,  "kg", "Mass" },
+    [0x1E] = { 0x1E, 1.0e3,  "kg", "Mass" },
+    [0x1F] = { 0x1F, 1.0e4,  "kg", "Mass" },
 
     /* E010 00nn    On Time s */
-    { 0x20,     1.0, "s", "On time" },  /* seconds */
-    { 0x21,    60.0, "s", "On time" },  /* minutes */
-    { 0x22,  3600.0, "s", "On time" },  /* hours   */
-    { 0x23, 86400.0, "s", "On time" },  /* days    */
+    [0x20] = { 0x20,     1.0, "s", "On time" },  /* seconds */
+    [0x21] = { 0x21,    60.0, "s", "On time" },  /* minutes */
+    [0x22] = { 0x22,  3600.0, "s", "On time" },  /* hours   */
+    [0x23] = { 0x23, 86400.0, "s", "On time" },  /* days    */
 
     /* E010 01nn    Operating Time s */
-    { 0x24,     1.0, "s", "Operating time" },  /* seconds */
-    { 0x25,    60.0, "s", "Operating time" },  /* minutes */
-    { 0x26,  3600.0, "s", "Operating time" },  /* hours   */
-    { 0x27, 86400.0, "s", "Operating time" },  /* days    */
+    [0x24] = { 0x24,     1.0, "s", "Operating time" },  /* seconds */
+    [0x25] = { 0x25,    60.0, "s", "Operating time" },  /* minutes */
+    [0x26] = { 0x26,  3600.0, "s", "Operating time" },  /* hours   */
+    [0x27] = { 0x27, 86400.0, "s", "Operating time" },  /* days    */
 
     /* E010 1nnn    Power W (0.001W to 10000W) */
-    { 0x28, 1.0e-3, "W", "Power" },
-    { 0x29, 1.0e-2, "W", "Power" },
-    { 0x2A, 1.0e-1, "W", "Power" },
-    { 0x2B, 1.0e0,  "W", "Power" },
-    { 0x2C, 1.0e1,  "W", "Power" },
-    { 0x2D, 1.0e2,  "W", "Power" },
-    { 0x2E, 1.0e3,  "W", "Power" },
-    { 0x2F, 1.0e4,  "W", "Power" },
+    [0x28] = { 0x28, 1.0e-3, "W", "Power" },
+    [0x29] = { 0x29, 1.0e-2, "W", "Power" },
+    [0x2A] = { 0x2A, 1.0e-1, "W", "Power" },
+    [0x2B] = { 0x2B, 1.0e0,  "W", "Power" },
+    [0x2C] = { 0x2C, 1.0e1,  "W", "Power" },
+    [0x2D] = { 0x2D, 1.0e2,  "W", "Power" },
+    [0x2E] = { 0x2E, 1.0e3,  "W", "Power" },
+    [0x2F] = { 0x2F, 1.0e4,  "W", "Power" },
 
     /* E011 0nnn    Power J/h (0.001kJ/h to 10000kJ/h) */
-    { 0x30, 1.0e0, "J/h", "Power" },
-    { 0x31, 1.0e1, "J/h", "Power" },
-    { 0x32, 1.0e2, "J/h", "Power" },
-    { 0x33, 1.0e3, "J/h", "Power" },
-    { 0x34, 1.0e4, "J/h", "Power" },
-    { 0x35, 1.0e5, "J/h", "Power" },
-    { 0x36, 1.0e6, "J/h", "Power" },
-    { 0x37, 1.0e7, "J/h", "Power" },
+    [0x30] = { 0x30, 1.0e0, "J/h", "Power" },
+    [0x31] = { 0x31, 1.0e1, "J/h", "Power" },
+    [0x32] = { 0x32, 1.0e2, "J/h", "Power" },
+    [0x33] = { 0x33, 1.0e3, "J/h", "Power" },
+    [0x34] = { 0x34, 1.0e4, "J/h", "Power" },
+    [0x35] = { 0x35, 1.0e5, "J/h", "Power" },
+    [0x36] = { 0x36, 1.0e6, "J/h", "Power" },
+    [0x37] = { 0x37, 1.0e7, "J/h", "Power" },
 
     /* E011 1nnn    Volume Flow m3/h (0.001l/h to 10000l/h) */
-    { 0x38, 1.0e-6, "m^3/h", "Volume flow" },
-    { 0x39, 1.0e-5, "m^3/h", "Volume flow" },
-    { 0x3A, 1.0e-4, "m^3/h", "Volume flow" },
-    { 0x3B, 1.0e-3, "m^3/h", "Volume flow" },
-    { 0x3C, 1.0e-2, "m^3/h", "Volume flow" },
-    { 0x3D, 1.0e-1, "m^3/h", "Volume flow" },
-    { 0x3E, 1.0e0,  "m^3/h", "Volume flow" },
-    { 0x3F, 1.0e1,  "m^3/h", "Volume flow" },
+    [0x38] = { 0x38, 1.0e-6, "m^3/h", "Volume flow" },
+    [0x39] = { 0x39, 1.0e-5, "m^3/h", "Volume flow" },
+    [0x3A] = { 0x3A, 1.0e-4, "m^3/h", "Volume flow" },
+    [0x3B] = { 0x3B, 1.0e-3, "m^3/h", "Volume flow" },
+    [0x3C] = { 0x3C, 1.0e-2, "m^3/h", "Volume flow" },
+    [0x3D] = { 0x3D, 1.0e-1, "m^3/h", "Volume flow" },
+    [0x3E] = { 0x3E, 1.0e0,  "m^3/h", "Volume flow" },
+    [0x3F] = { 0x3F, 1.0e1,  "m^3/h", "Volume flow" },
 
     /* E100 0nnn     Volume Flow ext.  m^3/min (0.0001l/min to 1000l/min) */
-    { 0x40, 1.0e-7, "m^3/min", "Volume flow" },
-    { 0x41, 1.0e-6, "m^3/min", "Volume flow" },
-    { 0x42, 1.0e-5, "m^3/min", "Volume flow" },
-    { 0x43, 1.0e-4, "m^3/min", "Volume flow" },
-    { 0x44, 1.0e-3, "m^3/min", "Volume flow" },
-    { 0x45, 1.0e-2, "m^3/min", "Volume flow" },
-    { 0x46, 1.0e-1, "m^3/min", "Volume flow" },
-    { 0x47, 1.0e0,  "m^3/min", "Volume flow" },
+    [0x40] = { 0x40, 1.0e-7, "m^3/min", "Volume flow" },
+    [0x41] = { 0x41, 1.0e-6, "m^3/min", "Volume flow" },
+    [0x42] = { 0x42, 1.0e-5, "m^3/min", "Volume flow" },
+    [0x43] = { 0x43, 1.0e-4, "m^3/min", "Volume flow" },
+    [0x44] = { 0x44, 1.0e-3, "m^3/min", "Volume flow" },
+    [0x45] = { 0x45, 1.0e-2, "m^3/min", "Volume flow" },
+    [0x46] = { 0x46, 1.0e-1, "m^3/min", "Volume flow" },
+    [0x47] = { 0x47, 1.0e0,  "m^3/min", "Volume flow" },
 
     /* E100 1nnn     Volume Flow ext.  m^3/s (0.001ml/s to 10000ml/s) */
-    { 0x48, 1.0e-9, "m^3/s", "Volume flow" },
-    { 0x49, 1.0e-8, "m^3/s", "Volume flow" },
-    { 0x4A, 1.0e-7, "m^3/s", "Volume flow" },
-    { 0x4B, 1.0e-6, "m^3/s", "Volume flow" },
-    { 0x4C, 1.0e-5, "m^3/s", "Volume flow" },
-    { 0x4D, 1.0e-4, "m^3/s", "Volume flow" },
-    { 0x4E, 1.0e-3, "m^3/s", "Volume flow" },
-    { 0x4F, 1.0e-2, "m^3/s", "Volume flow" },
+    [0x48] = { 0x48, 1.0e-9, "m^3/s", "Volume flow" },
+    [0x49] = { 0x49, 1.0e-8, "m^3/s", "Volume flow" },
+    [0x4A] = { 0x4A, 1.0e-7, "m^3/s", "Volume flow" },
+    [0x4B] = { 0x4B, 1.0e-6, "m^3/s", "Volume flow" },
+    [0x4C] = { 0x4C, 1.0e-5, "m^3/s", "Volume flow" },
+    [0x4D] = { 0x4D, 1.0e-4, "m^3/s", "Volume flow" },
+    [0x4E] = { 0x4E, 1.0e-3, "m^3/s", "Volume flow" },
+    [0x4F] = { 0x4F, 1.0e-2, "m^3/s", "Volume flow" },
 
     /* E101 0nnn     Mass flow kg/h (0.001kg/h to 10000kg/h) */
-    { 0x50, 1.0e-3, "kg/h", "Mass flow" },
-    { 0x51, 1.0e-2, "kg/h", "Mass flow" },
-    { 0x52, 1.0e-1, "kg/h", "Mass flow" },
-    { 0x53, 1.0e0,  "kg/h", "Mass flow" },
-    { 0x54, 1.0e1,  "kg/h", "Mass flow" },
-    { 0x55, 1.0e2,  "kg/h", "Mass flow" },
-    { 0x56, 1.0e3,  "kg/h", "Mass flow" },
-    { 0x57, 1.0e4,  "kg/h", "Mass flow" },
+    [0x50] = { 0x50, 1.0e-3, "kg/h", "Mass flow" },
+    [0x51] = { 0x51, 1.0e-2, "kg/h", "Mass flow" },
+    [0x52] = { 0x52, 1.0e-1, "kg/h", "Mass flow" },
+    [0x53] = { 0x53, 1.0e0,  "kg/h", "Mass flow" },
+    [0x54] = { 0x54, 1.0e1,  "kg/h", "Mass flow" },
+    [0x55] = { 0x55, 1.0e2,  "kg/h", "Mass flow" },
+    [0x56] = { 0x56, 1.0e3,  "kg/h", "Mass flow" },
+    [0x57] = { 0x57, 1.0e4,  "kg/h", "Mass flow" },
 
     /* E101 10nn     Flow Temperature °C (0.001°C to 1°C) */
-    { 0x58, 1.0e-3, "°C", "Flow temperature" },
-    { 0x59, 1.0e-2, "°C", "Flow temperature" },
-    { 0x5A, 1.0e-1, "°C", "Flow temperature" },
-    { 0x5B, 1.0e0,  "°C", "Flow temperature" },
+    [0x58] = { 0x58, 1.0e-3, "°C", "Flow temperature" },
+    [0x59] = { 0x59, 1.0e-2, "°C", "Flow temperature" },
+    [0x5A] = { 0x5A, 1.0e-1, "°C", "Flow temperature" },
+    [0x5B] = { 0x5B, 1.0e0,  "°C", "Flow temperature" },
 
     /* E101 11nn Return Temperature °C (0.001°C to 1°C) */
-    { 0x5C, 1.0e-3, "°C", "Return temperature" },
-    { 0x5D, 1.0e-2, "°C", "Return temperature" },
-    { 0x5E, 1.0e-1, "°C", "Return temperature" },
-    { 0x5F, 1.0e0,  "°C", "Return temperature" },
+    [0x5C] = { 0x5C, 1.0e-3, "°C", "Return temperature" },
+    [0x5D] = { 0x5D, 1.0e-2, "°C", "Return temperature" },
+    [0x5E] = { 0x5E, 1.0e-1, "°C", "Return temperature" },
+    [0x5F] = { 0x5F, 1.0e0,  "°C", "Return temperature" },
 
     /* E110 00nn    Temperature Difference  K   (mK to  K) */
-    { 0x60, 1.0e-3, "K", "Temperature difference" },
-    { 0x61, 1.0e-2, "K", "Temperature difference" },
-    { 0x62, 1.0e-1, "K", "Temperature difference" },
-    { 0x63, 1.0e0,  "K", "Temperature difference" },
+    [0x60] = { 0x60, 1.0e-3, "K", "Temperature difference" },
+    [0x61] = { 0x61, 1.0e-2, "K", "Temperature difference" },
+    [0x62] = { 0x62, 1.0e-1, "K", "Temperature difference" },
+    [0x63] = { 0x63, 1.0e0,  "K", "Temperature difference" },
 
     /* E110 01nn     External Temperature °C (0.001°C to 1°C) */
-    { 0x64, 1.0e-3, "°C", "External temperature" },
-    { 0x65, 1.0e-2, "°C", "External temperature" },
-    { 0x66, 1.0e-1, "°C", "External temperature" },
-    { 0x67, 1.0e0,  "°C", "External temperature" },
+    [0x64] = { 0x64, 1.0e-3, "°C", "External temperature" },
+    [0x65] = { 0x65, 1.0e-2, "°C", "External temperature" },
+    [0x66] = { 0x66, 1.0e-1, "°C", "External temperature" },
+    [0x67] = { 0x67, 1.0e0,  "°C", "External temperature" },
 
     /* E110 10nn     Pressure bar (1mbar to 1000mbar) */
-    { 0x68, 1.0e-3, "bar", "Pressure" },
-    { 0x69, 1.0e-2, "bar", "Pressure" },
-    { 0x6A, 1.0e-1, "bar", "Pressure" },
-    { 0x6B, 1.0e0,  "bar", "Pressure" },
+    [0x68] = { 0x68, 1.0e-3, "bar", "Pressure" },
+    [0x69] = { 0x69, 1.0e-2, "bar", "Pressure" },
+    [0x6A] = { 0x6A, 1.0e-1, "bar", "Pressure" },
+    [0x6B] = { 0x6B, 1.0e0,  "bar", "Pressure" },
 
     /* E110 110n     Time Point */
-    { 0x6C, 1.0e0, "-", "Time point (date)" },            /* n = 0        date, data type G */
-    { 0x6D, 1.0e0, "-", "Time point (date & time)" },     /* n = 1 time & date, data type F */
+    [0x6C] = { 0x6C, 1.0e0, "-", "Time point (date)" },            /* n = 0        date, data type G */
+    [0x6D] = { 0x6D, 1.0e0, "-", "Time point (date & time)" },     /* n = 1 time & date, data type F */
 
     /* E110 1110     Units for H.C.A. dimensionless */
-    { 0x6E, 1.0e0,  "Units for H.C.A.", "H.C.A." },
+    [0x6E] = { 0x6E, 1.0e0,  "Units for H.C.A.", "H.C.A." },
 
     /* E110 1111     Reserved */
-    { 0x6F, 0.0,  "Reserved", "Reserved" },
+    [0x6F] = { 0x6F, 0.0,  "Reserved", "Reserved" },
 
     /* E111 00nn     Averaging Duration s */
-    { 0x70,     1.0, "s", "Averaging Duration" },  /* seconds */
-    { 0x71,    60.0, "s", "Averaging Duration" },  /* minutes */
-    { 0x72,  3600.0, "s", "Averaging Duration" },  /* hours   */
-    { 0x73, 86400.0, "s", "Averaging Duration" },  /* days    */
+    [0x70] = { 0x70,     1.0, "s", "Averaging Duration" },  /* seconds */
+    [0x71] = { 0x71,    60.0, "s", "Averaging Duration" },  /* minutes */
+    [0x72] = { 0x72,  3600.0, "s", "Averaging Duration" },  /* hours   */
+    [0x73] = { 0x73, 86400.0, "s", "Averaging Duration" },  /* days    */
 
     /* E111 01nn     Actuality Duration s */
-    { 0x74,     1.0, "s", "Actuality Duration" },  /* seconds */
-    { 0x75,    60.0, "s", "Actuality Duration" },  /* minutes */
-    { 0x76,  3600.0, "s", "Actuality Duration" },  /* hours   */
-    { 0x77, 86400.0, "s", "Actuality Duration" },  /* days    */
+    [0x74] = { 0x74,     1.0, "s", "Actuality Duration" },  /* seconds */
+    [0x75] = { 0x75,    60.0, "s", "Actuality Duration" },  /* minutes */
+    [0x76] = { 0x76,  3600.0, "s", "Actuality Duration" },  /* hours   */
+    [0x77] = { 0x77, 86400.0, "s", "Actuality Duration" },  /* days    */
 
     /* Fabrication No */
-    { 0x78, 1.0, "", "Fabrication No" },
+    [0x78] = { 0x78, 1.0, "", "Fabrication No" },
 
     /* E111 1001 (Enhanced) Identification */
-    { 0x79, 1.0, "", "(Enhanced) Identification" },
+    [0x79] = { 0x79, 1.0, "", "(Enhanced) Identification" },
 
     /* E111 1010 Bus Address */
-    { 0x7A, 1.0, "", "Bus Address" },
+    [0x7A] = { 0x7A, 1.0, "", "Bus Address" },
 
     /* Any VIF: 7Eh */
-    { 0x7E, 1.0, "", "Any VIF" },
+    [0x7E] = { 0x7E, 1.0, "", "Any VIF" },
 
     /* Manufacturer specific: 7Fh */
-    { 0x7F, 1.0, "", "Manufacturer specific" },
+    [0x7F] = { 0x7F, 1.0, "", "Manufacturer specific" },
 
     /* Any VIF: 7Eh */
-    { 0xFE, 1.0, "", "Any VIF" },
+    [0xFE] = { 0xFE, 1.0, "", "Any VIF" },
 
     /* Manufacturer specific: FFh */
-    { 0xFF, 1.0, "", "Manufacturer specific" },
+    [0xFF] = { 0xFF, 1.0, "", "Manufacturer specific" },
 
 
 /* Main VIFE-Code Extension table (following VIF=FDh for primary VIF)
    See 8.4.4 a, only some of them are here. Using range 0x100 - 0x1FF */
 
     /* E000 00nn   Credit of 10nn-3 of the nominal local legal currency units */
-    { 0x100, 1.0e-3, "Currency units", "Credit" },
-    { 0x101, 1.0e-2, "Currency units", "Credit" },
-    { 0x102, 1.0e-1, "Currency units", "Credit" },
-    { 0x103, 1.0e0,  "Currency units", "Credit" },
+    [0x100] = { 0x100, 1.0e-3, "Currency units", "Credit" },
+    [0x101] = { 0x101, 1.0e-2, "Currency units", "Credit" },
+    [0x102] = { 0x102, 1.0e-1, "Currency units", "Credit" },
+    [0x103] = { 0x103, 1.0e0,  "Currency units", "Credit" },
 
     /* E000 01nn   Debit of 10nn-3 of the nominal local legal currency units */
-    { 0x104, 1.0e-3, "Currency units", "Debit" },
-    { 0x105, 1.0e-2, "Currency units", "Debit" },
-    { 0x106, 1.0e-1, "Currency units", "Debit" },
-    { 0x107, 1.0e0,  "Currency units", "Debit" },
+    [0x104] = { 0x104, 1.0e-3, "Currency units", "Debit" },
+    [0x105] = { 0x105, 1.0e-2, "Currency units", "Debit" },
+    [0x106] = { 0x106, 1.0e-1, "Currency units", "Debit" },
+    [0x107] = { 0x107, 1.0e0,  "Currency units", "Debit" },
 
     /* E000 1000 Access Number (transmission count) */
-    { 0x108, 1.0e0,  "", "Access Number (transmission count)" },
+    [0x108] = { 0x108, 1.0e0,  "", "Access Number (transmission count)" },
 
     /* E000 1001 Medium (as in fixed header) */
-    { 0x109, 1.0e0,  "", "Medium" },
+    [0x109] = { 0x109, 1.0e0,  "", "Medium" },
 
     /* E000 1010 Manufacturer (as in fixed header) */
-    { 0x10A, 1.0e0,  "", "Manufacturer" },
+    [0x10A] = { 0x10A, 1.0e0,  "", "Manufacturer" },
 
     /* E000 1011 Parameter set identification */
-    { 0x10B, 1.0e0,  "", "Parameter set identification" },
+    [0x10B] = { 0x10B, 1.0e0,  "", "Parameter set identification" },
 
     /* E000 1100 Model / Version */
-    { 0x10C, 1.0e0,  "", "Model / Version" },
+    [0x10C] = { 0x10C, 1.0e0,  "", "Model / Version" },
 
     /* E000 1101 Hardware version # */
-    { 0x10D, 1.0e0,  "", "Hardware version" },
+    [0x10D] = { 0x10D, 1.0e0,  "", "Hardware version" },
 
     /* E000 1110 Firmware version # */
-    { 0x10E, 1.0e0,  "", "Firmware version" },
+    [0x10E] = { 0x10E, 1.0e0,  "", "Firmware version" },
 
     /* E000 1111 Software version # */
-    { 0x10F, 1.0e0,  "", "Software version" },
+    [0x10F] = { 0x10F, 1.0e0,  "", "Software version" },
 
 
     /* E001 0000 Customer location */
-    { 0x110, 1.0e0,  "", "Customer location" },
+    [0x110] = { 0x110, 1.0e0,  "", "Customer location" },
 
     /* E001 0001 Customer */
-    { 0x111, 1.0e0,  "", "Customer" },
+    [0x111] = { 0x111, 1.0e0,  "", "Customer" },
 
     /* E001 0010 Access Code User */
-    { 0x112, 1.0e0,  "", "Access Code User" },
+    [0x112] = { 0x112, 1.0e0,  "", "Access Code User" },
 
     /* E001 0011 Access Code Operator */
-    { 0x113, 1.0e0,  "", "Access Code Operator" },
+    [0x113] = { 0x113, 1.0e0,  "", "Access Code Operator" },
 
     /* E001 0100 Access Code System Operator */
-    { 0x114, 1.0e0,  "", "Access Code System Operator" },
+    [0x114] = { 0x114, 1.0e0,  "", "Access Code System Operator" },
 
     /* E001 0101 Access Code Developer */
-    { 0x115, 1.0e0,  "", "Access Code Developer" },
+    [0x115] = { 0x115, 1.0e0,  "", "Access Code Developer" },
 
     /* E001 0110 Password */
-    { 0x116, 1.0e0,  "", "Password" },
+    [0x116] = { 0x116, 1.0e0,  "", "Password" },
 
     /* E001 0111 Error flags (binary) */
-    { 0x117, 1.0e0,  "", "Error flags" },
+    [0x117] = { 0x117, 1.0e0,  "", "Error flags" },
 
     /* E001 1000 Error mask */
-    { 0x118, 1.0e0,  "", "Error mask" },
+    [0x118] = { 0x118, 1.0e0,  "", "Error mask" },
 
     /* E001 1001 Reserved */
-    { 0x119, 1.0e0,  "Reserved", "Reserved" },
+    [0x119] = { 0x119, 1.0e0,  "Reserved", "Reserved" },
 
 
     /* E001 1010 Digital Output (binary) */
-    { 0x11A, 1.0e0,  "", "Digital Output" },
+    [0x11A] = { 0x11A, 1.0e0,  "", "Digital Output" },
 
     /* E001 1011 Digital Input (binary) */
-    { 0x11B, 1.0e0,  "", "Digital Input" },
+    [0x11B] = { 0x11B, 1.0e0,  "", "Digital Input" },
 
     /* E001 1100 Baudrate [Baud] */
-    { 0x11C, 1.0e0,  "Baud", "Baudrate" },
+    [0x11C] = { 0x11C, 1.0e0,  "Baud", "Baudrate" },
 
     /* E001 1101 Response delay time [bittimes] */
-    { 0x11D, 1.0e0,  "Bittimes", "Response delay time" },
+    [0x11D] = { 0x11D, 1.0e0,  "Bittimes", "Response delay time" },
 
     /* E001 1110 Retry */
-    { 0x11E, 1.0e0,  "", "Retry" },
+    [0x11E] = { 0x11E, 1.0e0,  "", "Retry" },
 
     /* E001 1111 Reserved */
-    { 0x11F, 1.0e0,  "Reserved", "Reserved" },
+    [0x11F] = { 0x11F, 1.0e0,  "Reserved", "Reserved" },
 
 
     /* E010 0000 First storage # for cyclic storage */
-    { 0x120, 1.0e0,  "", "First storage # for cyclic storage" },
+    [0x120] = { 0x120, 1.0e0,  "", "First storage # for cyclic storage" },
 
     /* E010 0001 Last storage # for cyclic storage */
-    { 0x121, 1.0e0,  "", "Last storage # for cyclic storage" },
+    [0x121] = { 0x121, 1.0e0,  "", "Last storage # for cyclic storage" },
 
     /* E010 0010 Size of storage block */
-    { 0x122, 1.0e0,  "", "Size of storage block" },
+    [0x122] = { 0x122, 1.0e0,  "", "Size of storage block" },
 
     /* E010 0011 Reserved */
-    { 0x123, 1.0e0,  "Reserved", "Reserved" },
+    [0x123] = { 0x123, 1.0e0,  "Reserved", "Reserved" },
 
     /* E010 01nn Storage interval [sec(s)..day(s)] */
-    { 0x124,        1.0,  "s", "Storage interval" },   /* second(s) */
-    { 0x125,       60.0,  "s", "Storage interval" },   /* minute(s) */
-    { 0x126,     3600.0,  "s", "Storage interval" },   /* hour(s)   */
-    { 0x127,    86400.0,  "s", "Storage interval" },   /* day(s)    */
-    { 0x128,  2629743.83, "s", "Storage interval" },   /* month(s)  */
-    { 0x129, 31556926.0,  "s", "Storage interval" },   /* year(s)   */
+    [0x124] = { 0x124,        1.0,  "s", "Storage interval" },   /* second(s) */
+    [0x125] = { 0x125,       60.0,  "s", "Storage interval" },   /* minute(s) */
+    [0x126] = { 0x126,     3600.0,  "s", "Storage interval" },   /* hour(s)   */
+    [0x127] = { 0x127,    86400.0,  "s", "Storage interval" },   /* day(s)    */
+    [0x128] = { 0x128,  2629743.83, "s", "Storage interval" },   /* month(s)  */
+    [0x129] = { 0x129, 31556926.0,  "s", "Storage interval" },   /* year(s)   */
 
     /* E010 1010 Reserved */
-    { 0x12A, 1.0e0,  "Reserved", "Reserved" },
+    [0x12A] = { 0x12A, 1.0e0,  "Reserved", "Reserved" },
 
     /* E010 1011 Reserved */
-    { 0x12B, 1.0e0,  "Reserved", "Reserved" },
+    [0x12B] = { 0x12B, 1.0e0,  "Reserved", "Reserved" },
 
     /* E010 11nn Duration since last readout [sec(s)..day(s)] */
-    { 0x12C,     1.0, "s", "Duration since last readout" },  /* seconds */
-    { 0x12D,    60.0, "s", "Duration since last readout" },  /* minutes */
-    { 0x12E,  3600.0, "s", "Duration since last readout" },  /* hours   */
-    { 0x12F, 86400.0, "s", "Duration since last readout" },  /* days    */
+    [0x12C] = { 0x12C,     1.0, "s", "Duration since last readout" },  /* seconds */
+    [0x12D] = { 0x12D,    60.0, "s", "Duration since last readout" },  /* minutes */
+    [0x12E] = { 0x12E,  3600.0, "s", "Duration since last readout" },  /* hours   */
+    [0x12F] = { 0x12F, 86400.0, "s", "Duration since last readout" },  /* days    */
 
     /* E011 0000 Start (date/time) of tariff  */
     /* The information about usage of data type F (date and time) or data type G (date) can */
     /* be derived from the datafield (0010b: type G / 0100: type F). */
-    { 0x130, 1.0e0,  "Reserved", "Reserved" }, /* ???? */
+    [0x130] = { 0x130, 1.0e0,  "Reserved", "Reserved" }, /* ???? */
 
     /* E011 00nn Duration of tariff (nn=01 ..11: min to days) */
-    { 0x131,       60.0,  "s", "Duration of tariff" },   /* minute(s) */
-    { 0x132,     3600.0,  "s", "Duration of tariff" },   /* hour(s)   */
-    { 0x133,    86400.0,  "s", "Duration of tariff" },   /* day(s)    */
+    [0x131] = { 0x131,       60.0,  "s", "Duration of tariff" },   /* minute(s) */
+    [0x132] = { 0x132,     3600.0,  "s", "Duration of tariff" },   /* hour(s)   */
+    [0x133] = { 0x133,    86400.0,  "s", "Duration of tariff" },   /* day(s)    */
 
     /* E011 01nn Period of tariff [sec(s) to day(s)]  */
-    { 0x134,        1.0, "s", "Period of tariff" },  /* seconds  */
-    { 0x135,       60.0, "s", "Period of tariff" },  /* minutes  */
-    { 0x136,     3600.0, "s", "Period of tariff" },  /* hours    */
-    { 0x137,    86400.0, "s", "Period of tariff" },  /* days     */
-    { 0x138,  2629743.83,"s", "Period of tariff" },  /* month(s) */
-    { 0x139, 31556926.0, "s", "Period of tariff" },  /* year(s)  */
+    [0x134] = { 0x134,        1.0, "s", "Period of tariff" },  /* seconds  */
+    [0x135] = { 0x135,       60.0, "s", "Period of tariff" },  /* minutes  */
+    [0x136] = { 0x136,     3600.0, "s", "Period of tariff" },  /* hours    */
+    [0x137] = { 0x137,    86400.0, "s", "Period of tariff" },  /* days     */
+    [0x138] = { 0x138,  2629743.83,"s", "Period of tariff" },  /* month(s) */
+    [0x139] = { 0x139, 31556926.0, "s", "Period of tariff" },  /* year(s)  */
 
     /* E011 1010 dimensionless / no VIF */
-    { 0x13A, 1.0e0,  "", "Dimensionless" },
+    [0x13A] = { 0x13A, 1.0e0,  "", "Dimensionless" },
 
     /* E011 1011 Reserved */
-    { 0x13B, 1.0e0,  "Reserved", "Reserved" },
+    [0x13B] = { 0x13B, 1.0e0,  "Reserved", "Reserved" },
 
     /* E011 11xx Reserved */
-    { 0x13C, 1.0e0,  "Reserved", "Reserved" },
-    { 0x13D, 1.0e0,  "Reserved", "Reserved" },
-    { 0x13E, 1.0e0,  "Reserved", "Reserved" },
-    { 0x13F, 1.0e0,  "Reserved", "Reserved" },
+    [0x13C] = { 0x13C, 1.0e0,  "Reserved", "Reserved" },
+    [0x13D] = { 0x13D, 1.0e0,  "Reserved", "Reserved" },
+    [0x13E] = { 0x13E, 1.0e0,  "Reserved", "Reserved" },
+    [0x13F] = { 0x13F, 1.0e0,  "Reserved", "Reserved" },
 
     /* E100 nnnn   Volts electrical units */
-    { 0x140, 1.0e-9, "V", "Voltage" },
-    { 0x141, 1.0e-8, "V", "Voltage" },
-    { 0x142, 1.0e-7, "V", "Voltage" },
-    { 0x143, 1.0e-6, "V", "Voltage" },
-    { 0x144, 1.0e-5, "V", "Voltage" },
-    { 0x145, 1.0e-4, "V", "Voltage" },
-    { 0x146, 1.0e-3, "V", "Voltage" },
-    { 0x147, 1.0e-2, "V", "Voltage" },
-    { 0x148, 1.0e-1, "V", "Voltage" },
-    { 0x149, 1.0e0,  "V", "Voltage" },
-    { 0x14A, 1.0e1,  "V", "Voltage" },
-    { 0x14B, 1.0e2,  "V", "Voltage" },
-    { 0x14C, 1.0e3,  "V", "Voltage" },
-    { 0x14D, 1.0e4,  "V", "Voltage" },
-    { 0x14E, 1.0e5,  "V", "Voltage" },
-    { 0x14F, 1.0e6,  "V", "Voltage" },
+    [0x140] = { 0x140, 1.0e-9, "V", "Voltage" },
+    [0x141] = { 0x141, 1.0e-8, "V", "Voltage" },
+    [0x142] = { 0x142, 1.0e-7, "V", "Voltage" },
+    [0x143] = { 0x143, 1.0e-6, "V", "Voltage" },
+    [0x144] = { 0x144, 1.0e-5, "V", "Voltage" },
+    [0x145] = { 0x145, 1.0e-4, "V", "Voltage" },
+    [0x146] = { 0x146, 1.0e-3, "V", "Voltage" },
+    [0x147] = { 0x147, 1.0e-2, "V", "Voltage" },
+    [0x148] = { 0x148, 1.0e-1, "V", "Voltage" },
+    [0x149] = { 0x149, 1.0e0,  "V", "Voltage" },
+    [0x14A] = { 0x14A, 1.0e1,  "V", "Voltage" },
+    [0x14B] = { 0x14B, 1.0e2,  "V", "Voltage" },
+    [0x14C] = { 0x14C, 1.0e3,  "V", "Voltage" },
+    [0x14D] = { 0x14D, 1.0e4,  "V", "Voltage" },
+    [0x14E] = { 0x14E, 1.0e5,  "V", "Voltage" },
+    [0x14F] = { 0x14F, 1.0e6,  "V", "Voltage" },
 
     /* E101 nnnn   A */
-    { 0x150, 1.0e-12, "A", "Current" },
-    { 0x151, 1.0e-11, "A", "Current" },
-    { 0x152, 1.0e-10, "A", "Current" },
-    { 0x153, 1.0e-9,  "A", "Current" },
-    { 0x154, 1.0e-8,  "A", "Current" },
-    { 0x155, 1.0e-7,  "A", "Current" },
-    { 0x156, 1.0e-6,  "A", "Current" },
-    { 0x157, 1.0e-5,  "A", "Current" },
-    { 0x158, 1.0e-4,  "A", "Current" },
-    { 0x159, 1.0e-3,  "A", "Current" },
-    { 0x15A, 1.0e-2,  "A", "Current" },
-    { 0x15B, 1.0e-1,  "A", "Current" },
-    { 0x15C, 1.0e0,   "A", "Current" },
-    { 0x15D, 1.0e1,   "A", "Current" },
-    { 0x15E, 1.0e2,   "A", "Current" },
-    { 0x15F, 1.0e3,   "A", "Current" },
+    [0x150] = { 0x150, 1.0e-12, "A", "Current" },
+    [0x151] = { 0x151, 1.0e-11, "A", "Current" },
+    [0x152] = { 0x152, 1.0e-10, "A", "Current" },
+    [0x153] = { 0x153, 1.0e-9,  "A", "Current" },
+    [0x154] = { 0x154, 1.0e-8,  "A", "Current" },
+    [0x155] = { 0x155, 1.0e-7,  "A", "Current" },
+    [0x156] = { 0x156, 1.0e-6,  "A", "Current" },
+    [0x157] = { 0x157, 1.0e-5,  "A", "Current" },
+    [0x158] = { 0x158, 1.0e-4,  "A", "Current" },
+    [0x159] = { 0x159, 1.0e-3,  "A", "Current" },
+    [0x15A] = { 0x15A, 1.0e-2,  "A", "Current" },
+    [0x15B] = { 0x15B, 1.0e-1,  "A", "Current" },
+    [0x15C] = { 0x15C, 1.0e0,   "A", "Current" },
+    [0x15D] = { 0x15D, 1.0e1,   "A", "Current" },
+    [0x15E] = { 0x15E, 1.0e2,   "A", "Current" },
+    [0x15F] = { 0x15F, 1.0e3,   "A", "Current" },
 
     /* E110 0000 Reset counter */
-    { 0x160, 1.0e0,  "", "Reset counter" },
+    [0x160] = { 0x160, 1.0e0,  "", "Reset counter" },
 
     /* E110 0001 Cumulation counter */
-    { 0x161, 1.0e0,  "", "Cumulation counter" },
+    [0x161] = { 0x161, 1.0e0,  "", "Cumulation counter" },
 
     /* E110 0010 Control signal */
-    { 0x162, 1.0e0,  "", "Control signal" },
+    [0x162] = { 0x162, 1.0e0,  "", "Control signal" },
 
     /* E110 0011 Day of week */
-    { 0x163, 1.0e0,  "", "Day of week" },
+    [0x163] = { 0x163, 1.0e0,  "", "Day of week" },
 
     /* E110 0100 Week number */
-    { 0x164, 1.0e0,  "", "Week number" },
+    [0x164] = { 0x164, 1.0e0,  "", "Week number" },
 
     /* E110 0101 Time point of day change */
-    { 0x165, 1.0e0,  "", "Time point of day change" },
+    [0x165] = { 0x165, 1.0e0,  "", "Time point of day change" },
 
     /* E110 0110 State of parameter activation */
-    { 0x166, 1.0e0,  "", "State of parameter activation" },
+    [0x166] = { 0x166, 1.0e0,  "", "State of parameter activation" },
 
     /* E110 0111 Special supplier information */
-    { 0x167, 1.0e0,  "", "Special supplier information" },
+    [0x167] = { 0x167, 1.0e0,  "", "Special supplier information" },
 
     /* E110 10pp Duration since last cumulation [hour(s)..years(s)] */
-    { 0x168,     3600.0, "s", "Duration since last cumulation" },  /* hours    */
-    { 0x169,    86400.0, "s", "Duration since last cumulation" },  /* days     */
-    { 0x16A,  2629743.83,"s", "Duration since last cumulation" },  /* month(s) */
-    { 0x16B, 31556926.0, "s", "Duration since last cumulation" },  /* year(s)  */
+    [0x168] = { 0x168,     3600.0, "s", "Duration since last cumulation" },  /* hours    */
+    [0x169] = { 0x169,    86400.0, "s", "Duration since last cumulation" },  /* days     */
+    [0x16A] = { 0x16A,  2629743.83,"s", "Duration since last cumulation" },  /* month(s) */
+    [0x16B] = { 0x16B, 31556926.0, "s", "Duration since last cumulation" },  /* year(s)  */
 
     /* E110 11pp Operating time battery [hour(s)..years(s)] */
-    { 0x16C,     3600.0, "s", "Operating time battery" },  /* hours    */
-    { 0x16D,    86400.0, "s", "Operating time battery" },  /* days     */
-    { 0x16E,  2629743.83,"s", "Operating time battery" },  /* month(s) */
-    { 0x16F, 31556926.0, "s", "Operating time battery" },  /* year(s)  */
+    [0x16C] = { 0x16C,     3600.0, "s", "Operating time battery" },  /* hours    */
+    [0x16D] = { 0x16D,    86400.0, "s", "Operating time battery" },  /* days     */
+    [0x16E] = { 0x16E,  2629743.83,"s", "Operating time battery" },  /* month(s) */
+    [0x16F] = { 0x16F, 31556926.0, "s", "Operating time battery" },  /* year(s)  */
 
     /* E111 0000 Date and time of battery change */
-    { 0x170, 1.0e0,  "", "Date and time of battery change" },
+    [0x170] = { 0x170, 1.0e0,  "", "Date and time of battery change" },
 
     /* E111 0001-1111 Reserved */
-    { 0x171, 1.0e0,  "Reserved", "Reserved" },
-    { 0x172, 1.0e0,  "Reserved", "Reserved" },
-    { 0x173, 1.0e0,  "Reserved", "Reserved" },
-    { 0x174, 1.0e0,  "Reserved", "Reserved" },
-    { 0x175, 1.0e0,  "Reserved", "Reserved" },
-    { 0x176, 1.0e0,  "Reserved", "Reserved" },
-    { 0x177, 1.0e0,  "Reserved", "Reserved" },
-    { 0x178, 1.0e0,  "Reserved", "Reserved" },
-    { 0x179, 1.0e0,  "Reserved", "Reserved" },
-    { 0x17A, 1.0e0,  "Reserved", "Reserved" },
-    { 0x17B, 1.0e0,  "Reserved", "Reserved" },
-    { 0x17C, 1.0e0,  "Reserved", "Reserved" },
-    { 0x17D, 1.0e0,  "Reserved", "Reserved" },
-    { 0x17E, 1.0e0,  "Reserved", "Reserved" },
-    { 0x17F, 1.0e0,  "Reserved", "Reserved" },
+    [0x171] = { 0x171, 1.0e0,  "Reserved", "Reserved" },
+    [0x172] = { 0x172, 1.0e0,  "Reserved", "Reserved" },
+    [0x173] = { 0x173, 1.0e0,  "Reserved", "Reserved" },
+    [0x174] = { 0x174, 1.0e0,  "Reserved", "Reserved" },
+    [0x175] = { 0x175, 1.0e0,  "Reserved", "Reserved" },
+    [0x176] = { 0x176, 1.0e0,  "Reserved", "Reserved" },
+    [0x177] = { 0x177, 1.0e0,  "Reserved", "Reserved" },
+    [0x178] = { 0x178, 1.0e0,  "Reserved", "Reserved" },
+    [0x179] = { 0x179, 1.0e0,  "Reserved", "Reserved" },
+    [0x17A] = { 0x17A, 1.0e0,  "Reserved", "Reserved" },
+    [0x17B] = { 0x17B, 1.0e0,  "Reserved", "Reserved" },
+    [0x17C] = { 0x17C, 1.0e0,  "Reserved", "Reserved" },
+    [0x17D] = { 0x17D, 1.0e0,  "Reserved", "Reserved" },
+    [0x17E] = { 0x17E, 1.0e0,  "Reserved", "Reserved" },
+    [0x17F] = { 0x17F, 1.0e0,  "Reserved", "Reserved" },
 
 
 /* Alternate VIFE-Code Extension table (following VIF=0FBh for primary VIF)
    See 8.4.4 b, only some of them are here. Using range 0x200 - 0x2FF */
 
     /* E000 000n Energy 10(n-1) MWh 0.1MWh to 1MWh */
-    { 0x200, 1.0e5,  "Wh", "Energy" },
-    { 0x201, 1.0e6,  "Wh", "Energy" },
+    [0x200] = { 0x200, 1.0e5,  "Wh", "Energy" },
+    [0x201] = { 0x201, 1.0e6,  "Wh", "Energy" },
 
     /* E000 001n Reserved */
-    { 0x202, 1.0e0,  "Reserved", "Reserved" },
-    { 0x203, 1.0e0,  "Reserved", "Reserved" },
+    [0x202] = { 0x202, 1.0e0,  "Reserved", "Reserved" },
+    [0x203] = { 0x203, 1.0e0,  "Reserved", "Reserved" },
 
     /* E000 01nn Reserved */
-    { 0x204, 1.0e0,  "Reserved", "Reserved" },
-    { 0x205, 1.0e0,  "Reserved", "Reserved" },
-    { 0x206, 1.0e0,  "Reserved", "Reserved" },
-    { 0x207, 1.0e0,  "Reserved", "Reserved" },
+    [0x204] = { 0x204, 1.0e0,  "Reserved", "Reserved" },
+    [0x205] = { 0x205, 1.0e0,  "Reserved", "Reserved" },
+    [0x206] = { 0x206, 1.0e0,  "Reserved", "Reserved" },
+    [0x207] = { 0x207, 1.0e0,  "Reserved", "Reserved" },
 
     /* E000 100n Energy 10(n-1) GJ 0.1GJ to 1GJ */
-    { 0x208, 1.0e8,  "Reserved", "Energy" },
-    { 0x209, 1.0e9,  "Reserved", "Energy" },
+    [0x208] = { 0x208, 1.0e8,  "Reserved", "Energy" },
+    [0x209] = { 0x209, 1.0e9,  "Reserved", "Energy" },
 
     /* E000 101n Reserved */
-    { 0x20A, 1.0e0,  "Reserved", "Reserved" },
-    { 0x20B, 1.0e0,  "Reserved", "Reserved" },
+    [0x20A] = { 0x20A, 1.0e0,  "Reserved", "Reserved" },
+    [0x20B] = { 0x20B, 1.0e0,  "Reserved", "Reserved" },
 
     /* E000 11nn Reserved */
-    { 0x20C, 1.0e0,  "Reserved", "Reserved" },
-    { 0x20D, 1.0e0,  "Reserved", "Reserved" },
-    { 0x20E, 1.0e0,  "Reserved", "Reserved" },
-    { 0x20F, 1.0e0,  "Reserved", "Reserved" },
+    [0x20C] = { 0x20C, 1.0e0,  "Reserved", "Reserved" },
+    [0x20D] = { 0x20D, 1.0e0,  "Reserved", "Reserved" },
+    [0x20E] = { 0x20E, 1.0e0,  "Reserved", "Reserved" },
+    [0x20F] = { 0x20F, 1.0e0,  "Reserved", "Reserved" },
 
     /* E001 000n Volume 10(n+2) m3 100m3 to 1000m3 */
-    { 0x210, 1.0e2,  "m^3", "Volume" },
-    { 0x211, 1.0e3,  "m^3", "Volume" },
+    [0x210] = { 0x210, 1.0e2,  "m^3", "Volume" },
+    [0x211] = { 0x211, 1.0e3,  "m^3", "Volume" },
 
     /* E001 001n Reserved */
-    { 0x212, 1.0e0,  "Reserved", "Reserved" },
-    { 0x213, 1.0e0,  "Reserved", "Reserved" },
+    [0x212] = { 0x212, 1.0e0,  "Reserved", "Reserved" },
+    [0x213] = { 0x213, 1.0e0,  "Reserved", "Reserved" },
 
     /* E001 01nn Reserved */
-    { 0x214, 1.0e0,  "Reserved", "Reserved" },
-    { 0x215, 1.0e0,  "Reserved", "Reserved" },
-    { 0x216, 1.0e0,  "Reserved", "Reserved" },
-    { 0x217, 1.0e0,  "Reserved", "Reserved" },
+    [0x214] = { 0x214, 1.0e0,  "Reserved", "Reserved" },
+    [0x215] = { 0x215, 1.0e0,  "Reserved", "Reserved" },
+    [0x216] = { 0x216, 1.0e0,  "Reserved", "Reserved" },
+    [0x217] = { 0x217, 1.0e0,  "Reserved", "Reserved" },
 
     /* E001 100n Mass 10(n+2) t 100t to 1000t */
-    { 0x218, 1.0e5,  "kg", "Mass" },
-    { 0x219, 1.0e6,  "kg", "Mass" },
+    [0x218] = { 0x218, 1.0e5,  "kg", "Mass" },
+    [0x219] = { 0x219, 1.0e6,  "kg", "Mass" },
 
     /* E001 1010 to E010 0000 Reserved */
-    { 0x21A, 1.0e0,  "Reserved", "Reserved" },
-    { 0x21B, 1.0e0,  "Reserved", "Reserved" },
-    { 0x21C, 1.0e0,  "Reserved", "Reserved" },
-    { 0x21D, 1.0e0,  "Reserved", "Reserved" },
-    { 0x21E, 1.0e0,  "Reserved", "Reserved" },
-    { 0x21F, 1.0e0,  "Reserved", "Reserved" },
-    { 0x220, 1.0e0,  "Reserved", "Reserved" },
+    [0x21A] = { 0x21A, 1.0e0,  "Reserved", "Reserved" },
+    [0x21B] = { 0x21B, 1.0e0,  "Reserved", "Reserved" },
+    [0x21C] = { 0x21C, 1.0e0,  "Reserved", "Reserved" },
+    [0x21D] = { 0x21D, 1.0e0,  "Reserved", "Reserved" },
+    [0x21E] = { 0x21E, 1.0e0,  "Reserved", "Reserved" },
+    [0x21F] = { 0x21F, 1.0e0,  "Reserved", "Reserved" },
+    [0x220] = { 0x220, 1.0e0,  "Reserved", "Reserved" },
 
     /* E010 0001 Volume 0,1 feet^3 */
-    { 0x221, 1.0e-1, "feet^3", "Volume" },
+    [0x221] = { 0x221, 1.0e-1, "feet^3", "Volume" },
 
     /* E010 001n Volume 0,1-1 american gallon */
-    { 0x222, 1.0e-1, "American gallon", "Volume" },
-    { 0x223, 1.0e-0, "American gallon", "Volume" },
+    [0x222] = { 0x222, 1.0e-1, "American gallon", "Volume" },
+    [0x223] = { 0x223, 1.0e-0, "American gallon", "Volume" },
 
     /* E010 0100    Volume flow 0,001 american gallon/min */
-    { 0x224, 1.0e-3, "American gallon/min", "Volume flow" },
+    [0x224] = { 0x224, 1.0e-3, "American gallon/min", "Volume flow" },
 
     /* E010 0101 Volume flow 1 american gallon/min */
-    { 0x225, 1.0e0,  "American gallon/min", "Volume flow" },
+    [0x225] = { 0x225, 1.0e0,  "American gallon/min", "Volume flow" },
 
     /* E010 0110 Volume flow 1 american gallon/h */
-    { 0x226, 1.0e0,  "American gallon/h", "Volume flow" },
+    [0x226] = { 0x226, 1.0e0,  "American gallon/h", "Volume flow" },
 
     /* E010 0111 Reserved */
-    { 0x227, 1.0e0, "Reserved", "Reserved" },
+    [0x227] = { 0x227, 1.0e0, "Reserved", "Reserved" },
 
     /* E010 100n Power 10(n-1) MW 0.1MW to 1MW */
-    { 0x228, 1.0e5, "W", "Power" },
-    { 0x229, 1.0e6, "W", "Power" },
+    [0x228] = { 0x228, 1.0e5, "W", "Power" },
+    [0x229] = { 0x229, 1.0e6, "W", "Power" },
 
     /* E010 101n Reserved */
-    { 0x22A, 1.0e0, "Reserved", "Reserved" },
-    { 0x22B, 1.0e0, "Reserved", "Reserved" },
+    [0x22A] = { 0x22A, 1.0e0, "Reserved", "Reserved" },
+    [0x22B] = { 0x22B, 1.0e0, "Reserved", "Reserved" },
 
     /* E010 11nn Reserved */
-    { 0x22C, 1.0e0, "Reserved", "Reserved" },
-    { 0x22D, 1.0e0, "Reserved", "Reserved" },
-    { 0x22E, 1.0e0, "Reserved", "Reserved" },
-    { 0x22F, 1.0e0, "Reserved", "Reserved" },
+    [0x22C] = { 0x22C, 1.0e0, "Reserved", "Reserved" },
+    [0x22D] = { 0x22D, 1.0e0, "Reserved", "Reserved" },
+    [0x22E] = { 0x22E, 1.0e0, "Reserved", "Reserved" },
+    [0x22F] = { 0x22F, 1.0e0, "Reserved", "Reserved" },
 
     /* E011 000n Power 10(n-1) GJ/h 0.1GJ/h to 1GJ/h */
-    { 0x230, 1.0e8, "J", "Power" },
-    { 0x231, 1.0e9, "J", "Power" },
+    [0x230] = { 0x230, 1.0e8, "J", "Power" },
+    [0x231] = { 0x231, 1.0e9, "J", "Power" },
 
     /* E011 0010 to E101 0111 Reserved */
-    { 0x232, 1.0e0, "Reserved", "Reserved" },
-    { 0x233, 1.0e0, "Reserved", "Reserved" },
-    { 0x234, 1.0e0, "Reserved", "Reserved" },
-    { 0x235, 1.0e0, "Reserved", "Reserved" },
-    { 0x236, 1.0e0, "Reserved", "Reserved" },
-    { 0x237, 1.0e0, "Reserved", "Reserved" },
-    { 0x238, 1.0e0, "Reserved", "Reserved" },
-    { 0x239, 1.0e0, "Reserved", "Reserved" },
-    { 0x23A, 1.0e0, "Reserved", "Reserved" },
-    { 0x23B, 1.0e0, "Reserved", "Reserved" },
-    { 0x23C, 1.0e0, "Reserved", "Reserved" },
-    { 0x23D, 1.0e0, "Reserved", "Reserved" },
-    { 0x23E, 1.0e0, "Reserved", "Reserved" },
-    { 0x23F, 1.0e0, "Reserved", "Reserved" },
-    { 0x240, 1.0e0, "Reserved", "Reserved" },
-    { 0x241, 1.0e0, "Reserved", "Reserved" },
-    { 0x242, 1.0e0, "Reserved", "Reserved" },
-    { 0x243, 1.0e0, "Reserved", "Reserved" },
-    { 0x244, 1.0e0, "Reserved", "Reserved" },
-    { 0x245, 1.0e0, "Reserved", "Reserved" },
-    { 0x246, 1.0e0, "Reserved", "Reserved" },
-    { 0x247, 1.0e0, "Reserved", "Reserved" },
-    { 0x248, 1.0e0, "Reserved", "Reserved" },
-    { 0x249, 1.0e0, "Reserved", "Reserved" },
-    { 0x24A, 1.0e0, "Reserved", "Reserved" },
-    { 0x24B, 1.0e0, "Reserved", "Reserved" },
-    { 0x24C, 1.0e0, "Reserved", "Reserved" },
-    { 0x24D, 1.0e0, "Reserved", "Reserved" },
-    { 0x24E, 1.0e0, "Reserved", "Reserved" },
-    { 0x24F, 1.0e0, "Reserved", "Reserved" },
-    { 0x250, 1.0e0, "Reserved", "Reserved" },
-    { 0x251, 1.0e0, "Reserved", "Reserved" },
-    { 0x252, 1.0e0, "Reserved", "Reserved" },
-    { 0x253, 1.0e0, "Reserved", "Reserved" },
-    { 0x254, 1.0e0, "Reserved", "Reserved" },
-    { 0x255, 1.0e0, "Reserved", "Reserved" },
-    { 0x256, 1.0e0, "Reserved", "Reserved" },
-    { 0x257, 1.0e0, "Reserved", "Reserved" },
+    [0x232] = { 0x232, 1.0e0, "Reserved", "Reserved" },
+    [0x233] = { 0x233, 1.0e0, "Reserved", "Reserved" },
+    [0x234] = { 0x234, 1.0e0, "Reserved", "Reserved" },
+    [0x235] = { 0x235, 1.0e0, "Reserved", "Reserved" },
+    [0x236] = { 0x236, 1.0e0, "Reserved", "Reserved" },
+    [0x237] = { 0x237, 1.0e0, "Reserved", "Reserved" },
+    [0x238] = { 0x238, 1.0e0, "Reserved", "Reserved" },
+    [0x239] = { 0x239, 1.0e0, "Reserved", "Reserved" },
+    [0x23A] = { 0x23A, 1.0e0, "Reserved", "Reserved" },
+    [0x23B] = { 0x23B, 1.0e0, "Reserved", "Reserved" },
+    [0x23C] = { 0x23C, 1.0e0, "Reserved", "Reserved" },
+    [0x23D] = { 0x23D, 1.0e0, "Reserved", "Reserved" },
+    [0x23E] = { 0x23E, 1.0e0, "Reserved", "Reserved" },
+    [0x23F] = { 0x23F, 1.0e0, "Reserved", "Reserved" },
+    [0x240] = { 0x240, 1.0e0, "Reserved", "Reserved" },
+    [0x241] = { 0x241, 1.0e0, "Reserved", "Reserved" },
+    [0x242] = { 0x242, 1.0e0, "Reserved", "Reserved" },
+    [0x243] = { 0x243, 1.0e0, "Reserved", "Reserved" },
+    [0x244] = { 0x244, 1.0e0, "Reserved", "Reserved" },
+    [0x245] = { 0x245, 1.0e0, "Reserved", "Reserved" },
+    [0x246] = { 0x246, 1.0e0, "Reserved", "Reserved" },
+    [0x247] = { 0x247, 1.0e0, "Reserved", "Reserved" },
+    [0x248] = { 0x248, 1.0e0, "Reserved", "Reserved" },
+    [0x249] = { 0x249, 1.0e0, "Reserved", "Reserved" },
+    [0x24A] = { 0x24A, 1.0e0, "Reserved", "Reserved" },
+    [0x24B] = { 0x24B, 1.0e0, "Reserved", "Reserved" },
+    [0x24C] = { 0x24C, 1.0e0, "Reserved", "Reserved" },
+    [0x24D] = { 0x24D, 1.0e0, "Reserved", "Reserved" },
+    [0x24E] = { 0x24E, 1.0e0, "Reserved", "Reserved" },
+    [0x24F] = { 0x24F, 1.0e0, "Reserved", "Reserved" },
+    [0x250] = { 0x250, 1.0e0, "Reserved", "Reserved" },
+    [0x251] = { 0x251, 1.0e0, "Reserved", "Reserved" },
+    [0x252] = { 0x252, 1.0e0, "Reserved", "Reserved" },
+    [0x253] = { 0x253, 1.0e0, "Reserved", "Reserved" },
+    [0x254] = { 0x254, 1.0e0, "Reserved", "Reserved" },
+    [0x255] = { 0x255, 1.0e0, "Reserved", "Reserved" },
+    [0x256] = { 0x256, 1.0e0, "Reserved", "Reserved" },
+    [0x257] = { 0x257, 1.0e0, "Reserved", "Reserved" },
 
     /* E101 10nn Flow Temperature 10(nn-3) °F 0.001°F to 1°F */
-    { 0x258, 1.0e-3, "°F", "Flow temperature" },
-    { 0x259, 1.0e-2, "°F", "Flow temperature" },
-    { 0x25A, 1.0e-1, "°F", "Flow temperature" },
-    { 0x25B, 1.0e0,  "°F", "Flow temperature" },
+    [0x258] = { 0x258, 1.0e-3, "°F", "Flow temperature" },
+    [0x259] = { 0x259, 1.0e-2, "°F", "Flow temperature" },
+    [0x25A] = { 0x25A, 1.0e-1, "°F", "Flow temperature" },
+    [0x25B] = { 0x25B, 1.0e0,  "°F", "Flow temperature" },
 
     /* E101 11nn Return Temperature 10(nn-3) °F 0.001°F to 1°F */
-    { 0x25C, 1.0e-3, "°F", "Return temperature" },
-    { 0x25D, 1.0e-2, "°F", "Return temperature" },
-    { 0x25E, 1.0e-1, "°F", "Return temperature" },
-    { 0x25F, 1.0e0,  "°F", "Return temperature" },
+    [0x25C] = { 0x25C, 1.0e-3, "°F", "Return temperature" },
+    [0x25D] = { 0x25D, 1.0e-2, "°F", "Return temperature" },
+    [0x25E] = { 0x25E, 1.0e-1, "°F", "Return temperature" },
+    [0x25F] = { 0x25F, 1.0e0,  "°F", "Return temperature" },
 
     /* E110 00nn Temperature Difference 10(nn-3) °F 0.001°F to 1°F */
-    { 0x260, 1.0e-3, "°F", "Temperature difference" },
-    { 0x261, 1.0e-2, "°F", "Temperature difference" },
-    { 0x262, 1.0e-1, "°F", "Temperature difference" },
-    { 0x263, 1.0e0,  "°F", "Temperature difference" },
+    [0x260] = { 0x260, 1.0e-3, "°F", "Temperature difference" },
+    [0x261] = { 0x261, 1.0e-2, "°F", "Temperature difference" },
+    [0x262] = { 0x262, 1.0e-1, "°F", "Temperature difference" },
+    [0x263] = { 0x263, 1.0e0,  "°F", "Temperature difference" },
 
     /* E110 01nn External Temperature 10(nn-3) °F 0.001°F to 1°F */
-    { 0x264, 1.0e-3, "°F", "External temperature" },
-    { 0x265, 1.0e-2, "°F", "External temperature" },
-    { 0x266, 1.0e-1, "°F", "External temperature" },
-    { 0x267, 1.0e0,  "°F", "External temperature" },
+    [0x264] = { 0x264, 1.0e-3, "°F", "External temperature" },
+    [0x265] = { 0x265, 1.0e-2, "°F", "External temperature" },
+    [0x266] = { 0x266, 1.0e-1, "°F", "External temperature" },
+    [0x267] = { 0x267, 1.0e0,  "°F", "External temperature" },
 
     /* E110 1nnn Reserved */
-    { 0x268, 1.0e0, "Reserved", "Reserved" },
-    { 0x269, 1.0e0, "Reserved", "Reserved" },
-    { 0x26A, 1.0e0, "Reserved", "Reserved" },
-    { 0x26B, 1.0e0, "Reserved", "Reserved" },
-    { 0x26C, 1.0e0, "Reserved", "Reserved" },
-    { 0x26D, 1.0e0, "Reserved", "Reserved" },
-    { 0x26E, 1.0e0, "Reserved", "Reserved" },
-    { 0x26F, 1.0e0, "Reserved", "Reserved" },
+    [0x268] = { 0x268, 1.0e0, "Reserved", "Reserved" },
+    [0x269] = { 0x269, 1.0e0, "Reserved", "Reserved" },
+    [0x26A] = { 0x26A, 1.0e0, "Reserved", "Reserved" },
+    [0x26B] = { 0x26B, 1.0e0, "Reserved", "Reserved" },
+    [0x26C] = { 0x26C, 1.0e0, "Reserved", "Reserved" },
+    [0x26D] = { 0x26D, 1.0e0, "Reserved", "Reserved" },
+    [0x26E] = { 0x26E, 1.0e0, "Reserved", "Reserved" },
+    [0x26F] = { 0x26F, 1.0e0, "Reserved", "Reserved" },
 
     /* E111 00nn Cold / Warm Temperature Limit 10(nn-3) °F 0.001°F to 1°F */
-    { 0x270, 1.0e-3, "°F", "Cold / Warm Temperature Limit" },
-    { 0x271, 1.0e-2, "°F", "Cold / Warm Temperature Limit" },
-    { 0x272, 1.0e-1, "°F", "Cold / Warm Temperature Limit" },
-    { 0x273, 1.0e0,  "°F", "Cold / Warm Temperature Limit" },
+    [0x270] = { 0x270, 1.0e-3, "°F", "Cold / Warm Temperature Limit" },
+    [0x271] = { 0x271, 1.0e-2, "°F", "Cold / Warm Temperature Limit" },
+    [0x272] = { 0x272, 1.0e-1, "°F", "Cold / Warm Temperature Limit" },
+    [0x273] = { 0x273, 1.0e0,  "°F", "Cold / Warm Temperature Limit" },
 
     /* E111 01nn Cold / Warm Temperature Limit 10(nn-3) °C 0.001°C to 1°C */
-    { 0x274, 1.0e-3, "°C", "Cold / Warm Temperature Limit" },
-    { 0x275, 1.0e-2, "°C", "Cold / Warm Temperature Limit" },
-    { 0x276, 1.0e-1, "°C", "Cold / Warm Temperature Limit" },
-    { 0x277, 1.0e0,  "°C", "Cold / Warm Temperature Limit" },
+    [0x274] = { 0x274, 1.0e-3, "°C", "Cold / Warm Temperature Limit" },
+    [0x275] = { 0x275, 1.0e-2, "°C", "Cold / Warm Temperature Limit" },
+    [0x276] = { 0x276, 1.0e-1, "°C", "Cold / Warm Temperature Limit" },
+    [0x277] = { 0x277, 1.0e0,  "°C", "Cold / Warm Temperature Limit" },
 
     /* E111 1nnn cumul. count max power § 10(nnn-3) W 0.001W to 10000W */
-    { 0x278, 1.0e-3, "W", "Cumul count max power" },
-    { 0x279, 1.0e-3, "W", "Cumul count max power" },
-    { 0x27A, 1.0e-1, "W", "Cumul count max power" },
-    { 0x27B, 1.0e0,  "W", "Cumul count max power" },
-    { 0x27C, 1.0e1,  "W", "Cumul count max power" },
-    { 0x27D, 1.0e2,  "W", "Cumul count max power" },
-    { 0x27E, 1.0e3,  "W", "Cumul count max power" },
-    { 0x27F, 1.0e4,  "W", "Cumul count max power" },
-
-/* End of array */
-    { 0xFFFF, 0.0, "", "" },
+    [0x278] = { 0x278, 1.0e-3, "W", "Cumul count max power" },
+    [0x279] = { 0x279, 1.0e-3, "W", "Cumul count max power" },
+    [0x27A] = { 0x27A, 1.0e-1, "W", "Cumul count max power" },
+    [0x27B] = { 0x27B, 1.0e0,  "W", "Cumul count max power" },
+    [0x27C] = { 0x27C, 1.0e1,  "W", "Cumul count max power" },
+    [0x27D] = { 0x27D, 1.0e2,  "W", "Cumul count max power" },
+    [0x27E] = { 0x27E, 1.0e3,  "W", "Cumul count max power" },
+    [0x27F] = { 0x27F, 1.0e4,  "W", "Cumul count max power" },
+
 };
 
 
-mbus_variable_vif fixed_table[] = {
+static const mbus_variable_vif fixed_table[0x40] = {
     /* 00, 01 left out */
-    { 0x02, 1.0e0, "Wh", "Energy" },
-    { 0x03, 1.0e1, "Wh", "Energy" },
-    { 0x04, 1.0e2, "Wh", "Energy" },
-    { 0x05, 1.0e3, "Wh", "Energy" },
-    { 0x06, 1.0e4, "Wh", "Energy" },
-    { 0x07, 1.0e5, "Wh", "Energy" },
-    { 0x08, 1.0e6, "Wh", "Energy" },
-    { 0x09, 1.0e7, "Wh", "Energy" },
-    { 0x0A, 1.0e8, "Wh", "Energy" },
-
-    { 0x0B, 1.0e3, "J", "Energy" },
-    { 0x0C, 1.0e4, "J", "Energy" },
-    { 0x0D, 1.0e5, "J", "Energy" },
-    { 0x0E, 1.0e6, "J", "Energy" },
-    { 0x0F, 1.0e7, "J", "Energy" },
-    { 0x10, 1.0e8, "J", "Energy" },
-    { 0x11, 1.0e9, "J", "Energy" },
-    { 0x12, 1.0e10,"J", "Energy" },
-    { 0x13, 1.0e11,"J", "Energy" },
-
-    { 0x14, 1.0e0, "W", "Power" },
-    { 0x15, 1.0e0, "W", "Power" },
-    { 0x16, 1.0e0, "W", "Power" },
-    { 0x17, 1.0e0, "W", "Power" },
-    { 0x18, 1.0e0, "W", "Power" },
-    { 0x19, 1.0e0, "W", "Power" },
-    { 0x1A, 1.0e0, "W", "Power" },
-    { 0x1B, 1.0e0, "W", "Power" },
-    { 0x1C, 1.0e0, "W", "Power" },
-
-    { 0x1D, 1.0e3, "J/h", "Energy" },
-    { 0x1E, 1.0e4, "J/h", "Energy" },
-    { 0x1F, 1.0e5, "J/h", "Energy" },
-    { 0x20, 1.0e6, "J/h", "Energy" },
-    { 0x21, 1.0e7, "J/h", "Energy" },
-    { 0x22, 1.0e8, "J/h", "Energy" },
-    { 0x23, 1.0e9, "J/h", "Energy" },
-    { 0x24, 1.0e10,"J/h", "Energy" },
-    { 0x25, 1.0e11,"J/h", "Energy" },
-
-    { 0x26, 1.0e-6,"m^3", "Volume" },
-    { 0x27, 1.0e-5,"m^3", "Volume" },
-    { 0x28, 1.0e-4,"m^3", "Volume" },
-    { 0x29, 1.0e-3,"m^3", "Volume" },
-    { 0x2A, 1.0e-2,"m^3", "Volume" },
-    { 0x2B, 1.0e-1,"m^3", "Volume" },
-    { 0x2C, 1.0e0, "m^3", "Volume" },
-    { 0x2D, 1.0e1, "m^3", "Volume" },
-    { 0x2E, 1.0e2, "m^3", "Volume" },
-
-    { 0x2F, 1.0e-5,"m^3/h", "Volume flow" },
-    { 0x31, 1.0e-4,"m^3/h", "Volume flow" },
-    { 0x32, 1.0e-3,"m^3/h", "Volume flow" },
-    { 0x33, 1.0e-2,"m^3/h", "Volume flow" },
-    { 0x34, 1.0e-1,"m^3/h", "Volume flow" },
-    { 0x35, 1.0e0, "m^3/h", "Volume flow" },
-    { 0x36, 1.0e1, "m^3/h", "Volume flow" },
-    { 0x37, 1.0e2, "m^3/h", "Volume flow" },
-
-    { 0x38, 1.0e-3, "°C", "Temperature" },
-
-    { 0x39, 1.0e0,  "Units for H.C.A.", "H.C.A." },
-
-    { 0x3A, 0.0,  "Reserved", "Reserved" },
-    { 0x3B, 0.0,  "Reserved", "Reserved" },
-    { 0x3C, 0.0,  "Reserved", "Reserved" },
-    { 0x3D, 0.0,  "Reserved", "Reserved" },
-
-    { 0x3E, 1.0e0,  "", "historic" },
-
-    { 0x3F, 1.0e0,  "", "No units" },
-
-/* end of array */
-    { 0xFFFF, 0.0, "", "" },
+    [0x02] = { 0x02, 1.0e0, "Wh", "Energy" },
+    [0x03] = { 0x03, 1.0e1, "Wh", "Energy" },
+    [0x04] = { 0x04, 1.0e2, "Wh", "Energy" },
+    [0x05] = { 0x05, 1.0e3, "Wh", "Energy" },
+    [0x06] = { 0x06, 1.0e4, "Wh", "Energy" },
+    [0x07] = { 0x07, 1.0e5, "Wh", "Energy" },
+    [0x08] = { 0x08, 1.0e6, "Wh", "Energy" },
+    [0x09] = { 0x09, 1.0e7, "Wh", "Energy" },
+    [0x0A] = { 0x0A, 1.0e8, "Wh", "Energy" },
+
+    [0x0B] = { 0x0B, 1.0e3, "J", "Energy" },
+    [0x0C] = { 0x0C, 1.0e4, "J", "Energy" },
+    [0x0D] = { 0x0D, 1.0e5, "J", "Energy" },
+    [0x0E] = { 0x0E, 1.0e6, "J", "Energy" },
+    [0x0F] = { 0x0F, 1.0e7, "J", "Energy" },
+    [0x10] = { 0x10, 1.0e8, "J", "Energy" },
+    [0x11] = { 0x11, 1.0e9, "J", "Energy" },
+    [0x12] = { 0x12, 1.0e10,"J", "Energy" },
+    [0x13] = { 0x13, 1.0e11,"J", "Energy" },
+
+    [0x14] = { 0x14, 1.0e0, "W", "Power" },
+    [0x15] = { 0x15, 1.0e0, "W", "Power" },
+    [0x16] = { 0x16, 1.0e0, "W", "Power" },
+    [0x17] = { 0x17, 1.0e0, "W", "Power" },
+    [0x18] = { 0x18, 1.0e0, "W", "Power" },
+    [0x19] = { 0x19, 1.0e0, "W", "Power" },
+    [0x1A] = { 0x1A, 1.0e0, "W", "Power" },
+    [0x1B] = { 0x1B, 1.0e0, "W", "Power" },
+    [0x1C] = { 0x1C, 1.0e0, "W", "Power" },
+
+    [0x1D] = { 0x1D, 1.0e3, "J/h", "Energy" },
+    [0x1E] = { 0x1E, 1.0e4, "J/h", "Energy" },
+    [0x1F] = { 0x1F, 1.0e5, "J/h", "Energy" },
+    [0x20] = { 0x20, 1.0e6, "J/h", "Energy" },
+    [0x21] = { 0x21, 1.0e7, "J/h", "Energy" },
+    [0x22] = { 0x22, 1.0e8, "J/h", "Energy" },
+    [0x23] = { 0x23, 1.0e9, "J/h", "Energy" },
+    [0x24] = { 0x24, 1.0e10,"J/h", "Energy" },
+    [0x25] = { 0x25, 1.0e11,"J/h", "Energy" },
+
+    [0x26] = { 0x26, 1.0e-6,"m^3", "Volume" },
+    [0x27] = { 0x27, 1.0e-5,"m^3", "Volume" },
+    [0x28] = { 0x28, 1.0e-4,"m^3", "Volume" },
+    [0x29] = { 0x29, 1.0e-3,"m^3", "Volume" },
+    [0x2A] = { 0x2A, 1.0e-2,"m^3", "Volume" },
+    [0x2B] = { 0x2B, 1.0e-1,"m^3", "Volume" },
+    [0x2C] = { 0x2C, 1.0e0, "m^3", "Volume" },
+    [0x2D] = { 0x2D, 1.0e1, "m^3", "Volume" },
+    [0x2E] = { 0x2E, 1.0e2, "m^3", "Volume" },
+
+    [0x2F] = { 0x2F, 1.0e-5,"m^3/h", "Volume flow" },
+    [0x31] = { 0x31, 1.0e-4,"m^3/h", "Volume flow" },
+    [0x32] = { 0x32, 1.0e-3,"m^3/h", "Volume flow" },
+    [0x33] = { 0x33, 1.0e-2,"m^3/h", "Volume flow" },
+    [0x34] = { 0x34, 1.0e-1,"m^3/h", "Volume flow" },
+    [0x35] = { 0x35, 1.0e0, "m^3/h", "Volume flow" },
+    [0x36] = { 0x36, 1.0e1, "m^3/h", "Volume flow" },
+    [0x37] = { 0x37, 1.0e2, "m^3/h", "Volume flow" },
+
+    [0x38] = { 0x38, 1.0e-3, "°C", "Temperature" },
+
+    [0x39] = { 0x39, 1.0e0,  "Units for H.C.A.", "H.C.A." },
+
+    [0x3A] = { 0x3A, 0.0,  "Reserved", "Reserved" },
+    [0x3B] = { 0x3B, 0.0,  "Reserved", "Reserved" },
+    [0x3C] = { 0x3C, 0.0,  "Reserved", "Reserved" },
+    [0x3D] = { 0x3D, 0.0,  "Reserved", "Reserved" },
+
+    [0x3E] = { 0x3E, 1.0e0,  "", "historic" },
+
+    [0x3F] = { 0x3F, 1.0e0,  "", "No units" },
 };
 
 //------------------------------------------------------------------------------
@@ -765,6 +783,32 @@ mbus_register_send_event(mbus_handle * handle, void (*event)(unsigned char src_t
     handle->send_event = event;
 }
 
+int
+mbus_handle_set_capture(mbus_handle *handle, mbus_capture *capture, unsigned int id)
+{
+    if (handle == NULL)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    handle->capture = capture;
+    handle->capture_id = id;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Log a frame sent or received. Records that can't be written are counted
+/// as dropped by the capture log, the traffic goes on.
+//------------------------------------------------------------------------------
+void
+mbus_handle_capture(mbus_handle *handle, int direction, const unsigned char *buff, size_t len)
+{
+    if (handle && handle->capture && len > 0)
+        mbus_capture_write(handle->capture, direction, handle->capture_id, buff, len);
+}
+
 //------------------------------------------------------------------------------
 /// Register a function for the scan progress.
 //------------------------------------------------------------------------------
@@ -783,8 +827,24 @@ mbus_register_found_event(mbus_handle * handle, void (*event)(mbus_handle * hand
     handle->found_event = event;
 }
 
+//------------------------------------------------------------------------------
+/// Return the unit descriptor of a fixed data medium/unit code, NULL if unknown
+//------------------------------------------------------------------------------
+const mbus_variable_vif *
+mbus_fixed_descriptor_lookup(int medium_unit)
+{
+    medium_unit = medium_unit & 0x3F;
+
+    if (fixed_table[medium_unit].unit == NULL)
+        return NULL;
+
+    return &fixed_table[medium_unit];
+}
+
 int mbus_fixed_normalize(int medium_unit, long medium_value, char **unit_out, double *value_out, char **quantity_out)
 {
+    const mbus_variable_vif *desc;
+
     medium_unit = medium_unit & 0x3F;
 
     if (unit_out == NULL || value_out == NULL || quantity_out == NULL)
@@ -805,15 +865,12 @@ int mbus_fixed_normalize(int medium_unit, long medium_value, char **unit_out, do
             break;
 
     default:
-        for(int i=0; fixed_table[i].vif < 0xfff; ++i)
+        if ((desc = mbus_fixed_descriptor_lookup(medium_unit)) != NULL)
         {
-            if (fixed_table[i].vif == medium_unit)
-            {
-                *unit_out = strdup(fixed_table[i].unit);
-                *value_out = ((double) (medium_value)) * fixed_table[i].exponent;
-                *quantity_out = strdup(fixed_table[i].quantity);
-                return 0;
-            }
+            *unit_out = strdup(desc->unit);
+            *value_out = ((double) (medium_value)) * desc->exponent;
+            *quantity_out = strdup(desc->quantity);
+            return 0;
         }
 
         *unit_out = strdup("Unknown");
@@ -1030,11 +1087,25 @@ int mbus_variable_value_decode(mbus_data_record *record, double *value_out_real,
     return result;
 }
 
+//------------------------------------------------------------------------------
+/// Return the unit descriptor of a VIF code (with 0x100 / 0x200 added for the
+/// 0xFD / 0xFB extension tables), NULL if unknown. The extension bit is ignored.
+//------------------------------------------------------------------------------
+const mbus_variable_vif *
+mbus_vif_descriptor_lookup(int vif)
+{
+    unsigned code = vif & 0xF7F; /* clear extension bit */
+
+    if (code >= NITEMS(vif_table) || vif_table[code].unit == NULL)
+        return NULL;
+
+    return &vif_table[code];
+}
+
 int
-mbus_vif_unit_normalize(int vif, double value, char **unit_out, double *value_out, char **quantity_out)
+mbus_vif_unit_normalize_const(int vif, double value, const char **unit_out, double *value_out, const char **quantity_out)
 {
-    int i;
-    unsigned newVif = vif & 0xF7F; /* clear extension bit */
+    const mbus_variable_vif *desc;
 
     MBUS_DEBUG("vif_unit_normalize = 0x%03X \n", vif);
 
@@ -1044,28 +1115,86 @@ mbus_vif_unit_normalize(int vif, double value, char **unit_out, double *value_ou
         return -1;
     }
 
-    for(i=0; vif_table[i].vif < 0xfff; ++i)
+    if ((desc = mbus_vif_descriptor_lookup(vif)) != NULL)
     {
-        if (vif_table[i].vif == newVif)
-        {
-            *unit_out = strdup(vif_table[i].unit);
-            *value_out = value * vif_table[i].exponent;
-            *quantity_out = strdup(vif_table[i].quantity);
-            return 0;
-        }
+        *unit_out = desc->unit;
+        *value_out = value * desc->exponent;
+        *quantity_out = desc->quantity;
+        return 0;
     }
 
-    MBUS_ERROR("%s: Unknown VIF 0x%03X\n", __PRETTY_FUNCTION__, newVif);
-    *unit_out = strdup("Unknown (VIF=0x%.02X)");
-    *quantity_out = strdup("Unknown");
+    MBUS_ERROR("%s: Unknown VIF 0x%03X\n", __PRETTY_FUNCTION__, vif & 0xF7F);
+    *unit_out = "Unknown (VIF=0x%.02X)";
+    *quantity_out = "Unknown";
     *value_out = 0.0;
     return -1;
 }
 
+int
+mbus_vif_unit_normalize(int vif, double value, char **unit_out, double *value_out, char **quantity_out)
+{
+    const char *unit, *quantity;
+    int ret;
+
+    if (unit_out == NULL || value_out == NULL || quantity_out == NULL)
+    {
+        MBUS_ERROR("%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    ret = mbus_vif_unit_normalize_const(vif, value, &unit, value_out, &quantity);
+
+    *unit_out = strdup(unit);
+    *quantity_out = strdup(quantity);
+
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+/// Correction of the value given by the first VIFE (table 8.4.5): the value
+/// is multiplied by factor, then offset is added.
+//------------------------------------------------------------------------------
+static void
+mbus_vife_correction(mbus_value_information_block *vib, double *factor, double *offset)
+{
+    *factor = 1.0;
+    *offset = 0.0;
+
+    if ((vib->vif & MBUS_DIB_VIF_EXTENSION_BIT) &&
+        (vib->vif != 0xFD) &&
+        (vib->vif != 0xFB))                       /* codes for VIF extention: see table 8.4.5 */
+    {
+        switch ((vib->vife[0]) & 0x7f)
+        {
+            case 0x70:
+            case 0x71:
+            case 0x72:
+            case 0x73:
+            case 0x74:
+            case 0x75:
+            case 0x76:
+            case 0x77: /* Multiplicative correction factor: 10^nnn-6 */
+                *factor = pow(10.0, (vib->vife[0] & 0x07) - 6);
+                break;
+
+            case 0x78:
+            case 0x79:
+            case 0x7A:
+            case 0x7B: /* Additive correction constant: 10^nn-3 unit of VIF (offset) */
+                *offset = pow(10.0, (vib->vife[0] & 0x03) - 3);
+                break;
+
+            case 0x7D: /* Multiplicative correction factor: 10^3 */
+                *factor = 1000.0;
+                break;
+        }
+    }
+}
 
 int
-mbus_vib_unit_normalize(mbus_value_information_block *vib, double value, char **unit_out, double *value_out, char **quantity_out)
+mbus_vib_unit_normalize_const(mbus_value_information_block *vib, double value, const char **unit_out, double *value_out, const char **quantity_out)
 {
+    double factor, offset;
     int code;
 
     if (vib == NULL || unit_out == NULL || value_out == NULL || quantity_out == NULL)
@@ -1085,7 +1214,7 @@ mbus_vib_unit_normalize(mbus_value_information_block *vib, double value, char **
         }
 
         code = ((vib->vife[0]) & MBUS_DIB_VIF_WITHOUT_EXTENSION) | 0x100;
-        if (mbus_vif_unit_normalize(code, value, unit_out, value_out, quantity_out) != 0)
+        if (mbus_vif_unit_normalize_const(code, value, unit_out, value_out, quantity_out) != 0)
         {
             MBUS_ERROR("%s: Error mbus_vif_unit_normalize\n", __PRETTY_FUNCTION__);
             return -1;
@@ -1100,7 +1229,7 @@ mbus_vib_unit_normalize(mbus_value_information_block *vib, double value, char **
             }
 
             code = ((vib->vife[0]) & MBUS_DIB_VIF_WITHOUT_EXTENSION) | 0x200;
-            if (0 != mbus_vif_unit_normalize(code, value, unit_out, value_out, quantity_out))
+            if (0 != mbus_vif_unit_normalize_const(code, value, unit_out, value_out, quantity_out))
             {
                 MBUS_ERROR("%s: Error mbus_vif_unit_normalize\n", __PRETTY_FUNCTION__);
                 return -1;
@@ -1110,14 +1239,14 @@ mbus_vib_unit_normalize(mbus_value_information_block *vib, double value, char **
                  (vib->vif == 0xFC))
         {
             // custom VIF
-            *unit_out = strdup("-");
-            *quantity_out = strdup(vib->custom_vif);
+            *unit_out = "-";
+            *quantity_out = (const char *) vib->custom_vif;
             *value_out = value;
         }
         else
         {
             code = (vib->vif) & MBUS_DIB_VIF_WITHOUT_EXTENSION;
-            if (0 != mbus_vif_unit_normalize(code, value, unit_out, value_out, quantity_out))
+            if (0 != mbus_vif_unit_normalize_const(code, value, unit_out, value_out, quantity_out))
             {
                 MBUS_ERROR("%s: Error mbus_vif_unit_normalize\n", __PRETTY_FUNCTION__);
                 return -1;
@@ -1125,612 +1254,2577 @@ mbus_vib_unit_normalize(mbus_value_information_block *vib, double value, char **
         }
     }
 
-    if ((vib->vif & MBUS_DIB_VIF_EXTENSION_BIT) &&
-        (vib->vif != 0xFD) &&
-        (vib->vif != 0xFB))                       /* codes for VIF extention: see table 8.4.5 */
-    {
-        code = (vib->vife[0]) & 0x7f;
-        switch (code)
-        {
-            case 0x70:
-            case 0x71:
-            case 0x72:
-            case 0x73:
-            case 0x74:
-            case 0x75:
-            case 0x76:
-            case 0x77: /* Multiplicative correction factor: 10^nnn-6 */
-                *value_out *= pow(10.0, (vib->vife[0] & 0x07) - 6);
-                break;
+    mbus_vife_correction(vib, &factor, &offset);
 
-            case 0x78:
-            case 0x79:
-            case 0x7A:
-            case 0x7B: /* Additive correction constant: 10^nn-3 unit of VIF (offset) */
-                *value_out += pow(10.0, (vib->vife[0] & 0x03) - 3);
-                break;
+    if (factor != 1.0)
+        *value_out *= factor;
 
-            case 0x7D: /* Multiplicative correction factor: 10^3 */
-                *value_out *= 1000.0;
-                break;
-        }
-    }
+    if (offset != 0.0)
+        *value_out += offset;
 
     return 0;
 }
 
-
-mbus_record *
-mbus_record_new()
+//------------------------------------------------------------------------------
+/// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+//------------------------------------------------------------------------------
+static int64_t
+mbus_days_from_civil(int64_t y, int m, int d)
 {
-    mbus_record * record;
+    int64_t era, yoe, doy, doe;
 
-    if (!(record = (mbus_record *) malloc(sizeof(mbus_record))))
-    {
-        MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
-        return NULL;
-    }
+    y -= (m <= 2);
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
 
-    record->value.real_val = 0.0;
-    record->is_numeric = 1;
-    record->unit = NULL;
-    record->function_medium = NULL;
-    record->quantity = NULL;
-    record->device = -1;
-    record->tariff = -1;
-    record->storage_number = 0;
-    return record;
+    return era * 146097 + doe - 719468;
 }
 
+//------------------------------------------------------------------------------
+// Decoders of a layout step, chosen from the DIF (and VIF for time points)
+//------------------------------------------------------------------------------
+#define MBUS_LAYOUT_DECODE_NONE      0
+#define MBUS_LAYOUT_DECODE_INT       1
+#define MBUS_LAYOUT_DECODE_LONG_LONG 2
+#define MBUS_LAYOUT_DECODE_REAL      3
+#define MBUS_LAYOUT_DECODE_BCD       4
+#define MBUS_LAYOUT_DECODE_TIME      5
+#define MBUS_LAYOUT_DECODE_RAW       6
 
-void
-mbus_record_free(mbus_record * rec)
+//------------------------------------------------------------------------------
+/// Work out how the value of a record is decoded, and its type, unit and
+/// exponent, from the DIB and VIB only. The result applies to every record
+/// with the same DIB/VIB, see mbus_typed_value_apply.
+//------------------------------------------------------------------------------
+static int
+mbus_typed_value_plan(mbus_data_record *record, mbus_layout_step *step)
 {
-    if (rec)
+    mbus_value_information_block *vib;
+    mbus_typed_value *value = &(step->value);
+    const mbus_variable_vif *desc = NULL;
+    unsigned char vif, vife;
+    int code = -1;
+
+    memset((void *)value, 0, sizeof(mbus_typed_value));
+    step->kind = MBUS_LAYOUT_DECODE_NONE;
+    step->width = 0;
+    step->data_len = record->data_len;
+
+    vib = &(record->drh.vib);
+
+    // ignore extension bit
+    vif = (vib->vif & MBUS_DIB_VIF_WITHOUT_EXTENSION);
+    vife = (vib->vife[0] & MBUS_DIB_VIF_WITHOUT_EXTENSION);
+
+    switch (record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_DATA)
     {
-        if (! rec->is_numeric)
-        {
-            free((rec->value).str_val.value);
-            (rec->value).str_val.value = NULL;
-        }
+        case 0x00: /* no data */
+            value->type = MBUS_VALUE_TYPE_NONE;
+            break;
 
-        if (rec->unit)
-        {
-            free(rec->unit);
-            rec->unit = NULL;
-        }
+        case 0x01: /* 1 byte integer (8 bit) */
+        case 0x03: /* 3 byte integer (24 bit) */
+            step->kind = MBUS_LAYOUT_DECODE_INT;
+            step->width = record->drh.dib.dif & 0x03;
+            value->type = MBUS_VALUE_TYPE_INT;
+            break;
 
-        if (rec->function_medium)
-        {
-            free(rec->function_medium);
-            rec->function_medium = NULL;
-        }
+        case 0x02: /* 2 byte integer (16 bit) */
+            if (vif == 0x6C) // Time Point (date)
+            {
+                step->kind = MBUS_LAYOUT_DECODE_TIME;
+                step->width = 2;
+                value->type = MBUS_VALUE_TYPE_TIME;
+                break;
+            }
 
-        if (rec->quantity)
-        {
-            free(rec->quantity);
-            rec->quantity = NULL;
-        }
-        free(rec);
-    }
-}
+            step->kind = MBUS_LAYOUT_DECODE_INT;
+            step->width = 2;
+            value->type = MBUS_VALUE_TYPE_INT;
+            break;
 
+        case 0x04: /* 4 byte integer (32 bit) */
+        case 0x06: /* 6 byte integer (48 bit) */
+            step->width = ((record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_DATA) == 0x04) ? 4 : 6;
 
-mbus_record *
-mbus_parse_fixed_record(char status_byte, char medium_unit, unsigned char *data)
-{
-    long value = 0;
-    mbus_record * record = NULL;
+            // Time Point (date/time), start of tariff, date and time of battery change
+            if ( (vif == 0x6D) ||
+                ((vib->vif == 0xFD) && (vife == 0x30)) ||
+                ((vib->vif == 0xFD) && (vife == 0x70)))
+            {
+                step->kind = MBUS_LAYOUT_DECODE_TIME;
+                value->type = MBUS_VALUE_TYPE_TIME;
+                break;
+            }
 
-    if (!(record = mbus_record_new()))
-    {
-        MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
-        return NULL;
+            step->kind = (step->width == 4) ? MBUS_LAYOUT_DECODE_INT : MBUS_LAYOUT_DECODE_LONG_LONG;
+            value->type = MBUS_VALUE_TYPE_INT;
+            break;
+
+        case 0x05: /* 32b real */
+            step->kind = MBUS_LAYOUT_DECODE_REAL;
+            value->type = MBUS_VALUE_TYPE_REAL;
+            break;
+
+        case 0x07: /* 8 byte integer (64 bit) */
+            step->kind = MBUS_LAYOUT_DECODE_LONG_LONG;
+            step->width = 8;
+            value->type = MBUS_VALUE_TYPE_INT;
+            break;
+
+        case 0x09: /* 2 digit BCD (8 bit) */
+        case 0x0A: /* 4 digit BCD (16 bit) */
+        case 0x0B: /* 6 digit BCD (24 bit) */
+        case 0x0C: /* 8 digit BCD (32 bit) */
+            step->kind = MBUS_LAYOUT_DECODE_BCD;
+            step->width = record->drh.dib.dif & 0x07;
+            value->type = MBUS_VALUE_TYPE_BCD;
+            break;
+
+        case 0x0E: /* 12 digit BCD (40 bit) */
+            step->kind = MBUS_LAYOUT_DECODE_BCD;
+            step->width = 6;
+            value->type = MBUS_VALUE_TYPE_BCD;
+            break;
+
+        case 0x0D: /* variable length */
+            if (record->data_len > 0xBF)
+            {
+                MBUS_ERROR("Non ASCII variable length not implemented yet\n");
+                return -1;
+            }
+            /* fall through */
+
+        case 0x0F: /* Special functions */
+            step->kind = MBUS_LAYOUT_DECODE_RAW;
+            value->type = MBUS_VALUE_TYPE_RAW;
+            break;
+
+        default:
+            MBUS_ERROR("Unknown DIF (0x%.2x)", record->drh.dib.dif);
+            return -1;
     }
 
-    /* shared/static memory - get own copy */
-    record->function_medium = strdup(mbus_data_fixed_function((int)status_byte));  /* stored / actual */
+    // unit and exponent of the VIB, as in mbus_vib_unit_normalize_const
+    value->exponent = 1.0;
 
-    if (record->function_medium == NULL)
+    if (record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC ||
+        record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
     {
-        MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
-        mbus_record_free(record);
-        return NULL;
+        return 0;
     }
 
-    if ((status_byte & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
+    if (vib->vif == 0xFD || vib->vif == 0xFB)
     {
-        value = mbus_data_bcd_decode(data, 4);
+        if (vib->nvife > 0)
+            code = vife | ((vib->vif == 0xFD) ? 0x100 : 0x200);
+    }
+    else if (vib->vif == 0x7C || vib->vif == 0xFC)
+    {
+        value->unit = "-";
+        value->quantity = (const char *) vib->custom_vif;
     }
     else
     {
-        mbus_data_long_decode(data, 4, &value);
+        code = vif;
     }
 
-    record->unit = NULL;
-    record->is_numeric = 1;
-    if (0 != mbus_fixed_normalize(medium_unit, value, &(record->unit), &(record->value.real_val), &(record->quantity)))
+    if (code >= 0 && (desc = mbus_vif_descriptor_lookup(code)) != NULL)
     {
-        MBUS_ERROR("Problem with mbus_fixed_normalize.\n");
-        mbus_record_free(record);
-        return NULL;
+        value->exponent = desc->exponent;
+        value->unit = desc->unit;
+        value->quantity = desc->quantity;
     }
 
-    return record;
-}
+    if (desc || value->unit)
+    {
+        double factor, offset;
 
+        mbus_vife_correction(vib, &factor, &offset);
+        value->exponent *= factor;
+        value->offset = offset;
+    }
 
-mbus_record *
-mbus_parse_variable_record(mbus_data_record *data)
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Decode the data field of a record as worked out by mbus_typed_value_plan
+//------------------------------------------------------------------------------
+static void
+mbus_typed_value_apply(const mbus_layout_step *step, const unsigned char *data, mbus_typed_value *value)
 {
-    mbus_record * record = NULL;
-    double value_out_real    = 0.0;  /**< raw value */
-    char * value_out_str     = NULL;
-    int    value_out_str_size = 0;
-    double real_val         = 0.0;  /**< normalized value */
+    unsigned char *field = (unsigned char *) data;
+    long long value_long_long;
+    int value_int;
 
-    if (data == NULL)
-    {
-        MBUS_ERROR("%s: Invalid record.\n", __PRETTY_FUNCTION__);
-        return NULL;
-    }
+    *value = step->value;
 
-    if (!(record = mbus_record_new()))
+    switch (step->kind)
     {
-        MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
-        return NULL;
-    }
+        case MBUS_LAYOUT_DECODE_INT:
+            mbus_data_int_decode(field, step->width, &value_int);
+            value->value.int_val = value_int;
+            break;
 
-    record->storage_number = mbus_data_record_storage_number(data);
-    record->tariff = mbus_data_record_tariff(data);
-    record->device = mbus_data_record_device(data);
+        case MBUS_LAYOUT_DECODE_LONG_LONG:
+            mbus_data_long_long_decode(field, step->width, &value_long_long);
+            value->value.int_val = value_long_long;
+            break;
 
-    if ((data->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) ||
-        (data->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)) /* MBUS_DIB_DIF_VENDOR_SPECIFIC */
-    {
-        if (data->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
-        {
-            record->function_medium = strdup("More records follow");
-        }
-        else
-        {
-            record->function_medium = strdup("Manufacturer specific");
-        }
+        case MBUS_LAYOUT_DECODE_REAL:
+            value->value.real_val = mbus_data_float_decode(field);
+            break;
 
-        if (record->function_medium == NULL)
-        {
-            MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
-            mbus_record_free(record);
-            return NULL;
-        }
+        case MBUS_LAYOUT_DECODE_BCD:
+            value->value.int_val = mbus_data_bcd_decode(field, step->width);
+            break;
 
-        /* parsing of data not implemented yet
-           manufacturer specific data structures to end of user data */
+        case MBUS_LAYOUT_DECODE_TIME:
+            mbus_data_tm_decode(&(value->value.time_val.tm), field, step->width);
 
-        if (mbus_variable_value_decode(data, &value_out_real, &value_out_str, &value_out_str_size) != 0)
-        {
-            MBUS_ERROR("%s: problem with mbus_variable_value_decode\n", __PRETTY_FUNCTION__);
-            mbus_record_free(record);
-            return NULL;
-        }
+            value->value.time_val.has_time = (step->width > 2);
+            value->value.time_val.epoch = -1;
 
-        if (value_out_str != NULL)
-        {
-            record->is_numeric = 0;
-            (record->value).str_val.value = value_out_str;
-            (record->value).str_val.size = value_out_str_size;
-        }
-        else
-        {
-            record->is_numeric = 1;
-            (record->value).real_val = real_val;
-        }
+            if (value->value.time_val.tm.tm_mday != 0)
+            {
+                value->value.time_val.epoch =
+                    mbus_days_from_civil(value->value.time_val.tm.tm_year + 1900,
+                                         value->value.time_val.tm.tm_mon + 1,
+                                         value->value.time_val.tm.tm_mday) * 86400 +
+                    value->value.time_val.tm.tm_hour * 3600 +
+                    value->value.time_val.tm.tm_min * 60 +
+                    value->value.time_val.tm.tm_sec;
+            }
+            break;
+
+        case MBUS_LAYOUT_DECODE_RAW:
+            value->value.raw.data = data;
+            value->value.raw.len = step->data_len;
+            break;
     }
-    else
+}
+
+//------------------------------------------------------------------------------
+/// Decode the value of a variable data record into a typed value. Follows
+/// mbus_variable_value_decode, but nothing is formatted or allocated.
+//------------------------------------------------------------------------------
+int
+mbus_data_record_typed_value(mbus_data_record *record, mbus_typed_value *value)
+{
+    mbus_layout_step step;
+
+    if (record == NULL || value == NULL)
     {
-        record->function_medium = strdup(mbus_data_record_function(data));
+        MBUS_ERROR("%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
 
-        if (record->function_medium == NULL)
-        {
-            MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
-            mbus_record_free(record);
-            return NULL;
-        }
+    if (mbus_typed_value_plan(record, &step) != 0)
+    {
+        memset((void *)value, 0, sizeof(mbus_typed_value));
+        return -1;
+    }
 
-        MBUS_DEBUG("record->function_medium = %s \n", record->function_medium);
+    mbus_typed_value_apply(&step, record->data, value);
 
-        if (mbus_variable_value_decode(data, &value_out_real, &value_out_str, &value_out_str_size) != 0)
-        {
-            MBUS_ERROR("%s: problem with mbus_variable_value_decode\n", __PRETTY_FUNCTION__);
-            mbus_record_free(record);
-            return NULL;
-        }
-        MBUS_DEBUG("value_out_real = %lf \n", value_out_real);
+    return 0;
+}
 
-        if (mbus_vib_unit_normalize(&(data->drh.vib), value_out_real, &(record->unit), &real_val, &(record->quantity)) != 0)
-        {
-            MBUS_ERROR("%s: problem with mbus_vib_unit_normalize\n", __PRETTY_FUNCTION__);
-            mbus_record_free(record);
-            record = NULL;
-            return NULL;
-        }
-        MBUS_DEBUG("record->unit = %s \n", record->unit);
-        MBUS_DEBUG("real_val = %lf \n", real_val);
+//------------------------------------------------------------------------------
+/// Normalized value of a numerical typed value
+//------------------------------------------------------------------------------
+double
+mbus_typed_value_normalized(const mbus_typed_value *value)
+{
+    double raw;
 
-        if (value_out_str != NULL)
-        {
-            record->is_numeric = 0;
-            (record->value).str_val.value = value_out_str;
-            (record->value).str_val.size = value_out_str_size;
-        }
-        else
-        {
-            record->is_numeric = 1;
-            (record->value).real_val = real_val;
-        }
+    if (value == NULL)
+        return NAN;
+
+    switch (value->type)
+    {
+        case MBUS_VALUE_TYPE_INT:
+        case MBUS_VALUE_TYPE_BCD:
+            raw = (double) value->value.int_val;
+            break;
+
+        case MBUS_VALUE_TYPE_REAL:
+            raw = value->value.real_val;
+            break;
+
+        default:
+            return NAN;
     }
 
-    return record;
+    return raw * value->exponent + value->offset;
 }
 
 //------------------------------------------------------------------------------
-/// Generate XML for variable-length data
+//
+// LAYOUT CACHE
+//
 //------------------------------------------------------------------------------
-char *
-mbus_data_variable_xml_normalized(mbus_data_variable *data)
-{
-    mbus_data_record *record;
-    mbus_record *norm_record;
-    char *buff = NULL, *new_buff = NULL;
-    char str_encoded[768] = "";
-    size_t len = 0, buff_size = 8192;
-    size_t i;
 
-    if (data)
+void
+mbus_layout_cache_init(mbus_layout_cache *cache)
+{
+    if (cache)
     {
-        buff = (char*) malloc(buff_size);
+        memset(cache, 0, sizeof(mbus_layout_cache));
+    }
+}
 
-        if (buff == NULL)
-            return NULL;
+static void
+mbus_layout_plan_free(mbus_layout_plan *plan)
+{
+    mbus_layout_plan *next;
+
+    while (plan)
+    {
+        next = plan->next;
+        mbus_data_record_free(plan->record);
+        free(plan->steps);
+        free(plan);
+        plan = next;
+    }
+}
 
-        len += snprintf(&buff[len], buff_size - len, MBUS_XML_PROCESSING_INSTRUCTION);
+void
+mbus_layout_cache_free(mbus_layout_cache *cache)
+{
+    size_t i;
 
-        len += snprintf(&buff[len], buff_size - len, "<MBusData>\n\n");
+    if (cache == NULL)
+        return;
 
-        len += snprintf(&buff[len], buff_size - len, "%s", mbus_data_variable_header_xml(&(data->header)));
+    for (i = 0; i < cache->size; i++)
+        mbus_layout_plan_free(cache->entries[i].plans);
 
-        for (record = data->record, i = 0; record; record = record->next, i++)
-        {
-            norm_record = mbus_parse_variable_record(record);
+    free(cache->entries);
+    mbus_layout_cache_init(cache);
+}
 
-            if ((buff_size - len) < 1024)
-            {
-                buff_size *= 2;
-                new_buff = (char*) realloc(buff,buff_size);
+//------------------------------------------------------------------------------
+/// Key of a telegram: manufacturer, version, medium, user data length and
+/// the first two bytes of the first record (DIF and DIFE/VIF)
+//------------------------------------------------------------------------------
+static uint64_t
+mbus_layout_key(const mbus_frame *frame)
+{
+    const unsigned char *data = frame->data;
+    uint64_t key;
 
-                if (new_buff == NULL)
-                {
-                    mbus_record_free(norm_record);
-                    free(buff);
-                    return NULL;
-                }
+    key = (uint64_t) data[4] | ((uint64_t) data[5] << 8) |
+          ((uint64_t) data[6] << 16) | ((uint64_t) data[7] << 24) |
+          ((uint64_t) (frame->data_size & 0xFF) << 32);
 
-                buff = new_buff;
-            }
+    if (frame->data_size > MBUS_DATA_VARIABLE_HEADER_LENGTH)
+        key |= (uint64_t) data[MBUS_DATA_VARIABLE_HEADER_LENGTH] << 40;
 
-            len += snprintf(&buff[len], buff_size - len, "    <DataRecord id=\"%zu\">\n", i);
+    if (frame->data_size > MBUS_DATA_VARIABLE_HEADER_LENGTH + 1)
+        key |= (uint64_t) data[MBUS_DATA_VARIABLE_HEADER_LENGTH + 1] << 48;
 
-            if (norm_record != NULL)
-            {
-                mbus_str_xml_encode(str_encoded, norm_record->function_medium, sizeof(str_encoded));
-                len += snprintf(&buff[len], buff_size - len, "        <Function>%s</Function>\n", str_encoded);
+    return key;
+}
 
-                len += snprintf(&buff[len], buff_size - len, "        <StorageNumber>%ld</StorageNumber>\n", norm_record->storage_number);
+static size_t
+mbus_layout_cache_index(const mbus_layout_cache *cache, uint64_t key)
+{
+    size_t i;
 
-                if (norm_record->tariff >= 0)
-                {
-                    len += snprintf(&buff[len], buff_size - len, "        <Tariff>%ld</Tariff>\n", norm_record->tariff);
-                    len += snprintf(&buff[len], buff_size - len, "        <Device>%d</Device>\n", norm_record->device);
-                }
+    // Fibonacci hashing, size is a power of two
+    i = (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (cache->size - 1);
 
-                mbus_str_xml_encode(str_encoded, norm_record->unit, sizeof(str_encoded));
+    while (cache->entries[i].plans && cache->entries[i].key != key)
+        i = (i + 1) & (cache->size - 1);
 
-                len += snprintf(&buff[len], buff_size - len, "        <Unit>%s</Unit>\n", str_encoded);
+    return i;
+}
 
-                mbus_str_xml_encode(str_encoded, norm_record->quantity, sizeof(str_encoded));
-                len += snprintf(&buff[len], buff_size - len, "        <Quantity>%s</Quantity>\n", str_encoded);
+//------------------------------------------------------------------------------
+/// Find the entry of a key, or the free entry it goes to. The table is grown
+/// first if a new entry would push the load factor above 3/4.
+//------------------------------------------------------------------------------
+static mbus_layout_entry *
+mbus_layout_cache_entry(mbus_layout_cache *cache, uint64_t key)
+{
+    mbus_layout_entry *entries, *old;
+    size_t i, j, size;
 
+    if (cache->size > 0)
+    {
+        i = mbus_layout_cache_index(cache, key);
 
-                if (norm_record->is_numeric)
-                {
-                    len += snprintf(&buff[len], buff_size - len, "        <Value>%f</Value>\n", norm_record->value.real_val);
-                }
-                else
-                {
-                    mbus_str_xml_encode(str_encoded, norm_record->value.str_val.value, sizeof(str_encoded));
-                    len += snprintf(&buff[len], buff_size - len, "        <Value>%s</Value>\n", str_encoded);
-                }
+        if (cache->entries[i].plans)
+            return &(cache->entries[i]);
+    }
 
-                mbus_record_free(norm_record);
-            }
-            else
-            {
-            }
+    if (4 * (cache->count + 1) > 3 * cache->size)
+    {
+        size = cache->size ? 2 * cache->size : 16;
 
-            len += snprintf(&buff[len], buff_size - len, "    </DataRecord>\n\n");
+        if ((entries = (mbus_layout_entry *) calloc(size, sizeof(mbus_layout_entry))) == NULL)
+        {
+            MBUS_ERROR("%s: Failed to allocate layout cache.\n", __PRETTY_FUNCTION__);
+            return NULL;
         }
 
-        len += snprintf(&buff[len], buff_size - len, "</MBusData>\n");
+        old = cache->entries;
+        j = cache->size;
+        cache->entries = entries;
+        cache->size = size;
+
+        for (i = 0; i < j; i++)
+        {
+            if (old[i].plans)
+                cache->entries[mbus_layout_cache_index(cache, old[i].key)] = old[i];
+        }
 
-        return buff;
+        free(old);
     }
 
-    return NULL;
+    return &(cache->entries[mbus_layout_cache_index(cache, key)]);
 }
 
 //------------------------------------------------------------------------------
-/// Return a string containing an XML representation of the M-BUS frame data.
+/// Check that a telegram has the layout of a plan: the fillers and DIB/VIB
+/// of every record, and the fillers at the end, are compared as a whole.
 //------------------------------------------------------------------------------
-char *
-mbus_frame_data_xml_normalized(mbus_frame_data *data)
+static int
+mbus_layout_plan_match(const mbus_layout_plan *plan, const mbus_frame *frame)
 {
-    if (data)
+    const mbus_layout_step *step;
+    size_t i;
+
+    if (plan->data_size != frame->data_size)
+        return 0;
+
+    for (i = 0; i < plan->nsteps; i++)
     {
-        if (data->type == MBUS_DATA_TYPE_FIXED)
-        {
-            return mbus_data_fixed_xml(&(data->data_fix));
-        }
+        step = &(plan->steps[i]);
 
-        if (data->type == MBUS_DATA_TYPE_VARIABLE)
-        {
-            return mbus_data_variable_xml_normalized(&(data->data_var));
-        }
+        if (memcmp(&(frame->data[step->check_offset]), &(plan->data[step->check_offset]),
+                   step->data_offset - step->check_offset) != 0)
+            return 0;
     }
 
-    return NULL;
+    return memcmp(&(frame->data[plan->tail_offset]), &(plan->data[plan->tail_offset]),
+                  plan->data_size - plan->tail_offset) == 0;
 }
 
-mbus_handle *
-mbus_context_serial(const char *device)
+//------------------------------------------------------------------------------
+/// Build the plan of a telegram with the full parser
+//------------------------------------------------------------------------------
+static mbus_layout_plan *
+mbus_layout_plan_new(mbus_frame *frame)
 {
-    mbus_handle *handle;
-    mbus_serial_data *serial_data;
-    char error_str[128];
+    mbus_layout_plan *plan;
+    mbus_data_variable data;
+    mbus_data_record *record;
+    mbus_layout_step *step;
+    mbus_frame_view view;
+    mbus_record_view rv;
+    size_t pos = 0, end = MBUS_DATA_VARIABLE_HEADER_LENGTH;
 
-    if ((handle = (mbus_handle *) malloc(sizeof(mbus_handle))) == NULL)
+    memset(&data, 0, sizeof(data));
+
+    if (mbus_data_variable_parse(frame, &data) != 0)
     {
-        MBUS_ERROR("%s: Failed to allocate handle.\n", __PRETTY_FUNCTION__);
+        MBUS_ERROR("%s: %s\n", __PRETTY_FUNCTION__, mbus_error_str());
+        mbus_data_record_free(data.record);
         return NULL;
     }
 
-    if ((serial_data = (mbus_serial_data *)malloc(sizeof(mbus_serial_data))) == NULL)
+    if ((plan = (mbus_layout_plan *) calloc(1, sizeof(mbus_layout_plan))) == NULL ||
+        (data.nrecords > 0 &&
+         (plan->steps = (mbus_layout_step *) calloc(data.nrecords, sizeof(mbus_layout_step))) == NULL))
     {
-        snprintf(error_str, sizeof(error_str), "%s: failed to allocate memory for handle\n", __PRETTY_FUNCTION__);
-        mbus_error_str_set(error_str);
-        free(handle);
+        MBUS_ERROR("%s: Failed to allocate layout plan.\n", __PRETTY_FUNCTION__);
+        free(plan);
+        mbus_data_record_free(data.record);
         return NULL;
     }
 
-    handle->max_data_retry = 3;
-    handle->max_search_retry = 1;
-    handle->is_serial = 1;
-    handle->purge_first_frame = MBUS_FRAME_PURGE_M2S;
-    handle->auxdata = serial_data;
-    handle->open = mbus_serial_connect;
-    handle->close = mbus_serial_disconnect;
-    handle->recv = mbus_serial_recv_frame;
-    handle->send = mbus_serial_send_frame;
-    handle->free_auxdata = mbus_serial_data_free;
-    handle->recv_event = NULL;
-    handle->send_event = NULL;
-    handle->scan_progress = NULL;
-    handle->found_event = NULL;
+    memcpy(plan->data, frame->data, frame->data_size);
+    plan->data_size = frame->data_size;
+    plan->record = data.record;
 
-    if ((serial_data->device = strdup(device)) == NULL)
+    // the records come in the order of the view
+    mbus_frame_view_of(&view, frame);
+    record = data.record;
+
+    while (record && mbus_frame_view_next_record(&view, &pos, &rv) == 1)
     {
-        snprintf(error_str, sizeof(error_str), "%s: failed to allocate memory for device\n", __PRETTY_FUNCTION__);
-        mbus_error_str_set(error_str);
-        free(serial_data);
-        free(handle);
-        return NULL;
+        step = &(plan->steps[plan->nsteps++]);
+
+        if (mbus_typed_value_plan(record, step) != 0)
+        {
+            memset(&(step->value), 0, sizeof(mbus_typed_value));
+            step->kind = MBUS_LAYOUT_DECODE_NONE;
+        }
+
+        step->check_offset = end;
+        step->data_offset = rv.data_offset;
+        end = rv.data_offset + rv.data_len;
+        record = record->next;
     }
 
-    return handle;
+    plan->tail_offset = end;
+
+    return plan;
 }
 
-mbus_handle *
-mbus_context_tcp(const char *host, uint16_t port)
+//------------------------------------------------------------------------------
+/// Decode a variable data telegram with the plan of its record layout,
+/// building the plan with the full parser if there is none yet
+//------------------------------------------------------------------------------
+int
+mbus_layout_cache_decode(mbus_layout_cache *cache, mbus_frame *frame, mbus_data_variable_header *header,
+                         mbus_typed_value *values, size_t nvalues)
 {
-    mbus_handle *handle;
-    mbus_tcp_data *tcp_data;
-    char error_str[128];
+    mbus_layout_entry *entry;
+    mbus_layout_plan *plan, **prev;
+    uint64_t key;
+    size_t i;
 
-    if ((handle = (mbus_handle *) malloc(sizeof(mbus_handle))) == NULL)
+    if (cache == NULL || frame == NULL || (values == NULL && nvalues > 0))
     {
-        MBUS_ERROR("%s: Failed to allocate handle.\n", __PRETTY_FUNCTION__);
-        return NULL;
+        MBUS_ERROR("%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
+        return -1;
     }
 
-    if ((tcp_data = (mbus_tcp_data *)malloc(sizeof(mbus_tcp_data))) == NULL)
+    if ((frame->control & MBUS_CONTROL_MASK_DIR) != MBUS_CONTROL_MASK_DIR_S2M ||
+        frame->control_information != MBUS_CONTROL_INFO_RESP_VARIABLE ||
+        frame->data_size < MBUS_DATA_VARIABLE_HEADER_LENGTH)
     {
-        snprintf(error_str, sizeof(error_str), "%s: failed to allocate memory for handle\n", __PRETTY_FUNCTION__);
-        mbus_error_str_set(error_str);
-        free(handle);
-        return NULL;
+        MBUS_ERROR("%s: Not a variable data response.\n", __PRETTY_FUNCTION__);
+        return -1;
     }
 
-    handle->max_data_retry = 3;
-    handle->max_search_retry = 1;
-    handle->is_serial = 0;
-    handle->purge_first_frame = MBUS_FRAME_PURGE_M2S;
-    handle->auxdata = tcp_data;
-    handle->open = mbus_tcp_connect;
-    handle->close = mbus_tcp_disconnect;
-    handle->recv = mbus_tcp_recv_frame;
-    handle->send = mbus_tcp_send_frame;
-    handle->free_auxdata = mbus_tcp_data_free;
-    handle->recv_event = NULL;
-    handle->send_event = NULL;
-    handle->scan_progress = NULL;
-    handle->found_event = NULL;
+    key = mbus_layout_key(frame);
 
-    tcp_data->port = port;
+    if ((entry = mbus_layout_cache_entry(cache, key)) == NULL)
+        return -1;
+
+    for (plan = entry->plans; plan; plan = plan->next)
+    {
+        if (mbus_layout_plan_match(plan, frame))
+            break;
+    }
+
+    if (plan)
+    {
+        cache->hits++;
+    }
+    else
+    {
+        if ((plan = mbus_layout_plan_new(frame)) == NULL)
+            return -1;
+
+        cache->misses++;
+
+        if (entry->plans == NULL)
+        {
+            entry->key = key;
+            cache->count++;
+        }
+
+        plan->next = entry->plans;
+        entry->plans = plan;
+
+        // drop the oldest plan
+        if (++entry->nplans > MBUS_LAYOUT_CACHE_PLANS)
+        {
+            for (prev = &(entry->plans); (*prev)->next; prev = &((*prev)->next))
+                ;
+
+            mbus_layout_plan_free(*prev);
+            *prev = NULL;
+            entry->nplans--;
+        }
+    }
+
+    if (header)
+    {
+        memcpy(header->id_bcd, &(frame->data[0]), 4);
+        memcpy(header->manufacturer, &(frame->data[4]), 2);
+        header->version      = frame->data[6];
+        header->medium       = frame->data[7];
+        header->access_no    = frame->data[8];
+        header->status       = frame->data[9];
+        memcpy(header->signature, &(frame->data[10]), 2);
+    }
+
+    for (i = 0; i < plan->nsteps && i < nvalues; i++)
+        mbus_typed_value_apply(&(plan->steps[i]), &(frame->data[plan->steps[i].data_offset]), &(values[i]));
+
+    return (int) plan->nsteps;
+}
+
+
+int
+mbus_vib_unit_normalize(mbus_value_information_block *vib, double value, char **unit_out, double *value_out, char **quantity_out)
+{
+    const char *unit = NULL, *quantity = NULL;
+    int ret;
+
+    if (vib == NULL || unit_out == NULL || value_out == NULL || quantity_out == NULL)
+    {
+        MBUS_ERROR("%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    ret = mbus_vib_unit_normalize_const(vib, value, &unit, value_out, &quantity);
+
+    if (unit)
+        *unit_out = strdup(unit);
+
+    if (quantity)
+        *quantity_out = strdup(quantity);
+
+    return ret;
+}
+
+
+mbus_record *
+mbus_record_new()
+{
+    mbus_record * record;
+
+    if (!(record = (mbus_record *) malloc(sizeof(mbus_record))))
+    {
+        MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    record->value.real_val = 0.0;
+    record->is_numeric = 1;
+    record->unit = NULL;
+    record->function_medium = NULL;
+    record->quantity = NULL;
+    record->device = -1;
+    record->tariff = -1;
+    record->storage_number = 0;
+    return record;
+}
+
+
+void
+mbus_record_free(mbus_record * rec)
+{
+    if (rec)
+    {
+        if (! rec->is_numeric)
+        {
+            free((rec->value).str_val.value);
+            (rec->value).str_val.value = NULL;
+        }
+
+        if (rec->unit)
+        {
+            free(rec->unit);
+            rec->unit = NULL;
+        }
+
+        if (rec->function_medium)
+        {
+            free(rec->function_medium);
+            rec->function_medium = NULL;
+        }
+
+        if (rec->quantity)
+        {
+            free(rec->quantity);
+            rec->quantity = NULL;
+        }
+        free(rec);
+    }
+}
+
+
+mbus_record *
+mbus_parse_fixed_record(char status_byte, char medium_unit, unsigned char *data)
+{
+    long value = 0;
+    mbus_record * record = NULL;
+
+    if (!(record = mbus_record_new()))
+    {
+        MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    /* shared/static memory - get own copy */
+    record->function_medium = strdup(mbus_data_fixed_function((int)status_byte));  /* stored / actual */
+
+    if (record->function_medium == NULL)
+    {
+        MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
+        mbus_record_free(record);
+        return NULL;
+    }
+
+    if ((status_byte & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
+    {
+        value = mbus_data_bcd_decode(data, 4);
+    }
+    else
+    {
+        mbus_data_long_decode(data, 4, &value);
+    }
+
+    record->unit = NULL;
+    record->is_numeric = 1;
+    if (0 != mbus_fixed_normalize(medium_unit, value, &(record->unit), &(record->value.real_val), &(record->quantity)))
+    {
+        MBUS_ERROR("Problem with mbus_fixed_normalize.\n");
+        mbus_record_free(record);
+        return NULL;
+    }
+
+    return record;
+}
+
+
+mbus_record *
+mbus_parse_variable_record(mbus_data_record *data)
+{
+    mbus_record * record = NULL;
+    double value_out_real    = 0.0;  /**< raw value */
+    char * value_out_str     = NULL;
+    int    value_out_str_size = 0;
+    double real_val         = 0.0;  /**< normalized value */
+
+    if (data == NULL)
+    {
+        MBUS_ERROR("%s: Invalid record.\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    if (!(record = mbus_record_new()))
+    {
+        MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    record->storage_number = mbus_data_record_storage_number(data);
+    record->tariff = mbus_data_record_tariff(data);
+    record->device = mbus_data_record_device(data);
+
+    if ((data->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) ||
+        (data->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)) /* MBUS_DIB_DIF_VENDOR_SPECIFIC */
+    {
+        if (data->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
+        {
+            record->function_medium = strdup("More records follow");
+        }
+        else
+        {
+            record->function_medium = strdup("Manufacturer specific");
+        }
+
+        if (record->function_medium == NULL)
+        {
+            MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
+            mbus_record_free(record);
+            return NULL;
+        }
+
+        /* parsing of data not implemented yet
+           manufacturer specific data structures to end of user data */
+
+        if (mbus_variable_value_decode(data, &value_out_real, &value_out_str, &value_out_str_size) != 0)
+        {
+            MBUS_ERROR("%s: problem with mbus_variable_value_decode\n", __PRETTY_FUNCTION__);
+            mbus_record_free(record);
+            return NULL;
+        }
+
+        if (value_out_str != NULL)
+        {
+            record->is_numeric = 0;
+            (record->value).str_val.value = value_out_str;
+            (record->value).str_val.size = value_out_str_size;
+        }
+        else
+        {
+            record->is_numeric = 1;
+            (record->value).real_val = real_val;
+        }
+    }
+    else
+    {
+        record->function_medium = strdup(mbus_data_record_function(data));
+
+        if (record->function_medium == NULL)
+        {
+            MBUS_ERROR("%s: memory allocation error\n", __PRETTY_FUNCTION__);
+            mbus_record_free(record);
+            return NULL;
+        }
+
+        MBUS_DEBUG("record->function_medium = %s \n", record->function_medium);
+
+        if (mbus_variable_value_decode(data, &value_out_real, &value_out_str, &value_out_str_size) != 0)
+        {
+            MBUS_ERROR("%s: problem with mbus_variable_value_decode\n", __PRETTY_FUNCTION__);
+            mbus_record_free(record);
+            return NULL;
+        }
+        MBUS_DEBUG("value_out_real = %lf \n", value_out_real);
+
+        if (mbus_vib_unit_normalize(&(data->drh.vib), value_out_real, &(record->unit), &real_val, &(record->quantity)) != 0)
+        {
+            MBUS_ERROR("%s: problem with mbus_vib_unit_normalize\n", __PRETTY_FUNCTION__);
+            mbus_record_free(record);
+            record = NULL;
+            return NULL;
+        }
+        MBUS_DEBUG("record->unit = %s \n", record->unit);
+        MBUS_DEBUG("real_val = %lf \n", real_val);
+
+        if (value_out_str != NULL)
+        {
+            record->is_numeric = 0;
+            (record->value).str_val.value = value_out_str;
+            (record->value).str_val.size = value_out_str_size;
+        }
+        else
+        {
+            record->is_numeric = 1;
+            (record->value).real_val = real_val;
+        }
+    }
+
+    return record;
+}
+
+//------------------------------------------------------------------------------
+/// Write a document for variable-length data with normalized values
+//------------------------------------------------------------------------------
+int
+mbus_data_variable_write_normalized(mbus_writer *writer, mbus_data_variable *data)
+{
+    mbus_data_record *record;
+    mbus_record *norm_record;
+    int i;
+
+    if (writer == NULL || data == NULL)
+        return -1;
+
+    mbus_writer_document_begin(writer);
+    mbus_data_variable_header_write(writer, &(data->header));
+
+    for (record = data->record, i = 0; record; record = record->next, i++)
+    {
+        norm_record = mbus_parse_variable_record(record);
+
+        mbus_writer_object_begin(writer, "DataRecord", i, -1);
+
+        if (norm_record != NULL)
+        {
+            mbus_writer_field(writer, "Function", norm_record->function_medium);
+            mbus_writer_field_printf(writer, "StorageNumber", 0, "%ld", norm_record->storage_number);
+
+            if (norm_record->tariff >= 0)
+            {
+                mbus_writer_field_printf(writer, "Tariff", 0, "%ld", norm_record->tariff);
+                mbus_writer_field_printf(writer, "Device", 0, "%d", norm_record->device);
+            }
+
+            mbus_writer_field(writer, "Unit", norm_record->unit);
+            mbus_writer_field(writer, "Quantity", norm_record->quantity);
+
+            if (norm_record->is_numeric)
+            {
+                // JSON has no representation for inf and nan
+                mbus_writer_field_printf(writer, "Value", !isfinite(norm_record->value.real_val),
+                                         "%f", norm_record->value.real_val);
+            }
+            else
+            {
+                mbus_writer_field(writer, "Value", norm_record->value.str_val.value);
+            }
+
+            mbus_record_free(norm_record);
+        }
+
+        mbus_writer_object_end(writer, "DataRecord");
+    }
+
+    return mbus_writer_document_end(writer);
+}
+
+//------------------------------------------------------------------------------
+/// Write a document for the M-Bus frame data with normalized values
+//------------------------------------------------------------------------------
+int
+mbus_frame_data_write_normalized(mbus_writer *writer, mbus_frame_data *data)
+{
+    if (writer && data)
+    {
+        if (data->type == MBUS_DATA_TYPE_FIXED)
+        {
+            return mbus_data_fixed_write(writer, &(data->data_fix));
+        }
+
+        if (data->type == MBUS_DATA_TYPE_VARIABLE)
+        {
+            return mbus_data_variable_write_normalized(writer, &(data->data_var));
+        }
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+/// Generate XML for variable-length data
+//------------------------------------------------------------------------------
+char *
+mbus_data_variable_xml_normalized(mbus_data_variable *data)
+{
+    mbus_writer writer;
+
+    if (data == NULL || mbus_writer_init_buffer(&writer, MBUS_WRITER_FORMAT_XML, 0) != 0)
+        return NULL;
+
+    mbus_data_variable_write_normalized(&writer, data);
+
+    return mbus_writer_detach(&writer);
+}
+
+//------------------------------------------------------------------------------
+/// Return a string containing an XML representation of the M-BUS frame data.
+//------------------------------------------------------------------------------
+char *
+mbus_frame_data_xml_normalized(mbus_frame_data *data)
+{
+    mbus_writer writer;
+
+    if (data == NULL || mbus_writer_init_buffer(&writer, MBUS_WRITER_FORMAT_XML, 0) != 0)
+        return NULL;
+
+    if (mbus_frame_data_write_normalized(&writer, data) != 0)
+    {
+        mbus_writer_free(&writer);
+        return NULL;
+    }
+
+    return mbus_writer_detach(&writer);
+}
+
+//------------------------------------------------------------------------------
+//
+// BINARY EXPORT
+//
+//------------------------------------------------------------------------------
+
+static void
+mbus_bin_put16(unsigned char *buff, uint16_t value)
+{
+    buff[0] = (unsigned char) value;
+    buff[1] = (unsigned char) (value >> 8);
+}
+
+static void
+mbus_bin_put32(unsigned char *buff, uint32_t value)
+{
+    mbus_bin_put16(buff, (uint16_t) value);
+    mbus_bin_put16(buff + 2, (uint16_t) (value >> 16));
+}
+
+static void
+mbus_bin_put64(unsigned char *buff, uint64_t value)
+{
+    mbus_bin_put32(buff, (uint32_t) value);
+    mbus_bin_put32(buff + 4, (uint32_t) (value >> 32));
+}
+
+static uint16_t
+mbus_bin_get16(const unsigned char *buff)
+{
+    return (uint16_t) (buff[0] | (buff[1] << 8));
+}
+
+static uint32_t
+mbus_bin_get32(const unsigned char *buff)
+{
+    return (uint32_t) mbus_bin_get16(buff) | ((uint32_t) mbus_bin_get16(buff + 2) << 16);
+}
+
+static uint64_t
+mbus_bin_get64(const unsigned char *buff)
+{
+    return (uint64_t) mbus_bin_get32(buff) | ((uint64_t) mbus_bin_get32(buff + 4) << 32);
+}
+
+//------------------------------------------------------------------------------
+/// Unit code of a VIB, as used by mbus_vib_unit_normalize
+//------------------------------------------------------------------------------
+static uint16_t
+mbus_bin_unit(mbus_value_information_block *vib)
+{
+    int code;
+
+    if (vib->vif == 0xFD || vib->vif == 0xFB)
+    {
+        if (vib->nvife == 0)
+            return MBUS_BIN_UNIT_NONE;
+
+        code = (vib->vife[0] & MBUS_DIB_VIF_WITHOUT_EXTENSION) | ((vib->vif == 0xFD) ? 0x100 : 0x200);
+    }
+    else if (vib->vif == 0x7C || vib->vif == 0xFC)
+    {
+        return MBUS_BIN_UNIT_PLAIN_TEXT;
+    }
+    else
+    {
+        code = vib->vif & MBUS_DIB_VIF_WITHOUT_EXTENSION;
+    }
+
+    return (mbus_vif_descriptor_lookup(code) != NULL) ? (uint16_t) code : MBUS_BIN_UNIT_NONE;
+}
+
+//------------------------------------------------------------------------------
+/// Fill a binary row from a variable data record
+//------------------------------------------------------------------------------
+int
+mbus_bin_record_variable(mbus_bin_record *row, mbus_data_variable_header *header,
+                         mbus_data_record *record, int record_cnt)
+{
+    const char *unit, *quantity;
+    mbus_typed_value value;
+    int is_string;
+    double value_raw = 0.0;
+
+    if (row == NULL || header == NULL || record == NULL)
+    {
+        MBUS_ERROR("%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    memset((void *)row, 0, sizeof(mbus_bin_record));
+
+    row->id = (uint32_t) mbus_data_bcd_decode(header->id_bcd, 4);
+    row->manufacturer = mbus_bin_get16(header->manufacturer);
+    row->version = header->version;
+    row->medium = header->medium;
+    row->timestamp = (int64_t) record->timestamp;
+    row->storage_number = (uint64_t) mbus_data_record_storage_number(record);
+    row->tariff = (int32_t) mbus_data_record_tariff(record);
+    row->device = (uint16_t) mbus_data_record_device(record);
+    row->record = (uint16_t) record_cnt;
+    row->unit = MBUS_BIN_UNIT_NONE;
+
+    if (mbus_data_record_typed_value(record, &value) != 0)
+    {
+        MBUS_ERROR("%s: problem with mbus_data_record_typed_value\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    is_string = (value.type == MBUS_VALUE_TYPE_NONE ||
+                 value.type == MBUS_VALUE_TYPE_TIME ||
+                 value.type == MBUS_VALUE_TYPE_RAW);
+
+    if (is_string)
+    {
+        row->flags |= MBUS_BIN_FLAG_STRING;
+        row->value = NAN;
+    }
+    else if (value.type == MBUS_VALUE_TYPE_REAL)
+    {
+        value_raw = value.value.real_val;
+    }
+    else
+    {
+        value_raw = (double) value.value.int_val;
+    }
+
+    if (record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC ||
+        record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
+    {
+        row->function = (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW) ?
+                        MBUS_BIN_FUNCTION_MORE_RECORDS : MBUS_BIN_FUNCTION_MANUFACTURER;
+        row->flags |= MBUS_BIN_FLAG_UNKNOWN_UNIT;
+
+        if (!is_string)
+            row->value = value_raw;
+
+        return 0;
+    }
+
+    row->function = (record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_FUNCTION) >> 4;
+    row->unit = mbus_bin_unit(&(record->drh.vib));
+
+    if (is_string)
+        return 0;
+
+    if (row->unit == MBUS_BIN_UNIT_NONE ||
+        mbus_vib_unit_normalize_const(&(record->drh.vib), value_raw, &unit, &(row->value), &quantity) != 0)
+    {
+        row->flags |= MBUS_BIN_FLAG_UNKNOWN_UNIT;
+        row->value = value_raw;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Fill a binary row from a counter of fixed data
+//------------------------------------------------------------------------------
+int
+mbus_bin_record_fixed(mbus_bin_record *row, mbus_data_fixed *data, int counter)
+{
+    const mbus_variable_vif *desc;
+    unsigned char *val;
+    long value = 0;
+    int type;
+
+    if (row == NULL || data == NULL || counter < 0 || counter > 1)
+    {
+        MBUS_ERROR("%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    memset((void *)row, 0, sizeof(mbus_bin_record));
+
+    type = (counter == 0) ? data->cnt1_type : data->cnt2_type;
+    val = (counter == 0) ? data->cnt1_val : data->cnt2_val;
+
+    row->id = (uint32_t) mbus_data_bcd_decode(data->id_bcd, 4);
+    row->medium = (uint8_t) ((data->cnt1_type & 0xC0) >> 6 | (data->cnt2_type & 0xC0) >> 4);
+    row->tariff = -1;
+    row->record = (uint16_t) counter;
+    row->function = MBUS_BIN_FUNCTION_INSTANTANEOUS;
+    row->flags = MBUS_BIN_FLAG_FIXED;
+    row->unit = (uint16_t) (type & 0x3F);
+
+    if ((data->status & MBUS_DATA_FIXED_STATUS_DATE_MASK) == MBUS_DATA_FIXED_STATUS_DATE_STORED)
+        row->flags |= MBUS_BIN_FLAG_STORED;
+
+    if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
+        value = mbus_data_bcd_decode(val, 4);
+    else
+        mbus_data_long_decode(val, 4, &value);
+
+    if ((desc = mbus_fixed_descriptor_lookup(type)) != NULL)
+    {
+        row->value = ((double) value) * desc->exponent;
+    }
+    else
+    {
+        row->flags |= MBUS_BIN_FLAG_UNKNOWN_UNIT;
+        row->value = (double) value;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Encode a row in the little endian binary layout
+//------------------------------------------------------------------------------
+void
+mbus_bin_record_encode(const mbus_bin_record *row, unsigned char *buff)
+{
+    uint64_t value;
+
+    memcpy((void *)&value, (const void *)&(row->value), sizeof(value));
+
+    mbus_bin_put32(buff + 0, row->id);
+    mbus_bin_put16(buff + 4, row->manufacturer);
+    buff[6] = row->version;
+    buff[7] = row->medium;
+    mbus_bin_put64(buff + 8, (uint64_t) row->timestamp);
+    mbus_bin_put64(buff + 16, value);
+    mbus_bin_put64(buff + 24, row->storage_number);
+    mbus_bin_put32(buff + 32, (uint32_t) row->tariff);
+    mbus_bin_put16(buff + 36, row->device);
+    mbus_bin_put16(buff + 38, row->unit);
+    mbus_bin_put16(buff + 40, row->record);
+    buff[42] = row->function;
+    buff[43] = row->flags;
+    mbus_bin_put32(buff + 44, 0);
+}
+
+//------------------------------------------------------------------------------
+/// Decode a row of the little endian binary layout
+//------------------------------------------------------------------------------
+void
+mbus_bin_record_decode(mbus_bin_record *row, const unsigned char *buff)
+{
+    uint64_t value;
+
+    row->id = mbus_bin_get32(buff + 0);
+    row->manufacturer = mbus_bin_get16(buff + 4);
+    row->version = buff[6];
+    row->medium = buff[7];
+    row->timestamp = (int64_t) mbus_bin_get64(buff + 8);
+    value = mbus_bin_get64(buff + 16);
+    memcpy((void *)&(row->value), (const void *)&value, sizeof(value));
+    row->storage_number = mbus_bin_get64(buff + 24);
+    row->tariff = (int32_t) mbus_bin_get32(buff + 32);
+    row->device = mbus_bin_get16(buff + 36);
+    row->unit = mbus_bin_get16(buff + 38);
+    row->record = mbus_bin_get16(buff + 40);
+    row->function = buff[42];
+    row->flags = buff[43];
+    row->reserved = mbus_bin_get32(buff + 44);
+}
+
+//------------------------------------------------------------------------------
+/// Encode the header of a binary stream
+//------------------------------------------------------------------------------
+void
+mbus_bin_header_encode(unsigned char *buff)
+{
+    memset((void *)buff, 0, MBUS_BIN_HEADER_SIZE);
+    memcpy((void *)buff, MBUS_BIN_MAGIC, sizeof(MBUS_BIN_MAGIC));
+    mbus_bin_put16(buff + 8, MBUS_BIN_VERSION);
+    mbus_bin_put16(buff + 10, MBUS_BIN_RECORD_SIZE);
+}
+
+//------------------------------------------------------------------------------
+/// Check the magic and version of a binary stream
+//------------------------------------------------------------------------------
+int
+mbus_bin_header_check(const unsigned char *buff, size_t buff_size)
+{
+    if (buff == NULL || buff_size < MBUS_BIN_HEADER_SIZE ||
+        memcmp((const void *)buff, MBUS_BIN_MAGIC, sizeof(MBUS_BIN_MAGIC)) != 0)
+    {
+        MBUS_ERROR("%s: Not a binary record stream.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    if (mbus_bin_get16(buff + 8) != MBUS_BIN_VERSION ||
+        mbus_bin_get16(buff + 10) != MBUS_BIN_RECORD_SIZE)
+    {
+        MBUS_ERROR("%s: Unsupported version %d of the binary record stream.\n",
+                   __PRETTY_FUNCTION__, mbus_bin_get16(buff + 8));
+        return -1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Write the header of a binary stream
+//------------------------------------------------------------------------------
+int
+mbus_bin_header_write(mbus_writer *writer)
+{
+    unsigned char buff[MBUS_BIN_HEADER_SIZE];
+
+    mbus_bin_header_encode(buff);
+
+    return mbus_writer_write(writer, (const char *) buff, sizeof(buff));
+}
+
+//------------------------------------------------------------------------------
+/// Write the records of the frame data as binary rows
+//------------------------------------------------------------------------------
+int
+mbus_frame_data_write_bin(mbus_writer *writer, mbus_frame_data *data)
+{
+    mbus_data_record *record;
+    mbus_bin_record row;
+    unsigned char buff[MBUS_BIN_RECORD_SIZE];
+    int i, rows = 0;
+
+    if (writer == NULL || data == NULL)
+    {
+        MBUS_ERROR("%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    if (data->type == MBUS_DATA_TYPE_VARIABLE)
+    {
+        for (record = data->data_var.record, i = 0; record; record = record->next, i++)
+        {
+            // records that can't be decoded are left out
+            if (mbus_bin_record_variable(&row, &(data->data_var.header), record, i) != 0)
+                continue;
+
+            mbus_bin_record_encode(&row, buff);
+
+            if (mbus_writer_write(writer, (const char *) buff, sizeof(buff)) != 0)
+                return -1;
+
+            rows++;
+        }
+    }
+    else if (data->type == MBUS_DATA_TYPE_FIXED)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            mbus_bin_record_fixed(&row, &(data->data_fix), i);
+            mbus_bin_record_encode(&row, buff);
+
+            if (mbus_writer_write(writer, (const char *) buff, sizeof(buff)) != 0)
+                return -1;
+
+            rows++;
+        }
+    }
+    else if (data->type != MBUS_DATA_TYPE_ERROR)
+    {
+        return -1;
+    }
+
+    return rows;
+}
+
+mbus_handle *
+mbus_context_serial(const char *device)
+{
+    mbus_handle *handle;
+    mbus_serial_data *serial_data;
+    char error_str[128];
+
+    if ((handle = (mbus_handle *) malloc(sizeof(mbus_handle))) == NULL)
+    {
+        MBUS_ERROR("%s: Failed to allocate handle.\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    if ((serial_data = (mbus_serial_data *)malloc(sizeof(mbus_serial_data))) == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: failed to allocate memory for handle\n", __PRETTY_FUNCTION__);
+        mbus_error_str_set(error_str);
+        free(handle);
+        return NULL;
+    }
+
+    handle->max_data_retry = 3;
+    handle->max_search_retry = 1;
+    handle->is_serial = 1;
+    handle->purge_first_frame = MBUS_FRAME_PURGE_M2S;
+    handle->auxdata = serial_data;
+    mbus_frame_parser_init(&(serial_data->parser), NULL, NULL);
+    handle->parser = &(serial_data->parser);
+    handle->open = mbus_serial_connect;
+    handle->close = mbus_serial_disconnect;
+    handle->recv = mbus_serial_recv_frame;
+    handle->send = mbus_serial_send_frame;
+    handle->free_auxdata = mbus_serial_data_free;
+    handle->recv_event = NULL;
+    handle->send_event = NULL;
+    handle->scan_progress = NULL;
+    handle->found_event = NULL;
+    handle->nonblocking = 0;
+    handle->purge_pending = 0;
+    handle->timeout_us = 0;
+    handle->allowance_us = MBUS_TIMEOUT_ALLOWANCE_DEFAULT;
+    handle->timeout_adaptive = 0;
+    handle->tx_end_us = 0;
+    handle->deadline_us = 0;
+    handle->tx_len = 0;
+    handle->tx_sent = 0;
+    handle->stats = NULL;
+    handle->stats_address = -1;
+    handle->stats_enabled = 0;
+    mbus_slave_table_init(&(handle->slaves));
+    handle->has_selected = 0;
+    handle->frame_pool = NULL;
+    handle->bus_baudrate = 0;
+    memset(handle->baudrate, 0, sizeof(handle->baudrate));
+    handle->capture = NULL;
+    handle->capture_id = 0;
+
+    if ((serial_data->device = strdup(device)) == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: failed to allocate memory for device\n", __PRETTY_FUNCTION__);
+        mbus_error_str_set(error_str);
+        free(serial_data);
+        free(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+
+mbus_handle *
+mbus_context_tcp(const char *host, uint16_t port)
+{
+    mbus_handle *handle;
+    mbus_tcp_data *tcp_data;
+    char error_str[128];
+
+    if ((handle = (mbus_handle *) malloc(sizeof(mbus_handle))) == NULL)
+    {
+        MBUS_ERROR("%s: Failed to allocate handle.\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    if ((tcp_data = (mbus_tcp_data *)malloc(sizeof(mbus_tcp_data))) == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: failed to allocate memory for handle\n", __PRETTY_FUNCTION__);
+        mbus_error_str_set(error_str);
+        free(handle);
+        return NULL;
+    }
+
+    handle->max_data_retry = 3;
+    handle->max_search_retry = 1;
+    handle->is_serial = 0;
+    handle->purge_first_frame = MBUS_FRAME_PURGE_M2S;
+    handle->auxdata = tcp_data;
+    mbus_frame_parser_init(&(tcp_data->parser), NULL, NULL);
+    handle->parser = &(tcp_data->parser);
+    handle->open = mbus_tcp_connect;
+    handle->close = mbus_tcp_disconnect;
+    handle->recv = mbus_tcp_recv_frame;
+    handle->send = mbus_tcp_send_frame;
+    handle->free_auxdata = mbus_tcp_data_free;
+    handle->recv_event = NULL;
+    handle->send_event = NULL;
+    handle->scan_progress = NULL;
+    handle->found_event = NULL;
+    handle->nonblocking = 0;
+    handle->purge_pending = 0;
+    handle->timeout_us = 0;
+    handle->allowance_us = MBUS_TIMEOUT_ALLOWANCE_DEFAULT;
+    handle->timeout_adaptive = 0;
+    handle->tx_end_us = 0;
+    handle->deadline_us = 0;
+    handle->tx_len = 0;
+    handle->tx_sent = 0;
+    handle->stats = NULL;
+    handle->stats_address = -1;
+    handle->stats_enabled = 0;
+    mbus_slave_table_init(&(handle->slaves));
+    handle->has_selected = 0;
+    handle->frame_pool = NULL;
+    handle->bus_baudrate = 0;
+    memset(handle->baudrate, 0, sizeof(handle->baudrate));
+    handle->capture = NULL;
+    handle->capture_id = 0;
+    handle->fd = -1;
+
+    tcp_data->port = port;
+    tcp_data->pool = NULL;
+    tcp_data->gateway = NULL;
+    tcp_data->connect_timeout_us = 0;
+    tcp_data->nodelay = 0;
+    tcp_data->keepalive_s = 0;
+    tcp_data->broken = 0;
     if ((tcp_data->host = strdup(host)) == NULL)
     {
-        snprintf(error_str, sizeof(error_str), "%s: failed to allocate memory for host\n", __PRETTY_FUNCTION__);
-        mbus_error_str_set(error_str);
-        free(tcp_data);
-        free(handle);
-        return NULL;
+        snprintf(error_str, sizeof(error_str), "%s: failed to allocate memory for host\n", __PRETTY_FUNCTION__);
+        mbus_error_str_set(error_str);
+        free(tcp_data);
+        free(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+
+mbus_handle *
+mbus_context_sim(void)
+{
+    mbus_handle *handle;
+    mbus_sim_data *sim_data;
+
+    if ((handle = (mbus_handle *) malloc(sizeof(mbus_handle))) == NULL)
+    {
+        MBUS_ERROR("%s: Failed to allocate handle.\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    if ((sim_data = (mbus_sim_data *) calloc(1, sizeof(mbus_sim_data))) == NULL)
+    {
+        MBUS_ERROR("%s: Failed to allocate simulator.\n", __PRETTY_FUNCTION__);
+        free(handle);
+        return NULL;
+    }
+
+    handle->max_data_retry = 3;
+    handle->max_search_retry = 1;
+    handle->is_serial = 0;
+    handle->purge_first_frame = MBUS_FRAME_PURGE_M2S;
+    handle->auxdata = sim_data;
+    mbus_frame_parser_init(&(sim_data->parser), NULL, NULL);
+    handle->parser = &(sim_data->parser);
+    handle->open = mbus_sim_connect;
+    handle->close = mbus_sim_disconnect;
+    handle->recv = mbus_sim_recv_frame;
+    handle->send = mbus_sim_send_frame;
+    handle->free_auxdata = mbus_sim_data_free;
+    handle->recv_event = NULL;
+    handle->send_event = NULL;
+    handle->scan_progress = NULL;
+    handle->found_event = NULL;
+    handle->nonblocking = 0;
+    handle->purge_pending = 0;
+    handle->timeout_us = 0;
+    handle->allowance_us = MBUS_TIMEOUT_ALLOWANCE_DEFAULT;
+    handle->timeout_adaptive = 0;
+    handle->tx_end_us = 0;
+    handle->deadline_us = 0;
+    handle->tx_len = 0;
+    handle->tx_sent = 0;
+    handle->stats = NULL;
+    handle->stats_address = -1;
+    handle->stats_enabled = 0;
+    mbus_slave_table_init(&(handle->slaves));
+    handle->has_selected = 0;
+    handle->frame_pool = NULL;
+    handle->bus_baudrate = 0;
+    memset(handle->baudrate, 0, sizeof(handle->baudrate));
+    handle->capture = NULL;
+    handle->capture_id = 0;
+    handle->fd = -1;
+
+    sim_data->peer = -1;
+
+    return handle;
+}
+
+void
+mbus_context_free(mbus_handle * handle)
+{
+    if (handle)
+    {
+        handle->free_auxdata(handle);
+        mbus_slave_table_free(&(handle->slaves));
+        mbus_frame_pool_free(handle->frame_pool);
+        free(handle->stats);
+        free(handle);
+    }
+}
+
+int
+mbus_connect(mbus_handle * handle)
+{
+    if (handle == NULL)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle for disconnect.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    return handle->open(handle);
+}
+
+int
+mbus_disconnect(mbus_handle * handle)
+{
+    if (handle == NULL)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle for disconnect.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    return handle->close(handle);
+}
+
+int
+mbus_context_set_option(mbus_handle * handle, mbus_context_option option, long value)
+{
+    size_t i;
+
+    if (handle == NULL)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle to set option.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    switch (option)
+    {
+        case MBUS_OPTION_MAX_DATA_RETRY:
+            if ((value >= 0) && (value <= 9))
+            {
+                handle->max_data_retry = value;
+                return 0;
+            }
+            break;
+        case MBUS_OPTION_MAX_SEARCH_RETRY:
+            if ((value >= 0) && (value <= 9))
+            {
+                handle->max_search_retry = value;
+                return 0;
+            }
+            break;
+        case MBUS_OPTION_PURGE_FIRST_FRAME:
+            if ((value == MBUS_FRAME_PURGE_NONE) ||
+                (value == MBUS_FRAME_PURGE_M2S)  ||
+                (value == MBUS_FRAME_PURGE_S2M))
+            {
+                handle->purge_first_frame = value;
+                return 0;
+            }
+            break;
+        case MBUS_OPTION_RESPONSE_TIMEOUT:
+            if (value >= 0)
+            {
+                handle->timeout_us = value;
+                return 0;
+            }
+            break;
+        case MBUS_OPTION_ADAPTER_ALLOWANCE:
+            if (value >= 0)
+            {
+                handle->allowance_us = value;
+                return 0;
+            }
+            break;
+        case MBUS_OPTION_ADAPTIVE_TIMEOUT:
+            handle->timeout_adaptive = (value != 0);
+            for (i = 0; i < handle->slaves.size; i++)
+            {
+                handle->slaves.entries[i].data.turnaround_samples = 0;
+                handle->slaves.entries[i].data.turnaround_us = 0;
+            }
+            return 0;
+        case MBUS_OPTION_STATS:
+            // the counters are kept, a snapshot may be taken concurrently
+            if (value == 0)
+            {
+                MBUS_STATS_ENABLE(handle, 0);
+                return 0;
+            }
+            if (handle->stats == NULL &&
+                (handle->stats = (mbus_stats *) malloc(sizeof(mbus_stats))) == NULL)
+            {
+                MBUS_ERROR("%s: Failed to allocate stats.\n", __PRETTY_FUNCTION__);
+                return -1;
+            }
+            mbus_stats_reset(handle);
+            MBUS_STATS_ENABLE(handle, 1);
+            return 0;
+        case MBUS_OPTION_CONNECT_TIMEOUT:
+        case MBUS_OPTION_TCP_NODELAY:
+        case MBUS_OPTION_TCP_KEEPALIVE:
+            if (handle->open == mbus_tcp_connect)
+            {
+                return mbus_tcp_set_option(handle, option, value);
+            }
+            break;
+        case MBUS_OPTION_FRAME_POOL:
+            if (value < 0)
+            {
+                break;
+            }
+            // frames still out of the old pool go back to the heap
+            mbus_frame_pool_free(handle->frame_pool);
+            handle->frame_pool = NULL;
+            if (value == 0)
+            {
+                return 0;
+            }
+            if ((handle->frame_pool = mbus_frame_pool_new((size_t) value)) == NULL)
+            {
+                MBUS_ERROR("%s: Failed to allocate frame pool.\n", __PRETTY_FUNCTION__);
+                return -1;
+            }
+            return 0;
+    }
+
+    return -1; // unable to set option
+}
+
+//------------------------------------------------------------------------------
+/// Monotonic clock in microseconds, used for the response timeouts
+//------------------------------------------------------------------------------
+static long long
+mbus_handle_clock_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+//------------------------------------------------------------------------------
+/// Size of a frame on the wire
+//------------------------------------------------------------------------------
+static size_t
+mbus_frame_wire_size(mbus_frame *frame)
+{
+    switch (frame->type)
+    {
+        case MBUS_FRAME_TYPE_ACK:   return MBUS_FRAME_BASE_SIZE_ACK;
+        case MBUS_FRAME_TYPE_SHORT: return MBUS_FRAME_BASE_SIZE_SHORT;
+        default:                    return MBUS_FRAME_FIXED_SIZE_LONG + frame->length1;
+    }
+}
+
+static void
+mbus_stats_latency_add(mbus_stats_latency *latency, uint64_t elapsed_us)
+{
+    uint64_t max;
+    int bucket = 0;
+
+    while (bucket < MBUS_STATS_BUCKETS - 1 && elapsed_us >= (uint64_t) mbus_stats_bucket_limit_us(bucket))
+        bucket++;
+
+    MBUS_STATS_ADD(latency->count, 1);
+    MBUS_STATS_ADD(latency->sum_us, elapsed_us);
+    MBUS_STATS_ADD(latency->bucket[bucket], 1);
+
+    max = MBUS_STATS_GET(latency->max_us);
+    while (elapsed_us > max)
+    {
+#if defined(__GNUC__)
+        if (__atomic_compare_exchange_n(&(latency->max_us), &max, elapsed_us, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+#else
+        latency->max_us = elapsed_us;
+        break;
+#endif
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Count a frame that has been transmitted to address
+//------------------------------------------------------------------------------
+static void
+mbus_stats_sent(mbus_handle *handle, size_t size, int address)
+{
+    handle->stats_address = address;
+
+    if (!MBUS_STATS_ENABLED(handle))
+        return;
+
+    MBUS_STATS_ADD(handle->stats->frames_sent, 1);
+    MBUS_STATS_ADD(handle->stats->bytes_sent, size);
+
+    if (address >= 0 && address < 256)
+        MBUS_STATS_ADD(handle->stats->address[address].requests, 1);
+}
+
+//------------------------------------------------------------------------------
+/// Count the result of a receive (MBUS_RECV_RESULT_*), size is the size of a
+/// received frame
+//------------------------------------------------------------------------------
+static void
+mbus_stats_received(mbus_handle *handle, int result, size_t size)
+{
+    mbus_stats_address *address = NULL;
+
+    if (!MBUS_STATS_ENABLED(handle))
+        return;
+
+    if (handle->stats_address >= 0 && handle->stats_address < 256)
+        address = &(handle->stats->address[handle->stats_address]);
+
+    switch (result)
+    {
+        case MBUS_RECV_RESULT_OK:
+            MBUS_STATS_ADD(handle->stats->frames_received, 1);
+            MBUS_STATS_ADD(handle->stats->bytes_received, size);
+            if (address)
+                MBUS_STATS_ADD(address->replies, 1);
+            break;
+
+        case MBUS_RECV_RESULT_TIMEOUT:
+            MBUS_STATS_ADD(handle->stats->timeouts, 1);
+            if (address)
+                MBUS_STATS_ADD(address->timeouts, 1);
+            break;
+
+        case MBUS_RECV_RESULT_INVALID:
+            MBUS_STATS_ADD(handle->stats->invalid, 1);
+            if (address)
+                MBUS_STATS_ADD(address->invalid, 1);
+            break;
+
+        case MBUS_RECV_RESULT_PENDING:
+            break;
+
+        default:
+            MBUS_STATS_ADD(handle->stats->errors, 1);
+            break;
+    }
+}
+
+int
+mbus_stats_snapshot(mbus_handle *handle, mbus_stats *snapshot)
+{
+    const uint64_t *src;
+    uint64_t *dst;
+    size_t i;
+
+    if (handle == NULL || snapshot == NULL || !MBUS_STATS_ENABLED(handle))
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle or stats not enabled.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    snapshot->started_us = handle->stats->started_us;
+    snapshot->elapsed_us = mbus_handle_clock_us() - snapshot->started_us;
+
+    // all counters following elapsed_us are uint64_t
+    src = &(handle->stats->frames_sent);
+    dst = &(snapshot->frames_sent);
+
+    for (i = 0; i < (sizeof(mbus_stats) - offsetof(mbus_stats, frames_sent)) / sizeof(uint64_t); i++)
+        dst[i] = MBUS_STATS_GET(src[i]);
+
+    return 0;
+}
+
+void
+mbus_stats_reset(mbus_handle *handle)
+{
+    if (handle && handle->stats)
+    {
+        memset((void *)handle->stats, 0, sizeof(mbus_stats));
+        handle->stats->started_us = mbus_handle_clock_us();
+    }
+}
+
+void
+mbus_stats_event(mbus_handle *handle, int event)
+{
+    if (handle == NULL || !MBUS_STATS_ENABLED(handle))
+        return;
+
+    switch (event)
+    {
+        case MBUS_STATS_EVENT_COLLISION:
+            MBUS_STATS_ADD(handle->stats->collisions, 1);
+            break;
+        case MBUS_STATS_EVENT_RETRY:
+            MBUS_STATS_ADD(handle->stats->retries, 1);
+            break;
+    }
+}
+
+long
+mbus_stats_bucket_limit_us(int bucket)
+{
+    if (bucket < 0 || bucket >= MBUS_STATS_BUCKETS - 1)
+        return -1;
+
+    return 1000L << bucket;
+}
+
+//------------------------------------------------------------------------------
+/// State of the slave at address, see mbus_handle_slave_data. Without create
+/// NULL is returned for slaves not known yet.
+//------------------------------------------------------------------------------
+static mbus_slave_data *
+mbus_handle_slave_lookup(mbus_handle *handle, int address, int create)
+{
+    if (address == MBUS_ADDRESS_NETWORK_LAYER)
+    {
+        if (!handle->has_selected)
+            return NULL;
+
+        return mbus_slave_table_get(&(handle->slaves), MBUS_SLAVE_KEY_SECONDARY,
+                                    mbus_slave_key_secondary(handle->selected), create);
+    }
+
+    if (address < 0 || address > MBUS_MAX_PRIMARY_SLAVES)
+        return NULL;
+
+    return mbus_slave_table_get(&(handle->slaves), MBUS_SLAVE_KEY_PRIMARY, (uint64_t) address, create);
+}
+
+long
+mbus_handle_timeout_us(mbus_handle *handle)
+{
+    mbus_serial_data *serial_data;
+    mbus_slave_data *slave;
+    long timeout, adaptive;
+
+    if (handle == NULL)
+        return 0;
+
+    if (handle->timeout_us > 0)
+    {
+        timeout = handle->timeout_us;
+    }
+    else if (handle->is_serial)
+    {
+        //
+        // The time structure of various link layer communication types is
+        // described in EN60870-5-1. The answer time between the end of a
+        // master send telegram and the beginning of the response telegram of
+        // the slave shall be between 11 bit times and (330 bit times + 50ms).
+        //
+        // Nowadays the usage of USB to serial adapter is very common, which
+        // could result in additional delay of 100 ms in worst case.
+        //
+        // For 2400Bd this means (330 + 11) / 2400 + 0.15 = 292 ms (added 11
+        // bit periods to receive first byte).
+        //
+        serial_data = (mbus_serial_data *) handle->auxdata;
+
+        timeout = (330 + 11) * 1000000L / ((serial_data && serial_data->baudrate > 0) ? serial_data->baudrate : 2400);
+        timeout += 50000 + handle->allowance_us;
+    }
+    else if (handle->open == mbus_sim_connect)
+    {
+        timeout = mbus_sim_get_timeout_us(handle);
+    }
+    else
+    {
+        timeout = mbus_tcp_get_timeout_us();
     }
 
-    return handle;
+    // learned per slave, broadcasts and unknown slaves get the default
+    if (handle->timeout_adaptive &&
+        (slave = mbus_handle_slave_lookup(handle, handle->stats_address, 0)) != NULL &&
+        slave->turnaround_samples >= MBUS_TIMEOUT_ADAPTIVE_SAMPLES)
+    {
+        adaptive = 2 * slave->turnaround_us + MBUS_TIMEOUT_ADAPTIVE_MARGIN;
+
+        if (adaptive < timeout)
+            timeout = adaptive;
+    }
+
+    return timeout;
 }
 
 void
-mbus_context_free(mbus_handle * handle)
+mbus_handle_timeout_observe(mbus_handle *handle, long turnaround_us)
 {
-    if (handle)
+    mbus_slave_data *slave;
+
+    if (handle == NULL || turnaround_us < 0 ||
+        (slave = mbus_handle_slave_lookup(handle, handle->stats_address, 1)) == NULL)
+        return;
+
+    // decaying maximum: follows slower replies at once, faster ones slowly
+    if (turnaround_us >= slave->turnaround_us)
+        slave->turnaround_us = turnaround_us;
+    else
+        slave->turnaround_us -= (slave->turnaround_us - turnaround_us) / 16;
+
+    if (slave->turnaround_samples < MBUS_TIMEOUT_ADAPTIVE_SAMPLES)
+        slave->turnaround_samples++;
+}
+
+//------------------------------------------------------------------------------
+/// The slave of the last request did not reply in time: forget what was
+/// learned, so the next request waits for the default timeout again.
+//------------------------------------------------------------------------------
+static void
+mbus_handle_timeout_expired(mbus_handle *handle)
+{
+    mbus_slave_data *slave;
+
+    if ((slave = mbus_handle_slave_lookup(handle, handle->stats_address, 0)) == NULL)
+        return;
+
+    slave->turnaround_samples = 0;
+    slave->turnaround_us = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Record the turnaround of a reply to the last request. On serial lines the
+/// time to transmit the reply itself is not part of the turnaround.
+//------------------------------------------------------------------------------
+static void
+mbus_handle_turnaround(mbus_handle *handle, mbus_frame *frame)
+{
+    mbus_serial_data *serial_data;
+    long long elapsed;
+
+    if (handle->tx_end_us == 0 ||
+        mbus_frame_direction(frame) == MBUS_CONTROL_MASK_DIR_M2S)
+        return;
+
+    elapsed = mbus_handle_clock_us() - handle->tx_end_us;
+    handle->tx_end_us = 0;
+
+    // the latency seen by the application includes the reply transmission
+    if (MBUS_STATS_ENABLED(handle) && elapsed >= 0)
     {
-        handle->free_auxdata(handle);
-        free(handle);
+        mbus_stats_latency_add(&(handle->stats->latency), (uint64_t) elapsed);
+
+        if (handle->stats_address >= 0 && handle->stats_address < 256)
+            mbus_stats_latency_add(&(handle->stats->address[handle->stats_address].latency), (uint64_t) elapsed);
+    }
+
+    if (handle->is_serial && (serial_data = (mbus_serial_data *) handle->auxdata) != NULL &&
+        serial_data->baudrate > 0)
+    {
+        // 11 bits per character (start, 8 data, parity, stop)
+        elapsed -= (long long) mbus_frame_wire_size(frame) * 11 * 1000000LL / serial_data->baudrate;
+    }
+
+    mbus_handle_timeout_observe(handle, (elapsed > 0) ? (long) elapsed : 0);
+}
+
+//------------------------------------------------------------------------------
+/// Receive a frame; the closing timeout of mbus_purge_frames is not counted
+/// in the stats.
+//------------------------------------------------------------------------------
+static int
+mbus_recv_frame_purge(mbus_handle * handle, mbus_frame *frame, int purge)
+{
+    int result = 0;
+
+    if (handle == NULL)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle for receive.\n", __PRETTY_FUNCTION__);
+        return MBUS_RECV_RESULT_ERROR;
+    }
+
+    if (frame == NULL)
+    {
+        MBUS_ERROR("%s: Invalid frame.\n", __PRETTY_FUNCTION__);
+        return MBUS_RECV_RESULT_ERROR;
     }
+
+    result = handle->recv(handle, frame);
+
+    switch (mbus_frame_direction(frame))
+    {
+        case MBUS_CONTROL_MASK_DIR_M2S:
+            if (handle->purge_first_frame == MBUS_FRAME_PURGE_M2S)
+                result = handle->recv(handle, frame);  // purge echo and retry
+            break;
+        case MBUS_CONTROL_MASK_DIR_S2M:
+            if (handle->purge_first_frame == MBUS_FRAME_PURGE_S2M)
+                result = handle->recv(handle, frame);  // purge echo and retry
+            break;
+    }
+
+    if (frame != NULL)
+    {
+        /* set timestamp to receive time */
+        time(&(frame->timestamp));
+
+        if (result == MBUS_RECV_RESULT_OK)
+            mbus_handle_turnaround(handle, frame);
+    }
+
+    // the closing timeout of mbus_purge_frames is expected
+    if (result == MBUS_RECV_RESULT_TIMEOUT && !purge)
+        mbus_handle_timeout_expired(handle);
+
+    if (!(purge && result == MBUS_RECV_RESULT_TIMEOUT))
+        mbus_stats_received(handle, result, (result == MBUS_RECV_RESULT_OK) ? mbus_frame_wire_size(frame) : 0);
+
+    return result;
 }
 
 int
-mbus_connect(mbus_handle * handle)
+mbus_recv_frame(mbus_handle * handle, mbus_frame *frame)
+{
+    return mbus_recv_frame_purge(handle, frame, 0);
+}
+
+int mbus_purge_frames(mbus_handle *handle)
+{
+    int err, received;
+    mbus_frame reply;
+
+    memset((void *)&reply, 0, sizeof(mbus_frame));
+
+    received = 0;
+    while (1)
+    {
+        err = mbus_recv_frame_purge(handle, &reply, 1);
+        if (err != MBUS_RECV_RESULT_OK &&
+            err != MBUS_RECV_RESULT_INVALID)
+            break;
+
+        received = 1;
+    }
+
+    return received;
+}
+
+mbus_frame *
+mbus_handle_frame_new(mbus_handle *handle, int frame_type)
+{
+    if (handle && handle->frame_pool)
+    {
+        return mbus_frame_pool_acquire(handle->frame_pool, frame_type);
+    }
+
+    return mbus_frame_new(frame_type);
+}
+
+int
+mbus_handle_set_baudrate(mbus_handle *handle, long baudrate)
+{
+    if (handle == NULL)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    if (handle->is_serial)
+        return mbus_serial_set_baudrate(handle, baudrate);
+
+    if (handle->open == mbus_sim_connect)
+        return mbus_sim_set_baudrate(handle, baudrate);
+
+    return -1;
+}
+
+long
+mbus_handle_get_baudrate(mbus_handle *handle)
+{
+    if (handle == NULL || handle->auxdata == NULL)
+        return -1;
+
+    if (handle->is_serial)
+        return ((mbus_serial_data *) handle->auxdata)->baudrate;
+
+    if (handle->open == mbus_sim_connect)
+        return mbus_sim_get_baudrate(handle);
+
+    return -1;
+}
+
+int
+mbus_handle_set_slave_baudrate(mbus_handle *handle, int address, long baudrate)
+{
+    if (handle == NULL || address < 0 || address > MBUS_MAX_PRIMARY_SLAVES || baudrate < 0)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle, address or baud rate.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    if (handle->bus_baudrate == 0 &&
+        (handle->bus_baudrate = mbus_handle_get_baudrate(handle)) <= 0)
+    {
+        handle->bus_baudrate = 0;
+        MBUS_ERROR("%s: Handle has no baud rate.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    handle->baudrate[address] = (baudrate == handle->bus_baudrate) ? 0 : baudrate;
+
+    return 0;
+}
+
+long
+mbus_handle_slave_baudrate(mbus_handle *handle, int address)
+{
+    if (handle == NULL || handle->bus_baudrate == 0)
+        return 0;
+
+    if (address >= 0 && address <= MBUS_MAX_PRIMARY_SLAVES && handle->baudrate[address] != 0)
+        return handle->baudrate[address];
+
+    return handle->bus_baudrate;
+}
+
+//------------------------------------------------------------------------------
+/// Set the port to the rate of the slave a frame is sent to
+//------------------------------------------------------------------------------
+static int
+mbus_handle_select_baudrate(mbus_handle *handle, mbus_frame *frame)
+{
+    long baudrate;
+
+    if (handle->bus_baudrate == 0)
+        return 0;
+
+    baudrate = mbus_handle_slave_baudrate(handle, frame->address);
+
+    if (baudrate == mbus_handle_get_baudrate(handle))
+        return 0;
+
+    return mbus_handle_set_baudrate(handle, baudrate);
+}
+
+mbus_slave_data *
+mbus_handle_slave_data(mbus_handle *handle, int address)
+{
+    if (handle == NULL)
+        return NULL;
+
+    return mbus_handle_slave_lookup(handle, address, 1);
+}
+
+//------------------------------------------------------------------------------
+/// Follow the slave state on the bus: a selection frame selects a secondary
+/// address, SND_NKE resets the FCB of the slaves it is sent to.
+//------------------------------------------------------------------------------
+static void
+mbus_handle_track_request(mbus_handle *handle, mbus_frame *frame)
+{
+    mbus_slave_data *slave;
+
+    if (frame->type == MBUS_FRAME_TYPE_LONG &&
+        frame->address == MBUS_ADDRESS_NETWORK_LAYER &&
+        frame->control_information == MBUS_CONTROL_INFO_SELECT_SLAVE &&
+        frame->data_size >= 8)
+    {
+        memcpy(handle->selected, frame->data, 8);
+        handle->has_selected = 1;
+        return;
+    }
+
+    if (frame->type != MBUS_FRAME_TYPE_SHORT ||
+        (frame->control & ~MBUS_CONTROL_MASK_FCB) != MBUS_CONTROL_MASK_SND_NKE)
+        return;
+
+    if (frame->address == MBUS_ADDRESS_BROADCAST_REPLY ||
+        frame->address == MBUS_ADDRESS_BROADCAST_NOREPLY)
+    {
+        mbus_slave_table_reset(&(handle->slaves));
+        handle->has_selected = 0;
+        return;
+    }
+
+    if ((slave = mbus_handle_slave_data(handle, frame->address)) != NULL)
+        mbus_slave_data_init(slave);
+
+    // SND_NKE to the network layer deselects the slave
+    if (frame->address == MBUS_ADDRESS_NETWORK_LAYER)
+        handle->has_selected = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Update the slave state after a valid reply to a request
+//------------------------------------------------------------------------------
+static void
+mbus_handle_track_reply(mbus_handle *handle, mbus_frame *request, mbus_frame *reply)
+{
+    mbus_slave_data *slave;
+
+    if ((slave = mbus_handle_slave_data(handle, request->address)) == NULL)
+        return;
+
+    slave->state_fcb = (request->control & MBUS_CONTROL_MASK_FCB) ? 0 : 1;
+    slave->state_acd = (reply->control & MBUS_CONTROL_MASK_ACD) ? 1 : 0;
+}
+
+int
+mbus_send_frame(mbus_handle * handle, mbus_frame *frame)
+{
+    int ret;
+
+    if (handle == NULL)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle for send.\n", __PRETTY_FUNCTION__);
+        return 0;
+    }
+
+    if (mbus_handle_select_baudrate(handle, frame) != 0)
+    {
+        MBUS_ERROR("%s: Failed to set the baud rate of address %d.\n", __PRETTY_FUNCTION__, frame->address);
+        return -1;
+    }
+
+    ret = handle->send(handle, frame);
+
+    // the response timeout starts when the request has been transmitted
+    handle->tx_end_us = (ret == 0) ? mbus_handle_clock_us() : 0;
+
+    if (ret == 0)
+    {
+        mbus_stats_sent(handle, mbus_frame_wire_size(frame), frame->address);
+        mbus_handle_track_request(handle, frame);
+    }
+
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+/// Descriptor of the connection, for the event loop of the application
+//------------------------------------------------------------------------------
+int
+mbus_handle_fd(mbus_handle *handle)
 {
     if (handle == NULL)
     {
-        MBUS_ERROR("%s: Invalid M-Bus handle for disconnect.\n", __PRETTY_FUNCTION__);
+        MBUS_ERROR("%s: Invalid M-Bus handle.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    return handle->fd;
+}
+
+int
+mbus_handle_set_nonblocking(mbus_handle *handle, int enable)
+{
+    int flags;
+
+    if (handle == NULL || handle->parser == NULL)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    if ((flags = fcntl(handle->fd, F_GETFL, 0)) == -1)
+    {
+        MBUS_ERROR("%s: Failed to get fd flags: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+        return -1;
+    }
+
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+
+    if (fcntl(handle->fd, F_SETFL, flags) == -1)
+    {
+        MBUS_ERROR("%s: Failed to set fd flags: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+        return -1;
+    }
+
+    handle->nonblocking = enable ? 1 : 0;
+    handle->purge_pending = 0;
+    handle->deadline_us = 0;
+    handle->tx_len = 0;
+    handle->tx_sent = 0;
+
+    return 0;
+}
+
+int
+mbus_handle_send_async(mbus_handle *handle, mbus_frame *frame)
+{
+    int len;
+
+    if (handle == NULL || frame == NULL || !handle->nonblocking)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle or frame.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    if (handle->tx_sent < handle->tx_len)
+    {
+        MBUS_ERROR("%s: Previous frame not sent yet.\n", __PRETTY_FUNCTION__);
         return -1;
     }
 
-    return handle->open(handle);
-}
+    if (mbus_handle_select_baudrate(handle, frame) != 0)
+    {
+        MBUS_ERROR("%s: Failed to set the baud rate of address %d.\n", __PRETTY_FUNCTION__, frame->address);
+        return -1;
+    }
 
-int
-mbus_disconnect(mbus_handle * handle)
-{
-    if (handle == NULL)
+    if ((len = mbus_frame_pack(frame, handle->tx_buff, sizeof(handle->tx_buff))) == -1)
     {
-        MBUS_ERROR("%s: Invalid M-Bus handle for disconnect.\n", __PRETTY_FUNCTION__);
+        MBUS_ERROR("%s: mbus_frame_pack failed\n", __PRETTY_FUNCTION__);
         return -1;
     }
 
-    return handle->close(handle);
+    handle->tx_len = (size_t) len;
+    handle->tx_sent = 0;
+    handle->deadline_us = 0;
+    handle->stats_address = frame->address;
+
+    mbus_handle_track_request(handle, frame);
+
+    //
+    // call the send event function, if the callback function is registered
+    //
+    if (handle->send_event)
+        handle->send_event(handle->is_serial ? MBUS_HANDLE_TYPE_SERIAL : MBUS_HANDLE_TYPE_TCP,
+                           (const char *) handle->tx_buff, handle->tx_len);
+
+    mbus_handle_capture(handle, MBUS_CAPTURE_SEND, handle->tx_buff, handle->tx_len);
+
+    // try to write right away, most of the time the fd is writable
+    return (mbus_handle_on_writable(handle) == MBUS_RECV_RESULT_ERROR) ? -1 : 0;
 }
 
 int
-mbus_context_set_option(mbus_handle * handle, mbus_context_option option, long value)
+mbus_handle_events(mbus_handle *handle)
 {
     if (handle == NULL)
-    {
-        MBUS_ERROR("%s: Invalid M-Bus handle to set option.\n", __PRETTY_FUNCTION__);
-        return -1;
-    }
+        return 0;
 
-    switch (option)
-    {
-        case MBUS_OPTION_MAX_DATA_RETRY:
-            if ((value >= 0) && (value <= 9))
-            {
-                handle->max_data_retry = value;
-                return 0;
-            }
-            break;
-        case MBUS_OPTION_MAX_SEARCH_RETRY:
-            if ((value >= 0) && (value <= 9))
-            {
-                handle->max_search_retry = value;
-                return 0;
-            }
-            break;
-        case MBUS_OPTION_PURGE_FIRST_FRAME:
-            if ((value == MBUS_FRAME_PURGE_NONE) ||
-                (value == MBUS_FRAME_PURGE_M2S)  ||
-                (value == MBUS_FRAME_PURGE_S2M))
-            {
-                handle->purge_first_frame = value;
-                return 0;
-            }
-            break;
-    }
+    if (handle->tx_sent < handle->tx_len)
+        return MBUS_HANDLE_EVENT_WRITABLE;
 
-    return -1; // unable to set option
+    return MBUS_HANDLE_EVENT_READABLE;
 }
 
 int
-mbus_recv_frame(mbus_handle * handle, mbus_frame *frame)
+mbus_handle_on_writable(mbus_handle *handle)
 {
-    int result = 0;
+    ssize_t ret;
 
-    if (handle == NULL)
+    if (handle == NULL || !handle->nonblocking)
     {
-        MBUS_ERROR("%s: Invalid M-Bus handle for receive.\n", __PRETTY_FUNCTION__);
+        MBUS_ERROR("%s: Invalid M-Bus handle.\n", __PRETTY_FUNCTION__);
         return MBUS_RECV_RESULT_ERROR;
     }
 
-    if (frame == NULL)
+    while (handle->tx_sent < handle->tx_len)
     {
-        MBUS_ERROR("%s: Invalid frame.\n", __PRETTY_FUNCTION__);
-        return MBUS_RECV_RESULT_ERROR;
-    }
+        ret = write(handle->fd, &(handle->tx_buff[handle->tx_sent]), handle->tx_len - handle->tx_sent);
 
-    result = handle->recv(handle, frame);
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
 
-    switch (mbus_frame_direction(frame))
-    {
-        case MBUS_CONTROL_MASK_DIR_M2S:
-            if (handle->purge_first_frame == MBUS_FRAME_PURGE_M2S)
-                result = handle->recv(handle, frame);  // purge echo and retry
-            break;
-        case MBUS_CONTROL_MASK_DIR_S2M:
-            if (handle->purge_first_frame == MBUS_FRAME_PURGE_S2M)
-                result = handle->recv(handle, frame);  // purge echo and retry
-            break;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return MBUS_RECV_RESULT_PENDING;
+
+            MBUS_ERROR("%s: Failed to write frame: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+            handle->tx_len = handle->tx_sent = 0;
+            return MBUS_RECV_RESULT_ERROR;
+        }
+
+        handle->tx_sent += (size_t) ret;
     }
 
-    if (frame != NULL)
+    if (handle->tx_len > 0)
     {
-        /* set timestamp to receive time */
-        time(&(frame->timestamp));
+        // frame is out, the response timeout starts now
+        mbus_stats_sent(handle, handle->tx_len, handle->stats_address);
+        handle->tx_len = handle->tx_sent = 0;
+        handle->purge_pending = 1;
+        handle->tx_end_us = mbus_handle_clock_us();
+        handle->deadline_us = handle->tx_end_us + mbus_handle_timeout_us(handle);
     }
 
-    return result;
+    return MBUS_RECV_RESULT_OK;
 }
 
-int mbus_purge_frames(mbus_handle *handle)
+int
+mbus_handle_on_readable(mbus_handle *handle, mbus_frame *frame)
 {
-    int err, received;
-    mbus_frame reply;
+    unsigned char buff[MBUS_FRAME_PARSER_BUFF_SIZE];
+    const unsigned char *raw;
+    size_t raw_len, space;
+    ssize_t nread;
+    int result, purge;
 
-    memset((void *)&reply, 0, sizeof(mbus_frame));
+    if (handle == NULL || frame == NULL || handle->parser == NULL || !handle->nonblocking)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle or frame.\n", __PRETTY_FUNCTION__);
+        return MBUS_RECV_RESULT_ERROR;
+    }
 
-    received = 0;
     while (1)
     {
-        err = mbus_recv_frame(handle, &reply);
-        if (err != MBUS_RECV_RESULT_OK &&
-            err != MBUS_RECV_RESULT_INVALID)
-            break;
+        //
+        // hand out buffered frames first, then read what is available
+        //
+        while ((result = mbus_frame_parser_next(handle->parser, frame, &raw, &raw_len)) != 0)
+        {
+            if (handle->recv_event)
+                handle->recv_event(handle->is_serial ? MBUS_HANDLE_TYPE_SERIAL : MBUS_HANDLE_TYPE_TCP,
+                                   (const char *) raw, raw_len);
 
-        received = 1;
-    }
+            mbus_handle_capture(handle, MBUS_CAPTURE_RECV, raw, raw_len);
 
-    return received;
+            if (result < 0)
+            {
+                handle->purge_pending = 0;
+                handle->deadline_us = 0;
+                mbus_stats_received(handle, MBUS_RECV_RESULT_INVALID, 0);
+                return MBUS_RECV_RESULT_INVALID;
+            }
+
+            purge = 0;
+            if (handle->purge_pending)
+            {
+                switch (mbus_frame_direction(frame))
+                {
+                    case MBUS_CONTROL_MASK_DIR_M2S:
+                        purge = (handle->purge_first_frame == MBUS_FRAME_PURGE_M2S);
+                        break;
+                    case MBUS_CONTROL_MASK_DIR_S2M:
+                        purge = (handle->purge_first_frame == MBUS_FRAME_PURGE_S2M);
+                        break;
+                }
+                handle->purge_pending = 0;
+            }
+
+            if (purge)
+                continue;  // drop the echo, wait for the reply
+
+            /* set timestamp to receive time */
+            time(&(frame->timestamp));
+            mbus_handle_turnaround(handle, frame);
+            handle->deadline_us = 0;
+            mbus_stats_received(handle, MBUS_RECV_RESULT_OK, raw_len);
+            return MBUS_RECV_RESULT_OK;
+        }
+
+        space = sizeof(handle->parser->buff) - mbus_frame_parser_pending(handle->parser);
+        if (space > sizeof(buff))
+            space = sizeof(buff);
+
+        nread = read(handle->fd, buff, space);
+
+        if (nread == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return MBUS_RECV_RESULT_PENDING;
+
+            MBUS_ERROR("%s: Failed to read data: %s\n", __PRETTY_FUNCTION__, strerror(errno));
+            mbus_frame_parser_reset(handle->parser);
+            handle->deadline_us = 0;
+            mbus_stats_received(handle, MBUS_RECV_RESULT_ERROR, 0);
+            return MBUS_RECV_RESULT_ERROR;
+        }
+
+        if (nread == 0)
+        {
+            // serial port with VMIN = 0: no data available
+            if (handle->is_serial)
+                return MBUS_RECV_RESULT_PENDING;
+
+            mbus_error_str_set("M-Bus tcp transport layer connection closed by remote host.");
+            mbus_frame_parser_reset(handle->parser);
+            handle->deadline_us = 0;
+            mbus_stats_received(handle, MBUS_RECV_RESULT_RESET, 0);
+            return MBUS_RECV_RESULT_RESET;
+        }
+
+        mbus_frame_parser_append(handle->parser, buff, (size_t) nread);
+
+        // like VTIME / SO_RCVTIMEO the timer restarts with every chunk
+        if (handle->deadline_us)
+            handle->deadline_us = mbus_handle_clock_us() + mbus_handle_timeout_us(handle);
+    }
 }
 
 int
-mbus_send_frame(mbus_handle * handle, mbus_frame *frame)
+mbus_handle_next_timeout_ms(mbus_handle *handle)
 {
-    if (handle == NULL)
-    {
-        MBUS_ERROR("%s: Invalid M-Bus handle for send.\n", __PRETTY_FUNCTION__);
+    long long remaining;
+
+    if (handle == NULL || handle->deadline_us == 0)
+        return -1;
+
+    remaining = handle->deadline_us - mbus_handle_clock_us();
+
+    if (remaining <= 0)
         return 0;
-    }
 
-    return handle->send(handle, frame);
+    // round up, waking up early would just spin
+    return (int) ((remaining + 999) / 1000);
+}
+
+int
+mbus_handle_on_timeout(mbus_handle *handle)
+{
+    int result;
+
+    if (handle == NULL || handle->deadline_us == 0)
+        return MBUS_RECV_RESULT_PENDING;
+
+    if (mbus_handle_clock_us() < handle->deadline_us)
+        return MBUS_RECV_RESULT_PENDING;
+
+    // an incomplete frame is invalid data, like for mbus_recv_frame
+    result = (mbus_frame_parser_pending(handle->parser) > 0) ? MBUS_RECV_RESULT_INVALID : MBUS_RECV_RESULT_TIMEOUT;
+
+    mbus_frame_parser_reset(handle->parser);
+    handle->purge_pending = 0;
+    handle->deadline_us = 0;
+
+    if (result == MBUS_RECV_RESULT_TIMEOUT)
+        mbus_handle_timeout_expired(handle);
+
+    mbus_stats_received(handle, result, 0);
+
+    return result;
 }
 
 //------------------------------------------------------------------------------
@@ -1743,7 +3837,7 @@ mbus_send_select_frame(mbus_handle * handle, const char *secondary_addr_str)
 {
     mbus_frame *frame;
 
-    frame = mbus_frame_new(MBUS_FRAME_TYPE_LONG);
+    frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_LONG);
 
     if (mbus_frame_select_secondary_pack(frame, (char*) secondary_addr_str) == -1)
     {
@@ -1811,7 +3905,7 @@ mbus_send_switch_baudrate_frame(mbus_handle * handle, int address, long baudrate
         return -1;
     }
 
-    frame = mbus_frame_new(MBUS_FRAME_TYPE_CONTROL);
+    frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_CONTROL);
 
     if (frame == NULL)
     {
@@ -1855,7 +3949,7 @@ mbus_send_application_reset_frame(mbus_handle * handle, int address, int subcode
         return -1;
     }
 
-    frame = mbus_frame_new(MBUS_FRAME_TYPE_LONG);
+    frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_LONG);
 
     if (frame == NULL)
     {
@@ -1903,7 +3997,7 @@ mbus_send_request_frame(mbus_handle * handle, int address)
         return -1;
     }
 
-    frame = mbus_frame_new(MBUS_FRAME_TYPE_SHORT);
+    frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_SHORT);
 
     if (frame == NULL)
     {
@@ -1951,7 +4045,7 @@ mbus_send_user_data_frame(mbus_handle * handle, int address, const unsigned char
         return -1;
     }
 
-    frame = mbus_frame_new(MBUS_FRAME_TYPE_LONG);
+    frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_LONG);
 
     if (frame == NULL)
     {
@@ -2012,6 +4106,7 @@ mbus_sendrecv_request(mbus_handle *handle, int address, mbus_frame *reply, int m
     int retval = 0, more_frames = 1, retry = 0;
     mbus_frame_data reply_data;
     mbus_frame *frame, *next_frame;
+    mbus_slave_data *slave;
     int frame_count = 0, result;
 
     if (handle == NULL)
@@ -2026,7 +4121,7 @@ mbus_sendrecv_request(mbus_handle *handle, int address, mbus_frame *reply, int m
         return 1;
     }
 
-    frame = mbus_frame_new(MBUS_FRAME_TYPE_SHORT);
+    frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_SHORT);
 
     if (frame == NULL)
     {
@@ -2036,8 +4131,12 @@ mbus_sendrecv_request(mbus_handle *handle, int address, mbus_frame *reply, int m
 
     frame->control = MBUS_CONTROL_MASK_REQ_UD2 |
                      MBUS_CONTROL_MASK_DIR_M2S |
-                     MBUS_CONTROL_MASK_FCV     |
-                     MBUS_CONTROL_MASK_FCB;
+                     MBUS_CONTROL_MASK_FCV;
+
+    // continue the FCB sequence of the slave
+    slave = mbus_handle_slave_data(handle, address);
+    if (slave == NULL || slave->state_fcb)
+        frame->control |= MBUS_CONTROL_MASK_FCB;
 
     frame->address = address;
 
@@ -2076,18 +4175,23 @@ mbus_sendrecv_request(mbus_handle *handle, int address, mbus_frame *reply, int m
         if (result == MBUS_RECV_RESULT_OK)
         {
             retry = 0;
+            mbus_handle_track_reply(handle, frame, next_frame);
             mbus_purge_frames(handle);
         }
         else if (result == MBUS_RECV_RESULT_TIMEOUT)
         {
             MBUS_ERROR("%s: No M-Bus response frame received.\n", __PRETTY_FUNCTION__);
             retry++;
+            if (retry <= handle->max_data_retry)
+                mbus_stats_event(handle, MBUS_STATS_EVENT_RETRY);
             continue;
         }
         else if (result == MBUS_RECV_RESULT_INVALID)
         {
             MBUS_ERROR("%s: Received invalid M-Bus response frame.\n", __PRETTY_FUNCTION__);
             retry++;
+            if (retry <= handle->max_data_retry)
+                mbus_stats_event(handle, MBUS_STATS_EVENT_RETRY);
             mbus_purge_frames(handle);
             continue;
         }
@@ -2135,7 +4239,7 @@ mbus_sendrecv_request(mbus_handle *handle, int address, mbus_frame *reply, int m
                 more_frames = 1;
 
                 // allocate new frame and increment next_frame pointer
-                next_frame->next = mbus_frame_new(MBUS_FRAME_TYPE_ANY);
+                next_frame->next = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_ANY);
 
                 if (next_frame->next == NULL)
                 {
@@ -2144,30 +4248,231 @@ mbus_sendrecv_request(mbus_handle *handle, int address, mbus_frame *reply, int m
                     more_frames = 0;
                 }
 
-                next_frame = next_frame->next;
+                next_frame = next_frame->next;
+
+                // toogle FCB bit
+                frame->control ^= MBUS_CONTROL_MASK_FCB;
+            }
+            else
+            {
+                if (debug)
+                    printf("%s: debug: no more frames\n", __PRETTY_FUNCTION__);
+            }
+        }
+
+        if (reply_data.data_var.record)
+        {
+            // free's up the whole list
+            mbus_data_record_free(reply_data.data_var.record);
+        }
+    }
+
+    mbus_frame_free(frame);
+    return retval;
+}
+
+
+//------------------------------------------------------------------------------
+/// Allocate a frame ring for streamed multi-telegram readouts
+//------------------------------------------------------------------------------
+mbus_frame_ring *
+mbus_frame_ring_new(size_t size)
+{
+    mbus_frame_ring *ring;
+
+    if (size < 2)
+    {
+        MBUS_ERROR("%s: a frame ring needs at least 2 frames.\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    if ((ring = (mbus_frame_ring *) malloc(sizeof(mbus_frame_ring))) == NULL)
+    {
+        MBUS_ERROR("%s: failed to allocate frame ring.\n", __PRETTY_FUNCTION__);
+        return NULL;
+    }
+
+    if ((ring->frames = (mbus_frame *) calloc(size, sizeof(mbus_frame))) == NULL)
+    {
+        MBUS_ERROR("%s: failed to allocate frame ring.\n", __PRETTY_FUNCTION__);
+        free(ring);
+        return NULL;
+    }
+
+    ring->size = size;
+    ring->count = 0;
+
+    return ring;
+}
+
+void
+mbus_frame_ring_free(mbus_frame_ring *ring)
+{
+    if (ring)
+    {
+        free(ring->frames);
+        free(ring);
+    }
+}
+
+mbus_frame *
+mbus_frame_ring_get(mbus_frame_ring *ring, size_t index)
+{
+    if (ring == NULL || index >= ring->count || ring->count - index > ring->size)
+        return NULL;
+
+    return &(ring->frames[index % ring->size]);
+}
+
+//------------------------------------------------------------------------------
+/// Send a request and stream the replies through a frame ring. The next
+/// request goes out as soon as a reply is validated, and the reply is handed
+/// to the event callback while the slave answers the next request.
+//------------------------------------------------------------------------------
+int
+mbus_sendrecv_request_stream(mbus_handle *handle, int address, mbus_frame_ring *ring,
+                             int max_frames, mbus_telegram_event event, void *userdata)
+{
+    mbus_frame request[2];
+    mbus_frame_view view;
+    mbus_frame *frame;
+    mbus_slave_data *slave;
+    int retval = 0, retry = 0, fcb = 0, more, result;
+
+    if (handle == NULL || ring == NULL || ring->size < 2)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle or frame ring for request.\n", __PRETTY_FUNCTION__);
+        return 1;
+    }
+
+    if (mbus_is_primary_address(address) == 0)
+    {
+        MBUS_ERROR("%s: invalid address %d\n", __PRETTY_FUNCTION__, address);
+        return 1;
+    }
+
+    //
+    // requests for both states of the FCB bit, toggled for every telegram
+    //
+    memset((void *)request, 0, sizeof(request));
+    request[0].type    = MBUS_FRAME_TYPE_SHORT;
+    request[0].start1  = MBUS_FRAME_SHORT_START;
+    request[0].stop    = MBUS_FRAME_STOP;
+    request[0].control = MBUS_CONTROL_MASK_REQ_UD2 |
+                         MBUS_CONTROL_MASK_DIR_M2S |
+                         MBUS_CONTROL_MASK_FCV     |
+                         MBUS_CONTROL_MASK_FCB;
+    request[0].address = address;
+    request[1] = request[0];
+    request[1].control ^= MBUS_CONTROL_MASK_FCB;
+
+    // continue the FCB sequence of the slave
+    if ((slave = mbus_handle_slave_data(handle, address)) != NULL && !slave->state_fcb)
+        fcb = 1;
+
+    ring->count = 0;
+
+    if (mbus_send_frame(handle, &request[fcb]) == -1)
+    {
+        MBUS_ERROR("%s: failed to send mbus frame.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    while (1)
+    {
+        frame = &(ring->frames[ring->count % ring->size]);
+
+        result = mbus_recv_frame(handle, frame);
+
+        if (result == MBUS_RECV_RESULT_TIMEOUT || result == MBUS_RECV_RESULT_INVALID)
+        {
+            if (result == MBUS_RECV_RESULT_INVALID)
+            {
+                MBUS_ERROR("%s: Received invalid M-Bus response frame.\n", __PRETTY_FUNCTION__);
+                mbus_purge_frames(handle);
+            }
+            else
+            {
+                MBUS_ERROR("%s: No M-Bus response frame received.\n", __PRETTY_FUNCTION__);
+            }
+
+            if (++retry > handle->max_data_retry)
+            {
+                // Give up
+                retval = 1;
+                break;
+            }
+
+            mbus_stats_event(handle, MBUS_STATS_EVENT_RETRY);
+
+            // repeat with the same FCB, the slave repeats its reply
+            if (mbus_send_frame(handle, &request[fcb]) == -1)
+            {
+                MBUS_ERROR("%s: failed to send mbus frame.\n", __PRETTY_FUNCTION__);
+                retval = -1;
+                break;
+            }
+            continue;
+        }
+        else if (result != MBUS_RECV_RESULT_OK)
+        {
+            MBUS_ERROR("%s: Failed to receive M-Bus response frame.\n", __PRETTY_FUNCTION__);
+            retval = 1;
+            break;
+        }
+
+        retry = 0;
+        frame->next = NULL;
+        mbus_handle_track_reply(handle, &request[fcb], frame);
+
+        //
+        // Only variable data replies can announce more telegrams (DIF=0x1F)
+        //
+        more = 0;
+        if (frame->control_information == MBUS_CONTROL_INFO_RESP_VARIABLE)
+        {
+            mbus_frame_view_of(&view, frame);
+
+            if ((more = mbus_frame_view_more_records_follow(&view)) == -1)
+            {
+                MBUS_ERROR("%s: M-bus data parse error.\n", __PRETTY_FUNCTION__);
+                retval = 1;
+                break;
+            }
+        }
+
+        ring->count++;
 
-                // toogle FCB bit
-                frame->control ^= MBUS_CONTROL_MASK_FCB;
-            }
-            else
+        if (max_frames > 0 && ring->count >= (size_t) max_frames)
+            more = 0;
+
+        if (more)
+        {
+            fcb ^= 1;
+
+            if (mbus_send_frame(handle, &request[fcb]) == -1)
             {
-                if (debug)
-                    printf("%s: debug: no more frames\n", __PRETTY_FUNCTION__);
+                MBUS_ERROR("%s: failed to send mbus frame.\n", __PRETTY_FUNCTION__);
+                retval = -1;
+                break;
             }
         }
 
-        if (reply_data.data_var.record)
+        if (event && event(handle, frame, ring->count - 1, userdata) != 0)
         {
-            // free's up the whole list
-            mbus_data_record_free(reply_data.data_var.record);
+            // drop the reply to the request already sent
+            if (more)
+                mbus_purge_frames(handle);
+            break;
         }
+
+        if (!more)
+            break;
     }
 
-    mbus_frame_free(frame);
     return retval;
 }
 
-
 //------------------------------------------------------------------------------
 // send a data request packet to from master to slave and optional purge response
 //------------------------------------------------------------------------------
@@ -2183,7 +4488,7 @@ mbus_send_ping_frame(mbus_handle *handle, int address, char purge_response)
         return 1;
     }
 
-    frame = mbus_frame_new(MBUS_FRAME_TYPE_SHORT);
+    frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_SHORT);
 
     if (frame == NULL)
     {
@@ -2210,6 +4515,129 @@ mbus_send_ping_frame(mbus_handle *handle, int address, char purge_response)
     return retval;
 }
 
+//------------------------------------------------------------------------------
+/// Send count SND_NKE to a slave at its current rate, allowing for
+/// max_data_retry lost replies. Returns 0 if all were acknowledged.
+//------------------------------------------------------------------------------
+static int
+mbus_baudrate_probe(mbus_handle *handle, int address, int count)
+{
+    mbus_frame reply;
+    int failures = 0;
+
+    while (count > 0)
+    {
+        if (mbus_send_ping_frame(handle, address, 0) != 0)
+            return -1;
+
+        memset((void *)&reply, 0, sizeof(mbus_frame));
+
+        if (mbus_recv_frame(handle, &reply) == MBUS_RECV_RESULT_OK &&
+            mbus_frame_type(&reply) == MBUS_FRAME_TYPE_ACK)
+        {
+            count--;
+            continue;
+        }
+
+        if (++failures > handle->max_data_retry)
+            return -1;
+
+        mbus_stats_event(handle, MBUS_STATS_EVENT_RETRY);
+        mbus_purge_frames(handle);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Ask a slave to switch to another rate. Returns 0 if the slave acknowledged
+/// the switch, 1 if not and -1 on error.
+//------------------------------------------------------------------------------
+static int
+mbus_baudrate_switch(mbus_handle *handle, int address, long baudrate)
+{
+    mbus_frame reply;
+    int ret;
+
+    if (mbus_send_switch_baudrate_frame(handle, address, baudrate) != 0)
+        return -1;
+
+    memset((void *)&reply, 0, sizeof(mbus_frame));
+
+    ret = mbus_recv_frame(handle, &reply);
+
+    // give the slave time to reconfigure its UART
+    if (handle->is_serial)
+        usleep(MBUS_BAUDRATE_SETTLE_US);
+
+    return (ret == MBUS_RECV_RESULT_OK && mbus_frame_type(&reply) == MBUS_FRAME_TYPE_ACK) ? 0 : 1;
+}
+
+long
+mbus_negotiate_baudrate(mbus_handle *handle, int address, long max_baudrate)
+{
+    static const long rates[] = { 300, 600, 1200, 2400, 4800, 9600, 19200, 38400 };
+    long current;
+    size_t i;
+    int ret;
+
+    if (handle == NULL || address < 0 || address > MBUS_MAX_PRIMARY_SLAVES)
+    {
+        MBUS_ERROR("%s: Invalid M-Bus handle or address.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    // start managing slave rates, taking the port rate as the bus rate
+    if (mbus_handle_set_slave_baudrate(handle, address, mbus_handle_slave_baudrate(handle, address)) == -1)
+        return -1;
+
+    current = mbus_handle_slave_baudrate(handle, address);
+
+    if (mbus_baudrate_probe(handle, address, 1) != 0)
+    {
+        MBUS_ERROR("%s: No reply from address %d at %ld baud.\n", __PRETTY_FUNCTION__, address, current);
+        return -1;
+    }
+
+    for (i = 0; i < NITEMS(rates) && rates[i] <= max_baudrate; i++)
+    {
+        if (rates[i] <= current)
+            continue;
+
+        if ((ret = mbus_baudrate_switch(handle, address, rates[i])) == -1)
+            break;
+
+        // no ACK: the slave refused the rate, unless only the ACK got lost
+        if (ret == 1 && mbus_baudrate_probe(handle, address, 1) == 0)
+            break;
+
+        mbus_handle_set_slave_baudrate(handle, address, rates[i]);
+
+        if (mbus_baudrate_probe(handle, address, MBUS_BAUDRATE_PROBES) == 0)
+        {
+            current = rates[i];
+            continue;
+        }
+
+        // unreliable at the new rate, fall back to the last good one
+        if (ret == 0)
+            mbus_baudrate_switch(handle, address, current);
+
+        mbus_handle_set_slave_baudrate(handle, address, current);
+
+        if (mbus_baudrate_probe(handle, address, 1) != 0)
+        {
+            MBUS_ERROR("%s: No reply from address %d after switching back to %ld baud.\n",
+                       __PRETTY_FUNCTION__, address, current);
+            return -1;
+        }
+
+        break;
+    }
+
+    return current;
+}
+
 //------------------------------------------------------------------------------
 // Select a device using the supplied secondary address  (mask).
 //------------------------------------------------------------------------------
@@ -2246,6 +4674,7 @@ mbus_select_secondary_address(mbus_handle * handle, const char *mask)
     {
         /* check for more data (collision) */
         mbus_purge_frames(handle);
+        mbus_stats_event(handle, MBUS_STATS_EVENT_COLLISION);
         return MBUS_PROBE_COLLISION;
     }
 
@@ -2254,6 +4683,7 @@ mbus_select_secondary_address(mbus_handle * handle, const char *mask)
         /* check for more data (collision) */
         if (mbus_purge_frames(handle))
         {
+            mbus_stats_event(handle, MBUS_STATS_EVENT_COLLISION);
             return MBUS_PROBE_COLLISION;
         }
 
@@ -2309,20 +4739,22 @@ mbus_probe_secondary_address(mbus_handle *handle, const char *mask, char *matchi
             {
                 /* check for more data (collision) */
                 mbus_purge_frames(handle);
+                mbus_stats_event(handle, MBUS_STATS_EVENT_COLLISION);
                 return MBUS_PROBE_COLLISION;
             }
 
             /* check for more data (collision) */
             if (mbus_purge_frames(handle))
             {
+                mbus_stats_event(handle, MBUS_STATS_EVENT_COLLISION);
                 return MBUS_PROBE_COLLISION;
             }
 
             if (mbus_frame_type(&reply) == MBUS_FRAME_TYPE_LONG)
             {
-                char *addr = mbus_frame_get_secondary_address(&reply);
+                char addr[17];
 
-                if (addr == NULL)
+                if (mbus_frame_get_secondary_address_r(&reply, addr, sizeof(addr)) == NULL)
                 {
                     // show error message, but procede with scan
                     MBUS_ERROR("Failed to generate secondary address from M-Bus reply frame: %s\n",
@@ -2522,6 +4954,323 @@ mbus_scan_2nd_address_range(mbus_handle * handle, int pos, char *addr_mask)
     return 0;
 }
 
+//------------------------------------------------------------------------------
+// Initialize an empty presence cache
+//------------------------------------------------------------------------------
+void
+mbus_presence_cache_init(mbus_presence_cache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    memset((void *)cache, 0, sizeof(mbus_presence_cache));
+    cache->absent_interval = 3600;
+}
+
+//------------------------------------------------------------------------------
+// Load the entries of a presence cache from a text file
+//------------------------------------------------------------------------------
+int
+mbus_presence_cache_load(mbus_presence_cache *cache, const char *path)
+{
+    mbus_presence_entry *entry;
+    char line[256], secondary[17];
+    long last_seen, last_probed, latency;
+    int address, present;
+    FILE *fp;
+
+    if (cache == NULL || path == NULL)
+    {
+        MBUS_ERROR("%s: Invalid cache or path.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        MBUS_ERROR("%s: Failed to open %s.\n", __PRETTY_FUNCTION__, path);
+        return -1;
+    }
+
+    memset((void *)cache->entry, 0, sizeof(cache->entry));
+
+    // address present secondary last_seen last_probed latency_us
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (line[0] == '#')
+            continue;
+
+        if (sscanf(line, "%d %d %16s %ld %ld %ld", &address, &present, secondary,
+                   &last_seen, &last_probed, &latency) != 6 ||
+            address < 0 || address > MBUS_MAX_PRIMARY_SLAVES)
+            continue;
+
+        entry = &(cache->entry[address]);
+        entry->present = (present != 0);
+        entry->last_seen = (time_t) last_seen;
+        entry->last_probed = (time_t) last_probed;
+        entry->latency_us = latency;
+
+        if (mbus_is_secondary_address(secondary))
+            snprintf(entry->secondary, sizeof(entry->secondary), "%s", secondary);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Store the entries of a presence cache in a text file
+//------------------------------------------------------------------------------
+int
+mbus_presence_cache_save(const mbus_presence_cache *cache, const char *path)
+{
+    const mbus_presence_entry *entry;
+    int address, ret;
+    FILE *fp;
+
+    if (cache == NULL || path == NULL)
+    {
+        MBUS_ERROR("%s: Invalid cache or path.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    if ((fp = fopen(path, "w")) == NULL)
+    {
+        MBUS_ERROR("%s: Failed to open %s.\n", __PRETTY_FUNCTION__, path);
+        return -1;
+    }
+
+    fprintf(fp, "# address present secondary last_seen last_probed latency_us\n");
+
+    for (address = 0; address <= MBUS_MAX_PRIMARY_SLAVES; address++)
+    {
+        entry = &(cache->entry[address]);
+
+        if (entry->last_probed == 0)
+            continue;
+
+        fprintf(fp, "%d %d %s %ld %ld %ld\n", address, entry->present ? 1 : 0,
+                entry->secondary[0] ? entry->secondary : "-",
+                (long) entry->last_seen, (long) entry->last_probed, entry->latency_us);
+    }
+
+    ret = ferror(fp) ? -1 : 0;
+
+    if (fclose(fp) != 0)
+        ret = -1;
+
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+// Ping a primary address like the bin/ scan tools. Returns a MBUS_PROBE_*
+// code, latency_us is the time to the reply.
+//------------------------------------------------------------------------------
+static int
+mbus_scan_primary_ping(mbus_handle *handle, int address, long *latency_us)
+{
+    mbus_frame reply;
+    long long start;
+    int i, ret = MBUS_RECV_RESULT_TIMEOUT;
+
+    memset((void *)&reply, 0, sizeof(mbus_frame));
+
+    for (i = 0; i <= handle->max_search_retry; i++)
+    {
+        start = mbus_handle_clock_us();
+
+        if (mbus_send_ping_frame(handle, address, 0) == -1)
+        {
+            MBUS_ERROR("%s: Could not send ping frame: %s\n", __PRETTY_FUNCTION__, mbus_error_str());
+            return MBUS_PROBE_ERROR;
+        }
+
+        if ((ret = mbus_recv_frame(handle, &reply)) != MBUS_RECV_RESULT_TIMEOUT)
+            break;
+
+        if (i < handle->max_search_retry)
+            mbus_stats_event(handle, MBUS_STATS_EVENT_RETRY);
+    }
+
+    *latency_us = (long) (mbus_handle_clock_us() - start);
+
+    switch (ret)
+    {
+        case MBUS_RECV_RESULT_TIMEOUT:
+            return MBUS_PROBE_NOTHING;
+
+        case MBUS_RECV_RESULT_INVALID:
+            /* check for more data (collision) */
+            mbus_purge_frames(handle);
+            mbus_stats_event(handle, MBUS_STATS_EVENT_COLLISION);
+            return MBUS_PROBE_COLLISION;
+
+        case MBUS_RECV_RESULT_OK:
+            if (mbus_frame_type(&reply) != MBUS_FRAME_TYPE_ACK)
+                return MBUS_PROBE_NOTHING;
+
+            /* check for more data (collision) */
+            if (mbus_purge_frames(handle))
+            {
+                mbus_stats_event(handle, MBUS_STATS_EVENT_COLLISION);
+                return MBUS_PROBE_COLLISION;
+            }
+
+            return MBUS_PROBE_SINGLE;
+    }
+
+    return MBUS_PROBE_ERROR;
+}
+
+//------------------------------------------------------------------------------
+// Probe a single address and update its cache entry
+//------------------------------------------------------------------------------
+static int
+mbus_scan_primary_update(mbus_handle *handle, mbus_presence_cache *cache, int address, time_t now)
+{
+    mbus_presence_entry *entry = &(cache->entry[address]);
+    mbus_frame reply, found;
+    char secondary[17];
+    long latency;
+    int ret, present;
+
+    ret = mbus_scan_primary_ping(handle, address, &latency);
+
+    if (ret == MBUS_PROBE_ERROR)
+        return -1;
+
+    // a collision still means somebody is there
+    present = (ret != MBUS_PROBE_NOTHING);
+
+    // a slave lost in the first pass of the scan keeps its change
+    entry->changed |= (entry->present != present);
+    entry->present = present;
+    entry->last_probed = now;
+
+    if (!present)
+        return 0;
+
+    entry->last_seen = now;
+    entry->latency_us = latency;
+
+    memset((void *)&found, 0, sizeof(mbus_frame));
+    found.type = MBUS_FRAME_TYPE_ACK;
+    found.address = address;
+
+    if (ret == MBUS_PROBE_SINGLE && cache->read_secondary &&
+        (entry->changed || entry->secondary[0] == '\0'))
+    {
+        memset((void *)&reply, 0, sizeof(mbus_frame));
+
+        if (mbus_send_request_frame(handle, address) == 0 &&
+            mbus_recv_frame(handle, &reply) == MBUS_RECV_RESULT_OK &&
+            mbus_frame_get_secondary_address_r(&reply, secondary, sizeof(secondary)) != NULL)
+        {
+            if (strcmp(entry->secondary, secondary) != 0)
+            {
+                snprintf(entry->secondary, sizeof(entry->secondary), "%s", secondary);
+                entry->changed = 1;
+            }
+
+            found = reply;
+        }
+    }
+
+    if (entry->changed && handle->found_event)
+        handle->found_event(handle, &found);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+// Scan the primary addresses, known slaves first, absent ones only when due.
+//------------------------------------------------------------------------------
+int
+mbus_scan_primary_cached(mbus_handle *handle, mbus_presence_cache *cache)
+{
+    char probed[MBUS_MAX_PRIMARY_SLAVES + 1];
+    time_t now;
+    int address, ret, present = 0;
+
+    if (handle == NULL || cache == NULL)
+    {
+        MBUS_ERROR("%s: Invalid handle or cache.\n", __PRETTY_FUNCTION__);
+        return -1;
+    }
+
+    time(&now);
+
+    for (address = 0; address <= MBUS_MAX_PRIMARY_SLAVES; address++)
+    {
+        cache->entry[address].changed = 0;
+        probed[address] = cache->entry[address].present;
+    }
+
+    //
+    // known slaves first, they are the ones asked for right after the scan
+    //
+    for (address = 0; address <= MBUS_MAX_PRIMARY_SLAVES; address++)
+    {
+        if (!probed[address])
+            continue;
+
+        if ((ret = mbus_scan_primary_update(handle, cache, address, now)) < 0)
+            return -1;
+
+        present += ret;
+    }
+
+    //
+    // then the absent (or never probed) addresses that are due
+    //
+    for (address = 0; address <= MBUS_MAX_PRIMARY_SLAVES; address++)
+    {
+        mbus_presence_entry *entry = &(cache->entry[address]);
+
+        // probed in the first pass, also those found absent just now
+        if (probed[address])
+            continue;
+
+        if (entry->last_probed != 0 &&
+            now - entry->last_probed < cache->absent_interval)
+            continue;
+
+        if ((ret = mbus_scan_primary_update(handle, cache, address, now)) < 0)
+            return -1;
+
+        present += ret;
+    }
+
+    return present;
+}
+
+//
+// Value of every character in a hex dump: the digit value, S for whitespace
+// or X for anything else.
+//
+#define S 0x10
+#define X 0xFF
+static const unsigned char mbus_hex_table[256] = {
+     X, X, X, X, X, X, X, X, X, S, S, S, S, S, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     S, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     0, 1, 2, 3, 4, 5, 6, 7, 8, 9, X, X, X, X, X, X,
+     X,10,11,12,13,14,15, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X,10,11,12,13,14,15, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+     X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X
+};
+#undef S
+#undef X
+
 //------------------------------------------------------------------------------
 // Convert a buffer with hex values into a buffer with binary values.
 // - invalid character stops convertion
@@ -2531,39 +5280,35 @@ size_t
 mbus_hex2bin(unsigned char * dst, size_t dst_len, const unsigned char * src, size_t src_len)
 {
     size_t i, result = 0;
-    unsigned long val;
-    unsigned char *ptr, *end, buf[3];
+    unsigned char hi, lo;
 
     if (!src || !dst)
     {
         return 0;
     }
 
-    memset(buf, 0, sizeof(buf));
     memset(dst, 0, dst_len);
 
     for (i = 0; i+1 < src_len; i++)
     {
+        hi = mbus_hex_table[src[i]];
+
         // ignore whitespace
-        if (isspace(src[i]))
+        if (hi == 0x10)
             continue;
 
-        buf[0] = src[i];
-        buf[1] = src[++i];
-
-        end = buf;
-        ptr = end;
-        val = strtoul(ptr, (char **)&end, 16);
+        lo = mbus_hex_table[src[++i]];
 
         // abort at non hex value
-        if (ptr == end)
+        if (hi > 0x10)
             break;
 
         // abort at end of buffer
         if (result >= dst_len)
             break;
 
-        dst[result++] = (unsigned char) val;
+        // a single digit is taken as is, like strtoul does
+        dst[result++] = (lo < 0x10) ? (unsigned char) ((hi << 4) | lo) : hi;
     }
 
     return result;
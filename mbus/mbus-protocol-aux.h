@@ -66,6 +66,7 @@
 #define __MBUS_PROTOCOL_AUX_H__
 
 #include "mbus-protocol.h"
+#include "mbus-capture.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -80,6 +81,65 @@ extern "C" {
 #define MBUS_FRAME_PURGE_M2S  1
 #define MBUS_FRAME_PURGE_NONE 0
 
+#define MBUS_HANDLE_EVENT_READABLE 0x01
+#define MBUS_HANDLE_EVENT_WRITABLE 0x02
+
+#define MBUS_HANDLE_TX_BUFF_SIZE (MBUS_FRAME_BASE_SIZE_LONG + MBUS_FRAME_DATA_LENGTH)
+
+#define MBUS_TIMEOUT_ALLOWANCE_DEFAULT  100000 /**< USB serial adapter delay (usec) */
+#define MBUS_TIMEOUT_ADAPTIVE_SAMPLES   4      /**< replies observed before adapting */
+#define MBUS_TIMEOUT_ADAPTIVE_MARGIN    20000  /**< added to twice the learned turnaround (usec) */
+
+#define MBUS_BAUDRATE_PROBES            3      /**< replies that verify a baud rate */
+#define MBUS_BAUDRATE_SETTLE_US         50000  /**< serial slaves switching to a new rate (usec) */
+
+#define MBUS_STATS_BUCKETS   16 /**< latency buckets: < 1 ms, < 2 ms, < 4 ms, ..., >= 16.4 s */
+
+#define MBUS_STATS_EVENT_COLLISION 1
+#define MBUS_STATS_EVENT_RETRY     2
+
+/**
+ * Request to response latency, as a fixed bucket histogram
+ */
+typedef struct _mbus_stats_latency {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t bucket[MBUS_STATS_BUCKETS]; /**< see #mbus_stats_bucket_limit_us */
+} mbus_stats_latency;
+
+/**
+ * Counters of a single slave address
+ */
+typedef struct _mbus_stats_address {
+    uint64_t requests;           /**< frames sent to the address */
+    uint64_t replies;
+    uint64_t timeouts;
+    uint64_t invalid;
+    mbus_stats_latency latency;
+} mbus_stats_address;
+
+/**
+ * Traffic counters of a handle. All fields are updated with relaxed atomic
+ * operations, so they can be read (see #mbus_stats_snapshot) from another
+ * thread without locking while the handle is in use.
+ */
+typedef struct _mbus_stats {
+    int64_t  started_us;         /**< monotonic time the counters were started or reset */
+    int64_t  elapsed_us;         /**< only set in snapshots: time since started_us */
+    uint64_t frames_sent;
+    uint64_t bytes_sent;
+    uint64_t frames_received;
+    uint64_t bytes_received;
+    uint64_t timeouts;           /**< MBUS_RECV_RESULT_TIMEOUT */
+    uint64_t invalid;            /**< checksum, length or framing errors (MBUS_RECV_RESULT_INVALID) */
+    uint64_t errors;             /**< transport errors and connection resets */
+    uint64_t collisions;         /**< colliding replies while searching / scanning */
+    uint64_t retries;            /**< repeated requests after a timeout or invalid reply */
+    mbus_stats_latency latency;  /**< all addresses */
+    mbus_stats_address address[256]; /**< by primary address, 253 for secondary addressing */
+} mbus_stats;
+
 /**
  * Unified MBus handle type encapsulating either Serial or TCP gateway.
  */
@@ -99,6 +159,28 @@ typedef struct _mbus_handle {
     void (*scan_progress) (struct _mbus_handle *handle, const char *mask);
     void (*found_event) (struct _mbus_handle *handle, mbus_frame *frame);    
     void *auxdata;
+    mbus_frame_parser *parser;   /**< receive buffer of the transport */
+    char nonblocking;            /**< non zero when the fd is in non-blocking mode */
+    char purge_pending;          /**< echo of the last sent frame still expected */
+    long timeout_us;             /**< response timeout (usec), zero for the transport default */
+    long allowance_us;           /**< adapter / gateway delay added to the serial timeout (usec) */
+    char timeout_adaptive;       /**< non zero to learn the timeout of every slave from its replies */
+    long long tx_end_us;         /**< monotonic time the last request was sent, zero if none */
+    long long deadline_us;       /**< monotonic response deadline, zero when idle */
+    unsigned char tx_buff[MBUS_HANDLE_TX_BUFF_SIZE]; /**< frame pending to be sent */
+    size_t tx_len;               /**< size of the pending frame */
+    size_t tx_sent;              /**< bytes of the pending frame already written */
+    mbus_stats *stats;           /**< traffic counters, NULL until MBUS_OPTION_STATS is first set */
+    char stats_enabled;          /**< non zero while the counters are updated */
+    int stats_address;           /**< address of the last request, -1 if none */
+    mbus_slave_table slaves;     /**< FCB / ACD state of the slaves on this bus */
+    unsigned char selected[8];   /**< secondary address of the last selection */
+    char has_selected;           /**< non zero while a slave may be selected */
+    mbus_frame_pool *frame_pool; /**< frames of the handle, NULL unless MBUS_OPTION_FRAME_POOL is set */
+    long bus_baudrate;           /**< rate of slaves without an entry in baudrate, zero if no rates are managed */
+    long baudrate[MBUS_MAX_PRIMARY_SLAVES + 1]; /**< rate of the slaves by primary address, zero for bus_baudrate */
+    mbus_capture *capture;       /**< log of the raw traffic, NULL if none (not owned) */
+    unsigned int capture_id;     /**< id of the handle in the capture log */
 } mbus_handle;
 
 /**
@@ -134,6 +216,108 @@ typedef union _mbus_value {
 } mbus_value;
 
 
+/**
+ * Types of a decoded record value, see #mbus_typed_value
+ */
+#define MBUS_VALUE_TYPE_NONE 0  /**< no data */
+#define MBUS_VALUE_TYPE_INT  1  /**< binary integer in int_val */
+#define MBUS_VALUE_TYPE_BCD  2  /**< BCD number, decoded into int_val */
+#define MBUS_VALUE_TYPE_REAL 3  /**< 32 bit real in real_val */
+#define MBUS_VALUE_TYPE_TIME 4  /**< date or date and time in time_val */
+#define MBUS_VALUE_TYPE_RAW  5  /**< string or manufacturer data in raw */
+
+/**
+ * Value of a variable data record, decoded without string formatting or heap
+ * allocation. The normalized value of a numerical record is
+ * raw value * exponent + offset, see #mbus_typed_value_normalized.
+ */
+typedef struct _mbus_typed_value {
+    int type;                    /**< MBUS_VALUE_TYPE_* */
+    union {
+        int64_t int_val;
+        double  real_val;
+        struct {
+            struct tm tm;        /**< as decoded, all zero if marked invalid */
+            int64_t epoch;       /**< seconds since 1970 (UTC), -1 if invalid */
+            int has_time;        /**< zero for a date only */
+        } time_val;
+        struct {
+            const unsigned char *data;  /**< points into the record, as transmitted (LSB first) */
+            size_t len;
+        } raw;
+    } value;
+    double exponent;             /**< factor to normalize the value, VIFE correction included */
+    double offset;               /**< additive correction (VIFE 0x78 - 0x7B) */
+    const char *unit;            /**< normalized unit, NULL if unknown */
+    const char *quantity;        /**< quantity type (or custom VIF), NULL if unknown */
+} mbus_typed_value;
+
+/**
+ * Unit descriptor of a VIF (or fixed data medium/unit) code
+ */
+typedef struct _mbus_variable_vif {
+    unsigned     vif;            /**< VIF code */
+    double       exponent;       /**< factor to normalize the raw value */
+    const char * unit;           /**< normalized unit (e.g. Wh) */
+    const char * quantity;       /**< quantity type (e.g. Energy) */
+} mbus_variable_vif;
+
+/**
+ * Number of record layouts kept per layout cache key
+ */
+#define MBUS_LAYOUT_CACHE_PLANS 4
+
+/**
+ * One record of a layout plan: where it is in the user data and how its
+ * value is decoded
+ */
+typedef struct _mbus_layout_step {
+    size_t check_offset;         /**< start of the fillers and DIB/VIB compared with the plan */
+    size_t data_offset;          /**< start of the data field in the user data */
+    size_t data_len;             /**< length of the data field */
+    int kind;                    /**< decoder of the data field (internal) */
+    size_t width;                /**< bytes decoded */
+    mbus_typed_value value;      /**< type, exponent, offset, unit and quantity of the record */
+} mbus_layout_step;
+
+/**
+ * Decode plan of a variable data telegram, built by the full parser. A
+ * telegram matches the plan when everything but the header and the data
+ * fields equals the telegram the plan was built from.
+ */
+typedef struct _mbus_layout_plan {
+    unsigned char data[MBUS_FRAME_DATA_LENGTH]; /**< user data the plan was built from */
+    size_t data_size;
+    size_t tail_offset;          /**< end of the last record, fillers follow */
+    mbus_layout_step *steps;
+    size_t nsteps;
+    mbus_data_record *record;    /**< parsed records, custom VIF quantities point here */
+    struct _mbus_layout_plan *next;
+} mbus_layout_plan;
+
+/**
+ * Layout cache entry, keyed by manufacturer, version, medium, user data
+ * length and the first bytes of the first record
+ */
+typedef struct _mbus_layout_entry {
+    uint64_t key;
+    mbus_layout_plan *plans;     /**< most recently built first, NULL for a free entry */
+    size_t nplans;
+} mbus_layout_entry;
+
+/**
+ * Cache of decode plans of variable data telegrams, see
+ * #mbus_layout_cache_decode. Open addressing with linear probing.
+ */
+typedef struct _mbus_layout_cache {
+    mbus_layout_entry *entries;
+    size_t size;                 /**< zero or a power of two */
+    size_t count;
+
+    unsigned long hits;          /**< telegrams decoded with a cached plan */
+    unsigned long misses;        /**< telegrams that needed a new plan */
+} mbus_layout_cache;
+
 /**
  * Single measured quantity record type
  */
@@ -148,13 +332,142 @@ typedef struct _mbus_record {
     long                storage_number; /**< Quantity storage number */
 } mbus_record;
 
+/**
+ * Binary export of decoded records.
+ *
+ * A stream starts with a MBUS_BIN_HEADER_SIZE byte header, followed by any
+ * number of MBUS_BIN_RECORD_SIZE byte rows, so files can be appended to and
+ * memory-mapped. All fields are little endian and naturally aligned; on
+ * little endian hosts a row can be used as mbus_bin_record directly.
+ *
+ * \verbatim
+ * header:  0  char[8]  magic "MBUSBIN" (NUL terminated)
+ *          8  uint16   version (MBUS_BIN_VERSION)
+ *         10  uint16   row size (MBUS_BIN_RECORD_SIZE)
+ *         12  uint32   reserved, 0
+ *
+ * row:     0  uint32   identification number (BCD decoded)
+ *          4  uint16   manufacturer code
+ *          6  uint8    version
+ *          7  uint8    medium
+ *          8  int64    timestamp (seconds since the epoch, 0 if unknown)
+ *         16  double   normalized value (IEEE 754, NaN if not numeric)
+ *         24  uint64   storage number
+ *         32  int32    tariff (-1 if not present)
+ *         36  uint16   device (subunit, 0xFFFF if not present)
+ *         38  uint16   unit code: VIF, 0x1nn / 0x2nn for the 0xFD / 0xFB
+ *                      extension tables, fixed data unit with
+ *                      MBUS_BIN_FLAG_FIXED, or a MBUS_BIN_UNIT_* value
+ *         40  uint16   record number within the reply
+ *         42  uint8    function (MBUS_BIN_FUNCTION_*)
+ *         43  uint8    flags (MBUS_BIN_FLAG_*)
+ *         44  uint32   reserved, 0
+ * \endverbatim
+ *
+ * The unit code selects both the quantity and the unit, see
+ * mbus_vif_descriptor_lookup and mbus_fixed_descriptor_lookup.
+ */
+#define MBUS_BIN_MAGIC                  "MBUSBIN"
+#define MBUS_BIN_VERSION                1
+#define MBUS_BIN_HEADER_SIZE            16
+#define MBUS_BIN_RECORD_SIZE            48
+
+#define MBUS_BIN_FUNCTION_INSTANTANEOUS 0
+#define MBUS_BIN_FUNCTION_MAXIMUM       1
+#define MBUS_BIN_FUNCTION_MINIMUM       2
+#define MBUS_BIN_FUNCTION_ERROR         3
+#define MBUS_BIN_FUNCTION_MANUFACTURER  4
+#define MBUS_BIN_FUNCTION_MORE_RECORDS  5
+
+#define MBUS_BIN_FLAG_STRING            0x01 /**< value is text or binary, not exported */
+#define MBUS_BIN_FLAG_FIXED             0x02 /**< fixed data counter */
+#define MBUS_BIN_FLAG_STORED            0x04 /**< fixed data: stored value */
+#define MBUS_BIN_FLAG_UNKNOWN_UNIT      0x08 /**< value is not normalized */
+
+#define MBUS_BIN_UNIT_PLAIN_TEXT        0xFFFE /**< plain text VIF */
+#define MBUS_BIN_UNIT_NONE              0xFFFF /**< no or unknown unit */
+
+/**
+ * Decoded record, in the layout of a binary row
+ */
+typedef struct _mbus_bin_record {
+    uint32_t id;
+    uint16_t manufacturer;
+    uint8_t  version;
+    uint8_t  medium;
+    int64_t  timestamp;
+    double   value;
+    uint64_t storage_number;
+    int32_t  tariff;
+    uint16_t device;
+    uint16_t unit;
+    uint16_t record;
+    uint8_t  function;
+    uint8_t  flags;
+    uint32_t reserved;
+} mbus_bin_record;
+
+/**
+ * Presence of a slave at a primary address, as seen by mbus_scan_primary_cached
+ */
+typedef struct _mbus_presence_entry {
+    char   present;              /**< non zero when the slave answered the last probe */
+    char   changed;              /**< non zero when the last scan changed this entry */
+    char   secondary[17];        /**< secondary address, empty when unknown */
+    time_t last_seen;            /**< last time the slave answered */
+    time_t last_probed;          /**< last time the address was probed */
+    long   latency_us;           /**< time to the last reply (usec) */
+} mbus_presence_entry;
+
+/**
+ * Presence cache of the primary addresses of a bus
+ */
+typedef struct _mbus_presence_cache {
+    mbus_presence_entry entry[MBUS_MAX_PRIMARY_SLAVES + 1];
+    long absent_interval;        /**< seconds until absent addresses are probed again, 0 for every scan */
+    char read_secondary;         /**< non zero to read the secondary address of new slaves */
+} mbus_presence_cache;
+
+/**
+ * Preallocated frames for streamed multi-telegram readouts. Telegram i of a
+ * readout is received into frames[i % size], so a frame stays valid until
+ * size further telegrams have been received.
+ */
+typedef struct _mbus_frame_ring {
+    mbus_frame *frames;
+    size_t size;                 /**< number of frames, at least 2 */
+    size_t count;                /**< telegrams received by the last readout */
+} mbus_frame_ring;
+
+/**
+ * Called by mbus_sendrecv_request_stream for every validated telegram. The
+ * request for the next telegram has already been sent when this is called.
+ *
+ * @param handle   Initialized handle
+ * @param frame    Telegram, a frame of the ring (not chained by next)
+ * @param index    Number of the telegram in the readout, starting at 0
+ * @param userdata as passed to mbus_sendrecv_request_stream
+ *
+ * @return Zero to continue the readout, non zero to stop it.
+ */
+typedef int (*mbus_telegram_event)(mbus_handle *handle, mbus_frame *frame,
+                                   size_t index, void *userdata);
+
 /**
  * MBus handle option enumeration
  */
 typedef enum _mbus_context_option {
     MBUS_OPTION_MAX_DATA_RETRY,  /**< option defines the maximum attempts of data request retransmission */
     MBUS_OPTION_MAX_SEARCH_RETRY,  /**< option defines the maximum attempts of search request retransmission */
-    MBUS_OPTION_PURGE_FIRST_FRAME  /**< option controls the echo cancelation for mbus_recv_frame */
+    MBUS_OPTION_PURGE_FIRST_FRAME, /**< option controls the echo cancelation for mbus_recv_frame */
+    MBUS_OPTION_RESPONSE_TIMEOUT,  /**< option sets the response timeout in usec, zero for the transport default */
+    MBUS_OPTION_ADAPTER_ALLOWANCE, /**< option sets the adapter delay in usec added to the serial response timeout */
+    MBUS_OPTION_ADAPTIVE_TIMEOUT,  /**< option enables learning the response timeout from observed replies */
+    MBUS_OPTION_STATS,             /**< option enables the traffic counters, see mbus_stats_snapshot */
+    MBUS_OPTION_CONNECT_TIMEOUT,   /**< option sets the TCP connect timeout in usec, zero for the default */
+    MBUS_OPTION_TCP_NODELAY,       /**< option disables Nagle's algorithm on TCP handles */
+    MBUS_OPTION_TCP_KEEPALIVE,     /**< option sets the TCP keepalive idle time in seconds, zero disables it */
+    MBUS_OPTION_FRAME_POOL         /**< option sets the frames kept for reuse by the handle, zero disables the pool */
 } mbus_context_option;
 
 /**
@@ -168,6 +481,30 @@ void mbus_register_send_event(mbus_handle *handle, void (*event)(unsigned char s
 void mbus_register_scan_progress(mbus_handle *handle, void (*event)(mbus_handle *handle, const char *mask));
 void mbus_register_found_event(mbus_handle *handle, void (*event)(mbus_handle *handle, mbus_frame *frame));
 
+/**
+ * Log the frames sent and received by a handle, see mbus-capture.h. A
+ * capture log can be shared by handles served by the same thread, the id
+ * tells their records apart. The handle does not close the log.
+ *
+ * @param handle  Initialized handle
+ * @param capture Capture log, NULL to stop logging
+ * @param id      Id of the handle in the records
+ *
+ * @return Zero when successful.
+ */
+int mbus_handle_set_capture(mbus_handle *handle, mbus_capture *capture, unsigned int id);
+
+/**
+ * Append sent or received bytes to the capture log of a handle, if any.
+ * Called by the transports next to the send and receive events.
+ *
+ * @param handle    Initialized handle
+ * @param direction MBUS_CAPTURE_SEND or MBUS_CAPTURE_RECV
+ * @param buff      Bytes sent or received
+ * @param len       Number of bytes
+ */
+void mbus_handle_capture(mbus_handle *handle, int direction, const unsigned char *buff, size_t len);
+
 /**
  * Allocate and initialize M-Bus serial context.
  *
@@ -187,6 +524,15 @@ mbus_handle * mbus_context_serial(const char *device);
  */
 mbus_handle * mbus_context_tcp(const char *host, uint16_t port);
 
+/**
+ * Allocate and initialize an M-Bus simulator context. Slaves are added with
+ * mbus_sim_add_slave and mbus_sim_add_telegram_file (see mbus-sim.h) before
+ * mbus_connect.
+ *
+ * @return Initialized "unified" handler when successful, NULL otherwise;
+ */
+mbus_handle * mbus_context_sim(void);
+
 /**
  * Deallocate memory used by M-Bus context.
  *
@@ -253,6 +599,157 @@ int mbus_purge_frames(mbus_handle * handle);
  */
 int mbus_send_frame(mbus_handle * handle, mbus_frame *frame);
 
+/**
+ * Copy the traffic counters of a handle. Safe to call from another thread
+ * while the handle is in use; the counters are read one by one, so the copy
+ * is only consistent per field. Disabling the counters with MBUS_OPTION_STATS
+ * does not free them, a concurrent snapshot fails instead.
+ *
+ * @param handle   Initialized handle with MBUS_OPTION_STATS enabled
+ * @param snapshot counters, elapsed_us is set to the time they cover
+ *
+ * @return Zero when successful, -1 if the counters are not enabled.
+ */
+int mbus_stats_snapshot(mbus_handle *handle, mbus_stats *snapshot);
+
+/**
+ * Clear the traffic counters of a handle. Not to be called concurrently with
+ * traffic on the handle.
+ *
+ * @param handle Initialized handle
+ */
+void mbus_stats_reset(mbus_handle *handle);
+
+/**
+ * Count an event that the transport layer does not see
+ *
+ * @param handle Initialized handle, counters may be disabled
+ * @param event  MBUS_STATS_EVENT_COLLISION or MBUS_STATS_EVENT_RETRY
+ */
+void mbus_stats_event(mbus_handle *handle, int event);
+
+/**
+ * Upper limit of a latency bucket
+ *
+ * @param bucket index, 0 - MBUS_STATS_BUCKETS-1
+ *
+ * @return latencies in the bucket are below this (usec), -1 for the last bucket
+ */
+long mbus_stats_bucket_limit_us(int bucket);
+
+/**
+ * Returns the response timeout of a handle. Unless set explicitly with
+ * MBUS_OPTION_RESPONSE_TIMEOUT, serial handles use the EN 13757 limit of
+ * (330 + 11) bit times + 50 ms plus the adapter allowance, TCP handles the
+ * timeout set by mbus_tcp_set_timeout_set. With MBUS_OPTION_ADAPTIVE_TIMEOUT
+ * the timeout shrinks to the turnaround time observed for the slave of the
+ * last request. A timeout of that slave widens it to the default again, so
+ * slow slaves on a segment of fast ones are not lost.
+ *
+ * @param handle Initialized handle
+ *
+ * @return timeout in microseconds
+ */
+long mbus_handle_timeout_us(mbus_handle *handle);
+
+/**
+ * Record the turnaround time of an observed reply for the adaptive timeout
+ * of the slave of the last request. Called by mbus_recv_frame and
+ * mbus_handle_on_readable.
+ *
+ * @param handle       Initialized handle
+ * @param turnaround_us time between the end of the request and the reply
+ */
+void mbus_handle_timeout_observe(mbus_handle *handle, long turnaround_us);
+
+/**
+ * Returns the file descriptor of a connected handle, to be registered with
+ * an event loop (epoll, kqueue, libuv, ...)
+ *
+ * @param handle Initialized handle
+ *
+ * @return file descriptor, -1 on error
+ */
+int mbus_handle_fd(mbus_handle *handle);
+
+/**
+ * Switches a connected handle to (or from) non-blocking mode. In non-blocking
+ * mode frames are sent with mbus_handle_send_async and the replies are
+ * collected by the mbus_handle_on_* functions when the event loop reports
+ * the fd ready or the deadline expired.
+ *
+ * @param handle Connected handle
+ * @param enable non zero to enable non-blocking mode
+ *
+ * @return Zero when successful.
+ */
+int mbus_handle_set_nonblocking(mbus_handle *handle, int enable);
+
+/**
+ * Queues a frame for sending. The data is written by mbus_handle_on_writable,
+ * the response deadline is armed when the last byte has been written.
+ *
+ * @param handle Handle in non-blocking mode
+ * @param frame  Frame to send
+ *
+ * @return Zero when successful, -1 on error or when a frame is still pending.
+ */
+int mbus_handle_send_async(mbus_handle *handle, mbus_frame *frame);
+
+/**
+ * Returns the events the handle is waiting for
+ *
+ * @param handle Initialized handle
+ *
+ * @return mask of MBUS_HANDLE_EVENT_READABLE and MBUS_HANDLE_EVENT_WRITABLE
+ */
+int mbus_handle_events(mbus_handle *handle);
+
+/**
+ * Writes pending data of the queued frame, to be called when the fd is writable
+ *
+ * @param handle Handle in non-blocking mode
+ *
+ * @return MBUS_RECV_RESULT_OK when the frame has been sent completely,
+ *         MBUS_RECV_RESULT_PENDING when data is left, MBUS_RECV_RESULT_ERROR
+ *         on failure.
+ */
+int mbus_handle_on_writable(mbus_handle *handle);
+
+/**
+ * Reads available data, to be called when the fd is readable. Echos are
+ * dropped according to MBUS_OPTION_PURGE_FIRST_FRAME.
+ *
+ * @param handle Handle in non-blocking mode
+ * @param frame  Received frame
+ *
+ * @return MBUS_RECV_RESULT_OK when a frame was received (call again to get
+ *         further buffered frames), MBUS_RECV_RESULT_PENDING when more data is
+ *         needed, otherwise MBUS_RECV_RESULT_INVALID, _RESET or _ERROR.
+ */
+int mbus_handle_on_readable(mbus_handle *handle, mbus_frame *frame);
+
+/**
+ * Returns the time until the response deadline expires, suitable as the
+ * timeout argument of poll/epoll_wait
+ *
+ * @param handle Initialized handle
+ *
+ * @return milliseconds until the deadline, -1 when no deadline is armed.
+ */
+int mbus_handle_next_timeout_ms(mbus_handle *handle);
+
+/**
+ * Checks the response deadline, to be called when the event loop timer fired
+ *
+ * @param handle Initialized handle
+ *
+ * @return MBUS_RECV_RESULT_TIMEOUT when the deadline expired,
+ *         MBUS_RECV_RESULT_INVALID when it expired with an incomplete frame
+ *         buffered (which is dropped), MBUS_RECV_RESULT_PENDING otherwise.
+ */
+int mbus_handle_on_timeout(mbus_handle *handle);
+
 /**
  * Sends secondary address selection frame using "unified" handle
  *
@@ -318,6 +815,92 @@ int mbus_send_user_data_frame(mbus_handle * handle, int address, const unsigned
  */
 int mbus_set_primary_address(mbus_handle * handle, int old_address, int new_address);
 
+/**
+ * State (FCB of the next request, last ACD) of a slave on the bus of a
+ * handle. Every handle keeps its own state, so the same primary address on
+ * different buses does not interfere.
+ *
+ * @param handle  Initialized handle
+ * @param address Primary address, or MBUS_ADDRESS_NETWORK_LAYER for the
+ *                slave last selected by secondary address
+ *
+ * @return slave state, NULL for broadcasts, if no slave is selected or on error
+ */
+mbus_slave_data *mbus_handle_slave_data(mbus_handle *handle, int address);
+
+/**
+ * Allocate a frame from the frame pool of the handle (see
+ * MBUS_OPTION_FRAME_POOL), or from the heap if the handle has no pool.
+ * The request frames and the additional telegrams of multi-telegram
+ * replies are allocated this way. Either way the frame is released with
+ * mbus_frame_free, also after the handle has been freed.
+ *
+ * @param handle     Initialized handle
+ * @param frame_type Frame type, see mbus_frame_new
+ *
+ * @return new frame, NULL on error
+ */
+mbus_frame *mbus_handle_frame_new(mbus_handle *handle, int frame_type);
+
+/**
+ * Change the rate of the port of a serial or simulator handle.
+ *
+ * @param handle   Initialized handle
+ * @param baudrate Baudrate (300,600,1200,2400,4800,9600,19200,38400)
+ *
+ * @return Zero when successful, -1 on error or for TCP handles.
+ */
+int mbus_handle_set_baudrate(mbus_handle *handle, long baudrate);
+
+/**
+ * Current rate of the port of a serial or simulator handle.
+ *
+ * @param handle Initialized handle
+ *
+ * @return baud rate, -1 on error or for TCP handles
+ */
+long mbus_handle_get_baudrate(mbus_handle *handle);
+
+/**
+ * Remember the rate of a slave, e.g. from an earlier
+ * mbus_negotiate_baudrate. Once a rate is known, frames to a primary
+ * address are sent at the rate of the slave, and all other frames
+ * (broadcasts, secondary addressing) at the bus rate. The bus rate is the
+ * port rate when the first slave rate is set.
+ *
+ * @param handle   Initialized serial or simulator handle
+ * @param address  Primary address (0-250)
+ * @param baudrate Rate of the slave, zero for the bus rate
+ *
+ * @return Zero when successful.
+ */
+int mbus_handle_set_slave_baudrate(mbus_handle *handle, int address, long baudrate);
+
+/**
+ * Rate frames to an address are sent at.
+ *
+ * @param handle  Initialized handle
+ * @param address Address (0-255)
+ *
+ * @return baud rate, zero if the handle does not manage slave rates
+ */
+long mbus_handle_slave_baudrate(mbus_handle *handle, int address);
+
+/**
+ * Switch a slave to the highest rate it answers reliably at. Starting at
+ * the current rate of the slave, every higher rate up to max_baudrate is
+ * tried: the slave acknowledges the switch frame at the old rate and must
+ * answer MBUS_BAUDRATE_PROBES SND_NKE at the new one. If it does not, it is
+ * switched back. The result is kept with mbus_handle_set_slave_baudrate.
+ *
+ * @param handle       Initialized serial or simulator handle
+ * @param address      Primary address (0-250)
+ * @param max_baudrate Highest rate to try
+ *
+ * @return rate of the slave, -1 if the slave does not answer at all.
+ */
+long mbus_negotiate_baudrate(mbus_handle *handle, int address, long max_baudrate);
+
 /**
  * Sends a request and read replies until no more records available
  * or limit is reached.
@@ -331,6 +914,55 @@ int mbus_set_primary_address(mbus_handle * handle, int old_address, int new_addr
  */
 int mbus_sendrecv_request(mbus_handle *handle, int address, mbus_frame *reply, int max_frames);
 
+/**
+ * Allocate a frame ring for mbus_sendrecv_request_stream
+ *
+ * @param size Number of frames (at least 2)
+ *
+ * @return new ring, NULL on error
+ */
+mbus_frame_ring *mbus_frame_ring_new(size_t size);
+
+/**
+ * Free a frame ring
+ *
+ * @param ring Frame ring
+ */
+void mbus_frame_ring_free(mbus_frame_ring *ring);
+
+/**
+ * Telegram of the last readout, if it has not been overwritten yet
+ *
+ * @param ring  Frame ring
+ * @param index Number of the telegram, starting at 0
+ *
+ * @return frame, NULL if not received or already reused
+ */
+mbus_frame *mbus_frame_ring_get(mbus_frame_ring *ring, size_t index);
+
+/**
+ * Sends a request and streams the replies until no more records are
+ * available or the limit is reached. Unlike mbus_sendrecv_request
+ *
+ * - nothing is allocated, the telegrams are received into the ring,
+ * - the requests for both FCB states are prepared up front, and the next
+ *   request is sent as soon as a reply has been validated (the records are
+ *   only sliced to find DIF 0x1F, not decoded),
+ * - stray frames are not purged after every telegram, only after errors,
+ * - every telegram is passed to event while the next one is on its way.
+ *
+ * @param handle     Initialized handle
+ * @param address    Address (0-255)
+ * @param ring       Frame ring receiving the telegrams
+ * @param max_frames limit of frames to readout (0 = no limit)
+ * @param event      Called for every telegram, may be NULL
+ * @param userdata   Passed to event
+ *
+ * @return Zero when successful (also if event stopped the readout).
+ */
+int mbus_sendrecv_request_stream(mbus_handle *handle, int address, mbus_frame_ring *ring,
+                                 int max_frames, mbus_telegram_event event, void *userdata);
+
 /**
  * Sends ping frame to given slave using "unified" handle
  *
@@ -442,6 +1074,62 @@ int mbus_data_fixed_normalize(int medium_unit_byte, long medium_value, char **un
  */
 int mbus_variable_value_decode(mbus_data_record *record, double *value_out_real, char **value_out_str, int *value_out_str_size);
 
+/**
+ * Decode the value of a variable data record into a caller owned struct,
+ * along with the normalization exponent and unit of its VIB
+ *
+ * @param record record to be decoded
+ * @param value  decoded value; for MBUS_VALUE_TYPE_RAW it refers to the record
+ *
+ * @return zero when OK, -1 for an unsupported data field
+ */
+int mbus_data_record_typed_value(mbus_data_record *record, mbus_typed_value *value);
+
+/**
+ * Normalized value of a numerical typed value
+ *
+ * @param value decoded value
+ *
+ * @return value * exponent + offset, NAN for non numerical values
+ */
+double mbus_typed_value_normalized(const mbus_typed_value *value);
+
+/**
+ * Initialize an empty layout cache
+ *
+ * @param cache layout cache
+ */
+void mbus_layout_cache_init(mbus_layout_cache *cache);
+
+/**
+ * Free the plans of a layout cache
+ *
+ * @param cache layout cache
+ */
+void mbus_layout_cache_free(mbus_layout_cache *cache);
+
+/**
+ * Decode the records of a variable data telegram into typed values, as
+ * mbus_data_variable_parse and mbus_data_record_typed_value would. The
+ * record layout of the telegram is looked up in the cache; when a plan
+ * matches, the data fields are decoded at the offsets of the plan without
+ * parsing the DIB/VIB again. Otherwise the telegram is parsed and a plan
+ * built for the next ones. Records whose value cannot be decoded are
+ * returned as MBUS_VALUE_TYPE_NONE.
+ *
+ * @param cache   layout cache
+ * @param frame   variable data response
+ * @param header  variable data header output, may be NULL
+ * @param values  typed values output; raw values point into the frame and
+ *                custom VIF quantities into the cache
+ * @param nvalues size of values
+ *
+ * @return number of records of the telegram (values beyond nvalues are not
+ *         written), -1 if the frame could not be parsed
+ */
+int mbus_layout_cache_decode(mbus_layout_cache *cache, mbus_frame *frame, mbus_data_variable_header *header,
+                             mbus_typed_value *values, size_t nvalues);
+
 /**
  * Decode units and normalize value using VIF/VIFE (used internally by mbus_vib_unit_normalize)
  *
@@ -455,6 +1143,50 @@ int mbus_variable_value_decode(mbus_data_record *record, double *value_out_real,
  */
 int mbus_vif_unit_normalize(int vif, double value, char **unit_out, double *value_out, char **quantity_out);
 
+/**
+ * Lookup the unit descriptor of a VIF code in constant time
+ *
+ * @param vif         VIF with 0x100 added for 0xFD and 0x200 for 0xFB extensions
+ *
+ * @return static descriptor, NULL when the code is unknown
+ */
+const mbus_variable_vif *mbus_vif_descriptor_lookup(int vif);
+
+/**
+ * Lookup the unit descriptor of a fixed data medium/unit code in constant time
+ *
+ * @param medium_unit medium/unit bits of the fixed counter
+ *
+ * @return static descriptor, NULL when the code is unknown
+ */
+const mbus_variable_vif *mbus_fixed_descriptor_lookup(int medium_unit);
+
+/**
+ * Same as mbus_vif_unit_normalize, but without allocating the result strings
+ *
+ * @param vif         VIF (including standard extensions)
+ * @param value       already parsed "raw" numerical value
+ * @param unit_out     parsed unit, static string - do not free
+ * @param value_out    normalized value
+ * @param quantity_out parsed quantity, static string - do not free
+ *
+ * @return zero when OK
+ */
+int mbus_vif_unit_normalize_const(int vif, double value, const char **unit_out, double *value_out, const char **quantity_out);
+
+/**
+ * Same as mbus_vib_unit_normalize, but without allocating the result strings
+ *
+ * @param vib         mbus value information block of the variable record
+ * @param value       already parsed "raw" numerical value
+ * @param unit_out     parsed unit, static string - do not free
+ * @param value_out    normalized value
+ * @param quantity_out parsed quantity, static string or the custom VIF of vib - do not free
+ *
+ * @return zero when OK
+ */
+int mbus_vib_unit_normalize_const(mbus_value_information_block *vib, double value, const char **unit_out, double *value_out, const char **quantity_out);
+
 /**
  * Decode units and normalize value from VIB
  *
@@ -486,6 +1218,103 @@ char * mbus_data_variable_xml_normalized(mbus_data_variable *data);
  */
 char * mbus_frame_data_xml_normalized(mbus_frame_data *data);
 
+/**
+ * Write an XML or JSON document for normalized variable-length data
+ *
+ * @param writer  Streaming writer
+ * @param data    variable-length data
+ *
+ * @return zero when OK
+ */
+int mbus_data_variable_write_normalized(mbus_writer *writer, mbus_data_variable *data);
+
+/**
+ * Write an XML or JSON document for the normalized M-BUS frame data
+ *
+ * @param writer  Streaming writer
+ * @param data    M-Bus frame data
+ *
+ * @return zero when OK
+ */
+int mbus_frame_data_write_normalized(mbus_writer *writer, mbus_frame_data *data);
+
+/**
+ * Fill a binary row from a variable data record
+ *
+ * @param row        Binary row
+ * @param header     Header of the variable data
+ * @param record     Data record
+ * @param record_cnt Record number
+ *
+ * @return zero when OK
+ */
+int mbus_bin_record_variable(mbus_bin_record *row, mbus_data_variable_header *header,
+                             mbus_data_record *record, int record_cnt);
+
+/**
+ * Fill a binary row from a counter of fixed data
+ *
+ * @param row     Binary row
+ * @param data    Fixed data
+ * @param counter Counter, 0 or 1
+ *
+ * @return zero when OK
+ */
+int mbus_bin_record_fixed(mbus_bin_record *row, mbus_data_fixed *data, int counter);
+
+/**
+ * Encode a row in the binary layout
+ *
+ * @param row  Binary row
+ * @param buff Output, MBUS_BIN_RECORD_SIZE bytes
+ */
+void mbus_bin_record_encode(const mbus_bin_record *row, unsigned char *buff);
+
+/**
+ * Decode a row of the binary layout
+ *
+ * @param row  Binary row
+ * @param buff Input, MBUS_BIN_RECORD_SIZE bytes
+ */
+void mbus_bin_record_decode(mbus_bin_record *row, const unsigned char *buff);
+
+/**
+ * Encode the header of a binary stream
+ *
+ * @param buff Output, MBUS_BIN_HEADER_SIZE bytes
+ */
+void mbus_bin_header_encode(unsigned char *buff);
+
+/**
+ * Check the header of a binary stream
+ *
+ * @param buff      Input
+ * @param buff_size Size of the input
+ *
+ * @return zero when the header is valid and the version is supported
+ */
+int mbus_bin_header_check(const unsigned char *buff, size_t buff_size);
+
+/**
+ * Write the header of a binary stream. Only needed at the start of a file,
+ * the rows of further replies are simply appended.
+ *
+ * @param writer  Streaming writer
+ *
+ * @return zero when OK
+ */
+int mbus_bin_header_write(mbus_writer *writer);
+
+/**
+ * Write the records of the M-Bus frame data as binary rows
+ *
+ * @param writer  Streaming writer, the format is ignored
+ * @param data    M-Bus frame data
+ *
+ * @return number of rows written, -1 on error
+ */
+int mbus_frame_data_write_bin(mbus_writer *writer, mbus_frame_data *data);
+
 /**
  * Iterate over secondary addresses, send a probe package to all addresses matching
  * the given addresses mask.
@@ -498,6 +1327,49 @@ char * mbus_frame_data_xml_normalized(mbus_frame_data *data);
  */
 int mbus_scan_2nd_address_range(mbus_handle * handle, int pos, char *addr_mask);
 
+/**
+ * Initialize an empty presence cache: every address is probed by the next
+ * scan, absent addresses are probed again after an hour.
+ *
+ * @param cache Presence cache
+ */
+void mbus_presence_cache_init(mbus_presence_cache *cache);
+
+/**
+ * Load a presence cache written by mbus_presence_cache_save. Only the
+ * entries are replaced, the settings of the cache are kept.
+ *
+ * @param cache Presence cache
+ * @param path  File name
+ *
+ * @return zero when OK
+ */
+int mbus_presence_cache_load(mbus_presence_cache *cache, const char *path);
+
+/**
+ * Store the entries of a presence cache in a text file
+ *
+ * @param cache Presence cache
+ * @param path  File name
+ *
+ * @return zero when OK
+ */
+int mbus_presence_cache_save(const mbus_presence_cache *cache, const char *path);
+
+/**
+ * Scan the primary addresses using a presence cache. Addresses known to be
+ * present are probed first, absent addresses only when they were not probed
+ * for cache->absent_interval seconds. Entries that changed are flagged and
+ * handle->found_event is called for every slave that appeared (or changed its
+ * secondary address), frame->address holds the primary address.
+ *
+ * @param handle Initialized handle
+ * @param cache  Presence cache of the bus
+ *
+ * @return number of present slaves, -1 on error
+ */
+int mbus_scan_primary_cached(mbus_handle *handle, mbus_presence_cache *cache);
+
 /**
  * Convert a buffer with hex values into a buffer with binary values.
  *
@@ -10,13 +10,22 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "mbus-protocol.h"
 
 static int parse_debug = 0, debug = 0;
-static char error_str[512];
+static MBUS_THREAD_LOCAL char error_str[512];
 
 #define NITEMS(x) (sizeof(x)/sizeof(x[0]))
 
@@ -114,12 +123,197 @@ mbus_slave_data_get(size_t i)
     return NULL;
 }
 
+//------------------------------------------------------------------------------
+/// State of a slave after reset (SND_NKE): the next request carries FCB
+//------------------------------------------------------------------------------
+void
+mbus_slave_data_init(mbus_slave_data *data)
+{
+    if (data)
+    {
+        data->state_fcb = 1;
+        data->state_acd = 0;
+    }
+}
+
+void
+mbus_slave_table_init(mbus_slave_table *table)
+{
+    if (table)
+    {
+        table->entries = NULL;
+        table->size = 0;
+        table->count = 0;
+    }
+}
+
+void
+mbus_slave_table_free(mbus_slave_table *table)
+{
+    if (table)
+    {
+        free(table->entries);
+        mbus_slave_table_init(table);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reset the state of all slaves (e.g. after a broadcast SND_NKE)
+//------------------------------------------------------------------------------
+void
+mbus_slave_table_reset(mbus_slave_table *table)
+{
+    size_t i;
+
+    if (table == NULL)
+        return;
+
+    for (i = 0; i < table->size; i++)
+    {
+        if (table->entries[i].type)
+            mbus_slave_data_init(&(table->entries[i].data));
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Key of a secondary address, given as the 8 bytes of the selection frame
+//------------------------------------------------------------------------------
+uint64_t
+mbus_slave_key_secondary(const unsigned char *secondary)
+{
+    uint64_t key = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+        key = (key << 8) | secondary[i];
+
+    return key;
+}
+
+static size_t
+mbus_slave_table_slot(const mbus_slave_table *table, int type, uint64_t key)
+{
+    size_t i;
+
+    // Fibonacci hashing, size is a power of two
+    i = (size_t) (((key ^ (uint64_t) type) * 0x9E3779B97F4A7C15ULL) >> 32) & (table->size - 1);
+
+    while (table->entries[i].type &&
+           (table->entries[i].type != type || table->entries[i].key != key))
+        i = (i + 1) & (table->size - 1);
+
+    return i;
+}
+
+//------------------------------------------------------------------------------
+/// Look up the state of a slave, optionally creating it in the reset state.
+/// The pointer is valid until the next entry is created.
+//------------------------------------------------------------------------------
+mbus_slave_data *
+mbus_slave_table_get(mbus_slave_table *table, int type, uint64_t key, int create)
+{
+    mbus_slave_entry *entries, *old;
+    size_t i, j, size;
+
+    if (table == NULL || (type != MBUS_SLAVE_KEY_PRIMARY && type != MBUS_SLAVE_KEY_SECONDARY))
+        return NULL;
+
+    if (table->size > 0)
+    {
+        i = mbus_slave_table_slot(table, type, key);
+
+        if (table->entries[i].type)
+            return &(table->entries[i].data);
+    }
+
+    if (!create)
+        return NULL;
+
+    // keep the load factor below 3/4
+    if (4 * (table->count + 1) > 3 * table->size)
+    {
+        size = table->size ? 2 * table->size : 16;
+
+        if ((entries = (mbus_slave_entry *) calloc(size, sizeof(mbus_slave_entry))) == NULL)
+        {
+            snprintf(error_str, sizeof(error_str), "Failed to allocate slave table.");
+            return NULL;
+        }
+
+        old = table->entries;
+        j = table->size;
+        table->entries = entries;
+        table->size = size;
+
+        for (i = 0; i < j; i++)
+        {
+            if (old[i].type)
+                table->entries[mbus_slave_table_slot(table, old[i].type, old[i].key)] = old[i];
+        }
+
+        free(old);
+    }
+
+    i = mbus_slave_table_slot(table, type, key);
+    table->entries[i].type = type;
+    table->entries[i].key = key;
+    mbus_slave_data_init(&(table->entries[i].data));
+    table->count++;
+
+    return &(table->entries[i].data);
+}
+
 //------------------------------------------------------------------------------
 //
 // M-Bus FRAME RELATED FUNCTIONS
 //
 //------------------------------------------------------------------------------
 
+//------------------------------------------------------------------------------
+/// Initialize an M-bus frame data structure according to which frame type is
+/// requested.
+//------------------------------------------------------------------------------
+static void
+mbus_frame_init(mbus_frame *frame, int frame_type)
+{
+    memset((void *)frame, 0, sizeof(mbus_frame));
+
+    frame->type = frame_type;
+    switch (frame->type)
+    {
+        case MBUS_FRAME_TYPE_ACK:
+
+            frame->start1 = MBUS_FRAME_ACK_START;
+
+            break;
+
+        case MBUS_FRAME_TYPE_SHORT:
+
+            frame->start1 = MBUS_FRAME_SHORT_START;
+            frame->stop   = MBUS_FRAME_STOP;
+
+            break;
+
+        case MBUS_FRAME_TYPE_CONTROL:
+
+            frame->start1 = MBUS_FRAME_CONTROL_START;
+            frame->start2 = MBUS_FRAME_CONTROL_START;
+            frame->length1 = 3;
+            frame->length2 = 3;
+            frame->stop   = MBUS_FRAME_STOP;
+
+            break;
+
+        case MBUS_FRAME_TYPE_LONG:
+
+            frame->start1 = MBUS_FRAME_LONG_START;
+            frame->start2 = MBUS_FRAME_LONG_START;
+            frame->stop   = MBUS_FRAME_STOP;
+
+            break;
+    }
+}
+
 //------------------------------------------------------------------------------
 /// Allocate an M-bus frame data structure and initialize it according to which
 /// frame type is requested.
@@ -131,62 +325,214 @@ mbus_frame_new(int frame_type)
 
     if ((frame = malloc(sizeof(mbus_frame))) != NULL)
     {
-        memset((void *)frame, 0, sizeof(mbus_frame));
+        mbus_frame_init(frame, frame_type);
+    }
 
-        frame->type = frame_type;
-        switch (frame->type)
-        {
-            case MBUS_FRAME_TYPE_ACK:
+    return frame;
+}
 
-                frame->start1 = MBUS_FRAME_ACK_START;
+//------------------------------------------------------------------------------
+/// Release the pool itself once it is closing and nothing is out any more.
+//------------------------------------------------------------------------------
+static void
+mbus_frame_pool_check(mbus_frame_pool *pool)
+{
+    if (pool->closing && pool->outstanding == 0)
+    {
+        free(pool->data);
+        free(pool);
+    }
+}
 
-                break;
+//------------------------------------------------------------------------------
+/// Free the memory resources allocated for the M-Bus frame data structure.
+/// Frames of a multi-telegram chain that were acquired from a frame pool are
+/// returned to it.
+//------------------------------------------------------------------------------
+int
+mbus_frame_free(mbus_frame *frame)
+{
+    mbus_frame *next;
+    mbus_frame_pool *pool;
 
-            case MBUS_FRAME_TYPE_SHORT:
+    if (frame == NULL)
+    {
+        return -1;
+    }
 
-                frame->start1 = MBUS_FRAME_SHORT_START;
-                frame->stop   = MBUS_FRAME_STOP;
+    for (; frame; frame = next)
+    {
+        next = frame->next;
 
-                break;
+        if ((pool = frame->pool) == NULL)
+        {
+            free(frame);
+            continue;
+        }
 
-            case MBUS_FRAME_TYPE_CONTROL:
+        pool->outstanding--;
 
-                frame->start1 = MBUS_FRAME_CONTROL_START;
-                frame->start2 = MBUS_FRAME_CONTROL_START;
-                frame->length1 = 3;
-                frame->length2 = 3;
-                frame->stop   = MBUS_FRAME_STOP;
+        if (!pool->closing && pool->nframes < pool->max_free)
+        {
+            frame->next = pool->frames;
+            pool->frames = frame;
+            pool->nframes++;
+        }
+        else
+        {
+            free(frame);
+        }
 
-                break;
+        mbus_frame_pool_check(pool);
+    }
 
-            case MBUS_FRAME_TYPE_LONG:
+    return 0;
+}
 
-                frame->start1 = MBUS_FRAME_LONG_START;
-                frame->start2 = MBUS_FRAME_LONG_START;
-                frame->stop   = MBUS_FRAME_STOP;
+//------------------------------------------------------------------------------
+/// Allocate a frame pool that keeps up to max_free frames and frame data
+/// structures for reuse.
+//------------------------------------------------------------------------------
+mbus_frame_pool *
+mbus_frame_pool_new(size_t max_free)
+{
+    mbus_frame_pool *pool;
 
-                break;
-        }
+    if (max_free == 0)
+    {
+        snprintf(error_str, sizeof(error_str), "Invalid frame pool size.");
+        return NULL;
     }
 
-    return frame;
+    if ((pool = (mbus_frame_pool *)malloc(sizeof(mbus_frame_pool))) == NULL)
+    {
+        return NULL;
+    }
+
+    memset(pool, 0, sizeof(mbus_frame_pool));
+
+    if ((pool->data = (mbus_frame_data **)malloc(max_free * sizeof(mbus_frame_data *))) == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    pool->max_free = max_free;
+
+    return pool;
 }
 
 //------------------------------------------------------------------------------
-/// Free the memory resources allocated for the M-Bus frame data structure.
+/// Free a frame pool and the objects it keeps. Frames and frame data that are
+/// still out go back to the heap when they are freed, the pool itself is
+/// released with the last of them.
 //------------------------------------------------------------------------------
-int
-mbus_frame_free(mbus_frame *frame)
+void
+mbus_frame_pool_free(mbus_frame_pool *pool)
 {
-    if (frame)
+    mbus_frame *frame;
+
+    if (pool == NULL)
     {
-        if (frame->next != NULL)
-            mbus_frame_free(frame->next);
+        return;
+    }
 
+    while ((frame = pool->frames) != NULL)
+    {
+        pool->frames = frame->next;
         free(frame);
+    }
+    pool->nframes = 0;
+
+    while (pool->ndata > 0)
+    {
+        free(pool->data[--pool->ndata]);
+    }
+
+    pool->closing = 1;
+    mbus_frame_pool_check(pool);
+}
+
+//------------------------------------------------------------------------------
+/// Take a frame from the pool, or from the heap when the pool is empty, and
+/// initialize it like mbus_frame_new. Release it with mbus_frame_free.
+//------------------------------------------------------------------------------
+mbus_frame *
+mbus_frame_pool_acquire(mbus_frame_pool *pool, int frame_type)
+{
+    mbus_frame *frame;
+
+    if (pool == NULL || pool->closing)
+    {
+        snprintf(error_str, sizeof(error_str), "Invalid frame pool.");
+        return NULL;
+    }
+
+    if ((frame = pool->frames) != NULL)
+    {
+        pool->frames = frame->next;
+        pool->nframes--;
+    }
+    else if ((frame = malloc(sizeof(mbus_frame))) == NULL)
+    {
+        return NULL;
+    }
+
+    mbus_frame_init(frame, frame_type);
+    frame->pool = pool;
+    pool->outstanding++;
+
+    return frame;
+}
+
+//------------------------------------------------------------------------------
+/// Arithmetic sum (modulo 256) of a buffer. The SIMD variants add 16 bytes
+/// at a time with SAD/pairwise add instructions, any remainder is added by
+/// the scalar loop.
+//------------------------------------------------------------------------------
+unsigned char
+mbus_checksum(const unsigned char *data, size_t data_size)
+{
+    unsigned int sum = 0;
+    size_t i = 0;
+
+    if (data == NULL)
         return 0;
+
+#if defined(__SSE2__)
+    {
+        __m128i acc = _mm_setzero_si128();
+        const __m128i zero = _mm_setzero_si128();
+
+        // _mm_sad_epu8 sums 8 bytes into each 64 bit lane, no overflow for
+        // any realistic buffer size
+        for (; i + 16 <= data_size; i += 16)
+        {
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) &data[i]), zero));
+        }
+
+        sum = (unsigned int) _mm_cvtsi128_si32(acc) + (unsigned int) _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
     }
-    return -1;
+#elif defined(__ARM_NEON)
+    {
+        uint32x4_t acc = vdupq_n_u32(0);
+
+        for (; i + 16 <= data_size; i += 16)
+        {
+            acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(&data[i])));
+        }
+
+        sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+              vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    }
+#endif
+
+    for (; i < data_size; i++)
+    {
+        sum += data[i];
+    }
+
+    return (unsigned char) sum;
 }
 
 //------------------------------------------------------------------------------
@@ -195,7 +541,6 @@ mbus_frame_free(mbus_frame *frame)
 unsigned char
 calc_checksum(mbus_frame *frame)
 {
-    size_t i;
     unsigned char cksum;
 
     assert(frame != NULL);
@@ -221,11 +566,7 @@ calc_checksum(mbus_frame *frame)
             cksum = frame->control;
             cksum += frame->address;
             cksum += frame->control_information;
-
-            for (i = 0; i < frame->data_size; i++)
-            {
-                cksum += frame->data[i];
-            }
+            cksum += mbus_checksum(frame->data, frame->data_size);
 
             break;
 
@@ -330,6 +671,30 @@ mbus_frame_direction(mbus_frame *frame)
     return -1;
 }
 
+//------------------------------------------------------------------------------
+// Control codes accepted in short and in long/control frames
+//------------------------------------------------------------------------------
+static int
+mbus_control_short_valid(unsigned char control)
+{
+    return (control ==  MBUS_CONTROL_MASK_SND_NKE)                          ||
+           (control ==  MBUS_CONTROL_MASK_REQ_UD1)                          ||
+           (control == (MBUS_CONTROL_MASK_REQ_UD1 | MBUS_CONTROL_MASK_FCB)) ||
+           (control ==  MBUS_CONTROL_MASK_REQ_UD2)                          ||
+           (control == (MBUS_CONTROL_MASK_REQ_UD2 | MBUS_CONTROL_MASK_FCB));
+}
+
+static int
+mbus_control_long_valid(unsigned char control)
+{
+    return (control ==  MBUS_CONTROL_MASK_SND_UD)                          ||
+           (control == (MBUS_CONTROL_MASK_SND_UD | MBUS_CONTROL_MASK_FCB)) ||
+           (control ==  MBUS_CONTROL_MASK_RSP_UD)                          ||
+           (control == (MBUS_CONTROL_MASK_RSP_UD | MBUS_CONTROL_MASK_DFC)) ||
+           (control == (MBUS_CONTROL_MASK_RSP_UD | MBUS_CONTROL_MASK_ACD)) ||
+           (control == (MBUS_CONTROL_MASK_RSP_UD | MBUS_CONTROL_MASK_DFC | MBUS_CONTROL_MASK_ACD));
+}
+
 //------------------------------------------------------------------------------
 /// Verify that parsed frame is a valid M-bus frame.
 //
@@ -362,11 +727,7 @@ mbus_frame_verify(mbus_frame *frame)
                     return -1;
                 }
 
-                if ((frame->control !=  MBUS_CONTROL_MASK_SND_NKE)                          &&
-                    (frame->control !=  MBUS_CONTROL_MASK_REQ_UD1)                          &&
-                    (frame->control != (MBUS_CONTROL_MASK_REQ_UD1 | MBUS_CONTROL_MASK_FCB)) &&
-                    (frame->control !=  MBUS_CONTROL_MASK_REQ_UD2)                          &&
-                    (frame->control != (MBUS_CONTROL_MASK_REQ_UD2 | MBUS_CONTROL_MASK_FCB)))
+                if (!mbus_control_short_valid(frame->control))
                 {
                     snprintf(error_str, sizeof(error_str), "Unknown Control Code 0x%.2x", frame->control);
 
@@ -385,12 +746,7 @@ mbus_frame_verify(mbus_frame *frame)
                     return -1;
                 }
 
-                if ((frame->control !=  MBUS_CONTROL_MASK_SND_UD)                          &&
-                    (frame->control != (MBUS_CONTROL_MASK_SND_UD | MBUS_CONTROL_MASK_FCB)) &&
-                    (frame->control !=  MBUS_CONTROL_MASK_RSP_UD)                          &&
-                    (frame->control != (MBUS_CONTROL_MASK_RSP_UD | MBUS_CONTROL_MASK_DFC)) &&
-                    (frame->control != (MBUS_CONTROL_MASK_RSP_UD | MBUS_CONTROL_MASK_ACD)) &&
-                    (frame->control != (MBUS_CONTROL_MASK_RSP_UD | MBUS_CONTROL_MASK_DFC | MBUS_CONTROL_MASK_ACD)))
+                if (!mbus_control_long_valid(frame->control))
                 {
                     snprintf(error_str, sizeof(error_str), "Unknown Control Code 0x%.2x", frame->control);
 
@@ -489,37 +845,148 @@ mbus_data_bcd_encode(unsigned char *bcd_data, size_t bcd_data_size, int value)
 }
 
 //------------------------------------------------------------------------------
-///
-/// Decode BCD data (decimal)
-///
+/// Little-endian load of the fixed data field widths of the DIF coding (1, 2,
+/// 3, 4, 6 and 8 bytes), as one or two unaligned loads on little-endian
+/// targets. Other widths up to 8 bytes, and big-endian targets, use a loop.
 //------------------------------------------------------------------------------
-long long
-mbus_data_bcd_decode(unsigned char *bcd_data, size_t bcd_data_size)
+static inline uint64_t
+mbus_data_load_le(const unsigned char *data, size_t size)
 {
-    long long val = 0;
-    size_t i;
+    uint64_t v = 0;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    uint32_t v32;
+    uint16_t v16;
 
-    if (bcd_data)
+    switch (size)
     {
-        for (i = bcd_data_size; i > 0; i--)
-        {
-            val = (val * 10);
+        case 1:
+            return data[0];
+        case 2:
+            memcpy(&v16, data, 2);
+            return v16;
+        case 3:
+            memcpy(&v16, data, 2);
+            return v16 | (uint64_t)data[2] << 16;
+        case 4:
+            memcpy(&v32, data, 4);
+            return v32;
+        case 6:
+            memcpy(&v32, data, 4);
+            memcpy(&v16, data + 4, 2);
+            return v32 | (uint64_t)v16 << 32;
+        case 8:
+            memcpy(&v, data, 8);
+            return v;
+    }
+#endif
 
-            if (bcd_data[i-1]>>4 < 0xA)
-            {
-                val += ((bcd_data[i-1]>>4) & 0xF);
-            }
+    while (size > 0)
+    {
+        v = (v << 8) | data[--size];
+    }
 
-            val = (val * 10) + ( bcd_data[i-1] & 0xF);
-        }
+    return v;
+}
 
-        // hex code Fh in the MSD position signals a negative BCD number
-        if (bcd_data[bcd_data_size-1]>>4 == 0xF)
+//------------------------------------------------------------------------------
+/// Sign extend the lowest size bytes of v (two's complement, 1 <= size <= 8)
+//------------------------------------------------------------------------------
+static inline int64_t
+mbus_data_sign_extend(uint64_t v, size_t size)
+{
+    uint64_t m = (uint64_t)1 << (size * 8 - 1);
+
+    return (int64_t)((v ^ m) - m);
+}
+
+//------------------------------------------------------------------------------
+/// Convert up to 16 packed BCD digits in parallel (SWAR): digit pairs are
+/// combined into bytes, then into 16, 32 and 64 bit lanes. High nibbles A-E are ignored
+/// like in the digit loop, a low nibble adds its hex value.
+//------------------------------------------------------------------------------
+static inline uint64_t
+mbus_data_bcd_swar(uint64_t v)
+{
+    uint64_t invalid;
+
+    // clear high nibbles >= 0xA: (nibble + 6) carries into bit 4
+    invalid = ((((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL;
+    v &= ~(invalid * 0xF0);
+
+    // 16 * hi + lo - 6 * hi = 10 * hi + lo, and so on for the wider lanes
+    v -= ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) * 6;
+    v -= ((v >> 8) & 0x00FF00FF00FF00FFULL) * 156;
+    v -= ((v >> 16) & 0x0000FFFF0000FFFFULL) * 55536;
+    v -= (v >> 32) * 4194967296ULL;
+
+    return v;
+}
+
+//------------------------------------------------------------------------------
+/// Same as mbus_data_bcd_swar for up to 8 digits, the data field widths of
+/// 1 to 4 bytes.
+//------------------------------------------------------------------------------
+static inline uint32_t
+mbus_data_bcd_swar32(uint32_t v)
+{
+    uint32_t invalid;
+
+    invalid = ((((v >> 4) & 0x0F0F0F0FU) + 0x06060606U) >> 4) & 0x01010101U;
+    v &= ~(invalid * 0xF0);
+
+    v -= ((v >> 4) & 0x0F0F0F0FU) * 6;
+    v -= ((v >> 8) & 0x00FF00FFU) * 156;
+    v -= (v >> 16) * 55536;
+
+    return v;
+}
+
+//------------------------------------------------------------------------------
+///
+/// Decode BCD data (decimal)
+///
+//------------------------------------------------------------------------------
+long long
+mbus_data_bcd_decode(unsigned char *bcd_data, size_t bcd_data_size)
+{
+    long long val = 0;
+    long long neg;
+    size_t i;
+
+    if (bcd_data)
+    {
+        if (bcd_data_size == 0)
         {
-            val *= -1;
+            return 0;
         }
 
-        return val;
+        if (bcd_data_size <= 4)
+        {
+            val = mbus_data_bcd_swar32((uint32_t) mbus_data_load_le(bcd_data, bcd_data_size));
+        }
+        else if (bcd_data_size <= 8)
+        {
+            val = (long long) mbus_data_bcd_swar(mbus_data_load_le(bcd_data, bcd_data_size));
+        }
+        else
+        {
+            for (i = bcd_data_size; i > 0; i--)
+            {
+                val = (val * 10);
+
+                if (bcd_data[i-1]>>4 < 0xA)
+                {
+                    val += ((bcd_data[i-1]>>4) & 0xF);
+                }
+
+                val = (val * 10) + ( bcd_data[i-1] & 0xF);
+            }
+        }
+
+        // hex code Fh in the MSD position signals a negative BCD number
+        neg = (bcd_data[bcd_data_size-1]>>4 == 0xF);
+
+        return (val ^ -neg) + neg;
     }
 
     return -1;
@@ -538,6 +1005,11 @@ mbus_data_bcd_decode_hex(unsigned char *bcd_data, size_t bcd_data_size)
 
     if (bcd_data)
     {
+        if (bcd_data_size <= 8)
+        {
+            return (long long) mbus_data_load_le(bcd_data, bcd_data_size);
+        }
+
         for (i = bcd_data_size; i > 0; i--)
         {
             val = (val << 8) | bcd_data[i-1];
@@ -554,18 +1026,19 @@ mbus_data_bcd_decode_hex(unsigned char *bcd_data, size_t bcd_data_size)
 /// Decode INTEGER data
 ///
 //------------------------------------------------------------------------------
-int
-mbus_data_int_decode(unsigned char *int_data, size_t int_data_size, int *value)
+static int
+mbus_data_integer_decode(unsigned char *int_data, size_t int_data_size, long long *value)
 {
     size_t i;
     int neg;
-    *value = 0;
 
-    if (!int_data || (int_data_size < 1))
+    if (int_data_size <= 8)
     {
-        return -1;
+        *value = mbus_data_sign_extend(mbus_data_load_le(int_data, int_data_size), int_data_size);
+        return 0;
     }
 
+    *value = 0;
     neg = int_data[int_data_size-1] & 0x80;
 
     for (i = int_data_size; i > 0; i--)
@@ -589,10 +1062,10 @@ mbus_data_int_decode(unsigned char *int_data, size_t int_data_size, int *value)
 }
 
 int
-mbus_data_long_decode(unsigned char *int_data, size_t int_data_size, long *value)
+mbus_data_int_decode(unsigned char *int_data, size_t int_data_size, int *value)
 {
-    size_t i;
-    int neg;
+    long long v;
+
     *value = 0;
 
     if (!int_data || (int_data_size < 1))
@@ -600,33 +1073,17 @@ mbus_data_long_decode(unsigned char *int_data, size_t int_data_size, long *value
         return -1;
     }
 
-    neg = int_data[int_data_size-1] & 0x80;
-
-    for (i = int_data_size; i > 0; i--)
-    {
-        if (neg)
-        {
-            *value = (*value << 8) + (int_data[i-1] ^ 0xFF);
-        }
-        else
-        {
-            *value = (*value << 8) + int_data[i-1];
-        }
-    }
-
-    if (neg)
-    {
-        *value = *value * -1 - 1;
-    }
+    mbus_data_integer_decode(int_data, int_data_size, &v);
+    *value = (int) v;
 
     return 0;
 }
 
 int
-mbus_data_long_long_decode(unsigned char *int_data, size_t int_data_size, long long *value)
+mbus_data_long_decode(unsigned char *int_data, size_t int_data_size, long *value)
 {
-    size_t i;
-    int neg;
+    long long v;
+
     *value = 0;
 
     if (!int_data || (int_data_size < 1))
@@ -634,26 +1091,23 @@ mbus_data_long_long_decode(unsigned char *int_data, size_t int_data_size, long l
         return -1;
     }
 
-    neg = int_data[int_data_size-1] & 0x80;
+    mbus_data_integer_decode(int_data, int_data_size, &v);
+    *value = (long) v;
 
-    for (i = int_data_size; i > 0; i--)
-    {
-        if (neg)
-        {
-            *value = (*value << 8) + (int_data[i-1] ^ 0xFF);
-        }
-        else
-        {
-            *value = (*value << 8) + int_data[i-1];
-        }
-    }
+    return 0;
+}
 
-    if (neg)
+int
+mbus_data_long_long_decode(unsigned char *int_data, size_t int_data_size, long long *value)
+{
+    *value = 0;
+
+    if (!int_data || (int_data_size < 1))
     {
-        *value = *value * -1 - 1;
+        return -1;
     }
 
-    return 0;
+    return mbus_data_integer_decode(int_data, int_data_size, value);
 }
 
 //------------------------------------------------------------------------------
@@ -887,16 +1341,18 @@ mbus_data_manufacturer_encode(unsigned char *m_data, unsigned char *m_code)
 ///
 //------------------------------------------------------------------------------
 const char *
-mbus_decode_manufacturer(unsigned char byte1, unsigned char byte2)
+mbus_decode_manufacturer_r(unsigned char byte1, unsigned char byte2, char *m_str, size_t m_str_size)
 {
-    static char m_str[4];
-
+    unsigned char m_raw[2];
     int m_id;
 
-    m_str[0] = byte1;
-    m_str[1] = byte2;
+    if (m_str == NULL || m_str_size < 4)
+        return NULL;
+
+    m_raw[0] = byte1;
+    m_raw[1] = byte2;
 
-    mbus_data_int_decode(m_str, 2, &m_id);
+    mbus_data_int_decode(m_raw, 2, &m_id);
 
     m_str[0] = (char)(((m_id>>10) & 0x001F) + 64);
     m_str[1] = (char)(((m_id>>5)  & 0x001F) + 64);
@@ -906,14 +1362,19 @@ mbus_decode_manufacturer(unsigned char byte1, unsigned char byte2)
     return m_str;
 }
 
+const char *
+mbus_decode_manufacturer(unsigned char byte1, unsigned char byte2)
+{
+    static char m_str[4];
+
+    return mbus_decode_manufacturer_r(byte1, byte2, m_str, sizeof(m_str));
+}
+
 const char *
 mbus_data_product_name(mbus_data_variable_header *header)
 {
-    static char buff[128];
     unsigned int manufacturer;
 
-    memset(buff, 0, sizeof(buff));
-
     if (header)
     {
         manufacturer = (header->manufacturer[1] << 8) + header->manufacturer[0];
@@ -925,11 +1386,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x02:
-                    strcpy(buff,"ABB Delta-Meter");
-                    break;
+                    return "ABB Delta-Meter";
                 case 0x20:
-                    strcpy(buff,"ABB B21 113-100");
-                    break;
+                    return "ABB B21 113-100";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("ACW"))
@@ -937,42 +1396,36 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x09:
-                    strcpy(buff,"Itron CF Echo 2");
-                    break;
+                    return "Itron CF Echo 2";
                 case 0x0A:
-                    strcpy(buff,"Itron CF 51");
-                    break;
+                    return "Itron CF 51";
                 case 0x0B:
-                    strcpy(buff,"Itron CF 55");
-                    break;
+                    return "Itron CF 55";
                 case 0x0E:
-                    strcpy(buff,"Itron BM +m");
-                    break;
+                    return "Itron BM +m";
                 case 0x0F:
-                    strcpy(buff,"Itron CF 800");
-                    break;
+                    return "Itron CF 800";
                 case 0x14:
-                    strcpy(buff,"Itron CYBLE M-Bus 1.4");
-                    break;
+                    return "Itron CYBLE M-Bus 1.4";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("AMT"))
         {
             if (header->version >= 0xC0)
             {
-                strcpy(buff,"Aquametro CALEC ST");
+                return "Aquametro CALEC ST";
             }
             else if (header->version >= 0x80)
             {
-                strcpy(buff,"Aquametro CALEC MB");
+                return "Aquametro CALEC MB";
             }
             else if (header->version >= 0x40)
             {
-                strcpy(buff,"Aquametro SAPHIR");
+                return "Aquametro SAPHIR";
             }
             else
             {
-                strcpy(buff,"Aquametro AMTRON");
+                return "Aquametro AMTRON";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("BEC"))
@@ -982,11 +1435,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
                 switch (header->version)
                 {
                     case 0x00:
-                        strcpy(buff,"Berg DCMi");
-                        break;
+                        return "Berg DCMi";
                     case 0x07:
-                        strcpy(buff,"Berg BLMi");
-                        break;
+                        return "Berg BLMi";
                 }
             }
             else if (header->medium == MBUS_VARIABLE_DATA_MEDIUM_UNKNOWN)
@@ -994,8 +1445,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
                 switch (header->version)
                 {
                     case 0x71:
-                        strcpy(buff, "Berg BMB-10S0");
-                        break;
+                        return "Berg BMB-10S0";
                 }
             }
         }
@@ -1004,11 +1454,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x00:
-                    strcpy(buff, ((header->medium == 0x06) ? "Engelmann WaterStar" : "Engelmann / Elster SensoStar 2"));
-                    break;
+                    return (header->medium == 0x06) ? "Engelmann WaterStar" : "Engelmann / Elster SensoStar 2";
                 case 0x01:
-                    strcpy(buff,"Engelmann SensoStar 2C");
-                    break;
+                    return "Engelmann SensoStar 2C";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("ELS"))
@@ -1016,14 +1464,11 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x02:
-                    strcpy(buff,"Elster TMP-A");
-                    break;
+                    return "Elster TMP-A";
                 case 0x0A:
-                    strcpy(buff,"Elster Falcon");
-                    break;
+                    return "Elster Falcon";
                 case 0x2F:
-                    strcpy(buff,"Elster F96 Plus");
-                    break;
+                    return "Elster F96 Plus";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("ELV"))
@@ -1040,8 +1485,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
                 case 0x1B:
                 case 0x1C:
                 case 0x1D:
-                    strcpy(buff, "Elvaco CMa10");
-                    break;
+                    return "Elvaco CMa10";
                 case 0x32:
                 case 0x33:
                 case 0x34:
@@ -1052,8 +1496,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
                 case 0x39:
                 case 0x3A:
                 case 0x3B:
-                    strcpy(buff,"Elvaco CMa11");
-                    break;
+                    return "Elvaco CMa11";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("EMH"))
@@ -1061,8 +1504,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x00:
-                    strcpy(buff,"EMH DIZ");
-                    break;
+                    return "EMH DIZ";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("EMU"))
@@ -1072,8 +1514,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
                 switch (header->version)
                 {
                     case 0x10:
-                        strcpy(buff,"EMU Professional 3/75 M-Bus");
-                        break;
+                        return "EMU Professional 3/75 M-Bus";
                 }
             }
         }
@@ -1087,15 +1528,12 @@ mbus_data_product_name(mbus_data_variable_header *header)
                     case 0x2E:
                     case 0x2F:
                     case 0x30:
-                        strcpy(buff,"Carlo Gavazzi EM24");
-                        break;
+                        return "Carlo Gavazzi EM24";
                     case 0x39:
                     case 0x3A:
-                        strcpy(buff,"Carlo Gavazzi EM21");
-                        break;
+                        return "Carlo Gavazzi EM21";
                     case 0x40:
-                        strcpy(buff,"Carlo Gavazzi EM33");
-                        break;
+                        return "Carlo Gavazzi EM33";
                 }
             }
         }
@@ -1104,8 +1542,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0xE6:
-                    strcpy(buff,"GMC-I A230 EMMOD 206");
-                    break;
+                    return "GMC-I A230 EMMOD 206";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("KAM"))
@@ -1113,11 +1550,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x01:
-                    strcpy(buff,"Kamstrup 382 (6850-005)");
-                    break;
+                    return "Kamstrup 382 (6850-005)";
                 case 0x08:
-                    strcpy(buff,"Kamstrup Multical 601");
-                    break;
+                    return "Kamstrup Multical 601";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("SLB"))
@@ -1125,11 +1560,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x02:
-                    strcpy(buff,"Allmess Megacontrol CF-50");
-                    break;
+                    return "Allmess Megacontrol CF-50";
                 case 0x06:
-                    strcpy(buff,"CF Compact / Integral MK MaXX");
-                    break;
+                    return "CF Compact / Integral MK MaXX";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("HYD"))
@@ -1137,11 +1570,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x28:
-                    strcpy(buff,"ABB F95 Typ US770");
-                    break;
+                    return "ABB F95 Typ US770";
                 case 0x2F:
-                    strcpy(buff,"Hydrometer Sharky 775");
-                    break;
+                    return "Hydrometer Sharky 775";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("JAN"))
@@ -1151,8 +1582,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
                 switch (header->version)
                 {
                     case 0x09:
-                        strcpy(buff,"Janitza UMG 96S");
-                        break;
+                        return "Janitza UMG 96S";
                 }
             }
         }
@@ -1161,17 +1591,13 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x02:
-                    strcpy(buff,"Landis & Gyr Ultraheat 2WR5");
-                    break;
+                    return "Landis & Gyr Ultraheat 2WR5";
                 case 0x03:
-                    strcpy(buff,"Landis & Gyr Ultraheat 2WR6");
-                    break;
+                    return "Landis & Gyr Ultraheat 2WR6";
                 case 0x04:
-                    strcpy(buff,"Landis & Gyr Ultraheat UH50");
-                    break;
+                    return "Landis & Gyr Ultraheat UH50";
                 case 0x07:
-                    strcpy(buff,"Landis & Gyr Ultraheat T230");
-                    break;
+                    return "Landis & Gyr Ultraheat T230";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("LSE"))
@@ -1179,8 +1605,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x99:
-                    strcpy(buff,"Siemens WFH21");
-                    break;
+                    return "Siemens WFH21";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("NZR"))
@@ -1188,11 +1613,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x01:
-                    strcpy(buff,"NZR DHZ 5/63");
-                    break;
+                    return "NZR DHZ 5/63";
                 case 0x50:
-                    strcpy(buff,"NZR IC-M2");
-                    break;
+                    return "NZR IC-M2";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("RAM"))
@@ -1200,8 +1623,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x03:
-                    strcpy(buff, "Rossweiner ETK/ETW Modularis");
-                    break;
+                    return "Rossweiner ETK/ETW Modularis";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("REL"))
@@ -1209,20 +1631,15 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x08:
-                    strcpy(buff, "Relay PadPuls M1");
-                    break;
+                    return "Relay PadPuls M1";
                 case 0x12:
-                    strcpy(buff, "Relay PadPuls M4");
-                    break;
+                    return "Relay PadPuls M4";
                 case 0x20:
-                    strcpy(buff, "Relay Padin 4");
-                    break;
+                    return "Relay Padin 4";
                 case 0x30:
-                    strcpy(buff, "Relay AnDi 4");
-                    break;
+                    return "Relay AnDi 4";
                 case 0x40:
-                    strcpy(buff, "Relay PadPuls M2");
-                    break;
+                    return "Relay PadPuls M2";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("RKE"))
@@ -1230,8 +1647,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x69:
-                    strcpy(buff,"Ista sensonic II mbus");
-                    break;
+                    return "Ista sensonic II mbus";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("SBC"))
@@ -1240,11 +1656,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             {
                 case 0x10:
                 case 0x19:
-                    strcpy(buff,"Saia-Burgess ALE3");
-                    break;
+                    return "Saia-Burgess ALE3";
                 case 0x11:
-                    strcpy(buff,"Saia-Burgess AWD3");
-                    break;
+                    return "Saia-Burgess AWD3";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("SEO") || manufacturer == mbus_manufacturer_id("GTE"))
@@ -1252,24 +1666,18 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->id_bcd[3])
             {
                 case 0x30:
-                    strcpy(buff,"Sensoco PT100");
-                    break;
+                    return "Sensoco PT100";
                 case 0x41:
-                    strcpy(buff,"Sensoco 2-NTC");
-                    break;
+                    return "Sensoco 2-NTC";
                 case 0x45:
-                    strcpy(buff,"Sensoco Laser Light");
-                    break;
+                    return "Sensoco Laser Light";
                 case 0x48:
-                    strcpy(buff,"Sensoco ADIO");
-                    break;
+                    return "Sensoco ADIO";
                 case 0x51:
                 case 0x61:
-                    strcpy(buff,"Sensoco THU");
-                    break;
+                    return "Sensoco THU";
                 case 0x80:
-                    strcpy(buff,"Sensoco PulseCounter for E-Meter");
-                    break;
+                    return "Sensoco PulseCounter for E-Meter";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("SEN"))
@@ -1278,14 +1686,11 @@ mbus_data_product_name(mbus_data_variable_header *header)
             {
                 case 0x08:
                 case 0x19:
-                    strcpy(buff,"Sensus PolluCom E");
-                    break;
+                    return "Sensus PolluCom E";
                 case 0x0B:
-                    strcpy(buff,"Sensus PolluTherm");
-                    break;
+                    return "Sensus PolluTherm";
                 case 0x0E:
-                    strcpy(buff,"Sensus PolluStat E");
-                    break;
+                    return "Sensus PolluStat E";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("SON"))
@@ -1293,8 +1698,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x0D:
-                    strcpy(buff,"Sontex Supercal 531");
-                    break;
+                    return "Sontex Supercal 531";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("SPX"))
@@ -1303,8 +1707,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
             {
                 case 0x31:
                 case 0x34:
-                    strcpy(buff,"Sensus PolluTherm");
-                    break;
+                    return "Sensus PolluTherm";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("SVM"))
@@ -1312,11 +1715,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x08:
-                    strcpy(buff,"Elster F2 / Deltamess F2");
-                    break;
+                    return "Elster F2 / Deltamess F2";
                 case 0x09:
-                    strcpy(buff,"Elster F4 / Kamstrup SVM F22");
-                    break;
+                    return "Elster F4 / Kamstrup SVM F22";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("TCH"))
@@ -1324,11 +1725,9 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x26:
-                    strcpy(buff,"Techem m-bus S");
-                    break;
+                    return "Techem m-bus S";
                 case 0x40:
-                    strcpy(buff,"Techem ultra S3");
-                    break;
+                    return "Techem ultra S3";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("WZG"))
@@ -1336,8 +1735,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x03:
-                    strcpy(buff,"Modularis ETW-EAX");
-                    break;
+                    return "Modularis ETW-EAX";
             }
         }
         else if (manufacturer == mbus_manufacturer_id("ZRM"))
@@ -1345,17 +1743,15 @@ mbus_data_product_name(mbus_data_variable_header *header)
             switch (header->version)
             {
                 case 0x81:
-                    strcpy(buff,"Minol Minocal C2");
-                    break;
+                    return "Minol Minocal C2";
                 case 0x82:
-                    strcpy(buff,"Minol Minocal WR3");
-                    break;
+                    return "Minol Minocal WR3";
             }
         }
 
     }
 
-    return buff;
+    return "";
 }
 
 //------------------------------------------------------------------------------
@@ -1392,66 +1788,45 @@ mbus_data_product_name(mbus_data_variable_header *header)
 const char *
 mbus_data_fixed_medium(mbus_data_fixed *data)
 {
-    static char buff[256];
-
     if (data)
     {
         switch ( (data->cnt1_type&0xC0)>>6 | (data->cnt2_type&0xC0)>>4 )
         {
             case 0x00:
-                snprintf(buff, sizeof(buff), "Other");
-                break;
+                return "Other";
             case 0x01:
-                snprintf(buff, sizeof(buff), "Oil");
-                break;
+                return "Oil";
             case 0x02:
-                snprintf(buff, sizeof(buff), "Electricity");
-                break;
+                return "Electricity";
             case 0x03:
-                snprintf(buff, sizeof(buff), "Gas");
-                break;
+                return "Gas";
             case 0x04:
-                snprintf(buff, sizeof(buff), "Heat");
-                break;
+                return "Heat";
             case 0x05:
-                snprintf(buff, sizeof(buff), "Steam");
-                break;
+                return "Steam";
             case 0x06:
-                snprintf(buff, sizeof(buff), "Hot Water");
-                break;
+                return "Hot Water";
             case 0x07:
-                snprintf(buff, sizeof(buff), "Water");
-                break;
+                return "Water";
             case 0x08:
-                snprintf(buff, sizeof(buff), "H.C.A.");
-                break;
+                return "H.C.A.";
             case 0x09:
-                snprintf(buff, sizeof(buff), "Reserved");
-                break;
+                return "Reserved";
             case 0x0A:
-                snprintf(buff, sizeof(buff), "Gas Mode 2");
-                break;
+                return "Gas Mode 2";
             case 0x0B:
-                snprintf(buff, sizeof(buff), "Heat Mode 2");
-                break;
+                return "Heat Mode 2";
             case 0x0C:
-                snprintf(buff, sizeof(buff), "Hot Water Mode 2");
-                break;
+                return "Hot Water Mode 2";
             case 0x0D:
-                snprintf(buff, sizeof(buff), "Water Mode 2");
-                break;
+                return "Water Mode 2";
             case 0x0E:
-                snprintf(buff, sizeof(buff), "H.C.A. Mode 2");
-                break;
+                return "H.C.A. Mode 2";
             case 0x0F:
-                snprintf(buff, sizeof(buff), "Reserved");
-                break;
+                return "Reserved";
             default:
-                snprintf(buff, sizeof(buff), "unknown");
-                break;
+                return "unknown";
         }
-
-        return buff;
     }
 
     return NULL;
@@ -1503,209 +1878,143 @@ mbus_data_fixed_medium(mbus_data_fixed *data)
 const char *
 mbus_data_fixed_unit(int medium_unit_byte)
 {
-    static char buff[256];
-
     switch (medium_unit_byte & 0x3F)
     {
         case 0x00:
-            snprintf(buff, sizeof(buff), "h,m,s");
-            break;
+            return "h,m,s";
         case 0x01:
-            snprintf(buff, sizeof(buff), "D,M,Y");
-            break;
+            return "D,M,Y";
 
         case 0x02:
-            snprintf(buff, sizeof(buff), "Wh");
-            break;
+            return "Wh";
         case 0x03:
-            snprintf(buff, sizeof(buff), "10 Wh");
-            break;
+            return "10 Wh";
         case 0x04:
-            snprintf(buff, sizeof(buff), "100 Wh");
-            break;
+            return "100 Wh";
         case 0x05:
-            snprintf(buff, sizeof(buff), "kWh");
-            break;
+            return "kWh";
         case 0x06:
-            snprintf(buff, sizeof(buff), "10 kWh");
-            break;
+            return "10 kWh";
         case 0x07:
-            snprintf(buff, sizeof(buff), "100 kWh");
-            break;
+            return "100 kWh";
         case 0x08:
-            snprintf(buff, sizeof(buff), "MWh");
-            break;
+            return "MWh";
         case 0x09:
-            snprintf(buff, sizeof(buff), "10 MWh");
-            break;
+            return "10 MWh";
         case 0x0A:
-            snprintf(buff, sizeof(buff), "100 MWh");
-            break;
+            return "100 MWh";
 
         case 0x0B:
-            snprintf(buff, sizeof(buff), "kJ");
-            break;
+            return "kJ";
         case 0x0C:
-            snprintf(buff, sizeof(buff), "10 kJ");
-            break;
+            return "10 kJ";
         case 0x0E:
-            snprintf(buff, sizeof(buff), "100 kJ");
-            break;
+            return "100 kJ";
         case 0x0D:
-            snprintf(buff, sizeof(buff), "MJ");
-            break;
+            return "MJ";
         case 0x0F:
-            snprintf(buff, sizeof(buff), "10 MJ");
-            break;
+            return "10 MJ";
         case 0x10:
-            snprintf(buff, sizeof(buff), "100 MJ");
-            break;
+            return "100 MJ";
         case 0x11:
-            snprintf(buff, sizeof(buff), "GJ");
-            break;
+            return "GJ";
         case 0x12:
-            snprintf(buff, sizeof(buff), "10 GJ");
-            break;
+            return "10 GJ";
         case 0x13:
-            snprintf(buff, sizeof(buff), "100 GJ");
-            break;
+            return "100 GJ";
 
         case 0x14:
-            snprintf(buff, sizeof(buff), "W");
-            break;
+            return "W";
         case 0x15:
-            snprintf(buff, sizeof(buff), "10 W");
-            break;
+            return "10 W";
         case 0x16:
-            snprintf(buff, sizeof(buff), "100 W");
-            break;
+            return "100 W";
         case 0x17:
-            snprintf(buff, sizeof(buff), "kW");
-            break;
+            return "kW";
         case 0x18:
-            snprintf(buff, sizeof(buff), "10 kW");
-            break;
+            return "10 kW";
         case 0x19:
-            snprintf(buff, sizeof(buff), "100 kW");
-            break;
+            return "100 kW";
         case 0x1A:
-            snprintf(buff, sizeof(buff), "MW");
-            break;
+            return "MW";
         case 0x1B:
-            snprintf(buff, sizeof(buff), "10 MW");
-            break;
+            return "10 MW";
         case 0x1C:
-            snprintf(buff, sizeof(buff), "100 MW");
-            break;
+            return "100 MW";
 
         case 0x1D:
-            snprintf(buff, sizeof(buff), "kJ/h");
-            break;
+            return "kJ/h";
         case 0x1E:
-            snprintf(buff, sizeof(buff), "10 kJ/h");
-            break;
+            return "10 kJ/h";
         case 0x1F:
-            snprintf(buff, sizeof(buff), "100 kJ/h");
-            break;
+            return "100 kJ/h";
         case 0x20:
-            snprintf(buff, sizeof(buff), "MJ/h");
-            break;
+            return "MJ/h";
         case 0x21:
-            snprintf(buff, sizeof(buff), "10 MJ/h");
-            break;
+            return "10 MJ/h";
         case 0x22:
-            snprintf(buff, sizeof(buff), "100 MJ/h");
-            break;
+            return "100 MJ/h";
         case 0x23:
-            snprintf(buff, sizeof(buff), "GJ/h");
-            break;
+            return "GJ/h";
         case 0x24:
-            snprintf(buff, sizeof(buff), "10 GJ/h");
-            break;
+            return "10 GJ/h";
         case 0x25:
-            snprintf(buff, sizeof(buff), "100 GJ/h");
-            break;
+            return "100 GJ/h";
 
         case 0x26:
-            snprintf(buff, sizeof(buff), "ml");
-            break;
+            return "ml";
         case 0x27:
-            snprintf(buff, sizeof(buff), "10 ml");
-            break;
+            return "10 ml";
         case 0x28:
-            snprintf(buff, sizeof(buff), "100 ml");
-            break;
+            return "100 ml";
         case 0x29:
-            snprintf(buff, sizeof(buff), "l");
-            break;
+            return "l";
         case 0x2A:
-            snprintf(buff, sizeof(buff), "10 l");
-            break;
+            return "10 l";
         case 0x2B:
-            snprintf(buff, sizeof(buff), "100 l");
-            break;
+            return "100 l";
         case 0x2C:
-            snprintf(buff, sizeof(buff), "m^3");
-            break;
+            return "m^3";
         case 0x2D:
-            snprintf(buff, sizeof(buff), "10 m^3");
-            break;
+            return "10 m^3";
         case 0x2E:
-            snprintf(buff, sizeof(buff), "100 m^3");
-            break;
+            return "100 m^3";
 
         case 0x2F:
-            snprintf(buff, sizeof(buff), "ml/h");
-            break;
+            return "ml/h";
         case 0x30:
-            snprintf(buff, sizeof(buff), "10 ml/h");
-            break;
+            return "10 ml/h";
         case 0x31:
-            snprintf(buff, sizeof(buff), "100 ml/h");
-            break;
+            return "100 ml/h";
         case 0x32:
-            snprintf(buff, sizeof(buff), "l/h");
-            break;
+            return "l/h";
         case 0x33:
-            snprintf(buff, sizeof(buff), "10 l/h");
-            break;
+            return "10 l/h";
         case 0x34:
-            snprintf(buff, sizeof(buff), "100 l/h");
-            break;
+            return "100 l/h";
         case 0x35:
-            snprintf(buff, sizeof(buff), "m^3/h");
-            break;
+            return "m^3/h";
         case 0x36:
-            snprintf(buff, sizeof(buff), "10 m^3/h");
-            break;
+            return "10 m^3/h";
         case 0x37:
-            snprintf(buff, sizeof(buff), "100 m^3/h");
-            break;
+            return "100 m^3/h";
 
         case 0x38:
-            snprintf(buff, sizeof(buff), "1e-3 °C");
-            break;
+            return "1e-3 °C";
         case 0x39:
-            snprintf(buff, sizeof(buff), "units for HCA");
-            break;
+            return "units for HCA";
         case 0x3A:
         case 0x3B:
         case 0x3C:
         case 0x3D:
-            snprintf(buff, sizeof(buff), "reserved");
-            break;
+            return "reserved";
         case 0x3E:
-            snprintf(buff, sizeof(buff), "reserved but historic");
-            break;
+            return "reserved but historic";
         case 0x3F:
-            snprintf(buff, sizeof(buff), "without units");
-            break;
+            return "without units";
         default:
-            snprintf(buff, sizeof(buff), "unknown");
-            break;
+            return "unknown";
     }
-
-    return buff;
 }
 
 //------------------------------------------------------------------------------
@@ -1773,158 +2082,156 @@ mbus_data_fixed_unit(int medium_unit_byte)
 /// For variable-length frames, returns a string describing the medium.
 ///
 const char *
-mbus_data_variable_medium_lookup(unsigned char medium)
+mbus_data_variable_medium_lookup_r(unsigned char medium, char *buff, size_t buff_size)
 {
-    static char buff[256];
-
     switch (medium)
     {
         case MBUS_VARIABLE_DATA_MEDIUM_OTHER:
-            snprintf(buff, sizeof(buff), "Other");
+            snprintf(buff, buff_size, "Other");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_OIL:
-            snprintf(buff, sizeof(buff), "Oil");
+            snprintf(buff, buff_size, "Oil");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_ELECTRICITY:
-            snprintf(buff, sizeof(buff), "Electricity");
+            snprintf(buff, buff_size, "Electricity");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_GAS:
-            snprintf(buff, sizeof(buff), "Gas");
+            snprintf(buff, buff_size, "Gas");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_HEAT_OUT:
-            snprintf(buff, sizeof(buff), "Heat: Outlet");
+            snprintf(buff, buff_size, "Heat: Outlet");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_STEAM:
-            snprintf(buff, sizeof(buff), "Steam");
+            snprintf(buff, buff_size, "Steam");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_HOT_WATER:
-            snprintf(buff, sizeof(buff), "Warm water (30-90°C)");
+            snprintf(buff, buff_size, "Warm water (30-90°C)");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_WATER:
-            snprintf(buff, sizeof(buff), "Water");
+            snprintf(buff, buff_size, "Water");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_HEAT_COST:
-            snprintf(buff, sizeof(buff), "Heat Cost Allocator");
+            snprintf(buff, buff_size, "Heat Cost Allocator");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_COMPR_AIR:
-            snprintf(buff, sizeof(buff), "Compressed Air");
+            snprintf(buff, buff_size, "Compressed Air");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_COOL_OUT:
-            snprintf(buff, sizeof(buff), "Cooling load meter: Outlet");
+            snprintf(buff, buff_size, "Cooling load meter: Outlet");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_COOL_IN:
-            snprintf(buff, sizeof(buff), "Cooling load meter: Inlet");
+            snprintf(buff, buff_size, "Cooling load meter: Inlet");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_HEAT_IN:
-            snprintf(buff, sizeof(buff), "Heat: Inlet");
+            snprintf(buff, buff_size, "Heat: Inlet");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_HEAT_COOL:
-            snprintf(buff, sizeof(buff), "Heat / Cooling load meter");
+            snprintf(buff, buff_size, "Heat / Cooling load meter");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_BUS:
-            snprintf(buff, sizeof(buff), "Bus/System");
+            snprintf(buff, buff_size, "Bus/System");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_UNKNOWN:
-            snprintf(buff, sizeof(buff), "Unknown Medium");
+            snprintf(buff, buff_size, "Unknown Medium");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_IRRIGATION:
-            snprintf(buff, sizeof(buff), "Irrigation Water");
+            snprintf(buff, buff_size, "Irrigation Water");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_WATER_LOGGER:
-            snprintf(buff, sizeof(buff), "Water Logger");
+            snprintf(buff, buff_size, "Water Logger");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_GAS_LOGGER:
-            snprintf(buff, sizeof(buff), "Gas Logger");
+            snprintf(buff, buff_size, "Gas Logger");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_GAS_CONV:
-            snprintf(buff, sizeof(buff), "Gas Converter");
+            snprintf(buff, buff_size, "Gas Converter");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_COLORIFIC:
-            snprintf(buff, sizeof(buff), "Calorific value");
+            snprintf(buff, buff_size, "Calorific value");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_BOIL_WATER:
-            snprintf(buff, sizeof(buff), "Hot water (>90°C)");
+            snprintf(buff, buff_size, "Hot water (>90°C)");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_COLD_WATER:
-            snprintf(buff, sizeof(buff), "Cold water");
+            snprintf(buff, buff_size, "Cold water");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_DUAL_WATER:
-            snprintf(buff, sizeof(buff), "Dual water");
+            snprintf(buff, buff_size, "Dual water");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_PRESSURE:
-            snprintf(buff, sizeof(buff), "Pressure");
+            snprintf(buff, buff_size, "Pressure");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_ADC:
-            snprintf(buff, sizeof(buff), "A/D Converter");
+            snprintf(buff, buff_size, "A/D Converter");
             break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_SMOKE:
-          snprintf(buff, sizeof(buff), "Smoke Detector");
+          snprintf(buff, buff_size, "Smoke Detector");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_ROOM_SENSOR:
-          snprintf(buff, sizeof(buff), "Ambient Sensor");
+          snprintf(buff, buff_size, "Ambient Sensor");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_GAS_DETECTOR:
-          snprintf(buff, sizeof(buff), "Gas Detector");
+          snprintf(buff, buff_size, "Gas Detector");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_BREAKER_E:
-          snprintf(buff, sizeof(buff), "Breaker: Electricity");
+          snprintf(buff, buff_size, "Breaker: Electricity");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_VALVE:
-          snprintf(buff, sizeof(buff), "Valve: Gas or Water");
+          snprintf(buff, buff_size, "Valve: Gas or Water");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_CUSTOMER_UNIT:
-          snprintf(buff, sizeof(buff), "Customer Unit: Display Device");
+          snprintf(buff, buff_size, "Customer Unit: Display Device");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_WASTE_WATER:
-          snprintf(buff, sizeof(buff), "Waste Water");
+          snprintf(buff, buff_size, "Waste Water");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_GARBAGE:
-          snprintf(buff, sizeof(buff), "Garbage");
+          snprintf(buff, buff_size, "Garbage");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_SERVICE_UNIT:
-          snprintf(buff, sizeof(buff), "Service Unit");
+          snprintf(buff, buff_size, "Service Unit");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_RC_SYSTEM:
-          snprintf(buff, sizeof(buff), "Radio Converter: System");
+          snprintf(buff, buff_size, "Radio Converter: System");
           break;
 
         case MBUS_VARIABLE_DATA_MEDIUM_RC_METER:
-          snprintf(buff, sizeof(buff), "Radio Converter: Meter");
+          snprintf(buff, buff_size, "Radio Converter: Meter");
           break;
 
         case 0x22:
@@ -1950,29 +2257,35 @@ mbus_data_variable_medium_lookup(unsigned char medium)
         case 0x3D:
         case 0x3E:
         case 0x3F:
-            snprintf(buff, sizeof(buff), "Reserved");
+            snprintf(buff, buff_size, "Reserved");
             break;
 
 
         // add more ...
         default:
-            snprintf(buff, sizeof(buff), "Unknown medium (0x%.2x)", medium);
+            snprintf(buff, buff_size, "Unknown medium (0x%.2x)", medium);
             break;
     }
 
     return buff;
 }
 
+const char *
+mbus_data_variable_medium_lookup(unsigned char medium)
+{
+    static char buff[256];
+
+    return mbus_data_variable_medium_lookup_r(medium, buff, sizeof(buff));
+}
+
 //------------------------------------------------------------------------------
 ///
 /// Lookup the unit description from a VIF field in a data record
 ///
 //------------------------------------------------------------------------------
 const char *
-mbus_unit_prefix(int exp)
+mbus_unit_prefix_r(int exp, char *buff, size_t buff_size)
 {
-    static char buff[256];
-
     switch (exp)
     {
         case 0:
@@ -1980,48 +2293,56 @@ mbus_unit_prefix(int exp)
             break;
 
         case -3:
-            snprintf(buff, sizeof(buff), "m");
+            snprintf(buff, buff_size, "m");
             break;
 
         case -6:
-            snprintf(buff, sizeof(buff), "my");
+            snprintf(buff, buff_size, "my");
             break;
 
         case 1:
-            snprintf(buff, sizeof(buff), "10 ");
+            snprintf(buff, buff_size, "10 ");
             break;
 
         case 2:
-            snprintf(buff, sizeof(buff), "100 ");
+            snprintf(buff, buff_size, "100 ");
             break;
 
         case 3:
-            snprintf(buff, sizeof(buff), "k");
+            snprintf(buff, buff_size, "k");
             break;
 
         case 4:
-            snprintf(buff, sizeof(buff), "10 k");
+            snprintf(buff, buff_size, "10 k");
             break;
 
         case 5:
-            snprintf(buff, sizeof(buff), "100 k");
+            snprintf(buff, buff_size, "100 k");
             break;
 
         case 6:
-            snprintf(buff, sizeof(buff), "M");
+            snprintf(buff, buff_size, "M");
             break;
 
         case 9:
-            snprintf(buff, sizeof(buff), "G");
+            snprintf(buff, buff_size, "G");
             break;
 
         default:
-            snprintf(buff, sizeof(buff), "1e%d ", exp);
+            snprintf(buff, buff_size, "1e%d ", exp);
     }
 
     return buff;
 }
 
+const char *
+mbus_unit_prefix(int exp)
+{
+    static char buff[256];
+
+    return mbus_unit_prefix_r(exp, buff, sizeof(buff));
+}
+
 //------------------------------------------------------------------------------
 /// Look up the data length from a DIF field in the data record.
 ///
@@ -2079,9 +2400,9 @@ mbus_dif_datalength_lookup(unsigned char dif)
 /// See section 8.4.3  Codes for Value Information Field (VIF) in the M-BUS spec
 //------------------------------------------------------------------------------
 const char *
-mbus_vif_unit_lookup(unsigned char vif)
+mbus_vif_unit_lookup_r(unsigned char vif, char *buff, size_t buff_size)
 {
-    static char buff[256];
+    char prefix_buff[32];
     int n;
 
     switch (vif & MBUS_DIB_VIF_WITHOUT_EXTENSION) // ignore the extension bit in this selection
@@ -2096,7 +2417,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x00+6:
         case 0x00+7:
             n = (vif & 0x07) - 3;
-            snprintf(buff, sizeof(buff), "Energy (%sWh)", mbus_unit_prefix(n));
+            snprintf(buff, buff_size, "Energy (%sWh)", mbus_unit_prefix_r(n, prefix_buff, sizeof(prefix_buff)));
             break;
 
         // 0000 1nnn          Energy       10(nnn)J     (0.001kJ to 10000kJ)
@@ -2110,7 +2431,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x08+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Energy (%sJ)", mbus_unit_prefix(n));
+            snprintf(buff, buff_size, "Energy (%sJ)", mbus_unit_prefix_r(n, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2125,7 +2446,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x18+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Mass (%skg)", mbus_unit_prefix(n-3));
+            snprintf(buff, buff_size, "Mass (%skg)", mbus_unit_prefix_r(n-3, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2140,8 +2461,8 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x28+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Power (%sW)", mbus_unit_prefix(n-3));
-            //snprintf(buff, sizeof(buff), "Power (10^%d W)", n-3);
+            snprintf(buff, buff_size, "Power (%sW)", mbus_unit_prefix_r(n-3, prefix_buff, sizeof(prefix_buff)));
+            //snprintf(buff, buff_size, "Power (10^%d W)", n-3);
 
             break;
 
@@ -2156,7 +2477,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x30+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Power (%sJ/h)", mbus_unit_prefix(n));
+            snprintf(buff, buff_size, "Power (%sJ/h)", mbus_unit_prefix_r(n, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2171,7 +2492,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x10+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Volume (%s m^3)", mbus_unit_prefix(n-6));
+            snprintf(buff, buff_size, "Volume (%s m^3)", mbus_unit_prefix_r(n-6, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2186,7 +2507,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x38+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Volume flow (%s m^3/h)", mbus_unit_prefix(n-6));
+            snprintf(buff, buff_size, "Volume flow (%s m^3/h)", mbus_unit_prefix_r(n-6, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2201,7 +2522,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x40+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Volume flow (%s m^3/min)", mbus_unit_prefix(n-7));
+            snprintf(buff, buff_size, "Volume flow (%s m^3/min)", mbus_unit_prefix_r(n-7, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2216,7 +2537,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x48+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Volume flow (%s m^3/s)", mbus_unit_prefix(n-9));
+            snprintf(buff, buff_size, "Volume flow (%s m^3/s)", mbus_unit_prefix_r(n-9, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2231,7 +2552,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x50+7:
 
             n = (vif & 0x07);
-            snprintf(buff, sizeof(buff), "Mass flow (%s kg/h)", mbus_unit_prefix(n-3));
+            snprintf(buff, buff_size, "Mass flow (%s kg/h)", mbus_unit_prefix_r(n-3, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2242,7 +2563,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x58+3:
 
             n = (vif & 0x03);
-            snprintf(buff, sizeof(buff), "Flow temperature (%sdeg C)", mbus_unit_prefix(n-3));
+            snprintf(buff, buff_size, "Flow temperature (%sdeg C)", mbus_unit_prefix_r(n-3, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2253,7 +2574,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x5C+3:
 
             n = (vif & 0x03);
-            snprintf(buff, sizeof(buff), "Return temperature (%sdeg C)", mbus_unit_prefix(n-3));
+            snprintf(buff, buff_size, "Return temperature (%sdeg C)", mbus_unit_prefix_r(n-3, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2264,7 +2585,7 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x68+3:
 
             n = (vif & 0x03);
-            snprintf(buff, sizeof(buff), "Pressure (%s bar)", mbus_unit_prefix(n-3));
+            snprintf(buff, buff_size, "Pressure (%s bar)", mbus_unit_prefix_r(n-3, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2296,27 +2617,31 @@ mbus_vif_unit_lookup(unsigned char vif)
                 int offset;
 
                 if      ((vif & 0x7C) == 0x20)
-                    offset = snprintf(buff, sizeof(buff), "On time ");
+                    offset = snprintf(buff, buff_size, "On time ");
                 else if ((vif & 0x7C) == 0x24)
-                    offset = snprintf(buff, sizeof(buff), "Operating time ");
+                    offset = snprintf(buff, buff_size, "Operating time ");
                 else if ((vif & 0x7C) == 0x70)
-                    offset = snprintf(buff, sizeof(buff), "Averaging Duration ");
+                    offset = snprintf(buff, buff_size, "Averaging Duration ");
                 else
-                    offset = snprintf(buff, sizeof(buff), "Actuality Duration ");
+                    offset = snprintf(buff, buff_size, "Actuality Duration ");
+
+                // the buffer of the caller may be too small for the unit
+                if (offset < 0 || (size_t) offset >= buff_size)
+                    break;
 
                 switch (vif & 0x03)
                 {
                     case 0x00:
-                        snprintf(&buff[offset], sizeof(buff)-offset, "(seconds)");
+                        snprintf(&buff[offset], buff_size-offset, "(seconds)");
                         break;
                     case 0x01:
-                        snprintf(&buff[offset], sizeof(buff)-offset, "(minutes)");
+                        snprintf(&buff[offset], buff_size-offset, "(minutes)");
                         break;
                     case 0x02:
-                        snprintf(&buff[offset], sizeof(buff)-offset, "(hours)");
+                        snprintf(&buff[offset], buff_size-offset, "(hours)");
                         break;
                     case 0x03:
-                        snprintf(&buff[offset], sizeof(buff)-offset, "(days)");
+                        snprintf(&buff[offset], buff_size-offset, "(days)");
                         break;
                 }
             }
@@ -2331,9 +2656,9 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x6C+1:
 
             if (vif & 0x1)
-                snprintf(buff, sizeof(buff), "Time Point (time & date)");
+                snprintf(buff, buff_size, "Time Point (time & date)");
             else
-                snprintf(buff, sizeof(buff), "Time Point (date)");
+                snprintf(buff, buff_size, "Time Point (date)");
 
             break;
 
@@ -2345,7 +2670,7 @@ mbus_vif_unit_lookup(unsigned char vif)
 
             n = (vif & 0x03);
 
-            snprintf(buff, sizeof(buff), "Temperature Difference (%s deg C)", mbus_unit_prefix(n-3));
+            snprintf(buff, buff_size, "Temperature Difference (%s deg C)", mbus_unit_prefix_r(n-3, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
@@ -2356,43 +2681,43 @@ mbus_vif_unit_lookup(unsigned char vif)
         case 0x64+3:
 
             n = (vif & 0x03);
-            snprintf(buff, sizeof(buff), "External temperature (%s deg C)", mbus_unit_prefix(n-3));
+            snprintf(buff, buff_size, "External temperature (%s deg C)", mbus_unit_prefix_r(n-3, prefix_buff, sizeof(prefix_buff)));
 
             break;
 
         // E110 1110 Units for H.C.A. dimensionless
         case 0x6E:
-            snprintf(buff, sizeof(buff), "Units for H.C.A.");
+            snprintf(buff, buff_size, "Units for H.C.A.");
             break;
 
         // E110 1111 Reserved
         case 0x6F:
-            snprintf(buff, sizeof(buff), "Reserved");
+            snprintf(buff, buff_size, "Reserved");
             break;
 
         // Custom VIF in the following string: never reached...
         case 0x7C:
-            snprintf(buff, sizeof(buff), "Custom VIF");
+            snprintf(buff, buff_size, "Custom VIF");
             break;
 
         // Fabrication No
         case 0x78:
-            snprintf(buff, sizeof(buff), "Fabrication number");
+            snprintf(buff, buff_size, "Fabrication number");
             break;
 
         // Bus Address
         case 0x7A:
-            snprintf(buff, sizeof(buff), "Bus Address");
+            snprintf(buff, buff_size, "Bus Address");
             break;
 
         // Manufacturer specific: 7Fh / FF
         case 0x7F:
         case 0xFF:
-            snprintf(buff, sizeof(buff), "Manufacturer specific");
+            snprintf(buff, buff_size, "Manufacturer specific");
             break;
 
         default:
-            snprintf(buff, sizeof(buff), "Unknown (VIF=0x%.2X)", vif);
+            snprintf(buff, buff_size, "Unknown (VIF=0x%.2X)", vif);
             break;
     }
 
@@ -2400,6 +2725,14 @@ mbus_vif_unit_lookup(unsigned char vif)
     return buff;
 }
 
+const char *
+mbus_vif_unit_lookup(unsigned char vif)
+{
+    static char buff[256];
+
+    return mbus_vif_unit_lookup_r(vif, buff, sizeof(buff));
+}
+
 
 //------------------------------------------------------------------------------
 // Lookup the error message
@@ -2407,60 +2740,66 @@ mbus_vif_unit_lookup(unsigned char vif)
 // See section 6.6  Codes for general application errors in the M-BUS spec
 //------------------------------------------------------------------------------
 const char *
-mbus_data_error_lookup(int error)
+mbus_data_error_lookup_r(int error, char *buff, size_t buff_size)
 {
-    static char buff[256];
-
     switch (error)
     {
         case MBUS_ERROR_DATA_UNSPECIFIED:
-            snprintf(buff, sizeof(buff), "Unspecified error");
+            snprintf(buff, buff_size, "Unspecified error");
             break;
 
         case MBUS_ERROR_DATA_UNIMPLEMENTED_CI:
-            snprintf(buff, sizeof(buff), "Unimplemented CI-Field");
+            snprintf(buff, buff_size, "Unimplemented CI-Field");
             break;
 
         case MBUS_ERROR_DATA_BUFFER_TOO_LONG:
-            snprintf(buff, sizeof(buff), "Buffer too long, truncated");
+            snprintf(buff, buff_size, "Buffer too long, truncated");
             break;
 
         case MBUS_ERROR_DATA_TOO_MANY_RECORDS:
-            snprintf(buff, sizeof(buff), "Too many records");
+            snprintf(buff, buff_size, "Too many records");
             break;
 
         case MBUS_ERROR_DATA_PREMATURE_END:
-            snprintf(buff, sizeof(buff), "Premature end of record");
+            snprintf(buff, buff_size, "Premature end of record");
             break;
 
         case MBUS_ERROR_DATA_TOO_MANY_DIFES:
-            snprintf(buff, sizeof(buff), "More than 10 DIFE´s");
+            snprintf(buff, buff_size, "More than 10 DIFE´s");
             break;
 
         case MBUS_ERROR_DATA_TOO_MANY_VIFES:
-            snprintf(buff, sizeof(buff), "More than 10 VIFE´s");
+            snprintf(buff, buff_size, "More than 10 VIFE´s");
             break;
 
         case MBUS_ERROR_DATA_RESERVED:
-            snprintf(buff, sizeof(buff), "Reserved");
+            snprintf(buff, buff_size, "Reserved");
             break;
 
         case MBUS_ERROR_DATA_APPLICATION_BUSY:
-            snprintf(buff, sizeof(buff), "Application busy");
+            snprintf(buff, buff_size, "Application busy");
             break;
 
         case MBUS_ERROR_DATA_TOO_MANY_READOUTS:
-            snprintf(buff, sizeof(buff), "Too many readouts");
+            snprintf(buff, buff_size, "Too many readouts");
             break;
 
         default:
-            snprintf(buff, sizeof(buff), "Unknown error (0x%.2X)", error);
+            snprintf(buff, buff_size, "Unknown error (0x%.2X)", error);
             break;
     }
 
     return buff;
 }
 
+const char *
+mbus_data_error_lookup(int error)
+{
+    static char buff[256];
+
+    return mbus_data_error_lookup_r(error, buff, sizeof(buff));
+}
+
 static const char *
 mbus_unit_duration_nn(int nn)
 {
@@ -2499,9 +2838,9 @@ mbus_unit_duration_pp(int pp)
 }
 
 static const char *
-mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
+mbus_vib_unit_lookup_fb_r(mbus_value_information_block *vib, char *buff, size_t buff_size)
 {
-    static char buff[256];
+    char prefix_buff[32];
     int n;
     const char * prefix = "";
     switch (vib->vife[0] & MBUS_DIB_VIF_WITHOUT_EXTENSION)
@@ -2512,7 +2851,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
             n = 0x01 & vib->vife[0];
             if (n == 0)
                 prefix = "0.1 ";
-        snprintf(buff, sizeof(buff), "Energy (%sMWh)", prefix);
+        snprintf(buff, buff_size, "Energy (%sMWh)", prefix);
         break;
     case 0x2:
     case 0x2 + 1:
@@ -2522,7 +2861,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x4 + 2:
     case 0x4 + 3:
         // E000 01nn
-        snprintf(buff, sizeof(buff), "Reserved (0x%.2x)", vib->vife[0]);
+        snprintf(buff, buff_size, "Reserved (0x%.2x)", vib->vife[0]);
         break;
     case 0x8:
     case 0x8 + 1:
@@ -2530,7 +2869,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
         n = 0x01 & vib->vife[0];
         if (n == 0)
            prefix = "0.1 ";
-        snprintf(buff, sizeof(buff), "Energy (%sGJ)", prefix);
+        snprintf(buff, buff_size, "Energy (%sGJ)", prefix);
         break;
     case 0xA:
     case 0xA + 1:
@@ -2540,13 +2879,13 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0xC + 3:
         // E000 101n
         // E000 11nn
-        snprintf(buff, sizeof(buff), "Reserved (0x%.2x)", vib->vife[0]);
+        snprintf(buff, buff_size, "Reserved (0x%.2x)", vib->vife[0]);
         break;
     case 0x10:
     case 0x10 + 1:
         // E001 000n
         n = 0x01 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "Volume (%sm3)", mbus_unit_prefix(n+2));
+        snprintf(buff, buff_size, "Volume (%sm3)", mbus_unit_prefix_r(n+2, prefix_buff, sizeof(prefix_buff)));
         break;
     case 0x12:
     case 0x12 + 1:
@@ -2556,13 +2895,13 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x14 + 3:
         // E001 001n
         // E001 01nn
-        snprintf(buff, sizeof(buff), "Reserved (0x%.2x)", vib->vife[0]);
+        snprintf(buff, buff_size, "Reserved (0x%.2x)", vib->vife[0]);
         break;
     case 0x18:
     case 0x18 + 1:
         // E001 100n
         n = 0x01 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "Mass (%st)", mbus_unit_prefix(n+2));
+        snprintf(buff, buff_size, "Mass (%st)", mbus_unit_prefix_r(n+2, prefix_buff, sizeof(prefix_buff)));
         break;
     case 0x1A:
     case 0x1B:
@@ -2572,11 +2911,11 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x1F:
     case 0x20:
         // E001 1010 to E010 0000, Reserved
-        snprintf(buff, sizeof(buff), "Reserved (0x%.2x)", vib->vife[0]);
+        snprintf(buff, buff_size, "Reserved (0x%.2x)", vib->vife[0]);
         break;
     case 0x21:
         // E010 0001
-        snprintf(buff, sizeof(buff), "Volume (0.1 feet^3)");
+        snprintf(buff, buff_size, "Volume (0.1 feet^3)");
         break;
     case 0x22:
     case 0x23:
@@ -2585,24 +2924,24 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
         n = 0x01 & vib->vife[0];
         if (n == 0)
            prefix = "0.1 ";
-        snprintf(buff, sizeof(buff), "Volume (%samerican gallon)", prefix);
+        snprintf(buff, buff_size, "Volume (%samerican gallon)", prefix);
         break;
 
     case 0x24:
         // E010 0100
-        snprintf(buff, sizeof(buff), "Volume flow (0.001 american gallon/min)");
+        snprintf(buff, buff_size, "Volume flow (0.001 american gallon/min)");
         break;
     case 0x25:
         // E010 0101
-        snprintf(buff, sizeof(buff), "Volume flow (american gallon/min)");
+        snprintf(buff, buff_size, "Volume flow (american gallon/min)");
         break;
     case 0x26:
         // E010 0110
-        snprintf(buff, sizeof(buff), "Volume flow (american gallon/h)");
+        snprintf(buff, buff_size, "Volume flow (american gallon/h)");
         break;
     case 0x27:
         // E010 0111, Reserved
-        snprintf(buff, sizeof(buff), "Reserved (0x%.2x)", vib->vife[0]);
+        snprintf(buff, buff_size, "Reserved (0x%.2x)", vib->vife[0]);
         break;
     case 0x28:
     case 0x28 + 1:
@@ -2610,7 +2949,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
         n = 0x01 & vib->vife[0];
         if (n == 0)
            prefix = "0.1 ";
-        snprintf(buff, sizeof(buff), "Power (%sMW)", prefix);
+        snprintf(buff, buff_size, "Power (%sMW)", prefix);
         break;
     case 0x2A:
     case 0x2A + 1:
@@ -2620,7 +2959,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x2C + 3:
         // E010 101n, Reserved
         // E010 11nn, Reserved
-        snprintf(buff, sizeof(buff), "Reserved (0x%.2x)", vib->vife[0]);
+        snprintf(buff, buff_size, "Reserved (0x%.2x)", vib->vife[0]);
         break;
     case 0x30:
     case 0x30 + 1:
@@ -2628,7 +2967,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
         n = 0x01 & vib->vife[0];
         if (n == 0)
            prefix = "0.1 ";
-        snprintf(buff, sizeof(buff), "Power (%sGJ/h)", prefix);
+        snprintf(buff, buff_size, "Power (%sGJ/h)", prefix);
         break;
     case 0x32:
     case 0x33:
@@ -2669,7 +3008,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x56:
     case 0x57:
         // E011 0010 to E101 0111
-        snprintf(buff, sizeof(buff), "Reserved (0x%.2x)", vib->vife[0]);
+        snprintf(buff, buff_size, "Reserved (0x%.2x)", vib->vife[0]);
         break;
     case 0x58:
     case 0x58 + 1:
@@ -2677,7 +3016,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x58 + 3:
         // E101 10nn
         n = 0x03 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "Flow Temperature (%s degree F)", mbus_unit_prefix(n -3));
+        snprintf(buff, buff_size, "Flow Temperature (%s degree F)", mbus_unit_prefix_r(n -3, prefix_buff, sizeof(prefix_buff)));
         break;
     case 0x5C:
     case 0x5C + 1:
@@ -2685,7 +3024,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x5C + 3:
         // E101 11nn
         n = 0x03 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "Return Temperature (%s degree F)", mbus_unit_prefix(n -3));
+        snprintf(buff, buff_size, "Return Temperature (%s degree F)", mbus_unit_prefix_r(n -3, prefix_buff, sizeof(prefix_buff)));
         break;
     case 0x60:
     case 0x60 + 1:
@@ -2693,7 +3032,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x60 + 3:
         // E110 00nn
         n = 0x03 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "Temperature Difference (%s degree F)", mbus_unit_prefix(n -3));
+        snprintf(buff, buff_size, "Temperature Difference (%s degree F)", mbus_unit_prefix_r(n -3, prefix_buff, sizeof(prefix_buff)));
         break;
     case 0x64:
     case 0x64 + 1:
@@ -2701,7 +3040,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x64 + 3:
         // E110 01nn
         n = 0x03 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "External Temperature (%s degree F)", mbus_unit_prefix(n -3));
+        snprintf(buff, buff_size, "External Temperature (%s degree F)", mbus_unit_prefix_r(n -3, prefix_buff, sizeof(prefix_buff)));
         break;
     case 0x68:
     case 0x69:
@@ -2712,7 +3051,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x6E:
     case 0x6F:
         // E110 1nnn
-        snprintf(buff, sizeof(buff), "Reserved (0x%.2x)", vib->vife[0]);
+        snprintf(buff, buff_size, "Reserved (0x%.2x)", vib->vife[0]);
         break;
     case 0x70:
     case 0x70 + 1:
@@ -2720,7 +3059,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x70 + 3:
         // E111 00nn
         n = 0x03 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "Cold / Warm Temperature Limit (%s degree F)", mbus_unit_prefix(n -3));
+        snprintf(buff, buff_size, "Cold / Warm Temperature Limit (%s degree F)", mbus_unit_prefix_r(n -3, prefix_buff, sizeof(prefix_buff)));
         break;
     case 0x74:
     case 0x74 + 1:
@@ -2728,7 +3067,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x74 + 3:
         // E111 00nn
         n = 0x03 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "Cold / Warm Temperature Limit (%s degree C)", mbus_unit_prefix(n -3));
+        snprintf(buff, buff_size, "Cold / Warm Temperature Limit (%s degree C)", mbus_unit_prefix_r(n -3, prefix_buff, sizeof(prefix_buff)));
         break;
     case 0x78:
     case 0x78 + 1:
@@ -2740,19 +3079,19 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
     case 0x78 + 7:
         // E111 1nnn
         n = 0x07 & vib->vife[0];
-        snprintf(buff, sizeof(buff), "cumul. count max power (%s W)", mbus_unit_prefix(n - 3));
+        snprintf(buff, buff_size, "cumul. count max power (%s W)", mbus_unit_prefix_r(n - 3, prefix_buff, sizeof(prefix_buff)));
         break;
     default:
-        snprintf(buff, sizeof(buff), "Unrecognized VIF 0xFB extension: 0x%.2x", vib->vife[0]);
+        snprintf(buff, buff_size, "Unrecognized VIF 0xFB extension: 0x%.2x", vib->vife[0]);
         break;
     }
     return buff;
 }
 
 static const char *
-mbus_vib_unit_lookup_fd(mbus_value_information_block *vib)
+mbus_vib_unit_lookup_fd_r(mbus_value_information_block *vib, char *buff, size_t buff_size)
 {
-    static char buff[256];
+    char prefix_buff[32];
     int n;
 
     // ignore the extension bit in this selection
@@ -2762,294 +3101,294 @@ mbus_vib_unit_lookup_fd(mbus_value_information_block *vib)
     {
         // VIFE = E000 00nn	Credit of 10nn-3 of the nominal local legal currency units
         n = (masked_vife0 & 0x03);
-        snprintf(buff, sizeof(buff), "Credit of %s of the nominal local legal currency units", mbus_unit_prefix(n - 3));
+        snprintf(buff, buff_size, "Credit of %s of the nominal local legal currency units", mbus_unit_prefix_r(n - 3, prefix_buff, sizeof(prefix_buff)));
     }
     else if ((masked_vife0 & 0x7C) == 0x04)
     {
         // VIFE = E000 01nn Debit of 10nn-3 of the nominal local legal currency units
         n = (masked_vife0 & 0x03);
-        snprintf(buff, sizeof(buff), "Debit of %s of the nominal local legal currency units", mbus_unit_prefix(n - 3));
+        snprintf(buff, buff_size, "Debit of %s of the nominal local legal currency units", mbus_unit_prefix_r(n - 3, prefix_buff, sizeof(prefix_buff)));
     }
     else if (masked_vife0 == 0x08)
     {
         // E000 1000
-        snprintf(buff, sizeof(buff), "Access Number (transmission count)");
+        snprintf(buff, buff_size, "Access Number (transmission count)");
     }
     else if (masked_vife0 == 0x09)
     {
         // E000 1001
-        snprintf(buff, sizeof(buff), "Medium (as in fixed header)");
+        snprintf(buff, buff_size, "Medium (as in fixed header)");
     }
     else if (masked_vife0 == 0x0A)
     {
         // E000 1010
-        snprintf(buff, sizeof(buff), "Manufacturer (as in fixed header)");
+        snprintf(buff, buff_size, "Manufacturer (as in fixed header)");
     }
     else if (masked_vife0 == 0x0B)
     {
         // E000 1010
-        snprintf(buff, sizeof(buff), "Parameter set identification");
+        snprintf(buff, buff_size, "Parameter set identification");
     }
     else if (masked_vife0 == 0x0C)
     {
         // E000 1100
-        snprintf(buff, sizeof(buff), "Model / Version");
+        snprintf(buff, buff_size, "Model / Version");
     }
     else if (masked_vife0 == 0x0D)
     {
         // E000 1100
-        snprintf(buff, sizeof(buff), "Hardware version");
+        snprintf(buff, buff_size, "Hardware version");
     }
     else if (masked_vife0 == 0x0E)
     {
         // E000 1101
-        snprintf(buff, sizeof(buff), "Firmware version");
+        snprintf(buff, buff_size, "Firmware version");
     }
     else if (masked_vife0 == 0x0F)
     {
         // E000 1101
-        snprintf(buff, sizeof(buff), "Software version");
+        snprintf(buff, buff_size, "Software version");
     }
     else if (masked_vife0 == 0x10)
     {
         // VIFE = E001 0000 Customer location
-        snprintf(buff, sizeof(buff), "Customer location");
+        snprintf(buff, buff_size, "Customer location");
     }
     else if (masked_vife0 == 0x11)
     {
         // VIFE = E001 0001 Customer
-        snprintf(buff, sizeof(buff), "Customer");
+        snprintf(buff, buff_size, "Customer");
     }
     else if (masked_vife0 == 0x12)
     {
         // VIFE = E001 0010	Access Code User
-        snprintf(buff, sizeof(buff), "Access Code User");
+        snprintf(buff, buff_size, "Access Code User");
     }
     else if (masked_vife0 == 0x13)
     {
         // VIFE = E001 0011	Access Code Operator
-        snprintf(buff, sizeof(buff), "Access Code Operator");
+        snprintf(buff, buff_size, "Access Code Operator");
     }
     else if (masked_vife0 == 0x14)
     {
         // VIFE = E001 0100	Access Code System Operator
-        snprintf(buff, sizeof(buff), "Access Code System Operator");
+        snprintf(buff, buff_size, "Access Code System Operator");
     }
     else if (masked_vife0 == 0x15)
     {
         // VIFE = E001 0101	Access Code Developer
-        snprintf(buff, sizeof(buff), "Access Code Developer");
+        snprintf(buff, buff_size, "Access Code Developer");
     }
     else if (masked_vife0 == 0x16)
     {
         // VIFE = E001 0110 Password
-        snprintf(buff, sizeof(buff), "Password");
+        snprintf(buff, buff_size, "Password");
     }
     else if (masked_vife0 == 0x17)
     {
         // VIFE = E001 0111 Error flags
-        snprintf(buff, sizeof(buff), "Error flags");
+        snprintf(buff, buff_size, "Error flags");
     }
     else if (masked_vife0 == 0x18)
     {
         // VIFE = E001 1000	Error mask
-        snprintf(buff, sizeof(buff), "Error mask");
+        snprintf(buff, buff_size, "Error mask");
     }
     else if (masked_vife0 == 0x19)
     {
         // VIFE = E001 1001	Reserved
-        snprintf(buff, sizeof(buff), "Reserved");
+        snprintf(buff, buff_size, "Reserved");
     }
     else if (masked_vife0 == 0x1A)
     {
         // VIFE = E001 1010 Digital output (binary)
-        snprintf(buff, sizeof(buff), "Digital output (binary)");
+        snprintf(buff, buff_size, "Digital output (binary)");
     }
     else if (masked_vife0 == 0x1B)
     {
         // VIFE = E001 1011 Digital input (binary)
-        snprintf(buff, sizeof(buff), "Digital input (binary)");
+        snprintf(buff, buff_size, "Digital input (binary)");
     }
     else if (masked_vife0 == 0x1C)
     {
         // VIFE = E001 1100	Baudrate [Baud]
-        snprintf(buff, sizeof(buff), "Baudrate");
+        snprintf(buff, buff_size, "Baudrate");
     }
     else if (masked_vife0 == 0x1D)
     {
         // VIFE = E001 1101	response delay time [bittimes]
-        snprintf(buff, sizeof(buff), "response delay time");
+        snprintf(buff, buff_size, "response delay time");
     }
     else if (masked_vife0 == 0x1E)
     {
         // VIFE = E001 1110	Retry
-        snprintf(buff, sizeof(buff), "Retry");
+        snprintf(buff, buff_size, "Retry");
     }
     else if (masked_vife0 == 0x1F)
     {
         // VIFE = E001 1111	Reserved
-        snprintf(buff, sizeof(buff), "Reserved");
+        snprintf(buff, buff_size, "Reserved");
     }
     else if (masked_vife0 == 0x20)
     {
         // VIFE = E010 0000	First storage # for cyclic storage
-        snprintf(buff, sizeof(buff), "First storage # for cyclic storage");
+        snprintf(buff, buff_size, "First storage # for cyclic storage");
     }
     else if (masked_vife0 == 0x21)
     {
         // VIFE = E010 0001	Last storage # for cyclic storage
-        snprintf(buff, sizeof(buff), "Last storage # for cyclic storage");
+        snprintf(buff, buff_size, "Last storage # for cyclic storage");
     }
     else if (masked_vife0 == 0x22)
     {
         // VIFE = E010 0010	Size of storage block
-        snprintf(buff, sizeof(buff), "Size of storage block");
+        snprintf(buff, buff_size, "Size of storage block");
     }
     else if (masked_vife0 == 0x23)
     {
         // VIFE = E010 0011	Reserved
-        snprintf(buff, sizeof(buff), "Reserved");
+        snprintf(buff, buff_size, "Reserved");
     }
     else if ((masked_vife0 & 0x7C) == 0x24)
     {
         // VIFE = E010 01nn	Storage interval [sec(s)..day(s)]
         n = (masked_vife0 & 0x03);
-        snprintf(buff, sizeof(buff), "Storage interval %s", mbus_unit_duration_nn(n));
+        snprintf(buff, buff_size, "Storage interval %s", mbus_unit_duration_nn(n));
     }
     else if (masked_vife0 == 0x28)
     {
         // VIFE = E010 1000	Storage interval month(s)
-        snprintf(buff, sizeof(buff), "Storage interval month(s)");
+        snprintf(buff, buff_size, "Storage interval month(s)");
     }
     else if (masked_vife0 == 0x29)
     {
         // VIFE = E010 1001	Storage interval year(s)
-        snprintf(buff, sizeof(buff), "Storage interval year(s)");
+        snprintf(buff, buff_size, "Storage interval year(s)");
     }
     else if (masked_vife0 == 0x2A)
     {
         // VIFE = E010 1010	Reserved
-        snprintf(buff, sizeof(buff), "Reserved");
+        snprintf(buff, buff_size, "Reserved");
     }
     else if (masked_vife0 == 0x2B)
     {
         // VIFE = E010 1011	Reserved
-        snprintf(buff, sizeof(buff), "Reserved");
+        snprintf(buff, buff_size, "Reserved");
     }
     else if ((masked_vife0 & 0x7C) == 0x2C)
     {
         // VIFE = E010 11nn	Duration since last readout [sec(s)..day(s)]
         n = (masked_vife0 & 0x03);
-        snprintf(buff, sizeof(buff), "Duration since last readout %s", mbus_unit_duration_nn(n));
+        snprintf(buff, buff_size, "Duration since last readout %s", mbus_unit_duration_nn(n));
     }
     else if (masked_vife0 == 0x30)
     {
         // VIFE = E011 0000	Start (date/time) of tariff
-        snprintf(buff, sizeof(buff), "Start (date/time) of tariff");
+        snprintf(buff, buff_size, "Start (date/time) of tariff");
     }
     else if ((masked_vife0 & 0x7C) == 0x30)
     {
         // VIFE = E011 00nn	Duration of tariff (nn=01 ..11: min to days)
         n = (masked_vife0 & 0x03);
-        snprintf(buff, sizeof(buff), "Duration of tariff %s", mbus_unit_duration_nn(n));
+        snprintf(buff, buff_size, "Duration of tariff %s", mbus_unit_duration_nn(n));
     }
     else if ((masked_vife0 & 0x7C) == 0x34)
     {
         // VIFE = E011 01nn	Period of tariff [sec(s) to day(s)]
         n = (masked_vife0 & 0x03);
-        snprintf(buff, sizeof(buff), "Period of tariff %s", mbus_unit_duration_nn(n));
+        snprintf(buff, buff_size, "Period of tariff %s", mbus_unit_duration_nn(n));
     }
     else if (masked_vife0 == 0x38)
     {
         // VIFE = E011 1000	Period of tariff months(s)
-        snprintf(buff, sizeof(buff), "Period of tariff months(s)");
+        snprintf(buff, buff_size, "Period of tariff months(s)");
     }
     else if (masked_vife0 == 0x39)
     {
         // VIFE = E011 1001	Period of tariff year(s)
-        snprintf(buff, sizeof(buff), "Period of tariff year(s)");
+        snprintf(buff, buff_size, "Period of tariff year(s)");
     }
     else if (masked_vife0 == 0x3A)
     {
         // VIFE = E011 1010	dimensionless / no VIF
-        snprintf(buff, sizeof(buff), "dimensionless / no VIF");
+        snprintf(buff, buff_size, "dimensionless / no VIF");
     }
     else if (masked_vife0 == 0x3B)
     {
         // VIFE = E011 1011	Reserved
-        snprintf(buff, sizeof(buff), "Reserved");
+        snprintf(buff, buff_size, "Reserved");
     }
     else if ((masked_vife0 & 0x7C) == 0x3C)
     {
         // VIFE = E011 11xx	Reserved
-        snprintf(buff, sizeof(buff), "Reserved");
+        snprintf(buff, buff_size, "Reserved");
     }
     else if ((masked_vife0 & 0x70) == 0x40)
     {
         // VIFE = E100 nnnn 10^(nnnn-9) V
         n = (masked_vife0 & 0x0F);
-        snprintf(buff, sizeof(buff), "%s V", mbus_unit_prefix(n - 9));
+        snprintf(buff, buff_size, "%s V", mbus_unit_prefix_r(n - 9, prefix_buff, sizeof(prefix_buff)));
     }
     else if ((masked_vife0 & 0x70) == 0x50)
     {
         // VIFE = E101 nnnn 10nnnn-12 A
         n = (masked_vife0 & 0x0F);
-        snprintf(buff, sizeof(buff), "%s A", mbus_unit_prefix(n - 12));
+        snprintf(buff, buff_size, "%s A", mbus_unit_prefix_r(n - 12, prefix_buff, sizeof(prefix_buff)));
     }
     else if (masked_vife0 == 0x60) {
         // VIFE = E110 0000	Reset counter
-        snprintf(buff, sizeof(buff), "Reset counter");
+        snprintf(buff, buff_size, "Reset counter");
     }
     else if (masked_vife0 == 0x61) {
         // VIFE = E110 0001	Cumulation counter
-        snprintf(buff, sizeof(buff), "Cumulation counter");
+        snprintf(buff, buff_size, "Cumulation counter");
     }
     else if (masked_vife0 == 0x62) {
         // VIFE = E110 0010	Control signal
-        snprintf(buff, sizeof(buff), "Control signal");
+        snprintf(buff, buff_size, "Control signal");
     }
     else if (masked_vife0 == 0x63) {
         // VIFE = E110 0011	Day of week
-        snprintf(buff, sizeof(buff), "Day of week");
+        snprintf(buff, buff_size, "Day of week");
     }
     else if (masked_vife0 == 0x64) {
         // VIFE = E110 0100	Week number
-        snprintf(buff, sizeof(buff), "Week number");
+        snprintf(buff, buff_size, "Week number");
     }
     else if (masked_vife0 == 0x65) {
         // VIFE = E110 0101	Time point of day change
-        snprintf(buff, sizeof(buff), "Time point of day change");
+        snprintf(buff, buff_size, "Time point of day change");
     }
     else if (masked_vife0 == 0x66) {
         // VIFE = E110 0110	State of parameter activation
-        snprintf(buff, sizeof(buff), "State of parameter activation");
+        snprintf(buff, buff_size, "State of parameter activation");
     }
     else if (masked_vife0 == 0x67) {
         // VIFE = E110 0111	Special supplier information
-        snprintf(buff, sizeof(buff), "Special supplier information");
+        snprintf(buff, buff_size, "Special supplier information");
     }
     else if ((masked_vife0 & 0x7C) == 0x68) {
         // VIFE = E110 10pp	Duration since last cumulation [hour(s)..years(s)]Ž
         n = (masked_vife0 & 0x03);
-        snprintf(buff, sizeof(buff), "Duration since last cumulation %s", mbus_unit_duration_pp(n));
+        snprintf(buff, buff_size, "Duration since last cumulation %s", mbus_unit_duration_pp(n));
     }
     else if ((masked_vife0 & 0x7C) == 0x6C) {
         // VIFE = E110 11pp	Operating time battery [hour(s)..years(s)]Ž
         n = (masked_vife0 & 0x03);
-        snprintf(buff, sizeof(buff), "Operating time battery %s", mbus_unit_duration_pp(n));
+        snprintf(buff, buff_size, "Operating time battery %s", mbus_unit_duration_pp(n));
     }
     else if (masked_vife0 == 0x70) {
         // VIFE = E111 0000	Date and time of battery change
-        snprintf(buff, sizeof(buff), "Date and time of battery change");
+        snprintf(buff, buff_size, "Date and time of battery change");
     }
     else if ((masked_vife0 & 0x70) == 0x70)
     {
         // VIFE = E111 nnn Reserved
-        snprintf(buff, sizeof(buff), "Reserved VIF extension");
+        snprintf(buff, buff_size, "Reserved VIF extension");
     }
     else
     {
-        snprintf(buff, sizeof(buff), "Unrecognized VIF 0xFD extension: 0x%.2x", masked_vife0);
+        snprintf(buff, buff_size, "Unrecognized VIF 0xFD extension: 0x%.2x", masked_vife0);
     }
 
     return buff;
@@ -3069,47 +3408,60 @@ mbus_vib_unit_lookup_fd(mbus_value_information_block *vib)
 //    E000 1111      Software version #
 //------------------------------------------------------------------------------
 const char *
-mbus_vib_unit_lookup(mbus_value_information_block *vib)
+mbus_vib_unit_lookup_r(mbus_value_information_block *vib, char *buff, size_t buff_size)
 {
-    static char buff[256];
+    char prefix_buff[32];
     int n;
 
     if (vib == NULL)
-        return "";
+    {
+        buff[0] = '\0';
+        return buff;
+    }
 
     if (vib->vif == 0xFB) // first type of VIF extention: see table 8.4.4
     {
         if (vib->nvife == 0)
         {
-            return "Missing VIF extension";
+            snprintf(buff, buff_size, "Missing VIF extension");
+            return buff;
         }
 
-        return mbus_vib_unit_lookup_fb(vib);
+        return mbus_vib_unit_lookup_fb_r(vib, buff, buff_size);
     }
     else if (vib->vif == 0xFD) // first type of VIF extention: see table 8.4.4
     {
         if (vib->nvife == 0)
         {
-            return "Missing VIF extension";
+            snprintf(buff, buff_size, "Missing VIF extension");
+            return buff;
         }
 
-        return mbus_vib_unit_lookup_fd(vib);
+        return mbus_vib_unit_lookup_fd_r(vib, buff, buff_size);
     }
     else if (vib->vif == 0x7C)
     {
         // custom VIF
-        snprintf(buff, sizeof(buff), "%s", vib->custom_vif);
+        snprintf(buff, buff_size, "%s", vib->custom_vif);
         return buff;
     }
     else if (vib->vif == 0xFC && (vib->vife[0] & 0x78) == 0x70)
     {
         // custom VIF
         n = (vib->vife[0] & 0x07);
-        snprintf(buff, sizeof(buff), "%s %s", mbus_unit_prefix(n-6), vib->custom_vif);
+        snprintf(buff, buff_size, "%s %s", mbus_unit_prefix_r(n-6, prefix_buff, sizeof(prefix_buff)), vib->custom_vif);
         return buff;
     }
 
-    return mbus_vif_unit_lookup(vib->vif); // no extention, use VIF
+    return mbus_vif_unit_lookup_r(vib->vif, buff, buff_size); // no extention, use VIF
+}
+
+const char *
+mbus_vib_unit_lookup(mbus_value_information_block *vib)
+{
+    static char buff[256];
+
+    return mbus_vib_unit_lookup_r(vib, buff, sizeof(buff));
 }
 
 //------------------------------------------------------------------------------
@@ -3136,9 +3488,8 @@ mbus_vib_unit_lookup(mbus_value_information_block *vib)
 //
 //------------------------------------------------------------------------------
 const char *
-mbus_data_record_decode(mbus_data_record *record)
+mbus_data_record_decode_r(mbus_data_record *record, char *buff, size_t buff_size)
 {
-    static char buff[768];
     unsigned char vif, vife;
 
     if (record)
@@ -3164,7 +3515,7 @@ mbus_data_record_decode(mbus_data_record *record)
 
                 mbus_data_int_decode(record->data, 1, &int_val);
 
-                snprintf(buff, sizeof(buff), "%d", int_val);
+                snprintf(buff, buff_size, "%d", int_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 1 byte integer\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3178,7 +3529,7 @@ mbus_data_record_decode(mbus_data_record *record)
                 if (vif == 0x6C)
                 {
                     mbus_data_tm_decode(&time, record->data, 2);
-                    snprintf(buff, sizeof(buff), "%04d-%02d-%02d",
+                    snprintf(buff, buff_size, "%04d-%02d-%02d",
                                                  (time.tm_year + 1900),
                                                  (time.tm_mon + 1),
                                                   time.tm_mday);
@@ -3186,7 +3537,7 @@ mbus_data_record_decode(mbus_data_record *record)
                 else  // 2 byte integer
                 {
                     mbus_data_int_decode(record->data, 2, &int_val);
-                    snprintf(buff, sizeof(buff), "%d", int_val);
+                    snprintf(buff, buff_size, "%d", int_val);
                     if (debug)
                         printf("%s: DIF 0x%.2x was decoded using 2 byte integer\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
 
@@ -3198,7 +3549,7 @@ mbus_data_record_decode(mbus_data_record *record)
 
                 mbus_data_int_decode(record->data, 3, &int_val);
 
-                snprintf(buff, sizeof(buff), "%d", int_val);
+                snprintf(buff, buff_size, "%d", int_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 3 byte integer\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3215,7 +3566,7 @@ mbus_data_record_decode(mbus_data_record *record)
                     ((record->drh.vib.vif == 0xFD) && (vife == 0x70)))
                 {
                     mbus_data_tm_decode(&time, record->data, 4);
-                    snprintf(buff, sizeof(buff), "%04d-%02d-%02dT%02d:%02d:%02d",
+                    snprintf(buff, buff_size, "%04d-%02d-%02dT%02d:%02d:%02d",
                                                  (time.tm_year + 1900),
                                                  (time.tm_mon + 1),
                                                   time.tm_mday,
@@ -3226,7 +3577,7 @@ mbus_data_record_decode(mbus_data_record *record)
                 else  // 4 byte integer
                 {
                     mbus_data_int_decode(record->data, 4, &int_val);
-                    snprintf(buff, sizeof(buff), "%d", int_val);
+                    snprintf(buff, buff_size, "%d", int_val);
                 }
 
                 if (debug)
@@ -3238,7 +3589,7 @@ mbus_data_record_decode(mbus_data_record *record)
 
                 float_val = mbus_data_float_decode(record->data);
 
-                snprintf(buff, sizeof(buff), "%f", float_val);
+                snprintf(buff, buff_size, "%f", float_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 4 byte Real\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3255,7 +3606,7 @@ mbus_data_record_decode(mbus_data_record *record)
                     ((record->drh.vib.vif == 0xFD) && (vife == 0x70)))
                 {
                     mbus_data_tm_decode(&time, record->data, 6);
-                    snprintf(buff, sizeof(buff), "%04d-%02d-%02dT%02d:%02d:%02d",
+                    snprintf(buff, buff_size, "%04d-%02d-%02dT%02d:%02d:%02d",
                                                  (time.tm_year + 1900),
                                                  (time.tm_mon + 1),
                                                   time.tm_mday,
@@ -3266,7 +3617,7 @@ mbus_data_record_decode(mbus_data_record *record)
                 else  // 6 byte integer
                 {
                     mbus_data_long_long_decode(record->data, 6, &long_long_val);
-                    snprintf(buff, sizeof(buff), "%lld", long_long_val);
+                    snprintf(buff, buff_size, "%lld", long_long_val);
                 }
 
                 if (debug)
@@ -3278,7 +3629,7 @@ mbus_data_record_decode(mbus_data_record *record)
 
                 mbus_data_long_long_decode(record->data, 8, &long_long_val);
 
-                snprintf(buff, sizeof(buff), "%lld", long_long_val);
+                snprintf(buff, buff_size, "%lld", long_long_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 8 byte integer\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3290,7 +3641,7 @@ mbus_data_record_decode(mbus_data_record *record)
             case 0x09: // 2 digit BCD (8 bit)
 
                 int_val = (int)mbus_data_bcd_decode_hex(record->data, 1);
-                snprintf(buff, sizeof(buff), "%X", int_val);
+                snprintf(buff, buff_size, "%X", int_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 2 digit BCD\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3300,7 +3651,7 @@ mbus_data_record_decode(mbus_data_record *record)
             case 0x0A: // 4 digit BCD (16 bit)
 
                 int_val = (int)mbus_data_bcd_decode_hex(record->data, 2);
-                snprintf(buff, sizeof(buff), "%X", int_val);
+                snprintf(buff, buff_size, "%X", int_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 4 digit BCD\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3310,7 +3661,7 @@ mbus_data_record_decode(mbus_data_record *record)
             case 0x0B: // 6 digit BCD (24 bit)
 
                 int_val = (int)mbus_data_bcd_decode_hex(record->data, 3);
-                snprintf(buff, sizeof(buff), "%X", int_val);
+                snprintf(buff, buff_size, "%X", int_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 6 digit BCD\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3320,7 +3671,7 @@ mbus_data_record_decode(mbus_data_record *record)
             case 0x0C: // 8 digit BCD (32 bit)
 
                 int_val = (int)mbus_data_bcd_decode_hex(record->data, 4);
-                snprintf(buff, sizeof(buff), "%X", int_val);
+                snprintf(buff, buff_size, "%X", int_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 8 digit BCD\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3330,7 +3681,7 @@ mbus_data_record_decode(mbus_data_record *record)
             case 0x0E: // 12 digit BCD (48 bit)
 
                 long_long_val = mbus_data_bcd_decode_hex(record->data, 6);
-                snprintf(buff, sizeof(buff), "%llX", long_long_val);
+                snprintf(buff, buff_size, "%llX", long_long_val);
 
                 if (debug)
                     printf("%s: DIF 0x%.2x was decoded using 12 digit BCD\n", __PRETTY_FUNCTION__, record->drh.dib.dif);
@@ -3339,11 +3690,11 @@ mbus_data_record_decode(mbus_data_record *record)
 
             case 0x0F: // special functions
 
-                mbus_data_bin_decode(buff, record->data, record->data_len, sizeof(buff));
+                mbus_data_bin_decode(buff, record->data, record->data_len, buff_size);
                 break;
 
             case 0x0D: // variable length
-                if (record->data_len <= 0xBF)
+                if (record->data_len <= 0xBF && (size_t) record->data_len < buff_size)
                 {
                     mbus_data_str_decode(buff, record->data, record->data_len);
                     break;
@@ -3352,7 +3703,7 @@ mbus_data_record_decode(mbus_data_record *record)
 
             default:
 
-                snprintf(buff, sizeof(buff), "Unknown DIF (0x%.2x)", record->drh.dib.dif);
+                snprintf(buff, buff_size, "Unknown DIF (0x%.2x)", record->drh.dib.dif);
                 break;
         }
 
@@ -3361,17 +3712,23 @@ mbus_data_record_decode(mbus_data_record *record)
 
     return NULL;
 }
+
+const char *
+mbus_data_record_decode(mbus_data_record *record)
+{
+    static char buff[768];
+
+    return mbus_data_record_decode_r(record, buff, sizeof(buff));
+}
 //------------------------------------------------------------------------------
 /// Return the unit description for a variable-length data record
 //------------------------------------------------------------------------------
 const char *
-mbus_data_record_unit(mbus_data_record *record)
+mbus_data_record_unit_r(mbus_data_record *record, char *buff, size_t buff_size)
 {
-    static char buff[128];
-
     if (record)
     {
-        snprintf(buff, sizeof(buff), "%s", mbus_vib_unit_lookup(&(record->drh.vib)));
+        mbus_vib_unit_lookup_r(&(record->drh.vib), buff, buff_size);
 
         return buff;
     }
@@ -3379,17 +3736,23 @@ mbus_data_record_unit(mbus_data_record *record)
     return NULL;
 }
 
+const char *
+mbus_data_record_unit(mbus_data_record *record)
+{
+    static char buff[128];
+
+    return mbus_data_record_unit_r(record, buff, sizeof(buff));
+}
+
 //------------------------------------------------------------------------------
 /// Return the value for a variable-length data record
 //------------------------------------------------------------------------------
 const char *
-mbus_data_record_value(mbus_data_record *record)
+mbus_data_record_value_r(mbus_data_record *record, char *buff, size_t buff_size)
 {
-    static char buff[768];
-
     if (record)
     {
-        snprintf(buff, sizeof(buff), "%s", mbus_data_record_decode(record));
+        mbus_data_record_decode_r(record, buff, buff_size);
 
         return buff;
     }
@@ -3397,27 +3760,83 @@ mbus_data_record_value(mbus_data_record *record)
     return NULL;
 }
 
+const char *
+mbus_data_record_value(mbus_data_record *record)
+{
+    static char buff[768];
+
+    return mbus_data_record_value_r(record, buff, sizeof(buff));
+}
+
 //------------------------------------------------------------------------------
-/// Return the storage number for a variable-length data record
+// Storage number, tariff and device unit from the DIF and DIFE bytes of a
+// record, shared by the record struct and the record view functions.
 //------------------------------------------------------------------------------
-long mbus_data_record_storage_number(mbus_data_record *record)
+static long
+mbus_dib_storage_number(unsigned char dif, const unsigned char *dife, size_t ndife)
 {
     int bit_index = 0;
     long result = 0;
-    int i;
+    size_t i;
 
-    if (record)
+    result |= (dif & MBUS_DATA_RECORD_DIF_MASK_STORAGE_NO) >> 6;
+    bit_index++;
+
+    for (i=0; i<ndife; i++)
+    {
+        result |= (dife[i] & MBUS_DATA_RECORD_DIFE_MASK_STORAGE_NO) << bit_index;
+        bit_index += 4;
+    }
+
+    return result;
+}
+
+static long
+mbus_dib_tariff(const unsigned char *dife, size_t ndife)
+{
+    int bit_index = 0;
+    long result = 0;
+    size_t i;
+
+    if (ndife == 0)
+        return -1;
+
+    for (i=0; i<ndife; i++)
+    {
+        result |= ((dife[i] & MBUS_DATA_RECORD_DIFE_MASK_TARIFF) >> 4) << bit_index;
+        bit_index += 2;
+    }
+
+    return result;
+}
+
+static int
+mbus_dib_device(const unsigned char *dife, size_t ndife)
+{
+    int bit_index = 0;
+    int result = 0;
+    size_t i;
+
+    if (ndife == 0)
+        return -1;
+
+    for (i=0; i<ndife; i++)
     {
-        result |= (record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_STORAGE_NO) >> 6;
+        result |= ((dife[i] & MBUS_DATA_RECORD_DIFE_MASK_DEVICE) >> 6) << bit_index;
         bit_index++;
+    }
 
-        for (i=0; i<record->drh.dib.ndife; i++)
-        {
-            result |= (record->drh.dib.dife[i] & MBUS_DATA_RECORD_DIFE_MASK_STORAGE_NO) << bit_index;
-            bit_index += 4;
-        }
+    return result;
+}
 
-        return result;
+//------------------------------------------------------------------------------
+/// Return the storage number for a variable-length data record
+//------------------------------------------------------------------------------
+long mbus_data_record_storage_number(mbus_data_record *record)
+{
+    if (record)
+    {
+        return mbus_dib_storage_number(record->drh.dib.dif, record->drh.dib.dife, record->drh.dib.ndife);
     }
 
     return -1;
@@ -3428,19 +3847,9 @@ long mbus_data_record_storage_number(mbus_data_record *record)
 //------------------------------------------------------------------------------
 long mbus_data_record_tariff(mbus_data_record *record)
 {
-    int bit_index = 0;
-    long result = 0;
-    int i;
-
-    if (record && (record->drh.dib.ndife > 0))
+    if (record)
     {
-        for (i=0; i<record->drh.dib.ndife; i++)
-        {
-            result |= ((record->drh.dib.dife[i] & MBUS_DATA_RECORD_DIFE_MASK_TARIFF) >> 4) << bit_index;
-            bit_index += 2;
-        }
-
-        return result;
+        return mbus_dib_tariff(record->drh.dib.dife, record->drh.dib.ndife);
     }
 
     return -1;
@@ -3451,19 +3860,9 @@ long mbus_data_record_tariff(mbus_data_record *record)
 //------------------------------------------------------------------------------
 int mbus_data_record_device(mbus_data_record *record)
 {
-    int bit_index = 0;
-    int result = 0;
-    int i;
-
-    if (record && (record->drh.dib.ndife > 0))
+    if (record)
     {
-        for (i=0; i<record->drh.dib.ndife; i++)
-        {
-            result |= ((record->drh.dib.dife[i] & MBUS_DATA_RECORD_DIFE_MASK_DEVICE) >> 6) << bit_index;
-            bit_index++;
-        }
-
-        return result;
+        return mbus_dib_device(record->drh.dib.dife, record->drh.dib.ndife);
     }
 
     return -1;
@@ -3475,33 +3874,25 @@ int mbus_data_record_device(mbus_data_record *record)
 const char *
 mbus_data_record_function(mbus_data_record *record)
 {
-    static char buff[128];
-
     if (record)
     {
         switch (record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_FUNCTION)
         {
             case 0x00:
-                snprintf(buff, sizeof(buff), "Instantaneous value");
-                break;
+                return "Instantaneous value";
 
             case 0x10:
-                snprintf(buff, sizeof(buff), "Maximum value");
-                break;
+                return "Maximum value";
 
             case 0x20:
-                snprintf(buff, sizeof(buff), "Minimum value");
-                break;
+                return "Minimum value";
 
             case 0x30:
-                snprintf(buff, sizeof(buff), "Value during error state");
-                break;
+                return "Value during error state";
 
             default:
-                snprintf(buff, sizeof(buff), "unknown");
+                return "unknown";
         }
-
-        return buff;
     }
 
     return NULL;
@@ -3514,13 +3905,8 @@ mbus_data_record_function(mbus_data_record *record)
 const char *
 mbus_data_fixed_function(int status)
 {
-    static char buff[128];
-
-    snprintf(buff, sizeof(buff), "%s",
-            (status & MBUS_DATA_FIXED_STATUS_DATE_MASK) == MBUS_DATA_FIXED_STATUS_DATE_STORED ?
-            "Stored value" : "Actual value" );
-
-    return buff;
+    return (status & MBUS_DATA_FIXED_STATUS_DATE_MASK) == MBUS_DATA_FIXED_STATUS_DATE_STORED ?
+           "Stored value" : "Actual value";
 }
 
 //------------------------------------------------------------------------------
@@ -3694,802 +4080,2682 @@ mbus_parse(mbus_frame *frame, unsigned char *data, size_t data_size)
 
 
 //------------------------------------------------------------------------------
-/// Parse the fixed-length data of a M-Bus frame
+/// Initialize an incremental frame parser. frame_event is only used by
+/// mbus_frame_parser_feed and may be NULL.
 //------------------------------------------------------------------------------
-int
-mbus_data_fixed_parse(mbus_frame *frame, mbus_data_fixed *data)
+void
+mbus_frame_parser_init(mbus_frame_parser *parser,
+                       void (*frame_event)(mbus_frame_parser *parser, mbus_frame *frame,
+                                           const unsigned char *data, size_t data_len),
+                       void *userdata)
 {
-    if (frame && data)
+    if (parser)
     {
-        if (frame->data_size != MBUS_DATA_FIXED_LENGTH)
-        {
-            snprintf(error_str, sizeof(error_str), "Invalid length for fixed data.");
-            return -1;
-        }
+        parser->start = 0;
+        parser->len = 0;
+        parser->nframes = 0;
+        parser->nerrors = 0;
+        parser->frame_event = frame_event;
+        parser->userdata = userdata;
+    }
+}
 
-        // copy the fixed-length data structure bytewise
-        data->id_bcd[0]   = frame->data[0];
-        data->id_bcd[1]   = frame->data[1];
-        data->id_bcd[2]   = frame->data[2];
-        data->id_bcd[3]   = frame->data[3];
-        data->tx_cnt      = frame->data[4];
-        data->status      = frame->data[5];
-        data->cnt1_type   = frame->data[6];
-        data->cnt2_type   = frame->data[7];
-        data->cnt1_val[0] = frame->data[8];
-        data->cnt1_val[1] = frame->data[9];
-        data->cnt1_val[2] = frame->data[10];
-        data->cnt1_val[3] = frame->data[11];
-        data->cnt2_val[0] = frame->data[12];
-        data->cnt2_val[1] = frame->data[13];
-        data->cnt2_val[2] = frame->data[14];
-        data->cnt2_val[3] = frame->data[15];
+//------------------------------------------------------------------------------
+/// Drop all buffered data
+//------------------------------------------------------------------------------
+void
+mbus_frame_parser_reset(mbus_frame_parser *parser)
+{
+    if (parser)
+    {
+        parser->start = 0;
+        parser->len = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Number of buffered bytes that have not been consumed yet
+//------------------------------------------------------------------------------
+size_t
+mbus_frame_parser_pending(const mbus_frame_parser *parser)
+{
+    return parser ? parser->len - parser->start : 0;
+}
 
+//------------------------------------------------------------------------------
+/// Number of bytes that are at least needed to complete the next frame.
+//------------------------------------------------------------------------------
+size_t
+mbus_frame_parser_needed(const mbus_frame_parser *parser)
+{
+    const unsigned char *data;
+    size_t avail, size;
+
+    if (parser == NULL)
         return 0;
+
+    avail = parser->len - parser->start;
+    data = &(parser->buff[parser->start]);
+
+    if (avail == 0)
+        return 1;
+
+    switch (data[0])
+    {
+        case MBUS_FRAME_SHORT_START:
+            size = MBUS_FRAME_BASE_SIZE_SHORT;
+            break;
+
+        case MBUS_FRAME_LONG_START:
+            size = (avail < 3) ? 3 : (size_t)(MBUS_FRAME_FIXED_SIZE_LONG + data[1]);
+            break;
+
+        default:
+            // ACK, or garbage that is discarded by the next call to
+            // mbus_frame_parser_next
+            return 0;
     }
 
-    return -1;
+    return (avail < size) ? size - avail : 0;
 }
 
-
 //------------------------------------------------------------------------------
-/// Parse the variable-length data of a M-Bus frame
+/// Append received data to the parser buffer. Returns the number of bytes
+/// taken, which is less than data_size only when the buffer is full.
 //------------------------------------------------------------------------------
-int
-mbus_data_variable_parse(mbus_frame *frame, mbus_data_variable *data)
+size_t
+mbus_frame_parser_append(mbus_frame_parser *parser, const unsigned char *data, size_t data_size)
 {
-    mbus_data_record *record = NULL;
-    size_t i, j;
+    size_t n;
 
-    if (frame && data)
+    if (parser == NULL || data == NULL)
+        return 0;
+
+    if (parser->start > 0 && parser->len + data_size > sizeof(parser->buff))
     {
-        // parse header
-        data->nrecords = 0;
-        data->more_records_follow = 0;
-        i = MBUS_DATA_VARIABLE_HEADER_LENGTH;
+        // move the unconsumed bytes to the front of the buffer
+        memmove(parser->buff, &(parser->buff[parser->start]), parser->len - parser->start);
+        parser->len -= parser->start;
+        parser->start = 0;
+    }
 
-        if(frame->data_size < i)
-        {
-            snprintf(error_str, sizeof(error_str), "Variable header too short.");
-            return -1;
-        }
+    n = sizeof(parser->buff) - parser->len;
+    if (n > data_size)
+        n = data_size;
 
-        // first copy the variable data fixed header bytewise
-        data->header.id_bcd[0]       = frame->data[0];
-        data->header.id_bcd[1]       = frame->data[1];
-        data->header.id_bcd[2]       = frame->data[2];
-        data->header.id_bcd[3]       = frame->data[3];
-        data->header.manufacturer[0] = frame->data[4];
-        data->header.manufacturer[1] = frame->data[5];
-        data->header.version         = frame->data[6];
-        data->header.medium          = frame->data[7];
-        data->header.access_no       = frame->data[8];
-        data->header.status          = frame->data[9];
-        data->header.signature[0]    = frame->data[10];
-        data->header.signature[1]    = frame->data[11];
-
-        data->record = NULL;
-
-        while (i < frame->data_size)
-        {
-            // Skip filler dif=2F
-            if ((frame->data[i] & 0xFF) == MBUS_DIB_DIF_IDLE_FILLER)
-            {
-              i++;
-              continue;
-            }
-
-            if ((record = mbus_data_record_new()) == NULL)
-            {
-                // clean up...
-                return (-2);
-            }
-
-            // copy timestamp
-            memcpy((void *)&(record->timestamp), (void *)&(frame->timestamp), sizeof(time_t));
+    memcpy(&(parser->buff[parser->len]), data, n);
+    parser->len += n;
 
-            // read and parse DIB (= DIF + DIFE)
-
-            // DIF
-            record->drh.dib.dif = frame->data[i];
-
-            if ((record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) ||
-                (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW))
-            {
-                if ((record->drh.dib.dif & 0xFF) == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
-                {
-                  data->more_records_follow = 1;
-                }
+    return n;
+}
 
-                i++;
-                // just copy the remaining data as it is vendor specific
-                record->data_len = frame->data_size - i;
-                for (j = 0; j < record->data_len; j++)
-                {
-                    record->data[j] = frame->data[i++];
-                }
+//------------------------------------------------------------------------------
+/// Extract the next frame from the buffered data. Returns 1 when a frame was
+/// parsed, 0 when more data is needed, or the (negative) mbus_parse error
+/// when invalid data was discarded. data/data_len are set to the raw bytes
+/// of the frame or the discarded bytes; they are valid until the next append.
+//------------------------------------------------------------------------------
+int
+mbus_frame_parser_next(mbus_frame_parser *parser, mbus_frame *frame, const unsigned char **data, size_t *data_len)
+{
+    unsigned char *buff;
+    size_t avail, size, discard;
+    int result;
 
-                // append the record and move on to next one
-                mbus_data_record_append(data, record);
-                data->nrecords++;
-                continue;
-            }
+    if (parser == NULL || frame == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to parser or frame.");
+        return -1;
+    }
 
-            // calculate length of data record
-            record->data_len = mbus_dif_datalength_lookup(record->drh.dib.dif);
+    avail = parser->len - parser->start;
+    buff = &(parser->buff[parser->start]);
 
-            // read DIF extensions
-            record->drh.dib.ndife = 0;
-            while ((i < frame->data_size) &&
-                   (frame->data[i] & MBUS_DIB_DIF_EXTENSION_BIT))
-            {
-                unsigned char dife;
+    if (avail == 0)
+    {
+        parser->start = parser->len = 0;
+        return 0;
+    }
 
-                if (record->drh.dib.ndife >= MBUS_DATA_INFO_BLOCK_DIFE_SIZE)
-                {
-                    mbus_data_record_free(record);
-                    snprintf(error_str, sizeof(error_str), "Too many DIFE.");
-                    return -1;
-                }
+    switch (buff[0])
+    {
+        case MBUS_FRAME_ACK_START:
+            size = MBUS_FRAME_BASE_SIZE_ACK;
+            break;
 
-                dife = frame->data[i+1];
-                record->drh.dib.dife[record->drh.dib.ndife] = dife;
+        case MBUS_FRAME_SHORT_START:
+            size = MBUS_FRAME_BASE_SIZE_SHORT;
+            break;
 
-                record->drh.dib.ndife++;
-                i++;
-            }
-            i++;
+        case MBUS_FRAME_LONG_START:
+            if (avail < 3)
+                return 0;
 
-            if (i > frame->data_size)
-            {
-                mbus_data_record_free(record);
-                snprintf(error_str, sizeof(error_str), "Premature end of record at DIF.");
-                return -1;
-            }
+            // let mbus_parse report an invalid length
+            size = (buff[1] < 3 || buff[1] != buff[2]) ? 3 : (size_t)(MBUS_FRAME_FIXED_SIZE_LONG + buff[1]);
+            break;
 
-            // read and parse VIB (= VIF + VIFE)
+        default:
+            size = 1;
+            break;
+    }
 
-            // VIF
-            record->drh.vib.vif = frame->data[i++];
+    if (avail < size)
+        return 0;
 
-            if ((record->drh.vib.vif & MBUS_DIB_VIF_WITHOUT_EXTENSION) == 0x7C)
-            {
-                // variable length VIF in ASCII format
-                int var_vif_len;
-                var_vif_len = frame->data[i++];
-                if (var_vif_len > MBUS_VALUE_INFO_BLOCK_CUSTOM_VIF_SIZE)
-                {
-                    mbus_data_record_free(record);
-                    snprintf(error_str, sizeof(error_str), "Too long variable length VIF.");
-                    return -1;
-                }
+    result = mbus_parse(frame, buff, size);
 
-                if (i + var_vif_len > frame->data_size)
-                {
-                    mbus_data_record_free(record);
-                    snprintf(error_str, sizeof(error_str), "Premature end of record at variable length VIF.");
-                    return -1;
-                }
-                mbus_data_str_decode(record->drh.vib.custom_vif, &(frame->data[i]), var_vif_len);
-                i += var_vif_len;
-            }
+    if (result == 0)
+    {
+        discard = size;
+        parser->nframes++;
+    }
+    else
+    {
+        // skip a complete frame that failed verification, otherwise resync
+        // at the next byte
+        discard = (result == -3) ? size : 1;
+        parser->nerrors++;
+        result = (result > 0) ? -2 : result;
+    }
 
-            // VIFE
-            record->drh.vib.nvife = 0;
+    if (data)
+        *data = buff;
 
-            if (record->drh.vib.vif & MBUS_DIB_VIF_EXTENSION_BIT)
-            {
-                record->drh.vib.vife[0] = frame->data[i];
-                record->drh.vib.nvife++;
+    if (data_len)
+        *data_len = discard;
 
-                while ((i < frame->data_size) &&
-                       (frame->data[i] & MBUS_DIB_VIF_EXTENSION_BIT))
-                {
-                    unsigned char vife;
+    parser->start += discard;
 
-                    if (record->drh.vib.nvife >= MBUS_VALUE_INFO_BLOCK_VIFE_SIZE)
-                    {
-                        mbus_data_record_free(record);
-                        snprintf(error_str, sizeof(error_str), "Too many VIFE.");
-                        return -1;
-                    }
+    return (result == 0) ? 1 : result;
+}
 
-                    vife = frame->data[i+1];
-                    record->drh.vib.vife[record->drh.vib.nvife] = vife;
+//------------------------------------------------------------------------------
+/// Feed received data to the parser and call its frame_event for every
+/// complete frame. Invalid data is discarded. Returns the number of frames
+/// found.
+//------------------------------------------------------------------------------
+int
+mbus_frame_parser_feed(mbus_frame_parser *parser, const unsigned char *data, size_t data_size)
+{
+    mbus_frame frame;
+    const unsigned char *raw;
+    size_t n, raw_len;
+    int result, nframes = 0;
 
-                    record->drh.vib.nvife++;
-                    i++;
-                }
-                i++;
-            }
+    if (parser == NULL || data == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to parser or data.");
+        return -1;
+    }
 
-            if (i > frame->data_size)
-            {
-                mbus_data_record_free(record);
-                snprintf(error_str, sizeof(error_str), "Premature end of record at VIF.");
-                return -1;
-            }
+    do
+    {
+        n = mbus_frame_parser_append(parser, data, data_size);
+        data += n;
+        data_size -= n;
 
-            // re-calculate data length, if of variable length type
-            if ((record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_DATA) == 0x0D) // flag for variable length data
+        while ((result = mbus_frame_parser_next(parser, &frame, &raw, &raw_len)) != 0)
+        {
+            if (result == 1)
             {
-                if(frame->data[i] <= 0xBF)
-                    record->data_len = frame->data[i++];
-                else if(frame->data[i] >= 0xC0 && frame->data[i] <= 0xCF)
-                    record->data_len = (frame->data[i++] - 0xC0) * 2;
-                else if(frame->data[i] >= 0xD0 && frame->data[i] <= 0xDF)
-                    record->data_len = (frame->data[i++] - 0xD0) * 2;
-                else if(frame->data[i] >= 0xE0 && frame->data[i] <= 0xEF)
-                    record->data_len = frame->data[i++] - 0xE0;
-                else if(frame->data[i] >= 0xF0 && frame->data[i] <= 0xFA)
-                    record->data_len = frame->data[i++] - 0xF0;
-            }
+                nframes++;
 
-            if (i + record->data_len > frame->data_size)
-            {
-                mbus_data_record_free(record);
-                snprintf(error_str, sizeof(error_str), "Premature end of record at data.");
-                return -1;
+                if (parser->frame_event)
+                    parser->frame_event(parser, &frame, raw, raw_len);
             }
+        }
+    } while (data_size > 0);
 
-            // copy data
-            for (j = 0; j < record->data_len; j++)
-            {
-                record->data[j] = frame->data[i++];
-            }
+    return nframes;
+}
 
-            // append the record and move on to next one
-            mbus_data_record_append(data, record);
-            data->nrecords++;
+//------------------------------------------------------------------------------
+/// Parse the fixed-length data of a M-Bus frame
+//------------------------------------------------------------------------------
+int
+mbus_data_fixed_parse(mbus_frame *frame, mbus_data_fixed *data)
+{
+    if (frame && data)
+    {
+        if (frame->data_size != MBUS_DATA_FIXED_LENGTH)
+        {
+            snprintf(error_str, sizeof(error_str), "Invalid length for fixed data.");
+            return -1;
         }
 
+        // copy the fixed-length data structure bytewise
+        data->id_bcd[0]   = frame->data[0];
+        data->id_bcd[1]   = frame->data[1];
+        data->id_bcd[2]   = frame->data[2];
+        data->id_bcd[3]   = frame->data[3];
+        data->tx_cnt      = frame->data[4];
+        data->status      = frame->data[5];
+        data->cnt1_type   = frame->data[6];
+        data->cnt2_type   = frame->data[7];
+        data->cnt1_val[0] = frame->data[8];
+        data->cnt1_val[1] = frame->data[9];
+        data->cnt1_val[2] = frame->data[10];
+        data->cnt1_val[3] = frame->data[11];
+        data->cnt2_val[0] = frame->data[12];
+        data->cnt2_val[1] = frame->data[13];
+        data->cnt2_val[2] = frame->data[14];
+        data->cnt2_val[3] = frame->data[15];
+
         return 0;
     }
 
     return -1;
 }
 
+
 //------------------------------------------------------------------------------
-/// Check the stype of the frame data (error, fixed or variable) and dispatch to the
-/// corresponding parser function.
+// Locate the next data record in the user data of a variable-length frame,
+// starting at *pos (which must not point to an idle filler). On success *pos
+// is advanced past the record.
 //------------------------------------------------------------------------------
-int
-mbus_frame_data_parse(mbus_frame *frame, mbus_frame_data *data)
+static int
+mbus_data_record_slice(const unsigned char *data, size_t data_size, size_t *pos, mbus_record_view *rv)
 {
-    char direction;
+    size_t i = *pos;
+    size_t var_vif_len;
 
-    if (frame == NULL)
+    memset(rv, 0, sizeof(mbus_record_view));
+
+    // DIF
+    rv->offset = i;
+    rv->dif = data[i];
+
+    if ((rv->dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) ||
+        (rv->dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW))
     {
-        snprintf(error_str, sizeof(error_str), "Got null pointer to frame.");
+        // the remaining data is vendor specific
+        i++;
+        rv->data_offset = i;
+        rv->data_len = data_size - i;
+        *pos = data_size;
+        return 0;
+    }
+
+    // calculate length of data record
+    rv->data_len = mbus_dif_datalength_lookup(rv->dif);
+
+    // DIF extensions
+    rv->dife_offset = i + 1;
+    while ((i < data_size) && (data[i] & MBUS_DIB_DIF_EXTENSION_BIT))
+    {
+        if (rv->ndife >= MBUS_DATA_INFO_BLOCK_DIFE_SIZE)
+        {
+            snprintf(error_str, sizeof(error_str), "Too many DIFE.");
+            return -1;
+        }
+
+        rv->ndife++;
+        i++;
+    }
+    i++;
+
+    if (i > data_size)
+    {
+        snprintf(error_str, sizeof(error_str), "Premature end of record at DIF.");
         return -1;
     }
 
-    if (data == NULL)
+    // VIF
+    if (i >= data_size)
     {
-        snprintf(error_str, sizeof(error_str), "Got null pointer to data.");
+        snprintf(error_str, sizeof(error_str), "Premature end of record at VIF.");
         return -1;
     }
 
-    direction = (frame->control & MBUS_CONTROL_MASK_DIR);
+    rv->vif = data[i++];
 
-    if (direction == MBUS_CONTROL_MASK_DIR_S2M)
+    if ((rv->vif & MBUS_DIB_VIF_WITHOUT_EXTENSION) == 0x7C)
     {
-        if (frame->control_information == MBUS_CONTROL_INFO_ERROR_GENERAL)
+        // variable length VIF in ASCII format
+        if (i >= data_size)
         {
-            data->type = MBUS_DATA_TYPE_ERROR;
-
-            if (frame->data_size > 0)
-            {
-                data->error = (int) frame->data[0];
-            }
-            else
-            {
-                data->error = 0;
-            }
+            snprintf(error_str, sizeof(error_str), "Premature end of record at variable length VIF.");
+            return -1;
+        }
 
-            return 0;
+        var_vif_len = data[i++];
+        if (var_vif_len > MBUS_VALUE_INFO_BLOCK_CUSTOM_VIF_SIZE)
+        {
+            snprintf(error_str, sizeof(error_str), "Too long variable length VIF.");
+            return -1;
         }
-        else if (frame->control_information == MBUS_CONTROL_INFO_RESP_FIXED)
+
+        if (i + var_vif_len > data_size)
         {
-            if (frame->data_size == 0)
-            {
-                snprintf(error_str, sizeof(error_str), "Got zero data_size.");
+            snprintf(error_str, sizeof(error_str), "Premature end of record at variable length VIF.");
+            return -1;
+        }
 
-                return -1;
-            }
+        rv->custom_vif_offset = i;
+        rv->custom_vif_len = var_vif_len;
+        i += var_vif_len;
+    }
 
-            data->type = MBUS_DATA_TYPE_FIXED;
-            return mbus_data_fixed_parse(frame, &(data->data_fix));
+    // VIF extensions
+    if (rv->vif & MBUS_DIB_VIF_EXTENSION_BIT)
+    {
+        if (i >= data_size)
+        {
+            snprintf(error_str, sizeof(error_str), "Premature end of record at VIF.");
+            return -1;
         }
-        else if (frame->control_information == MBUS_CONTROL_INFO_RESP_VARIABLE)
+
+        rv->vife_offset = i;
+        rv->nvife = 1;
+
+        while ((i < data_size) && (data[i] & MBUS_DIB_VIF_EXTENSION_BIT))
         {
-            if (frame->data_size == 0)
+            if (rv->nvife >= MBUS_VALUE_INFO_BLOCK_VIFE_SIZE)
             {
-                snprintf(error_str, sizeof(error_str), "Got zero data_size.");
-
+                snprintf(error_str, sizeof(error_str), "Too many VIFE.");
                 return -1;
             }
 
-            data->type = MBUS_DATA_TYPE_VARIABLE;
-            return mbus_data_variable_parse(frame, &(data->data_var));
+            rv->nvife++;
+            i++;
         }
-        else
-        {
-            snprintf(error_str, sizeof(error_str), "Unknown control information 0x%.2x", frame->control_information);
+        i++;
+    }
+
+    if (i > data_size)
+    {
+        snprintf(error_str, sizeof(error_str), "Premature end of record at VIF.");
+        return -1;
+    }
 
+    // re-calculate data length, if of variable length type
+    if ((rv->dif & MBUS_DATA_RECORD_DIF_MASK_DATA) == 0x0D) // flag for variable length data
+    {
+        if (i >= data_size)
+        {
+            snprintf(error_str, sizeof(error_str), "Premature end of record at data.");
             return -1;
         }
+
+        if(data[i] <= 0xBF)
+            rv->data_len = data[i++];
+        else if(data[i] >= 0xC0 && data[i] <= 0xCF)
+            rv->data_len = (data[i++] - 0xC0) * 2;
+        else if(data[i] >= 0xD0 && data[i] <= 0xDF)
+            rv->data_len = (data[i++] - 0xD0) * 2;
+        else if(data[i] >= 0xE0 && data[i] <= 0xEF)
+            rv->data_len = data[i++] - 0xE0;
+        else if(data[i] >= 0xF0 && data[i] <= 0xFA)
+            rv->data_len = data[i++] - 0xF0;
     }
 
-    snprintf(error_str, sizeof(error_str), "Wrong direction in frame (master to slave)");
+    if (i + rv->data_len > data_size)
+    {
+        snprintf(error_str, sizeof(error_str), "Premature end of record at data.");
+        return -1;
+    }
 
-    return -1;
+    rv->data_offset = i;
+    *pos = i + rv->data_len;
+
+    return 0;
 }
 
 //------------------------------------------------------------------------------
-/// Pack the M-bus frame into a binary string representation that can be sent
-/// on the bus. The binary packet format is different for the different types
-/// of M-bus frames.
+// Copy a data record located by mbus_data_record_slice into a record struct
 //------------------------------------------------------------------------------
-int
-mbus_frame_pack(mbus_frame *frame, unsigned char *data, size_t data_size)
+static void
+mbus_data_record_copy_slice(mbus_data_record *record, const unsigned char *data, const mbus_record_view *rv)
 {
-    size_t i, offset = 0;
+    record->drh.dib.dif   = rv->dif;
+    record->drh.dib.ndife = rv->ndife;
+    memcpy(record->drh.dib.dife, &data[rv->dife_offset], rv->ndife);
 
-    if (frame && data)
-    {
-        if (mbus_frame_calc_length(frame) == -1)
-        {
-            return -2;
-        }
+    record->drh.vib.vif   = rv->vif;
+    record->drh.vib.nvife = rv->nvife;
+    memcpy(record->drh.vib.vife, &data[rv->vife_offset], rv->nvife);
 
-        if (mbus_frame_calc_checksum(frame) == -1)
-        {
-            return -3;
-        }
+    if ((rv->vif & MBUS_DIB_VIF_WITHOUT_EXTENSION) == 0x7C)
+    {
+        mbus_data_str_decode(record->drh.vib.custom_vif, &data[rv->custom_vif_offset], rv->custom_vif_len);
+    }
 
-        switch (frame->type)
-        {
-            case MBUS_FRAME_TYPE_ACK:
+    record->data_len = rv->data_len;
+    if (record->data_len > sizeof(record->data))
+    {
+        record->data_len = sizeof(record->data);
+    }
+    memcpy(record->data, &data[rv->data_offset], record->data_len);
+}
+
+//------------------------------------------------------------------------------
+// Check a record located by mbus_data_record_slice against a filter. Only the
+// DIB/VIB bytes are looked at.
+//------------------------------------------------------------------------------
+static int
+mbus_data_record_slice_match(const unsigned char *data, const mbus_record_view *rv, const mbus_record_filter *filter)
+{
+    const unsigned char *dife = &data[rv->dife_offset];
+    long tariff;
+    int device;
+    size_t i;
+
+    if (filter == NULL)
+        return 1;
+
+    if (filter->function >= 0 &&
+        (rv->dif & MBUS_DATA_RECORD_DIF_MASK_FUNCTION) != filter->function)
+        return 0;
+
+    if (filter->vif)
+    {
+        // manufacturer specific data has no VIF
+        if ((rv->dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) ||
+            (rv->dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW))
+            return 0;
+
+        for (i = 0; i < filter->nvif; i++)
+        {
+            if ((rv->vif & filter->vif_mask) == (filter->vif[i] & filter->vif_mask))
+                break;
+        }
+
+        if (i == filter->nvif)
+            return 0;
+    }
+
+    if (filter->vife >= 0 && (rv->vif == 0xFB || rv->vif == 0xFD))
+    {
+        if (rv->nvife == 0 ||
+            (data[rv->vife_offset] & filter->vife_mask) != (filter->vife & filter->vife_mask))
+            return 0;
+    }
+
+    if (filter->storage_number >= 0 &&
+        mbus_dib_storage_number(rv->dif, dife, rv->ndife) != filter->storage_number)
+        return 0;
+
+    if (filter->tariff >= 0)
+    {
+        tariff = mbus_dib_tariff(dife, rv->ndife);
+        if ((tariff < 0 ? 0 : tariff) != filter->tariff)
+            return 0;
+    }
+
+    if (filter->device >= 0)
+    {
+        device = mbus_dib_device(dife, rv->ndife);
+        if ((device < 0 ? 0 : device) != filter->device)
+            return 0;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Parse the variable-length data of a M-Bus frame, keeping only the records
+/// that match the filter (all records if filter is NULL). The other records
+/// are skipped without being copied. When an arena is given, the records are
+/// taken from it rather than allocated one by one.
+//------------------------------------------------------------------------------
+int
+mbus_data_variable_parse_filter(mbus_frame *frame, mbus_data_variable *data,
+                                const mbus_record_filter *filter, mbus_record_arena *arena)
+{
+    mbus_data_record *record = NULL, *tail = NULL;
+    mbus_record_view slice;
+    size_t i;
+
+    if (frame && data)
+    {
+        // parse header
+        data->nrecords = 0;
+        data->more_records_follow = 0;
+        i = MBUS_DATA_VARIABLE_HEADER_LENGTH;
+
+        if(frame->data_size < i)
+        {
+            snprintf(error_str, sizeof(error_str), "Variable header too short.");
+            return -1;
+        }
+
+        // first copy the variable data fixed header bytewise
+        data->header.id_bcd[0]       = frame->data[0];
+        data->header.id_bcd[1]       = frame->data[1];
+        data->header.id_bcd[2]       = frame->data[2];
+        data->header.id_bcd[3]       = frame->data[3];
+        data->header.manufacturer[0] = frame->data[4];
+        data->header.manufacturer[1] = frame->data[5];
+        data->header.version         = frame->data[6];
+        data->header.medium          = frame->data[7];
+        data->header.access_no       = frame->data[8];
+        data->header.status          = frame->data[9];
+        data->header.signature[0]    = frame->data[10];
+        data->header.signature[1]    = frame->data[11];
+
+        data->record = NULL;
+        data->arena = arena;
+
+        while (i < frame->data_size)
+        {
+            // Skip filler dif=2F
+            if ((frame->data[i] & 0xFF) == MBUS_DIB_DIF_IDLE_FILLER)
+            {
+              i++;
+              continue;
+            }
+
+            if (mbus_data_record_slice(frame->data, frame->data_size, &i, &slice) != 0)
+            {
+                return -1;
+            }
+
+            if (slice.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
+            {
+                data->more_records_follow = 1;
+            }
+
+            if (!mbus_data_record_slice_match(frame->data, &slice, filter))
+            {
+                continue;
+            }
+
+            record = arena ? mbus_record_arena_alloc(arena) : mbus_data_record_new();
+
+            if (record == NULL)
+            {
+                // clean up...
+                return (-2);
+            }
+
+            mbus_data_record_copy_slice(record, frame->data, &slice);
+
+            // copy timestamp
+            memcpy((void *)&(record->timestamp), (void *)&(frame->timestamp), sizeof(time_t));
+
+            // append the record and move on to next one
+            if (tail)
+                tail->next = record;
+            else
+                data->record = record;
+            tail = record;
+            data->nrecords++;
+        }
+
+        return 0;
+    }
+
+    return -1;
+}
+
+int
+mbus_data_variable_parse_arena(mbus_frame *frame, mbus_data_variable *data, mbus_record_arena *arena)
+{
+    return mbus_data_variable_parse_filter(frame, data, NULL, arena);
+}
+
+int
+mbus_data_variable_parse(mbus_frame *frame, mbus_data_variable *data)
+{
+    return mbus_data_variable_parse_filter(frame, data, NULL, NULL);
+}
+
+//------------------------------------------------------------------------------
+/// Validate the frame at the start of buff in place and set up a read-only
+/// view of it. Returns 0 on success, the number of missing bytes if the frame
+/// is incomplete, or a negative value (as mbus_parse) if it is invalid. Bytes
+/// following the frame are ignored, view->size tells where the frame ends.
+//------------------------------------------------------------------------------
+int
+mbus_frame_view_init(mbus_frame_view *view, const unsigned char *buff, size_t buff_size)
+{
+    size_t len;
+    unsigned char checksum;
+
+    if (view == NULL || buff == NULL || buff_size == 0)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to frame view, data or zero data_size.");
+        return -1;
+    }
+
+    memset(view, 0, sizeof(mbus_frame_view));
+    view->buff = buff;
+
+    switch (buff[0])
+    {
+        case MBUS_FRAME_ACK_START:
+
+            view->type = MBUS_FRAME_TYPE_ACK;
+            view->size = MBUS_FRAME_BASE_SIZE_ACK;
+            return 0;
+
+        case MBUS_FRAME_SHORT_START:
+
+            if (buff_size < MBUS_FRAME_BASE_SIZE_SHORT)
+            {
+                return MBUS_FRAME_BASE_SIZE_SHORT - buff_size;
+            }
+
+            view->type    = MBUS_FRAME_TYPE_SHORT;
+            view->size    = MBUS_FRAME_BASE_SIZE_SHORT;
+            view->control = buff[1];
+            view->address = buff[2];
+
+            if (!mbus_control_short_valid(view->control))
+            {
+                snprintf(error_str, sizeof(error_str), "Unknown Control Code 0x%.2x", view->control);
+                return -3;
+            }
+
+            checksum = buff[1] + buff[2];
+            break;
+
+        case MBUS_FRAME_LONG_START: // (also CONTROL)
+
+            if (buff_size < 3)
+            {
+                return 3 - buff_size;
+            }
+
+            if (buff[1] < 3 || buff[1] != buff[2])
+            {
+                snprintf(error_str, sizeof(error_str), "Invalid M-Bus frame length.");
+                return -2;
+            }
+
+            len = buff[1];
+
+            if (buff_size < MBUS_FRAME_FIXED_SIZE_LONG + len)
+            {
+                return MBUS_FRAME_FIXED_SIZE_LONG + len - buff_size;
+            }
+
+            view->size    = MBUS_FRAME_FIXED_SIZE_LONG + len;
+            view->control = buff[4];
+            view->address = buff[5];
+            view->control_information = buff[6];
+            view->data      = &buff[7];
+            view->data_size = len - 3;
+            view->type = (view->data_size == 0) ? MBUS_FRAME_TYPE_CONTROL : MBUS_FRAME_TYPE_LONG;
+
+            if (buff[3] != MBUS_FRAME_CONTROL_START)
+            {
+                snprintf(error_str, sizeof(error_str), "No frame start");
+                return -3;
+            }
+
+            if (!mbus_control_long_valid(view->control))
+            {
+                snprintf(error_str, sizeof(error_str), "Unknown Control Code 0x%.2x", view->control);
+                return -3;
+            }
+
+            checksum = mbus_checksum(&buff[4], len);
+            break;
+
+        default:
+            snprintf(error_str, sizeof(error_str), "Invalid M-Bus frame start.");
+            return -4;
+    }
+
+    if (buff[view->size - 1] != MBUS_FRAME_STOP)
+    {
+        snprintf(error_str, sizeof(error_str), "No frame stop");
+        return -3;
+    }
+
+    if (buff[view->size - 2] != checksum)
+    {
+        snprintf(error_str, sizeof(error_str), "Invalid checksum (0x%.2x != 0x%.2x)", buff[view->size - 2], checksum);
+        return -3;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Decode the fixed header of a variable-length frame view
+//------------------------------------------------------------------------------
+int
+mbus_frame_view_header(const mbus_frame_view *view, mbus_data_variable_header *header)
+{
+    if (view == NULL || header == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to frame view or header.");
+        return -1;
+    }
+
+    if (view->control_information != MBUS_CONTROL_INFO_RESP_VARIABLE ||
+        view->data_size < MBUS_DATA_VARIABLE_HEADER_LENGTH)
+    {
+        snprintf(error_str, sizeof(error_str), "Variable header too short.");
+        return -1;
+    }
+
+    memcpy(header->id_bcd, &(view->data[0]), 4);
+    header->manufacturer[0] = view->data[4];
+    header->manufacturer[1] = view->data[5];
+    header->version         = view->data[6];
+    header->medium          = view->data[7];
+    header->access_no       = view->data[8];
+    header->status          = view->data[9];
+    header->signature[0]    = view->data[10];
+    header->signature[1]    = view->data[11];
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Iterate over the data records of a variable-length frame view. Start with
+/// *pos = 0. Returns 1 and fills in record while there are records left, 0 at
+/// the end of the data and -1 if a record is malformed.
+//------------------------------------------------------------------------------
+int
+mbus_frame_view_next_record(const mbus_frame_view *view, size_t *pos, mbus_record_view *record)
+{
+    size_t i;
+
+    if (view == NULL || pos == NULL || record == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to frame view or record.");
+        return -1;
+    }
+
+    if (view->control_information != MBUS_CONTROL_INFO_RESP_VARIABLE)
+    {
+        snprintf(error_str, sizeof(error_str), "Non-variable data response.");
+        return -1;
+    }
+
+    if (view->data_size < MBUS_DATA_VARIABLE_HEADER_LENGTH)
+    {
+        snprintf(error_str, sizeof(error_str), "Variable header too short.");
+        return -1;
+    }
+
+    i = (*pos < MBUS_DATA_VARIABLE_HEADER_LENGTH) ? MBUS_DATA_VARIABLE_HEADER_LENGTH : *pos;
+
+    // skip filler dif=2F
+    while (i < view->data_size && view->data[i] == MBUS_DIB_DIF_IDLE_FILLER)
+    {
+        i++;
+    }
+
+    if (i >= view->data_size)
+    {
+        *pos = i;
+        return 0;
+    }
+
+    if (mbus_data_record_slice(view->data, view->data_size, &i, record) != 0)
+    {
+        return -1;
+    }
+
+    *pos = i;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Decode a single record of a frame view into a record struct, so that the
+/// regular record functions (mbus_data_record_value_r, ...) can be applied.
+//------------------------------------------------------------------------------
+int
+mbus_record_view_decode(const mbus_frame_view *view, const mbus_record_view *record_view, mbus_data_record *record)
+{
+    if (view == NULL || record_view == NULL || record == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to frame view or record.");
+        return -1;
+    }
+
+    memset(record, 0, sizeof(mbus_data_record));
+
+    mbus_data_record_copy_slice(record, view->data, record_view);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Set up a view of a frame that has already been parsed into a frame
+/// struct, e.g. by mbus_recv_frame. The view is valid as long as the frame
+/// is; view->buff is NULL as the raw frame is not available.
+//------------------------------------------------------------------------------
+int
+mbus_frame_view_of(mbus_frame_view *view, mbus_frame *frame)
+{
+    if (view == NULL || frame == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to frame view or frame.");
+        return -1;
+    }
+
+    memset(view, 0, sizeof(mbus_frame_view));
+
+    view->type    = frame->type;
+    view->control = frame->control;
+    view->address = frame->address;
+    view->control_information = frame->control_information;
+    view->data      = frame->data;
+    view->data_size = frame->data_size;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Check whether a variable-length frame view ends with DIF 0x1F, i.e. the
+/// slave has more records to send. The records are only sliced. Returns 1 or
+/// 0, and -1 if a record is malformed.
+//------------------------------------------------------------------------------
+int
+mbus_frame_view_more_records_follow(const mbus_frame_view *view)
+{
+    mbus_record_view record;
+    size_t pos = 0;
+    int ret;
+
+    while ((ret = mbus_frame_view_next_record(view, &pos, &record)) == 1)
+    {
+        if (record.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
+            return 1;
+    }
+
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+/// Initialize a record filter that matches every record
+//------------------------------------------------------------------------------
+void
+mbus_record_filter_init(mbus_record_filter *filter)
+{
+    if (filter)
+    {
+        filter->vif = NULL;
+        filter->nvif = 0;
+        filter->vif_mask = MBUS_DIB_VIF_WITHOUT_EXTENSION;
+        filter->vife = -1;
+        filter->vife_mask = MBUS_DIB_VIF_WITHOUT_EXTENSION;
+        filter->function = -1;
+        filter->storage_number = -1;
+        filter->tariff = -1;
+        filter->device = -1;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Check a record of a frame view against a filter. Returns 1 if it matches,
+/// 0 if not and -1 on invalid parameters.
+//------------------------------------------------------------------------------
+int
+mbus_record_view_match(const mbus_frame_view *view, const mbus_record_view *record_view,
+                       const mbus_record_filter *filter)
+{
+    if (view == NULL || record_view == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to frame view or record.");
+        return -1;
+    }
+
+    return mbus_data_record_slice_match(view->data, record_view, filter);
+}
+
+//------------------------------------------------------------------------------
+/// Like mbus_frame_view_next_record, but skips the records that do not match
+/// the filter. Nothing but the DIB/VIB of the skipped records is read.
+//------------------------------------------------------------------------------
+int
+mbus_frame_view_find_record(const mbus_frame_view *view, size_t *pos, const mbus_record_filter *filter,
+                            mbus_record_view *record)
+{
+    int result;
+
+    while ((result = mbus_frame_view_next_record(view, pos, record)) == 1)
+    {
+        if (mbus_data_record_slice_match(view->data, record, filter))
+            return 1;
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+/// Check the stype of the frame data (error, fixed or variable) and dispatch to the
+/// corresponding parser function.
+//------------------------------------------------------------------------------
+int
+mbus_frame_data_parse_arena(mbus_frame *frame, mbus_frame_data *data, mbus_record_arena *arena)
+{
+    char direction;
+
+    if (frame == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to frame.");
+        return -1;
+    }
+
+    if (data == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to data.");
+        return -1;
+    }
+
+    direction = (frame->control & MBUS_CONTROL_MASK_DIR);
+
+    if (direction == MBUS_CONTROL_MASK_DIR_S2M)
+    {
+        if (frame->control_information == MBUS_CONTROL_INFO_ERROR_GENERAL)
+        {
+            data->type = MBUS_DATA_TYPE_ERROR;
+
+            if (frame->data_size > 0)
+            {
+                data->error = (int) frame->data[0];
+            }
+            else
+            {
+                data->error = 0;
+            }
+
+            return 0;
+        }
+        else if (frame->control_information == MBUS_CONTROL_INFO_RESP_FIXED)
+        {
+            if (frame->data_size == 0)
+            {
+                snprintf(error_str, sizeof(error_str), "Got zero data_size.");
+
+                return -1;
+            }
+
+            data->type = MBUS_DATA_TYPE_FIXED;
+            return mbus_data_fixed_parse(frame, &(data->data_fix));
+        }
+        else if (frame->control_information == MBUS_CONTROL_INFO_RESP_VARIABLE)
+        {
+            if (frame->data_size == 0)
+            {
+                snprintf(error_str, sizeof(error_str), "Got zero data_size.");
+
+                return -1;
+            }
+
+            data->type = MBUS_DATA_TYPE_VARIABLE;
+            return mbus_data_variable_parse_arena(frame, &(data->data_var), arena);
+        }
+        else
+        {
+            snprintf(error_str, sizeof(error_str), "Unknown control information 0x%.2x", frame->control_information);
+
+            return -1;
+        }
+    }
+
+    snprintf(error_str, sizeof(error_str), "Wrong direction in frame (master to slave)");
+
+    return -1;
+}
+
+int
+mbus_frame_data_parse(mbus_frame *frame, mbus_frame_data *data)
+{
+    return mbus_frame_data_parse_arena(frame, data, NULL);
+}
+
+//------------------------------------------------------------------------------
+//
+// CHANGE DETECTION CACHE
+//
+//------------------------------------------------------------------------------
+
+void
+mbus_frame_cache_init(mbus_frame_cache *cache)
+{
+    if (cache)
+    {
+        memset(cache, 0, sizeof(mbus_frame_cache));
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Drop all cached telegrams, e.g. after the slaves were reconfigured
+//------------------------------------------------------------------------------
+void
+mbus_frame_cache_reset(mbus_frame_cache *cache)
+{
+    mbus_frame_cache_slot *slot;
+    size_t i, j;
+
+    if (cache == NULL)
+        return;
+
+    for (i = 0; i < cache->size; i++)
+    {
+        for (j = 0; j < MBUS_FRAME_CACHE_TELEGRAMS; j++)
+        {
+            slot = &(cache->entries[i].slot[j]);
+            mbus_frame_data_free(slot->data);
+            memset(slot, 0, sizeof(mbus_frame_cache_slot));
+        }
+
+        cache->entries[i].next = 0;
+    }
+}
+
+void
+mbus_frame_cache_free(mbus_frame_cache *cache)
+{
+    if (cache)
+    {
+        mbus_frame_cache_reset(cache);
+        free(cache->entries);
+        mbus_frame_cache_init(cache);
+    }
+}
+
+static size_t
+mbus_frame_cache_index(const mbus_frame_cache *cache, uint64_t key)
+{
+    size_t i;
+
+    // Fibonacci hashing, size is a power of two
+    i = (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (cache->size - 1);
+
+    while (cache->entries[i].used && cache->entries[i].key != key)
+        i = (i + 1) & (cache->size - 1);
+
+    return i;
+}
+
+//------------------------------------------------------------------------------
+/// Look up the cache entry of a slave, creating it if needed. The pointer is
+/// valid until the next entry is created.
+//------------------------------------------------------------------------------
+static mbus_frame_cache_entry *
+mbus_frame_cache_entry_get(mbus_frame_cache *cache, uint64_t key)
+{
+    mbus_frame_cache_entry *entries, *old;
+    size_t i, j, size;
+
+    if (cache->size > 0)
+    {
+        i = mbus_frame_cache_index(cache, key);
+
+        if (cache->entries[i].used)
+            return &(cache->entries[i]);
+    }
+
+    // keep the load factor below 3/4
+    if (4 * (cache->count + 1) > 3 * cache->size)
+    {
+        size = cache->size ? 2 * cache->size : 16;
+
+        if ((entries = (mbus_frame_cache_entry *) calloc(size, sizeof(mbus_frame_cache_entry))) == NULL)
+        {
+            snprintf(error_str, sizeof(error_str), "Failed to allocate frame cache.");
+            return NULL;
+        }
+
+        old = cache->entries;
+        j = cache->size;
+        cache->entries = entries;
+        cache->size = size;
+
+        for (i = 0; i < j; i++)
+        {
+            if (old[i].used)
+                cache->entries[mbus_frame_cache_index(cache, old[i].key)] = old[i];
+        }
+
+        free(old);
+    }
+
+    i = mbus_frame_cache_index(cache, key);
+    cache->entries[i].used = 1;
+    cache->entries[i].key = key;
+    cache->count++;
+
+    return &(cache->entries[i]);
+}
+
+// FNV-1a
+#define MBUS_FRAME_CACHE_HASH_INIT 0xCBF29CE484222325ULL
+
+static uint64_t
+mbus_frame_cache_hash(uint64_t hash, const unsigned char *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+//------------------------------------------------------------------------------
+/// Date/time records (VIF 0x6C/0x6D) change with every telegram of many
+/// meters and are left out of the comparison.
+//------------------------------------------------------------------------------
+static int
+mbus_frame_cache_time_record(const mbus_record_view *record)
+{
+    if ((record->dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) ||
+        (record->dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW))
+        return 0;
+
+    return (record->vif & 0x7E) == 0x6C && record->data_len > 0;
+}
+
+//------------------------------------------------------------------------------
+/// Compare the user data of a frame with the telegram of a slot whose hash
+/// matched, apart from the access number and the date/time records patched
+/// on a hit. The time records are kept in the order of their offsets.
+//------------------------------------------------------------------------------
+static int
+mbus_frame_cache_same(const mbus_frame_cache_slot *slot, const mbus_frame *frame)
+{
+    size_t pos = 0, i, end;
+
+    if (slot->payload_len != frame->data_size)
+        return 0;
+
+    for (i = 0; i <= slot->ntime; i++)
+    {
+        end = (i < slot->ntime) ? slot->time_offset[i] : frame->data_size;
+
+        // the access number is in the header, before the first record
+        if (i == 0)
+        {
+            if (memcmp(slot->payload, frame->data, 8) != 0)
+                return 0;
+
+            pos = 9;
+        }
+
+        if (memcmp(&(slot->payload[pos]), &(frame->data[pos]), end - pos) != 0)
+            return 0;
+
+        if (i < slot->ntime)
+            pos = end + slot->time_record[i]->data_len;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Decode a reply through the cache. Returns MBUS_FRAME_CACHE_UNCHANGED if a
+/// variable data telegram equals the last one from the slave with the same
+/// record layout (apart from the access number and date/time records), in
+/// which case the cached data is updated in place, MBUS_FRAME_CACHE_CHANGED
+/// if the frame was parsed, and -1 if the frame could not be parsed. Fixed
+/// data and error replies are always parsed.
+//------------------------------------------------------------------------------
+int
+mbus_frame_cache_parse(mbus_frame_cache *cache, mbus_frame *frame, mbus_frame_data **data)
+{
+    mbus_frame_cache_entry *entry;
+    mbus_frame_cache_slot *slot = NULL;
+    mbus_data_record *record;
+    mbus_frame_view view;
+    mbus_record_view rv;
+    uint64_t layout, hash;
+    size_t time_index[MBUS_FRAME_CACHE_TIME_RECORDS];
+    size_t time_offset[MBUS_FRAME_CACHE_TIME_RECORDS];
+    size_t ntime = 0, nrecords = 0, pos = 0, i, j;
+    int ret;
+
+    if (cache == NULL || frame == NULL || data == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to cache, frame or data.");
+        return -1;
+    }
+
+    *data = NULL;
+
+    if ((frame->control & MBUS_CONTROL_MASK_DIR) != MBUS_CONTROL_MASK_DIR_S2M ||
+        frame->control_information != MBUS_CONTROL_INFO_RESP_VARIABLE ||
+        frame->data_size < MBUS_DATA_VARIABLE_HEADER_LENGTH)
+    {
+        // nothing to cache, these replies have no records
+        memset(&(cache->scratch), 0, sizeof(mbus_frame_data));
+
+        if (mbus_frame_data_parse(frame, &(cache->scratch)) != 0)
+            return -1;
+
+        *data = &(cache->scratch);
+        return MBUS_FRAME_CACHE_CHANGED;
+    }
+
+    // header without the access number
+    hash = mbus_frame_cache_hash(MBUS_FRAME_CACHE_HASH_INIT, frame->data, 8);
+    hash = mbus_frame_cache_hash(hash, &(frame->data[9]), MBUS_DATA_VARIABLE_HEADER_LENGTH - 9);
+    layout = MBUS_FRAME_CACHE_HASH_INIT;
+
+    mbus_frame_view_of(&view, frame);
+
+    while ((ret = mbus_frame_view_next_record(&view, &pos, &rv)) == 1)
+    {
+        // record headers and where they are, so that the date/time records
+        // can be patched at the same offsets on a hit
+        layout = mbus_frame_cache_hash(layout, (const unsigned char *) &(rv.offset), sizeof(rv.offset));
+        layout = mbus_frame_cache_hash(layout, &(frame->data[rv.offset]), rv.data_offset - rv.offset);
+        hash = mbus_frame_cache_hash(hash, &(frame->data[rv.offset]), rv.data_offset - rv.offset);
+
+        if (mbus_frame_cache_time_record(&rv) && ntime < MBUS_FRAME_CACHE_TIME_RECORDS)
+        {
+            time_index[ntime] = nrecords;
+            time_offset[ntime] = rv.data_offset;
+            ntime++;
+        }
+        else
+        {
+            hash = mbus_frame_cache_hash(hash, &(frame->data[rv.data_offset]), rv.data_len);
+        }
+
+        nrecords++;
+    }
+
+    if (ret != 0)
+        return -1;
+
+    layout = mbus_frame_cache_hash(layout, (const unsigned char *) &(frame->data_size), sizeof(frame->data_size));
+
+    // zero marks a free slot
+    if (hash == 0)
+        hash = 1;
+
+    if ((entry = mbus_frame_cache_entry_get(cache, mbus_slave_key_secondary(frame->data))) == NULL)
+        return -1;
+
+    for (i = 0; i < MBUS_FRAME_CACHE_TELEGRAMS; i++)
+    {
+        if (entry->slot[i].hash && entry->slot[i].layout == layout)
+        {
+            slot = &(entry->slot[i]);
+            break;
+        }
+    }
+
+    if (slot && slot->hash == hash && mbus_frame_cache_same(slot, frame))
+    {
+        slot->data->data_var.header.access_no = frame->data[8];
+
+        for (i = 0; i < slot->ntime; i++)
+        {
+            record = slot->time_record[i];
+            memcpy(record->data, &(frame->data[slot->time_offset[i]]), record->data_len);
+        }
+
+        for (record = slot->data->data_var.record; record; record = record->next)
+            record->timestamp = frame->timestamp;
+
+        cache->hits++;
+        *data = slot->data;
+        return MBUS_FRAME_CACHE_UNCHANGED;
+    }
+
+    cache->misses++;
+
+    if (slot == NULL)
+    {
+        // a free slot, or the next one in turn
+        for (i = 0; i < MBUS_FRAME_CACHE_TELEGRAMS && entry->slot[i].hash; i++)
+            ;
+
+        if (i == MBUS_FRAME_CACHE_TELEGRAMS)
+        {
+            i = entry->next;
+            entry->next = (entry->next + 1) % MBUS_FRAME_CACHE_TELEGRAMS;
+        }
+
+        slot = &(entry->slot[i]);
+    }
+
+    mbus_frame_data_free(slot->data);
+    memset(slot, 0, sizeof(mbus_frame_cache_slot));
+
+    if ((slot->data = mbus_frame_data_new()) == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Failed to allocate frame data.");
+        return -1;
+    }
+
+    if (mbus_frame_data_parse(frame, slot->data) != 0)
+    {
+        mbus_frame_data_free(slot->data);
+        slot->data = NULL;
+        return -1;
+    }
+
+    // the records come in the order of the view
+    for (record = slot->data->data_var.record, i = 0, j = 0; record && j < ntime; record = record->next, i++)
+    {
+        if (i == time_index[j])
+        {
+            slot->time_record[j] = record;
+            slot->time_offset[j] = time_offset[j];
+            j++;
+        }
+    }
+
+    slot->ntime = j;
+    slot->layout = layout;
+    slot->hash = (j == ntime) ? hash : 0; // not cached if a record is missing
+
+    memcpy(slot->payload, frame->data, frame->data_size);
+    slot->payload_len = frame->data_size;
+
+    *data = slot->data;
+    return MBUS_FRAME_CACHE_CHANGED;
+}
+
+//------------------------------------------------------------------------------
+/// Pack the M-bus frame into a binary string representation that can be sent
+/// on the bus. The binary packet format is different for the different types
+/// of M-bus frames.
+//------------------------------------------------------------------------------
+int
+mbus_frame_pack(mbus_frame *frame, unsigned char *data, size_t data_size)
+{
+    size_t i, offset = 0;
+
+    if (frame && data)
+    {
+        if (mbus_frame_calc_length(frame) == -1)
+        {
+            return -2;
+        }
+
+        if (mbus_frame_calc_checksum(frame) == -1)
+        {
+            return -3;
+        }
+
+        switch (frame->type)
+        {
+            case MBUS_FRAME_TYPE_ACK:
 
                 if (data_size < MBUS_FRAME_ACK_BASE_SIZE)
                 {
-                    return -4;
+                    return -4;
+                }
+
+                data[offset++] = frame->start1;
+
+                return offset;
+
+            case MBUS_FRAME_TYPE_SHORT:
+
+                if (data_size < MBUS_FRAME_SHORT_BASE_SIZE)
+                {
+                    return -4;
+                }
+
+                data[offset++] = frame->start1;
+                data[offset++] = frame->control;
+                data[offset++] = frame->address;
+                data[offset++] = frame->checksum;
+                data[offset++] = frame->stop;
+
+                return offset;
+
+            case MBUS_FRAME_TYPE_CONTROL:
+
+                if (data_size < MBUS_FRAME_CONTROL_BASE_SIZE)
+                {
+                    return -4;
+                }
+
+                data[offset++] = frame->start1;
+                data[offset++] = frame->length1;
+                data[offset++] = frame->length2;
+                data[offset++] = frame->start2;
+
+                data[offset++] = frame->control;
+                data[offset++] = frame->address;
+                data[offset++] = frame->control_information;
+
+                data[offset++] = frame->checksum;
+                data[offset++] = frame->stop;
+
+                return offset;
+
+            case MBUS_FRAME_TYPE_LONG:
+
+                if (data_size < frame->data_size + MBUS_FRAME_LONG_BASE_SIZE)
+                {
+                    return -4;
+                }
+
+                data[offset++] = frame->start1;
+                data[offset++] = frame->length1;
+                data[offset++] = frame->length2;
+                data[offset++] = frame->start2;
+
+                data[offset++] = frame->control;
+                data[offset++] = frame->address;
+                data[offset++] = frame->control_information;
+
+                for (i = 0; i < frame->data_size; i++)
+                {
+                    data[offset++] = frame->data[i];
+                }
+
+                data[offset++] = frame->checksum;
+                data[offset++] = frame->stop;
+
+                return offset;
+
+            default:
+                return -5;
+        }
+    }
+
+    return -1;
+}
+
+
+//------------------------------------------------------------------------------
+/// pack the data stuctures into frame->data
+//------------------------------------------------------------------------------
+int
+mbus_frame_internal_pack(mbus_frame *frame, mbus_frame_data *frame_data)
+{
+    mbus_data_record *record;
+    int j;
+
+    if (frame == NULL || frame_data == NULL)
+        return -1;
+
+    frame->data_size = 0;
+
+    switch (frame_data->type)
+    {
+        case MBUS_DATA_TYPE_ERROR:
+
+            frame->data[frame->data_size++] = (char) frame_data->error;
+
+            break;
+
+        case MBUS_DATA_TYPE_FIXED:
+
+            //
+            // pack fixed data structure
+            //
+            frame->data[frame->data_size++] = frame_data->data_fix.id_bcd[0];
+            frame->data[frame->data_size++] = frame_data->data_fix.id_bcd[1];
+            frame->data[frame->data_size++] = frame_data->data_fix.id_bcd[2];
+            frame->data[frame->data_size++] = frame_data->data_fix.id_bcd[3];
+            frame->data[frame->data_size++] = frame_data->data_fix.tx_cnt;
+            frame->data[frame->data_size++] = frame_data->data_fix.status;
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_type;
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_type;
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_val[0];
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_val[1];
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_val[2];
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_val[3];
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_val[0];
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_val[1];
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_val[2];
+            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_val[3];
+
+            break;
+
+        case MBUS_DATA_TYPE_VARIABLE:
+
+            //
+            // first pack variable data structure header
+            //
+            frame->data[frame->data_size++] = frame_data->data_var.header.id_bcd[0];
+            frame->data[frame->data_size++] = frame_data->data_var.header.id_bcd[1];
+            frame->data[frame->data_size++] = frame_data->data_var.header.id_bcd[2];
+            frame->data[frame->data_size++] = frame_data->data_var.header.id_bcd[3];
+            frame->data[frame->data_size++] = frame_data->data_var.header.manufacturer[0];
+            frame->data[frame->data_size++] = frame_data->data_var.header.manufacturer[1];
+            frame->data[frame->data_size++] = frame_data->data_var.header.version;
+            frame->data[frame->data_size++] = frame_data->data_var.header.medium;
+            frame->data[frame->data_size++] = frame_data->data_var.header.access_no;
+            frame->data[frame->data_size++] = frame_data->data_var.header.status;
+            frame->data[frame->data_size++] = frame_data->data_var.header.signature[0];
+            frame->data[frame->data_size++] = frame_data->data_var.header.signature[1];
+
+            //
+            // pack all data records
+            //
+            for (record = frame_data->data_var.record; record; record = record->next)
+            {
+                // pack DIF
+                if (parse_debug)
+                    printf("%s: packing DIF [%zu]", __PRETTY_FUNCTION__, frame->data_size);
+                frame->data[frame->data_size++] = record->drh.dib.dif;
+                for (j = 0; j < record->drh.dib.ndife; j++)
+                {
+                    frame->data[frame->data_size++] = record->drh.dib.dife[j];
+                }
+
+                // pack VIF
+                if (parse_debug)
+                    printf("%s: packing VIF [%zu]", __PRETTY_FUNCTION__, frame->data_size);
+                frame->data[frame->data_size++] = record->drh.vib.vif;
+                for (j = 0; j < record->drh.vib.nvife; j++)
+                {
+                    frame->data[frame->data_size++] = record->drh.vib.vife[j];
+                }
+
+                // pack data
+                if (parse_debug)
+                    printf("%s: packing data [%zu : %zu]", __PRETTY_FUNCTION__, frame->data_size, record->data_len);
+                for (j = 0; j < record->data_len; j++)
+                {
+                    frame->data[frame->data_size++] = record->data[j];
+                }
+            }
+
+            break;
+
+        default:
+            return -2;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//
+// Print/Dump functions
+//
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Switch parse debugging
+//------------------------------------------------------------------------------
+void
+mbus_parse_set_debug(int debug)
+{
+    parse_debug = debug;
+}
+
+//------------------------------------------------------------------------------
+/// Dump frame in HEX on standard output
+//------------------------------------------------------------------------------
+int
+mbus_frame_print(mbus_frame *frame)
+{
+    mbus_frame *iter;
+    unsigned char data_buff[256];
+    int len, i;
+
+    if (frame == NULL)
+        return -1;
+
+    for (iter = frame; iter; iter = iter->next)
+    {
+        if ((len = mbus_frame_pack(iter, data_buff, sizeof(data_buff))) == -1)
+        {
+            return -2;
+        }
+
+        printf("%s: Dumping M-Bus frame [type %d, %d bytes]: ", __PRETTY_FUNCTION__, iter->type, len);
+        for (i = 0; i < len; i++)
+        {
+            printf("%.2X ", data_buff[i]);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+///
+/// Print the data part of a frame.
+///
+//------------------------------------------------------------------------------
+int
+mbus_frame_data_print(mbus_frame_data *data)
+{
+    if (data)
+    {
+        if (data->type == MBUS_DATA_TYPE_ERROR)
+        {
+            return mbus_data_error_print(data->error);
+        }
+
+        if (data->type == MBUS_DATA_TYPE_FIXED)
+        {
+            return mbus_data_fixed_print(&(data->data_fix));
+        }
+
+        if (data->type == MBUS_DATA_TYPE_VARIABLE)
+        {
+            return mbus_data_variable_print(&(data->data_var));
+        }
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+/// Print M-bus frame info to stdout
+//------------------------------------------------------------------------------
+int
+mbus_data_variable_header_print(mbus_data_variable_header *header)
+{
+    if (header)
+    {
+        printf("%s: ID           = %llX\n", __PRETTY_FUNCTION__,
+               mbus_data_bcd_decode_hex(header->id_bcd, 4));
+
+        printf("%s: Manufacturer = 0x%.2X%.2X\n", __PRETTY_FUNCTION__,
+               header->manufacturer[1], header->manufacturer[0]);
+
+        printf("%s: Manufacturer = %s\n", __PRETTY_FUNCTION__,
+               mbus_decode_manufacturer(header->manufacturer[0], header->manufacturer[1]));
+
+        printf("%s: Version      = 0x%.2X\n", __PRETTY_FUNCTION__, header->version);
+        printf("%s: Medium       = %s (0x%.2X)\n", __PRETTY_FUNCTION__, mbus_data_variable_medium_lookup(header->medium), header->medium);
+        printf("%s: Access #     = 0x%.2X\n", __PRETTY_FUNCTION__, header->access_no);
+        printf("%s: Status       = 0x%.2X\n", __PRETTY_FUNCTION__, header->status);
+        printf("%s: Signature    = 0x%.2X%.2X\n", __PRETTY_FUNCTION__,
+               header->signature[1], header->signature[0]);
+
+    }
+
+    return -1;
+}
+
+int
+mbus_data_variable_print(mbus_data_variable *data)
+{
+    mbus_data_record *record;
+    size_t j;
+    int i;
+
+    if (data)
+    {
+        mbus_data_variable_header_print(&(data->header));
+
+        for (record = data->record, i = 0; record; record = record->next, i++)
+        {
+            printf("Record ID         = %d\n", i);
+            // DIF
+            printf("DIF               = %.2X\n", record->drh.dib.dif);
+            printf("DIF.Extension     = %s\n",  (record->drh.dib.dif & MBUS_DIB_DIF_EXTENSION_BIT) ? "Yes":"No");
+            printf("DIF.StorageNumber = %d\n",  (record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_STORAGE_NO) >> 6);
+            printf("DIF.Function      = %s\n",  (record->drh.dib.dif & 0x30) ? "Value during error state" : "Instantaneous value" );
+            printf("DIF.Data          = %.2X\n", record->drh.dib.dif & 0x0F);
+
+            // VENDOR SPECIFIC
+            if ((record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) ||
+                (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)) //MBUS_DIB_DIF_VENDOR_SPECIFIC
+            {
+                printf("%s: VENDOR DATA [size=%zu] = ", __PRETTY_FUNCTION__, record->data_len);
+                for (j = 0; j < record->data_len; j++)
+                {
+                    printf("%.2X ", record->data[j]);
+                }
+                printf("\n");
+
+                if (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
+                {
+                  printf("%s: More records follow in next telegram\n", __PRETTY_FUNCTION__);
                 }
+                continue;
+            }
+
+            // calculate length of data record
+            printf("DATA LENGTH = %zu\n", record->data_len);
+
+            // DIFE
+            for (j = 0; j < record->drh.dib.ndife; j++)
+            {
+                unsigned char dife = record->drh.dib.dife[j];
+
+                printf("DIFE[%zu]               = %.2X\n", j,  dife);
+                printf("DIFE[%zu].Extension     = %s\n",   j, (dife & MBUS_DATA_RECORD_DIFE_MASK_EXTENSION) ? "Yes" : "No");
+                printf("DIFE[%zu].Device        = %d\n",   j, (dife & MBUS_DATA_RECORD_DIFE_MASK_DEVICE) >> 6 );
+                printf("DIFE[%zu].Tariff        = %d\n",   j, (dife & MBUS_DATA_RECORD_DIFE_MASK_TARIFF) >> 4 );
+                printf("DIFE[%zu].StorageNumber = %.2X\n", j,  dife & MBUS_DATA_RECORD_DIFE_MASK_STORAGE_NO);
+            }
+
+            // VIF
+            printf("VIF           = %.2X\n", record->drh.vib.vif);
+            printf("VIF.Extension = %s\n",  (record->drh.vib.vif & MBUS_DIB_VIF_EXTENSION_BIT) ? "Yes":"No");
+            printf("VIF.Value     = %.2X\n", record->drh.vib.vif & MBUS_DIB_VIF_WITHOUT_EXTENSION);
+
+            // VIFE
+            for (j = 0; j < record->drh.vib.nvife; j++)
+            {
+                unsigned char vife = record->drh.vib.vife[j];
+
+                printf("VIFE[%zu]           = %.2X\n", j,  vife);
+                printf("VIFE[%zu].Extension = %s\n",   j, (vife & MBUS_DIB_VIF_EXTENSION_BIT) ? "Yes" : "No");
+                printf("VIFE[%zu].Value     = %.2X\n", j,  vife & MBUS_DIB_VIF_WITHOUT_EXTENSION);
+            }
+
+            printf("\n");
+        }
+    }
+
+    return -1;
+}
+
+int
+mbus_data_fixed_print(mbus_data_fixed *data)
+{
+    int val;
+
+    if (data)
+    {
+        printf("%s: ID       = %llX\n", __PRETTY_FUNCTION__, mbus_data_bcd_decode_hex(data->id_bcd, 4));
+        printf("%s: Access # = 0x%.2X\n", __PRETTY_FUNCTION__, data->tx_cnt);
+        printf("%s: Status   = 0x%.2X\n", __PRETTY_FUNCTION__, data->status);
+        printf("%s: Function = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_function(data->status));
+
+        printf("%s: Medium1  = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_medium(data));
+        printf("%s: Unit1    = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_unit(data->cnt1_type));
+        if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
+        {
+            printf("%s: Counter1 = %llX\n", __PRETTY_FUNCTION__, mbus_data_bcd_decode_hex(data->cnt1_val, 4));
+        }
+        else
+        {
+            mbus_data_int_decode(data->cnt1_val, 4, &val);
+            printf("%s: Counter1 = %d\n", __PRETTY_FUNCTION__, val);
+        }
+
+        printf("%s: Medium2  = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_medium(data));
+        printf("%s: Unit2    = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_unit(data->cnt2_type));
+        if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
+        {
+            printf("%s: Counter2 = %llX\n", __PRETTY_FUNCTION__, mbus_data_bcd_decode_hex(data->cnt2_val, 4));
+        }
+        else
+        {
+            mbus_data_int_decode(data->cnt2_val, 4, &val);
+            printf("%s: Counter2 = %d\n", __PRETTY_FUNCTION__, val);
+        }
+    }
+
+    return -1;
+}
+
+void
+mbus_hex_dump(const char *label, const char *buff, size_t len)
+{
+    time_t rawtime;
+    struct tm timeinfo;
+    char timestamp[22];
+    size_t i;
+
+    if (label == NULL || buff == NULL)
+        return;
 
-                data[offset++] = frame->start1;
+    time ( &rawtime );
+    gmtime_r ( &rawtime, &timeinfo );
 
-                return offset;
+    strftime(timestamp,21,"%Y-%m-%d %H:%M:%SZ",&timeinfo);
+    fprintf(stderr, "[%s] %s (%03zu):", timestamp, label, len);
 
-            case MBUS_FRAME_TYPE_SHORT:
+    for (i = 0; i < len; i++)
+    {
+       fprintf(stderr, " %02X", (unsigned char) buff[i]);
+    }
 
-                if (data_size < MBUS_FRAME_SHORT_BASE_SIZE)
-                {
-                    return -4;
-                }
+    fprintf(stderr, "\n");
+}
 
-                data[offset++] = frame->start1;
-                data[offset++] = frame->control;
-                data[offset++] = frame->address;
-                data[offset++] = frame->checksum;
-                data[offset++] = frame->stop;
+int
+mbus_data_error_print(int error)
+{
+    printf("%s: Error = %d\n", __PRETTY_FUNCTION__, error);
 
-                return offset;
+    return -1;
+}
 
-            case MBUS_FRAME_TYPE_CONTROL:
 
-                if (data_size < MBUS_FRAME_CONTROL_BASE_SIZE)
-                {
-                    return -4;
-                }
+//------------------------------------------------------------------------------
+//
+// STREAMING XML/JSON WRITER
+//
+//------------------------------------------------------------------------------
 
-                data[offset++] = frame->start1;
-                data[offset++] = frame->length1;
-                data[offset++] = frame->length2;
-                data[offset++] = frame->start2;
+static int
+mbus_writer_file_write(mbus_writer *writer, const char *data, size_t data_len)
+{
+    return (fwrite(data, 1, data_len, (FILE *) writer->userdata) == data_len) ? 0 : -1;
+}
 
-                data[offset++] = frame->control;
-                data[offset++] = frame->address;
-                data[offset++] = frame->control_information;
+static int
+mbus_writer_fd_write(mbus_writer *writer, const char *data, size_t data_len)
+{
+    ssize_t ret;
 
-                data[offset++] = frame->checksum;
-                data[offset++] = frame->stop;
+    while (data_len > 0)
+    {
+        if ((ret = write(writer->fd, data, data_len)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
 
-                return offset;
+            return -1;
+        }
 
-            case MBUS_FRAME_TYPE_LONG:
+        data += ret;
+        data_len -= (size_t) ret;
+    }
 
-                if (data_size < frame->data_size + MBUS_FRAME_LONG_BASE_SIZE)
-                {
-                    return -4;
-                }
+    return 0;
+}
 
-                data[offset++] = frame->start1;
-                data[offset++] = frame->length1;
-                data[offset++] = frame->length2;
-                data[offset++] = frame->start2;
+//------------------------------------------------------------------------------
+/// Initialize a writer that hands its output to a user callback
+//------------------------------------------------------------------------------
+void
+mbus_writer_init(mbus_writer *writer, int format,
+                 int (*sink)(mbus_writer *writer, const char *data, size_t data_len),
+                 void *userdata)
+{
+    if (writer == NULL)
+        return;
 
-                data[offset++] = frame->control;
-                data[offset++] = frame->address;
-                data[offset++] = frame->control_information;
+    writer->format = format;
+    writer->write = sink;
+    writer->userdata = userdata;
+    writer->fd = -1;
+    writer->buff = writer->local;
+    writer->len = 0;
+    writer->size = sizeof(writer->local);
+    writer->grow = 0;
+    writer->error = 0;
+    writer->members = 0;
+    writer->fields = 0;
+    writer->records = 0;
+}
 
-                for (i = 0; i < frame->data_size; i++)
-                {
-                    data[offset++] = frame->data[i];
-                }
+//------------------------------------------------------------------------------
+/// Initialize a writer that writes to a stdio stream
+//------------------------------------------------------------------------------
+void
+mbus_writer_init_file(mbus_writer *writer, int format, FILE *fp)
+{
+    mbus_writer_init(writer, format, mbus_writer_file_write, fp);
+}
 
-                data[offset++] = frame->checksum;
-                data[offset++] = frame->stop;
+//------------------------------------------------------------------------------
+/// Initialize a writer that writes to a file descriptor
+//------------------------------------------------------------------------------
+void
+mbus_writer_init_fd(mbus_writer *writer, int format, int fd)
+{
+    mbus_writer_init(writer, format, mbus_writer_fd_write, NULL);
 
-                return offset;
+    if (writer)
+        writer->fd = fd;
+}
+
+//------------------------------------------------------------------------------
+/// Initialize a writer that collects the output in an allocated buffer,
+/// starting with size bytes (8 KB if zero). The result is taken with
+/// mbus_writer_detach, or dropped with mbus_writer_free.
+//------------------------------------------------------------------------------
+int
+mbus_writer_init_buffer(mbus_writer *writer, int format, size_t size)
+{
+    if (writer == NULL)
+        return -1;
+
+    mbus_writer_init(writer, format, NULL, NULL);
+
+    if (size == 0)
+        size = 8192;
+
+    if ((writer->buff = (char *) malloc(size)) == NULL)
+    {
+        writer->buff = writer->local;
+        writer->error = 1;
+        return -1;
+    }
+
+    writer->size = size;
+    writer->grow = 1;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Initialize a writer on a caller supplied buffer; output that does not fit
+/// is dropped.
+//------------------------------------------------------------------------------
+static void
+mbus_writer_init_static(mbus_writer *writer, char *buff, size_t buff_size)
+{
+    mbus_writer_init(writer, MBUS_WRITER_FORMAT_XML, NULL, NULL);
+
+    writer->buff = buff;
+    writer->size = buff_size;
+}
+
+//------------------------------------------------------------------------------
+/// Hand the buffered output to the sink
+//------------------------------------------------------------------------------
+int
+mbus_writer_flush(mbus_writer *writer)
+{
+    if (writer == NULL)
+        return -1;
+
+    if (writer->write && writer->len > 0 && writer->error == 0)
+    {
+        if (writer->write(writer, writer->buff, writer->len) != 0)
+            writer->error = 1;
+
+        writer->len = 0;
+    }
+
+    return writer->error ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Return the output collected by a buffer writer as a NUL terminated string,
+/// which the caller has to free. Returns NULL (and frees the output) if
+/// anything failed.
+//------------------------------------------------------------------------------
+char *
+mbus_writer_detach(mbus_writer *writer)
+{
+    char *buff;
+
+    if (writer == NULL || writer->grow == 0)
+        return NULL;
+
+    if (writer->error)
+    {
+        mbus_writer_free(writer);
+        return NULL;
+    }
+
+    buff = writer->buff;
+    buff[writer->len] = '\0';
+
+    mbus_writer_init(writer, writer->format, NULL, NULL);
+
+    return buff;
+}
+
+//------------------------------------------------------------------------------
+/// Free the output collected by a buffer writer
+//------------------------------------------------------------------------------
+void
+mbus_writer_free(mbus_writer *writer)
+{
+    if (writer && writer->grow)
+    {
+        free(writer->buff);
+        mbus_writer_init(writer, writer->format, NULL, NULL);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Make room for n more bytes (and a terminating NUL in memory buffers).
+//------------------------------------------------------------------------------
+static int
+mbus_writer_reserve(mbus_writer *writer, size_t n)
+{
+    char *buff;
+    size_t size;
+
+    if (writer->error)
+        return -1;
+
+    if (writer->len + n < writer->size)
+        return 0;
+
+    if (writer->write)
+    {
+        if (mbus_writer_flush(writer) != 0)
+            return -1;
+
+        return (n < writer->size) ? 0 : -1;
+    }
+
+    if (writer->grow == 0)
+    {
+        // output truncated
+        writer->error = 1;
+        return -1;
+    }
+
+    for (size = writer->size * 2; writer->len + n >= size; size *= 2)
+        ;
+
+    if ((buff = (char *) realloc(writer->buff, size)) == NULL)
+    {
+        writer->error = 1;
+        return -1;
+    }
+
+    writer->buff = buff;
+    writer->size = size;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Append raw data to the output
+//------------------------------------------------------------------------------
+int
+mbus_writer_write(mbus_writer *writer, const char *data, size_t data_len)
+{
+    size_t n;
+
+    if (writer == NULL || data == NULL)
+        return -1;
+
+    while (data_len > 0)
+    {
+        if (mbus_writer_reserve(writer, 1) != 0)
+            return -1;
+
+        // sinks take the data in chunks of the buffer size
+        n = writer->size - writer->len - 1;
+
+        if (writer->write == NULL && n < data_len && mbus_writer_reserve(writer, data_len) != 0)
+            return -1;
+
+        n = writer->size - writer->len - 1;
+        if (n > data_len)
+            n = data_len;
+
+        memcpy(&(writer->buff[writer->len]), data, n);
+        writer->len += n;
+        data += n;
+        data_len -= n;
+    }
+
+    return 0;
+}
+
+static int
+mbus_writer_puts(mbus_writer *writer, const char *str)
+{
+    return mbus_writer_write(writer, str, strlen(str));
+}
+
+static int
+mbus_writer_vprintf(mbus_writer *writer, const char *format, va_list args)
+{
+    va_list args_copy;
+    char *buff;
+    int n;
+
+    if (writer->error)
+        return -1;
+
+    va_copy(args_copy, args);
+    n = vsnprintf(&(writer->buff[writer->len]), writer->size - writer->len, format, args_copy);
+    va_end(args_copy);
+
+    if (n < 0)
+    {
+        writer->error = 1;
+        return -1;
+    }
+
+    if ((size_t) n < writer->size - writer->len)
+    {
+        writer->len += (size_t) n;
+        return 0;
+    }
+
+    if (mbus_writer_reserve(writer, (size_t) n) == 0)
+    {
+        writer->len += (size_t) vsnprintf(&(writer->buff[writer->len]), writer->size - writer->len, format, args);
+        return 0;
+    }
+
+    if (writer->write == NULL || writer->error)
+        return -1;
+
+    // longer than the buffer of the sink
+    if ((buff = (char *) malloc((size_t) n + 1)) == NULL)
+    {
+        writer->error = 1;
+        return -1;
+    }
+
+    vsnprintf(buff, (size_t) n + 1, format, args);
+    if (writer->write(writer, buff, (size_t) n) != 0)
+        writer->error = 1;
+
+    free(buff);
+
+    return writer->error ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Append formatted output
+//------------------------------------------------------------------------------
+int
+mbus_writer_printf(mbus_writer *writer, const char *format, ...)
+{
+    va_list args;
+    int ret;
+
+    if (writer == NULL || format == NULL)
+        return -1;
+
+    va_start(args, format);
+    ret = mbus_writer_vprintf(writer, format, args);
+    va_end(args);
+
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+/// Append a string, encoded for the output format
+//------------------------------------------------------------------------------
+static int
+mbus_writer_put_encoded(mbus_writer *writer, const char *str)
+{
+    const unsigned char *src = (const unsigned char *) str;
+    const char *entity;
+
+    if (writer->error)
+        return -1;
+
+    if (src == NULL)
+        return 0;
+
+    for (; *src; src++)
+    {
+        // at most 6 bytes per character
+        if (writer->len + 6 >= writer->size && mbus_writer_reserve(writer, 6) != 0)
+            return -1;
+
+        entity = NULL;
+
+        if (iscntrl(*src))
+        {
+            // convert all control chars into spaces
+            writer->buff[writer->len++] = ' ';
+            continue;
+        }
+
+        if (writer->format == MBUS_WRITER_FORMAT_JSON)
+        {
+            if (*src == '"')
+                entity = "\\\"";
+            else if (*src == '\\')
+                entity = "\\\\";
+            else if (*src >= 0x80)
+            {
+                // the strings are ISO-8859-1, JSON is UTF-8
+                writer->buff[writer->len++] = (char) (0xC0 | (*src >> 6));
+                writer->buff[writer->len++] = (char) (0x80 | (*src & 0x3F));
+                continue;
+            }
+        }
+        else
+        {
+            switch (*src)
+            {
+                case '&':
+                    entity = "&amp;";
+                    break;
+                case '<':
+                    entity = "&lt;";
+                    break;
+                case '>':
+                    entity = "&gt;";
+                    break;
+                case '"':
+                    entity = "&quot;";
+                    break;
+            }
+        }
 
-            default:
-                return -5;
+        if (entity)
+        {
+            while (*entity)
+                writer->buff[writer->len++] = *entity++;
+        }
+        else
+        {
+            writer->buff[writer->len++] = (char) *src;
         }
     }
 
-    return -1;
+    return 0;
 }
 
-
 //------------------------------------------------------------------------------
-/// pack the data stuctures into frame->data
+/// Start a document (<MBusData>)
 //------------------------------------------------------------------------------
 int
-mbus_frame_internal_pack(mbus_frame *frame, mbus_frame_data *frame_data)
+mbus_writer_document_begin(mbus_writer *writer)
 {
-    mbus_data_record *record;
-    int j;
-
-    if (frame == NULL || frame_data == NULL)
+    if (writer == NULL)
         return -1;
 
-    frame->data_size = 0;
-
-    switch (frame_data->type)
-    {
-        case MBUS_DATA_TYPE_ERROR:
-
-            frame->data[frame->data_size++] = (char) frame_data->error;
-
-            break;
+    writer->members = 0;
+    writer->fields = 0;
+    writer->records = 0;
 
-        case MBUS_DATA_TYPE_FIXED:
+    if (writer->format == MBUS_WRITER_FORMAT_JSON)
+        return mbus_writer_puts(writer, "{\"MBusData\":{");
 
-            //
-            // pack fixed data structure
-            //
-            frame->data[frame->data_size++] = frame_data->data_fix.id_bcd[0];
-            frame->data[frame->data_size++] = frame_data->data_fix.id_bcd[1];
-            frame->data[frame->data_size++] = frame_data->data_fix.id_bcd[2];
-            frame->data[frame->data_size++] = frame_data->data_fix.id_bcd[3];
-            frame->data[frame->data_size++] = frame_data->data_fix.tx_cnt;
-            frame->data[frame->data_size++] = frame_data->data_fix.status;
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_type;
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_type;
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_val[0];
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_val[1];
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_val[2];
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt1_val[3];
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_val[0];
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_val[1];
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_val[2];
-            frame->data[frame->data_size++] = frame_data->data_fix.cnt2_val[3];
+    return mbus_writer_puts(writer, MBUS_XML_PROCESSING_INSTRUCTION "<MBusData>\n\n");
+}
 
-            break;
+//------------------------------------------------------------------------------
+/// Finish a document
+//------------------------------------------------------------------------------
+int
+mbus_writer_document_end(mbus_writer *writer)
+{
+    if (writer == NULL)
+        return -1;
 
-        case MBUS_DATA_TYPE_VARIABLE:
+    if (writer->format == MBUS_WRITER_FORMAT_JSON)
+        return mbus_writer_puts(writer, (writer->records > 0) ? "]}}\n" : "}}\n");
 
-            //
-            // first pack variable data structure header
-            //
-            frame->data[frame->data_size++] = frame_data->data_var.header.id_bcd[0];
-            frame->data[frame->data_size++] = frame_data->data_var.header.id_bcd[1];
-            frame->data[frame->data_size++] = frame_data->data_var.header.id_bcd[2];
-            frame->data[frame->data_size++] = frame_data->data_var.header.id_bcd[3];
-            frame->data[frame->data_size++] = frame_data->data_var.header.manufacturer[0];
-            frame->data[frame->data_size++] = frame_data->data_var.header.manufacturer[1];
-            frame->data[frame->data_size++] = frame_data->data_var.header.version;
-            frame->data[frame->data_size++] = frame_data->data_var.header.medium;
-            frame->data[frame->data_size++] = frame_data->data_var.header.access_no;
-            frame->data[frame->data_size++] = frame_data->data_var.header.status;
-            frame->data[frame->data_size++] = frame_data->data_var.header.signature[0];
-            frame->data[frame->data_size++] = frame_data->data_var.header.signature[1];
+    return mbus_writer_puts(writer, "</MBusData>\n");
+}
 
-            //
-            // pack all data records
-            //
-            for (record = frame_data->data_var.record; record; record = record->next)
-            {
-                // pack DIF
-                if (parse_debug)
-                    printf("%s: packing DIF [%zu]", __PRETTY_FUNCTION__, frame->data_size);
-                frame->data[frame->data_size++] = record->drh.dib.dif;
-                for (j = 0; j < record->drh.dib.ndife; j++)
-                {
-                    frame->data[frame->data_size++] = record->drh.dib.dife[j];
-                }
+//------------------------------------------------------------------------------
+/// Start an object of the document. Objects with an id >= 0 are records
+/// (frame is only written if >= 0), in JSON they form an array that has to
+/// be the last member of the document.
+//------------------------------------------------------------------------------
+int
+mbus_writer_object_begin(mbus_writer *writer, const char *name, int id, int frame)
+{
+    if (writer == NULL || name == NULL)
+        return -1;
 
-                // pack VIF
-                if (parse_debug)
-                    printf("%s: packing VIF [%zu]", __PRETTY_FUNCTION__, frame->data_size);
-                frame->data[frame->data_size++] = record->drh.vib.vif;
-                for (j = 0; j < record->drh.vib.nvife; j++)
-                {
-                    frame->data[frame->data_size++] = record->drh.vib.vife[j];
-                }
+    if (writer->format == MBUS_WRITER_FORMAT_JSON)
+    {
+        if (id < 0)
+            mbus_writer_printf(writer, "%s\"%s\":{", writer->members++ ? "," : "", name);
+        else if (writer->records++ == 0)
+            mbus_writer_printf(writer, "%s\"%s\":[{", writer->members++ ? "," : "", name);
+        else
+            mbus_writer_puts(writer, ",{");
 
-                // pack data
-                if (parse_debug)
-                    printf("%s: packing data [%zu : %zu]", __PRETTY_FUNCTION__, frame->data_size, record->data_len);
-                for (j = 0; j < record->data_len; j++)
-                {
-                    frame->data[frame->data_size++] = record->data[j];
-                }
-            }
+        writer->fields = 0;
 
-            break;
+        if (id >= 0)
+            mbus_writer_field_printf(writer, "id", 0, "%d", id);
 
-        default:
-            return -2;
+        if (id >= 0 && frame >= 0)
+            mbus_writer_field_printf(writer, "frame", 0, "%d", frame);
+    }
+    else if (id < 0)
+    {
+        mbus_writer_printf(writer, "    <%s>\n", name);
+    }
+    else if (frame < 0)
+    {
+        mbus_writer_printf(writer, "    <%s id=\"%d\">\n", name, id);
+    }
+    else
+    {
+        mbus_writer_printf(writer, "    <%s id=\"%d\" frame=\"%d\">\n", name, id, frame);
     }
 
-    return 0;
+    return writer->error ? -1 : 0;
 }
 
 //------------------------------------------------------------------------------
-//
-// Print/Dump functions
-//
-//------------------------------------------------------------------------------
-
-//------------------------------------------------------------------------------
-/// Switch parse debugging
+/// Finish an object of the document
 //------------------------------------------------------------------------------
-void
-mbus_parse_set_debug(int debug)
+int
+mbus_writer_object_end(mbus_writer *writer, const char *name)
 {
-    parse_debug = debug;
+    if (writer == NULL || name == NULL)
+        return -1;
+
+    if (writer->format == MBUS_WRITER_FORMAT_JSON)
+        return mbus_writer_puts(writer, "}");
+
+    return mbus_writer_printf(writer, "    </%s>\n\n", name);
 }
 
 //------------------------------------------------------------------------------
-/// Dump frame in HEX on standard output
+/// Write a string field of the current object
 //------------------------------------------------------------------------------
 int
-mbus_frame_print(mbus_frame *frame)
+mbus_writer_field(mbus_writer *writer, const char *name, const char *value)
 {
-    mbus_frame *iter;
-    unsigned char data_buff[256];
-    int len, i;
-
-    if (frame == NULL)
+    if (writer == NULL || name == NULL)
         return -1;
 
-    for (iter = frame; iter; iter = iter->next)
+    if (writer->format == MBUS_WRITER_FORMAT_JSON)
     {
-        if ((len = mbus_frame_pack(iter, data_buff, sizeof(data_buff))) == -1)
-        {
-            return -2;
-        }
-
-        printf("%s: Dumping M-Bus frame [type %d, %d bytes]: ", __PRETTY_FUNCTION__, iter->type, len);
-        for (i = 0; i < len; i++)
-        {
-            printf("%.2X ", data_buff[i]);
-        }
-        printf("\n");
+        mbus_writer_printf(writer, "%s\"%s\":\"", writer->fields++ ? "," : "", name);
+        mbus_writer_put_encoded(writer, value);
+        mbus_writer_puts(writer, "\"");
+    }
+    else
+    {
+        mbus_writer_printf(writer, "        <%s>", name);
+        mbus_writer_put_encoded(writer, value);
+        mbus_writer_printf(writer, "</%s>\n", name);
     }
 
-    return 0;
+    return writer->error ? -1 : 0;
 }
 
 //------------------------------------------------------------------------------
-///
-/// Print the data part of a frame.
-///
+/// Write a formatted field of the current object. The value is not encoded,
+/// quoted selects a JSON string instead of a number.
 //------------------------------------------------------------------------------
 int
-mbus_frame_data_print(mbus_frame_data *data)
+mbus_writer_field_printf(mbus_writer *writer, const char *name, int quoted, const char *format, ...)
 {
-    if (data)
-    {
-        if (data->type == MBUS_DATA_TYPE_ERROR)
-        {
-            return mbus_data_error_print(data->error);
-        }
+    va_list args;
 
-        if (data->type == MBUS_DATA_TYPE_FIXED)
-        {
-            return mbus_data_fixed_print(&(data->data_fix));
-        }
+    if (writer == NULL || name == NULL || format == NULL)
+        return -1;
 
-        if (data->type == MBUS_DATA_TYPE_VARIABLE)
-        {
-            return mbus_data_variable_print(&(data->data_var));
-        }
+    if (writer->format == MBUS_WRITER_FORMAT_JSON)
+        mbus_writer_printf(writer, "%s\"%s\":%s", writer->fields++ ? "," : "", name, quoted ? "\"" : "");
+    else
+        mbus_writer_printf(writer, "        <%s>", name);
+
+    va_start(args, format);
+    mbus_writer_vprintf(writer, format, args);
+    va_end(args);
+
+    if (writer->format == MBUS_WRITER_FORMAT_JSON)
+    {
+        if (quoted)
+            mbus_writer_puts(writer, "\"");
+    }
+    else
+    {
+        mbus_writer_printf(writer, "</%s>\n", name);
     }
 
-    return -1;
+    return writer->error ? -1 : 0;
 }
 
 //------------------------------------------------------------------------------
-/// Print M-bus frame info to stdout
+/// Write the variable-length data header
 //------------------------------------------------------------------------------
 int
-mbus_data_variable_header_print(mbus_data_variable_header *header)
+mbus_data_variable_header_write(mbus_writer *writer, mbus_data_variable_header *header)
 {
-    if (header)
-    {
-        printf("%s: ID           = %llX\n", __PRETTY_FUNCTION__,
-               mbus_data_bcd_decode_hex(header->id_bcd, 4));
+    char lookup[256];
 
-        printf("%s: Manufacturer = 0x%.2X%.2X\n", __PRETTY_FUNCTION__,
-               header->manufacturer[1], header->manufacturer[0]);
+    if (writer == NULL)
+        return -1;
 
-        printf("%s: Manufacturer = %s\n", __PRETTY_FUNCTION__,
-               mbus_decode_manufacturer(header->manufacturer[0], header->manufacturer[1]));
+    if (header == NULL)
+        return 0;
 
-        printf("%s: Version      = 0x%.2X\n", __PRETTY_FUNCTION__, header->version);
-        printf("%s: Medium       = %s (0x%.2X)\n", __PRETTY_FUNCTION__, mbus_data_variable_medium_lookup(header->medium), header->medium);
-        printf("%s: Access #     = 0x%.2X\n", __PRETTY_FUNCTION__, header->access_no);
-        printf("%s: Status       = 0x%.2X\n", __PRETTY_FUNCTION__, header->status);
-        printf("%s: Signature    = 0x%.2X%.2X\n", __PRETTY_FUNCTION__,
-               header->signature[1], header->signature[0]);
+    mbus_writer_object_begin(writer, "SlaveInformation", -1, -1);
 
-    }
+    mbus_writer_field_printf(writer, "Id", 1, "%llX", mbus_data_bcd_decode_hex(header->id_bcd, 4));
+    mbus_writer_field(writer, "Manufacturer",
+                      mbus_decode_manufacturer_r(header->manufacturer[0], header->manufacturer[1], lookup, sizeof(lookup)));
+    mbus_writer_field_printf(writer, "Version", 0, "%d", header->version);
+    mbus_writer_field(writer, "ProductName", mbus_data_product_name(header));
+    mbus_writer_field(writer, "Medium", mbus_data_variable_medium_lookup_r(header->medium, lookup, sizeof(lookup)));
+    mbus_writer_field_printf(writer, "AccessNumber", 0, "%d", header->access_no);
+    mbus_writer_field_printf(writer, "Status", 1, "%.2X", header->status);
+    mbus_writer_field_printf(writer, "Signature", 1, "%.2X%.2X", header->signature[1], header->signature[0]);
 
-    return -1;
+    return mbus_writer_object_end(writer, "SlaveInformation");
 }
 
+//------------------------------------------------------------------------------
+/// Write a single variable-length data record
+//------------------------------------------------------------------------------
 int
-mbus_data_variable_print(mbus_data_variable *data)
+mbus_data_variable_record_write(mbus_writer *writer, mbus_data_record *record, int record_cnt, int frame_cnt,
+                                mbus_data_variable_header *header)
 {
-    mbus_data_record *record;
-    size_t j;
-    int i;
+    char value[768];
+    struct tm timeinfo;
+    char timestamp[22];
+    long tariff;
 
-    if (data)
-    {
-        mbus_data_variable_header_print(&(data->header));
+    if (writer == NULL)
+        return -1;
 
-        for (record = data->record, i = 0; record; record = record->next, i++)
-        {
-            printf("Record ID         = %d\n", i);
-            // DIF
-            printf("DIF               = %.2X\n", record->drh.dib.dif);
-            printf("DIF.Extension     = %s\n",  (record->drh.dib.dif & MBUS_DIB_DIF_EXTENSION_BIT) ? "Yes":"No");
-            printf("DIF.StorageNumber = %d\n",  (record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_STORAGE_NO) >> 6);
-            printf("DIF.Function      = %s\n",  (record->drh.dib.dif & 0x30) ? "Value during error state" : "Instantaneous value" );
-            printf("DIF.Data          = %.2X\n", record->drh.dib.dif & 0x0F);
+    if (record == NULL)
+        return 0;
 
-            // VENDOR SPECIFIC
-            if ((record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) ||
-                (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)) //MBUS_DIB_DIF_VENDOR_SPECIFIC
-            {
-                printf("%s: VENDOR DATA [size=%zu] = ", __PRETTY_FUNCTION__, record->data_len);
-                for (j = 0; j < record->data_len; j++)
-                {
-                    printf("%.2X ", record->data[j]);
-                }
-                printf("\n");
+    mbus_writer_object_begin(writer, "DataRecord", record_cnt, frame_cnt);
+
+    if (record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) // MBUS_DIB_DIF_VENDOR_SPECIFIC
+    {
+        mbus_writer_field(writer, "Function", "Manufacturer specific");
+    }
+    else if (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
+    {
+        mbus_writer_field(writer, "Function", "More records follow");
+    }
+    else
+    {
+        mbus_writer_field(writer, "Function", mbus_data_record_function(record));
+        mbus_writer_field_printf(writer, "StorageNumber", 0, "%ld", mbus_data_record_storage_number(record));
 
-                if (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
-                {
-                  printf("%s: More records follow in next telegram\n", __PRETTY_FUNCTION__);
-                }
-                continue;
-            }
+        if ((tariff = mbus_data_record_tariff(record)) >= 0)
+        {
+            mbus_writer_field_printf(writer, "Tariff", 0, "%ld", tariff);
+            mbus_writer_field_printf(writer, "Device", 0, "%d", mbus_data_record_device(record));
+        }
 
-            // calculate length of data record
-            printf("DATA LENGTH = %zu\n", record->data_len);
+        mbus_writer_field(writer, "Unit", mbus_data_record_unit_r(record, value, sizeof(value)));
+    }
 
-            // DIFE
-            for (j = 0; j < record->drh.dib.ndife; j++)
-            {
-                unsigned char dife = record->drh.dib.dife[j];
+    mbus_writer_field(writer, "Value", mbus_data_record_value_r(record, value, sizeof(value)));
 
-                printf("DIFE[%zu]               = %.2X\n", j,  dife);
-                printf("DIFE[%zu].Extension     = %s\n",   j, (dife & MBUS_DATA_RECORD_DIFE_MASK_EXTENSION) ? "Yes" : "No");
-                printf("DIFE[%zu].Device        = %d\n",   j, (dife & MBUS_DATA_RECORD_DIFE_MASK_DEVICE) >> 6 );
-                printf("DIFE[%zu].Tariff        = %d\n",   j, (dife & MBUS_DATA_RECORD_DIFE_MASK_TARIFF) >> 4 );
-                printf("DIFE[%zu].StorageNumber = %.2X\n", j,  dife & MBUS_DATA_RECORD_DIFE_MASK_STORAGE_NO);
-            }
+    if (record->timestamp > 0)
+    {
+        gmtime_r(&(record->timestamp), &timeinfo);
+        strftime(timestamp,21,"%Y-%m-%dT%H:%M:%SZ",&timeinfo);
+        mbus_writer_field(writer, "Timestamp", timestamp);
+    }
 
-            // VIF
-            printf("VIF           = %.2X\n", record->drh.vib.vif);
-            printf("VIF.Extension = %s\n",  (record->drh.vib.vif & MBUS_DIB_VIF_EXTENSION_BIT) ? "Yes":"No");
-            printf("VIF.Value     = %.2X\n", record->drh.vib.vif & MBUS_DIB_VIF_WITHOUT_EXTENSION);
+    return mbus_writer_object_end(writer, "DataRecord");
+}
 
-            // VIFE
-            for (j = 0; j < record->drh.vib.nvife; j++)
-            {
-                unsigned char vife = record->drh.vib.vife[j];
+//------------------------------------------------------------------------------
+/// Write a document for variable-length data
+//------------------------------------------------------------------------------
+int
+mbus_data_variable_write(mbus_writer *writer, mbus_data_variable *data)
+{
+    mbus_data_record *record;
+    int i;
 
-                printf("VIFE[%zu]           = %.2X\n", j,  vife);
-                printf("VIFE[%zu].Extension = %s\n",   j, (vife & MBUS_DIB_VIF_EXTENSION_BIT) ? "Yes" : "No");
-                printf("VIFE[%zu].Value     = %.2X\n", j,  vife & MBUS_DIB_VIF_WITHOUT_EXTENSION);
-            }
+    if (writer == NULL || data == NULL)
+        return -1;
 
-            printf("\n");
-        }
+    mbus_writer_document_begin(writer);
+    mbus_data_variable_header_write(writer, &(data->header));
+
+    for (record = data->record, i = 0; record; record = record->next, i++)
+    {
+        mbus_data_variable_record_write(writer, record, i, -1, &(data->header));
     }
 
-    return -1;
+    return mbus_writer_document_end(writer);
 }
 
+//------------------------------------------------------------------------------
+/// Write a document for fixed-length data
+//------------------------------------------------------------------------------
 int
-mbus_data_fixed_print(mbus_data_fixed *data)
+mbus_data_fixed_write(mbus_writer *writer, mbus_data_fixed *data)
 {
     int val;
 
-    if (data)
+    if (writer == NULL || data == NULL)
+        return -1;
+
+    mbus_writer_document_begin(writer);
+
+    mbus_writer_object_begin(writer, "SlaveInformation", -1, -1);
+    mbus_writer_field_printf(writer, "Id", 1, "%llX", mbus_data_bcd_decode_hex(data->id_bcd, 4));
+    mbus_writer_field(writer, "Medium", mbus_data_fixed_medium(data));
+    mbus_writer_field_printf(writer, "AccessNumber", 0, "%d", data->tx_cnt);
+    mbus_writer_field_printf(writer, "Status", 1, "%.2X", data->status);
+    mbus_writer_object_end(writer, "SlaveInformation");
+
+    mbus_writer_object_begin(writer, "DataRecord", 0, -1);
+    mbus_writer_field(writer, "Function", mbus_data_fixed_function(data->status));
+    mbus_writer_field(writer, "Unit", mbus_data_fixed_unit(data->cnt1_type));
+    if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
     {
-        printf("%s: ID       = %llX\n", __PRETTY_FUNCTION__, mbus_data_bcd_decode_hex(data->id_bcd, 4));
-        printf("%s: Access # = 0x%.2X\n", __PRETTY_FUNCTION__, data->tx_cnt);
-        printf("%s: Status   = 0x%.2X\n", __PRETTY_FUNCTION__, data->status);
-        printf("%s: Function = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_function(data->status));
+        mbus_writer_field_printf(writer, "Value", 1, "%llX", mbus_data_bcd_decode_hex(data->cnt1_val, 4));
+    }
+    else
+    {
+        mbus_data_int_decode(data->cnt1_val, 4, &val);
+        mbus_writer_field_printf(writer, "Value", 1, "%d", val);
+    }
+    mbus_writer_object_end(writer, "DataRecord");
 
-        printf("%s: Medium1  = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_medium(data));
-        printf("%s: Unit1    = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_unit(data->cnt1_type));
-        if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
-        {
-            printf("%s: Counter1 = %llX\n", __PRETTY_FUNCTION__, mbus_data_bcd_decode_hex(data->cnt1_val, 4));
-        }
-        else
+    mbus_writer_object_begin(writer, "DataRecord", 1, -1);
+    mbus_writer_field(writer, "Function", mbus_data_fixed_function(data->status));
+    mbus_writer_field(writer, "Unit", mbus_data_fixed_unit(data->cnt2_type));
+    if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
+    {
+        mbus_writer_field_printf(writer, "Value", 1, "%llX", mbus_data_bcd_decode_hex(data->cnt2_val, 4));
+    }
+    else
+    {
+        mbus_data_int_decode(data->cnt2_val, 4, &val);
+        mbus_writer_field_printf(writer, "Value", 1, "%d", val);
+    }
+    mbus_writer_object_end(writer, "DataRecord");
+
+    return mbus_writer_document_end(writer);
+}
+
+//------------------------------------------------------------------------------
+/// Write a document for a general application error
+//------------------------------------------------------------------------------
+int
+mbus_data_error_write(mbus_writer *writer, int error)
+{
+    char lookup[256];
+
+    if (writer == NULL)
+        return -1;
+
+    mbus_writer_document_begin(writer);
+
+    mbus_writer_object_begin(writer, "SlaveInformation", -1, -1);
+    mbus_writer_field(writer, "Error", mbus_data_error_lookup_r(error, lookup, sizeof(lookup)));
+    mbus_writer_object_end(writer, "SlaveInformation");
+
+    return mbus_writer_document_end(writer);
+}
+
+//------------------------------------------------------------------------------
+/// Write a document for the M-Bus frame data
+//------------------------------------------------------------------------------
+int
+mbus_frame_data_write(mbus_writer *writer, mbus_frame_data *data)
+{
+    if (writer && data)
+    {
+        if (data->type == MBUS_DATA_TYPE_ERROR)
         {
-            mbus_data_int_decode(data->cnt1_val, 4, &val);
-            printf("%s: Counter1 = %d\n", __PRETTY_FUNCTION__, val);
+            return mbus_data_error_write(writer, data->error);
         }
 
-        printf("%s: Medium2  = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_medium(data));
-        printf("%s: Unit2    = %s\n", __PRETTY_FUNCTION__, mbus_data_fixed_unit(data->cnt2_type));
-        if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
+        if (data->type == MBUS_DATA_TYPE_FIXED)
         {
-            printf("%s: Counter2 = %llX\n", __PRETTY_FUNCTION__, mbus_data_bcd_decode_hex(data->cnt2_val, 4));
+            return mbus_data_fixed_write(writer, &(data->data_fix));
         }
-        else
+
+        if (data->type == MBUS_DATA_TYPE_VARIABLE)
         {
-            mbus_data_int_decode(data->cnt2_val, 4, &val);
-            printf("%s: Counter2 = %d\n", __PRETTY_FUNCTION__, val);
+            return mbus_data_variable_write(writer, &(data->data_var));
         }
     }
 
     return -1;
 }
 
-void
-mbus_hex_dump(const char *label, const char *buff, size_t len)
+//------------------------------------------------------------------------------
+/// Write a document for a M-Bus frame, or a sequence of variable data frames
+/// chained by next (multi-telegram transfer).
+//------------------------------------------------------------------------------
+int
+mbus_frame_write(mbus_writer *writer, mbus_frame *frame)
 {
-    time_t rawtime;
-    struct tm * timeinfo;
-    char timestamp[22];
-    size_t i;
+    mbus_frame_data frame_data;
+    mbus_frame *iter;
+    mbus_data_record *record;
+    int record_cnt = 0, frame_cnt;
 
-    if (label == NULL || buff == NULL)
-        return;
+    if (writer == NULL || frame == NULL)
+        return -1;
 
-    time ( &rawtime );
-    timeinfo = gmtime ( &rawtime );
+    memset((void *)&frame_data, 0, sizeof(mbus_frame_data));
 
-    strftime(timestamp,21,"%Y-%m-%d %H:%M:%SZ",timeinfo);
-    fprintf(stderr, "[%s] %s (%03zu):", timestamp, label, len);
+    if (mbus_frame_data_parse(frame, &frame_data) == -1)
+    {
+        mbus_error_str_set("M-bus data parse error.");
+        return -1;
+    }
 
-    for (i = 0; i < len; i++)
+    if (frame_data.type != MBUS_DATA_TYPE_VARIABLE)
     {
-       fprintf(stderr, " %02X", (unsigned char) buff[i]);
+        return mbus_frame_data_write(writer, &frame_data);
     }
 
-    fprintf(stderr, "\n");
-}
+    // include frame counter in the output if more than one frame
+    // is available (frame_cnt = -1 => not included in output)
+    frame_cnt = (frame->next == NULL) ? -1 : 0;
 
-int
-mbus_data_error_print(int error)
-{
-    printf("%s: Error = %d\n", __PRETTY_FUNCTION__, error);
+    mbus_writer_document_begin(writer);
 
-    return -1;
-}
+    // only write the header info for the first frame (should be
+    // the same for each frame in a sequence of a multi-telegram
+    // transfer.
+    mbus_data_variable_header_write(writer, &(frame_data.data_var.header));
+
+    for (iter = frame; iter; iter = iter->next)
+    {
+        if (iter != frame && mbus_frame_data_parse(iter, &frame_data) == -1)
+        {
+            mbus_error_str_set("M-bus variable data parse error.");
+            return -1;
+        }
 
+        // loop through all records in the current frame, using a global
+        // record count as record ID in the output
+        for (record = frame_data.data_var.record; record; record = record->next, record_cnt++)
+        {
+            mbus_data_variable_record_write(writer, record, record_cnt, frame_cnt, &(frame_data.data_var.header));
+        }
+
+        // free all records in the list
+        if (frame_data.data_var.record)
+        {
+            mbus_data_record_free(frame_data.data_var.record);
+            frame_data.data_var.record = NULL;
+        }
+
+        if (frame_cnt >= 0)
+            frame_cnt++;
+    }
+
+    return mbus_writer_document_end(writer);
+}
 
 //------------------------------------------------------------------------------
 //
@@ -4555,258 +6821,90 @@ mbus_str_xml_encode(unsigned char *dst, const unsigned char *src, size_t max_len
             }
         }
 
-        i++;
-    }
-
-    dst[len] = '\0';
-    return 0;
-}
-
-//------------------------------------------------------------------------------
-/// Generate XML for the variable-length data header
-//------------------------------------------------------------------------------
-char *
-mbus_data_variable_header_xml(mbus_data_variable_header *header)
-{
-    static char buff[8192];
-    char str_encoded[768];
-    size_t len = 0;
-
-    if (header)
-    {
-        len += snprintf(&buff[len], sizeof(buff) - len, "    <SlaveInformation>\n");
-
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <Id>%llX</Id>\n", mbus_data_bcd_decode_hex(header->id_bcd, 4));
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <Manufacturer>%s</Manufacturer>\n",
-                mbus_decode_manufacturer(header->manufacturer[0], header->manufacturer[1]));
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <Version>%d</Version>\n", header->version);
-
-        mbus_str_xml_encode(str_encoded, mbus_data_product_name(header), sizeof(str_encoded));
-
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <ProductName>%s</ProductName>\n", str_encoded);
-
-        mbus_str_xml_encode(str_encoded, mbus_data_variable_medium_lookup(header->medium), sizeof(str_encoded));
-
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <Medium>%s</Medium>\n", str_encoded);
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <AccessNumber>%d</AccessNumber>\n", header->access_no);
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <Status>%.2X</Status>\n", header->status);
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <Signature>%.2X%.2X</Signature>\n", header->signature[1], header->signature[0]);
-
-        len += snprintf(&buff[len], sizeof(buff) - len, "    </SlaveInformation>\n\n");
-
-        return buff;
-    }
-
-    return "";
-}
-
-//------------------------------------------------------------------------------
-/// Generate XML for a single variable-length data record
-//------------------------------------------------------------------------------
-char *
-mbus_data_variable_record_xml(mbus_data_record *record, int record_cnt, int frame_cnt, mbus_data_variable_header *header)
-{
-    static char buff[8192];
-    char str_encoded[768];
-    size_t len = 0;
-    struct tm * timeinfo;
-    char timestamp[22];
-    long tariff;
-
-    if (record)
-    {
-        if (frame_cnt >= 0)
-        {
-            len += snprintf(&buff[len], sizeof(buff) - len,
-                            "    <DataRecord id=\"%d\" frame=\"%d\">\n",
-                            record_cnt, frame_cnt);
-        }
-        else
-        {
-            len += snprintf(&buff[len], sizeof(buff) - len,
-                            "    <DataRecord id=\"%d\">\n", record_cnt);
-        }
-
-        if (record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) // MBUS_DIB_DIF_VENDOR_SPECIFIC
-        {
-            len += snprintf(&buff[len], sizeof(buff) - len,
-                            "        <Function>Manufacturer specific</Function>\n");
-        }
-        else if (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW)
-        {
-            len += snprintf(&buff[len], sizeof(buff) - len,
-                            "        <Function>More records follow</Function>\n");
-        }
-        else
-        {
-            mbus_str_xml_encode(str_encoded, mbus_data_record_function(record), sizeof(str_encoded));
-            len += snprintf(&buff[len], sizeof(buff) - len,
-                            "        <Function>%s</Function>\n", str_encoded);
-
-            len += snprintf(&buff[len], sizeof(buff) - len,
-                            "        <StorageNumber>%ld</StorageNumber>\n",
-                            mbus_data_record_storage_number(record));
-
-            if ((tariff = mbus_data_record_tariff(record)) >= 0)
-            {
-                len += snprintf(&buff[len], sizeof(buff) - len, "        <Tariff>%ld</Tariff>\n",
-                                tariff);
-                len += snprintf(&buff[len], sizeof(buff) - len, "        <Device>%d</Device>\n",
-                                mbus_data_record_device(record));
-            }
-
-            mbus_str_xml_encode(str_encoded, mbus_data_record_unit(record), sizeof(str_encoded));
-            len += snprintf(&buff[len], sizeof(buff) - len,
-                            "        <Unit>%s</Unit>\n", str_encoded);
-        }
-
-        mbus_str_xml_encode(str_encoded, mbus_data_record_value(record), sizeof(str_encoded));
-        len += snprintf(&buff[len], sizeof(buff) - len, "        <Value>%s</Value>\n", str_encoded);
-
-        if (record->timestamp > 0)
-        {
-            timeinfo = gmtime (&(record->timestamp));
-            strftime(timestamp,21,"%Y-%m-%dT%H:%M:%SZ",timeinfo);
-            len += snprintf(&buff[len], sizeof(buff) - len,
-                            "        <Timestamp>%s</Timestamp>\n", timestamp);
-        }
-
-        len += snprintf(&buff[len], sizeof(buff) - len, "    </DataRecord>\n\n");
-
-        return buff;
-    }
-
-    return "";
-}
-
-//------------------------------------------------------------------------------
-/// Generate XML for variable-length data
-//------------------------------------------------------------------------------
-char *
-mbus_data_variable_xml(mbus_data_variable *data)
-{
-    mbus_data_record *record;
-    char *buff = NULL, *new_buff;
-    size_t len = 0, buff_size = 8192;
-    int i;
-
-    if (data)
-    {
-        buff = (char*) malloc(buff_size);
-
-        if (buff == NULL)
-            return NULL;
-
-        len += snprintf(&buff[len], buff_size - len, MBUS_XML_PROCESSING_INSTRUCTION);
-
-        len += snprintf(&buff[len], buff_size - len, "<MBusData>\n\n");
-
-        len += snprintf(&buff[len], buff_size - len, "%s",
-                        mbus_data_variable_header_xml(&(data->header)));
-
-        for (record = data->record, i = 0; record; record = record->next, i++)
-        {
-            if ((buff_size - len) < 1024)
-            {
-                buff_size *= 2;
-                new_buff = (char*) realloc(buff,buff_size);
-
-                if (new_buff == NULL)
-                {
-                    free(buff);
-                    return NULL;
-                }
-
-                buff = new_buff;
-            }
-
-            len += snprintf(&buff[len], buff_size - len, "%s",
-                            mbus_data_variable_record_xml(record, i, -1, &(data->header)));
-        }
-        len += snprintf(&buff[len], buff_size - len, "</MBusData>\n");
-
-        return buff;
+        i++;
     }
 
-    return NULL;
+    dst[len] = '\0';
+    return 0;
 }
 
 //------------------------------------------------------------------------------
-/// Generate XML representation of fixed-length frame.
+/// Generate XML for the variable-length data header
 //------------------------------------------------------------------------------
 char *
-mbus_data_fixed_xml(mbus_data_fixed *data)
+mbus_data_variable_header_xml_r(mbus_data_variable_header *header, char *buff, size_t buff_size)
 {
-    char *buff = NULL;
-    char str_encoded[256];
-    size_t len = 0, buff_size = 8192;
-    int val;
-
-    if (data)
-    {
-        buff = (char*) malloc(buff_size);
+    mbus_writer writer;
 
-        if (buff == NULL)
-            return NULL;
+    mbus_writer_init_static(&writer, buff, buff_size);
+    mbus_data_variable_header_write(&writer, header);
 
-        len += snprintf(&buff[len], buff_size - len, MBUS_XML_PROCESSING_INSTRUCTION);
+    buff[writer.len] = '\0';
+    return buff;
+}
 
-        len += snprintf(&buff[len], buff_size - len, "<MBusData>\n\n");
+char *
+mbus_data_variable_header_xml(mbus_data_variable_header *header)
+{
+    static char buff[8192];
 
-        len += snprintf(&buff[len], buff_size - len, "    <SlaveInformation>\n");
-        len += snprintf(&buff[len], buff_size - len, "        <Id>%llX</Id>\n", mbus_data_bcd_decode_hex(data->id_bcd, 4));
+    return mbus_data_variable_header_xml_r(header, buff, sizeof(buff));
+}
 
-        mbus_str_xml_encode(str_encoded, mbus_data_fixed_medium(data), sizeof(str_encoded));
-        len += snprintf(&buff[len], buff_size - len, "        <Medium>%s</Medium>\n", str_encoded);
+//------------------------------------------------------------------------------
+/// Generate XML for a single variable-length data record
+//------------------------------------------------------------------------------
+char *
+mbus_data_variable_record_xml_r(mbus_data_record *record, int record_cnt, int frame_cnt, mbus_data_variable_header *header,
+                                char *buff, size_t buff_size)
+{
+    mbus_writer writer;
 
-        len += snprintf(&buff[len], buff_size - len, "        <AccessNumber>%d</AccessNumber>\n", data->tx_cnt);
-        len += snprintf(&buff[len], buff_size - len, "        <Status>%.2X</Status>\n", data->status);
-        len += snprintf(&buff[len], buff_size - len, "    </SlaveInformation>\n\n");
+    mbus_writer_init_static(&writer, buff, buff_size);
+    mbus_data_variable_record_write(&writer, record, record_cnt, frame_cnt, header);
 
-        len += snprintf(&buff[len], buff_size - len, "    <DataRecord id=\"0\">\n");
+    buff[writer.len] = '\0';
+    return buff;
+}
 
-        mbus_str_xml_encode(str_encoded, mbus_data_fixed_function(data->status), sizeof(str_encoded));
-        len += snprintf(&buff[len], buff_size - len, "        <Function>%s</Function>\n", str_encoded);
+char *
+mbus_data_variable_record_xml(mbus_data_record *record, int record_cnt, int frame_cnt, mbus_data_variable_header *header)
+{
+    static char buff[8192];
 
-        mbus_str_xml_encode(str_encoded, mbus_data_fixed_unit(data->cnt1_type), sizeof(str_encoded));
-        len += snprintf(&buff[len], buff_size - len, "        <Unit>%s</Unit>\n", str_encoded);
-        if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
-        {
-            len += snprintf(&buff[len], buff_size - len, "        <Value>%llX</Value>\n", mbus_data_bcd_decode_hex(data->cnt1_val, 4));
-        }
-        else
-        {
-            mbus_data_int_decode(data->cnt1_val, 4, &val);
-            len += snprintf(&buff[len], buff_size - len, "        <Value>%d</Value>\n", val);
-        }
+    return mbus_data_variable_record_xml_r(record, record_cnt, frame_cnt, header, buff, sizeof(buff));
+}
 
-        len += snprintf(&buff[len], buff_size - len, "    </DataRecord>\n\n");
+//------------------------------------------------------------------------------
+/// Generate XML for variable-length data
+//------------------------------------------------------------------------------
+char *
+mbus_data_variable_xml(mbus_data_variable *data)
+{
+    mbus_writer writer;
 
-        len += snprintf(&buff[len], buff_size - len, "    <DataRecord id=\"1\">\n");
+    if (data == NULL || mbus_writer_init_buffer(&writer, MBUS_WRITER_FORMAT_XML, 0) != 0)
+        return NULL;
 
-        mbus_str_xml_encode(str_encoded, mbus_data_fixed_function(data->status), sizeof(str_encoded));
-        len += snprintf(&buff[len], buff_size - len, "        <Function>%s</Function>\n", str_encoded);
+    mbus_data_variable_write(&writer, data);
 
-        mbus_str_xml_encode(str_encoded, mbus_data_fixed_unit(data->cnt2_type), sizeof(str_encoded));
-        len += snprintf(&buff[len], buff_size - len, "        <Unit>%s</Unit>\n", str_encoded);
-        if ((data->status & MBUS_DATA_FIXED_STATUS_FORMAT_MASK) == MBUS_DATA_FIXED_STATUS_FORMAT_BCD)
-        {
-            len += snprintf(&buff[len], buff_size - len, "        <Value>%llX</Value>\n", mbus_data_bcd_decode_hex(data->cnt2_val, 4));
-        }
-        else
-        {
-            mbus_data_int_decode(data->cnt2_val, 4, &val);
-            len += snprintf(&buff[len], buff_size - len, "        <Value>%d</Value>\n", val);
-        }
+    return mbus_writer_detach(&writer);
+}
 
-        len += snprintf(&buff[len], buff_size - len, "    </DataRecord>\n\n");
+//------------------------------------------------------------------------------
+/// Generate XML representation of fixed-length frame.
+//------------------------------------------------------------------------------
+char *
+mbus_data_fixed_xml(mbus_data_fixed *data)
+{
+    mbus_writer writer;
 
-        len += snprintf(&buff[len], buff_size - len, "</MBusData>\n");
+    if (data == NULL || mbus_writer_init_buffer(&writer, MBUS_WRITER_FORMAT_XML, 0) != 0)
+        return NULL;
 
-        return buff;
-    }
+    mbus_data_fixed_write(&writer, data);
 
-    return NULL;
+    return mbus_writer_detach(&writer);
 }
 
 //------------------------------------------------------------------------------
@@ -4815,28 +6913,14 @@ mbus_data_fixed_xml(mbus_data_fixed *data)
 char *
 mbus_data_error_xml(int error)
 {
-    char *buff = NULL;
-    char str_encoded[256];
-    size_t len = 0, buff_size = 8192;
+    mbus_writer writer;
 
-    buff = (char*) malloc(buff_size);
-
-    if (buff == NULL)
+    if (mbus_writer_init_buffer(&writer, MBUS_WRITER_FORMAT_XML, 0) != 0)
         return NULL;
 
-    len += snprintf(&buff[len], buff_size - len, MBUS_XML_PROCESSING_INSTRUCTION);
-    len += snprintf(&buff[len], buff_size - len, "<MBusData>\n\n");
-
-    len += snprintf(&buff[len], buff_size - len, "    <SlaveInformation>\n");
-
-    mbus_str_xml_encode(str_encoded, mbus_data_error_lookup(error), sizeof(str_encoded));
-    len += snprintf(&buff[len], buff_size - len, "        <Error>%s</Error>\n", str_encoded);
-
-    len += snprintf(&buff[len], buff_size - len, "    </SlaveInformation>\n\n");
+    mbus_data_error_write(&writer, error);
 
-    len += snprintf(&buff[len], buff_size - len, "</MBusData>\n");
-
-    return buff;
+    return mbus_writer_detach(&writer);
 }
 
 //------------------------------------------------------------------------------
@@ -4845,25 +6929,18 @@ mbus_data_error_xml(int error)
 char *
 mbus_frame_data_xml(mbus_frame_data *data)
 {
-    if (data)
-    {
-        if (data->type == MBUS_DATA_TYPE_ERROR)
-        {
-            return mbus_data_error_xml(data->error);
-        }
+    mbus_writer writer;
 
-        if (data->type == MBUS_DATA_TYPE_FIXED)
-        {
-            return mbus_data_fixed_xml(&(data->data_fix));
-        }
+    if (data == NULL || mbus_writer_init_buffer(&writer, MBUS_WRITER_FORMAT_XML, 0) != 0)
+        return NULL;
 
-        if (data->type == MBUS_DATA_TYPE_VARIABLE)
-        {
-            return mbus_data_variable_xml(&(data->data_var));
-        }
+    if (mbus_frame_data_write(&writer, data) != 0)
+    {
+        mbus_writer_free(&writer);
+        return NULL;
     }
 
-    return NULL;
+    return mbus_writer_detach(&writer);
 }
 
 
@@ -4873,145 +6950,18 @@ mbus_frame_data_xml(mbus_frame_data *data)
 char *
 mbus_frame_xml(mbus_frame *frame)
 {
-    mbus_frame_data frame_data;
-    mbus_frame *iter;
-
-    mbus_data_record *record;
-    char *buff = NULL, *new_buff;
+    mbus_writer writer;
 
-    size_t len = 0, buff_size = 8192;
-    int record_cnt = 0, frame_cnt;
+    if (frame == NULL || mbus_writer_init_buffer(&writer, MBUS_WRITER_FORMAT_XML, 0) != 0)
+        return NULL;
 
-    if (frame)
+    if (mbus_frame_write(&writer, frame) != 0)
     {
-        memset((void *)&frame_data, 0, sizeof(mbus_frame_data));
-
-        if (mbus_frame_data_parse(frame, &frame_data) == -1)
-        {
-            mbus_error_str_set("M-bus data parse error.");
-            return NULL;
-        }
-
-        if (frame_data.type == MBUS_DATA_TYPE_ERROR)
-        {
-            //
-            // generate XML for error
-            //
-            return mbus_data_error_xml(frame_data.error);
-        }
-
-        if (frame_data.type == MBUS_DATA_TYPE_FIXED)
-        {
-            //
-            // generate XML for fixed data
-            //
-            return mbus_data_fixed_xml(&(frame_data.data_fix));
-        }
-
-        if (frame_data.type == MBUS_DATA_TYPE_VARIABLE)
-        {
-            //
-            // generate XML for a sequence of variable data frames
-            //
-
-            buff = (char*) malloc(buff_size);
-
-            if (buff == NULL)
-            {
-                mbus_data_record_free(frame_data.data_var.record);
-                return NULL;
-            }
-
-            // include frame counter in XML output if more than one frame
-            // is available (frame_cnt = -1 => not included in output)
-            frame_cnt = (frame->next == NULL) ? -1 : 0;
-
-            len += snprintf(&buff[len], buff_size - len, MBUS_XML_PROCESSING_INSTRUCTION);
-
-            len += snprintf(&buff[len], buff_size - len, "<MBusData>\n\n");
-
-            // only print the header info for the first frame (should be
-            // the same for each frame in a sequence of a multi-telegram
-            // transfer.
-            len += snprintf(&buff[len], buff_size - len, "%s",
-                                    mbus_data_variable_header_xml(&(frame_data.data_var.header)));
-
-            // loop through all records in the current frame, using a global
-            // record count as record ID in the XML output
-            for (record = frame_data.data_var.record; record; record = record->next, record_cnt++)
-            {
-                if ((buff_size - len) < 1024)
-                {
-                    buff_size *= 2;
-                    new_buff = (char*) realloc(buff,buff_size);
-
-                    if (new_buff == NULL)
-                    {
-                        free(buff);
-                        mbus_data_record_free(frame_data.data_var.record);
-                        return NULL;
-                    }
-
-                    buff = new_buff;
-                }
-
-                len += snprintf(&buff[len], buff_size - len, "%s",
-                                mbus_data_variable_record_xml(record, record_cnt, frame_cnt, &(frame_data.data_var.header)));
-            }
-
-            // free all records in the list
-            if (frame_data.data_var.record)
-            {
-                mbus_data_record_free(frame_data.data_var.record);
-            }
-
-            frame_cnt++;
-
-            for (iter = frame->next; iter; iter = iter->next, frame_cnt++)
-            {
-                if (mbus_frame_data_parse(iter, &frame_data) == -1)
-                {
-                    mbus_error_str_set("M-bus variable data parse error.");
-                    return NULL;
-                }
-
-                // loop through all records in the current frame, using a global
-                // record count as record ID in the XML output
-                for (record = frame_data.data_var.record; record; record = record->next, record_cnt++)
-                {
-                    if ((buff_size - len) < 1024)
-                    {
-                        buff_size *= 2;
-                        new_buff = (char*) realloc(buff,buff_size);
-
-                        if (new_buff == NULL)
-                        {
-                            free(buff);
-                            mbus_data_record_free(frame_data.data_var.record);
-                            return NULL;
-                        }
-
-                        buff = new_buff;
-                    }
-
-                    len += snprintf(&buff[len], buff_size - len, "%s",
-                                    mbus_data_variable_record_xml(record, record_cnt, frame_cnt, &(frame_data.data_var.header)));
-                }
-
-                // free all records in the list
-                if (frame_data.data_var.record)
-                {
-                    mbus_data_record_free(frame_data.data_var.record);
-                }
-            }
-
-            len += snprintf(&buff[len], buff_size - len, "</MBusData>\n");
-
-            return buff;
-        }
+        mbus_writer_free(&writer);
+        return NULL;
     }
 
-    return NULL;
+    return mbus_writer_detach(&writer);
 }
 
 
@@ -5045,13 +6995,64 @@ mbus_frame_data_free(mbus_frame_data *data)
 {
     if (data)
     {
-        if (data->data_var.record)
+        mbus_frame_pool *pool = data->pool;
+
+        if (data->data_var.record && data->data_var.arena == NULL)
         {
             mbus_data_record_free(data->data_var.record); // free's up the whole list
         }
 
-        free(data);
+        if (pool == NULL)
+        {
+            free(data);
+            return;
+        }
+
+        pool->outstanding--;
+
+        if (!pool->closing && pool->ndata < pool->max_free)
+        {
+            pool->data[pool->ndata++] = data;
+        }
+        else
+        {
+            free(data);
+        }
+
+        mbus_frame_pool_check(pool);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Take a frame data structure from the pool, or from the heap when the pool
+/// is empty. Release it with mbus_frame_data_free.
+//------------------------------------------------------------------------------
+mbus_frame_data *
+mbus_frame_pool_acquire_data(mbus_frame_pool *pool)
+{
+    mbus_frame_data *data;
+
+    if (pool == NULL || pool->closing)
+    {
+        snprintf(error_str, sizeof(error_str), "Invalid frame pool.");
+        return NULL;
+    }
+
+    if (pool->ndata > 0)
+    {
+        data = pool->data[--pool->ndata];
+    }
+    else if ((data = (mbus_frame_data *)malloc(sizeof(mbus_frame_data))) == NULL)
+    {
+        return NULL;
     }
+
+    memset(data, 0, sizeof(mbus_frame_data));
+
+    data->pool = pool;
+    pool->outstanding++;
+
+    return data;
 }
 
 
@@ -5094,7 +7095,7 @@ mbus_data_record_free(mbus_data_record *record)
 }
 
 //------------------------------------------------------------------------------
-/// Return a string containing an XML representation of the M-BUS frame.
+/// Append a record to the record list of variable-length data.
 //------------------------------------------------------------------------------
 void
 mbus_data_record_append(mbus_data_variable *data, mbus_data_record *record)
@@ -5117,15 +7118,116 @@ mbus_data_record_append(mbus_data_variable *data, mbus_data_record *record)
     }
 }
 
+//------------------------------------------------------------------------------
+/// Allocate a record arena with room for size records in one contiguous block
+//------------------------------------------------------------------------------
+mbus_record_arena *
+mbus_record_arena_new(size_t size)
+{
+    mbus_record_arena *arena;
+    mbus_data_record *block;
+
+    if (size == 0)
+    {
+        snprintf(error_str, sizeof(error_str), "Invalid record arena size.");
+        return NULL;
+    }
+
+    if ((arena = (mbus_record_arena *)malloc(sizeof(mbus_record_arena))) == NULL)
+    {
+        return NULL;
+    }
+
+    if ((block = (mbus_data_record *)malloc(size * sizeof(mbus_data_record))) == NULL)
+    {
+        free(arena);
+        return NULL;
+    }
+
+    mbus_record_arena_init(arena, block, size);
+    arena->owned = 1;
+
+    return arena;
+}
+
+//------------------------------------------------------------------------------
+/// Free a record arena allocated with mbus_record_arena_new
+//------------------------------------------------------------------------------
+void
+mbus_record_arena_free(mbus_record_arena *arena)
+{
+    if (arena)
+    {
+        if (arena->owned)
+        {
+            free(arena->records);
+        }
+
+        free(arena);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Initialize a record arena on top of a caller supplied block of records
+//------------------------------------------------------------------------------
+int
+mbus_record_arena_init(mbus_record_arena *arena, mbus_data_record *block, size_t size)
+{
+    if (arena == NULL || block == NULL || size == 0)
+    {
+        snprintf(error_str, sizeof(error_str), "Invalid record arena.");
+        return -1;
+    }
+
+    arena->records = block;
+    arena->size = size;
+    arena->used = 0;
+    arena->owned = 0;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Release all records handed out from the arena
+//------------------------------------------------------------------------------
+void
+mbus_record_arena_reset(mbus_record_arena *arena)
+{
+    if (arena)
+    {
+        arena->used = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Take the next record from the arena, or NULL when it is exhausted
+//------------------------------------------------------------------------------
+mbus_data_record *
+mbus_record_arena_alloc(mbus_record_arena *arena)
+{
+    mbus_data_record *record;
+
+    if (arena == NULL || arena->used >= arena->size)
+    {
+        snprintf(error_str, sizeof(error_str), "Record arena exhausted.");
+        return NULL;
+    }
+
+    record = &(arena->records[arena->used++]);
+
+    memset(record, 0, sizeof(mbus_data_record));
+
+    return record;
+}
+
 //------------------------------------------------------------------------------
 // Extract the secondary address from an M-Bus frame. The secondary address
 // should be a 16 character string comprised of the device ID (4 bytes),
 // manufacturer ID (2 bytes), version (1 byte) and medium (1 byte).
 //------------------------------------------------------------------------------
 char *
-mbus_frame_get_secondary_address(mbus_frame *frame)
+mbus_frame_get_secondary_address_r(mbus_frame *frame, char *addr, size_t addr_size)
 {
-    static char addr[32];
     mbus_frame_data *data;
     unsigned long id;
 
@@ -5152,7 +7254,7 @@ mbus_frame_get_secondary_address(mbus_frame *frame)
 
     id = (unsigned long) mbus_data_bcd_decode_hex(data->data_var.header.id_bcd, 4);
 
-    snprintf(addr, sizeof(addr), "%08lX%02X%02X%02X%02X",
+    snprintf(addr, addr_size, "%08lX%02X%02X%02X%02X",
              id,
              data->data_var.header.manufacturer[0],
              data->data_var.header.manufacturer[1],
@@ -5165,6 +7267,14 @@ mbus_frame_get_secondary_address(mbus_frame *frame)
     return addr;
 }
 
+char *
+mbus_frame_get_secondary_address(mbus_frame *frame)
+{
+    static char addr[32];
+
+    return mbus_frame_get_secondary_address_r(frame, addr, sizeof(addr));
+}
+
 //------------------------------------------------------------------------------
 // Pack a secondary address string into an mbus frame
 //------------------------------------------------------------------------------
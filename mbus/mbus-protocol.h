@@ -21,11 +21,24 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//
+// Storage class for per-thread library state (e.g. the error string), so
+// that frames can be parsed and decoded on several threads at once.
+//
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define MBUS_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define MBUS_THREAD_LOCAL __thread
+#else
+#define MBUS_THREAD_LOCAL
+#endif
+
 //
 // Packet formats:
 //
@@ -72,6 +85,8 @@ extern "C" {
 
 #define MBUS_FRAME_DATA_LENGTH 252
 
+struct _mbus_frame_pool;
+
 typedef struct _mbus_frame {
 
     unsigned char start1;
@@ -95,15 +110,44 @@ typedef struct _mbus_frame {
 
     void *next; // pointer to next mbus_frame for multi-telegram replies
 
+    struct _mbus_frame_pool *pool; // pool the frame was acquired from, NULL for the heap
+
 } mbus_frame;
 
 typedef struct _mbus_slave_data {
 
-    int state_fcb;
-    int state_acd;
+    int state_fcb;                   // FCB of the next request to the slave
+    int state_acd;                   // ACD of the last reply
+
+    int turnaround_samples;          // replies observed for the adaptive timeout
+    long turnaround_us;              // learned reply time, decaying maximum (usec)
 
 } mbus_slave_data;
 
+//
+// Slave state table of a handle, keyed by primary address or by secondary
+// address (the 8 address bytes of the header, as in the selection frame).
+// Open addressing with linear probing, entries are never removed.
+//
+#define MBUS_SLAVE_KEY_PRIMARY   1
+#define MBUS_SLAVE_KEY_SECONDARY 2
+
+typedef struct _mbus_slave_entry {
+
+    uint64_t key;
+    int type;                        // MBUS_SLAVE_KEY_*, zero for a free slot
+    mbus_slave_data data;
+
+} mbus_slave_entry;
+
+typedef struct _mbus_slave_table {
+
+    mbus_slave_entry *entries;
+    size_t size;                     // zero or a power of two
+    size_t count;
+
+} mbus_slave_table;
+
 #define NITEMS(x) (sizeof(x)/sizeof(x[0]))
 
 //
@@ -111,6 +155,7 @@ typedef struct _mbus_slave_data {
 //
 #define MBUS_HANDLE_TYPE_TCP    0
 #define MBUS_HANDLE_TYPE_SERIAL 1
+#define MBUS_HANDLE_TYPE_SIM    2
 
 //
 // Resultcodes for mbus_recv_frame
@@ -120,6 +165,7 @@ typedef struct _mbus_slave_data {
 #define MBUS_RECV_RESULT_INVALID   -2
 #define MBUS_RECV_RESULT_TIMEOUT   -3
 #define MBUS_RECV_RESULT_RESET     -4
+#define MBUS_RECV_RESULT_PENDING    1
 
 //------------------------------------------------------------------------------
 // MBUS FRAME DATA FORMATS
@@ -177,6 +223,22 @@ typedef struct _mbus_data_record {
 
 } mbus_data_record;
 
+//
+// Record arena: a contiguous block of data records that the parser can use
+// instead of allocating every record separately. Records handed out from an
+// arena are released all at once with mbus_record_arena_reset() and must not
+// be passed to mbus_data_record_free().
+//
+typedef struct _mbus_record_arena {
+
+    mbus_data_record *records;
+    size_t size;                     // capacity, in records
+    size_t used;                     // records handed out since last reset
+
+    int owned;                       // block allocated by mbus_record_arena_new
+
+} mbus_record_arena;
+
 //
 // HEADER FOR VARIABLE LENGTH DATA FORMAT
 //
@@ -220,6 +282,9 @@ typedef struct _mbus_data_variable {
     unsigned char *mfg_data;
     size_t  mfg_data_len;
 
+    // arena the records were allocated from, NULL for heap allocated records
+    mbus_record_arena *arena;
+
 } mbus_data_variable;
 
 //
@@ -266,8 +331,192 @@ typedef struct _mbus_frame_data {
     int type;
     int error;
 
+    struct _mbus_frame_pool *pool; // pool the data was acquired from, NULL for the heap
+
 } mbus_frame_data;
 
+//
+// Frame pool: free lists of frames and frame data structures that are reused
+// instead of going back to the heap. mbus_frame_free() and
+// mbus_frame_data_free() return pooled objects to their pool, so the usual
+// lifecycle does not change. At most max_free objects of each kind are kept,
+// the rest is freed. A pool freed while objects are still out is released
+// when the last one comes back.
+//
+typedef struct _mbus_frame_pool {
+
+    mbus_frame *frames;              // free frames, chained through next
+    size_t nframes;
+
+    mbus_frame_data **data;          // free frame data structures
+    size_t ndata;
+
+    size_t max_free;                 // free objects kept of each kind
+    size_t outstanding;              // objects acquired and not yet released
+    char closing;                    // mbus_frame_pool_free was called
+
+} mbus_frame_pool;
+
+//
+// Change detection cache: keeps the decoded data of the last variable data
+// telegrams of every slave, keyed by the secondary address in the header.
+// A telegram is compared by a hash of its user data that leaves out the
+// access number and the contents of date/time records, and on a match byte
+// by byte with the user data kept in the slot. When it equals the cached
+// telegram, the cached data is returned with the access number, the
+// date/time records and the record timestamps updated, without parsing the
+// frame again. Slaves with multi-telegram replies get one slot per record
+// layout.
+//
+#define MBUS_FRAME_CACHE_TELEGRAMS    4  // cached telegrams per slave
+#define MBUS_FRAME_CACHE_TIME_RECORDS 16 // date/time records updated on a hit
+
+// results of mbus_frame_cache_parse
+#define MBUS_FRAME_CACHE_CHANGED      0
+#define MBUS_FRAME_CACHE_UNCHANGED    1
+
+typedef struct _mbus_frame_cache_slot {
+
+    uint64_t layout;                 // hash of the record headers and offsets
+    uint64_t hash;                   // hash of the telegram, zero for a free slot
+    mbus_frame_data *data;
+
+    unsigned char payload[MBUS_FRAME_DATA_LENGTH]; // user data of the telegram
+    size_t payload_len;
+
+    // date/time records, patched from the telegram on a hit
+    mbus_data_record *time_record[MBUS_FRAME_CACHE_TIME_RECORDS];
+    size_t time_offset[MBUS_FRAME_CACHE_TIME_RECORDS];
+    size_t ntime;
+
+} mbus_frame_cache_slot;
+
+typedef struct _mbus_frame_cache_entry {
+
+    uint64_t key;                    // mbus_slave_key_secondary of the header
+    char used;
+    mbus_frame_cache_slot slot[MBUS_FRAME_CACHE_TELEGRAMS];
+    size_t next;                     // slot replaced when all are taken
+
+} mbus_frame_cache_entry;
+
+typedef struct _mbus_frame_cache {
+
+    mbus_frame_cache_entry *entries;
+    size_t size;                     // zero or a power of two
+    size_t count;
+
+    mbus_frame_data scratch;         // fixed and error replies, not cached
+
+    unsigned long hits;
+    unsigned long misses;
+
+} mbus_frame_cache;
+
+//
+// INCREMENTAL FRAME PARSER
+//
+// Received data can be fed to the parser in arbitrary chunks. It keeps the
+// bytes of an incomplete frame between calls and hands out every complete
+// frame, including several frames that arrived back-to-back in one chunk.
+//
+#define MBUS_FRAME_PARSER_BUFF_SIZE 1024
+
+typedef struct _mbus_frame_parser {
+
+    unsigned char buff[MBUS_FRAME_PARSER_BUFF_SIZE];
+    size_t start;                    // first byte not yet consumed
+    size_t len;                      // end of buffered data
+
+    size_t nframes;                  // frames parsed since init
+    size_t nerrors;                  // invalid frames / bytes discarded since init
+
+    // called by mbus_frame_parser_feed for every complete frame
+    void (*frame_event)(struct _mbus_frame_parser *parser, mbus_frame *frame,
+                        const unsigned char *data, size_t data_len);
+    void *userdata;
+
+} mbus_frame_parser;
+
+//
+// READ-ONLY FRAME VIEW
+//
+// A frame view refers to a frame in place in the receive buffer. Nothing is
+// copied: the records are iterated as slices of the user data, and values
+// are only decoded on request.
+//
+typedef struct _mbus_frame_view {
+
+    const unsigned char *buff;       // start of the frame in the receive buffer
+    size_t size;                     // number of bytes occupied by the frame
+
+    int type;
+    unsigned char control;
+    unsigned char address;
+    unsigned char control_information;
+
+    const unsigned char *data;       // user data, points into buff
+    size_t data_size;
+
+} mbus_frame_view;
+
+//
+// One data record of a frame view. All offsets are relative to
+// mbus_frame_view.data.
+//
+typedef struct _mbus_record_view {
+
+    size_t offset;                   // DIF
+
+    unsigned char dif;
+    size_t dife_offset;
+    size_t ndife;
+
+    unsigned char vif;
+    size_t custom_vif_offset;        // only for plain text VIF (0x7C/0xFC)
+    size_t custom_vif_len;
+    size_t vife_offset;
+    size_t nvife;
+
+    size_t data_offset;
+    size_t data_len;
+
+} mbus_record_view;
+
+//
+// Record filter: selects data records by their DIB/VIB before anything is
+// copied or decoded. Set up with mbus_record_filter_init (matches every
+// record), then narrow it down, e.g. energy and volume of the current value:
+//
+//     unsigned char vifs[] = { 0x00, 0x10 };
+//     mbus_record_filter_init(&filter);
+//     filter.vif = vifs; filter.nvif = 2; filter.vif_mask = 0x78;
+//     filter.storage_number = 0; filter.tariff = 0;
+//
+// The quantities of the extension tables (VIF 0xFB and 0xFD) are told apart
+// by their first VIFE, e.g. the voltage of the 0xFD table:
+//
+//     unsigned char vifs[] = { 0xFD };
+//     filter.vif = vifs; filter.nvif = 1;
+//     filter.vife = 0x40; filter.vife_mask = 0x70;
+//
+typedef struct _mbus_record_filter {
+
+    const unsigned char *vif;        // accepted primary VIFs, NULL for any
+    size_t nvif;
+    unsigned char vif_mask;          // VIF bits compared, e.g. 0x78 to ignore the exponent
+
+    int vife;                        // first VIFE of 0xFB/0xFD records, -1 for any; records
+                                     // with other VIFs are only selected by vif
+    unsigned char vife_mask;         // VIFE bits compared, e.g. 0x70 to ignore the exponent
+
+    int function;                    // MBUS_DATA_RECORD_DIF_MASK_INST, ..., -1 for any
+    long storage_number;             // -1 for any
+    long tariff;                     // -1 for any, records without DIFE have tariff 0
+    int device;                      // -1 for any, records without DIFE have device 0
+
+} mbus_record_filter;
+
 //
 // HEADER FOR SECONDARY ADDRESSING
 //
@@ -523,6 +772,44 @@ unsigned int mbus_manufacturer_id(char *manufacturer);
 // it is useful to attach the appropriate code page for postprocessing.
 #define MBUS_XML_PROCESSING_INSTRUCTION         "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
 
+//
+// STREAMING XML/JSON WRITER
+//
+// The document is formatted in a single pass straight into the writer buffer.
+// Whenever the buffer is full it is handed to the sink (FILE, file descriptor
+// or user callback), or grown when the writer collects the output in memory.
+// The JSON output follows the XML schema, but is compact and UTF-8 encoded:
+//
+//   {"MBusData":{"SlaveInformation":{...},"DataRecord":[{"id":0,...},...]}}
+//
+#define MBUS_WRITER_FORMAT_XML                  0
+#define MBUS_WRITER_FORMAT_JSON                 1
+
+#define MBUS_WRITER_BUFF_SIZE                   4096
+
+typedef struct _mbus_writer {
+
+    int format;                      // MBUS_WRITER_FORMAT_*
+
+    // sink, called with the buffered output. Returns zero when successful.
+    int (*write)(struct _mbus_writer *writer, const char *data, size_t data_len);
+    void *userdata;
+    int fd;
+
+    char *buff;                      // local, or allocated when grow is set
+    size_t len;
+    size_t size;
+    char grow;                       // collect the output in memory
+    char error;                      // sink failed or output truncated
+
+    int members;                     // JSON: members of the document
+    int fields;                      // JSON: fields of the current object
+    int records;                     // JSON: elements of the record array
+
+    char local[MBUS_WRITER_BUFF_SIZE];
+
+} mbus_writer;
+
 //
 // Event callback functions
 //
@@ -536,6 +823,15 @@ mbus_data_record *mbus_data_record_new();
 void              mbus_data_record_free(mbus_data_record *record);
 void              mbus_data_record_append(mbus_data_variable *data, mbus_data_record *record);
 
+//
+// record arenas
+//
+mbus_record_arena *mbus_record_arena_new(size_t size);
+void               mbus_record_arena_free(mbus_record_arena *arena);
+int                mbus_record_arena_init(mbus_record_arena *arena, mbus_data_record *block, size_t size);
+void               mbus_record_arena_reset(mbus_record_arena *arena);
+mbus_data_record  *mbus_record_arena_alloc(mbus_record_arena *arena);
+
 
 // XXX: Add application reset subcodes
 
@@ -545,10 +841,19 @@ int         mbus_frame_free(mbus_frame *frame);
 mbus_frame_data *mbus_frame_data_new();
 void             mbus_frame_data_free(mbus_frame_data *data);
 
+//
+// frame pools
+//
+mbus_frame_pool *mbus_frame_pool_new(size_t max_free);
+void             mbus_frame_pool_free(mbus_frame_pool *pool);
+mbus_frame      *mbus_frame_pool_acquire(mbus_frame_pool *pool, int frame_type);
+mbus_frame_data *mbus_frame_pool_acquire_data(mbus_frame_pool *pool);
+
 //
 //
 //
 int mbus_frame_calc_checksum(mbus_frame *frame);
+unsigned char mbus_checksum(const unsigned char *data, size_t data_size);
 int mbus_frame_calc_length  (mbus_frame *frame);
 
 //
@@ -561,6 +866,44 @@ int mbus_data_variable_parse(mbus_frame *frame, mbus_data_variable *data);
 
 int mbus_frame_data_parse   (mbus_frame *frame, mbus_frame_data *data);
 
+void   mbus_frame_parser_init(mbus_frame_parser *parser,
+                              void (*frame_event)(mbus_frame_parser *parser, mbus_frame *frame,
+                                                  const unsigned char *data, size_t data_len),
+                              void *userdata);
+void   mbus_frame_parser_reset(mbus_frame_parser *parser);
+size_t mbus_frame_parser_append(mbus_frame_parser *parser, const unsigned char *data, size_t data_size);
+int    mbus_frame_parser_next(mbus_frame_parser *parser, mbus_frame *frame, const unsigned char **data, size_t *data_len);
+int    mbus_frame_parser_feed(mbus_frame_parser *parser, const unsigned char *data, size_t data_size);
+size_t mbus_frame_parser_needed(const mbus_frame_parser *parser);
+size_t mbus_frame_parser_pending(const mbus_frame_parser *parser);
+
+int mbus_frame_view_init(mbus_frame_view *view, const unsigned char *buff, size_t buff_size);
+int mbus_frame_view_header(const mbus_frame_view *view, mbus_data_variable_header *header);
+int mbus_frame_view_next_record(const mbus_frame_view *view, size_t *pos, mbus_record_view *record);
+int mbus_frame_view_of(mbus_frame_view *view, mbus_frame *frame);
+int mbus_frame_view_more_records_follow(const mbus_frame_view *view);
+int mbus_record_view_decode(const mbus_frame_view *view, const mbus_record_view *record_view, mbus_data_record *record);
+
+void mbus_record_filter_init(mbus_record_filter *filter);
+int  mbus_record_view_match(const mbus_frame_view *view, const mbus_record_view *record_view,
+                            const mbus_record_filter *filter);
+int  mbus_frame_view_find_record(const mbus_frame_view *view, size_t *pos, const mbus_record_filter *filter,
+                                 mbus_record_view *record);
+int  mbus_data_variable_parse_filter(mbus_frame *frame, mbus_data_variable *data,
+                                     const mbus_record_filter *filter, mbus_record_arena *arena);
+
+int mbus_data_variable_parse_arena(mbus_frame *frame, mbus_data_variable *data, mbus_record_arena *arena);
+int mbus_frame_data_parse_arena   (mbus_frame *frame, mbus_frame_data *data, mbus_record_arena *arena);
+
+//
+// change detection cache, *data is owned by the cache and valid until the
+// next call
+//
+void mbus_frame_cache_init (mbus_frame_cache *cache);
+void mbus_frame_cache_free (mbus_frame_cache *cache);
+void mbus_frame_cache_reset(mbus_frame_cache *cache);
+int  mbus_frame_cache_parse(mbus_frame_cache *cache, mbus_frame *frame, mbus_frame_data **data);
+
 int mbus_frame_pack(mbus_frame *frame, unsigned char *data, size_t data_size);
 
 int mbus_frame_verify(mbus_frame *frame);
@@ -578,6 +921,14 @@ int         mbus_data_record_device(mbus_data_record *record);
 const char *mbus_data_record_unit(mbus_data_record *record);
 const char *mbus_data_record_value(mbus_data_record *record);
 
+//
+// Reentrant variants of the functions above: the result is written to the
+// caller supplied buffer, which is also returned.
+//
+const char *mbus_data_record_decode_r(mbus_data_record *record, char *buff, size_t buff_size);
+const char *mbus_data_record_unit_r(mbus_data_record *record, char *buff, size_t buff_size);
+const char *mbus_data_record_value_r(mbus_data_record *record, char *buff, size_t buff_size);
+
 //
 // M-Bus frame data struct access/write functions
 //
@@ -585,10 +936,18 @@ int mbus_frame_type(mbus_frame *frame);
 int mbus_frame_direction(mbus_frame *frame);
 
 //
-// Slave status data register.
+// Slave status data register. Process-global, kept for compatibility: use the
+// state table of the handle (mbus_handle_slave_data) instead.
 //
 mbus_slave_data *mbus_slave_data_get(size_t i);
 
+void             mbus_slave_data_init(mbus_slave_data *data);
+void             mbus_slave_table_init(mbus_slave_table *table);
+void             mbus_slave_table_free(mbus_slave_table *table);
+void             mbus_slave_table_reset(mbus_slave_table *table);
+mbus_slave_data *mbus_slave_table_get(mbus_slave_table *table, int type, uint64_t key, int create);
+uint64_t         mbus_slave_key_secondary(const unsigned char *secondary);
+
 //
 // XML generating functions
 //
@@ -600,9 +959,44 @@ char *mbus_data_error_xml(int error);
 char *mbus_frame_data_xml(mbus_frame_data *data);
 
 char *mbus_data_variable_header_xml(mbus_data_variable_header *header);
+char *mbus_data_variable_header_xml_r(mbus_data_variable_header *header, char *buff, size_t buff_size);
+char *mbus_data_variable_record_xml(mbus_data_record *record, int record_cnt, int frame_cnt, mbus_data_variable_header *header);
+char *mbus_data_variable_record_xml_r(mbus_data_record *record, int record_cnt, int frame_cnt, mbus_data_variable_header *header,
+                                      char *buff, size_t buff_size);
 
 char *mbus_frame_xml(mbus_frame *frame);
 
+//
+// Streaming writer
+//
+void  mbus_writer_init(mbus_writer *writer, int format,
+                       int (*sink)(mbus_writer *writer, const char *data, size_t data_len),
+                       void *userdata);
+void  mbus_writer_init_file(mbus_writer *writer, int format, FILE *fp);
+void  mbus_writer_init_fd(mbus_writer *writer, int format, int fd);
+int   mbus_writer_init_buffer(mbus_writer *writer, int format, size_t size);
+int   mbus_writer_flush(mbus_writer *writer);
+char *mbus_writer_detach(mbus_writer *writer);
+void  mbus_writer_free(mbus_writer *writer);
+
+int   mbus_writer_write(mbus_writer *writer, const char *data, size_t data_len);
+int   mbus_writer_printf(mbus_writer *writer, const char *format, ...);
+int   mbus_writer_document_begin(mbus_writer *writer);
+int   mbus_writer_document_end(mbus_writer *writer);
+int   mbus_writer_object_begin(mbus_writer *writer, const char *name, int id, int frame);
+int   mbus_writer_object_end(mbus_writer *writer, const char *name);
+int   mbus_writer_field(mbus_writer *writer, const char *name, const char *value);
+int   mbus_writer_field_printf(mbus_writer *writer, const char *name, int quoted, const char *format, ...);
+
+int   mbus_data_variable_header_write(mbus_writer *writer, mbus_data_variable_header *header);
+int   mbus_data_variable_record_write(mbus_writer *writer, mbus_data_record *record, int record_cnt, int frame_cnt,
+                                      mbus_data_variable_header *header);
+int   mbus_data_variable_write(mbus_writer *writer, mbus_data_variable *data);
+int   mbus_data_fixed_write(mbus_writer *writer, mbus_data_fixed *data);
+int   mbus_data_error_write(mbus_writer *writer, int error);
+int   mbus_frame_data_write(mbus_writer *writer, mbus_frame_data *data);
+int   mbus_frame_write(mbus_writer *writer, mbus_frame *frame);
+
 //
 // Debug/dump
 //
@@ -613,6 +1007,9 @@ int mbus_data_error_print(int error);
 int mbus_data_variable_header_print(mbus_data_variable_header *header);
 int mbus_data_variable_print(mbus_data_variable *data);
 
+//
+// The error string is kept per thread, see MBUS_THREAD_LOCAL.
+//
 char *mbus_error_str();
 void  mbus_error_str_set(char *message);
 void  mbus_error_reset();
@@ -625,6 +1022,7 @@ void  mbus_hex_dump(const char *label, const char *buff, size_t len);
 //
 int mbus_data_manufacturer_encode(unsigned char *m_data, unsigned char *m_code);
 const char *mbus_decode_manufacturer(unsigned char byte1, unsigned char byte2);
+const char *mbus_decode_manufacturer_r(unsigned char byte1, unsigned char byte2, char *m_str, size_t m_str_size);
 const char *mbus_data_product_name(mbus_data_variable_header *header);
 
 int mbus_data_bcd_encode(unsigned char *bcd_data, size_t bcd_data_size, int value);
@@ -647,16 +1045,22 @@ void mbus_data_bin_decode(unsigned char *dst, const unsigned char *src, size_t l
 const char *mbus_data_fixed_medium(mbus_data_fixed *data);
 const char *mbus_data_fixed_unit(int medium_unit_byte);
 const char *mbus_data_variable_medium_lookup(unsigned char medium);
+const char *mbus_data_variable_medium_lookup_r(unsigned char medium, char *buff, size_t buff_size);
 const char *mbus_unit_prefix(int exp);
+const char *mbus_unit_prefix_r(int exp, char *buff, size_t buff_size);
 
 const char *mbus_data_error_lookup(int error);
+const char *mbus_data_error_lookup_r(int error, char *buff, size_t buff_size);
 
 const char *mbus_vib_unit_lookup(mbus_value_information_block *vib);
+const char *mbus_vib_unit_lookup_r(mbus_value_information_block *vib, char *buff, size_t buff_size);
 const char *mbus_vif_unit_lookup(unsigned char vif);
+const char *mbus_vif_unit_lookup_r(unsigned char vif, char *buff, size_t buff_size);
 
 unsigned char mbus_dif_datalength_lookup(unsigned char dif);
 
 char *mbus_frame_get_secondary_address(mbus_frame *frame);
+char *mbus_frame_get_secondary_address_r(mbus_frame *frame, char *addr, size_t addr_size);
 int   mbus_frame_select_secondary_pack(mbus_frame *frame, char *address);
 
 int mbus_is_primary_address(int value);
@@ -0,0 +1,348 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2011, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mbus-ring.h"
+
+#define MBUS_RING_ROW_WORDS (MBUS_BIN_RECORD_SIZE / 8)
+
+//------------------------------------------------------------------------------
+/// Map the ring file, after checking its header when it is not new
+//------------------------------------------------------------------------------
+static mbus_ring *
+mbus_ring_map(int fd, size_t map_size, int publisher)
+{
+    mbus_ring *ring;
+    void *map;
+
+    if ((ring = (mbus_ring *) calloc(1, sizeof(mbus_ring))) == NULL)
+    {
+        mbus_error_str_set("mbus_ring: failed to allocate ring");
+        return NULL;
+    }
+
+    map = mmap(NULL, map_size, publisher ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        mbus_error_str_set("mbus_ring: failed to map the ring file");
+        free(ring);
+        return NULL;
+    }
+
+    ring->header = (mbus_ring_header *) map;
+    ring->slots = (mbus_ring_slot *) ((char *) map + MBUS_RING_HEADER_SIZE);
+    ring->map_size = map_size;
+    ring->publisher = publisher;
+
+    return ring;
+}
+
+//------------------------------------------------------------------------------
+/// Check the header of a ring file, returns the capacity or 0
+//------------------------------------------------------------------------------
+static uint64_t
+mbus_ring_check(const mbus_ring_header *header, size_t file_size)
+{
+    uint64_t capacity;
+
+    if (memcmp(header->magic, MBUS_RING_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MBUS_RING_VERSION ||
+        header->slot_size != MBUS_RING_SLOT_SIZE)
+        return 0;
+
+    capacity = header->capacity;
+
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        capacity > (file_size - MBUS_RING_HEADER_SIZE) / MBUS_RING_SLOT_SIZE)
+        return 0;
+
+    return capacity;
+}
+
+mbus_ring *
+mbus_ring_create(const char *path, size_t capacity)
+{
+    mbus_ring_header header;
+    mbus_ring *ring;
+    uint64_t size;
+    size_t map_size;
+    struct stat st;
+    int fd, reuse;
+
+    if (path == NULL || capacity == 0 || (uint64_t) capacity > ((uint64_t) 1 << 32))
+    {
+        mbus_error_str_set("mbus_ring_create: invalid path or capacity");
+        return NULL;
+    }
+
+    for (size = 1; size < capacity; size <<= 1)
+        ;
+
+    // a 32 bit address space does not hold the larger rings
+    if (size > (SIZE_MAX - MBUS_RING_HEADER_SIZE) / MBUS_RING_SLOT_SIZE)
+    {
+        mbus_error_str_set("mbus_ring_create: capacity too large to map");
+        return NULL;
+    }
+
+    map_size = MBUS_RING_HEADER_SIZE + (size_t) size * MBUS_RING_SLOT_SIZE;
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1)
+    {
+        mbus_error_str_set("mbus_ring_create: failed to open the ring file");
+        return NULL;
+    }
+
+    // a ring of the same capacity is continued
+    reuse = (fstat(fd, &st) == 0 && (size_t) st.st_size == map_size &&
+             pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) &&
+             mbus_ring_check(&header, map_size) == size);
+
+    if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t) map_size) != 0))
+    {
+        mbus_error_str_set("mbus_ring_create: failed to size the ring file");
+        close(fd);
+        return NULL;
+    }
+
+    ring = mbus_ring_map(fd, map_size, 1);
+    close(fd);
+
+    if (ring == NULL)
+        return NULL;
+
+    ring->capacity = size;
+
+    if (!reuse)
+    {
+        // the file is all zero, the magic is written last
+        ring->header->version = MBUS_RING_VERSION;
+        ring->header->slot_size = MBUS_RING_SLOT_SIZE;
+        ring->header->capacity = size;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(ring->header->magic, MBUS_RING_MAGIC, sizeof(ring->header->magic));
+    }
+
+    return ring;
+}
+
+mbus_ring *
+mbus_ring_open(const char *path)
+{
+    mbus_ring_header header;
+    mbus_ring *ring;
+    uint64_t capacity;
+    struct stat st;
+    int fd;
+
+    if (path == NULL)
+    {
+        mbus_error_str_set("mbus_ring_open: invalid path");
+        return NULL;
+    }
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        mbus_error_str_set("mbus_ring_open: failed to open the ring file");
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < MBUS_RING_HEADER_SIZE ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+        (capacity = mbus_ring_check(&header, (size_t) st.st_size)) == 0)
+    {
+        mbus_error_str_set("mbus_ring_open: not a ring file");
+        close(fd);
+        return NULL;
+    }
+
+    ring = mbus_ring_map(fd, MBUS_RING_HEADER_SIZE + (size_t) capacity * MBUS_RING_SLOT_SIZE, 0);
+    close(fd);
+
+    if (ring == NULL)
+        return NULL;
+
+    ring->capacity = capacity;
+    ring->cursor = mbus_ring_head(ring);
+
+    return ring;
+}
+
+void
+mbus_ring_close(mbus_ring *ring)
+{
+    if (ring)
+    {
+        munmap((void *) ring->header, ring->map_size);
+        free(ring);
+    }
+}
+
+uint64_t
+mbus_ring_head(const mbus_ring *ring)
+{
+    if (ring == NULL)
+        return 0;
+
+    return __atomic_load_n(&(ring->header->head), __ATOMIC_ACQUIRE);
+}
+
+//------------------------------------------------------------------------------
+/// Write a row into its slot. The sequence number is odd while the row is
+/// written, so readers can tell a torn copy (seqlock). The row is copied as
+/// 64 bit words with atomic stores, the readers copy it with atomic loads.
+//------------------------------------------------------------------------------
+int
+mbus_ring_publish(mbus_ring *ring, const mbus_bin_record *row)
+{
+    uint64_t words[MBUS_RING_ROW_WORDS];
+    mbus_ring_slot *slot;
+    uint64_t seq;
+    size_t i;
+
+    if (ring == NULL || row == NULL || !ring->publisher)
+    {
+        mbus_error_str_set("mbus_ring_publish: invalid ring or row");
+        return -1;
+    }
+
+    mbus_bin_record_encode(row, (unsigned char *) words);
+
+    seq = ring->header->head;
+    slot = &(ring->slots[seq & (ring->capacity - 1)]);
+
+    __atomic_store_n(&(slot->seq), 2 * seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0; i < MBUS_RING_ROW_WORDS; i++)
+        __atomic_store_n(&(slot->row[i]), words[i], __ATOMIC_RELAXED);
+
+    __atomic_store_n(&(slot->seq), 2 * seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&(ring->header->head), seq + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int
+mbus_ring_publish_frame_data(mbus_ring *ring, mbus_frame_data *data)
+{
+    mbus_data_record *record;
+    mbus_bin_record row;
+    int i, rows = 0;
+
+    if (ring == NULL || data == NULL)
+    {
+        mbus_error_str_set("mbus_ring_publish_frame_data: invalid ring or data");
+        return -1;
+    }
+
+    if (data->type == MBUS_DATA_TYPE_VARIABLE)
+    {
+        for (record = data->data_var.record, i = 0; record; record = record->next, i++)
+        {
+            // records that can't be decoded are left out
+            if (mbus_bin_record_variable(&row, &(data->data_var.header), record, i) != 0)
+                continue;
+
+            if (mbus_ring_publish(ring, &row) != 0)
+                return -1;
+
+            rows++;
+        }
+    }
+    else if (data->type == MBUS_DATA_TYPE_FIXED)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            mbus_bin_record_fixed(&row, &(data->data_fix), i);
+
+            if (mbus_ring_publish(ring, &row) != 0)
+                return -1;
+
+            rows++;
+        }
+    }
+    else if (data->type != MBUS_DATA_TYPE_ERROR)
+    {
+        mbus_error_str_set("mbus_ring_publish_frame_data: unknown data type");
+        return -1;
+    }
+
+    return rows;
+}
+
+//------------------------------------------------------------------------------
+/// Read the next row. When the publisher has lapped the reader, reading goes
+/// on with the oldest row still in the ring.
+//------------------------------------------------------------------------------
+int
+mbus_ring_read(mbus_ring *ring, mbus_bin_record *row)
+{
+    uint64_t words[MBUS_RING_ROW_WORDS];
+    mbus_ring_slot *slot;
+    uint64_t head, seq;
+    size_t i;
+
+    if (ring == NULL || row == NULL)
+    {
+        mbus_error_str_set("mbus_ring_read: invalid ring or row");
+        return -1;
+    }
+
+    for (;;)
+    {
+        head = mbus_ring_head(ring);
+
+        if (ring->cursor == head)
+            return 0;
+
+        if (head - ring->cursor > ring->capacity || head < ring->cursor)
+        {
+            // overrun, or the ring was created anew
+            ring->lost += (head > ring->cursor) ? head - ring->cursor - ring->capacity : 0;
+            ring->cursor = (head > ring->capacity) ? head - ring->capacity : 0;
+        }
+
+        slot = &(ring->slots[ring->cursor & (ring->capacity - 1)]);
+
+        seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+
+        if (seq == 2 * ring->cursor + 2)
+        {
+            for (i = 0; i < MBUS_RING_ROW_WORDS; i++)
+                words[i] = __atomic_load_n(&(slot->row[i]), __ATOMIC_RELAXED);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&(slot->seq), __ATOMIC_RELAXED) == seq)
+            {
+                mbus_bin_record_decode(row, (const unsigned char *) words);
+                ring->cursor++;
+                return 1;
+            }
+        }
+
+        // the slot is being reused for a later row: skip what was lost
+        ring->lost++;
+        ring->cursor++;
+    }
+}
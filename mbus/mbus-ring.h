@@ -0,0 +1,174 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2011, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+/**
+ * @file   mbus-ring.h
+ *
+ * @brief  Shared memory ring for publishing decoded readings.
+ *
+ * One process publishes decoded records as binary rows (see mbus_bin_record)
+ * into a memory-mapped file, any number of processes read them without
+ * locks or system calls. The ring is a broadcast buffer: every reader sees
+ * every row, and when a reader falls behind by more than the capacity the
+ * oldest rows are overwritten and counted as lost.
+ * \verbatim
+ * // publisher
+ * ring = mbus_ring_create("/dev/shm/mbus", 4096);
+ * mbus_ring_publish_frame_data(ring, &frame_data);
+ *
+ * // reader
+ * ring = mbus_ring_open("/dev/shm/mbus");
+ * while (mbus_ring_read(ring, &row) == 1)
+ *     ...
+ * \endverbatim
+ *
+ * Layout of the file (native byte order, the ring is local to a host):
+ * \verbatim
+ * header:   0  char[8]  magic "MBUSRNG" (NUL terminated)
+ *           8  uint16   version (MBUS_RING_VERSION)
+ *          10  uint16   slot size (MBUS_RING_SLOT_SIZE)
+ *          12  uint32   reserved, 0
+ *          16  uint64   capacity, in slots (a power of two)
+ *          64  uint64   head: sequence number of the next row
+ *
+ * slot n:   0  uint64   2 * sequence + 2 when the row is complete,
+ *                       odd while it is written
+ *           8  row      MBUS_BIN_RECORD_SIZE bytes, as mbus_bin_record_encode
+ * \endverbatim
+ * Slot n starts at MBUS_RING_HEADER_SIZE + n * MBUS_RING_SLOT_SIZE and holds
+ * the rows with sequence & (capacity - 1) == n.
+ */
+
+#ifndef MBUS_RING_H
+#define MBUS_RING_H
+
+#include <stdint.h>
+
+#include "mbus-protocol.h"
+#include "mbus-protocol-aux.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MBUS_RING_MAGIC       "MBUSRNG"
+#define MBUS_RING_VERSION     1
+#define MBUS_RING_HEADER_SIZE 128
+#define MBUS_RING_SLOT_SIZE   64
+
+/**
+ * Header of the ring file. Head has a cache line of its own.
+ */
+typedef struct _mbus_ring_header {
+    char     magic[8];
+    uint16_t version;
+    uint16_t slot_size;
+    uint32_t reserved;
+    uint64_t capacity;
+    char     pad1[40];
+    uint64_t head;               /**< written by the publisher only */
+    char     pad2[56];
+} mbus_ring_header;
+
+/**
+ * Slot of the ring, a row guarded by its sequence number
+ */
+typedef struct _mbus_ring_slot {
+    uint64_t seq;                /**< 2 * sequence + 2, odd while written */
+    uint64_t row[MBUS_BIN_RECORD_SIZE / 8];
+    uint64_t pad;
+} mbus_ring_slot;
+
+/**
+ * Mapping of a ring, for the publisher or a reader
+ */
+typedef struct _mbus_ring {
+    mbus_ring_header *header;
+    mbus_ring_slot *slots;
+    uint64_t capacity;
+    size_t map_size;
+    int publisher;               /**< non zero if created by mbus_ring_create */
+
+    uint64_t cursor;             /**< reader: sequence number of the next row */
+    uint64_t lost;               /**< reader: rows overwritten before they were read */
+} mbus_ring;
+
+/**
+ * Create the ring file for publishing, or reuse an existing ring of the same
+ * capacity (readers keep their position after a restart of the publisher)
+ *
+ * @param path     file to map, e.g. in /dev/shm
+ * @param capacity number of rows kept, rounded up to a power of two
+ *
+ * @return ring, NULL on error (see mbus_error_str)
+ */
+mbus_ring *mbus_ring_create(const char *path, size_t capacity);
+
+/**
+ * Map a ring for reading. Reading starts with the next row published.
+ *
+ * @param path file created by mbus_ring_create
+ *
+ * @return ring, NULL on error (see mbus_error_str)
+ */
+mbus_ring *mbus_ring_open(const char *path);
+
+/**
+ * Unmap a ring. The file is left in place.
+ *
+ * @param ring ring
+ */
+void mbus_ring_close(mbus_ring *ring);
+
+/**
+ * Publish a row
+ *
+ * @param ring ring created by mbus_ring_create
+ * @param row  decoded record
+ *
+ * @return zero when OK
+ */
+int mbus_ring_publish(mbus_ring *ring, const mbus_bin_record *row);
+
+/**
+ * Publish the records of a frame data structure, the rows of
+ * mbus_frame_data_write_bin
+ *
+ * @param ring ring created by mbus_ring_create
+ * @param data decoded frame data
+ *
+ * @return number of rows published, -1 on error
+ */
+int mbus_ring_publish_frame_data(mbus_ring *ring, mbus_frame_data *data);
+
+/**
+ * Read the next row
+ *
+ * @param ring ring opened by mbus_ring_open
+ * @param row  decoded record
+ *
+ * @return 1 if a row was read, 0 if there is none yet, -1 on error
+ */
+int mbus_ring_read(mbus_ring *ring, mbus_bin_record *row);
+
+/**
+ * Sequence number of the next row to be published
+ *
+ * @param ring ring
+ *
+ * @return sequence number, also the number of rows published so far
+ */
+uint64_t mbus_ring_head(const mbus_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MBUS_RING_H */
@@ -13,6 +13,7 @@
 #include <fcntl.h>
 
 #include <sys/types.h>
+#include <poll.h>
 
 #include <stdio.h>
 #include <strings.h>
@@ -46,11 +47,14 @@ mbus_serial_connect(mbus_handle *handle)
 
     device = serial_data->device;
     term = &(serial_data->t);
+
+    mbus_frame_parser_init(&(serial_data->parser), NULL, NULL);
     //
     // create the SERIAL connection
     //
 
-    // Use blocking read and handle it by serial port VMIN/VTIME setting
+    // The response timeout is handled by poll() in mbus_serial_recv_frame, see
+    // mbus_handle_timeout_us
     if ((handle->fd = open(device, O_RDWR | O_NOCTTY)) < 0)
     {
         fprintf(stderr, "%s: failed to open tty.", __PRETTY_FUNCTION__);
@@ -61,27 +65,13 @@ mbus_serial_connect(mbus_handle *handle)
     term->c_cflag |= (CS8|CREAD|CLOCAL);
     term->c_cflag |= PARENB;
 
-    // No received data still OK
+    // No received data still OK, read returns whatever is available
     term->c_cc[VMIN] = (cc_t) 0;
-
-    // Wait at most 0.2 sec.Note that it starts after first received byte!!
-    // I.e. if CMIN>0 and there are no data we would still wait forever...
-    //
-    // The specification mentions link layer response timeout this way:
-    // The time structure of various link layer communication types is described in EN60870-5-1. The answer time
-    // between the end of a master send telegram and the beginning of the response telegram of the slave shall be
-    // between 11 bit times and (330 bit times + 50ms).
-    //
-    // Nowadays the usage of USB to serial adapter is very common, which could
-    // result in additional delay of 100 ms in worst case.
-    //
-    // For 2400Bd this means (330 + 11) / 2400 + 0.15 = 292 ms (added 11 bit periods to receive first byte).
-    // I.e. timeout of 0.3s seems appropriate for 2400Bd.
-
-    term->c_cc[VTIME] = (cc_t) 3; // Timeout in 1/10 sec
+    term->c_cc[VTIME] = (cc_t) 0;
 
     cfsetispeed(term, B2400);
     cfsetospeed(term, B2400);
+    serial_data->baudrate = 2400;
 
 #ifdef MBUS_SERIAL_DEBUG
     printf("%s: t.c_cflag = %x\n", __PRETTY_FUNCTION__, term->c_cflag);
@@ -92,6 +82,10 @@ mbus_serial_connect(mbus_handle *handle)
 
     tcsetattr(handle->fd, TCSANOW, term);
 
+    handle->nonblocking = 0;
+    handle->deadline_us = 0;
+    handle->tx_len = handle->tx_sent = 0;
+
     return 0;
 }
 
@@ -116,42 +110,34 @@ mbus_serial_set_baudrate(mbus_handle *handle, long baudrate)
     {
         case 300:
             speed = B300;
-            serial_data->t.c_cc[VTIME] = (cc_t) 13; // Timeout in 1/10 sec
             break;
 
         case 600:
             speed = B600;
-            serial_data->t.c_cc[VTIME] = (cc_t) 8;  // Timeout in 1/10 sec
             break;
 
         case 1200:
             speed = B1200;
-            serial_data->t.c_cc[VTIME] = (cc_t) 5;  // Timeout in 1/10 sec
             break;
 
         case 2400:
             speed = B2400;
-            serial_data->t.c_cc[VTIME] = (cc_t) 3;  // Timeout in 1/10 sec
             break;
 
         case 4800:
             speed = B4800;
-            serial_data->t.c_cc[VTIME] = (cc_t) 3;  // Timeout in 1/10 sec
             break;
 
         case 9600:
             speed = B9600;
-            serial_data->t.c_cc[VTIME] = (cc_t) 2;  // Timeout in 1/10 sec
             break;
 
         case 19200:
             speed = B19200;
-            serial_data->t.c_cc[VTIME] = (cc_t) 2;  // Timeout in 1/10 sec
             break;
 
         case 38400:
             speed = B38400;
-            serial_data->t.c_cc[VTIME] = (cc_t) 2;  // Timeout in 1/10 sec
             break;
 
        default:
@@ -176,6 +162,8 @@ mbus_serial_set_baudrate(mbus_handle *handle, long baudrate)
         return -1;
     }
 
+    serial_data->baudrate = baudrate;
+
     return 0;
 }
 
@@ -266,6 +254,8 @@ mbus_serial_send_frame(mbus_handle *handle, mbus_frame *frame)
         //
         if (handle->send_event)
                 handle->send_event(MBUS_HANDLE_TYPE_SERIAL, buff, len);
+
+        mbus_handle_capture(handle, MBUS_CAPTURE_SEND, buff, len);
     }
     else
     {
@@ -287,11 +277,16 @@ mbus_serial_send_frame(mbus_handle *handle, mbus_frame *frame)
 int
 mbus_serial_recv_frame(mbus_handle *handle, mbus_frame *frame)
 {
-    char buff[PACKET_BUFF_SIZE];
-    int remaining, timeouts;
-    ssize_t len, nread;
-
-    if (handle == NULL || frame == NULL)
+    unsigned char buff[MBUS_FRAME_PARSER_BUFF_SIZE];
+    mbus_serial_data *serial_data;
+    mbus_frame_parser *parser;
+    const unsigned char *raw = NULL;
+    size_t raw_len = 0;
+    struct pollfd pfd;
+    int result, ret, timeout_ms;
+    ssize_t nread;
+
+    if (handle == NULL || frame == NULL || handle->auxdata == NULL)
     {
         fprintf(stderr, "%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
         return MBUS_RECV_RESULT_ERROR;
@@ -304,78 +299,81 @@ mbus_serial_recv_frame(mbus_handle *handle, mbus_frame *frame)
         return MBUS_RECV_RESULT_ERROR;
     }
 
-    memset((void *)buff, 0, sizeof(buff));
+    serial_data = (mbus_serial_data *) handle->auxdata;
+    parser = &(serial_data->parser);
 
     //
-    // read data until a packet is received
+    // read data until a packet is received. Whatever a read returns is fed to
+    // the parser, bytes following the frame are kept for the next call. The
+    // response timeout restarts with every received chunk.
     //
-    remaining = 1; // start by reading 1 byte
-    len = 0;
-    timeouts = 0;
+    timeout_ms = (int) ((mbus_handle_timeout_us(handle) + 999) / 1000);
 
-    do {
-        if (len + remaining > PACKET_BUFF_SIZE)
-        {
-            // avoid out of bounds access
-            return MBUS_RECV_RESULT_ERROR;
-        }
+    pfd.fd = handle->fd;
+    pfd.events = POLLIN;
 
-        //printf("%s: Attempt to read %d bytes [len = %d]\n", __PRETTY_FUNCTION__, remaining, len);
-
-        if ((nread = read(handle->fd, &buff[len], remaining)) == -1)
+    while ((result = mbus_frame_parser_next(parser, frame, &raw, &raw_len)) == 0)
+    {
+        if ((ret = poll(&pfd, 1, timeout_ms)) == -1)
         {
-       //     fprintf(stderr, "%s: aborting recv frame (remaining = %d, len = %d, nread = %d)\n",
-         //          __PRETTY_FUNCTION__, remaining, len, nread);
+            if (errno == EINTR)
+                continue;
+
+            mbus_frame_parser_reset(parser);
             return MBUS_RECV_RESULT_ERROR;
         }
 
-//   printf("%s: Got %d byte [remaining %d, len %d]\n", __PRETTY_FUNCTION__, nread, remaining, len);
-
-        if (nread == 0)
+        if (ret == 0)
         {
-            timeouts++;
-
-            if (timeouts >= 3)
-            {
-                // abort to avoid endless loop
-                fprintf(stderr, "%s: Timeout\n", __PRETTY_FUNCTION__);
-                break;
-            }
+            fprintf(stderr, "%s: Timeout\n", __PRETTY_FUNCTION__);
+            break;
         }
 
-        if (len > (SSIZE_MAX-nread))
+        if ((nread = read(handle->fd, buff, sizeof(parser->buff) - mbus_frame_parser_pending(parser))) == -1)
         {
-            // avoid overflow
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
+
+            mbus_frame_parser_reset(parser);
             return MBUS_RECV_RESULT_ERROR;
         }
 
-        len += nread;
+        if (nread == 0)
+        {
+            // readable without data (e.g. hang up), avoid an endless loop
+            fprintf(stderr, "%s: Timeout\n", __PRETTY_FUNCTION__);
+            break;
+        }
 
-    } while ((remaining = mbus_parse(frame, buff, len)) > 0);
+        mbus_frame_parser_append(parser, buff, (size_t) nread);
+    }
 
-    if (len == 0)
+    if (result == 0)
     {
-        // No data received
-        return MBUS_RECV_RESULT_TIMEOUT;
+        raw = &(parser->buff[parser->start]);
+        raw_len = mbus_frame_parser_pending(parser);
+
+        if (raw_len == 0)
+        {
+            // No data received
+            return MBUS_RECV_RESULT_TIMEOUT;
+        }
     }
 
     //
     // call the receive event function, if the callback function is registered
     //
     if (handle->recv_event)
-        handle->recv_event(MBUS_HANDLE_TYPE_SERIAL, buff, len);
+        handle->recv_event(MBUS_HANDLE_TYPE_SERIAL, (const char *) raw, raw_len);
 
-    if (remaining != 0)
-    {
-        // Would be OK when e.g. scanning the bus, otherwise it is a failure.
-        // printf("%s: M-Bus layer failed to receive complete data.\n", __PRETTY_FUNCTION__);
-        return MBUS_RECV_RESULT_INVALID;
-    }
+    mbus_handle_capture(handle, MBUS_CAPTURE_RECV, raw, raw_len);
 
-    if (len == -1)
+    if (result != 1)
     {
-        fprintf(stderr, "%s: M-Bus layer failed to parse data.\n", __PRETTY_FUNCTION__);
-        return MBUS_RECV_RESULT_ERROR;
+        // Incomplete or invalid data. Would be OK when e.g. scanning the bus,
+        // otherwise it is a failure.
+        mbus_frame_parser_reset(parser);
+        return MBUS_RECV_RESULT_INVALID;
     }
 
     return MBUS_RECV_RESULT_OK;
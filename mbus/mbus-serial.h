@@ -31,6 +31,8 @@ typedef struct _mbus_serial_data
 {
     char *device;
     struct termios t;
+    long baudrate;
+    mbus_frame_parser parser;
 } mbus_serial_data;
 
 int  mbus_serial_connect(mbus_handle *handle);
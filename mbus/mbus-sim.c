@@ -0,0 +1,972 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2011, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "mbus-sim.h"
+#include "mbus-capture.h"
+
+#define PACKET_BUFF_SIZE 2048
+
+// bits per character on the bus (start, 8 data, parity, stop)
+#define MBUS_SIM_CHAR_BITS 11
+
+//------------------------------------------------------------------------------
+/// Sleep for a number of microseconds, restarted after signals
+//------------------------------------------------------------------------------
+static void
+mbus_sim_sleep_us(long long usec)
+{
+    struct timespec ts;
+
+    if (usec <= 0)
+        return;
+
+    ts.tv_sec  = usec / 1000000LL;
+    ts.tv_nsec = (usec % 1000000LL) * 1000;
+
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+//------------------------------------------------------------------------------
+/// Time to transmit data_size characters at a baud rate
+//------------------------------------------------------------------------------
+static long long
+mbus_sim_wire_us(long baudrate, size_t data_size)
+{
+    if (baudrate <= 0)
+        return 0;
+
+    return (long long) data_size * MBUS_SIM_CHAR_BITS * 1000000LL / baudrate;
+}
+
+//------------------------------------------------------------------------------
+/// Match the 8 data bytes of a selection against a secondary address. Every
+/// nibble F of the selection is a wildcard.
+//------------------------------------------------------------------------------
+static int
+mbus_sim_secondary_match(const unsigned char *mask, const unsigned char *secondary)
+{
+    size_t i;
+
+    for (i = 0; i < 8; i++)
+    {
+        if ((mask[i] & 0xF0) != 0xF0 && (mask[i] & 0xF0) != (secondary[i] & 0xF0))
+            return 0;
+
+        if ((mask[i] & 0x0F) != 0x0F && (mask[i] & 0x0F) != (secondary[i] & 0x0F))
+            return 0;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Add the reply of a slave to the bus. Overlapping replies of several slaves
+/// are combined like on the wire: a dominant zero bit wins, and every further
+/// slave is assumed to start one bit time later than the previous one.
+//------------------------------------------------------------------------------
+static size_t
+mbus_sim_overlay(unsigned char *bus, size_t bus_len, const unsigned char *data, size_t data_size,
+                 int shift, size_t bus_size)
+{
+    unsigned int prev = 0xFF, byte;
+    size_t i, len;
+
+    len = data_size + (shift > 0 ? 1 : 0);
+    if (len > bus_size)
+        len = bus_size;
+
+    // idle line is mark (1)
+    for (i = bus_len; i < len; i++)
+        bus[i] = 0xFF;
+
+    for (i = 0; i < len; i++)
+    {
+        byte = (i < data_size) ? data[i] : 0xFF;
+        bus[i] &= (unsigned char) (((byte >> shift) | (prev << (8 - shift))) & 0xFF);
+        prev = byte;
+    }
+
+    return (len > bus_len) ? len : bus_len;
+}
+
+//------------------------------------------------------------------------------
+/// Process a request the master sent at baudrate. Returns the number of
+/// bytes the slaves put on the bus, turnaround_us is set to the largest extra
+/// delay of the slaves that answer.
+//------------------------------------------------------------------------------
+static size_t
+mbus_sim_request(mbus_sim_data *sim, mbus_frame *request, long baudrate, unsigned char *bus, size_t bus_size,
+                 long *turnaround_us)
+{
+    static const unsigned char ack = MBUS_FRAME_ACK_START;
+    mbus_sim_slave *slave;
+    const unsigned char *reply;
+    size_t i, reply_len, bus_len = 0;
+    int match, fcb, responders = 0;
+    unsigned char control;
+    long switch_baudrate;
+
+    *turnaround_us = 0;
+
+    if (mbus_frame_direction(request) != MBUS_CONTROL_MASK_DIR_M2S)
+        return 0;
+
+    control = request->control & ~(MBUS_CONTROL_MASK_FCB | MBUS_CONTROL_MASK_FCV);
+    fcb = (request->control & MBUS_CONTROL_MASK_FCB) ? 1 : 0;
+
+    for (i = 0; i < sim->nslaves; i++)
+    {
+        slave = &(sim->slaves[i]);
+
+        // the frame is garbage at any other rate
+        if ((slave->current_baudrate ? slave->current_baudrate : sim->baudrate) != baudrate)
+            continue;
+
+        //
+        // selection by secondary address: every slave either matches the
+        // mask and is selected, or is deselected
+        //
+        if (request->type == MBUS_FRAME_TYPE_LONG &&
+            request->address == MBUS_ADDRESS_NETWORK_LAYER &&
+            request->control_information == MBUS_CONTROL_INFO_SELECT_SLAVE &&
+            request->data_size >= 8)
+        {
+            slave->selected = slave->has_secondary &&
+                              mbus_sim_secondary_match(request->data, slave->secondary);
+            match = slave->selected;
+        }
+        else if (request->address == MBUS_ADDRESS_NETWORK_LAYER)
+        {
+            match = slave->selected;
+        }
+        else if (request->address == MBUS_ADDRESS_BROADCAST_REPLY ||
+                 request->address == MBUS_ADDRESS_BROADCAST_NOREPLY)
+        {
+            match = 1;
+        }
+        else
+        {
+            match = (slave->primary == request->address);
+        }
+
+        if (!match)
+            continue;
+
+        reply = &ack;
+        reply_len = 1;
+
+        if (control == (MBUS_CONTROL_MASK_SND_NKE & ~MBUS_CONTROL_MASK_FCV))
+        {
+            slave->next = 0;
+            slave->fcb = -1;
+
+            if (request->address == MBUS_ADDRESS_NETWORK_LAYER)
+                slave->selected = 0;
+        }
+        else if (control == (MBUS_CONTROL_MASK_REQ_UD2 & ~MBUS_CONTROL_MASK_FCV))
+        {
+            if (slave->ntelegrams == 0)
+                continue;
+
+            // a toggled FCB acknowledges the last telegram, the same one
+            // asks for a repetition
+            if ((request->control & MBUS_CONTROL_MASK_FCV) && slave->fcb != -1 && fcb != slave->fcb)
+            {
+                if (slave->next + 1 < slave->ntelegrams && slave->telegram_more[slave->next])
+                    slave->next++;
+                else
+                    slave->next = 0;
+            }
+
+            if (request->control & MBUS_CONTROL_MASK_FCV)
+                slave->fcb = fcb;
+
+            reply = slave->telegram[slave->next];
+            reply_len = slave->telegram_len[slave->next];
+        }
+        else if (control == (MBUS_CONTROL_MASK_SND_UD & ~MBUS_CONTROL_MASK_FCV) &&
+                 request->control_information >= MBUS_CONTROL_INFO_SET_BAUDRATE_300 &&
+                 request->control_information <= MBUS_CONTROL_INFO_SET_BAUDRATE_38400)
+        {
+            switch_baudrate = 300L << (request->control_information - MBUS_CONTROL_INFO_SET_BAUDRATE_300);
+
+            // unsupported rates are ignored
+            if (switch_baudrate != baudrate && switch_baudrate > slave->max_baudrate)
+                continue;
+
+            // the ACK still goes out at the old rate
+            slave->current_baudrate = switch_baudrate;
+        }
+
+        if (request->address == MBUS_ADDRESS_BROADCAST_NOREPLY)
+            continue;
+
+        if (sim->drop_rate > 0.0 &&
+            (double) rand_r(&(sim->seed)) / ((double) RAND_MAX + 1.0) < sim->drop_rate)
+        {
+            sim->drops++;
+            continue;
+        }
+
+        bus_len = mbus_sim_overlay(bus, bus_len, reply, reply_len, responders % 8, bus_size);
+        responders++;
+
+        if (slave->turnaround_us > *turnaround_us)
+            *turnaround_us = slave->turnaround_us;
+    }
+
+    if (responders > 1)
+        sim->collisions++;
+
+    if (responders > 0)
+        sim->replies++;
+
+    return bus_len;
+}
+
+//------------------------------------------------------------------------------
+/// Bus thread: reads the requests of the master and writes the replies of
+/// the slaves with the configured timing.
+//------------------------------------------------------------------------------
+static void *
+mbus_sim_run(void *arg)
+{
+    mbus_sim_data *sim = (mbus_sim_data *) arg;
+    unsigned char buff[MBUS_FRAME_PARSER_BUFF_SIZE], bus[PACKET_BUFF_SIZE];
+    const unsigned char *raw;
+    mbus_frame request;
+    size_t raw_len, bus_len, sent, chunk;
+    ssize_t nread, nwritten;
+    long long delay;
+    long baudrate, turnaround_us;
+    int result;
+
+    while ((nread = read(sim->peer, buff, sizeof(buff) - mbus_frame_parser_pending(&(sim->bus_parser)))) != 0)
+    {
+        if (nread < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        mbus_frame_parser_append(&(sim->bus_parser), buff, (size_t) nread);
+
+        while ((result = mbus_frame_parser_next(&(sim->bus_parser), &request, &raw, &raw_len)) != 0)
+        {
+            // the slaves ignore garbage on the bus
+            if (result < 0)
+                continue;
+
+            sim->requests++;
+
+            baudrate = __atomic_load_n(&(sim->port_baudrate), __ATOMIC_ACQUIRE);
+
+            if ((bus_len = mbus_sim_request(sim, &request, baudrate, bus, sizeof(bus), &turnaround_us)) == 0)
+                continue;
+
+            // bytes written per chunk, about 10 ms worth of characters
+            chunk = (baudrate > 0) ? (size_t) (baudrate / (MBUS_SIM_CHAR_BITS * 100)) : sizeof(bus);
+            if (chunk < 1)
+                chunk = 1;
+
+            // the request was written at once, but takes its time on the bus
+            delay = mbus_sim_wire_us(baudrate, raw_len) + sim->turnaround_us + turnaround_us;
+            if (sim->jitter_us > 0)
+                delay += rand_r(&(sim->seed)) % (sim->jitter_us + 1);
+
+            mbus_sim_sleep_us(delay);
+
+            for (sent = 0; sent < bus_len; sent += (size_t) nwritten)
+            {
+                nwritten = send(sim->peer, &bus[sent], (bus_len - sent < chunk) ? bus_len - sent : chunk, MSG_NOSIGNAL);
+
+                if (nwritten <= 0)
+                    break;
+
+                mbus_sim_sleep_us(mbus_sim_wire_us(baudrate, (size_t) nwritten));
+            }
+
+            if (sent < bus_len)
+                return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+/// Connect the simulated bus: create the socket pair and start the bus thread
+//------------------------------------------------------------------------------
+int
+mbus_sim_connect(mbus_handle *handle)
+{
+    mbus_sim_data *sim;
+    char error_str[128];
+    int fds[2];
+    size_t i;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL)
+        return -1;
+
+    if (sim->running)
+    {
+        mbus_error_str_set("M-Bus simulator is already connected.");
+        return -1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: failed to create socket pair: %s", __PRETTY_FUNCTION__, strerror(errno));
+        mbus_error_str_set(error_str);
+        return -1;
+    }
+
+    for (i = 0; i < sim->nslaves; i++)
+    {
+        sim->slaves[i].next = 0;
+        sim->slaves[i].fcb = -1;
+        sim->slaves[i].selected = 0;
+    }
+
+    sim->port_baudrate = sim->baudrate;
+
+    sim->requests = sim->replies = sim->drops = sim->collisions = 0;
+
+    mbus_frame_parser_init(&(sim->parser), NULL, NULL);
+    mbus_frame_parser_init(&(sim->bus_parser), NULL, NULL);
+
+    handle->fd = fds[0];
+    sim->peer = fds[1];
+
+    if (pthread_create(&(sim->thread), NULL, mbus_sim_run, sim) != 0)
+    {
+        mbus_error_str_set("M-Bus simulator failed to start the bus thread.");
+        close(fds[0]);
+        close(fds[1]);
+        handle->fd = -1;
+        return -1;
+    }
+
+    sim->running = 1;
+    handle->nonblocking = 0;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Disconnect: the bus thread ends when the master end is closed
+//------------------------------------------------------------------------------
+int
+mbus_sim_disconnect(mbus_handle *handle)
+{
+    mbus_sim_data *sim;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL)
+        return -1;
+
+    if (!sim->running)
+        return -1;
+
+    shutdown(handle->fd, SHUT_RDWR);
+    pthread_join(sim->thread, NULL);
+
+    close(handle->fd);
+    close(sim->peer);
+    handle->fd = -1;
+    sim->peer = -1;
+    sim->running = 0;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+void
+mbus_sim_data_free(mbus_handle *handle)
+{
+    mbus_sim_data *sim;
+    size_t i, j;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL)
+        return;
+
+    if (sim->running)
+        mbus_sim_disconnect(handle);
+
+    for (i = 0; i < sim->nslaves; i++)
+    {
+        for (j = 0; j < sim->slaves[i].ntelegrams; j++)
+            free(sim->slaves[i].telegram[j]);
+    }
+
+    free(sim->slaves);
+    free(sim);
+    handle->auxdata = NULL;
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+int
+mbus_sim_send_frame(mbus_handle *handle, mbus_frame *frame)
+{
+    unsigned char buff[PACKET_BUFF_SIZE];
+    int len, ret;
+    char error_str[128];
+
+    if (handle == NULL || frame == NULL)
+    {
+        return -1;
+    }
+
+    if ((len = mbus_frame_pack(frame, buff, sizeof(buff))) == -1)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: mbus_frame_pack failed\n", __PRETTY_FUNCTION__);
+        mbus_error_str_set(error_str);
+        return -1;
+    }
+
+    if ((ret = write(handle->fd, buff, len)) != len)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: Failed to write frame to simulator (ret = %d)\n", __PRETTY_FUNCTION__, ret);
+        mbus_error_str_set(error_str);
+        return -1;
+    }
+
+    if (handle->send_event)
+        handle->send_event(MBUS_HANDLE_TYPE_SIM, (const char *) buff, len);
+
+    mbus_handle_capture(handle, MBUS_CAPTURE_SEND, buff, len);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+int
+mbus_sim_recv_frame(mbus_handle *handle, mbus_frame *frame)
+{
+    unsigned char buff[MBUS_FRAME_PARSER_BUFF_SIZE];
+    mbus_frame_parser *parser;
+    const unsigned char *raw;
+    size_t raw_len;
+    struct pollfd pfd;
+    int result, ret, timeout_ms;
+    ssize_t nread;
+
+    if (handle == NULL || frame == NULL || handle->auxdata == NULL)
+    {
+        fprintf(stderr, "%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
+        return MBUS_RECV_RESULT_ERROR;
+    }
+
+    parser = &(((mbus_sim_data *) handle->auxdata)->parser);
+
+    // the response timeout restarts with every chunk, like on a serial line
+    timeout_ms = (int) ((mbus_handle_timeout_us(handle) + 999) / 1000);
+
+    pfd.fd = handle->fd;
+    pfd.events = POLLIN;
+
+    while ((result = mbus_frame_parser_next(parser, frame, &raw, &raw_len)) == 0)
+    {
+        if ((ret = poll(&pfd, 1, timeout_ms)) == 0)
+        {
+            mbus_frame_parser_reset(parser);
+            mbus_error_str_set("M-Bus simulator response timeout has been reached.");
+            return MBUS_RECV_RESULT_TIMEOUT;
+        }
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            mbus_frame_parser_reset(parser);
+            mbus_error_str_set("M-Bus simulator failed to read data.");
+            return MBUS_RECV_RESULT_ERROR;
+        }
+
+        nread = read(handle->fd, buff, sizeof(parser->buff) - mbus_frame_parser_pending(parser));
+
+        if (nread == -1 && errno == EINTR)
+            continue;
+
+        if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+
+        if (nread <= 0)
+        {
+            mbus_frame_parser_reset(parser);
+            mbus_error_str_set("M-Bus simulator failed to read data.");
+            return (nread == 0) ? MBUS_RECV_RESULT_RESET : MBUS_RECV_RESULT_ERROR;
+        }
+
+        mbus_frame_parser_append(parser, buff, (size_t) nread);
+    }
+
+    if (handle->recv_event)
+        handle->recv_event(MBUS_HANDLE_TYPE_SIM, (const char *) raw, raw_len);
+
+    mbus_handle_capture(handle, MBUS_CAPTURE_RECV, raw, raw_len);
+
+    if (result < 0)
+    {
+        mbus_error_str_set("M-Bus layer failed to parse data.");
+        return MBUS_RECV_RESULT_INVALID;
+    }
+
+    return MBUS_RECV_RESULT_OK;
+}
+
+//------------------------------------------------------------------------------
+/// Default response timeout: the EN 13757 limit of (330 + 11) bit times plus
+/// 50 ms, extended by the configured turnaround and jitter
+//------------------------------------------------------------------------------
+long
+mbus_sim_get_timeout_us(mbus_handle *handle)
+{
+    mbus_sim_data *sim;
+    long timeout = 50000;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL)
+        return timeout;
+
+    if (sim->port_baudrate > 0)
+        timeout += (330 + MBUS_SIM_CHAR_BITS) * 1000000L / sim->port_baudrate;
+
+    return timeout + sim->turnaround_us + sim->jitter_us;
+}
+
+//------------------------------------------------------------------------------
+/// Add a slave. With a secondary address (16 characters, as returned by
+/// mbus_frame_get_secondary_address) the header of its telegrams is patched,
+/// otherwise the address of the first telegram is used. A primary address of
+/// -1 also takes the address of the first telegram. Returns the slave index.
+//------------------------------------------------------------------------------
+int
+mbus_sim_add_slave(mbus_handle *handle, int primary, const char *secondary)
+{
+    mbus_sim_data *sim;
+    mbus_sim_slave *slave;
+    mbus_frame frame;
+    size_t size;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL || sim->running ||
+        primary < -1 || primary > MBUS_MAX_PRIMARY_SLAVES ||
+        (secondary != NULL && mbus_is_secondary_address(secondary) == 0))
+    {
+        mbus_error_str_set("Invalid simulator handle or slave address.");
+        return -1;
+    }
+
+    if (sim->nslaves == sim->size)
+    {
+        size = sim->size ? 2 * sim->size : 8;
+
+        if ((slave = (mbus_sim_slave *) realloc(sim->slaves, size * sizeof(mbus_sim_slave))) == NULL)
+        {
+            mbus_error_str_set("Failed to allocate simulated slave.");
+            return -1;
+        }
+
+        sim->slaves = slave;
+        sim->size = size;
+    }
+
+    slave = &(sim->slaves[sim->nslaves]);
+    memset(slave, 0, sizeof(mbus_sim_slave));
+    slave->primary = primary;
+    slave->fcb = -1;
+
+    if (secondary)
+    {
+        // same byte layout as the selection frame
+        memset(&frame, 0, sizeof(frame));
+        mbus_frame_select_secondary_pack(&frame, (char *) secondary);
+        memcpy(slave->secondary, frame.data, 8);
+        slave->has_secondary = 1;
+        slave->override_secondary = 1;
+    }
+
+    return (int) sim->nslaves++;
+}
+
+//------------------------------------------------------------------------------
+/// Add a reply telegram (a complete RSP_UD frame) to a slave
+//------------------------------------------------------------------------------
+int
+mbus_sim_add_telegram(mbus_handle *handle, int slave_index, const unsigned char *data, size_t data_size)
+{
+    mbus_sim_data *sim;
+    mbus_sim_slave *slave;
+    mbus_frame frame;
+    mbus_frame_view view;
+    unsigned char *telegram;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL || sim->running ||
+        slave_index < 0 || (size_t) slave_index >= sim->nslaves || data == NULL)
+    {
+        mbus_error_str_set("Invalid simulator handle or slave.");
+        return -1;
+    }
+
+    slave = &(sim->slaves[slave_index]);
+
+    if (slave->ntelegrams >= MBUS_SIM_MAX_TELEGRAMS)
+    {
+        mbus_error_str_set("Too many telegrams for simulated slave.");
+        return -1;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+
+    if (mbus_parse(&frame, (unsigned char *) data, data_size) != 0 ||
+        frame.type != MBUS_FRAME_TYPE_LONG ||
+        mbus_frame_direction(&frame) != MBUS_CONTROL_MASK_DIR_S2M)
+    {
+        mbus_error_str_set("Simulated slave telegram is not a valid reply frame.");
+        return -1;
+    }
+
+    // the frame itself, without trailing data
+    data_size = frame.data_size + MBUS_FRAME_LONG_BASE_SIZE;
+
+    if ((telegram = (unsigned char *) malloc(data_size)) == NULL)
+    {
+        mbus_error_str_set("Failed to allocate simulated slave telegram.");
+        return -1;
+    }
+
+    memcpy(telegram, data, data_size);
+
+    if (slave->primary == -1)
+        slave->primary = telegram[5];
+    else
+        telegram[5] = (unsigned char) slave->primary;
+
+    if (frame.control_information == MBUS_CONTROL_INFO_RESP_VARIABLE && frame.data_size >= 8)
+    {
+        if (slave->override_secondary)
+        {
+            memcpy(&telegram[7], slave->secondary, 8);
+        }
+        else if (!slave->has_secondary)
+        {
+            memcpy(slave->secondary, &telegram[7], 8);
+            slave->has_secondary = 1;
+        }
+    }
+
+    telegram[data_size - 2] = mbus_checksum(&telegram[4], data_size - 6);
+
+    slave->telegram[slave->ntelegrams] = telegram;
+    slave->telegram_len[slave->ntelegrams] = data_size;
+    slave->telegram_more[slave->ntelegrams] = 0;
+
+    if (frame.control_information == MBUS_CONTROL_INFO_RESP_VARIABLE)
+    {
+        mbus_frame_view_of(&view, &frame);
+        slave->telegram_more[slave->ntelegrams] = (mbus_frame_view_more_records_follow(&view) == 1);
+    }
+    slave->ntelegrams++;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Add a reply telegram read from a hex file (as in test/test-frames)
+//------------------------------------------------------------------------------
+int
+mbus_sim_add_telegram_file(mbus_handle *handle, int slave, const char *path)
+{
+    unsigned char raw_buff[4096], buff[4096];
+    char error_str[128];
+    size_t len;
+    FILE *fp;
+
+    if (path == NULL || (fp = fopen(path, "r")) == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: failed to open '%s'", __PRETTY_FUNCTION__, path ? path : "");
+        mbus_error_str_set(error_str);
+        return -1;
+    }
+
+    len = fread(raw_buff, 1, sizeof(raw_buff), fp);
+    fclose(fp);
+
+    len = mbus_hex2bin(buff, sizeof(buff), raw_buff, len);
+
+    return mbus_sim_add_telegram(handle, slave, buff, len);
+}
+
+//------------------------------------------------------------------------------
+/// Find the slave a reply telegram is from, by primary address and, for
+/// variable data, the secondary address in its header
+//------------------------------------------------------------------------------
+static int
+mbus_sim_find_slave(mbus_sim_data *sim, const mbus_frame *frame, const unsigned char *data)
+{
+    mbus_sim_slave *slave;
+    size_t i;
+
+    for (i = 0; i < sim->nslaves; i++)
+    {
+        slave = &(sim->slaves[i]);
+
+        if (slave->primary != frame->address)
+            continue;
+
+        if (frame->control_information == MBUS_CONTROL_INFO_RESP_VARIABLE && frame->data_size >= 8 &&
+            slave->has_secondary && memcmp(slave->secondary, &data[7], 8) != 0)
+            continue;
+
+        return (int) i;
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+/// Add the replies of a capture log (see mbus-capture.h) to the slaves they
+/// are from, slaves not known yet are added. A slave takes the telegrams of
+/// its first complete readout, later replies are left out. Returns the
+/// number of telegrams added.
+//------------------------------------------------------------------------------
+int
+mbus_sim_add_capture_file(mbus_handle *handle, const char *path)
+{
+    mbus_capture_record record;
+    mbus_sim_data *sim;
+    mbus_sim_slave *slave;
+    mbus_frame frame;
+    const unsigned char *map = MAP_FAILED, *data;
+    char error_str[128];
+    size_t pos, end;
+    struct stat st;
+    int fd, index, ret, added = 0;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL || sim->running)
+    {
+        mbus_error_str_set("Invalid simulator handle.");
+        return -1;
+    }
+
+    if (path == NULL || (fd = open(path, O_RDONLY)) == -1)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: failed to open '%s'", __PRETTY_FUNCTION__, path ? path : "");
+        mbus_error_str_set(error_str);
+        return -1;
+    }
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = (const unsigned char *) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (map == MAP_FAILED || mbus_capture_check(map, (size_t) st.st_size, &end) != 0)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: '%s' is not a capture file", __PRETTY_FUNCTION__, path);
+        mbus_error_str_set(error_str);
+
+        if (map != MAP_FAILED)
+            munmap((void *) map, (size_t) st.st_size);
+
+        return -1;
+    }
+
+    pos = MBUS_CAPTURE_HEADER_SIZE;
+
+    while ((ret = mbus_capture_next(map, end, &pos, &record, &data)) == 1)
+    {
+        if (record.direction != MBUS_CAPTURE_RECV)
+            continue;
+
+        memset(&frame, 0, sizeof(frame));
+
+        if (mbus_parse(&frame, (unsigned char *) data, record.len) != 0 ||
+            frame.type != MBUS_FRAME_TYPE_LONG ||
+            mbus_frame_direction(&frame) != MBUS_CONTROL_MASK_DIR_S2M)
+            continue;
+
+        // errors of the slave and telegram functions are passed on as -2
+        if ((index = mbus_sim_find_slave(sim, &frame, data)) == -1 &&
+            (index = mbus_sim_add_slave(handle, frame.address, NULL)) == -1)
+        {
+            ret = -2;
+            break;
+        }
+
+        slave = &(sim->slaves[index]);
+
+        // the readout ends with the first telegram without DIF 0x1F
+        if (slave->ntelegrams >= MBUS_SIM_MAX_TELEGRAMS ||
+            (slave->ntelegrams > 0 && !slave->telegram_more[slave->ntelegrams - 1]))
+            continue;
+
+        if (mbus_sim_add_telegram(handle, index, data, record.len) != 0)
+        {
+            ret = -2;
+            break;
+        }
+
+        added++;
+    }
+
+    munmap((void *) map, (size_t) st.st_size);
+
+    if (ret == -1)
+    {
+        snprintf(error_str, sizeof(error_str), "%s: malformed record in '%s'", __PRETTY_FUNCTION__, path);
+        mbus_error_str_set(error_str);
+    }
+
+    if (ret != 0)
+        return -1;
+
+    return added;
+}
+
+//------------------------------------------------------------------------------
+/// Set the bus timing. A baud rate of zero transmits without delay.
+//------------------------------------------------------------------------------
+int
+mbus_sim_set_timing(mbus_handle *handle, long baudrate, long turnaround_us, long jitter_us)
+{
+    mbus_sim_data *sim;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL || sim->running ||
+        baudrate < 0 || turnaround_us < 0 || jitter_us < 0)
+    {
+        mbus_error_str_set("Invalid simulator handle or timing.");
+        return -1;
+    }
+
+    sim->baudrate = baudrate;
+    sim->port_baudrate = baudrate;
+    sim->turnaround_us = turnaround_us;
+    sim->jitter_us = jitter_us;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Set the probability that a slave does not reply, and the seed of the
+/// random numbers (drops and jitter), so that runs are reproducible
+//------------------------------------------------------------------------------
+int
+mbus_sim_set_drop_rate(mbus_handle *handle, double drop_rate, unsigned int seed)
+{
+    mbus_sim_data *sim;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL || sim->running ||
+        drop_rate < 0.0 || drop_rate > 1.0)
+    {
+        mbus_error_str_set("Invalid simulator handle or drop rate.");
+        return -1;
+    }
+
+    sim->drop_rate = drop_rate;
+    sim->seed = seed;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Delay the replies of a slave by turnaround_us on top of the bus timing
+//------------------------------------------------------------------------------
+int
+mbus_sim_set_slave_turnaround(mbus_handle *handle, int slave_index, long turnaround_us)
+{
+    mbus_sim_data *sim;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL || sim->running ||
+        slave_index < 0 || (size_t) slave_index >= sim->nslaves || turnaround_us < 0)
+    {
+        mbus_error_str_set("Invalid simulator handle, slave or turnaround.");
+        return -1;
+    }
+
+    sim->slaves[slave_index].turnaround_us = turnaround_us;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Set the rate a slave listens at (zero for the bus rate) and the highest
+/// rate it accepts in a switch baudrate frame (zero for none but its own)
+//------------------------------------------------------------------------------
+int
+mbus_sim_set_slave_baudrate(mbus_handle *handle, int slave_index, long baudrate, long max_baudrate)
+{
+    mbus_sim_data *sim;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL || sim->running ||
+        slave_index < 0 || (size_t) slave_index >= sim->nslaves || baudrate < 0 || max_baudrate < 0)
+    {
+        mbus_error_str_set("Invalid simulator handle, slave or baud rate.");
+        return -1;
+    }
+
+    sim->slaves[slave_index].current_baudrate = baudrate;
+    sim->slaves[slave_index].max_baudrate = max_baudrate;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Change the rate of the master end, like mbus_serial_set_baudrate. Frames
+/// are sent and replies are timed at this rate.
+//------------------------------------------------------------------------------
+int
+mbus_sim_set_baudrate(mbus_handle *handle, long baudrate)
+{
+    mbus_sim_data *sim;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL || baudrate <= 0)
+    {
+        mbus_error_str_set("Invalid simulator handle or baud rate.");
+        return -1;
+    }
+
+    __atomic_store_n(&(sim->port_baudrate), baudrate, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+long
+mbus_sim_get_baudrate(mbus_handle *handle)
+{
+    mbus_sim_data *sim;
+
+    if (handle == NULL || (sim = (mbus_sim_data *) handle->auxdata) == NULL)
+        return -1;
+
+    return __atomic_load_n(&(sim->port_baudrate), __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,121 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2011, Robert Johansson, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+/**
+ * @file   mbus-sim.h
+ *
+ * @brief  In-process M-Bus segment with simulated slaves.
+ *
+ * The slaves answer with recorded telegrams (e.g. the hex files in
+ * test/test-frames). A thread serves the bus end of a socket pair, so the
+ * handle works with the blocking, the non-blocking and the poll engine API
+ * like a serial or TCP handle:
+ * \verbatim
+ * handle = mbus_context_sim();
+ * slave = mbus_sim_add_slave(handle, 1, "1234567814490106");
+ * mbus_sim_add_telegram_file(handle, slave, "test-frames/abb_f95.hex");
+ * mbus_sim_set_timing(handle, 2400, 20000, 5000);
+ * mbus_connect(handle);
+ * \endverbatim
+ */
+
+#ifndef MBUS_SIM_H
+#define MBUS_SIM_H
+
+#include <pthread.h>
+
+#include "mbus-protocol-aux.h"
+#include "mbus-protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MBUS_SIM_MAX_TELEGRAMS 16    // telegrams per slave (multi-telegram replies)
+
+//
+// Simulated slave. Telegrams with DIF 0x1F are followed by the next one when
+// the master toggles the FCB, the last one wraps around to the first. A
+// switch baudrate frame (CI 0xB8-0xBF) up to max_baudrate is acknowledged at
+// the old rate, then the slave listens at the new one, also after reconnects.
+//
+typedef struct _mbus_sim_slave
+{
+    int primary;                                    // primary address
+    unsigned char secondary[8];                     // secondary address as in the telegram header
+    char has_secondary;                             // non zero if secondary is valid
+    char override_secondary;                        // secondary is patched into the telegrams
+    unsigned char *telegram[MBUS_SIM_MAX_TELEGRAMS];
+    size_t telegram_len[MBUS_SIM_MAX_TELEGRAMS];
+    char telegram_more[MBUS_SIM_MAX_TELEGRAMS];    // telegram ends with DIF 0x1F
+    size_t ntelegrams;
+    size_t next;                                    // telegram sent for the next REQ_UD2
+    int fcb;                                        // FCB of the last REQ_UD2, -1 after reset
+    char selected;                                  // selected by secondary address
+    long current_baudrate;                          // rate the slave listens at, zero for the bus rate
+    long max_baudrate;                              // highest rate the slave switches to, zero for none
+    long turnaround_us;                             // extra delay of the replies of this slave
+} mbus_sim_slave;
+
+typedef struct _mbus_sim_data
+{
+    mbus_sim_slave *slaves;
+    size_t nslaves;
+    size_t size;
+
+    long baudrate;                   // bus speed, zero for no transmission delay
+    long port_baudrate;              // rate of the master end, see mbus_sim_set_baudrate
+    long turnaround_us;              // delay of a slave reply after the request
+    long jitter_us;                  // random extra delay, 0 .. jitter_us
+    double drop_rate;                // probability that a slave does not reply
+    unsigned int seed;
+
+    int peer;                        // bus end of the socket pair
+    pthread_t thread;
+    char running;
+
+    mbus_frame_parser parser;        // master end
+    mbus_frame_parser bus_parser;    // bus end
+
+    // counters of the simulator, valid after mbus_disconnect
+    unsigned long requests;
+    unsigned long replies;
+    unsigned long drops;
+    unsigned long collisions;
+} mbus_sim_data;
+
+int  mbus_sim_connect(mbus_handle *handle);
+int  mbus_sim_disconnect(mbus_handle *handle);
+int  mbus_sim_send_frame(mbus_handle *handle, mbus_frame *frame);
+int  mbus_sim_recv_frame(mbus_handle *handle, mbus_frame *frame);
+void mbus_sim_data_free(mbus_handle *handle);
+long mbus_sim_get_timeout_us(mbus_handle *handle);
+
+// configuration, only while the handle is not connected
+int  mbus_sim_add_slave(mbus_handle *handle, int primary, const char *secondary);
+int  mbus_sim_add_telegram(mbus_handle *handle, int slave, const unsigned char *data, size_t data_size);
+int  mbus_sim_add_telegram_file(mbus_handle *handle, int slave, const char *path);
+
+// replies of a capture log (mbus-capture.h), returns the number of telegrams added
+int  mbus_sim_add_capture_file(mbus_handle *handle, const char *path);
+int  mbus_sim_set_timing(mbus_handle *handle, long baudrate, long turnaround_us, long jitter_us);
+int  mbus_sim_set_drop_rate(mbus_handle *handle, double drop_rate, unsigned int seed);
+int  mbus_sim_set_slave_baudrate(mbus_handle *handle, int slave, long baudrate, long max_baudrate);
+int  mbus_sim_set_slave_turnaround(mbus_handle *handle, int slave, long turnaround_us);
+
+// rate of the master end, a slave only hears frames sent at its own rate
+int  mbus_sim_set_baudrate(mbus_handle *handle, long baudrate);
+long mbus_sim_get_baudrate(mbus_handle *handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MBUS_SIM_H */
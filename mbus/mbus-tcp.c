@@ -11,15 +11,19 @@
 #include <unistd.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <errno.h>
@@ -32,17 +36,238 @@ static int tcp_timeout_sec = 4;
 static int tcp_timeout_usec = 0;
 
 //------------------------------------------------------------------------------
-/// Setup a TCP/IP handle.
+/// Monotonic clock in microseconds, used for the connect deadline and the
+/// cached resolution
+//------------------------------------------------------------------------------
+static long long
+mbus_tcp_clock_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static mbus_tcp_gateway *
+mbus_tcp_gateway_new(const char *host, uint16_t port)
+{
+    mbus_tcp_gateway *gateway;
+
+    if ((gateway = (mbus_tcp_gateway *) calloc(1, sizeof(mbus_tcp_gateway))) == NULL)
+        return NULL;
+
+    if ((gateway->host = strdup(host)) == NULL)
+    {
+        free(gateway);
+        return NULL;
+    }
+
+    gateway->port = port;
+
+    return gateway;
+}
+
+static void
+mbus_tcp_gateway_free(mbus_tcp_gateway *gateway)
+{
+    size_t i;
+
+    if (gateway == NULL)
+        return;
+
+    for (i = 0; i < gateway->nidle; i++)
+        close(gateway->idle_fd[i]);
+
+    if (gateway->addr)
+        freeaddrinfo(gateway->addr);
+
+    free(gateway->host);
+    free(gateway);
+}
+
+//------------------------------------------------------------------------------
+/// Gateway state of a handle: the pool entry for host and port, or a private
+/// entry if the handle is not pooled
+//------------------------------------------------------------------------------
+static mbus_tcp_gateway *
+mbus_tcp_gateway_get(mbus_tcp_data *tcp_data)
+{
+    mbus_tcp_gateway *gateway;
+
+    if (tcp_data->gateway)
+        return tcp_data->gateway;
+
+    if (tcp_data->pool)
+    {
+        for (gateway = tcp_data->pool->gateways; gateway; gateway = gateway->next)
+        {
+            if (gateway->port == tcp_data->port && strcmp(gateway->host, tcp_data->host) == 0)
+                return (tcp_data->gateway = gateway);
+        }
+    }
+
+    if ((gateway = mbus_tcp_gateway_new(tcp_data->host, tcp_data->port)) == NULL)
+        return NULL;
+
+    if (tcp_data->pool)
+    {
+        gateway->next = tcp_data->pool->gateways;
+        tcp_data->pool->gateways = gateway;
+    }
+
+    return (tcp_data->gateway = gateway);
+}
+
+//------------------------------------------------------------------------------
+/// Take an idle connection of a gateway. Connections closed by the gateway
+/// meanwhile are dropped, stale data (e.g. a late reply) is discarded.
+//------------------------------------------------------------------------------
+static int
+mbus_tcp_idle_take(mbus_tcp_gateway *gateway)
+{
+    unsigned char buff[PACKET_BUFF_SIZE];
+    ssize_t nread;
+    int fd;
+
+    while (gateway->nidle > 0)
+    {
+        fd = gateway->idle_fd[--gateway->nidle];
+
+        while ((nread = recv(fd, buff, sizeof(buff), MSG_DONTWAIT)) > 0)
+            ;
+
+        if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return fd;
+
+        close(fd);
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+/// Connect to a single address, giving up at deadline_us
+//------------------------------------------------------------------------------
+static int
+mbus_tcp_connect_addr(const struct addrinfo *ai, long long deadline_us)
+{
+    struct pollfd pfd;
+    socklen_t len;
+    long long remaining;
+    int fd, flags, ret, err;
+
+    if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+        return -1;
+
+    if ((flags = fcntl(fd, F_GETFL, 0)) == -1 ||
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+    {
+        if (errno != EINPROGRESS)
+        {
+            close(fd);
+            return -1;
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+
+        while (1)
+        {
+            if ((remaining = deadline_us - mbus_tcp_clock_us()) <= 0)
+            {
+                close(fd);
+                errno = ETIMEDOUT;
+                return -1;
+            }
+
+            ret = poll(&pfd, 1, (int) ((remaining + 999) / 1000));
+
+            if (ret == -1 && errno == EINTR)
+                continue;
+
+            if (ret <= 0)
+            {
+                close(fd);
+                errno = (ret == 0) ? ETIMEDOUT : errno;
+                return -1;
+            }
+
+            break;
+        }
+
+        len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+        {
+            close(fd);
+            errno = err;
+            return -1;
+        }
+    }
+
+    if (fcntl(fd, F_SETFL, flags) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+//------------------------------------------------------------------------------
+/// Apply the per handle socket options to the connection
+//------------------------------------------------------------------------------
+static void
+mbus_tcp_socket_setup(mbus_handle *handle, mbus_tcp_data *tcp_data)
+{
+    struct timeval time_out;
+    long timeout_us;
+    int flags, on;
+
+    // pooled connections may still be in non-blocking mode
+    if ((flags = fcntl(handle->fd, F_GETFL, 0)) != -1)
+        fcntl(handle->fd, F_SETFL, flags & ~O_NONBLOCK);
+
+    // Set a timeout
+    timeout_us = mbus_handle_timeout_us(handle);
+    time_out.tv_sec  = timeout_us / 1000000L;   // seconds
+    time_out.tv_usec = timeout_us % 1000000L;   // microseconds
+    setsockopt(handle->fd, SOL_SOCKET, SO_SNDTIMEO, &time_out, sizeof(time_out));
+    setsockopt(handle->fd, SOL_SOCKET, SO_RCVTIMEO, &time_out, sizeof(time_out));
+
+    on = tcp_data->nodelay ? 1 : 0;
+    setsockopt(handle->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    on = (tcp_data->keepalive_s > 0) ? 1 : 0;
+    setsockopt(handle->fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+
+#ifdef TCP_KEEPIDLE
+    if (tcp_data->keepalive_s > 0)
+        setsockopt(handle->fd, IPPROTO_TCP, TCP_KEEPIDLE, &(tcp_data->keepalive_s), sizeof(tcp_data->keepalive_s));
+#endif
+}
+
+//------------------------------------------------------------------------------
+/// Setup a TCP/IP handle. An idle connection of the pool is used if there is
+/// one, otherwise the gateway is connected with a deadline, trying all
+/// addresses (IPv4 and IPv6) the host resolves to. The resolution is cached.
 //------------------------------------------------------------------------------
 int
 mbus_tcp_connect(mbus_handle *handle)
 {
-    char error_str[128], *host;
-    struct hostent *host_addr;
-    struct sockaddr_in s;
-    struct timeval time_out;
+    char error_str[128], *host, port_str[8];
+    struct addrinfo hints, *ai;
     mbus_tcp_data *tcp_data;
+    mbus_tcp_gateway *gateway;
+    long long now, deadline;
     uint16_t port;
+    int fd = -1, ret;
 
     if (handle == NULL)
         return -1;
@@ -54,41 +279,98 @@ mbus_tcp_connect(mbus_handle *handle)
     host = tcp_data->host;
     port = tcp_data->port;
 
-    //
-    // create the TCP connection
-    //
-    if ((handle->fd = socket(AF_INET,SOCK_STREAM, 0)) < 0)
+    mbus_frame_parser_init(&(tcp_data->parser), NULL, NULL);
+
+    if ((gateway = mbus_tcp_gateway_get(tcp_data)) == NULL)
     {
-        snprintf(error_str, sizeof(error_str), "%s: failed to setup a socket.", __PRETTY_FUNCTION__);
+        snprintf(error_str, sizeof(error_str), "%s: failed to allocate gateway.", __PRETTY_FUNCTION__);
         mbus_error_str_set(error_str);
         return -1;
     }
 
-    s.sin_family = AF_INET;
-    s.sin_port = htons(port);
+    if ((fd = mbus_tcp_idle_take(gateway)) >= 0)
+        goto connected;
 
-    /* resolve hostname */
-    if ((host_addr = gethostbyname(host)) == NULL)
+    now = mbus_tcp_clock_us();
+
+    if (gateway->retry_after_us && now < gateway->retry_after_us)
     {
-        snprintf(error_str, sizeof(error_str), "%s: unknown host: %s", __PRETTY_FUNCTION__, host);
+        snprintf(error_str, sizeof(error_str), "%s: connection to %s:%d failed, retrying in %lld ms",
+                 __PRETTY_FUNCTION__, host, port, (gateway->retry_after_us - now + 999) / 1000);
         mbus_error_str_set(error_str);
         return -1;
     }
 
-    memcpy((void *)(&s.sin_addr), (void *)(host_addr->h_addr), host_addr->h_length);
+    /* resolve hostname */
+    if (gateway->addr && now - gateway->resolved_us > MBUS_TCP_RESOLVE_TTL)
+    {
+        freeaddrinfo(gateway->addr);
+        gateway->addr = NULL;
+    }
+
+    if (gateway->addr == NULL)
+    {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        snprintf(port_str, sizeof(port_str), "%u", (unsigned) port);
+
+        if ((ret = getaddrinfo(host, port_str, &hints, &(gateway->addr))) != 0)
+        {
+            gateway->addr = NULL;
+            snprintf(error_str, sizeof(error_str), "%s: unknown host: %s (%s)", __PRETTY_FUNCTION__, host, gai_strerror(ret));
+            mbus_error_str_set(error_str);
+            return -1;
+        }
+
+        gateway->resolved_us = now;
+    }
+
+    //
+    // create the TCP connection
+    //
+    deadline = now + (tcp_data->connect_timeout_us > 0 ? tcp_data->connect_timeout_us : MBUS_TCP_CONNECT_TIMEOUT_DEFAULT);
+
+    for (ai = gateway->addr; ai != NULL && fd < 0; ai = ai->ai_next)
+    {
+        fd = mbus_tcp_connect_addr(ai, deadline);
+
+        if (fd < 0 && errno == ETIMEDOUT)
+            break;
+    }
 
-    if (connect(handle->fd, (struct sockaddr *)&s, sizeof(s)) < 0)
+    if (fd < 0)
     {
+        // resolve again next time, the gateway may have moved
+        freeaddrinfo(gateway->addr);
+        gateway->addr = NULL;
+
+        // pooled gateways back off, so that a dead gateway fails fast
+        if (tcp_data->pool)
+        {
+            gateway->backoff_us = (gateway->backoff_us == 0) ? MBUS_TCP_BACKOFF_MIN :
+                                  (gateway->backoff_us >= MBUS_TCP_BACKOFF_MAX / 2) ? MBUS_TCP_BACKOFF_MAX :
+                                  2 * gateway->backoff_us;
+            gateway->retry_after_us = mbus_tcp_clock_us() + gateway->backoff_us;
+        }
+
         snprintf(error_str, sizeof(error_str), "%s: Failed to establish connection to %s:%d", __PRETTY_FUNCTION__, host, port);
         mbus_error_str_set(error_str);
         return -1;
     }
 
-    // Set a timeout
-    time_out.tv_sec  = tcp_timeout_sec;   // seconds
-    time_out.tv_usec = tcp_timeout_usec;  // microseconds
-    setsockopt(handle->fd, SOL_SOCKET, SO_SNDTIMEO, &time_out, sizeof(time_out));
-    setsockopt(handle->fd, SOL_SOCKET, SO_RCVTIMEO, &time_out, sizeof(time_out));
+    gateway->backoff_us = 0;
+    gateway->retry_after_us = 0;
+
+connected:
+    handle->fd = fd;
+    tcp_data->broken = 0;
+
+    mbus_tcp_socket_setup(handle, tcp_data);
+
+    handle->nonblocking = 0;
+    handle->deadline_us = 0;
+    handle->tx_len = handle->tx_sent = 0;
 
     return 0;
 }
@@ -110,6 +392,9 @@ mbus_tcp_data_free(mbus_handle *handle)
             return;
         }
 
+        if (tcp_data->pool == NULL)
+            mbus_tcp_gateway_free(tcp_data->gateway);
+
         free(tcp_data->host);
         free(tcp_data);
         handle->auxdata = NULL;
@@ -117,11 +402,14 @@ mbus_tcp_data_free(mbus_handle *handle)
 }
 
 //------------------------------------------------------------------------------
-//
+/// Close the connection, or hand it back to the pool if it is still in sync
 //------------------------------------------------------------------------------
 int
 mbus_tcp_disconnect(mbus_handle *handle)
 {
+    mbus_tcp_data *tcp_data;
+    mbus_tcp_gateway *gateway;
+
     if (handle == NULL)
     {
         return -1;
@@ -132,12 +420,116 @@ mbus_tcp_disconnect(mbus_handle *handle)
        return -1;
     }
 
-    close(handle->fd);
+    tcp_data = (mbus_tcp_data *) handle->auxdata;
+    gateway = tcp_data ? tcp_data->gateway : NULL;
+
+    if (tcp_data && tcp_data->pool && gateway && !tcp_data->broken &&
+        gateway->nidle < MBUS_TCP_POOL_IDLE_MAX &&
+        mbus_frame_parser_pending(&(tcp_data->parser)) == 0 &&
+        handle->tx_sent == handle->tx_len)
+    {
+        gateway->idle_fd[gateway->nidle++] = handle->fd;
+    }
+    else
+    {
+        close(handle->fd);
+    }
+
     handle->fd = -1;
 
     return 0;
 }
 
+//------------------------------------------------------------------------------
+/// Allocate an empty connection pool
+//------------------------------------------------------------------------------
+mbus_tcp_pool *
+mbus_tcp_pool_new(void)
+{
+    return (mbus_tcp_pool *) calloc(1, sizeof(mbus_tcp_pool));
+}
+
+//------------------------------------------------------------------------------
+/// Close all idle connections and free the pool. Handles attached to the pool
+/// must be freed first.
+//------------------------------------------------------------------------------
+void
+mbus_tcp_pool_free(mbus_tcp_pool *pool)
+{
+    mbus_tcp_gateway *gateway, *next;
+
+    if (pool == NULL)
+        return;
+
+    for (gateway = pool->gateways; gateway; gateway = next)
+    {
+        next = gateway->next;
+        mbus_tcp_gateway_free(gateway);
+    }
+
+    free(pool);
+}
+
+//------------------------------------------------------------------------------
+/// Attach a disconnected handle to a pool, NULL for a private connection
+//------------------------------------------------------------------------------
+int
+mbus_tcp_set_pool(mbus_handle *handle, mbus_tcp_pool *pool)
+{
+    mbus_tcp_data *tcp_data;
+
+    if (handle == NULL || handle->open != mbus_tcp_connect || handle->auxdata == NULL || handle->fd >= 0)
+    {
+        mbus_error_str_set("Invalid or connected TCP handle.");
+        return -1;
+    }
+
+    tcp_data = (mbus_tcp_data *) handle->auxdata;
+
+    if (tcp_data->pool == NULL)
+        mbus_tcp_gateway_free(tcp_data->gateway);
+
+    tcp_data->pool = pool;
+    tcp_data->gateway = NULL;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Set a TCP specific option (see mbus_context_set_option), applied at once
+/// if the handle is connected
+//------------------------------------------------------------------------------
+int
+mbus_tcp_set_option(mbus_handle *handle, mbus_context_option option, long value)
+{
+    mbus_tcp_data *tcp_data;
+
+    if (handle == NULL || handle->open != mbus_tcp_connect || handle->auxdata == NULL || value < 0)
+        return -1;
+
+    tcp_data = (mbus_tcp_data *) handle->auxdata;
+
+    switch (option)
+    {
+        case MBUS_OPTION_CONNECT_TIMEOUT:
+            tcp_data->connect_timeout_us = value;
+            return 0;
+        case MBUS_OPTION_TCP_NODELAY:
+            tcp_data->nodelay = (value != 0);
+            break;
+        case MBUS_OPTION_TCP_KEEPALIVE:
+            tcp_data->keepalive_s = (int) value;
+            break;
+        default:
+            return -1;
+    }
+
+    if (handle->fd >= 0)
+        mbus_tcp_socket_setup(handle, tcp_data);
+
+    return 0;
+}
+
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
@@ -167,9 +559,14 @@ mbus_tcp_send_frame(mbus_handle *handle, mbus_frame *frame)
         //
         if (handle->send_event)
             handle->send_event(MBUS_HANDLE_TYPE_TCP, buff, len);
+
+        mbus_handle_capture(handle, MBUS_CAPTURE_SEND, buff, len);
     }
     else
     {
+        if (handle->auxdata)
+            ((mbus_tcp_data *) handle->auxdata)->broken = 1;
+
         snprintf(error_str, sizeof(error_str), "%s: Failed to write frame to socket (ret = %d)\n", __PRETTY_FUNCTION__, ret);
         mbus_error_str_set(error_str);
         return -1;
@@ -183,65 +580,78 @@ mbus_tcp_send_frame(mbus_handle *handle, mbus_frame *frame)
 //------------------------------------------------------------------------------
 int mbus_tcp_recv_frame(mbus_handle *handle, mbus_frame *frame)
 {
-    char buff[PACKET_BUFF_SIZE];
-    int remaining;
-    ssize_t len, nread;
-
-    if (handle == NULL || frame == NULL) {
+    unsigned char buff[MBUS_FRAME_PARSER_BUFF_SIZE];
+    mbus_tcp_data *tcp_data;
+    mbus_frame_parser *parser;
+    const unsigned char *raw;
+    size_t raw_len;
+    struct pollfd pfd;
+    int result, ret, timeout_ms;
+    ssize_t nread;
+
+    if (handle == NULL || frame == NULL || handle->auxdata == NULL) {
         fprintf(stderr, "%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
         return MBUS_RECV_RESULT_ERROR;
     }
 
-    memset((void *) buff, 0, sizeof(buff));
+    tcp_data = (mbus_tcp_data *) handle->auxdata;
+    parser = &(tcp_data->parser);
 
     //
-    // read data until a packet is received
+    // read data until a packet is received. Whatever a read returns is fed to
+    // the parser, bytes following the frame are kept for the next call. The
+    // response timeout (at most the socket timeout) restarts with every chunk.
     //
-    remaining = 1; // start by reading 1 byte
-    len = 0;
+    timeout_ms = (int) ((mbus_handle_timeout_us(handle) + 999) / 1000);
 
-    do {
-retry:
-        if (len + remaining > PACKET_BUFF_SIZE)
-        {
-            // avoid out of bounds access
-            return MBUS_RECV_RESULT_ERROR;
+    pfd.fd = handle->fd;
+    pfd.events = POLLIN;
+
+    while ((result = mbus_frame_parser_next(parser, frame, &raw, &raw_len)) == 0) {
+        if ((ret = poll(&pfd, 1, timeout_ms)) == 0) {
+            mbus_frame_parser_reset(parser);
+            mbus_error_str_set("M-Bus tcp transport layer response timeout has been reached.");
+            return MBUS_RECV_RESULT_TIMEOUT;
         }
 
-        nread = read(handle->fd, &buff[len], remaining);
+        if (ret == -1 && errno == EINTR)
+            continue;
+
+        nread = read(handle->fd, buff, sizeof(parser->buff) - mbus_frame_parser_pending(parser));
         switch (nread) {
         case -1:
             if (errno == EINTR)
-                goto retry;
+                continue;
+
+            mbus_frame_parser_reset(parser);
 
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 mbus_error_str_set("M-Bus tcp transport layer response timeout has been reached.");
                 return MBUS_RECV_RESULT_TIMEOUT;
             }
 
+            tcp_data->broken = 1;
             mbus_error_str_set("M-Bus tcp transport layer failed to read data.");
             return MBUS_RECV_RESULT_ERROR;
         case 0:
+            tcp_data->broken = 1;
+            mbus_frame_parser_reset(parser);
             mbus_error_str_set("M-Bus tcp transport layer connection closed by remote host.");
             return MBUS_RECV_RESULT_RESET;
         default:
-            if (len > (SSIZE_MAX-nread))
-            {
-                // avoid overflow
-                return MBUS_RECV_RESULT_ERROR;
-            }
-
-            len += nread;
+            mbus_frame_parser_append(parser, buff, (size_t) nread);
         }
-    } while ((remaining = mbus_parse(frame, buff, len)) > 0);
+    }
 
     //
     // call the receive event function, if the callback function is registered
     //
     if (handle->recv_event)
-        handle->recv_event(MBUS_HANDLE_TYPE_TCP, buff, len);
+        handle->recv_event(MBUS_HANDLE_TYPE_TCP, (const char *) raw, raw_len);
 
-    if (remaining < 0) {
+    mbus_handle_capture(handle, MBUS_CAPTURE_RECV, raw, raw_len);
+
+    if (result < 0) {
         mbus_error_str_set("M-Bus layer failed to parse data.");
         return MBUS_RECV_RESULT_INVALID;
     }
@@ -268,3 +678,12 @@ mbus_tcp_set_timeout_set(double seconds)
 
     return 0;
 }
+
+//------------------------------------------------------------------------------
+/// The default response timeout of TCP handles in microseconds
+//------------------------------------------------------------------------------
+long
+mbus_tcp_get_timeout_us(void)
+{
+    return tcp_timeout_sec * 1000000L + tcp_timeout_usec;
+}
@@ -26,10 +26,54 @@ extern "C" {
 #endif
 
 
+#define MBUS_TCP_CONNECT_TIMEOUT_DEFAULT 5000000L    // usec
+#define MBUS_TCP_RESOLVE_TTL             300000000LL  // usec, cached addresses are resolved again after this
+#define MBUS_TCP_BACKOFF_MIN             1000000L     // usec, first reconnect delay of a pooled gateway
+#define MBUS_TCP_BACKOFF_MAX             60000000L    // usec
+#define MBUS_TCP_POOL_IDLE_MAX           4            // idle connections kept per gateway
+
+struct addrinfo;
+
+//
+// Connection state of a gateway (host and port): the cached address
+// resolution, idle connections and the reconnect backoff. Shared by all
+// handles of a pool, private to the handle otherwise.
+//
+typedef struct _mbus_tcp_gateway
+{
+    char *host;
+    uint16_t port;
+    struct addrinfo *addr;           // cached getaddrinfo result, NULL if not resolved
+    long long resolved_us;           // monotonic time of the resolution
+    int idle_fd[MBUS_TCP_POOL_IDLE_MAX];
+    size_t nidle;
+    long backoff_us;                 // zero unless the last connect failed (pooled only)
+    long long retry_after_us;        // connects fail at once before this time
+    struct _mbus_tcp_gateway *next;
+} mbus_tcp_gateway;
+
+//
+// Pool of gateway connections. A handle attached with mbus_tcp_set_pool
+// hands its connection back to the pool on mbus_disconnect, and the next
+// mbus_connect to the same gateway picks it up again. A pool is not thread
+// safe, use one per thread.
+//
+typedef struct _mbus_tcp_pool
+{
+    mbus_tcp_gateway *gateways;
+} mbus_tcp_pool;
+
 typedef struct _mbus_tcp_data
 {
     char *host;
     uint16_t port;
+    mbus_frame_parser parser;
+    mbus_tcp_pool *pool;             // NULL for a private connection
+    mbus_tcp_gateway *gateway;       // pool entry or private state
+    long connect_timeout_us;         // zero for MBUS_TCP_CONNECT_TIMEOUT_DEFAULT
+    int nodelay;                     // set TCP_NODELAY
+    int keepalive_s;                 // TCP keepalive idle time, zero for off
+    int broken;                      // connection failed, not to be pooled
 } mbus_tcp_data;
 
 int  mbus_tcp_connect(mbus_handle *handle);
@@ -38,6 +82,12 @@ int  mbus_tcp_send_frame(mbus_handle *handle, mbus_frame *frame);
 int  mbus_tcp_recv_frame(mbus_handle *handle, mbus_frame *frame);
 void mbus_tcp_data_free(mbus_handle *handle);
 int  mbus_tcp_set_timeout_set(double seconds);
+long mbus_tcp_get_timeout_us(void);
+
+mbus_tcp_pool *mbus_tcp_pool_new(void);
+void           mbus_tcp_pool_free(mbus_tcp_pool *pool);
+int            mbus_tcp_set_pool(mbus_handle *handle, mbus_tcp_pool *pool);
+int            mbus_tcp_set_option(mbus_handle *handle, mbus_context_option option, long value);
 
 #ifdef __cplusplus
 }
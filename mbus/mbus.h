@@ -37,6 +37,10 @@
 #include "mbus-protocol-aux.h"
 #include "mbus-tcp.h"
 #include "mbus-serial.h"
+#include "mbus-sim.h"
+#include "mbus-poll.h"
+#include "mbus-ring.h"
+#include "mbus-capture.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -0,0 +1,722 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+/**
+ * @file   mbus.hpp
+ *
+ * @brief  Header-only C++20 binding of the libmbus API.
+ *
+ * Handles, frames, frame data and the strings returned by the XML functions
+ * are move-only owners of the C objects and free them when they go out of
+ * scope. Records, telegrams and frame views are non-owning and give access
+ * to the data through std::span and std::string_view, nothing is copied.
+ * Failing calls return an mbus::result holding an mbus::error, read from the
+ * (thread-local) error string right after the call on the calling thread.
+ * mbus::result is std::expected when the standard library provides it.
+ *
+\verbatim
+#include <mbus/mbus.hpp>
+
+auto handle = mbus::handle::serial("/dev/ttyUSB0");
+if (!handle || !handle->connect())
+    return;
+
+if (auto reply = handle->request(1))
+{
+    if (auto data = mbus::frame_data::parse(*reply))
+    {
+        for (mbus::record_ref record : data->records())
+            use(record.function(), record.data());
+    }
+}
+\endverbatim
+ */
+
+#ifndef _MBUS_HPP_
+#define _MBUS_HPP_
+
+#if __cplusplus < 202002L
+#error "mbus.hpp requires C++20"
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <version>
+
+#ifdef __cpp_lib_expected
+#include <expected>
+#endif
+
+#include "mbus.h"
+
+namespace mbus {
+
+/**
+ * Error of a failed call: the return code of the C function and the error
+ * string of the calling thread at the time
+ */
+struct error {
+    int code;                    /**< return code, e.g. MBUS_RECV_RESULT_TIMEOUT */
+    std::string message;         /**< mbus_error_str(), may be empty */
+
+    /**
+     * Capture the error string of the calling thread
+     *
+     * @param code return code of the failed call
+     */
+    static error last(int code)
+    {
+        const char *message = mbus_error_str();
+
+        return error{code, message ? message : ""};
+    }
+};
+
+#ifdef __cpp_lib_expected
+
+template <class T>
+using result = std::expected<T, error>;
+
+using std::unexpected;
+
+#else
+
+/**
+ * Error value of a result, as std::unexpected
+ */
+template <class E>
+class unexpected {
+public:
+    explicit unexpected(E e) : error_(std::move(e)) {}
+
+    E &error() & noexcept { return error_; }
+    const E &error() const & noexcept { return error_; }
+    E &&error() && noexcept { return std::move(error_); }
+
+private:
+    E error_;
+};
+
+/**
+ * Value or error, the subset of std::expected used by this binding
+ */
+template <class T>
+class result {
+public:
+    result(T value) : v_(std::in_place_index<0>, std::move(value)) {}
+    result(unexpected<mbus::error> e) : v_(std::in_place_index<1>, std::move(e).error()) {}
+
+    bool has_value() const noexcept { return v_.index() == 0; }
+    explicit operator bool() const noexcept { return has_value(); }
+
+    T &value() & { return std::get<0>(v_); }
+    const T &value() const & { return std::get<0>(v_); }
+    T &&value() && { return std::get<0>(std::move(v_)); }
+
+    T &operator*() & { return std::get<0>(v_); }
+    const T &operator*() const & { return std::get<0>(v_); }
+    T &&operator*() && { return std::get<0>(std::move(v_)); }
+    T *operator->() { return &std::get<0>(v_); }
+    const T *operator->() const { return &std::get<0>(v_); }
+
+    mbus::error &error() & { return std::get<1>(v_); }
+    const mbus::error &error() const & { return std::get<1>(v_); }
+
+private:
+    std::variant<T, mbus::error> v_;
+};
+
+template <>
+class result<void> {
+public:
+    result() noexcept {}
+    result(unexpected<mbus::error> e) : error_(std::move(e).error()), failed_(true) {}
+
+    bool has_value() const noexcept { return !failed_; }
+    explicit operator bool() const noexcept { return has_value(); }
+    void value() const {}
+
+    mbus::error &error() & { return error_; }
+    const mbus::error &error() const & { return error_; }
+
+private:
+    mbus::error error_{};
+    bool failed_ = false;
+};
+
+#endif
+
+/**
+ * Error result of the last call on this thread
+ */
+inline unexpected<error> last_error(int code)
+{
+    return unexpected<error>(error::last(code));
+}
+
+/**
+ * String returned by the C library, released with free()
+ */
+class owned_string {
+public:
+    owned_string() noexcept = default;
+    explicit owned_string(char *str) noexcept : str_(str) {}
+
+    std::string_view view() const noexcept { return str_ ? std::string_view(str_.get()) : std::string_view(); }
+    const char *c_str() const noexcept { return str_ ? str_.get() : ""; }
+    operator std::string_view() const noexcept { return view(); }
+
+private:
+    struct deleter {
+        void operator()(char *str) const noexcept { std::free(str); }
+    };
+
+    std::unique_ptr<char, deleter> str_;
+};
+
+/**
+ * Non-owning range over a list linked through void *next, as the records of
+ * a frame data structure and the telegrams of a multi-telegram reply
+ */
+template <class Node, class Ref>
+class list_range {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Ref;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() noexcept = default;
+        explicit iterator(Node *node) noexcept : node_(node) {}
+
+        Ref operator*() const noexcept { return Ref(node_); }
+        iterator &operator++() noexcept { node_ = static_cast<Node *>(node_->next); return *this; }
+        iterator operator++(int) noexcept { iterator i = *this; ++*this; return i; }
+        bool operator==(const iterator &other) const noexcept = default;
+
+    private:
+        Node *node_ = nullptr;
+    };
+
+    explicit list_range(Node *head) noexcept : head_(head) {}
+
+    iterator begin() const noexcept { return iterator(head_); }
+    iterator end() const noexcept { return iterator(); }
+    bool empty() const noexcept { return head_ == nullptr; }
+
+private:
+    Node *head_;
+};
+
+/**
+ * One data record of a frame data structure (non-owning)
+ */
+class record_ref {
+public:
+    explicit record_ref(const mbus_data_record *record) noexcept : record_(record) {}
+
+    const mbus_data_record *get() const noexcept { return record_; }
+
+    unsigned char dif() const noexcept { return record_->drh.dib.dif; }
+    unsigned char vif() const noexcept { return record_->drh.vib.vif; }
+    std::span<const unsigned char> dife() const noexcept { return {record_->drh.dib.dife, record_->drh.dib.ndife}; }
+    std::span<const unsigned char> vife() const noexcept { return {record_->drh.vib.vife, record_->drh.vib.nvife}; }
+
+    /** data field as transmitted (LSB first) */
+    std::span<const unsigned char> data() const noexcept { return {record_->data, record_->data_len}; }
+    time_t timestamp() const noexcept { return record_->timestamp; }
+
+    long storage_number() const noexcept { return mbus_data_record_storage_number(ptr()); }
+    long tariff() const noexcept { return mbus_data_record_tariff(ptr()); }
+    int device() const noexcept { return mbus_data_record_device(ptr()); }
+
+    /** function field, static string */
+    std::string_view function() const noexcept
+    {
+        const char *function = mbus_data_record_function(ptr());
+
+        return function ? std::string_view(function) : std::string_view();
+    }
+
+    /**
+     * Decoded value, unit and exponent. Raw values point into the record.
+     */
+    result<mbus_typed_value> typed_value() const
+    {
+        mbus_typed_value value;
+        int ret;
+
+        if ((ret = mbus_data_record_typed_value(ptr(), &value)) != 0)
+            return last_error(ret);
+
+        return value;
+    }
+
+    /**
+     * Value as text, written to a caller supplied buffer
+     *
+     * @param buff buffer for the text
+     *
+     * @return view of the text in buff
+     */
+    std::string_view value(std::span<char> buff) const noexcept
+    {
+        const char *str = mbus_data_record_value_r(ptr(), buff.data(), buff.size());
+
+        return str ? std::string_view(str) : std::string_view();
+    }
+
+    /**
+     * Unit as text, written to a caller supplied buffer
+     *
+     * @param buff buffer for the text
+     *
+     * @return view of the text in buff
+     */
+    std::string_view unit(std::span<char> buff) const noexcept
+    {
+        const char *str = mbus_data_record_unit_r(ptr(), buff.data(), buff.size());
+
+        return str ? std::string_view(str) : std::string_view();
+    }
+
+private:
+    // the C functions do not modify the record, but are not const correct
+    mbus_data_record *ptr() const noexcept { return const_cast<mbus_data_record *>(record_); }
+
+    const mbus_data_record *record_;
+};
+
+/**
+ * One telegram of a (multi-telegram) reply (non-owning)
+ */
+class telegram_ref {
+public:
+    explicit telegram_ref(const mbus_frame *frame) noexcept : frame_(frame) {}
+
+    const mbus_frame *get() const noexcept { return frame_; }
+
+    int type() const noexcept { return frame_->type; }
+    unsigned char control() const noexcept { return frame_->control; }
+    unsigned char address() const noexcept { return frame_->address; }
+    unsigned char control_information() const noexcept { return frame_->control_information; }
+    time_t timestamp() const noexcept { return frame_->timestamp; }
+
+    /** user data of a long frame */
+    std::span<const unsigned char> data() const noexcept { return {frame_->data, frame_->data_size}; }
+
+private:
+    const mbus_frame *frame_;
+};
+
+/**
+ * Heap allocated frame, owning the telegrams that follow it in a
+ * multi-telegram reply
+ */
+class frame {
+public:
+    /**
+     * Allocate an empty frame
+     *
+     * @param type MBUS_FRAME_TYPE_*
+     */
+    static result<frame> make(int type = MBUS_FRAME_TYPE_ANY)
+    {
+        mbus_frame *f;
+
+        if ((f = mbus_frame_new(type)) == nullptr)
+            return unexpected<error>(error{-1, "Failed to allocate frame."});
+
+        return frame(f);
+    }
+
+    /**
+     * Parse a frame from a buffer, as mbus_parse
+     *
+     * @param buff complete frame
+     */
+    static result<frame> parse(std::span<const unsigned char> buff)
+    {
+        auto f = make();
+        int ret;
+
+        if (!f)
+            return f;
+
+        if ((ret = mbus_parse(f->get(), const_cast<unsigned char *>(buff.data()), buff.size())) != 0)
+            return last_error(ret);
+
+        return f;
+    }
+
+    explicit frame(mbus_frame *f) noexcept : frame_(f) {}
+
+    mbus_frame *get() const noexcept { return frame_.get(); }
+    mbus_frame *release() noexcept { return frame_.release(); }
+
+    /** first telegram */
+    telegram_ref front() const noexcept { return telegram_ref(frame_.get()); }
+
+    /** all telegrams of the reply */
+    list_range<const mbus_frame, telegram_ref> telegrams() const noexcept
+    {
+        return list_range<const mbus_frame, telegram_ref>(frame_.get());
+    }
+
+    /** XML of all telegrams, as mbus_frame_xml */
+    result<owned_string> xml() const
+    {
+        char *str;
+
+        if ((str = mbus_frame_xml(frame_.get())) == nullptr)
+            return last_error(-1);
+
+        return owned_string(str);
+    }
+
+private:
+    struct deleter {
+        void operator()(mbus_frame *f) const noexcept { mbus_frame_free(f); }
+    };
+
+    std::unique_ptr<mbus_frame, deleter> frame_;
+};
+
+/**
+ * Decoded frame data, owning its records
+ */
+class frame_data {
+public:
+    /**
+     * Decode the first telegram of a frame, as mbus_frame_data_parse
+     */
+    static result<frame_data> parse(const frame &f)
+    {
+        mbus_frame_data *data;
+        int ret;
+
+        if ((data = mbus_frame_data_new()) == nullptr)
+            return unexpected<error>(error{-1, "Failed to allocate frame data."});
+
+        frame_data owner(data);
+
+        if ((ret = mbus_frame_data_parse(f.get(), data)) != 0)
+            return last_error(ret);
+
+        return owner;
+    }
+
+    explicit frame_data(mbus_frame_data *data) noexcept : data_(data) {}
+
+    mbus_frame_data *get() const noexcept { return data_.get(); }
+
+    /** MBUS_DATA_TYPE_* */
+    int type() const noexcept { return data_->type; }
+
+    /** header of variable data */
+    const mbus_data_variable_header &header() const noexcept { return data_->data_var.header; }
+
+    /** records of variable data */
+    list_range<const mbus_data_record, record_ref> records() const noexcept
+    {
+        return list_range<const mbus_data_record, record_ref>(data_->data_var.record);
+    }
+
+    /** XML, as mbus_frame_data_xml */
+    result<owned_string> xml() const
+    {
+        char *str;
+
+        if ((str = mbus_frame_data_xml(data_.get())) == nullptr)
+            return last_error(-1);
+
+        return owned_string(str);
+    }
+
+    /** XML with normalized values, as mbus_frame_data_xml_normalized */
+    result<owned_string> xml_normalized() const
+    {
+        char *str;
+
+        if ((str = mbus_frame_data_xml_normalized(data_.get())) == nullptr)
+            return last_error(-1);
+
+        return owned_string(str);
+    }
+
+private:
+    struct deleter {
+        void operator()(mbus_frame_data *data) const noexcept { mbus_frame_data_free(data); }
+    };
+
+    std::unique_ptr<mbus_frame_data, deleter> data_;
+};
+
+/**
+ * Read-only view of a frame in a receive buffer, see mbus_frame_view_init.
+ * The buffer must outlive the view.
+ */
+class frame_view {
+public:
+    /**
+     * One record of the view, as offsets into the user data
+     */
+    class record {
+    public:
+        record(const mbus_frame_view *view, const mbus_record_view &rv) noexcept : view_(view), rv_(rv) {}
+
+        const mbus_record_view &get() const noexcept { return rv_; }
+
+        unsigned char dif() const noexcept { return rv_.dif; }
+        unsigned char vif() const noexcept { return rv_.vif; }
+        std::span<const unsigned char> data() const noexcept { return {view_->data + rv_.data_offset, rv_.data_len}; }
+
+        /** decode into a record struct, as mbus_record_view_decode */
+        result<mbus_data_record> decode() const
+        {
+            mbus_data_record r;
+            int ret;
+
+            if ((ret = mbus_record_view_decode(view_, &rv_, &r)) != 0)
+                return last_error(ret);
+
+            return r;
+        }
+
+    private:
+        const mbus_frame_view *view_;
+        mbus_record_view rv_;
+    };
+
+    /**
+     * Iterates over the records, stops at the first malformed one
+     */
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = record;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() noexcept = default;
+        explicit iterator(const mbus_frame_view *view) noexcept : view_(view) { ++*this; }
+
+        record operator*() const noexcept { return record(view_, rv_); }
+        iterator &operator++() noexcept
+        {
+            if (mbus_frame_view_next_record(view_, &pos_, &rv_) != 1)
+                view_ = nullptr;
+            return *this;
+        }
+        void operator++(int) noexcept { ++*this; }
+        bool operator==(const iterator &other) const noexcept { return view_ == other.view_; }
+
+    private:
+        const mbus_frame_view *view_ = nullptr;
+        size_t pos_ = 0;
+        mbus_record_view rv_{};
+    };
+
+    /**
+     * Set up a view of the frame at the start of buff
+     *
+     * @return the view, or an error with the number of missing bytes (> 0)
+     *         or the result of the validation (< 0) as code
+     */
+    static result<frame_view> parse(std::span<const unsigned char> buff)
+    {
+        frame_view v;
+        int ret;
+
+        if ((ret = mbus_frame_view_init(&(v.view_), buff.data(), buff.size())) != 0)
+            return last_error(ret);
+
+        return v;
+    }
+
+    const mbus_frame_view *get() const noexcept { return &view_; }
+
+    int type() const noexcept { return view_.type; }
+    unsigned char control() const noexcept { return view_.control; }
+    unsigned char address() const noexcept { return view_.address; }
+    unsigned char control_information() const noexcept { return view_.control_information; }
+
+    /** bytes of the frame in the buffer */
+    std::span<const unsigned char> bytes() const noexcept { return {view_.buff, view_.size}; }
+
+    /** user data */
+    std::span<const unsigned char> data() const noexcept { return {view_.data, view_.data_size}; }
+
+    iterator begin() const noexcept { return iterator(&view_); }
+    iterator end() const noexcept { return iterator(); }
+
+private:
+    frame_view() noexcept : view_{} {}
+
+    mbus_frame_view view_;
+};
+
+/**
+ * Serial, TCP or simulator handle, disconnected and freed on destruction
+ */
+class handle {
+public:
+    /** serial context, as mbus_context_serial */
+    static result<handle> serial(const char *device) { return make(mbus_context_serial(device)); }
+
+    /** TCP context, as mbus_context_tcp */
+    static result<handle> tcp(const char *host, uint16_t port) { return make(mbus_context_tcp(host, port)); }
+
+    /** simulator context, as mbus_context_sim */
+    static result<handle> sim() { return make(mbus_context_sim()); }
+
+    explicit handle(mbus_handle *h) noexcept : handle_(h) {}
+
+    handle(handle &&other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)), connected_(std::exchange(other.connected_, false)) {}
+
+    handle &operator=(handle &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            handle_ = std::exchange(other.handle_, nullptr);
+            connected_ = std::exchange(other.connected_, false);
+        }
+        return *this;
+    }
+
+    handle(const handle &) = delete;
+    handle &operator=(const handle &) = delete;
+
+    ~handle() { reset(); }
+
+    mbus_handle *get() const noexcept { return handle_; }
+    bool connected() const noexcept { return connected_; }
+
+    result<void> connect()
+    {
+        int ret;
+
+        if ((ret = mbus_connect(handle_)) != 0)
+            return last_error(ret);
+
+        connected_ = true;
+        return {};
+    }
+
+    result<void> disconnect()
+    {
+        int ret;
+
+        connected_ = false;
+
+        if ((ret = mbus_disconnect(handle_)) != 0)
+            return last_error(ret);
+
+        return {};
+    }
+
+    result<void> set_option(mbus_context_option option, long value)
+    {
+        int ret;
+
+        if ((ret = mbus_context_set_option(handle_, option, value)) != 0)
+            return last_error(ret);
+
+        return {};
+    }
+
+    /** send a REQ_UD2, as mbus_send_request_frame */
+    result<void> send_request(int address)
+    {
+        int ret;
+
+        if ((ret = mbus_send_request_frame(handle_, address)) != 0)
+            return last_error(ret);
+
+        return {};
+    }
+
+    /**
+     * Receive a frame, as mbus_recv_frame
+     *
+     * @return the frame, or an error with a MBUS_RECV_RESULT_* code
+     */
+    result<frame> recv()
+    {
+        auto f = frame::make();
+        int ret;
+
+        if (!f)
+            return f;
+
+        if ((ret = mbus_recv_frame(handle_, f->get())) != MBUS_RECV_RESULT_OK)
+            return last_error(ret);
+
+        return f;
+    }
+
+    /**
+     * Request the data of a slave with all telegrams, as mbus_sendrecv_request
+     *
+     * @param address    primary address
+     * @param max_frames limit of telegrams (0 = no limit)
+     */
+    result<frame> request(int address, int max_frames = 0)
+    {
+        auto f = frame::make();
+        int ret;
+
+        if (!f)
+            return f;
+
+        if ((ret = mbus_sendrecv_request(handle_, address, f->get(), max_frames)) != 0)
+            return last_error(ret);
+
+        return f;
+    }
+
+private:
+    static result<handle> make(mbus_handle *h)
+    {
+        if (h == nullptr)
+            return last_error(-1);
+
+        return handle(h);
+    }
+
+    void reset() noexcept
+    {
+        if (handle_ == nullptr)
+            return;
+
+        if (connected_)
+            mbus_disconnect(handle_);
+
+        mbus_context_free(handle_);
+        handle_ = nullptr;
+        connected_ = false;
+    }
+
+    mbus_handle *handle_ = nullptr;
+    bool connected_ = false;
+};
+
+} // namespace mbus
+
+#endif /* _MBUS_HPP_ */
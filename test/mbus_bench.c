@@ -0,0 +1,591 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Micro-benchmarks for the parse, decode and serialize paths. Every benchmark
+// runs over all frames of the given hex files (e.g. test-frames/*.hex) and
+// reports the throughput and the heap usage per frame, as tab separated
+// values or (-j) as JSON.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mbus/mbus.h>
+
+//------------------------------------------------------------------------------
+// Heap accounting. With glibc the allocator is wrapped to count the calls
+// made by the library as well; elsewhere the allocation columns read -1.
+// Sanitizers bring their own allocator, so the accounting is left out for
+// them, or on request with -DBENCH_NO_ALLOC_STATS.
+//------------------------------------------------------------------------------
+static unsigned long long bench_allocs = 0;
+static unsigned long long bench_bytes = 0;
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(memory_sanitizer) || __has_feature(thread_sanitizer)
+#define BENCH_NO_ALLOC_STATS 1
+#endif
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define BENCH_NO_ALLOC_STATS 1
+#endif
+
+#if defined(__GLIBC__) && !defined(BENCH_NO_ALLOC_STATS)
+#define BENCH_ALLOC_STATS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void  __libc_free(void *ptr);
+
+void *
+malloc(size_t size)
+{
+    bench_allocs++;
+    bench_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    bench_allocs++;
+    bench_bytes += nmemb * size;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    bench_allocs++;
+    bench_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#else
+#define BENCH_ALLOC_STATS 0
+#endif
+
+//------------------------------------------------------------------------------
+// Corpus
+//------------------------------------------------------------------------------
+typedef struct _bench_frame {
+    unsigned char buff[4096];
+    size_t len;
+    mbus_frame frame;
+    mbus_frame_data data;
+    size_t nrecords;
+    mbus_data_record *normalized[256];  // records mbus_parse_variable_record accepts
+    size_t nnormalized;
+} bench_frame;
+
+typedef struct _bench_result {
+    unsigned long long frames;
+    unsigned long long records;
+    unsigned long long ns;
+    unsigned long long allocs;
+    unsigned long long bytes;
+} bench_result;
+
+// returns the number of records processed
+typedef size_t (*bench_func)(bench_frame *f);
+
+static mbus_record_arena *bench_arena = NULL;
+static mbus_frame_cache bench_cache;
+static mbus_layout_cache bench_layout;
+static mbus_ring *bench_ring = NULL;
+static mbus_capture *bench_capture = NULL;
+static size_t bench_sink_bytes = 0;
+
+static int
+bench_sink(mbus_writer *writer, const char *data, size_t data_len)
+{
+    (void) writer;
+    (void) data;
+
+    bench_sink_bytes += data_len;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Benchmarks, each processes a single frame of the corpus
+//------------------------------------------------------------------------------
+static size_t
+bench_parse(bench_frame *f)
+{
+    mbus_frame frame;
+
+    mbus_parse(&frame, f->buff, f->len);
+
+    return f->nrecords;
+}
+
+static size_t
+bench_data_parse(bench_frame *f)
+{
+    mbus_frame_data data;
+
+    memset(&data, 0, sizeof(data));
+
+    if (mbus_frame_data_parse(&(f->frame), &data) == 0)
+        mbus_data_record_free(data.data_var.record);
+
+    return f->nrecords;
+}
+
+static size_t
+bench_data_parse_arena(bench_frame *f)
+{
+    mbus_frame_data data;
+
+    memset(&data, 0, sizeof(data));
+
+    mbus_frame_data_parse_arena(&(f->frame), &data, bench_arena);
+    mbus_record_arena_reset(bench_arena);
+
+    return f->nrecords;
+}
+
+// repeated telegrams, all but the first pass are cache hits
+static size_t
+bench_cache_parse(bench_frame *f)
+{
+    mbus_frame_data *data;
+
+    mbus_frame_cache_parse(&bench_cache, &(f->frame), &data);
+
+    return f->nrecords;
+}
+
+static size_t
+bench_record_value(bench_frame *f)
+{
+    mbus_data_record *record;
+
+    for (record = f->data.data_var.record; record; record = record->next)
+        mbus_data_record_value(record);
+
+    return f->nrecords;
+}
+
+static size_t
+bench_typed_value(bench_frame *f)
+{
+    mbus_data_record *record;
+    mbus_typed_value value;
+
+    for (record = f->data.data_var.record; record; record = record->next)
+        mbus_data_record_typed_value(record, &value);
+
+    return f->nrecords;
+}
+
+// same values as above, straight from the frame with a cached layout plan
+static size_t
+bench_layout_decode(bench_frame *f)
+{
+    mbus_typed_value values[256];
+
+    mbus_layout_cache_decode(&bench_layout, &(f->frame), NULL, values, NITEMS(values));
+
+    return f->nrecords;
+}
+
+static size_t
+bench_vib_unit_lookup(bench_frame *f)
+{
+    mbus_data_record *record;
+
+    for (record = f->data.data_var.record; record; record = record->next)
+        mbus_vib_unit_lookup(&(record->drh.vib));
+
+    return f->nrecords;
+}
+
+static size_t
+bench_normalize(bench_frame *f)
+{
+    size_t i;
+
+    for (i = 0; i < f->nnormalized; i++)
+        mbus_record_free(mbus_parse_variable_record(f->normalized[i]));
+
+    return f->nnormalized;
+}
+
+static size_t
+bench_find_record(bench_frame *f)
+{
+    static const unsigned char vifs[] = { 0x00, 0x10 };  // energy (Wh) and volume
+    mbus_frame_view view;
+    mbus_record_view record_view;
+    mbus_record_filter filter;
+    mbus_data_record record;
+    char buff[768];
+    size_t pos = 0;
+
+    mbus_record_filter_init(&filter);
+    filter.vif = vifs;
+    filter.nvif = sizeof(vifs);
+    filter.vif_mask = 0x78;
+    filter.storage_number = 0;
+    filter.tariff = 0;
+
+    if (mbus_frame_view_of(&view, &(f->frame)) != 0 ||
+        view.control_information != MBUS_CONTROL_INFO_RESP_VARIABLE)
+        return 0;
+
+    while (mbus_frame_view_find_record(&view, &pos, &filter, &record_view) == 1)
+    {
+        mbus_record_view_decode(&view, &record_view, &record);
+        mbus_data_record_value_r(&record, buff, sizeof(buff));
+    }
+
+    return f->nrecords;
+}
+
+static size_t
+bench_xml(bench_frame *f)
+{
+    free(mbus_frame_data_xml(&(f->data)));
+
+    return f->nrecords;
+}
+
+static size_t
+bench_xml_normalized(bench_frame *f)
+{
+    free(mbus_frame_data_xml_normalized(&(f->data)));
+
+    return f->nrecords;
+}
+
+static size_t
+bench_write_xml(bench_frame *f)
+{
+    mbus_writer writer;
+
+    mbus_writer_init(&writer, MBUS_WRITER_FORMAT_XML, bench_sink, NULL);
+    mbus_frame_data_write(&writer, &(f->data));
+    mbus_writer_flush(&writer);
+
+    return f->nrecords;
+}
+
+static size_t
+bench_write_json(bench_frame *f)
+{
+    mbus_writer writer;
+
+    mbus_writer_init(&writer, MBUS_WRITER_FORMAT_JSON, bench_sink, NULL);
+    mbus_frame_data_write(&writer, &(f->data));
+    mbus_writer_flush(&writer);
+
+    return f->nrecords;
+}
+
+static size_t
+bench_ring_publish(bench_frame *f)
+{
+    mbus_ring_publish_frame_data(bench_ring, &(f->data));
+
+    return f->nrecords;
+}
+
+static size_t
+bench_capture_write(bench_frame *f)
+{
+    mbus_capture_write(bench_capture, MBUS_CAPTURE_RECV, 1, f->buff, f->len);
+
+    return f->nrecords;
+}
+
+static const struct {
+    const char *name;
+    bench_func func;
+} benchmarks[] = {
+    { "mbus_parse",                  bench_parse },
+    { "mbus_frame_data_parse",       bench_data_parse },
+    { "mbus_frame_data_parse_arena", bench_data_parse_arena },
+    { "mbus_frame_cache_parse",      bench_cache_parse },
+    { "mbus_data_record_value",      bench_record_value },
+    { "mbus_data_record_typed_value", bench_typed_value },
+    { "mbus_layout_cache_decode",    bench_layout_decode },
+    { "mbus_vib_unit_lookup",        bench_vib_unit_lookup },
+    { "mbus_parse_variable_record",  bench_normalize },
+    { "mbus_frame_view_find_record", bench_find_record },
+    { "mbus_frame_data_xml",         bench_xml },
+    { "mbus_frame_data_xml_normalized", bench_xml_normalized },
+    { "mbus_frame_data_write_xml",   bench_write_xml },
+    { "mbus_frame_data_write_json",  bench_write_json },
+    { "mbus_ring_publish_frame_data", bench_ring_publish },
+    { "mbus_capture_write",          bench_capture_write },
+};
+
+//------------------------------------------------------------------------------
+// Driver
+//------------------------------------------------------------------------------
+static unsigned long long
+bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static int
+bench_load(const char *file, bench_frame *f)
+{
+    FILE *fp;
+    unsigned char raw_buff[4096];
+    size_t raw_len;
+    mbus_data_record *record;
+    mbus_record *rec;
+
+    if ((fp = fopen(file, "r")) == NULL)
+    {
+        fprintf(stderr, "failed to open '%s'\n", file);
+        return -1;
+    }
+
+    raw_len = fread(raw_buff, 1, sizeof(raw_buff), fp);
+    fclose(fp);
+
+    memset(f, 0, sizeof(bench_frame));
+    f->len = mbus_hex2bin(f->buff, sizeof(f->buff), raw_buff, raw_len);
+
+    if (mbus_parse(&(f->frame), f->buff, f->len) != 0 ||
+        mbus_frame_data_parse(&(f->frame), &(f->data)) != 0)
+    {
+        fprintf(stderr, "skipping '%s': %s\n", file, mbus_error_str());
+        mbus_data_record_free(f->data.data_var.record);
+        return -1;
+    }
+
+    // records with unknown units are left out of the normalize benchmark,
+    // the library reports them on every call
+    for (record = f->data.data_var.record; record; record = record->next)
+    {
+        f->nrecords++;
+
+        if (f->nnormalized < sizeof(f->normalized) / sizeof(f->normalized[0]) &&
+            (rec = mbus_parse_variable_record(record)) != NULL)
+        {
+            f->normalized[f->nnormalized++] = record;
+            mbus_record_free(rec);
+        }
+    }
+
+    return 0;
+}
+
+static void
+bench_run(bench_func func, bench_frame *frames, size_t nframes, int rounds, bench_result *result)
+{
+    unsigned long long start, allocs, bytes, records;
+    size_t i;
+    int round;
+
+    memset(result, 0, sizeof(bench_result));
+
+    // warm up caches and lazily initialized tables
+    for (i = 0; i < nframes; i++)
+        func(&frames[i]);
+
+    records = 0;
+
+    allocs = bench_allocs;
+    bytes = bench_bytes;
+    start = bench_now_ns();
+
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0; i < nframes; i++)
+            records += func(&frames[i]);
+    }
+
+    result->ns = bench_now_ns() - start;
+    result->allocs = bench_allocs - allocs;
+    result->bytes = bench_bytes - bytes;
+
+    result->frames = (unsigned long long) nframes * rounds;
+    result->records = records;
+}
+
+//------------------------------------------------------------------------------
+// Release the frames and the state of the benchmarks, on every exit
+//------------------------------------------------------------------------------
+static int
+bench_free(bench_frame *frames, size_t nframes, const char *capture_path, int ret)
+{
+    size_t i;
+
+    for (i = 0; frames && i < nframes; i++)
+        mbus_data_record_free(frames[i].data.data_var.record);
+
+    mbus_frame_cache_free(&bench_cache);
+    mbus_layout_cache_free(&bench_layout);
+    mbus_ring_close(bench_ring);
+    mbus_capture_close(bench_capture);
+    mbus_record_arena_free(bench_arena);
+    free(frames);
+
+    if (capture_path[0])
+        unlink(capture_path);
+
+    return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+    bench_frame *frames;
+    bench_result result;
+    size_t nframes = 0, b;
+    int i, rounds = 200, json = 0, null_fd, stderr_fd, ring_fd;
+    char ring_path[64], capture_path[64] = "";
+    double frames_per_sec, ns_per_frame, ns_per_record, allocs_per_frame, bytes_per_frame;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+            json = 1;
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else
+            break;
+    }
+
+    if (i == argc || rounds <= 0)
+    {
+        fprintf(stderr, "usage: %s [-j] [-r rounds] hex-file...\n", argv[0]);
+        fprintf(stderr, "    optional flag -j for JSON output\n");
+        fprintf(stderr, "    optional flag -r for the passes over all frames (default 200)\n");
+        return 1;
+    }
+
+    mbus_frame_cache_init(&bench_cache);
+    mbus_layout_cache_init(&bench_layout);
+
+    if ((frames = (bench_frame *) calloc(argc - i, sizeof(bench_frame))) == NULL ||
+        (bench_arena = mbus_record_arena_new(256)) == NULL)
+    {
+        fprintf(stderr, "%s: memory allocation failed\n", argv[0]);
+        return bench_free(frames, 0, capture_path, 1);
+    }
+
+    // the ring file is unlinked right away, the mapping stays valid
+    snprintf(ring_path, sizeof(ring_path), "/tmp/mbus_bench_ring.XXXXXX");
+
+    if ((ring_fd = mkstemp(ring_path)) != -1)
+    {
+        close(ring_fd);
+        bench_ring = mbus_ring_create(ring_path, 4096);
+        unlink(ring_path);
+    }
+
+    if (bench_ring == NULL)
+    {
+        fprintf(stderr, "%s: failed to create ring: %s\n", argv[0], mbus_error_str());
+        return bench_free(frames, 0, capture_path, 1);
+    }
+
+    // the capture log starts over in the same file when it is full
+    snprintf(capture_path, sizeof(capture_path), "/tmp/mbus_bench_capture.XXXXXX");
+
+    if ((ring_fd = mkstemp(capture_path)) == -1)
+        capture_path[0] = '\0';
+    else
+        close(ring_fd);
+
+    if (capture_path[0] == '\0' ||
+        (bench_capture = mbus_capture_open(capture_path, 1 << 20, 0)) == NULL)
+    {
+        fprintf(stderr, "%s: failed to create capture log: %s\n", argv[0], mbus_error_str());
+        return bench_free(frames, 0, capture_path, 1);
+    }
+
+    for (; i < argc; i++)
+    {
+        if (bench_load(argv[i], &frames[nframes]) == 0)
+            nframes++;
+    }
+
+    if (nframes == 0)
+    {
+        fprintf(stderr, "%s: no frames to run on\n", argv[0]);
+        return bench_free(frames, nframes, capture_path, 1);
+    }
+
+    if (json)
+        printf("{\"frames\":%zu,\"rounds\":%d,\"alloc_stats\":%s,\"benchmarks\":[\n",
+               nframes, rounds, BENCH_ALLOC_STATS ? "true" : "false");
+    else
+        printf("benchmark\tframes\trecords\tns\tframes_per_sec\tns_per_frame\tns_per_record\tallocs_per_frame\tbytes_per_frame\n");
+
+    for (b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++)
+    {
+        // the library reports unsupported records on stderr, keep that out
+        // of the measurement
+        fflush(stderr);
+        stderr_fd = dup(STDERR_FILENO);
+
+        if ((null_fd = open("/dev/null", O_WRONLY)) != -1)
+        {
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+
+        bench_run(benchmarks[b].func, frames, nframes, rounds, &result);
+
+        if (stderr_fd != -1)
+        {
+            dup2(stderr_fd, STDERR_FILENO);
+            close(stderr_fd);
+        }
+
+        frames_per_sec = result.ns ? (double) result.frames * 1e9 / (double) result.ns : 0.0;
+        ns_per_frame = (double) result.ns / (double) result.frames;
+        ns_per_record = result.records ? (double) result.ns / (double) result.records : 0.0;
+        allocs_per_frame = BENCH_ALLOC_STATS ? (double) result.allocs / (double) result.frames : -1.0;
+        bytes_per_frame = BENCH_ALLOC_STATS ? (double) result.bytes / (double) result.frames : -1.0;
+
+        if (json)
+            printf("{\"name\":\"%s\",\"frames\":%llu,\"records\":%llu,\"ns\":%llu,"
+                   "\"frames_per_sec\":%.1f,\"ns_per_frame\":%.1f,\"ns_per_record\":%.1f,"
+                   "\"allocs_per_frame\":%.2f,\"bytes_per_frame\":%.1f}%s\n",
+                   benchmarks[b].name, result.frames, result.records, result.ns,
+                   frames_per_sec, ns_per_frame, ns_per_record, allocs_per_frame, bytes_per_frame,
+                   b + 1 < sizeof(benchmarks) / sizeof(benchmarks[0]) ? "," : "");
+        else
+            printf("%s\t%llu\t%llu\t%llu\t%.1f\t%.1f\t%.1f\t%.2f\t%.1f\n",
+                   benchmarks[b].name, result.frames, result.records, result.ns,
+                   frames_per_sec, ns_per_frame, ns_per_record, allocs_per_frame, bytes_per_frame);
+
+        fflush(stdout);
+    }
+
+    if (json)
+        printf("]}\n");
+
+    return bench_free(frames, nframes, capture_path, 0);
+}
@@ -19,25 +19,32 @@ main(int argc, char *argv[])
 {
     FILE *fp = NULL;
     size_t buff_len;
-    int result, normalized = 0;
+    int i, result, normalized = 0, format = MBUS_WRITER_FORMAT_XML;
     unsigned char raw_buff[4096], buff[4096];
     mbus_frame reply;
     mbus_frame_data frame_data;
-    char *xml_result = NULL, *file = NULL;
+    mbus_writer writer;
+    char *file = NULL;
 
-    if (argc == 3 && strcmp(argv[1], "-n") == 0)
+    for (i = 1; i < argc - 1; i++)
     {
-        file = argv[2];
-        normalized = 1;
+        if (strcmp(argv[i], "-n") == 0)
+            normalized = 1;
+        else if (strcmp(argv[i], "-j") == 0)
+            format = MBUS_WRITER_FORMAT_JSON;
+        else
+            break;
     }
-    else if (argc == 2)
+
+    if (i == argc - 1)
     {
-        file = argv[1];
+        file = argv[i];
     }
     else
     {
-        fprintf(stderr, "usage: %s [-n] hex-file\n", argv[0]);
+        fprintf(stderr, "usage: %s [-n] [-j] hex-file\n", argv[0]);
         fprintf(stderr, "    optional flag -n for normalized values\n");
+        fprintf(stderr, "    optional flag -j for JSON output\n");
         return 1;
     }
 
@@ -91,15 +98,15 @@ main(int argc, char *argv[])
     //mbus_frame_print(&reply);
     //mbus_frame_data_print(&frame_data);
 
-    xml_result = normalized ? mbus_frame_data_xml_normalized(&frame_data) : mbus_frame_data_xml(&frame_data);
+    mbus_writer_init_file(&writer, format, stdout);
+
+    result = normalized ? mbus_frame_data_write_normalized(&writer, &frame_data) : mbus_frame_data_write(&writer, &frame_data);
 
-    if (xml_result == NULL)
+    if (result != 0 || mbus_writer_flush(&writer) != 0)
     {
         fprintf(stderr, "Failed to generate XML representation of MBUS frame: %s\n", mbus_error_str());
         return 1;
     }
-    printf("%s", xml_result);
-    free(xml_result);
     mbus_data_record_free(frame_data.data_var.record);
 
     return 0;
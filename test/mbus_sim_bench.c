@@ -0,0 +1,461 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// End-to-end benchmarks on simulated M-Bus segments. The slaves answer with
+// the telegrams of the given hex files (e.g. test-frames/*.hex), assigned
+// round robin, at primary addresses 1, 2, ... and sequential secondary IDs.
+// Reports readouts per second for the blocking API, the streamed readout,
+// the secondary address scan and the poll engine over several segments, as
+// tab separated values or (-j) as JSON. With -N the slaves support rates up
+// to the given one, and every slave is switched to it with
+// mbus_negotiate_baudrate before the benchmarks. Secondary addressing stays
+// at the bus rate, so the scans only find slaves left at that rate.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mbus/mbus.h>
+
+typedef struct _bench_result {
+    unsigned long long ns;
+    unsigned long ok;                /* readouts or slaves found */
+    unsigned long requests;
+    unsigned long replies;
+    unsigned long drops;
+    unsigned long collisions;
+} bench_result;
+
+typedef int (*bench_func)(mbus_handle **handles, int nsegments, int nslaves, bench_result *result);
+
+static unsigned long bench_found = 0;
+
+static unsigned long long
+bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+// Benchmarks. Only segment 0 is used by the blocking API.
+//------------------------------------------------------------------------------
+static int
+bench_readout(mbus_handle **handles, int nsegments, int nslaves, bench_result *result)
+{
+    mbus_frame reply;
+    int address;
+
+    for (address = 1; address <= nslaves; address++)
+    {
+        memset(&reply, 0, sizeof(reply));
+
+        if (mbus_sendrecv_request(handles[0], address, &reply, 32) == 0)
+            result->ok++;
+
+        if (reply.next)
+            mbus_frame_free((mbus_frame *) reply.next);
+    }
+
+    return 0;
+}
+
+static int
+bench_readout_stream(mbus_handle **handles, int nsegments, int nslaves, bench_result *result)
+{
+    mbus_frame_ring *ring;
+    int address;
+
+    if ((ring = mbus_frame_ring_new(4)) == NULL)
+        return -1;
+
+    for (address = 1; address <= nslaves; address++)
+    {
+        if (mbus_sendrecv_request_stream(handles[0], address, ring, 32, NULL, NULL) == 0)
+            result->ok++;
+    }
+
+    mbus_frame_ring_free(ring);
+
+    return 0;
+}
+
+static void
+bench_found_event(mbus_handle *handle, mbus_frame *frame)
+{
+    bench_found++;
+}
+
+static int
+bench_scan_secondary(mbus_handle **handles, int nsegments, int nslaves, bench_result *result)
+{
+    bench_found = 0;
+    mbus_register_found_event(handles[0], bench_found_event);
+
+    mbus_scan_2nd_address_range(handles[0], 0, "FFFFFFFFFFFFFFFF");
+
+    mbus_register_found_event(handles[0], NULL);
+    result->ok = bench_found;
+
+    return 0;
+}
+
+static void
+bench_poll_event(mbus_poll *engine, mbus_handle *handle, const char *address, int result,
+                 mbus_frame *reply, void *userdata)
+{
+    if (result == MBUS_RECV_RESULT_OK && reply != NULL)
+        ((bench_result *) userdata)->ok++;
+}
+
+static int
+bench_poll(mbus_handle **handles, int nsegments, int nslaves, bench_result *result, int scan)
+{
+    mbus_poll *engine;
+    int segment, address, ret = 0;
+
+    if ((engine = mbus_poll_new(bench_poll_event, result)) == NULL)
+        return -1;
+
+    for (segment = 0; segment < nsegments && ret == 0; segment++)
+    {
+        if (scan)
+        {
+            ret = mbus_poll_add_scan(engine, handles[segment], "FFFFFFFFFFFFFFFF", NULL, 0);
+            continue;
+        }
+
+        for (address = 1; address <= nslaves && ret == 0; address++)
+            ret = mbus_poll_add_primary(engine, handles[segment], address);
+    }
+
+    if (ret == 0)
+        ret = mbus_poll_run(engine);
+
+    mbus_poll_free(engine);
+
+    return ret;
+}
+
+static int
+bench_poll_readout(mbus_handle **handles, int nsegments, int nslaves, bench_result *result)
+{
+    return bench_poll(handles, nsegments, nslaves, result, 0);
+}
+
+static int
+bench_poll_scan(mbus_handle **handles, int nsegments, int nslaves, bench_result *result)
+{
+    return bench_poll(handles, nsegments, nslaves, result, 1);
+}
+
+static const struct {
+    const char *name;
+    bench_func func;
+    int all_segments;
+} benchmarks[] = {
+    { "readout",        bench_readout,        0 },
+    { "readout_stream", bench_readout_stream, 0 },
+    { "scan_secondary", bench_scan_secondary, 0 },
+    { "poll_readout",   bench_poll_readout,   1 },
+    { "poll_scan",      bench_poll_scan,      1 },
+};
+
+//------------------------------------------------------------------------------
+// Secondary address (ID replaced by a sequential number) of a hex file, empty
+// when the telegram has no variable data header. Fails for files that are
+// not a slave reply.
+//------------------------------------------------------------------------------
+static int
+bench_secondary(const char *file, int id, char *secondary, size_t secondary_size)
+{
+    unsigned char raw_buff[4096], buff[4096];
+    char addr[32], id_str[16];
+    mbus_frame frame;
+    size_t len;
+    FILE *fp;
+
+    secondary[0] = '\0';
+
+    if ((fp = fopen(file, "r")) == NULL)
+        return -1;
+
+    len = fread(raw_buff, 1, sizeof(raw_buff), fp);
+    fclose(fp);
+
+    len = mbus_hex2bin(buff, sizeof(buff), raw_buff, len);
+
+    memset(&frame, 0, sizeof(frame));
+
+    if (mbus_parse(&frame, buff, len) != 0 ||
+        frame.type != MBUS_FRAME_TYPE_LONG ||
+        mbus_frame_direction(&frame) != MBUS_CONTROL_MASK_DIR_S2M)
+        return -1;
+
+    if (frame.control_information == MBUS_CONTROL_INFO_RESP_VARIABLE &&
+        mbus_frame_get_secondary_address_r(&frame, addr, sizeof(addr)) != NULL)
+    {
+        snprintf(id_str, sizeof(id_str), "%08d", id);
+        memcpy(addr, id_str, 8);
+        snprintf(secondary, secondary_size, "%s", addr);
+    }
+
+    return 0;
+}
+
+static mbus_handle *
+bench_segment(char **files, int nfiles, int nslaves, long baudrate, long turnaround_us,
+              long jitter_us, double drop_rate, unsigned int seed, long max_baudrate)
+{
+    mbus_handle *handle;
+    char secondary[32];
+    int i, slave, file, tries;
+
+    if ((handle = mbus_context_sim()) == NULL)
+        return NULL;
+
+    mbus_sim_set_timing(handle, baudrate, turnaround_us, jitter_us);
+    mbus_sim_set_drop_rate(handle, drop_rate, seed);
+
+    for (i = 0; i < nslaves; i++)
+    {
+        // skip files the simulator cannot serve
+        for (tries = 0, file = i % nfiles; tries < nfiles; tries++, file = (file + 1) % nfiles)
+        {
+            if (bench_secondary(files[file], 10000000 + i, secondary, sizeof(secondary)) == 0)
+                break;
+        }
+
+        if (tries == nfiles ||
+            (slave = mbus_sim_add_slave(handle, i + 1, secondary[0] ? secondary : NULL)) == -1 ||
+            mbus_sim_add_telegram_file(handle, slave, files[file]) == -1 ||
+            mbus_sim_set_slave_baudrate(handle, slave, 0, max_baudrate) == -1)
+        {
+            mbus_context_free(handle);
+            return NULL;
+        }
+    }
+
+    return handle;
+}
+
+//------------------------------------------------------------------------------
+// Switch the slaves of a segment to the highest rate they support, returns
+// the number of slaves that are faster than the bus afterwards
+//------------------------------------------------------------------------------
+static int
+bench_negotiate(mbus_handle *handle, int nslaves, long baudrate, long max_baudrate)
+{
+    int address, faster = 0;
+
+    if (mbus_connect(handle) == -1)
+        return -1;
+
+    for (address = 1; address <= nslaves; address++)
+    {
+        if (mbus_negotiate_baudrate(handle, address, max_baudrate) > baudrate)
+            faster++;
+    }
+
+    mbus_disconnect(handle);
+
+    return faster;
+}
+
+static void
+bench_usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-h] [-j] [-g segments] [-n slaves] [-b baudrate] [-t turnaround_us]\n"
+                    "       [-J jitter_us] [-d drop_rate] [-s seed] [-N baudrate] hex-file...\n", name);
+    fprintf(stderr, "    optional flag -h for this message\n");
+    fprintf(stderr, "    optional flag -j for JSON output\n");
+    fprintf(stderr, "    optional flag -g for the segments of the poll engine benchmarks (default 4)\n");
+    fprintf(stderr, "    optional flag -n for the slaves per segment (default 10)\n");
+    fprintf(stderr, "    optional flag -b for the baud rate, 0 for no transmission delay (default 9600)\n");
+    fprintf(stderr, "    optional flags -t, -J for the slave turnaround and jitter (default 5000, 1000 usec)\n");
+    fprintf(stderr, "    optional flag -d for the probability of a lost reply (default 0)\n");
+    fprintf(stderr, "    optional flag -s for the seed of the lost replies and jitter (default 1)\n");
+    fprintf(stderr, "    optional flag -N to negotiate slave rates up to baudrate first\n");
+}
+
+//------------------------------------------------------------------------------
+// Release the segments, on every exit. Connected segments are disconnected.
+//------------------------------------------------------------------------------
+static int
+bench_free(mbus_handle **handles, int nsegments, int ret)
+{
+    int s;
+
+    for (s = 0; handles && s < nsegments; s++)
+        mbus_context_free(handles[s]);
+
+    free(handles);
+
+    return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+    mbus_handle **handles;
+    bench_result result;
+    mbus_sim_data *sim;
+    size_t b;
+    int i, s, nsegments = 4, nslaves = 10, json = 0, null_fd, stderr_fd, ret, used, faster;
+    long baudrate = 9600, turnaround_us = 5000, jitter_us = 1000, max_baudrate = 0;
+    double drop_rate = 0.0, readouts_per_sec;
+    unsigned int seed = 1;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0)
+        {
+            bench_usage(argv[0]);
+            return 0;
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+            json = 1;
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+            nsegments = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            nslaves = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            baudrate = atol(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            turnaround_us = atol(argv[++i]);
+        else if (strcmp(argv[i], "-J") == 0 && i + 1 < argc)
+            jitter_us = atol(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            drop_rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            seed = (unsigned int) atol(argv[++i]);
+        else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc)
+            max_baudrate = atol(argv[++i]);
+        else
+            break;
+    }
+
+    if (i == argc || nsegments <= 0 || nslaves <= 0 || nslaves > MBUS_MAX_PRIMARY_SLAVES)
+    {
+        bench_usage(argv[0]);
+        return 1;
+    }
+
+    if ((handles = (mbus_handle **) calloc(nsegments, sizeof(mbus_handle *))) == NULL)
+    {
+        fprintf(stderr, "%s: memory allocation failed\n", argv[0]);
+        return 1;
+    }
+
+    for (s = 0; s < nsegments; s++)
+    {
+        if ((handles[s] = bench_segment(&argv[i], argc - i, nslaves, baudrate, turnaround_us,
+                                        jitter_us, drop_rate, seed + s, max_baudrate)) == NULL)
+        {
+            fprintf(stderr, "%s: failed to set up simulated segment: %s\n", argv[0], mbus_error_str());
+            return bench_free(handles, s, 1);
+        }
+
+        if (max_baudrate > baudrate && baudrate > 0)
+        {
+            if ((faster = bench_negotiate(handles[s], nslaves, baudrate, max_baudrate)) == -1)
+            {
+                fprintf(stderr, "%s: failed to connect simulated segment: %s\n", argv[0], mbus_error_str());
+                return bench_free(handles, s + 1, 1);
+            }
+
+            fprintf(stderr, "segment %d: %d of %d slaves above %ld baud\n", s, faster, nslaves, baudrate);
+        }
+    }
+
+    if (json)
+        printf("{\"segments\":%d,\"slaves\":%d,\"baudrate\":%ld,\"turnaround_us\":%ld,\"jitter_us\":%ld,"
+               "\"drop_rate\":%.3f,\"benchmarks\":[\n",
+               nsegments, nslaves, baudrate, turnaround_us, jitter_us, drop_rate);
+    else
+        printf("benchmark\tsegments\tok\trequests\treplies\tdrops\tcollisions\tms\treadouts_per_sec\n");
+
+    for (b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++)
+    {
+        used = benchmarks[b].all_segments ? nsegments : 1;
+        memset(&result, 0, sizeof(result));
+
+        for (s = 0; s < used; s++)
+        {
+            if (mbus_connect(handles[s]) == -1)
+            {
+                fprintf(stderr, "%s: failed to connect simulated segment: %s\n", argv[0], mbus_error_str());
+                return bench_free(handles, nsegments, 1);
+            }
+        }
+
+        // failed readouts are reported on stderr, keep that out of the output
+        fflush(stderr);
+        stderr_fd = dup(STDERR_FILENO);
+
+        if ((null_fd = open("/dev/null", O_WRONLY)) != -1)
+        {
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+
+        result.ns = bench_now_ns();
+        ret = benchmarks[b].func(handles, used, nslaves, &result);
+        result.ns = bench_now_ns() - result.ns;
+
+        if (stderr_fd != -1)
+        {
+            dup2(stderr_fd, STDERR_FILENO);
+            close(stderr_fd);
+        }
+
+        for (s = 0; s < used; s++)
+        {
+            mbus_disconnect(handles[s]);
+
+            sim = (mbus_sim_data *) handles[s]->auxdata;
+            result.requests += sim->requests;
+            result.replies += sim->replies;
+            result.drops += sim->drops;
+            result.collisions += sim->collisions;
+        }
+
+        if (ret != 0)
+            fprintf(stderr, "%s: benchmark %s failed\n", argv[0], benchmarks[b].name);
+
+        readouts_per_sec = result.ns ? (double) result.ok * 1e9 / (double) result.ns : 0.0;
+
+        if (json)
+            printf("{\"name\":\"%s\",\"segments\":%d,\"ok\":%lu,\"requests\":%lu,\"replies\":%lu,"
+                   "\"drops\":%lu,\"collisions\":%lu,\"ms\":%.1f,\"readouts_per_sec\":%.2f}%s\n",
+                   benchmarks[b].name, used, result.ok, result.requests, result.replies,
+                   result.drops, result.collisions, (double) result.ns / 1e6, readouts_per_sec,
+                   b + 1 < sizeof(benchmarks) / sizeof(benchmarks[0]) ? "," : "");
+        else
+            printf("%s\t%d\t%lu\t%lu\t%lu\t%lu\t%lu\t%.1f\t%.2f\n",
+                   benchmarks[b].name, used, result.ok, result.requests, result.replies,
+                   result.drops, result.collisions, (double) result.ns / 1e6, readouts_per_sec);
+
+        fflush(stdout);
+    }
+
+    if (json)
+        printf("]}\n");
+
+    return bench_free(handles, nsegments, 0);
+}
@@ -0,0 +1,166 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "mbus_test.h"
+
+int test_failures = 0;
+
+static const char *test_srcdir = ".";
+
+//------------------------------------------------------------------------------
+// Take the test data from $srcdir or the first argument, and keep the error
+// messages of the library out of the test log
+//------------------------------------------------------------------------------
+void
+test_init(int argc, char *argv[])
+{
+    int null_fd;
+
+    if (getenv("srcdir"))
+        test_srcdir = getenv("srcdir");
+
+    if (argc > 1)
+        test_srcdir = argv[1];
+
+    if (getenv("MBUS_TEST_VERBOSE") == NULL && (null_fd = open("/dev/null", O_WRONLY)) != -1)
+    {
+        fflush(stderr);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+}
+
+int
+test_exit(void)
+{
+    if (test_failures)
+        printf("%d checks failed\n", test_failures);
+
+    return test_failures ? 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+// Test data
+//------------------------------------------------------------------------------
+const char *
+test_frame_path(const char *name)
+{
+    static char path[1024];
+
+    snprintf(path, sizeof(path), "%s/test-frames/%s", test_srcdir, name);
+
+    return path;
+}
+
+size_t
+test_load_frame(const char *name, unsigned char *buff, size_t buff_size)
+{
+    unsigned char raw_buff[4096];
+    size_t len;
+    FILE *fp;
+
+    if ((fp = fopen(test_frame_path(name), "r")) == NULL)
+        return 0;
+
+    len = fread(raw_buff, 1, sizeof(raw_buff), fp);
+    fclose(fp);
+
+    return mbus_hex2bin(buff, buff_size, raw_buff, len);
+}
+
+//------------------------------------------------------------------------------
+// Parse a hex file, data may be NULL. The records of data are freed with
+// mbus_data_record_free.
+//------------------------------------------------------------------------------
+int
+test_parse_frame(const char *name, mbus_frame *frame, mbus_frame_data *data)
+{
+    unsigned char buff[4096];
+    size_t len;
+
+    memset(frame, 0, sizeof(mbus_frame));
+
+    if (data)
+        memset(data, 0, sizeof(mbus_frame_data));
+
+    if ((len = test_load_frame(name, buff, sizeof(buff))) == 0 ||
+        mbus_parse(frame, buff, len) != 0)
+        return -1;
+
+    if (data && mbus_frame_data_parse(frame, data) != 0)
+        return -1;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Secondary address of a hex file with the ID replaced by id
+//------------------------------------------------------------------------------
+int
+test_secondary(const char *name, int id, char *secondary, size_t secondary_size)
+{
+    char addr[17], id_str[16];
+    mbus_frame frame;
+
+    if (test_parse_frame(name, &frame, NULL) != 0 ||
+        mbus_frame_get_secondary_address_r(&frame, addr, sizeof(addr)) == NULL)
+        return -1;
+
+    snprintf(id_str, sizeof(id_str), "%08d", id);
+    memcpy(addr, id_str, 8);
+    snprintf(secondary, secondary_size, "%s", addr);
+
+    return 0;
+}
+
+int
+test_same_frame(const mbus_frame *a, const mbus_frame *b)
+{
+    return a->control_information == b->control_information &&
+           a->address == b->address &&
+           a->data_size == b->data_size &&
+           memcmp(a->data, b->data, a->data_size) == 0;
+}
+
+mbus_handle *
+test_segment(void)
+{
+    mbus_handle *handle;
+    char secondary[17];
+    int slave;
+
+    if ((handle = mbus_context_sim()) == NULL)
+        return NULL;
+
+    mbus_context_set_option(handle, MBUS_OPTION_RESPONSE_TIMEOUT, 10000);
+
+    if ((slave = mbus_sim_add_slave(handle, 1, NULL)) == -1 ||
+        mbus_sim_add_telegram_file(handle, slave, test_frame_path("sontex_supercal_531_telegram1.hex")) != 0 ||
+        mbus_sim_add_telegram_file(handle, slave, test_frame_path("abb_f95.hex")) != 0 ||
+        test_secondary("abb_f95.hex", 10000002, secondary, sizeof(secondary)) != 0 ||
+        (slave = mbus_sim_add_slave(handle, 2, secondary)) == -1 ||
+        mbus_sim_add_telegram_file(handle, slave, test_frame_path("abb_f95.hex")) != 0 ||
+        test_secondary("kamstrup_multical_601.hex", 10000003, secondary, sizeof(secondary)) != 0 ||
+        (slave = mbus_sim_add_slave(handle, 3, secondary)) == -1 ||
+        mbus_sim_add_telegram_file(handle, slave, test_frame_path("kamstrup_multical_601.hex")) != 0)
+    {
+        printf("failed to set up the simulator: %s\n", mbus_error_str());
+        mbus_context_free(handle);
+        return NULL;
+    }
+
+    return handle;
+}
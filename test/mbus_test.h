@@ -0,0 +1,53 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Helpers of the regression tests run by make check. The test data are the
+// hex files of test-frames/, found in $srcdir. A check that fails is reported
+// with its line on stdout, the library reports the expected errors (timeouts,
+// absent slaves) on stderr, which is only kept with MBUS_TEST_VERBOSE set.
+//
+
+#ifndef _MBUS_TEST_H_
+#define _MBUS_TEST_H_
+
+#include <stdio.h>
+
+#include <mbus/mbus.h>
+
+extern int test_failures;
+
+#define TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            fflush(stdout); \
+            test_failures++; \
+        } \
+    } while (0)
+
+void         test_init(int argc, char *argv[]);
+int          test_exit(void);
+
+const char  *test_frame_path(const char *name);
+size_t       test_load_frame(const char *name, unsigned char *buff, size_t buff_size);
+int          test_parse_frame(const char *name, mbus_frame *frame, mbus_frame_data *data);
+int          test_secondary(const char *name, int id, char *secondary, size_t secondary_size);
+int          test_same_frame(const mbus_frame *a, const mbus_frame *b);
+
+//
+// Simulated segment, not connected yet:
+//   1: sontex_supercal_531_telegram1 (DIF 0x1F) followed by abb_f95
+//   2: abb_f95, secondary ID 10000002
+//   3: kamstrup_multical_601, secondary ID 10000003
+//
+mbus_handle *test_segment(void);
+
+#endif /* _MBUS_TEST_H_ */
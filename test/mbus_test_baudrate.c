@@ -0,0 +1,90 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Baud rate negotiation: every slave switches up to its maximum, the handle
+// sends the frames to a slave at its rate
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+static void
+test_baudrate(void)
+{
+    mbus_handle *handle;
+    mbus_sim_data *sim;
+    mbus_frame reply;
+
+    if ((handle = test_segment()) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    sim = (mbus_sim_data *) handle->auxdata;
+
+    // a reply takes a while at 2400 baud
+    mbus_context_set_option(handle, MBUS_OPTION_RESPONSE_TIMEOUT, 500000);
+    mbus_sim_set_timing(handle, 2400, 0, 0);
+    mbus_sim_set_slave_baudrate(handle, 1, 0, 9600);
+    mbus_sim_set_slave_baudrate(handle, 2, 300, 0);
+
+    TEST_CHECK(mbus_connect(handle) == 0);
+
+    // no slave rates are managed yet
+    TEST_CHECK(mbus_handle_slave_baudrate(handle, 2) == 0);
+    TEST_CHECK(mbus_handle_get_baudrate(handle) == 2400);
+
+    // switched up to the maximum of the slave, 19200 is refused
+    TEST_CHECK(mbus_negotiate_baudrate(handle, 2, 38400) == 9600);
+    TEST_CHECK(mbus_handle_slave_baudrate(handle, 2) == 9600);
+    TEST_CHECK(mbus_handle_slave_baudrate(handle, MBUS_ADDRESS_BROADCAST_REPLY) == 2400);
+
+    // slave 1 does not switch at all
+    TEST_CHECK(mbus_negotiate_baudrate(handle, 1, 38400) == 2400);
+
+    // slave 3 only listens at 300 baud
+    TEST_CHECK(mbus_negotiate_baudrate(handle, 3, 38400) == -1);
+    TEST_CHECK(mbus_handle_set_slave_baudrate(handle, 3, 300) == 0);
+
+    // the handle switches the port for every slave
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(handle, 2, &reply, 0) == 0);
+    TEST_CHECK(mbus_handle_get_baudrate(handle) == 9600);
+    TEST_CHECK(mbus_sendrecv_request(handle, 3, &reply, 0) == 0);
+    TEST_CHECK(mbus_handle_get_baudrate(handle) == 300);
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(handle, 1, &reply, 1) == 0);
+    TEST_CHECK(mbus_handle_get_baudrate(handle) == 2400);
+    mbus_frame_free((mbus_frame *) reply.next);
+
+    TEST_CHECK(mbus_handle_set_slave_baudrate(handle, MBUS_MAX_PRIMARY_SLAVES + 1, 2400) == -1);
+
+    mbus_disconnect(handle);
+
+    // the slaves keep their rate over a reconnect
+    TEST_CHECK(sim->slaves[1].current_baudrate == 9600);
+    TEST_CHECK(sim->slaves[0].current_baudrate == 0);
+
+    mbus_context_free(handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_baudrate();
+
+    return test_exit();
+}
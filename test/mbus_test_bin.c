@@ -0,0 +1,88 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Binary export: header, rows and the decoded values of abb_f95
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "mbus_test.h"
+
+static void
+test_bin(void)
+{
+    unsigned char buff[4096];
+    mbus_frame frame;
+    mbus_frame_data data;
+    mbus_data_record *record;
+    mbus_bin_record row, expected;
+    mbus_writer writer;
+    const unsigned char *rows;
+    int n, i, record_cnt;
+
+    TEST_CHECK(test_parse_frame("abb_f95.hex", &frame, &data) == 0);
+    TEST_CHECK(mbus_writer_init_buffer(&writer, MBUS_WRITER_FORMAT_XML, 0) == 0);
+
+    TEST_CHECK(mbus_bin_header_write(&writer) == 0);
+    TEST_CHECK((n = mbus_frame_data_write_bin(&writer, &data)) > 2);
+    TEST_CHECK(writer.len == MBUS_BIN_HEADER_SIZE + (size_t) n * MBUS_BIN_RECORD_SIZE);
+    TEST_CHECK(mbus_bin_header_check((unsigned char *) writer.buff, writer.len) == 0);
+
+    rows = (const unsigned char *) writer.buff + MBUS_BIN_HEADER_SIZE;
+
+    // every row as encoded from the records
+    for (record = data.data_var.record, i = 0, record_cnt = 0; record && i < n; record = record->next, record_cnt++)
+    {
+        if (mbus_bin_record_variable(&expected, &(data.data_var.header), record, record_cnt) != 0)
+            continue;
+
+        mbus_bin_record_decode(&row, rows + (size_t) i * MBUS_BIN_RECORD_SIZE);
+        TEST_CHECK(memcmp(&row, &expected, sizeof(row)) == 0);
+        i++;
+    }
+
+    TEST_CHECK(i == n);
+
+    // see abb_f95.norm.xml
+    mbus_bin_record_decode(&row, rows + MBUS_BIN_RECORD_SIZE);
+    TEST_CHECK(row.id == 26718590);
+    TEST_CHECK(row.version == 40);
+    TEST_CHECK(row.record == 1);
+    TEST_CHECK(row.function == MBUS_BIN_FUNCTION_INSTANTANEOUS);
+    TEST_CHECK(fabs(row.value - 0.0742) < 1e-9);
+
+    mbus_bin_record_decode(&row, rows + 2 * MBUS_BIN_RECORD_SIZE);
+    TEST_CHECK(row.function == MBUS_BIN_FUNCTION_ERROR);
+    TEST_CHECK(fabs(row.value - 1311041.3) < 1e-6);
+
+    // encode and decode are inverse
+    mbus_bin_record_encode(&row, buff);
+    mbus_bin_record_decode(&expected, buff);
+    TEST_CHECK(memcmp(&row, &expected, sizeof(row)) == 0);
+
+    writer.buff[0] = 'X';
+    TEST_CHECK(mbus_bin_header_check((unsigned char *) writer.buff, writer.len) != 0);
+
+    mbus_writer_free(&writer);
+    mbus_data_record_free(data.data_var.record);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_bin();
+
+    return test_exit();
+}
@@ -0,0 +1,140 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Change detection cache: hits and misses of kamstrup_multical_601, the
+// access number and the date/time record patched on a hit, and a telegram
+// whose hash collides with the cached one
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+//------------------------------------------------------------------------------
+// Offset of the data of the first record with the given VIF in the user data
+//------------------------------------------------------------------------------
+static size_t
+test_record_offset(mbus_frame *frame, unsigned char vif)
+{
+    mbus_record_filter filter;
+    mbus_frame_view view;
+    mbus_record_view record;
+    size_t pos = 0;
+
+    mbus_record_filter_init(&filter);
+    filter.vif = &vif;
+    filter.nvif = 1;
+
+    if (mbus_frame_view_of(&view, frame) != 0 ||
+        mbus_frame_view_find_record(&view, &pos, &filter, &record) != 1)
+        return 0;
+
+    return record.data_offset;
+}
+
+static mbus_data_record *
+test_record(mbus_frame_data *data, unsigned char vif)
+{
+    mbus_data_record *record;
+
+    for (record = data->data_var.record; record; record = record->next)
+    {
+        if (record->drh.vib.vif == vif)
+            return record;
+    }
+
+    return NULL;
+}
+
+static mbus_frame_cache_slot *
+test_slot(mbus_frame_cache *cache)
+{
+    size_t i;
+
+    for (i = 0; i < cache->size; i++)
+    {
+        if (cache->entries[i].used)
+            return &(cache->entries[i].slot[0]);
+    }
+
+    return NULL;
+}
+
+static void
+test_cache(void)
+{
+    mbus_frame_cache cache;
+    mbus_frame_data *data, *first;
+    mbus_frame frame, changed;
+    mbus_frame_cache_slot *slot;
+    mbus_data_record *record;
+    size_t time_offset, energy_offset;
+    uint64_t hash;
+
+    mbus_frame_cache_init(&cache);
+
+    TEST_CHECK(test_parse_frame("kamstrup_multical_601.hex", &frame, NULL) == 0);
+    TEST_CHECK((time_offset = test_record_offset(&frame, 0x6D)) != 0);
+    TEST_CHECK((energy_offset = test_record_offset(&frame, 0x06)) != 0);
+
+    // parsed once, then served from the cache
+    TEST_CHECK(mbus_frame_cache_parse(&cache, &frame, &first) == MBUS_FRAME_CACHE_CHANGED);
+    TEST_CHECK(mbus_frame_cache_parse(&cache, &frame, &data) == MBUS_FRAME_CACHE_UNCHANGED);
+    TEST_CHECK(data == first && cache.hits == 1 && cache.misses == 1);
+
+    // a new access number and time are patched in
+    frame.data[8]++;
+    frame.data[time_offset] ^= 0x01;
+    frame.timestamp += 60;
+    TEST_CHECK(mbus_frame_cache_parse(&cache, &frame, &data) == MBUS_FRAME_CACHE_UNCHANGED);
+    TEST_CHECK(data->data_var.header.access_no == frame.data[8]);
+    TEST_CHECK((record = test_record(data, 0x6D)) != NULL &&
+               memcmp(record->data, &(frame.data[time_offset]), record->data_len) == 0 &&
+               record->timestamp == frame.timestamp);
+
+    // a new value is parsed
+    changed = frame;
+    changed.data[energy_offset]++;
+    TEST_CHECK(mbus_frame_cache_parse(&cache, &changed, &data) == MBUS_FRAME_CACHE_CHANGED);
+    TEST_CHECK(cache.misses == 2);
+
+    // frame is cached again with the hash of changed, as if they collided:
+    // the user data kept in the slot tells them apart
+    TEST_CHECK((slot = test_slot(&cache)) != NULL);
+    hash = slot ? slot->hash : 0;
+
+    TEST_CHECK(mbus_frame_cache_parse(&cache, &frame, &data) == MBUS_FRAME_CACHE_CHANGED);
+
+    if (slot)
+        slot->hash = hash;
+
+    TEST_CHECK(mbus_frame_cache_parse(&cache, &changed, &data) == MBUS_FRAME_CACHE_CHANGED);
+    TEST_CHECK(cache.misses == 4);
+    TEST_CHECK((record = test_record(data, 0x06)) != NULL &&
+               memcmp(record->data, &(changed.data[energy_offset]), record->data_len) == 0);
+
+    // nothing is cached after a reset
+    mbus_frame_cache_reset(&cache);
+    TEST_CHECK(mbus_frame_cache_parse(&cache, &frame, &data) == MBUS_FRAME_CACHE_CHANGED);
+
+    mbus_frame_cache_free(&cache);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_cache();
+
+    return test_exit();
+}
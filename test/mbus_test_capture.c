@@ -0,0 +1,241 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Capture log: record a session, decode the log, replay it in a simulator,
+// and rotate the full files
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "mbus_test.h"
+
+//------------------------------------------------------------------------------
+// Record a session, decode the log, replay it in a simulator
+//------------------------------------------------------------------------------
+static void
+test_capture(void)
+{
+    char path[] = "mbus_test_capture.cap";
+    mbus_capture_record record;
+    mbus_capture *capture;
+    mbus_handle *handle, *replay;
+    mbus_frame reply[3], again;
+    const unsigned char *data;
+    unsigned char buff[65536];
+    size_t len, end, pos;
+    int address, sent = 0, received = 0, ret;
+    FILE *fp;
+
+    if ((handle = test_segment()) == NULL ||
+        (capture = mbus_capture_open(path, 1 << 16, 0)) == NULL)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(handle);
+        return;
+    }
+
+    TEST_CHECK(mbus_handle_set_capture(handle, capture, 42) == 0);
+    TEST_CHECK(mbus_connect(handle) == 0);
+
+    for (address = 1; address <= 3; address++)
+    {
+        memset(&reply[address - 1], 0, sizeof(mbus_frame));
+        TEST_CHECK(mbus_sendrecv_request(handle, address, &reply[address - 1], 1) == 0);
+    }
+
+    mbus_disconnect(handle);
+    TEST_CHECK(capture->records > 0 && capture->dropped == 0);
+    mbus_capture_close(capture);
+
+    // requests and replies, in order
+    TEST_CHECK((fp = fopen(path, "r")) != NULL);
+    len = fp ? fread(buff, 1, sizeof(buff), fp) : 0;
+
+    if (fp)
+        fclose(fp);
+
+    TEST_CHECK(mbus_capture_check(buff, len, &end) == 0 && end == len);
+
+    pos = MBUS_CAPTURE_HEADER_SIZE;
+
+    while ((ret = mbus_capture_next(buff, end, &pos, &record, &data)) == 1)
+    {
+        TEST_CHECK(record.handle_id == 42);
+
+        if (record.direction == MBUS_CAPTURE_SEND)
+            sent++;
+        else if (record.direction == MBUS_CAPTURE_RECV)
+            received++;
+    }
+
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(received >= 3 && sent >= received);
+
+    // the replayed slaves answer like the recorded ones
+    TEST_CHECK((replay = mbus_context_sim()) != NULL);
+
+    if (replay)
+    {
+        mbus_context_set_option(replay, MBUS_OPTION_RESPONSE_TIMEOUT, 10000);
+
+        // slave 1 sends its first telegram only, its readout is incomplete
+        TEST_CHECK(mbus_sim_add_capture_file(replay, path) == 3);
+        TEST_CHECK(mbus_sim_add_capture_file(replay, "mbus_test_capture.none") == -1);
+        TEST_CHECK(mbus_connect(replay) == 0);
+
+        for (address = 1; address <= 3; address++)
+        {
+            memset(&again, 0, sizeof(again));
+            TEST_CHECK(mbus_sendrecv_request(replay, address, &again, 1) == 0 &&
+                       test_same_frame(&again, &reply[address - 1]));
+        }
+
+        mbus_disconnect(replay);
+        mbus_context_free(replay);
+    }
+
+    mbus_context_free(handle);
+    unlink(path);
+}
+
+//------------------------------------------------------------------------------
+// Number of a capture file (counts the rotations), -1 if it is none
+//------------------------------------------------------------------------------
+static long
+test_capture_sequence(const char *path)
+{
+    unsigned char buff[MBUS_CAPTURE_HEADER_SIZE];
+    mbus_capture_header header;
+    FILE *fp;
+    size_t len;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+
+    len = fread(buff, 1, sizeof(buff), fp);
+    fclose(fp);
+
+    if (mbus_capture_check(buff, len, NULL) != 0)
+        return -1;
+
+    memcpy(&header, buff, sizeof(header));
+
+    return (long) header.sequence;
+}
+
+//------------------------------------------------------------------------------
+// Fill the current file until the next record starts a new one
+//------------------------------------------------------------------------------
+static int
+test_capture_fill(mbus_capture *capture)
+{
+    unsigned char data[256];
+    unsigned long rotations = capture->rotations;
+    int ret;
+
+    memset(data, 0xA5, sizeof(data));
+
+    while ((ret = mbus_capture_write(capture, MBUS_CAPTURE_RECV, 1, data, sizeof(data))) == 0 &&
+           capture->rotations == rotations)
+        ;
+
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+// Full files are kept as path.1 and path.2. A rotation that failed to rename
+// the full file is retried without moving the kept files on again.
+//------------------------------------------------------------------------------
+static void
+test_rotate(void)
+{
+    char path[] = "mbus_test_rotate.cap";
+    char kept[2][64], marker[2][80];
+    mbus_capture *capture;
+    struct stat st;
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        snprintf(kept[i], sizeof(kept[i]), "%s.%d", path, i + 1);
+        snprintf(marker[i], sizeof(marker[i]), "%s/marker", kept[i]);
+    }
+
+    if ((capture = mbus_capture_open(path, 4096, 2)) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    for (i = 0; i < 3; i++)
+        TEST_CHECK(test_capture_fill(capture) == 0);
+
+    TEST_CHECK(capture->rotations == 3 && capture->dropped == 0);
+    TEST_CHECK(test_capture_sequence(kept[0]) == 2);
+    TEST_CHECK(test_capture_sequence(kept[1]) == 1);
+
+    mbus_capture_close(capture);
+    unlink(kept[0]);
+    unlink(kept[1]);
+
+    // both kept files are directories that can not be replaced
+    for (i = 0; i < 2; i++)
+    {
+        TEST_CHECK(mkdir(kept[i], 0755) == 0);
+        TEST_CHECK((fp = fopen(marker[i], "w")) != NULL);
+
+        if (fp)
+            fclose(fp);
+    }
+
+    if ((capture = mbus_capture_open(path, 4096, 2)) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    TEST_CHECK(test_capture_fill(capture) == -1);
+    TEST_CHECK(capture->rotations == 0 && capture->dropped == 1);
+
+    // path.2 could take path.1 now, but the kept files were shifted already
+    unlink(marker[1]);
+    TEST_CHECK(mbus_capture_write(capture, MBUS_CAPTURE_SEND, 1, NULL, 0) == -1);
+    TEST_CHECK(stat(marker[0], &st) == 0);
+
+    // path.1 is free, the full file is renamed with its records
+    unlink(marker[0]);
+    rmdir(kept[0]);
+    TEST_CHECK(mbus_capture_write(capture, MBUS_CAPTURE_SEND, 1, NULL, 0) == 0);
+    TEST_CHECK(capture->rotations == 1 && capture->dropped == 2);
+    TEST_CHECK(test_capture_sequence(kept[0]) == 0);
+    TEST_CHECK(stat(kept[1], &st) == 0 && S_ISDIR(st.st_mode));
+
+    mbus_capture_close(capture);
+    unlink(path);
+    unlink(kept[0]);
+    rmdir(kept[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_capture();
+    test_rotate();
+
+    return test_exit();
+}
@@ -0,0 +1,248 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// C++ binding: the frames, frame data, records and views of every test frame
+// against the C API, errors of failing calls, and a readout of the simulated
+// segment through a handle that frees the context
+//
+
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include <dirent.h>
+
+#include <mbus/mbus.hpp>
+
+extern "C" {
+#include "mbus_test.h"
+}
+
+static void
+test_frame(const char *name)
+{
+    unsigned char buff[2048];
+    char value[256], c_value[256];
+    mbus_frame c_frame;
+    mbus_frame_data c_data;
+    mbus_data_record *c_record;
+    size_t len;
+    char *c_xml;
+    int ok = 1;
+
+    if ((len = test_load_frame(name, buff, sizeof(buff))) == 0 ||
+        test_parse_frame(name, &c_frame, &c_data) != 0)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    auto frame = mbus::frame::parse(std::span<const unsigned char>(buff, len));
+
+    if (!frame)
+    {
+        fprintf(stderr, "%s: %s\n", name, frame.error().message.c_str());
+        TEST_CHECK(0);
+        mbus_data_record_free(c_data.data_var.record);
+        return;
+    }
+
+    auto data = mbus::frame_data::parse(*frame);
+
+    if (!data)
+    {
+        fprintf(stderr, "%s: %s\n", name, data.error().message.c_str());
+        TEST_CHECK(0);
+        mbus_data_record_free(c_data.data_var.record);
+        return;
+    }
+
+    TEST_CHECK(test_same_frame(frame->get(), &c_frame));
+    TEST_CHECK(data->type() == c_data.type);
+
+    // the same XML as the C functions
+    if ((c_xml = mbus_frame_data_xml(&c_data)) != NULL)
+    {
+        auto xml = data->xml();
+        TEST_CHECK(xml && xml->view() == std::string_view(c_xml));
+        free(c_xml);
+    }
+
+    if ((c_xml = mbus_frame_data_xml_normalized(&c_data)) != NULL)
+    {
+        auto xml = data->xml_normalized();
+        TEST_CHECK(xml && std::strcmp(xml->c_str(), c_xml) == 0);
+        free(c_xml);
+    }
+
+    if (data->type() != MBUS_DATA_TYPE_VARIABLE)
+    {
+        mbus_data_record_free(c_data.data_var.record);
+        return;
+    }
+
+    TEST_CHECK(std::memcmp(&(data->header()), &(c_data.data_var.header), sizeof(mbus_data_variable_header)) == 0);
+
+    // records in the order of the C list
+    c_record = c_data.data_var.record;
+
+    for (mbus::record_ref record : data->records())
+    {
+        if (c_record == NULL)
+        {
+            ok = 0;
+            break;
+        }
+
+        ok = ok && record.dif() == c_record->drh.dib.dif && record.vif() == c_record->drh.vib.vif;
+        ok = ok && record.data().size() == c_record->data_len &&
+             std::memcmp(record.data().data(), c_record->data, c_record->data_len) == 0;
+        ok = ok && record.value(value) ==
+             std::string_view(mbus_data_record_value_r(c_record, c_value, sizeof(c_value)));
+        ok = ok && record.unit(value) ==
+             std::string_view(mbus_data_record_unit_r(c_record, c_value, sizeof(c_value)));
+
+        c_record = (mbus_data_record *) c_record->next;
+    }
+
+    TEST_CHECK(ok && c_record == NULL);
+
+    // the view finds the records of the list
+    auto view = mbus::frame_view::parse(std::span<const unsigned char>(buff, len));
+    c_record = c_data.data_var.record;
+
+    if (view)
+    {
+        TEST_CHECK(view->bytes().size() == len && view->type() == c_frame.type);
+
+        for (auto record : *view)
+        {
+            ok = ok && c_record && record.data().size() == c_record->data_len;
+            c_record = c_record ? (mbus_data_record *) c_record->next : NULL;
+        }
+
+        TEST_CHECK(ok && c_record == NULL);
+    }
+    else
+    {
+        TEST_CHECK(0);
+    }
+
+    mbus_data_record_free(c_data.data_var.record);
+}
+
+static void
+test_errors(void)
+{
+    unsigned char buff[512];
+    size_t len;
+
+    TEST_CHECK((len = test_load_frame("abb_f95.hex", buff, sizeof(buff))) > 10);
+
+    // missing bytes, and a damaged checksum
+    auto frame = mbus::frame::parse(std::span<const unsigned char>(buff, len - 3));
+    TEST_CHECK(!frame && frame.error().code > 0);
+
+    auto view = mbus::frame_view::parse(std::span<const unsigned char>(buff, len - 3));
+    TEST_CHECK(!view && view.error().code == 3);
+
+    buff[len - 2] ^= 0xFF;
+    frame = mbus::frame::parse(std::span<const unsigned char>(buff, len));
+    TEST_CHECK(!frame && frame.error().code < 0 && !frame.error().message.empty());
+
+    view = mbus::frame_view::parse(std::span<const unsigned char>(buff, len));
+    TEST_CHECK(!view && view.error().code < 0);
+}
+
+static void
+test_handle(void)
+{
+    mbus::handle handle(test_segment());
+
+    if (handle.get() == NULL || !handle.connect())
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    TEST_CHECK(handle.connected());
+
+    // both telegrams of slave 1
+    if (auto reply = handle.request(1, 2))
+    {
+        int ntelegrams = 0;
+
+        for (auto telegram : reply->telegrams())
+        {
+            (void) telegram;
+            ntelegrams++;
+        }
+
+        TEST_CHECK(ntelegrams == 2);
+        TEST_CHECK(reply->xml().has_value());
+    }
+    else
+    {
+        TEST_CHECK(0);
+    }
+
+    if (auto reply = handle.request(3))
+    {
+        auto data = mbus::frame_data::parse(*reply);
+        TEST_CHECK(data && data->type() == MBUS_DATA_TYPE_VARIABLE && data->records().begin() != data->records().end());
+    }
+    else
+    {
+        TEST_CHECK(0);
+    }
+
+    // an absent slave times out
+    auto reply = handle.request(7);
+    TEST_CHECK(!reply);
+
+    // moved, the context is freed once
+    mbus::handle other(std::move(handle));
+    TEST_CHECK(handle.get() == NULL && !handle.connected());
+    TEST_CHECK(other.connected() && other.send_request(2));
+    TEST_CHECK(other.recv().has_value());
+    TEST_CHECK(other.disconnect() && !other.connected());
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct dirent *entry;
+    DIR *dir;
+    size_t len;
+
+    test_init(argc, argv);
+
+    if ((dir = opendir(test_frame_path(""))) == NULL)
+    {
+        TEST_CHECK(0);
+        return test_exit();
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        len = strlen(entry->d_name);
+
+        if (len > 4 && strcmp(&(entry->d_name[len - 4]), ".hex") == 0)
+            test_frame(entry->d_name);
+    }
+
+    closedir(dir);
+
+    test_errors();
+    test_handle();
+
+    return test_exit();
+}
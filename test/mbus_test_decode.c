@@ -0,0 +1,175 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Integer and BCD data fields: known values in the widths of the DIF coding
+// (1, 2, 3, 4, 6 and 8 bytes), and every width up to 8 bytes compared with
+// the byte loops the fixed-width decoders replaced, for signed values and
+// invalid BCD digits
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+static const size_t test_widths[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+static unsigned int test_seed = 1;
+
+static unsigned int
+test_random(void)
+{
+    test_seed = test_seed * 1103515245 + 12345;
+
+    return (test_seed >> 16) & 0x7FFF;
+}
+
+//------------------------------------------------------------------------------
+// The byte loops of the decoders before the fixed-width loads
+//------------------------------------------------------------------------------
+static long long
+test_int(const unsigned char *data, size_t size)
+{
+    long long value = 0;
+    size_t i;
+    int neg;
+
+    neg = data[size - 1] & 0x80;
+
+    for (i = size; i > 0; i--)
+        value = (value << 8) + (neg ? (data[i - 1] ^ 0xFF) : data[i - 1]);
+
+    return neg ? -value - 1 : value;
+}
+
+static long long
+test_bcd(const unsigned char *data, size_t size)
+{
+    long long value = 0;
+    size_t i;
+
+    for (i = size; i > 0; i--)
+    {
+        value = value * 10;
+
+        if (data[i - 1] >> 4 < 0xA)
+            value += data[i - 1] >> 4;
+
+        value = value * 10 + (data[i - 1] & 0xF);
+    }
+
+    return (data[size - 1] >> 4 == 0xF) ? -value : value;
+}
+
+static int
+test_same(const unsigned char *data, size_t size)
+{
+    long long ll;
+    long l;
+    int i;
+
+    if (mbus_data_long_long_decode((unsigned char *) data, size, &ll) != 0 || ll != test_int(data, size))
+        return 0;
+
+    if (size <= sizeof(long) &&
+        (mbus_data_long_decode((unsigned char *) data, size, &l) != 0 || l != (long) test_int(data, size)))
+        return 0;
+
+    if (size <= sizeof(int) &&
+        (mbus_data_int_decode((unsigned char *) data, size, &i) != 0 || i != (int) test_int(data, size)))
+        return 0;
+
+    return mbus_data_bcd_decode((unsigned char *) data, size) == test_bcd(data, size);
+}
+
+static void
+test_known(void)
+{
+    unsigned char data[8] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80 };
+    unsigned char bcd[4] = { 0x78, 0x56, 0x34, 0x12 };
+    long long ll;
+    int i;
+
+    TEST_CHECK(mbus_data_int_decode(&data[6], 2, &i) == 0 && i == -32768);
+    TEST_CHECK(mbus_data_int_decode(&data[5], 3, &i) == 0 && i == -8388608);
+    TEST_CHECK(mbus_data_long_long_decode(&data[2], 6, &ll) == 0 && ll == -140737488355328LL);
+    TEST_CHECK(mbus_data_long_long_decode(data, 8, &ll) == 0 && ll == (-9223372036854775807LL - 1));
+
+    memset(data, 0xFF, sizeof(data));
+    TEST_CHECK(mbus_data_int_decode(data, 3, &i) == 0 && i == -1);
+    TEST_CHECK(mbus_data_long_long_decode(data, 8, &ll) == 0 && ll == -1);
+
+    data[0] = 0x34;
+    data[1] = 0x12;
+    data[2] = 0x00;
+    TEST_CHECK(mbus_data_int_decode(data, 3, &i) == 0 && i == 0x1234);
+
+    TEST_CHECK(mbus_data_bcd_decode(bcd, 4) == 12345678);
+    TEST_CHECK(mbus_data_bcd_decode(bcd, 3) == 345678);
+    TEST_CHECK(mbus_data_bcd_decode(bcd, 1) == 78);
+
+    // F in the most significant digit is the sign
+    bcd[1] = 0xF6;
+    TEST_CHECK(mbus_data_bcd_decode(bcd, 2) == -678);
+
+    TEST_CHECK(mbus_data_int_decode(NULL, 2, &i) == -1);
+    TEST_CHECK(mbus_data_long_long_decode(data, 0, &ll) == -1);
+}
+
+static void
+test_compare(void)
+{
+    unsigned char data[8];
+    size_t w, size, j;
+    int n, ok = 1;
+
+    for (w = 0; w < sizeof(test_widths) / sizeof(test_widths[0]); w++)
+    {
+        size = test_widths[w];
+
+        // sign boundaries
+        for (n = 0; n < 4; n++)
+        {
+            memset(data, (n & 1) ? 0xFF : 0x00, size);
+            data[size - 1] = (n & 2) ? 0x80 : 0x7F;
+            ok = ok && test_same(data, size);
+        }
+
+        // random bytes, and BCD digits with a sign
+        for (n = 0; n < 20000 && ok; n++)
+        {
+            for (j = 0; j < size; j++)
+                data[j] = (n & 1) ? (unsigned char) test_random() : (unsigned char) ((test_random() % 10) << 4 | test_random() % 10);
+
+            if (n % 4 == 2)
+                data[size - 1] |= 0xF0;
+
+            if (!test_same(data, size))
+            {
+                fprintf(stderr, "width %d differs\n", (int) size);
+                ok = 0;
+            }
+        }
+    }
+
+    TEST_CHECK(ok);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_known();
+    test_compare();
+
+    return test_exit();
+}
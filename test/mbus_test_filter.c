@@ -0,0 +1,130 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Record filter: selection of the records of eastron_sdm630 by VIF and by the
+// first VIFE of the 0xFD extension table (voltage 0x4x, current 0x5x,
+// dimensionless 0x3A)
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+static const unsigned char test_vif_fd[] = { 0xFD };
+
+//------------------------------------------------------------------------------
+// Records of the frame view matching the filter
+//------------------------------------------------------------------------------
+static int
+test_view_count(const mbus_frame_view *view, const mbus_record_filter *filter)
+{
+    mbus_record_view record;
+    size_t pos = 0;
+    int n = 0, ret;
+
+    while ((ret = mbus_frame_view_find_record(view, &pos, filter, &record)) == 1)
+        n++;
+
+    return (ret == 0) ? n : -1;
+}
+
+//------------------------------------------------------------------------------
+// Records of the 0xFD table kept by the filtered parser
+//------------------------------------------------------------------------------
+static int
+test_parse_count(mbus_frame *frame, const mbus_record_filter *filter)
+{
+    mbus_data_variable data;
+    mbus_data_record *record;
+    int n = 0;
+
+    memset(&data, 0, sizeof(data));
+
+    if (mbus_data_variable_parse_filter(frame, &data, filter, NULL) != 0)
+        return -1;
+
+    for (record = data.record; record; record = record->next)
+    {
+        TEST_CHECK(record->drh.vib.vif == 0xFD &&
+                   (record->drh.vib.vife[0] & filter->vife_mask) == (filter->vife & filter->vife_mask));
+        n++;
+    }
+
+    mbus_data_record_free(data.record);
+
+    return n;
+}
+
+static void
+test_filter(void)
+{
+    unsigned char buff[4096];
+    mbus_record_filter filter;
+    mbus_frame_view view;
+    mbus_frame frame;
+    size_t len;
+
+    TEST_CHECK((len = test_load_frame("eastron_sdm630.hex", buff, sizeof(buff))) > 0);
+    TEST_CHECK(mbus_frame_view_init(&view, buff, len) == 0);
+    TEST_CHECK(test_parse_frame("eastron_sdm630.hex", &frame, NULL) == 0);
+
+    mbus_record_filter_init(&filter);
+    TEST_CHECK(test_view_count(&view, &filter) == 23);
+    TEST_CHECK(test_view_count(&view, NULL) == 23);
+
+    // every quantity of the extension table
+    filter.vif = test_vif_fd;
+    filter.nvif = 1;
+    TEST_CHECK(test_view_count(&view, &filter) == 19);
+
+    // a single quantity: the current
+    filter.vife = 0x59;
+    TEST_CHECK(test_view_count(&view, &filter) == 4);
+    TEST_CHECK(test_parse_count(&frame, &filter) == 4);
+
+    // the voltage, any exponent
+    filter.vife = 0x40;
+    filter.vife_mask = 0x70;
+    TEST_CHECK(test_view_count(&view, &filter) == 6);
+    TEST_CHECK(test_parse_count(&frame, &filter) == 6);
+
+    // the extension bit is not compared by default
+    mbus_record_filter_init(&filter);
+    filter.vif = test_vif_fd;
+    filter.nvif = 1;
+    filter.vife = 0x80 | 0x3A;
+    TEST_CHECK(test_view_count(&view, &filter) == 9);
+
+    // the VIFE does not apply to records of the primary table (power, 0x2A)
+    filter.vif = NULL;
+    filter.nvif = 0;
+    filter.vife = 0x59;
+    TEST_CHECK(test_view_count(&view, &filter) == 4 + 4);
+
+    // combined with the function field, every record is an instantaneous value
+    filter.vife = -1;
+    filter.function = MBUS_DATA_RECORD_DIF_MASK_INST;
+    TEST_CHECK(test_view_count(&view, &filter) == 23);
+
+    filter.function = MBUS_DATA_RECORD_DIF_MASK_MIN;
+    TEST_CHECK(test_view_count(&view, &filter) == 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_filter();
+
+    return test_exit();
+}
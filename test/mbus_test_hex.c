@@ -0,0 +1,172 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Checksum and hex dump decoding: the checksum of every length and alignment
+// against a scalar sum, and mbus_hex2bin against the strtoul decoder it
+// replaced, for dumps with irregular whitespace, single digits and garbage
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "mbus_test.h"
+
+static unsigned int test_seed = 1;
+
+static unsigned int
+test_random(void)
+{
+    test_seed = test_seed * 1103515245 + 12345;
+
+    return (test_seed >> 16) & 0x7FFF;
+}
+
+static unsigned char
+test_checksum(const unsigned char *data, size_t data_size)
+{
+    unsigned char sum = 0;
+    size_t i;
+
+    for (i = 0; i < data_size; i++)
+        sum += data[i];
+
+    return sum;
+}
+
+static void
+test_checksums(void)
+{
+    unsigned char buff[512 + 16];
+    size_t offset, len;
+    int fill;
+
+    for (fill = 0; fill < 2; fill++)
+    {
+        for (len = 0; len < sizeof(buff); len++)
+            buff[len] = fill ? 0xFF : (unsigned char) test_random();
+
+        for (offset = 0; offset < 16; offset++)
+        {
+            for (len = 0; len <= 512; len++)
+            {
+                if (mbus_checksum(&buff[offset], len) != test_checksum(&buff[offset], len))
+                {
+                    fprintf(stderr, "checksum differs at offset %d length %d\n", (int) offset, (int) len);
+                    TEST_CHECK(0);
+                    return;
+                }
+            }
+        }
+    }
+
+    TEST_CHECK(mbus_checksum(NULL, 4) == 0);
+}
+
+//------------------------------------------------------------------------------
+// The decoder mbus_hex2bin had before the lookup table
+//------------------------------------------------------------------------------
+static size_t
+test_hex2bin(unsigned char *dst, size_t dst_len, const unsigned char *src, size_t src_len)
+{
+    size_t i, result = 0;
+    unsigned long val;
+    char *end, buf[3];
+
+    memset(buf, 0, sizeof(buf));
+    memset(dst, 0, dst_len);
+
+    for (i = 0; i + 1 < src_len; i++)
+    {
+        if (isspace(src[i]))
+            continue;
+
+        buf[0] = src[i];
+        buf[1] = src[++i];
+
+        val = strtoul(buf, &end, 16);
+
+        if (end == buf || result >= dst_len)
+            break;
+
+        dst[result++] = (unsigned char) val;
+    }
+
+    return result;
+}
+
+static int
+test_same_hex2bin(const char *src, size_t src_len, size_t dst_len)
+{
+    unsigned char dst[256], expected[256];
+    size_t len;
+
+    len = mbus_hex2bin(dst, dst_len, (const unsigned char *) src, src_len);
+
+    return len == test_hex2bin(expected, dst_len, (const unsigned char *) src, src_len) &&
+           memcmp(dst, expected, dst_len) == 0;
+}
+
+static void
+test_hex(void)
+{
+    static const char alphabet[] = "0123456789abcdefABCDEF \t\n\r\v\fgGx:";
+    const char *dump = "68 1F 1f\t68\r\n08 0 2 72 ";
+    unsigned char dst[256];
+    char src[128];
+    size_t i, len;
+    int n;
+
+    TEST_CHECK(mbus_hex2bin(dst, sizeof(dst), (const unsigned char *) dump, strlen(dump)) == 8);
+    TEST_CHECK(dst[0] == 0x68 && dst[1] == 0x1F && dst[2] == 0x1F && dst[3] == 0x68);
+    TEST_CHECK(dst[4] == 0x08 && dst[5] == 0x00 && dst[6] == 0x02 && dst[7] == 0x72);
+
+    // an odd digit at the end has no pair
+    TEST_CHECK(mbus_hex2bin(dst, sizeof(dst), (const unsigned char *) "68 1", 4) == 1);
+
+    // stops at garbage and at the end of the destination
+    TEST_CHECK(mbus_hex2bin(dst, sizeof(dst), (const unsigned char *) "68 G1 68", 8) == 1);
+    TEST_CHECK(mbus_hex2bin(dst, 2, (const unsigned char *) "68 1F 1F", 8) == 2 && dst[1] == 0x1F);
+
+    TEST_CHECK(mbus_hex2bin(dst, sizeof(dst), NULL, 4) == 0);
+    TEST_CHECK(mbus_hex2bin(NULL, sizeof(dst), (const unsigned char *) "68", 2) == 0);
+
+    TEST_CHECK(test_same_hex2bin(dump, strlen(dump), sizeof(dst)));
+    TEST_CHECK(test_same_hex2bin(dump, strlen(dump), 3));
+
+    // random dumps, mostly digits
+    for (n = 0; n < 20000; n++)
+    {
+        len = test_random() % sizeof(src);
+
+        for (i = 0; i < len; i++)
+            src[i] = (test_random() % 4) ? alphabet[test_random() % 22] : alphabet[test_random() % (sizeof(alphabet) - 1)];
+
+        if (!test_same_hex2bin(src, len, 1 + test_random() % 64))
+        {
+            fprintf(stderr, "hex2bin differs for '%.*s'\n", (int) len, src);
+            TEST_CHECK(0);
+            return;
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_checksums();
+    test_hex();
+
+    return test_exit();
+}
@@ -0,0 +1,234 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Layout cache: the values of every test frame decoded with a new and with a
+// cached plan are those of the parser, a new value in the same layout is
+// decoded with the plan, and a changed layout builds another one
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "mbus_test.h"
+
+#define TEST_NVALUES 128
+
+static int
+test_same_str(const char *a, const char *b)
+{
+    return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
+}
+
+static int
+test_same_value(const mbus_typed_value *a, const mbus_typed_value *b)
+{
+    if (a->type != b->type || a->exponent != b->exponent || a->offset != b->offset ||
+        !test_same_str(a->unit, b->unit) || !test_same_str(a->quantity, b->quantity))
+        return 0;
+
+    switch (a->type)
+    {
+        case MBUS_VALUE_TYPE_INT:
+        case MBUS_VALUE_TYPE_BCD:
+            return a->value.int_val == b->value.int_val;
+
+        case MBUS_VALUE_TYPE_REAL:
+            return a->value.real_val == b->value.real_val;
+
+        case MBUS_VALUE_TYPE_TIME:
+            return a->value.time_val.epoch == b->value.time_val.epoch &&
+                   a->value.time_val.has_time == b->value.time_val.has_time;
+
+        case MBUS_VALUE_TYPE_RAW:
+            return a->value.raw.len == b->value.raw.len &&
+                   memcmp(a->value.raw.data, b->value.raw.data, a->value.raw.len) == 0;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+// Values of the cache against those of the parsed records
+//------------------------------------------------------------------------------
+static int
+test_same_values(mbus_frame *frame, const mbus_typed_value *values, int nvalues)
+{
+    mbus_frame_data data;
+    mbus_data_record *record;
+    mbus_typed_value value;
+    int i, ok = 1;
+
+    memset(&data, 0, sizeof(data));
+
+    if (mbus_frame_data_parse(frame, &data) != 0)
+        return 0;
+
+    for (record = data.data_var.record, i = 0; record && ok; record = record->next, i++)
+    {
+        if (mbus_data_record_typed_value(record, &value) != 0)
+            value.type = MBUS_VALUE_TYPE_NONE;
+
+        ok = (i < nvalues && (value.type == MBUS_VALUE_TYPE_NONE ? values[i].type == MBUS_VALUE_TYPE_NONE
+                                                                   : test_same_value(&value, &(values[i]))));
+    }
+
+    mbus_data_record_free(data.data_var.record);
+
+    return ok && i == nvalues;
+}
+
+static void
+test_frame(const char *name)
+{
+    mbus_typed_value values[TEST_NVALUES];
+    mbus_data_variable_header header;
+    mbus_layout_cache cache;
+    mbus_frame_data data;
+    mbus_frame frame;
+    int n;
+
+    mbus_layout_cache_init(&cache);
+
+    if (test_parse_frame(name, &frame, &data) != 0)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    mbus_data_record_free(data.data_var.record);
+
+    if (data.type != MBUS_DATA_TYPE_VARIABLE)
+    {
+        TEST_CHECK(mbus_layout_cache_decode(&cache, &frame, NULL, values, TEST_NVALUES) == -1);
+        return;
+    }
+
+    // a new plan, then the cached one
+    n = mbus_layout_cache_decode(&cache, &frame, &header, values, TEST_NVALUES);
+    TEST_CHECK(cache.misses == 1 && cache.hits == 0);
+    TEST_CHECK(memcmp(&header, &(data.data_var.header), sizeof(header)) == 0);
+
+    if (n < 0 || !test_same_values(&frame, values, n))
+    {
+        fprintf(stderr, "%s: values differ\n", name);
+        TEST_CHECK(0);
+    }
+
+    memset(values, 0, sizeof(values));
+    TEST_CHECK(mbus_layout_cache_decode(&cache, &frame, NULL, values, TEST_NVALUES) == n);
+    TEST_CHECK(cache.misses == 1 && cache.hits == 1);
+
+    if (!test_same_values(&frame, values, n))
+    {
+        fprintf(stderr, "%s: cached values differ\n", name);
+        TEST_CHECK(0);
+    }
+
+    mbus_layout_cache_free(&cache);
+}
+
+//------------------------------------------------------------------------------
+// Plans kept for the key of kamstrup_multical_601
+//------------------------------------------------------------------------------
+static size_t
+test_plans(mbus_layout_cache *cache)
+{
+    size_t i, nplans = 0;
+
+    for (i = 0; i < cache->size; i++)
+    {
+        if (cache->entries[i].plans && cache->entries[i].nplans > nplans)
+            nplans = cache->entries[i].nplans;
+    }
+
+    return nplans;
+}
+
+static void
+test_layouts(void)
+{
+    mbus_layout_cache cache;
+    mbus_typed_value values[TEST_NVALUES];
+    mbus_frame_view view;
+    mbus_record_view record;
+    mbus_frame frame;
+    size_t pos = 0, vif_offset = 0;
+    unsigned long hits;
+    int n, i;
+
+    mbus_layout_cache_init(&cache);
+
+    TEST_CHECK(test_parse_frame("kamstrup_multical_601.hex", &frame, NULL) == 0);
+    TEST_CHECK((n = mbus_layout_cache_decode(&cache, &frame, NULL, values, TEST_NVALUES)) > 2);
+
+    // a new value in the same layout
+    TEST_CHECK(mbus_frame_view_of(&view, &frame) == 0);
+    TEST_CHECK(mbus_frame_view_next_record(&view, &pos, &record) == 1);
+    TEST_CHECK(mbus_frame_view_next_record(&view, &pos, &record) == 1);
+
+    frame.data[record.data_offset] ^= 0x01;
+    hits = cache.hits;
+    TEST_CHECK(mbus_layout_cache_decode(&cache, &frame, NULL, values, TEST_NVALUES) == n);
+    TEST_CHECK(cache.hits == hits + 1 && test_same_values(&frame, values, n));
+
+    // fewer values than records
+    TEST_CHECK(mbus_layout_cache_decode(&cache, &frame, NULL, values, 1) == n);
+    TEST_CHECK(mbus_layout_cache_decode(&cache, &frame, NULL, NULL, 0) == n);
+    TEST_CHECK(mbus_layout_cache_decode(&cache, &frame, NULL, NULL, 1) == -1);
+
+    // the second record with other exponents: a plan for each, the oldest
+    // dropped beyond MBUS_LAYOUT_CACHE_PLANS
+    vif_offset = record.offset + 1 + record.ndife;
+
+    for (i = 1; i <= MBUS_LAYOUT_CACHE_PLANS + 2; i++)
+    {
+        frame.data[vif_offset] = (frame.data[vif_offset] & 0xF8) | ((frame.data[vif_offset] + 1) & 0x07);
+        TEST_CHECK(mbus_layout_cache_decode(&cache, &frame, NULL, values, TEST_NVALUES) == n);
+        TEST_CHECK(test_same_values(&frame, values, n));
+    }
+
+    TEST_CHECK(cache.count == 1 && test_plans(&cache) == MBUS_LAYOUT_CACHE_PLANS);
+    TEST_CHECK(cache.misses == 1 + MBUS_LAYOUT_CACHE_PLANS + 2);
+
+    mbus_layout_cache_free(&cache);
+    TEST_CHECK(cache.entries == NULL && cache.count == 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct dirent *entry;
+    DIR *dir;
+    size_t len;
+
+    test_init(argc, argv);
+
+    if ((dir = opendir(test_frame_path(""))) == NULL)
+    {
+        TEST_CHECK(0);
+        return test_exit();
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        len = strlen(entry->d_name);
+
+        if (len > 4 && strcmp(&(entry->d_name[len - 4]), ".hex") == 0)
+            test_frame(entry->d_name);
+    }
+
+    closedir(dir);
+
+    test_layouts();
+
+    return test_exit();
+}
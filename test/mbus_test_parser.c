@@ -0,0 +1,181 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Incremental frame parser: a stream of several telegrams, an ACK and a stray
+// byte fed in chunks of every size, and the bytes still needed for a frame
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+static const char *test_frames[] = {
+    "abb_f95.hex",
+    "kamstrup_multical_601.hex",
+    "sontex_supercal_531_telegram1.hex",
+};
+
+#define TEST_NFRAMES (sizeof(test_frames) / sizeof(test_frames[0]))
+#define TEST_ROUNDS  4
+
+typedef struct _test_stream {
+    unsigned char buff[4096];
+    size_t len;
+    mbus_frame frames[TEST_NFRAMES];
+    size_t next;                     // frame expected by the callback
+    int mismatch;
+} test_stream;
+
+//------------------------------------------------------------------------------
+// ACK, the test frames with a stray byte after the first one, and repeats of
+// them so the stream is longer than the parser buffer
+//------------------------------------------------------------------------------
+static int
+test_stream_init(test_stream *stream)
+{
+    size_t i, n, len;
+
+    memset(stream, 0, sizeof(test_stream));
+    stream->buff[stream->len++] = MBUS_FRAME_ACK_START;
+
+    for (n = 0; n < TEST_ROUNDS; n++)
+    {
+        for (i = 0; i < TEST_NFRAMES; i++)
+        {
+            len = test_load_frame(test_frames[i], &(stream->buff[stream->len]),
+                                  sizeof(stream->buff) - stream->len - 1);
+
+            if (len == 0 || test_parse_frame(test_frames[i], &(stream->frames[i]), NULL) != 0)
+                return -1;
+
+            stream->len += len;
+
+            if (n == 0 && i == 0)
+                stream->buff[stream->len++] = 0x42;
+        }
+    }
+
+    return 0;
+}
+
+static void
+test_frame_event(mbus_frame_parser *parser, mbus_frame *frame, const unsigned char *data, size_t data_len)
+{
+    test_stream *stream = (test_stream *) parser->userdata;
+
+    if (frame->type == MBUS_FRAME_TYPE_ACK)
+    {
+        if (stream->next != 0 || data_len != 1)
+            stream->mismatch++;
+
+        return;
+    }
+
+    if (!test_same_frame(frame, &(stream->frames[stream->next % TEST_NFRAMES])))
+        stream->mismatch++;
+
+    stream->next++;
+}
+
+static void
+test_chunks(test_stream *stream)
+{
+    mbus_frame_parser parser;
+    size_t chunk, pos, n;
+    int nframes;
+
+    for (chunk = 1; chunk <= stream->len; chunk += (chunk < 64) ? 1 : 97)
+    {
+        mbus_frame_parser_init(&parser, test_frame_event, stream);
+        stream->next = 0;
+        stream->mismatch = 0;
+
+        for (pos = 0, nframes = 0; pos < stream->len; pos += n)
+        {
+            n = (stream->len - pos < chunk) ? stream->len - pos : chunk;
+            nframes += mbus_frame_parser_feed(&parser, &(stream->buff[pos]), n);
+        }
+
+        TEST_CHECK(nframes == TEST_ROUNDS * TEST_NFRAMES + 1);
+        TEST_CHECK(stream->next == TEST_ROUNDS * TEST_NFRAMES && stream->mismatch == 0);
+        TEST_CHECK(parser.nframes == TEST_ROUNDS * TEST_NFRAMES + 1 && parser.nerrors == 1);
+        TEST_CHECK(mbus_frame_parser_pending(&parser) == 0);
+    }
+}
+
+static void
+test_needed(test_stream *stream)
+{
+    mbus_frame_parser parser;
+    mbus_frame frame;
+    const unsigned char *data;
+    size_t data_len, len;
+
+    mbus_frame_parser_init(&parser, NULL, NULL);
+    TEST_CHECK(mbus_frame_parser_needed(&parser) == 1);
+
+    // the ACK, then the length of the first frame is known from its header
+    TEST_CHECK(mbus_frame_parser_append(&parser, stream->buff, 2) == 2);
+    TEST_CHECK(mbus_frame_parser_next(&parser, &frame, &data, &data_len) == 1);
+    TEST_CHECK(frame.type == MBUS_FRAME_TYPE_ACK && data_len == 1);
+    TEST_CHECK(mbus_frame_parser_needed(&parser) == 2);
+    TEST_CHECK(mbus_frame_parser_next(&parser, &frame, &data, &data_len) == 0);
+
+    len = MBUS_FRAME_FIXED_SIZE_LONG + stream->buff[2];
+    TEST_CHECK(mbus_frame_parser_append(&parser, &(stream->buff[2]), 2) == 2);
+    TEST_CHECK(mbus_frame_parser_needed(&parser) == len - 3);
+    TEST_CHECK(mbus_frame_parser_pending(&parser) == 3);
+
+    TEST_CHECK(mbus_frame_parser_append(&parser, &(stream->buff[4]), len - 3) == len - 3);
+    TEST_CHECK(mbus_frame_parser_needed(&parser) == 0);
+    TEST_CHECK(mbus_frame_parser_next(&parser, &frame, &data, &data_len) == 1);
+    TEST_CHECK(data_len == len && memcmp(data, &(stream->buff[1]), len) == 0);
+    TEST_CHECK(test_same_frame(&frame, &(stream->frames[0])));
+
+    // the stray byte is discarded on its own
+    TEST_CHECK(mbus_frame_parser_append(&parser, &(stream->buff[1 + len]), 1) == 1);
+    TEST_CHECK(mbus_frame_parser_next(&parser, &frame, &data, &data_len) < 0);
+    TEST_CHECK(data_len == 1 && parser.nerrors == 1);
+    TEST_CHECK(mbus_frame_parser_pending(&parser) == 0);
+
+    // a damaged checksum drops the whole frame
+    TEST_CHECK(mbus_frame_parser_append(&parser, &(stream->buff[1]), len) == len);
+    parser.buff[parser.start + len - 2] ^= 0xFF;
+    TEST_CHECK(mbus_frame_parser_next(&parser, &frame, &data, &data_len) < 0);
+    TEST_CHECK(data_len == len && mbus_frame_parser_pending(&parser) == 0);
+
+    // a full buffer takes no more
+    mbus_frame_parser_reset(&parser);
+    TEST_CHECK(mbus_frame_parser_append(&parser, stream->buff, stream->len) == MBUS_FRAME_PARSER_BUFF_SIZE);
+    TEST_CHECK(mbus_frame_parser_append(&parser, stream->buff, 1) == 0);
+
+    TEST_CHECK(mbus_frame_parser_feed(&parser, NULL, 1) == -1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_stream stream;
+
+    test_init(argc, argv);
+
+    if (test_stream_init(&stream) != 0 || stream.len <= MBUS_FRAME_PARSER_BUFF_SIZE)
+    {
+        TEST_CHECK(0);
+        return test_exit();
+    }
+
+    test_chunks(&stream);
+    test_needed(&stream);
+
+    return test_exit();
+}
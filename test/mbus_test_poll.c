@@ -0,0 +1,257 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Poll engine: concurrent readouts on two simulated segments and secondary
+// address scans
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+#define TEST_MAX_EVENTS 16
+
+typedef struct _test_events {
+    mbus_handle *handle[TEST_MAX_EVENTS];
+    char address[TEST_MAX_EVENTS][17];
+    int result[TEST_MAX_EVENTS];
+    size_t telegrams[TEST_MAX_EVENTS];
+    size_t count;
+    mbus_handle *requeue;        /**< handle to queue address 2 on from the first event */
+} test_events;
+
+static void
+test_poll_event(mbus_poll *engine, mbus_handle *handle, const char *address, int result,
+                mbus_frame *reply, void *userdata)
+{
+    test_events *events = (test_events *) userdata;
+    size_t n = 0;
+
+    if (events->count == TEST_MAX_EVENTS)
+    {
+        TEST_CHECK(events->count < TEST_MAX_EVENTS);
+        return;
+    }
+
+    // a reply only comes with MBUS_RECV_RESULT_OK
+    TEST_CHECK((reply != NULL) == (result == MBUS_RECV_RESULT_OK));
+
+    for (; reply; reply = reply->next)
+        n++;
+
+    events->handle[events->count] = handle;
+    snprintf(events->address[events->count], sizeof(events->address[0]), "%s", address);
+    events->result[events->count] = result;
+    events->telegrams[events->count] = n;
+    events->count++;
+
+    if (events->requeue)
+    {
+        TEST_CHECK(mbus_poll_add_primary(engine, events->requeue, 2) == 0);
+        events->requeue = NULL;
+    }
+}
+
+static int
+test_find_event(test_events *events, mbus_handle *handle, const char *address)
+{
+    size_t i;
+
+    for (i = 0; i < events->count; i++)
+    {
+        if (events->handle[i] == handle && strcmp(events->address[i], address) == 0)
+            return (int) i;
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+// Readouts by primary and secondary address, one of them missing, and a job
+// queued from the callback
+//------------------------------------------------------------------------------
+static void
+test_poll(void)
+{
+    mbus_handle *a, *b;
+    mbus_poll *engine;
+    mbus_frame reply;
+    test_events events;
+    char secondary[17];
+    int i;
+
+    memset(&events, 0, sizeof(events));
+
+    a = test_segment();
+    b = test_segment();
+
+    if (a == NULL || b == NULL || mbus_connect(a) != 0 || mbus_connect(b) != 0 ||
+        (engine = mbus_poll_new(test_poll_event, &events)) == NULL)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(a);
+        mbus_context_free(b);
+        return;
+    }
+
+    events.requeue = b;
+
+    test_secondary("kamstrup_multical_601.hex", 10000003, secondary, sizeof(secondary));
+
+    TEST_CHECK(mbus_poll_add_primary(engine, a, 1) == 0);
+    TEST_CHECK(mbus_poll_add_primary(engine, a, 9) == 0);
+    TEST_CHECK(mbus_poll_add_secondary(engine, a, secondary) == 0);
+    TEST_CHECK(mbus_poll_add_primary(engine, b, 3) == 0);
+    TEST_CHECK(mbus_poll_add_primary(engine, a, 256) != 0);
+    TEST_CHECK(mbus_poll_add_secondary(engine, a, "12345") != 0);
+    TEST_CHECK(mbus_poll_pending(engine) == 4);
+
+    TEST_CHECK(mbus_poll_run(engine) == 0);
+    TEST_CHECK(mbus_poll_pending(engine) == 0);
+    TEST_CHECK(events.count == 5);
+
+    TEST_CHECK((i = test_find_event(&events, a, "1")) != -1 &&
+               events.result[i] == MBUS_RECV_RESULT_OK && events.telegrams[i] == 2);
+    TEST_CHECK((i = test_find_event(&events, a, "9")) != -1 &&
+               events.result[i] == MBUS_RECV_RESULT_TIMEOUT);
+    TEST_CHECK((i = test_find_event(&events, a, secondary)) != -1 &&
+               events.result[i] == MBUS_RECV_RESULT_OK && events.telegrams[i] == 1);
+    TEST_CHECK((i = test_find_event(&events, b, "3")) != -1 &&
+               events.result[i] == MBUS_RECV_RESULT_OK && events.telegrams[i] == 1);
+    TEST_CHECK((i = test_find_event(&events, b, "2")) != -1 &&
+               events.result[i] == MBUS_RECV_RESULT_OK && events.telegrams[i] == 1);
+
+    // the handles are usable with the blocking API again
+    mbus_poll_free(engine);
+
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(a, 2, &reply, 0) == 0);
+
+    mbus_disconnect(a);
+    mbus_disconnect(b);
+    mbus_context_free(a);
+    mbus_context_free(b);
+}
+
+//------------------------------------------------------------------------------
+// Scan of the whole secondary address range, without and with the result of
+// the last scan as seeds. Slave 1 answers with the address of its telegram.
+//------------------------------------------------------------------------------
+static int test_found;
+
+static void
+test_found_event(mbus_handle *handle, mbus_frame *frame)
+{
+    (void) handle;
+    (void) frame;
+
+    test_found++;
+}
+
+static void
+test_scan_run(test_events *events, const char **seeds, size_t nseeds)
+{
+    mbus_handle *handle;
+    mbus_poll *engine;
+
+    memset(events, 0, sizeof(test_events));
+
+    if ((handle = test_segment()) == NULL || mbus_connect(handle) != 0 ||
+        (engine = mbus_poll_new(test_poll_event, events)) == NULL)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(handle);
+        return;
+    }
+
+    TEST_CHECK(mbus_poll_add_scan(engine, handle, "FFFFFFFFFFFFFFFF", seeds, nseeds) == 0);
+    TEST_CHECK(mbus_poll_add_scan(engine, handle, "FFFFFFFFFFFFFFFX", NULL, 0) != 0);
+    TEST_CHECK(mbus_poll_run(engine) == 0);
+
+    // the scan ends last, with the mask
+    TEST_CHECK(events->count == 4);
+    TEST_CHECK(events->count > 0 &&
+               strcmp(events->address[events->count - 1], "FFFFFFFFFFFFFFFF") == 0 &&
+               events->result[events->count - 1] == MBUS_POLL_RESULT_SCAN_DONE);
+
+    mbus_poll_free(engine);
+    mbus_disconnect(handle);
+    mbus_context_free(handle);
+}
+
+static void
+test_scan(void)
+{
+    char found[3][17], secondary[17], sontex[17], mask[] = "FFFFFFFFFFFFFFFF";
+    const char *seeds[4];
+    test_events events;
+    mbus_handle *handle;
+    mbus_frame frame;
+    int i;
+
+    test_scan_run(&events, NULL, 0);
+
+    test_secondary("abb_f95.hex", 10000002, secondary, sizeof(secondary));
+    TEST_CHECK((i = test_find_event(&events, events.handle[0], secondary)) != -1 &&
+               events.result[i] == MBUS_RECV_RESULT_OK && events.telegrams[i] == 1);
+    test_secondary("kamstrup_multical_601.hex", 10000003, secondary, sizeof(secondary));
+    TEST_CHECK((i = test_find_event(&events, events.handle[0], secondary)) != -1 &&
+               events.result[i] == MBUS_RECV_RESULT_OK);
+
+    TEST_CHECK(test_parse_frame("sontex_supercal_531_telegram1.hex", &frame, NULL) == 0 &&
+               mbus_frame_get_secondary_address_r(&frame, sontex, sizeof(sontex)) != NULL);
+    TEST_CHECK((i = test_find_event(&events, events.handle[0], sontex)) != -1 &&
+               events.result[i] == MBUS_RECV_RESULT_OK);
+
+    // seeds are verified first, one of a slave that is gone is not reported
+    for (i = 0; i < 3; i++)
+    {
+        snprintf(found[i], sizeof(found[i]), "%s", events.address[i]);
+        seeds[i] = found[i];
+    }
+
+    seeds[3] = "1234567812345678";
+    test_scan_run(&events, seeds, 4);
+
+    for (i = 0; i < 3; i++)
+        TEST_CHECK(test_find_event(&events, events.handle[0], found[i]) != -1);
+
+    TEST_CHECK(test_find_event(&events, events.handle[0], seeds[3]) == -1);
+
+
+    // the blocking scan finds the same slaves
+    if ((handle = test_segment()) == NULL || mbus_connect(handle) != 0)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(handle);
+        return;
+    }
+
+    test_found = 0;
+    mbus_register_found_event(handle, test_found_event);
+    TEST_CHECK(mbus_scan_2nd_address_range(handle, 0, mask) == 0);
+    TEST_CHECK(test_found == 3);
+
+    mbus_disconnect(handle);
+    mbus_context_free(handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_poll();
+    test_scan();
+
+    return test_exit();
+}
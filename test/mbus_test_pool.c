@@ -0,0 +1,164 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Frame pool: frames and frame data reused up to the pool size, a chain of
+// frames returned at once, a pool freed while frames are still out, and the
+// extra telegrams of a readout taken from the pool of the handle
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+static void
+test_frames(void)
+{
+    mbus_frame_pool *pool;
+    mbus_frame *a, *b, *c;
+
+    TEST_CHECK(mbus_frame_pool_new(0) == NULL);
+    TEST_CHECK(mbus_frame_pool_acquire(NULL, MBUS_FRAME_TYPE_SHORT) == NULL);
+
+    if ((pool = mbus_frame_pool_new(2)) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    a = mbus_frame_pool_acquire(pool, MBUS_FRAME_TYPE_LONG);
+    b = mbus_frame_pool_acquire(pool, MBUS_FRAME_TYPE_LONG);
+    c = mbus_frame_pool_acquire(pool, MBUS_FRAME_TYPE_LONG);
+
+    if (a == NULL || b == NULL || c == NULL)
+    {
+        TEST_CHECK(0);
+        mbus_frame_pool_free(pool);
+        return;
+    }
+
+    TEST_CHECK(pool->outstanding == 3 && pool->nframes == 0);
+    TEST_CHECK(a->pool == pool && a->type == MBUS_FRAME_TYPE_LONG);
+
+    // a chain goes back at once, frames beyond the pool size to the heap
+    a->next = b;
+    b->next = c;
+    TEST_CHECK(mbus_frame_free(a) == 0);
+    TEST_CHECK(pool->outstanding == 0 && pool->nframes == 2);
+
+    // reused frames are initialized for their new type
+    TEST_CHECK((a = mbus_frame_pool_acquire(pool, MBUS_FRAME_TYPE_SHORT)) != NULL);
+    TEST_CHECK(pool->nframes == 1);
+
+    if (a)
+    {
+        TEST_CHECK(a->type == MBUS_FRAME_TYPE_SHORT && a->next == NULL && a->pool == pool);
+        TEST_CHECK(a->start1 == MBUS_FRAME_SHORT_START && a->stop == MBUS_FRAME_STOP);
+    }
+
+    // a pool freed with a frame still out is released with the frame
+    mbus_frame_pool_free(pool);
+    TEST_CHECK(pool->closing && pool->nframes == 0);
+    TEST_CHECK(mbus_frame_pool_acquire(pool, MBUS_FRAME_TYPE_SHORT) == NULL);
+    mbus_frame_free(a);
+}
+
+static void
+test_data(void)
+{
+    mbus_frame_pool *pool;
+    mbus_frame_data *data;
+    mbus_frame frame;
+
+    if ((pool = mbus_frame_pool_new(1)) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    // the records of pooled data are freed when it goes back
+    TEST_CHECK(test_parse_frame("abb_f95.hex", &frame, NULL) == 0);
+    TEST_CHECK((data = mbus_frame_pool_acquire_data(pool)) != NULL);
+
+    if (data)
+    {
+        TEST_CHECK(data->pool == pool);
+        TEST_CHECK(mbus_frame_data_parse(&frame, data) == 0 && data->data_var.record != NULL);
+        mbus_frame_data_free(data);
+        TEST_CHECK(pool->ndata == 1 && pool->outstanding == 0);
+    }
+
+    TEST_CHECK((data = mbus_frame_pool_acquire_data(pool)) != NULL);
+
+    if (data)
+    {
+        TEST_CHECK(pool->ndata == 0 && data->data_var.record == NULL && data->pool == pool);
+        mbus_frame_data_free(data);
+    }
+
+    mbus_frame_pool_free(pool);
+}
+
+static void
+test_handle(void)
+{
+    mbus_handle *handle;
+    mbus_frame reply, *frame;
+
+    if ((handle = test_segment()) == NULL || mbus_connect(handle) != 0)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(handle);
+        return;
+    }
+
+    // heap frames without a pool
+    TEST_CHECK((frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_SHORT)) != NULL);
+    TEST_CHECK(frame == NULL || frame->pool == NULL);
+    mbus_frame_free(frame);
+
+    TEST_CHECK(mbus_context_set_option(handle, MBUS_OPTION_FRAME_POOL, 4) == 0);
+    TEST_CHECK(handle->frame_pool != NULL && handle->frame_pool->max_free == 4);
+
+    // the second telegram of slave 1 comes from the pool
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(handle, 1, &reply, 2) == 0);
+    TEST_CHECK((frame = (mbus_frame *) reply.next) != NULL);
+
+    if (frame && handle->frame_pool)
+    {
+        TEST_CHECK(frame->pool == handle->frame_pool);
+        TEST_CHECK(handle->frame_pool->outstanding == 1);
+        mbus_frame_free(frame);
+        TEST_CHECK(handle->frame_pool->outstanding == 0);
+    }
+
+    // a frame still out when the pool is replaced goes back to the heap
+    TEST_CHECK((frame = mbus_handle_frame_new(handle, MBUS_FRAME_TYPE_SHORT)) != NULL);
+    TEST_CHECK(mbus_context_set_option(handle, MBUS_OPTION_FRAME_POOL, 0) == 0);
+    TEST_CHECK(handle->frame_pool == NULL);
+    mbus_frame_free(frame);
+
+    mbus_disconnect(handle);
+    mbus_context_free(handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_frames();
+    test_data();
+    test_handle();
+
+    return test_exit();
+}
@@ -0,0 +1,112 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Primary address scan with a presence cache: slaves appear, are probed
+// again, and disappear
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+static int test_found;
+
+static void
+test_found_event(mbus_handle *handle, mbus_frame *frame)
+{
+    (void) handle;
+    (void) frame;
+
+    test_found++;
+}
+
+static int
+test_changed(mbus_presence_cache *cache)
+{
+    int address, changed = 0;
+
+    for (address = 0; address <= MBUS_MAX_PRIMARY_SLAVES; address++)
+        changed += cache->entry[address].changed;
+
+    return changed;
+}
+
+static unsigned long
+test_scan(mbus_handle *handle, mbus_presence_cache *cache, int expected)
+{
+    TEST_CHECK(mbus_connect(handle) == 0);
+    TEST_CHECK(mbus_scan_primary_cached(handle, cache) == expected);
+    mbus_disconnect(handle);
+
+    return ((mbus_sim_data *) handle->auxdata)->requests;
+}
+
+static void
+test_presence(void)
+{
+    mbus_presence_cache cache;
+    mbus_handle *handle;
+    char secondary[17];
+
+    if ((handle = test_segment()) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    mbus_context_set_option(handle, MBUS_OPTION_RESPONSE_TIMEOUT, 2000);
+    mbus_context_set_option(handle, MBUS_OPTION_MAX_SEARCH_RETRY, 0);
+    mbus_register_found_event(handle, test_found_event);
+
+    TEST_CHECK(mbus_scan_primary_cached(NULL, &cache) == -1);
+
+    mbus_presence_cache_init(&cache);
+    cache.absent_interval = 3600;
+    cache.read_secondary = 1;
+
+    // every address is probed, the new slaves are reported with their secondary address
+    test_found = 0;
+    TEST_CHECK(test_scan(handle, &cache, 3) == MBUS_MAX_PRIMARY_SLAVES + 1 + 3);
+    TEST_CHECK(test_changed(&cache) == 3 && test_found == 3);
+    TEST_CHECK(cache.entry[1].present && cache.entry[2].present && cache.entry[3].present);
+    TEST_CHECK(!cache.entry[4].present && cache.entry[4].last_probed != 0);
+
+    test_secondary("abb_f95.hex", 10000002, secondary, sizeof(secondary));
+    TEST_CHECK(strcmp(cache.entry[2].secondary, secondary) == 0);
+
+    // only the known slaves are probed while the absent ones are not due,
+    // nothing changed
+    test_found = 0;
+    TEST_CHECK(test_scan(handle, &cache, 3) == 3);
+    TEST_CHECK(test_changed(&cache) == 0 && test_found == 0);
+
+    // probe every address again, the slaves that are gone are flagged, also
+    // within the same second as the last scan
+    cache.absent_interval = 0;
+    mbus_sim_set_drop_rate(handle, 1.0, 1);
+
+    TEST_CHECK(test_scan(handle, &cache, 0) == MBUS_MAX_PRIMARY_SLAVES + 1);
+    TEST_CHECK(test_changed(&cache) == 3);
+    TEST_CHECK(cache.entry[1].changed && !cache.entry[1].present);
+
+    mbus_context_free(handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_presence();
+
+    return test_exit();
+}
@@ -0,0 +1,112 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Multi-telegram readout, blocking and streamed through a frame ring. The
+// simulator only moves on to the second telegram when the FCB is toggled,
+// and starts over after the last one.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+typedef struct _test_stream {
+    size_t telegrams;
+    size_t stop_after;           /**< telegrams until the event stops the readout, 0 for none */
+} test_stream;
+
+static int
+test_stream_event(mbus_handle *handle, mbus_frame *frame, size_t index, void *userdata)
+{
+    test_stream *stream = (test_stream *) userdata;
+
+    (void) handle;
+
+    TEST_CHECK(frame != NULL);
+    TEST_CHECK(index == stream->telegrams);
+    stream->telegrams++;
+
+    return (stream->stop_after && stream->telegrams == stream->stop_after) ? 1 : 0;
+}
+
+static void
+test_readout(void)
+{
+    mbus_handle *handle;
+    mbus_frame reply, *second;
+    mbus_frame_ring *ring;
+    test_stream stream;
+
+    if ((handle = test_segment()) == NULL || mbus_connect(handle) != 0)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(handle);
+        return;
+    }
+
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(handle, 1, &reply, 2) == 0);
+    TEST_CHECK(reply.next != NULL);
+
+    if ((second = (mbus_frame *) reply.next) != NULL)
+    {
+        TEST_CHECK(second->next == NULL);
+        TEST_CHECK(!test_same_frame(&reply, second));
+        mbus_frame_free(second);
+    }
+
+    TEST_CHECK(mbus_frame_ring_new(1) == NULL);
+    TEST_CHECK((ring = mbus_frame_ring_new(2)) != NULL);
+
+    if (ring)
+    {
+        memset(&stream, 0, sizeof(stream));
+        TEST_CHECK(mbus_sendrecv_request_stream(handle, 1, ring, 0, test_stream_event, &stream) == 0);
+        TEST_CHECK(ring->count == 2);
+        TEST_CHECK(stream.telegrams == 2);
+        TEST_CHECK(mbus_frame_ring_get(ring, 0) != NULL &&
+                   test_same_frame(mbus_frame_ring_get(ring, 0), &reply));
+        TEST_CHECK(mbus_frame_ring_get(ring, 2) == NULL);
+
+        // the event ends the readout after the first telegram
+        memset(&stream, 0, sizeof(stream));
+        stream.stop_after = 1;
+        TEST_CHECK(mbus_sendrecv_request_stream(handle, 1, ring, 0, test_stream_event, &stream) == 0);
+        TEST_CHECK(ring->count == 1 && stream.telegrams == 1);
+
+        // limited to one telegram
+        TEST_CHECK(mbus_sendrecv_request_stream(handle, 1, ring, 1, NULL, NULL) == 0);
+        TEST_CHECK(ring->count == 1);
+
+        // a single telegram
+        TEST_CHECK(mbus_sendrecv_request_stream(handle, 3, ring, 0, NULL, NULL) == 0);
+        TEST_CHECK(ring->count == 1);
+
+        // nobody there
+        TEST_CHECK(mbus_sendrecv_request_stream(handle, 9, ring, 0, NULL, NULL) != 0);
+
+        mbus_frame_ring_free(ring);
+    }
+
+    mbus_disconnect(handle);
+    mbus_context_free(handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_readout();
+
+    return test_exit();
+}
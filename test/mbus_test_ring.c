@@ -0,0 +1,132 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Shared memory ring: rows of abb_f95 published and read back, a reader that
+// is lapped, and a publisher that restarts
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mbus_test.h"
+
+#define TEST_RING_PATH "mbus_test_ring.shm"
+
+static void
+test_ring(void)
+{
+    mbus_ring *ring, *reader;
+    mbus_frame frame;
+    mbus_frame_data data;
+    mbus_data_record *record;
+    mbus_bin_record row, expected;
+    int i, rows, record_cnt;
+    FILE *fp;
+
+    TEST_CHECK(mbus_ring_create(TEST_RING_PATH, 0) == NULL);
+    TEST_CHECK(mbus_ring_create(NULL, 8) == NULL);
+
+    if (sizeof(size_t) > 4)
+        TEST_CHECK(mbus_ring_create(TEST_RING_PATH, (size_t) (((uint64_t) 1 << 32) + 1)) == NULL);
+
+    unlink(TEST_RING_PATH);
+
+    // rounded up to a power of two
+    if ((ring = mbus_ring_create(TEST_RING_PATH, 13)) == NULL ||
+        (reader = mbus_ring_open(TEST_RING_PATH)) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    TEST_CHECK(ring->capacity == 16 && reader->capacity == 16);
+    TEST_CHECK(mbus_ring_read(reader, &row) == 0);
+    TEST_CHECK(mbus_ring_publish(reader, &row) == -1);
+
+    // every row as encoded from the records
+    TEST_CHECK(test_parse_frame("abb_f95.hex", &frame, &data) == 0);
+    TEST_CHECK((rows = mbus_ring_publish_frame_data(ring, &data)) > 2 && rows <= 16);
+    TEST_CHECK(mbus_ring_head(ring) == (uint64_t) rows);
+
+    for (record = data.data_var.record, i = 0, record_cnt = 0; record; record = record->next, record_cnt++)
+    {
+        if (mbus_bin_record_variable(&expected, &(data.data_var.header), record, record_cnt) != 0)
+            continue;
+
+        TEST_CHECK(mbus_ring_read(reader, &row) == 1);
+        TEST_CHECK(memcmp(&row, &expected, sizeof(row)) == 0);
+        i++;
+    }
+
+    TEST_CHECK(i == rows);
+    TEST_CHECK(mbus_ring_read(reader, &row) == 0 && reader->lost == 0);
+
+    // the publisher laps the reader, the oldest rows still in the ring are read
+    for (i = 0; i < 40; i++)
+    {
+        memset(&expected, 0, sizeof(expected));
+        expected.record = i;
+        TEST_CHECK(mbus_ring_publish(ring, &expected) == 0);
+    }
+
+    for (i = 24; i < 40; i++)
+        TEST_CHECK(mbus_ring_read(reader, &row) == 1 && row.record == i);
+
+    TEST_CHECK(mbus_ring_read(reader, &row) == 0 && reader->lost == 24);
+
+    // a restarted publisher continues the ring of the same capacity
+    mbus_ring_close(ring);
+    TEST_CHECK((ring = mbus_ring_create(TEST_RING_PATH, 16)) != NULL);
+
+    if (ring)
+    {
+        TEST_CHECK(mbus_ring_head(ring) == (uint64_t) rows + 40);
+        expected.record = 42;
+        TEST_CHECK(mbus_ring_publish(ring, &expected) == 0);
+        TEST_CHECK(mbus_ring_read(reader, &row) == 1 && row.record == 42);
+        mbus_ring_close(ring);
+    }
+
+    mbus_ring_close(reader);
+
+    // other capacities start over
+    TEST_CHECK((ring = mbus_ring_create(TEST_RING_PATH, 32)) != NULL);
+
+    if (ring)
+    {
+        TEST_CHECK(mbus_ring_head(ring) == 0);
+        mbus_ring_close(ring);
+    }
+
+    // not a ring
+    if ((fp = fopen(TEST_RING_PATH, "w")) != NULL)
+    {
+        fprintf(fp, "%0256d", 0);
+        fclose(fp);
+    }
+
+    TEST_CHECK(mbus_ring_open(TEST_RING_PATH) == NULL);
+    TEST_CHECK(mbus_ring_open("mbus_test_ring.none") == NULL);
+
+    mbus_data_record_free(data.data_var.record);
+    unlink(TEST_RING_PATH);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_ring();
+
+    return test_exit();
+}
@@ -0,0 +1,204 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Simulated slave transport: replies, selection by secondary address,
+// collisions, lost replies, bus timing and the counters of the simulator.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mbus_test.h"
+
+static long long
+test_clock_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+//------------------------------------------------------------------------------
+// The slaves answer with their telegrams, the secondary address is patched in
+//------------------------------------------------------------------------------
+static void
+test_reply(void)
+{
+    mbus_handle *handle;
+    mbus_sim_data *sim;
+    mbus_frame reply, expected;
+    char secondary[17], addr[17];
+
+    if ((handle = test_segment()) == NULL || mbus_connect(handle) != 0)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(handle);
+        return;
+    }
+
+    sim = (mbus_sim_data *) handle->auxdata;
+
+    TEST_CHECK(test_parse_frame("kamstrup_multical_601.hex", &expected, NULL) == 0);
+
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(handle, 3, &reply, 0) == 0);
+    TEST_CHECK(reply.data_size == expected.data_size);
+    TEST_CHECK(memcmp(reply.data + 8, expected.data + 8, expected.data_size - 8) == 0);
+
+    // the secondary address given to mbus_sim_add_slave
+    test_secondary("kamstrup_multical_601.hex", 10000003, secondary, sizeof(secondary));
+    TEST_CHECK(mbus_frame_get_secondary_address_r(&reply, addr, sizeof(addr)) != NULL &&
+               strcmp(addr, secondary) == 0);
+
+    // selection by secondary address
+    TEST_CHECK(mbus_select_secondary_address(handle, secondary) == MBUS_PROBE_SINGLE);
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(handle, MBUS_ADDRESS_NETWORK_LAYER, &reply, 0) == 0);
+    TEST_CHECK(mbus_frame_get_secondary_address_r(&reply, addr, sizeof(addr)) != NULL &&
+               strcmp(addr, secondary) == 0);
+
+    // the configuration is fixed while connected
+    TEST_CHECK(mbus_sim_add_slave(handle, 4, NULL) == -1);
+    TEST_CHECK(mbus_sim_set_timing(handle, 2400, 0, 0) == -1);
+
+    mbus_disconnect(handle);
+
+    TEST_CHECK(sim->requests == 3);
+    TEST_CHECK(sim->replies == 3);
+    TEST_CHECK(sim->drops == 0 && sim->collisions == 0);
+
+    mbus_context_free(handle);
+}
+
+//------------------------------------------------------------------------------
+// Invalid configuration
+//------------------------------------------------------------------------------
+static void
+test_config(void)
+{
+    mbus_handle *handle;
+    int slave;
+
+    if ((handle = mbus_context_sim()) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    TEST_CHECK(mbus_sim_add_slave(handle, MBUS_MAX_PRIMARY_SLAVES + 1, NULL) == -1);
+    TEST_CHECK(mbus_sim_add_slave(handle, 1, "12345") == -1);
+    TEST_CHECK((slave = mbus_sim_add_slave(handle, 1, NULL)) == 0);
+    TEST_CHECK(mbus_sim_add_telegram_file(handle, slave, test_frame_path("does_not_exist.hex")) == -1);
+    TEST_CHECK(mbus_sim_add_telegram(handle, slave + 1, (const unsigned char *) "\x68", 1) == -1);
+    TEST_CHECK(mbus_sim_set_drop_rate(handle, 1.5, 0) == -1);
+    TEST_CHECK(mbus_sim_set_slave_baudrate(handle, slave + 1, 0, 9600) == -1);
+
+    mbus_context_free(handle);
+}
+
+//------------------------------------------------------------------------------
+// Two slaves at the same primary address garble the reply, a drop rate of one
+// silences all slaves
+//------------------------------------------------------------------------------
+static void
+test_collision(void)
+{
+    mbus_handle *handle;
+    mbus_sim_data *sim;
+    mbus_frame reply;
+    int slave;
+
+    if ((handle = test_segment()) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    sim = (mbus_sim_data *) handle->auxdata;
+    mbus_context_set_option(handle, MBUS_OPTION_MAX_DATA_RETRY, 0);
+
+    TEST_CHECK((slave = mbus_sim_add_slave(handle, 3, NULL)) != -1);
+    TEST_CHECK(mbus_sim_add_telegram_file(handle, slave, test_frame_path("abb_f95.hex")) == 0);
+
+    TEST_CHECK(mbus_connect(handle) == 0);
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(handle, 3, &reply, 0) != 0);
+    mbus_disconnect(handle);
+
+    TEST_CHECK(sim->collisions == 1);
+    TEST_CHECK(sim->replies == 1);
+
+    mbus_sim_set_drop_rate(handle, 1.0, 1);
+
+    TEST_CHECK(mbus_connect(handle) == 0);
+    memset(&reply, 0, sizeof(reply));
+    TEST_CHECK(mbus_sendrecv_request(handle, 2, &reply, 0) != 0);
+    mbus_disconnect(handle);
+
+    TEST_CHECK(sim->requests == 1);
+    TEST_CHECK(sim->replies == 0 && sim->drops == 1);
+
+    mbus_context_free(handle);
+}
+
+//------------------------------------------------------------------------------
+// At 2400 baud the reply takes its time on the bus: 11 bits per character
+//------------------------------------------------------------------------------
+static void
+test_timing(void)
+{
+    unsigned char buff[MBUS_FRAME_PARSER_BUFF_SIZE];
+    mbus_handle *handle;
+    mbus_frame reply;
+    long long start, elapsed, wire_us;
+    int size;
+
+    if ((handle = test_segment()) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    mbus_context_set_option(handle, MBUS_OPTION_RESPONSE_TIMEOUT, 500000);
+    TEST_CHECK(mbus_sim_set_timing(handle, 2400, 20000, 0) == 0);
+    TEST_CHECK(mbus_sim_get_timeout_us(handle) > 20000 + 330 * 1000000L / 2400);
+
+    TEST_CHECK(mbus_connect(handle) == 0);
+
+    memset(&reply, 0, sizeof(reply));
+    start = test_clock_us();
+    TEST_CHECK(mbus_sendrecv_request(handle, 2, &reply, 0) == 0);
+    elapsed = test_clock_us() - start;
+
+    // request (5 bytes), turnaround and reply
+    TEST_CHECK((size = mbus_frame_pack(&reply, buff, sizeof(buff))) > 0);
+    wire_us = (long long) (5 + size) * 11 * 1000000LL / 2400 + 20000;
+    TEST_CHECK(elapsed >= wire_us * 9 / 10);
+
+    mbus_disconnect(handle);
+    mbus_context_free(handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_reply();
+    test_config();
+    test_collision();
+    test_timing();
+
+    return test_exit();
+}
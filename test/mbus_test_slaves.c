@@ -0,0 +1,163 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Slave state table: primary and secondary keys across a resize, and the FCB
+// of each handle, continued over readouts, reset by SND_NKE and kept apart
+// for the slave selected by its secondary address
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+static unsigned char test_control;
+
+static void
+test_send_event(unsigned char src_type, const char *buff, size_t len)
+{
+    // the control field of short frames
+    if (len == MBUS_FRAME_BASE_SIZE_SHORT)
+        test_control = (unsigned char) buff[1];
+}
+
+static void
+test_table(void)
+{
+    mbus_slave_table table;
+    mbus_slave_data *data;
+    uint64_t key;
+    int ok = 1;
+
+    mbus_slave_table_init(&table);
+
+    TEST_CHECK(mbus_slave_table_get(&table, MBUS_SLAVE_KEY_PRIMARY, 5, 0) == NULL);
+    TEST_CHECK(mbus_slave_table_get(&table, 0, 5, 1) == NULL);
+
+    // every entry keeps its state while the table grows
+    for (key = 0; key < 1000; key++)
+    {
+        if ((data = mbus_slave_table_get(&table, MBUS_SLAVE_KEY_PRIMARY, key, 1)) == NULL ||
+            data->state_fcb != 1 || data->state_acd != 0)
+            ok = 0;
+        else
+            data->state_acd = (int) key;
+
+        if ((data = mbus_slave_table_get(&table, MBUS_SLAVE_KEY_SECONDARY, key << 32, 1)) == NULL)
+            ok = 0;
+        else
+            data->state_acd = (int) key + 1000;
+    }
+
+    TEST_CHECK(ok && table.count == 2000);
+    TEST_CHECK(table.size > 2000 && (table.size & (table.size - 1)) == 0);
+
+    for (key = 0, ok = 1; key < 1000; key++)
+    {
+        data = mbus_slave_table_get(&table, MBUS_SLAVE_KEY_PRIMARY, key, 0);
+        ok = ok && data && data->state_acd == (int) key;
+        data = mbus_slave_table_get(&table, MBUS_SLAVE_KEY_SECONDARY, key << 32, 0);
+        ok = ok && data && data->state_acd == (int) key + 1000;
+    }
+
+    TEST_CHECK(ok);
+    TEST_CHECK(mbus_slave_table_get(&table, MBUS_SLAVE_KEY_SECONDARY, 5, 0) == NULL);
+
+    // a reset keeps the entries, in their initial state
+    mbus_slave_table_reset(&table);
+    TEST_CHECK(table.count == 2000);
+    TEST_CHECK((data = mbus_slave_table_get(&table, MBUS_SLAVE_KEY_PRIMARY, 7, 0)) != NULL &&
+               data->state_fcb == 1 && data->state_acd == 0);
+
+    mbus_slave_table_free(&table);
+    TEST_CHECK(table.entries == NULL && table.size == 0 && table.count == 0);
+}
+
+static int
+test_request(mbus_handle *handle, int address)
+{
+    mbus_frame reply;
+
+    memset(&reply, 0, sizeof(reply));
+    test_control = 0;
+
+    if (mbus_sendrecv_request(handle, address, &reply, 0) != 0)
+        return -1;
+
+    return (test_control & MBUS_CONTROL_MASK_FCB) ? 1 : 0;
+}
+
+static void
+test_fcb(void)
+{
+    mbus_handle *handle, *other;
+    char secondary[17];
+
+    handle = test_segment();
+    other = test_segment();
+
+    if (handle == NULL || other == NULL || mbus_connect(handle) != 0 || mbus_connect(other) != 0)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(handle);
+        mbus_context_free(other);
+        return;
+    }
+
+    mbus_register_send_event(handle, test_send_event);
+    mbus_register_send_event(other, test_send_event);
+
+    // toggled with every readout, on this handle only
+    TEST_CHECK(test_request(handle, 2) == 1);
+    TEST_CHECK(test_request(handle, 2) == 0);
+    TEST_CHECK(test_request(handle, 2) == 1);
+    TEST_CHECK(test_request(handle, 3) == 1);
+    TEST_CHECK(test_request(other, 2) == 1);
+
+    // SND_NKE resets the slave
+    TEST_CHECK(mbus_send_ping_frame(handle, 2, 1) == 0);
+    TEST_CHECK(test_request(handle, 2) == 1);
+    TEST_CHECK(test_request(handle, 3) == 0);
+
+    // the selected slave has a state of its own
+    TEST_CHECK(mbus_handle_slave_data(handle, MBUS_ADDRESS_NETWORK_LAYER) == NULL);
+    TEST_CHECK(test_secondary("abb_f95.hex", 10000002, secondary, sizeof(secondary)) == 0);
+    TEST_CHECK(mbus_select_secondary_address(handle, secondary) == MBUS_PROBE_SINGLE);
+    TEST_CHECK(test_request(handle, MBUS_ADDRESS_NETWORK_LAYER) == 1);
+    TEST_CHECK(test_request(handle, MBUS_ADDRESS_NETWORK_LAYER) == 0);
+    TEST_CHECK(test_request(handle, 2) == 0);
+
+    // and is deselected by SND_NKE to the network layer
+    TEST_CHECK(mbus_send_ping_frame(handle, MBUS_ADDRESS_NETWORK_LAYER, 1) == 0);
+    TEST_CHECK(mbus_handle_slave_data(handle, MBUS_ADDRESS_NETWORK_LAYER) == NULL);
+
+    // a broadcast resets every slave
+    TEST_CHECK(mbus_send_ping_frame(handle, MBUS_ADDRESS_BROADCAST_NOREPLY, 0) == 0);
+    TEST_CHECK(test_request(handle, 2) == 1);
+    TEST_CHECK(test_request(handle, 3) == 1);
+    TEST_CHECK(test_request(other, 2) == 0);
+
+    mbus_disconnect(handle);
+    mbus_disconnect(other);
+    mbus_context_free(handle);
+    mbus_context_free(other);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_table();
+    test_fcb();
+
+    return test_exit();
+}
@@ -0,0 +1,170 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Traffic counters: frames, replies and timeouts by address, events, and
+// snapshots taken by another thread while the counters are switched off
+// and on
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mbus_test.h"
+
+static int
+test_request(mbus_handle *handle, int address)
+{
+    mbus_frame reply;
+
+    memset(&reply, 0, sizeof(reply));
+
+    return mbus_sendrecv_request(handle, address, &reply, 0);
+}
+
+static void
+test_counters(void)
+{
+    mbus_handle *handle;
+    mbus_stats stats;
+    uint64_t sent;
+    int i;
+
+    if ((handle = test_segment()) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    mbus_context_set_option(handle, MBUS_OPTION_MAX_DATA_RETRY, 0);
+
+    // not enabled yet
+    TEST_CHECK(mbus_stats_snapshot(handle, &stats) == -1);
+    TEST_CHECK(mbus_context_set_option(handle, MBUS_OPTION_STATS, 1) == 0);
+    TEST_CHECK(mbus_connect(handle) == 0);
+
+    TEST_CHECK(test_request(handle, 2) == 0);
+    TEST_CHECK(test_request(handle, 3) == 0);
+    TEST_CHECK(test_request(handle, 9) != 0);
+    mbus_stats_event(handle, MBUS_STATS_EVENT_COLLISION);
+    mbus_stats_event(handle, MBUS_STATS_EVENT_RETRY);
+
+    TEST_CHECK(mbus_stats_snapshot(handle, &stats) == 0);
+    TEST_CHECK(stats.frames_sent == 3 && stats.frames_received == 2);
+    TEST_CHECK(stats.bytes_sent == 3 * 5 && stats.bytes_received > 0);
+    TEST_CHECK(stats.timeouts == 1 && stats.invalid == 0 && stats.errors == 0);
+    TEST_CHECK(stats.collisions == 1 && stats.retries == 1);
+    TEST_CHECK(stats.address[2].requests == 1 && stats.address[2].replies == 1);
+    TEST_CHECK(stats.address[9].requests == 1 && stats.address[9].timeouts == 1);
+    TEST_CHECK(stats.latency.count == 2 && stats.address[3].latency.count == 1);
+    TEST_CHECK(stats.latency.max_us >= stats.address[3].latency.max_us);
+
+    for (sent = 0, i = 0; i < MBUS_STATS_BUCKETS; i++)
+        sent += stats.latency.bucket[i];
+
+    TEST_CHECK(sent == stats.latency.count);
+    TEST_CHECK(stats.elapsed_us >= 0);
+
+    // switched off, the counters stay allocated but are not updated
+    TEST_CHECK(mbus_context_set_option(handle, MBUS_OPTION_STATS, 0) == 0);
+    TEST_CHECK(handle->stats != NULL);
+    TEST_CHECK(test_request(handle, 2) == 0);
+    mbus_stats_event(handle, MBUS_STATS_EVENT_RETRY);
+    TEST_CHECK(mbus_stats_snapshot(handle, &stats) == -1);
+    TEST_CHECK(handle->stats->frames_sent == 3 && handle->stats->retries == 1);
+
+    // switched on again, they start over
+    TEST_CHECK(mbus_context_set_option(handle, MBUS_OPTION_STATS, 1) == 0);
+    TEST_CHECK(test_request(handle, 2) == 0);
+    TEST_CHECK(mbus_stats_snapshot(handle, &stats) == 0);
+    TEST_CHECK(stats.frames_sent == 1 && stats.address[9].requests == 0);
+
+    mbus_stats_reset(handle);
+    TEST_CHECK(mbus_stats_snapshot(handle, &stats) == 0 && stats.frames_sent == 0);
+
+    mbus_disconnect(handle);
+    mbus_context_free(handle);
+}
+
+//------------------------------------------------------------------------------
+// Snapshots from another thread while the handle switches the counters
+//------------------------------------------------------------------------------
+typedef struct _test_reader {
+    mbus_handle *handle;
+    int stop;
+    unsigned long snapshots;
+} test_reader;
+
+static void *
+test_reader_run(void *arg)
+{
+    test_reader *reader = (test_reader *) arg;
+    mbus_stats stats;
+
+    while (!__atomic_load_n(&(reader->stop), __ATOMIC_ACQUIRE))
+    {
+        if (mbus_stats_snapshot(reader->handle, &stats) == 0)
+            reader->snapshots++;
+    }
+
+    return NULL;
+}
+
+static void
+test_concurrent(void)
+{
+    test_reader reader;
+    pthread_t thread;
+    int i;
+
+    memset(&reader, 0, sizeof(reader));
+
+    if ((reader.handle = test_segment()) == NULL || mbus_connect(reader.handle) != 0)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(reader.handle);
+        return;
+    }
+
+    TEST_CHECK(mbus_context_set_option(reader.handle, MBUS_OPTION_STATS, 1) == 0);
+
+    if (pthread_create(&thread, NULL, test_reader_run, &reader) != 0)
+    {
+        TEST_CHECK(0);
+        mbus_context_free(reader.handle);
+        return;
+    }
+
+    for (i = 0; i < 20; i++)
+    {
+        TEST_CHECK(test_request(reader.handle, 2) == 0);
+        TEST_CHECK(mbus_context_set_option(reader.handle, MBUS_OPTION_STATS, i % 2) == 0);
+    }
+
+    __atomic_store_n(&(reader.stop), 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+
+    TEST_CHECK(reader.snapshots > 0);
+
+    mbus_disconnect(reader.handle);
+    mbus_context_free(reader.handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_counters();
+    test_concurrent();
+
+    return test_exit();
+}
@@ -0,0 +1,231 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// TCP connection pool against a gateway on the loopback interface: a
+// connection handed back on disconnect and reused by another handle, stale
+// data drained, connections closed by the gateway or with a partial frame
+// dropped, and the backoff after a refused connect
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "mbus_test.h"
+
+typedef struct _test_gateway {
+    int listen_fd;
+    uint16_t port;
+    unsigned char reply[512];
+    size_t reply_len;
+    mbus_frame frame;
+} test_gateway;
+
+static int
+test_gateway_open(test_gateway *gateway)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    memset(gateway, 0, sizeof(test_gateway));
+
+    if ((gateway->reply_len = test_load_frame("abb_f95.hex", gateway->reply, sizeof(gateway->reply))) == 0 ||
+        test_parse_frame("abb_f95.hex", &(gateway->frame), NULL) != 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((gateway->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    if (bind(gateway->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(gateway->listen_fd, 4) != 0 ||
+        getsockname(gateway->listen_fd, (struct sockaddr *) &addr, &addr_len) != 0)
+    {
+        close(gateway->listen_fd);
+        return -1;
+    }
+
+    gateway->port = ntohs(addr.sin_port);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Connection of a client, -1 if there is none within timeout_ms
+//------------------------------------------------------------------------------
+static int
+test_gateway_accept(test_gateway *gateway, int timeout_ms)
+{
+    struct pollfd pfd;
+
+    pfd.fd = gateway->listen_fd;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, timeout_ms) != 1)
+        return -1;
+
+    return accept(gateway->listen_fd, NULL, NULL);
+}
+
+//------------------------------------------------------------------------------
+// The client closed the connection within a second
+//------------------------------------------------------------------------------
+static int
+test_closed(int fd)
+{
+    unsigned char buff[16];
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    return poll(&pfd, 1, 1000) == 1 && read(fd, buff, sizeof(buff)) == 0;
+}
+
+static int
+test_reply(test_gateway *gateway, int fd, mbus_handle *handle, size_t extra)
+{
+    mbus_frame frame;
+    size_t len = gateway->reply_len + extra;
+
+    memset(&frame, 0, sizeof(frame));
+
+    // the second copy is cut short after extra bytes
+    memcpy(&(gateway->reply[gateway->reply_len]), gateway->reply, extra);
+
+    if (write(fd, gateway->reply, len) != (ssize_t) len ||
+        mbus_recv_frame(handle, &frame) != MBUS_RECV_RESULT_OK)
+        return 0;
+
+    return test_same_frame(&frame, &(gateway->frame));
+}
+
+static mbus_handle *
+test_handle(test_gateway *gateway, mbus_tcp_pool *pool)
+{
+    mbus_handle *handle;
+
+    if ((handle = mbus_context_tcp("127.0.0.1", gateway->port)) == NULL)
+        return NULL;
+
+    mbus_context_set_option(handle, MBUS_OPTION_RESPONSE_TIMEOUT, 100000);
+
+    if (pool && mbus_tcp_set_pool(handle, pool) != 0)
+    {
+        mbus_context_free(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+
+static void
+test_connections(test_gateway *gateway, mbus_tcp_pool *pool, mbus_handle *a, mbus_handle *b, mbus_handle *c)
+{
+    mbus_tcp_gateway *entry;
+    unsigned char request[8];
+    int fd, next_fd;
+
+    // a request and its reply
+    TEST_CHECK(mbus_connect(a) == 0);
+    TEST_CHECK((fd = test_gateway_accept(gateway, 1000)) >= 0);
+    TEST_CHECK(mbus_send_request_frame(a, 5) == 0);
+    TEST_CHECK(read(fd, request, sizeof(request)) == 5 && request[0] == MBUS_FRAME_SHORT_START && request[2] == 5);
+    TEST_CHECK(test_reply(gateway, fd, a, 0));
+
+    // handed back to the pool
+    TEST_CHECK(mbus_disconnect(a) == 0);
+    TEST_CHECK((entry = pool->gateways) != NULL && entry->nidle == 1);
+
+    // reused by the next handle, a late reply is drained
+    TEST_CHECK(write(fd, gateway->reply, 7) == 7);
+    usleep(10000);
+    TEST_CHECK(mbus_connect(b) == 0);
+    TEST_CHECK(test_gateway_accept(gateway, 0) == -1);
+    TEST_CHECK(entry == NULL || entry->nidle == 0);
+    TEST_CHECK(test_reply(gateway, fd, b, 0));
+
+    // closed by the gateway while idle, a new connection is made
+    TEST_CHECK(mbus_disconnect(b) == 0);
+    close(fd);
+    usleep(10000);
+    TEST_CHECK(mbus_connect(b) == 0);
+    TEST_CHECK((next_fd = test_gateway_accept(gateway, 1000)) >= 0);
+    fd = next_fd;
+
+    // a partial frame left in the parser, the connection is not pooled
+    TEST_CHECK(test_reply(gateway, fd, b, 3));
+    TEST_CHECK(mbus_disconnect(b) == 0);
+    TEST_CHECK(entry == NULL || entry->nidle == 0);
+    TEST_CHECK(test_closed(fd));
+    close(fd);
+
+    // refused, pooled gateways back off
+    close(gateway->listen_fd);
+    TEST_CHECK(mbus_connect(b) == -1);
+    TEST_CHECK(entry == NULL || entry->backoff_us == MBUS_TCP_BACKOFF_MIN);
+    TEST_CHECK(mbus_connect(a) == -1 && strstr(mbus_error_str(), "retrying") != NULL);
+
+    // others do not
+    TEST_CHECK(mbus_connect(c) == -1);
+    TEST_CHECK(mbus_connect(c) == -1 && strstr(mbus_error_str(), "retrying") == NULL);
+}
+
+static void
+test_pool(void)
+{
+    test_gateway gateway;
+    mbus_tcp_pool *pool;
+    mbus_handle *a, *b, *c;
+
+    if (test_gateway_open(&gateway) != 0 || (pool = mbus_tcp_pool_new()) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    a = test_handle(&gateway, pool);
+    b = test_handle(&gateway, pool);
+    c = test_handle(&gateway, NULL);
+
+    if (a && b && c)
+    {
+        test_connections(&gateway, pool, a, b, c);
+    }
+    else
+    {
+        TEST_CHECK(0);
+        close(gateway.listen_fd);
+    }
+
+    mbus_context_free(a);
+    mbus_context_free(b);
+    mbus_context_free(c);
+    mbus_tcp_pool_free(pool);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_pool();
+
+    return test_exit();
+}
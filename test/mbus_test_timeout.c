@@ -0,0 +1,115 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Adaptive response timeout on a segment of fast and slow slaves: the timeout
+// is learned per slave, and widened to the default after a timeout
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+#define TEST_SLOW_US 60000
+
+static int
+test_request(mbus_handle *handle, int address, int count)
+{
+    mbus_frame reply;
+    int failed = 0;
+
+    while (count-- > 0)
+    {
+        memset(&reply, 0, sizeof(reply));
+
+        if (mbus_sendrecv_request(handle, address, &reply, 0) != 0)
+            failed++;
+    }
+
+    return failed;
+}
+
+static void
+test_timeout(void)
+{
+    mbus_handle *handle;
+    mbus_slave_data *slave;
+
+    if ((handle = test_segment()) == NULL)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    mbus_context_set_option(handle, MBUS_OPTION_RESPONSE_TIMEOUT, 500000);
+    mbus_context_set_option(handle, MBUS_OPTION_MAX_DATA_RETRY, 0);
+    mbus_context_set_option(handle, MBUS_OPTION_ADAPTIVE_TIMEOUT, 1);
+
+    // slave 3 takes its time, slave 2 answers at once
+    TEST_CHECK(mbus_sim_set_slave_turnaround(handle, 2, TEST_SLOW_US) == 0);
+    TEST_CHECK(mbus_sim_set_slave_turnaround(handle, 3, 0) == -1);
+    TEST_CHECK(mbus_sim_set_slave_turnaround(handle, 0, -1) == -1);
+
+    TEST_CHECK(mbus_connect(handle) == 0);
+
+    // the timeout of slave 2 shrinks once it is learned
+    TEST_CHECK(test_request(handle, 2, MBUS_TIMEOUT_ADAPTIVE_SAMPLES) == 0);
+    TEST_CHECK((slave = mbus_handle_slave_data(handle, 2)) != NULL &&
+               slave->turnaround_samples == MBUS_TIMEOUT_ADAPTIVE_SAMPLES);
+    TEST_CHECK(mbus_handle_timeout_us(handle) < TEST_SLOW_US);
+
+    // slave 3 is not cut off by the timeout of slave 2, and learns its own
+    TEST_CHECK(test_request(handle, 3, MBUS_TIMEOUT_ADAPTIVE_SAMPLES) == 0);
+    TEST_CHECK((slave = mbus_handle_slave_data(handle, 3)) != NULL &&
+               slave->turnaround_us >= TEST_SLOW_US * 9 / 10);
+    TEST_CHECK(mbus_handle_timeout_us(handle) > 2 * TEST_SLOW_US * 9 / 10);
+    TEST_CHECK(mbus_handle_timeout_us(handle) < 500000);
+
+    // both keep their timeout
+    TEST_CHECK(test_request(handle, 2, 1) == 0);
+    TEST_CHECK(mbus_handle_timeout_us(handle) < TEST_SLOW_US);
+    TEST_CHECK(test_request(handle, 3, 1) == 0);
+
+    mbus_disconnect(handle);
+
+    // slave 2 got slow: its first request times out, the next one waits for
+    // the default timeout again
+    TEST_CHECK(mbus_sim_set_slave_turnaround(handle, 1, TEST_SLOW_US) == 0);
+    TEST_CHECK(mbus_connect(handle) == 0);
+
+    TEST_CHECK(test_request(handle, 2, 1) == 1);
+    TEST_CHECK((slave = mbus_handle_slave_data(handle, 2)) != NULL &&
+               slave->turnaround_samples == 0);
+    TEST_CHECK(mbus_handle_timeout_us(handle) == 500000);
+    TEST_CHECK(test_request(handle, 2, 1) == 0);
+
+    // slave 3 was not affected
+    TEST_CHECK((slave = mbus_handle_slave_data(handle, 3)) != NULL &&
+               slave->turnaround_samples == MBUS_TIMEOUT_ADAPTIVE_SAMPLES);
+
+    // setting the option again forgets what was learned
+    mbus_context_set_option(handle, MBUS_OPTION_ADAPTIVE_TIMEOUT, 1);
+    TEST_CHECK((slave = mbus_handle_slave_data(handle, 3)) != NULL &&
+               slave->turnaround_samples == 0);
+
+    mbus_disconnect(handle);
+    mbus_context_free(handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+    test_init(argc, argv);
+
+    test_timeout();
+
+    return test_exit();
+}
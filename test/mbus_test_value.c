@@ -0,0 +1,207 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Typed value accessor: every record of the test frames decodes to the same
+// value, normalized value and unit as the string based decoder, and dates
+// and raw data point at the record
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+
+#include "mbus_test.h"
+
+static int
+test_same_real(double a, double b)
+{
+    return a == b || fabs(a - b) <= 1e-9 * fabs(b);
+}
+
+static int
+test_record(mbus_data_record *data)
+{
+    mbus_typed_value value;
+    mbus_record *record;
+    double real = 0.0;
+    char *str = NULL;
+    int str_size = 0, ok = 1;
+
+    if (mbus_variable_value_decode(data, &real, &str, &str_size) != 0)
+        return mbus_data_record_typed_value(data, &value) != 0;
+
+    if (mbus_data_record_typed_value(data, &value) != 0)
+    {
+        free(str);
+        return 0;
+    }
+
+    switch (value.type)
+    {
+        case MBUS_VALUE_TYPE_INT:
+        case MBUS_VALUE_TYPE_BCD:
+            ok = (str == NULL && (double) value.value.int_val == real);
+            break;
+
+        case MBUS_VALUE_TYPE_REAL:
+            ok = (str == NULL && test_same_real(value.value.real_val, real));
+            break;
+
+        case MBUS_VALUE_TYPE_TIME:
+            ok = (str != NULL && (value.value.time_val.epoch == -1 || value.value.time_val.tm.tm_mday > 0));
+            break;
+
+        case MBUS_VALUE_TYPE_RAW:
+            ok = (value.value.raw.data >= data->data &&
+                  value.value.raw.data + value.value.raw.len <= data->data + data->data_len);
+            break;
+
+        case MBUS_VALUE_TYPE_NONE:
+            ok = (data->data_len == 0);
+            break;
+
+        default:
+            ok = 0;
+    }
+
+    free(str);
+
+    // the normalized value and unit of numerical records
+    if (ok && (value.type == MBUS_VALUE_TYPE_INT || value.type == MBUS_VALUE_TYPE_BCD ||
+               value.type == MBUS_VALUE_TYPE_REAL) &&
+        (data->drh.dib.dif & 0x0F) != 0x0F &&
+        (record = mbus_parse_variable_record(data)) != NULL)
+    {
+        ok = (record->is_numeric &&
+              test_same_real(mbus_typed_value_normalized(&value), record->value.real_val) &&
+              (value.unit == NULL || record->unit == NULL || strcmp(value.unit, record->unit) == 0));
+
+        mbus_record_free(record);
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "record dif 0x%.2x vif 0x%.2x type %d: differs\n",
+                data->drh.dib.dif, data->drh.vib.vif, value.type);
+    }
+
+    return ok;
+}
+
+static void
+test_frame(const char *name)
+{
+    mbus_frame frame;
+    mbus_frame_data data;
+    mbus_data_record *record;
+
+    if (test_parse_frame(name, &frame, &data) != 0)
+    {
+        TEST_CHECK(0);
+        return;
+    }
+
+    if (data.type != MBUS_DATA_TYPE_VARIABLE)
+        return;
+
+    for (record = data.data_var.record; record; record = record->next)
+    {
+        if (!test_record(record))
+        {
+            fprintf(stderr, "%s\n", name);
+            TEST_CHECK(0);
+        }
+    }
+
+    mbus_data_record_free(data.data_var.record);
+}
+
+//------------------------------------------------------------------------------
+// Records of known values
+//------------------------------------------------------------------------------
+static void
+test_values(void)
+{
+    mbus_data_record record;
+    mbus_typed_value value;
+
+    // 32 bit integer, energy in 10 Wh
+    memset(&record, 0, sizeof(record));
+    record.drh.dib.dif = 0x04;
+    record.drh.vib.vif = 0x04;
+    record.data[0] = 0xD2;
+    record.data[1] = 0x04;
+    record.data_len = 4;
+    TEST_CHECK(mbus_data_record_typed_value(&record, &value) == 0);
+    TEST_CHECK(value.type == MBUS_VALUE_TYPE_INT && value.value.int_val == 1234);
+    TEST_CHECK(test_same_real(mbus_typed_value_normalized(&value), 12340.0));
+    TEST_CHECK(value.unit != NULL && strcmp(value.unit, "Wh") == 0);
+
+    // 8 digit BCD, volume in litres
+    record.drh.dib.dif = 0x0C;
+    record.drh.vib.vif = 0x13;
+    record.data[0] = 0x78;
+    record.data[1] = 0x56;
+    record.data[2] = 0x34;
+    record.data[3] = 0x12;
+    TEST_CHECK(mbus_data_record_typed_value(&record, &value) == 0);
+    TEST_CHECK(value.type == MBUS_VALUE_TYPE_BCD && value.value.int_val == 12345678);
+    TEST_CHECK(test_same_real(mbus_typed_value_normalized(&value), 12345.678));
+
+    // date and time, type F: 2012-03-15 12:30
+    record.drh.dib.dif = 0x04;
+    record.drh.vib.vif = 0x6D;
+    record.data[0] = 30;
+    record.data[1] = 12;
+    record.data[2] = 0x0F | ((12 & 0x07) << 5);
+    record.data[3] = 0x03 | ((12 >> 3) << 4);
+    TEST_CHECK(mbus_data_record_typed_value(&record, &value) == 0);
+    TEST_CHECK(value.type == MBUS_VALUE_TYPE_TIME && value.value.time_val.has_time);
+    TEST_CHECK(value.value.time_val.tm.tm_year == 112 && value.value.time_val.tm.tm_mon == 2 &&
+               value.value.time_val.tm.tm_mday == 15 && value.value.time_val.tm.tm_hour == 12 &&
+               value.value.time_val.tm.tm_min == 30);
+    TEST_CHECK(isnan(mbus_typed_value_normalized(&value)));
+
+    TEST_CHECK(mbus_data_record_typed_value(NULL, &value) == -1);
+    TEST_CHECK(mbus_data_record_typed_value(&record, NULL) == -1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct dirent *entry;
+    DIR *dir;
+    size_t len;
+
+    test_init(argc, argv);
+
+    if ((dir = opendir(test_frame_path(""))) == NULL)
+    {
+        TEST_CHECK(0);
+        return test_exit();
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        len = strlen(entry->d_name);
+
+        if (len > 4 && strcmp(&(entry->d_name[len - 4]), ".hex") == 0)
+            test_frame(entry->d_name);
+    }
+
+    closedir(dir);
+
+    test_values();
+
+    return test_exit();
+}
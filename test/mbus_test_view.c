@@ -0,0 +1,156 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Frame view: the records walked in place match those of the parser, and
+// truncated or damaged telegrams are told apart by the return value
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbus_test.h"
+
+static const char *test_frames[] = {
+    "abb_f95.hex",
+    "eastron_sdm630.hex",
+    "kamstrup_multical_601.hex",
+    "EMU_EMU-Professional-375-M-Bus.hex",
+    "SEN_Sensus-PolluTherm.hex",
+};
+
+static int
+test_same_record(const mbus_data_record *a, const mbus_data_record *b)
+{
+    return a->drh.dib.dif == b->drh.dib.dif &&
+           a->drh.dib.ndife == b->drh.dib.ndife &&
+           memcmp(a->drh.dib.dife, b->drh.dib.dife, a->drh.dib.ndife) == 0 &&
+           a->drh.vib.vif == b->drh.vib.vif &&
+           a->drh.vib.nvife == b->drh.vib.nvife &&
+           memcmp(a->drh.vib.vife, b->drh.vib.vife, a->drh.vib.nvife) == 0 &&
+           strcmp((const char *) a->drh.vib.custom_vif, (const char *) b->drh.vib.custom_vif) == 0 &&
+           a->data_len == b->data_len &&
+           memcmp(a->data, b->data, a->data_len) == 0;
+}
+
+static void
+test_records(const char *name)
+{
+    unsigned char buff[4096];
+    mbus_frame_view view;
+    mbus_record_view record_view;
+    mbus_data_variable_header header;
+    mbus_data_record decoded, *record;
+    mbus_frame frame;
+    mbus_frame_data data;
+    size_t len, pos = 0;
+    int ret;
+
+    TEST_CHECK((len = test_load_frame(name, buff, sizeof(buff))) > 0);
+    TEST_CHECK(mbus_frame_view_init(&view, buff, len) == 0);
+    TEST_CHECK(view.type == MBUS_FRAME_TYPE_LONG && view.size == len);
+    TEST_CHECK(test_parse_frame(name, &frame, &data) == 0);
+
+    TEST_CHECK(mbus_frame_view_header(&view, &header) == 0);
+    TEST_CHECK(memcmp(header.id_bcd, data.data_var.header.id_bcd, 4) == 0 &&
+               header.access_no == data.data_var.header.access_no &&
+               header.medium == data.data_var.header.medium);
+
+    for (record = data.data_var.record; record; record = record->next)
+    {
+        if ((ret = mbus_frame_view_next_record(&view, &pos, &record_view)) != 1)
+            break;
+
+        TEST_CHECK(mbus_record_view_decode(&view, &record_view, &decoded) == 0);
+        TEST_CHECK(test_same_record(&decoded, record));
+    }
+
+    TEST_CHECK(record == NULL);
+    TEST_CHECK(mbus_frame_view_next_record(&view, &pos, &record_view) == 0);
+
+    // a view of the parsed frame walks the same records
+    TEST_CHECK(mbus_frame_view_of(&view, &frame) == 0);
+    TEST_CHECK(memcmp(view.data, &(buff[7]), view.data_size) == 0);
+    TEST_CHECK(mbus_frame_view_more_records_follow(&view) ==
+               (data.data_var.more_records_follow ? 1 : 0));
+
+    mbus_data_record_free(data.data_var.record);
+}
+
+static void
+test_damaged(void)
+{
+    unsigned char buff[4096];
+    mbus_frame_view view;
+    size_t len, i;
+
+    TEST_CHECK((len = test_load_frame("abb_f95.hex", buff, sizeof(buff))) > 0);
+
+    // every prefix asks for the bytes still missing
+    for (i = 1; i < len; i++)
+    {
+        if (mbus_frame_view_init(&view, buff, i) <= 0)
+        {
+            TEST_CHECK(0);
+            break;
+        }
+    }
+
+    // bytes after the telegram are not part of it
+    buff[len] = 0x10;
+    TEST_CHECK(mbus_frame_view_init(&view, buff, len + 1) == 0 && view.size == len);
+
+    buff[len - 2] ^= 0xFF;
+    TEST_CHECK(mbus_frame_view_init(&view, buff, len) < 0);
+    buff[len - 2] ^= 0xFF;
+
+    buff[len - 1] = 0x00;
+    TEST_CHECK(mbus_frame_view_init(&view, buff, len) < 0);
+    buff[len - 1] = MBUS_FRAME_STOP;
+
+    buff[2]++;
+    TEST_CHECK(mbus_frame_view_init(&view, buff, len) < 0);
+    buff[2]--;
+
+    buff[0] = 0x42;
+    TEST_CHECK(mbus_frame_view_init(&view, buff, len) < 0);
+
+    TEST_CHECK(mbus_frame_view_init(&view, buff, 0) == -1);
+    TEST_CHECK(mbus_frame_view_init(NULL, buff, len) == -1);
+
+    // short frames and single characters
+    buff[0] = MBUS_FRAME_SHORT_START;
+    buff[1] = MBUS_CONTROL_MASK_SND_NKE;
+    buff[2] = 0x05;
+    buff[3] = buff[1] + buff[2];
+    buff[4] = MBUS_FRAME_STOP;
+    TEST_CHECK(mbus_frame_view_init(&view, buff, 3) == 2);
+    TEST_CHECK(mbus_frame_view_init(&view, buff, 5) == 0);
+    TEST_CHECK(view.type == MBUS_FRAME_TYPE_SHORT && view.address == 0x05 && view.size == 5);
+    TEST_CHECK(mbus_frame_view_next_record(&view, &len, NULL) == -1);
+
+    buff[0] = MBUS_FRAME_ACK_START;
+    TEST_CHECK(mbus_frame_view_init(&view, buff, 1) == 0 && view.type == MBUS_FRAME_TYPE_ACK);
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t i;
+
+    test_init(argc, argv);
+
+    for (i = 0; i < sizeof(test_frames) / sizeof(test_frames[0]); i++)
+        test_records(test_frames[i]);
+
+    test_damaged();
+
+    return test_exit();
+}
@@ -0,0 +1,405 @@
+//------------------------------------------------------------------------------
+// Copyright (C) 2010, Raditex AB
+// All rights reserved.
+//
+// rSCADA
+// http://www.rSCADA.se
+// info@rscada.se
+//
+//------------------------------------------------------------------------------
+
+//
+// Streaming writer: the XML of every test frame matches the .xml and
+// .norm.xml files, whatever sink it is written to, and the JSON document of
+// every test frame is well formed UTF-8 with one element per data record
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "mbus_test.h"
+
+//------------------------------------------------------------------------------
+// Expected output, read from the test-frames directory
+//------------------------------------------------------------------------------
+static char *
+test_load_text(const char *name)
+{
+    char *text;
+    size_t len;
+    FILE *fp;
+
+    if ((fp = fopen(test_frame_path(name), "r")) == NULL)
+        return NULL;
+
+    if ((text = (char *) malloc(65536)) != NULL)
+    {
+        len = fread(text, 1, 65535, fp);
+        text[len] = '\0';
+    }
+
+    fclose(fp);
+
+    return text;
+}
+
+static int
+test_write(mbus_writer *writer, mbus_frame_data *data, int normalized)
+{
+    int result;
+
+    result = normalized ? mbus_frame_data_write_normalized(writer, data) : mbus_frame_data_write(writer, data);
+
+    return (result == 0) ? mbus_writer_flush(writer) : -1;
+}
+
+static char *
+test_document(mbus_frame_data *data, int format, int normalized)
+{
+    mbus_writer writer;
+
+    if (mbus_writer_init_buffer(&writer, format, 64) != 0)
+        return NULL;
+
+    if (test_write(&writer, data, normalized) != 0)
+    {
+        mbus_writer_free(&writer);
+        return NULL;
+    }
+
+    return mbus_writer_detach(&writer);
+}
+
+//------------------------------------------------------------------------------
+// Sink that compares the output with the expected document as it arrives
+//------------------------------------------------------------------------------
+typedef struct _test_sink {
+    const char *expected;
+    size_t pos;
+    int calls;
+    int fail;
+} test_sink;
+
+static int
+test_sink_write(mbus_writer *writer, const char *data, size_t data_len)
+{
+    test_sink *sink = (test_sink *) writer->userdata;
+
+    sink->calls++;
+
+    if (sink->fail || strncmp(&(sink->expected[sink->pos]), data, data_len) != 0)
+        return -1;
+
+    sink->pos += data_len;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// JSON syntax
+//------------------------------------------------------------------------------
+static int test_json_value(const char **p);
+
+static void
+test_json_space(const char **p)
+{
+    while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r')
+        (*p)++;
+}
+
+static int
+test_json_string(const char **p)
+{
+    const unsigned char *s = (const unsigned char *) *p;
+    int i, n;
+
+    if (*s++ != '"')
+        return -1;
+
+    while (*s != '"')
+    {
+        if (*s < 0x20)
+            return -1;
+
+        if (*s == '\\')
+        {
+            s++;
+
+            if (*s == 'u')
+            {
+                for (i = 1; i <= 4; i++)
+                {
+                    if (strchr("0123456789abcdefABCDEF", s[i]) == NULL || s[i] == '\0')
+                        return -1;
+                }
+
+                s += 4;
+            }
+            else if (strchr("\"\\/bfnrt", *s) == NULL || *s == '\0')
+            {
+                return -1;
+            }
+
+            s++;
+            continue;
+        }
+
+        // UTF-8 sequences of two and three bytes
+        n = (*s >= 0xE0 && *s < 0xF0) ? 2 : (*s >= 0xC2 && *s < 0xE0) ? 1 : (*s < 0x80) ? 0 : -1;
+
+        if (n < 0)
+            return -1;
+
+        for (i = 1; i <= n; i++)
+        {
+            if ((s[i] & 0xC0) != 0x80)
+                return -1;
+        }
+
+        s += n + 1;
+    }
+
+    *p = (const char *) s + 1;
+
+    return 0;
+}
+
+static int
+test_json_members(const char **p, char close, int named)
+{
+    test_json_space(p);
+
+    if (**p == close)
+    {
+        (*p)++;
+        return 0;
+    }
+
+    for (;;)
+    {
+        test_json_space(p);
+
+        if (named)
+        {
+            if (test_json_string(p) != 0)
+                return -1;
+
+            test_json_space(p);
+
+            if (*(*p)++ != ':')
+                return -1;
+        }
+
+        if (test_json_value(p) != 0)
+            return -1;
+
+        test_json_space(p);
+
+        if (**p == close)
+        {
+            (*p)++;
+            return 0;
+        }
+
+        if (*(*p)++ != ',')
+            return -1;
+    }
+}
+
+static int
+test_json_value(const char **p)
+{
+    char *end;
+
+    test_json_space(p);
+
+    switch (**p)
+    {
+        case '{':
+            (*p)++;
+            return test_json_members(p, '}', 1);
+
+        case '[':
+            (*p)++;
+            return test_json_members(p, ']', 0);
+
+        case '"':
+            return test_json_string(p);
+
+        case 't':
+            return (strncmp(*p, "true", 4) == 0) ? (*p += 4, 0) : -1;
+
+        case 'f':
+            return (strncmp(*p, "false", 5) == 0) ? (*p += 5, 0) : -1;
+
+        case 'n':
+            return (strncmp(*p, "null", 4) == 0) ? (*p += 4, 0) : -1;
+
+        default:
+            if (**p != '-' && (**p < '0' || **p > '9'))
+                return -1;
+
+            strtod(*p, &end);
+            *p = end;
+            return 0;
+    }
+}
+
+static int
+test_json(const char *text)
+{
+    if (test_json_value(&text) != 0)
+        return -1;
+
+    test_json_space(&text);
+
+    return (*text == '\0') ? 0 : -1;
+}
+
+//------------------------------------------------------------------------------
+// Elements of the DataRecord array
+//------------------------------------------------------------------------------
+static size_t
+test_json_records(const char *text)
+{
+    size_t n = 0;
+
+    while ((text = strstr(text, "{\"id\":")) != NULL)
+    {
+        n++;
+        text++;
+    }
+
+    return n;
+}
+
+static void
+test_xml(const char *name, mbus_frame_data *data, int normalized)
+{
+    char expected_name[256], *expected, *xml, *old;
+    mbus_writer writer;
+    test_sink sink;
+    size_t len;
+
+    len = strlen(name) - strlen(".hex");
+    snprintf(expected_name, sizeof(expected_name), "%.*s%s", (int) len, name,
+             normalized ? ".norm.xml" : ".xml");
+
+    if ((expected = test_load_text(expected_name)) == NULL)
+    {
+        fprintf(stderr, "%s: no %s\n", name, expected_name);
+        TEST_CHECK(0);
+        return;
+    }
+
+    // a growing buffer, and the char * API built on it
+    if ((xml = test_document(data, MBUS_WRITER_FORMAT_XML, normalized)) == NULL ||
+        strcmp(xml, expected) != 0)
+    {
+        fprintf(stderr, "%s: differs from %s\n", name, expected_name);
+        TEST_CHECK(0);
+    }
+
+    old = normalized ? mbus_frame_data_xml_normalized(data) : mbus_frame_data_xml(data);
+    TEST_CHECK(old != NULL && strcmp(old, expected) == 0);
+
+    // a sink, the output may be longer than the writer buffer
+    memset(&sink, 0, sizeof(sink));
+    sink.expected = expected;
+    mbus_writer_init(&writer, MBUS_WRITER_FORMAT_XML, test_sink_write, &sink);
+    TEST_CHECK(test_write(&writer, data, normalized) == 0);
+    TEST_CHECK(sink.pos == strlen(expected));
+    TEST_CHECK(sink.calls >= (int) ((sink.pos + MBUS_WRITER_BUFF_SIZE - 1) / MBUS_WRITER_BUFF_SIZE));
+
+    // a failing sink
+    memset(&sink, 0, sizeof(sink));
+    sink.expected = expected;
+    sink.fail = 1;
+    mbus_writer_init(&writer, MBUS_WRITER_FORMAT_XML, test_sink_write, &sink);
+    TEST_CHECK(test_write(&writer, data, normalized) != 0 && sink.calls > 0);
+
+    free(old);
+    free(xml);
+    free(expected);
+}
+
+static void
+test_frame(const char *name)
+{
+    mbus_frame frame;
+    mbus_frame_data data;
+    mbus_data_record *record;
+    size_t nrecords = 0;
+    char *json;
+    int normalized;
+
+    if (test_parse_frame(name, &frame, &data) != 0)
+    {
+        fprintf(stderr, "%s: failed to parse\n", name);
+        TEST_CHECK(0);
+        return;
+    }
+
+    if (data.type == MBUS_DATA_TYPE_VARIABLE)
+    {
+        for (record = data.data_var.record; record; record = record->next)
+            nrecords++;
+    }
+
+    for (normalized = 0; normalized <= 1; normalized++)
+    {
+        test_xml(name, &data, normalized);
+
+        if ((json = test_document(&data, MBUS_WRITER_FORMAT_JSON, normalized)) == NULL ||
+            test_json(json) != 0 ||
+            strncmp(json, "{\"MBusData\":{", 13) != 0)
+        {
+            fprintf(stderr, "%s: invalid JSON\n%s\n", name, json ? json : "");
+            TEST_CHECK(0);
+        }
+        else if (data.type == MBUS_DATA_TYPE_VARIABLE)
+        {
+            TEST_CHECK(test_json_records(json) == nrecords);
+        }
+
+        free(json);
+    }
+
+    mbus_data_record_free(data.data_var.record);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct dirent *entry;
+    DIR *dir;
+    size_t len;
+    int nframes = 0;
+
+    test_init(argc, argv);
+
+    if ((dir = opendir(test_frame_path(""))) == NULL)
+    {
+        TEST_CHECK(0);
+        return test_exit();
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        len = strlen(entry->d_name);
+
+        if (len > 4 && strcmp(&(entry->d_name[len - 4]), ".hex") == 0)
+        {
+            test_frame(entry->d_name);
+            nframes++;
+        }
+    }
+
+    closedir(dir);
+
+    TEST_CHECK(nframes > 0);
+
+    return test_exit();
+}